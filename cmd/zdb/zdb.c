@@ -41,6 +41,7 @@
 #include <sys/vdev.h>
 #include <sys/vdev_impl.h>
 #include <sys/metaslab_impl.h>
+#include <sys/spa_log_spacemap.h>
 #include <sys/dmu_objset.h>
 #include <sys/dsl_dir.h>
 #include <sys/dsl_dataset.h>
@@ -53,6 +54,7 @@
 #include <sys/dmu_traverse.h>
 #include <sys/zio_checksum.h>
 #include <sys/zio_compress.h>
+#include <sys/abd.h>
 #include <sys/zfs_fuid.h>
 #include <sys/arc.h>
 #include <sys/ddt.h>
@@ -122,8 +124,10 @@ usage(void)
 	    "vdev:offset:size[:flags]\n"
 	    "       %s -S [-PA] [-e [-p path...]] [-U config] poolname\n"
 	    "       %s -l [-uA] device\n"
+	    "       %s -z file...\n"
 	    "       %s -C [-A] [-U config]\n\n",
-	    cmdname, cmdname, cmdname, cmdname, cmdname, cmdname, cmdname);
+	    cmdname, cmdname, cmdname, cmdname, cmdname, cmdname, cmdname,
+	    cmdname);
 
 	(void) fprintf(stderr, "    Dataset name must include at least one "
 	    "separator character '/' or '@'\n");
@@ -149,7 +153,9 @@ usage(void)
 	(void) fprintf(stderr, "        -L disable leak tracking (do not "
 	    "load spacemaps)\n");
 	(void) fprintf(stderr, "        -R read and display block from a "
-	    "device\n\n");
+	    "device\n");
+	(void) fprintf(stderr, "        -z benchmark compression and "
+	    "checksum algorithms on files\n\n");
 	(void) fprintf(stderr, "    Below options are intended for use "
 	    "with other options (except -l):\n");
 	(void) fprintf(stderr, "        -A ignore assertions (-A), enable "
@@ -527,7 +533,7 @@ dump_spacemap(objset_t *os, space_map_obj_t *smo, space_map_t *sm)
 	uint8_t mapshift = sm->sm_shift;
 	uint64_t mapstart = sm->sm_start;
 	char *ddata[] = { "ALLOC", "FREE", "CONDENSE", "INVALID",
-			    "INVALID", "INVALID", "INVALID", "INVALID" };
+			    "VDEV", "METASLAB", "INVALID", "INVALID" };
 
 	if (smo->smo_object == 0)
 		return;
@@ -575,7 +581,7 @@ dump_metaslab_stats(metaslab_t *msp)
 	char maxbuf[32];
 	space_map_t *sm = msp->ms_map;
 	avl_tree_t *t = sm->sm_pp_root;
-	int free_pct = sm->sm_space * 100 / sm->sm_size;
+	int free_pct = sm->sm_rt.rt_space * 100 / sm->sm_size;
 
 	zdb_nicenum(space_map_maxsize(sm), maxbuf);
 
@@ -584,6 +590,25 @@ dump_metaslab_stats(metaslab_t *msp)
 	    "freepct", free_pct);
 }
 
+static void
+dump_metaslab_histogram(metaslab_t *msp)
+{
+	space_map_obj_t *smo = &msp->ms_smo;
+	int shift = msp->ms_map->sm_shift;
+	boolean_t first = B_TRUE;
+	int i;
+
+	for (i = 0; i < SPACE_MAP_HISTOGRAM_SIZE; i++) {
+		if (smo->smo_histogram[i] == 0)
+			continue;
+		(void) printf("\t %25s 2^%-2d%s %10llu\n",
+		    first ? "free segments" : "", i + shift,
+		    i == SPACE_MAP_HISTOGRAM_SIZE - 1 ? "+" : " ",
+		    (u_longlong_t)smo->smo_histogram[i]);
+		first = B_FALSE;
+	}
+}
+
 static void
 dump_metaslab(metaslab_t *msp)
 {
@@ -593,7 +618,7 @@ dump_metaslab(metaslab_t *msp)
 	space_map_obj_t *smo = &msp->ms_smo;
 	char freebuf[32];
 
-	zdb_nicenum(sm->sm_size - smo->smo_alloc, freebuf);
+	zdb_nicenum(sm->sm_size - msp->ms_allocated, freebuf);
 
 	(void) printf(
 	    "\tmetaslab %6llu   offset %12llx   spacemap %6llu   free    %5s\n",
@@ -603,14 +628,22 @@ dump_metaslab(metaslab_t *msp)
 	if (dump_opt['m'] > 1 && !dump_opt['L']) {
 		mutex_enter(&msp->ms_lock);
 		space_map_load_wait(sm);
-		if (!sm->sm_loaded)
+		if (!sm->sm_loaded) {
 			VERIFY(space_map_load(sm, zfs_metaslab_ops,
 			    SM_FREE, smo, spa->spa_meta_objset) == 0);
+			space_map_walk(msp->ms_unflushed_allocs,
+			    space_map_claim, sm);
+			space_map_walk(msp->ms_unflushed_frees,
+			    space_map_free, sm);
+		}
 		dump_metaslab_stats(msp);
 		space_map_unload(sm);
 		mutex_exit(&msp->ms_lock);
 	}
 
+	if (dump_opt['m'] > 1)
+		dump_metaslab_histogram(msp);
+
 	if (dump_opt['d'] > 5 || dump_opt['m'] > 2) {
 		ASSERT(sm->sm_size == (1ULL << vd->vdev_ms_shift));
 
@@ -632,6 +665,28 @@ print_vdev_metaslab_header(vdev_t *vd)
 	    "---------------", "-------------");
 }
 
+static void
+dump_log_spacemaps(spa_t *spa)
+{
+	spa_log_sm_t *sls;
+	char sizebuf[32];
+
+	if (!spa_log_sm_active(spa))
+		return;
+
+	zdb_nicenum(spa->spa_log_sm_size, sizebuf);
+	(void) printf("\nLog spacemaps: %llu metaslabs unflushed, %s\n",
+	    (u_longlong_t)avl_numnodes(&spa->spa_log_sm_unflushed), sizebuf);
+
+	for (sls = list_head(&spa->spa_log_sm_list); sls != NULL;
+	    sls = list_next(&spa->spa_log_sm_list, sls)) {
+		(void) printf("\ttxg %10llu   spacemap %6llu   size %10llu\n",
+		    (u_longlong_t)sls->sls_txg,
+		    (u_longlong_t)sls->sls_smo.smo_object,
+		    (u_longlong_t)sls->sls_smo.smo_objsize);
+	}
+}
+
 static void
 dump_metaslabs(spa_t *spa)
 {
@@ -845,7 +900,7 @@ dump_dtl(vdev_t *vd, int indent)
 
 	for (t = 0; t < DTL_TYPES; t++) {
 		space_map_t *sm = &vd->vdev_dtl[t];
-		if (sm->sm_space == 0)
+		if (sm->sm_rt.rt_space == 0)
 			continue;
 		(void) snprintf(prefix, sizeof (prefix), "\t%*s%s",
 		    indent + 2, "", name[t]);
@@ -865,7 +920,7 @@ static void
 dump_history(spa_t *spa)
 {
 	nvlist_t **events = NULL;
-	char buf[SPA_MAXBLOCKSIZE];
+	char buf[SPA_OLD_MAXBLOCKSIZE];
 	uint64_t resid, len, off = 0;
 	uint_t num = 0;
 	int error;
@@ -970,6 +1025,16 @@ sprintf_blkptr_compact(char *blkbuf, const blkptr_t *bp)
 
 	blkbuf[0] = '\0';
 
+	if (BP_IS_EMBEDDED(bp)) {
+		(void) sprintf(blkbuf,
+		    "EMBEDDED et=%u %llxL/%llxP B=%llu",
+		    (int)BPE_GET_ETYPE(bp),
+		    (u_longlong_t)BPE_GET_LSIZE(bp),
+		    (u_longlong_t)BPE_GET_PSIZE(bp),
+		    (u_longlong_t)bp->blk_birth);
+		return;
+	}
+
 	for (i = 0; i < ndvas; i++)
 		(void) sprintf(blkbuf + strlen(blkbuf), "%llu:%llx:%llx ",
 		    (u_longlong_t)DVA_GET_VDEV(&dva[i]),
@@ -980,7 +1045,7 @@ sprintf_blkptr_compact(char *blkbuf, const blkptr_t *bp)
 	    "%llxL/%llxP F=%llu B=%llu/%llu",
 	    (u_longlong_t)BP_GET_LSIZE(bp),
 	    (u_longlong_t)BP_GET_PSIZE(bp),
-	    (u_longlong_t)bp->blk_fill,
+	    (u_longlong_t)BP_GET_FILL(bp),
 	    (u_longlong_t)bp->blk_birth,
 	    (u_longlong_t)BP_PHYSICAL_BIRTH(bp));
 }
@@ -1047,10 +1112,10 @@ visit_indirect(spa_t *spa, const dnode_phys_t *dnp,
 			err = visit_indirect(spa, dnp, cbp, &czb);
 			if (err)
 				break;
-			fill += cbp->blk_fill;
+			fill += BP_GET_FILL(cbp);
 		}
 		if (!err)
-			ASSERT3U(fill, ==, bp->blk_fill);
+			ASSERT3U(fill, ==, BP_GET_FILL(bp));
 		(void) arc_buf_remove_ref(buf, &buf);
 	}
 
@@ -1598,15 +1663,15 @@ dump_object(objset_t *os, uint64_t object, int verbosity, int *print_header)
 	dnode_t *dn;
 	void *bonus = NULL;
 	size_t bsize = 0;
-	char iblk[32], dblk[32], lsize[32], asize[32], fill[32];
+	char iblk[32], dblk[32], lsize[32], asize[32], fill[32], dnsize[32];
 	char bonus_size[32];
 	char aux[50];
 	int error;
 
 	if (*print_header) {
-		(void) printf("\n%10s  %3s  %5s  %5s  %5s  %5s  %6s  %s\n",
-		    "Object", "lvl", "iblk", "dblk", "dsize", "lsize",
-		    "%full", "type");
+		(void) printf("\n%10s  %3s  %5s  %5s  %5s  %6s  %5s  %6s  %s\n",
+		    "Object", "lvl", "iblk", "dblk", "dsize", "dnsize",
+		    "lsize", "%full", "type");
 		*print_header = 0;
 	}
 
@@ -1628,6 +1693,7 @@ dump_object(objset_t *os, uint64_t object, int verbosity, int *print_header)
 	zdb_nicenum(doi.doi_max_offset, lsize);
 	zdb_nicenum(doi.doi_physical_blocks_512 << 9, asize);
 	zdb_nicenum(doi.doi_bonus_size, bonus_size);
+	zdb_nicenum(doi.doi_dnodesize, dnsize);
 	(void) sprintf(fill, "%6.2f", 100.0 * doi.doi_fill_count *
 	    doi.doi_data_block_size / (object == 0 ? DNODES_PER_BLOCK : 1) /
 	    doi.doi_max_offset);
@@ -1644,13 +1710,13 @@ dump_object(objset_t *os, uint64_t object, int verbosity, int *print_header)
 		    ZDB_COMPRESS_NAME(doi.doi_compress));
 	}
 
-	(void) printf("%10lld  %3u  %5s  %5s  %5s  %5s  %6s  %s%s\n",
+	(void) printf("%10lld  %3u  %5s  %5s  %5s  %6s  %5s  %6s  %s%s\n",
 	    (u_longlong_t)object, doi.doi_indirection, iblk, dblk,
-	    asize, lsize, fill, ZDB_OT_NAME(doi.doi_type), aux);
+	    asize, dnsize, lsize, fill, ZDB_OT_NAME(doi.doi_type), aux);
 
 	if (doi.doi_bonus_type != DMU_OT_NONE && verbosity > 3) {
-		(void) printf("%10s  %3s  %5s  %5s  %5s  %5s  %6s  %s\n",
-		    "", "", "", "", "", bonus_size, "bonus",
+		(void) printf("%10s  %3s  %5s  %5s  %5s  %6s  %5s  %6s  %s\n",
+		    "", "", "", "", "", "", bonus_size, "bonus",
 		    ZDB_OT_NAME(doi.doi_bonus_type));
 	}
 
@@ -1994,6 +2060,141 @@ dump_label(const char *dev)
 	(void) close(fd);
 }
 
+/*
+ * Compress the given files record by record with every algorithm in
+ * zio_compress_table, the same way zio_write_bp_init() would, and report
+ * the resulting ratio and the compression and decompression throughput.
+ * Every record is decompressed again and checked against the original.
+ * The same records are then checksummed with every data checksum in
+ * zio_checksum_table, using whichever engine each one selected at load.
+ */
+static void
+dump_compress_bench(int argc, char **argv)
+{
+	size_t recsize = SPA_OLD_MAXBLOCKSIZE;
+	size_t datasize = 0, off, len, psize;
+	uint64_t lsum, psum, dsum;
+	hrtime_t start, ctime, dtime;
+	char *data, *cbuf, *dbuf;
+	enum zio_compress c;
+	enum zio_checksum ck;
+	int i, fd, error;
+
+	for (i = 0; i < argc; i++) {
+		struct stat statbuf;
+
+		if (stat(argv[i], &statbuf) != 0) {
+			(void) printf("cannot stat '%s': %s\n", argv[i],
+			    strerror(errno));
+			exit(1);
+		}
+		datasize += statbuf.st_size;
+	}
+	if (datasize == 0) {
+		(void) printf("nothing to compress\n");
+		exit(1);
+	}
+
+	data = umem_alloc(datasize, UMEM_NOFAIL);
+	cbuf = umem_alloc(recsize, UMEM_NOFAIL);
+	dbuf = umem_alloc(recsize, UMEM_NOFAIL);
+
+	for (i = 0, off = 0; i < argc; i++) {
+		ssize_t n;
+
+		if ((fd = open(argv[i], O_RDONLY)) < 0) {
+			(void) printf("cannot open '%s': %s\n", argv[i],
+			    strerror(errno));
+			exit(1);
+		}
+		while (off < datasize &&
+		    (n = read(fd, data + off, datasize - off)) > 0)
+			off += n;
+		(void) close(fd);
+	}
+	datasize = off;
+
+	(void) printf("%llu bytes in %llu byte records\n\n",
+	    (u_longlong_t)datasize, (u_longlong_t)recsize);
+	(void) printf("%-12s %8s %12s %12s\n", "algorithm", "ratio",
+	    "comp MB/s", "decomp MB/s");
+
+	for (c = 0; c < ZIO_COMPRESS_FUNCTIONS; c++) {
+		zio_compress_info_t *ci = &zio_compress_table[c];
+
+		if (ci->ci_compress == NULL)
+			continue;
+
+		lsum = psum = dsum = 0;
+		ctime = dtime = 0;
+		for (off = 0; off < datasize; off += len) {
+			abd_t *abd;
+
+			len = MIN(recsize, datasize - off);
+			abd = abd_get_from_buf(data + off, len);
+
+			start = gethrtime();
+			psize = zio_compress_data(c, abd, cbuf, len);
+			ctime += gethrtime() - start;
+			abd_put(abd);
+
+			lsum += len;
+			psum += psize;
+			if (psize == 0 || psize >= len)
+				continue;	/* hole or stored uncompressed */
+
+			start = gethrtime();
+			error = zio_decompress_data_buf(c, cbuf, dbuf, psize,
+			    len);
+			dtime += gethrtime() - start;
+			dsum += len;
+
+			if (error != 0 || bcmp(dbuf, data + off, len) != 0) {
+				(void) printf("%s: record at offset %llu "
+				    "does not decompress correctly\n",
+				    ci->ci_name, (u_longlong_t)off);
+				exit(1);
+			}
+		}
+
+		(void) printf("%-12s %7.2fx %12.1f %12.1f\n", ci->ci_name,
+		    psum == 0 ? 0.0 : (double)lsum / psum,
+		    ctime == 0 ? 0.0 :
+		    (double)lsum * NANOSEC / ctime / (1 << 20),
+		    dtime == 0 ? 0.0 :
+		    (double)dsum * NANOSEC / dtime / (1 << 20));
+	}
+
+	(void) printf("\n%-12s %12s\n", "checksum", "MB/s");
+
+	for (ck = 0; ck < ZIO_CHECKSUM_FUNCTIONS; ck++) {
+		zio_checksum_info_t *ci = &zio_checksum_table[ck];
+		zio_cksum_t zc;
+
+		/* Embedded checksums only ever cover labels and the ZIL. */
+		if (ci->ci_func[0] == NULL || ci->ci_eck ||
+		    ck == ZIO_CHECKSUM_OFF)
+			continue;
+
+		ctime = 0;
+		for (off = 0; off < datasize; off += len) {
+			len = MIN(recsize, datasize - off);
+
+			start = gethrtime();
+			ci->ci_func[0](data + off, len, &zc);
+			ctime += gethrtime() - start;
+		}
+
+		(void) printf("%-12s %12.1f\n", ci->ci_name,
+		    ctime == 0 ? 0.0 :
+		    (double)datasize * NANOSEC / ctime / (1 << 20));
+	}
+
+	umem_free(dbuf, recsize);
+	umem_free(cbuf, recsize);
+	umem_free(data, datasize);
+}
+
 /*ARGSUSED*/
 static int
 dump_one_dir(const char *dsname, void *arg)
@@ -2110,7 +2311,7 @@ zdb_blkptr_done(zio_t *zio)
 	zdb_cb_t *zcb = zio->io_private;
 	zbookmark_t *zb = &zio->io_bookmark;
 
-	zio_data_buf_free(zio->io_data, zio->io_size);
+	abd_free(zio->io_abd);
 
 	mutex_enter(&spa->spa_scrub_lock);
 	spa->spa_scrub_inflight--;
@@ -2159,9 +2360,10 @@ zdb_blkptr_cb(spa_t *spa, zilog_t *zilog, const blkptr_t *bp,
 
 	is_metadata = (BP_GET_LEVEL(bp) != 0 || DMU_OT_IS_METADATA(type));
 
-	if (dump_opt['c'] > 1 || (dump_opt['c'] && is_metadata)) {
+	if (!BP_IS_EMBEDDED(bp) &&
+	    (dump_opt['c'] > 1 || (dump_opt['c'] && is_metadata))) {
 		size_t size = BP_GET_PSIZE(bp);
-		void *data = zio_data_buf_alloc(size);
+		abd_t *data = abd_alloc(size, B_FALSE);
 		int flags = ZIO_FLAG_CANFAIL | ZIO_FLAG_SCRUB | ZIO_FLAG_RAW;
 
 		/* If it's an intent log block, failure is expected. */
@@ -2230,45 +2432,79 @@ static space_map_ops_t zdb_space_map_ops = {
 	NULL	/* maxsize */
 };
 
+static void
+zdb_ddt_leak_entry(spa_t *spa, zdb_cb_t *zcb, enum zio_checksum checksum,
+    ddt_entry_t *dde)
+{
+	blkptr_t blk;
+	ddt_phys_t *ddp = dde->dde_phys;
+	int p;
+
+	ASSERT(ddt_phys_total_refcnt(dde) > 1);
+
+	for (p = 0; p < DDT_PHYS_TYPES; p++, ddp++) {
+		if (ddp->ddp_phys_birth == 0)
+			continue;
+		ddt_bp_create(checksum, &dde->dde_key, ddp, &blk);
+		if (p == DDT_PHYS_DITTO) {
+			zdb_count_block(zcb, NULL, &blk, ZDB_OT_DITTO);
+		} else {
+			zcb->zcb_dedup_asize +=
+			    BP_GET_ASIZE(&blk) * (ddp->ddp_refcnt - 1);
+			zcb->zcb_dedup_blocks++;
+		}
+	}
+	if (!dump_opt['L']) {
+		ddt_t *ddt = spa->spa_ddt[checksum];
+		ddt_enter(ddt);
+		VERIFY(ddt_lookup(ddt, &blk, B_TRUE) != NULL);
+		ddt_exit(ddt);
+	}
+}
+
 static void
 zdb_ddt_leak_init(spa_t *spa, zdb_cb_t *zcb)
 {
 	ddt_bookmark_t ddb = { 0 };
 	ddt_entry_t dde;
+	enum zio_checksum c;
 	int error;
-	int p;
 
 	while ((error = ddt_walk(spa, &ddb, &dde)) == 0) {
-		blkptr_t blk;
-		ddt_phys_t *ddp = dde.dde_phys;
+		ddt_t *ddt = spa->spa_ddt[ddb.ddb_checksum];
+		boolean_t logged;
 
 		if (ddb.ddb_class == DDT_CLASS_UNIQUE)
-			return;
+			break;
+
+		/*
+		 * The logs hold the current state of the entries in them;
+		 * those are counted below.
+		 */
+		ddt_enter(ddt);
+		logged = (ddt_log_find(ddt, &dde.dde_key) != NULL);
+		ddt_exit(ddt);
+		if (logged)
+			continue;
+
+		zdb_ddt_leak_entry(spa, zcb, ddb.ddb_checksum, &dde);
+	}
+
+	ASSERT(error == 0 || error == ENOENT);
+
+	for (c = 0; c < ZIO_CHECKSUM_FUNCTIONS; c++) {
+		ddt_t *ddt = spa->spa_ddt[c];
 
-		ASSERT(ddt_phys_total_refcnt(&dde) > 1);
+		if (ddt == NULL)
+			continue;
 
-		for (p = 0; p < DDT_PHYS_TYPES; p++, ddp++) {
-			if (ddp->ddp_phys_birth == 0)
+		bzero(&dde, sizeof (dde));
+		while (ddt_log_walk(ddt, &dde) == 0) {
+			if (dde.dde_class == DDT_CLASS_UNIQUE)
 				continue;
-			ddt_bp_create(ddb.ddb_checksum,
-			    &dde.dde_key, ddp, &blk);
-			if (p == DDT_PHYS_DITTO) {
-				zdb_count_block(zcb, NULL, &blk, ZDB_OT_DITTO);
-			} else {
-				zcb->zcb_dedup_asize +=
-				    BP_GET_ASIZE(&blk) * (ddp->ddp_refcnt - 1);
-				zcb->zcb_dedup_blocks++;
-			}
-		}
-		if (!dump_opt['L']) {
-			ddt_t *ddt = spa->spa_ddt[ddb.ddb_checksum];
-			ddt_enter(ddt);
-			VERIFY(ddt_lookup(ddt, &blk, B_TRUE) != NULL);
-			ddt_exit(ddt);
+			zdb_ddt_leak_entry(spa, zcb, c, &dde);
 		}
 	}
-
-	ASSERT(error == ENOENT);
 }
 
 static void
@@ -2288,6 +2524,10 @@ zdb_leak_init(spa_t *spa, zdb_cb_t *zcb)
 				VERIFY(space_map_load(msp->ms_map,
 				    &zdb_space_map_ops, SM_ALLOC, &msp->ms_smo,
 				    spa->spa_meta_objset) == 0);
+				space_map_walk(msp->ms_unflushed_allocs,
+				    space_map_add, msp->ms_map);
+				space_map_walk(msp->ms_unflushed_frees,
+				    space_map_remove, msp->ms_map);
 				msp->ms_map->sm_ppd = vd;
 				mutex_exit(&msp->ms_lock);
 			}
@@ -2562,7 +2802,7 @@ zdb_ddt_add_cb(spa_t *spa, zilog_t *zilog, const blkptr_t *bp,
 		(void) printf("traversing objset %llu, %llu objects, "
 		    "%lu blocks so far\n",
 		    (u_longlong_t)zb->zb_objset,
-		    (u_longlong_t)bp->blk_fill,
+		    (u_longlong_t)BP_GET_FILL(bp),
 		    avl_numnodes(t));
 	}
 
@@ -2666,8 +2906,10 @@ dump_zpool(spa_t *spa)
 	if (dump_opt['D'])
 		dump_all_ddts(spa);
 
-	if (dump_opt['d'] > 2 || dump_opt['m'])
+	if (dump_opt['d'] > 2 || dump_opt['m']) {
 		dump_metaslabs(spa);
+		dump_log_spacemaps(spa);
+	}
 
 	if (dump_opt['d'] || dump_opt['i']) {
 		dump_dir(dp->dp_meta_objset);
@@ -2867,6 +3109,7 @@ zdb_read_block(char *thing, spa_t *spa)
 	zio_t *zio;
 	vdev_t *vd;
 	void *pbuf, *lbuf, *buf;
+	abd_t *pabd;
 	char *s, *p, *dup, *vdev, *flagstr;
 	int i, error;
 
@@ -2958,6 +3201,8 @@ zdb_read_block(char *thing, spa_t *spa)
 	BP_SET_DEDUP(bp, 0);
 	BP_SET_BYTEORDER(bp, ZFS_HOST_BYTEORDER);
 
+	pabd = abd_get_from_buf(pbuf, psize);
+
 	spa_config_enter(spa, SCL_STATE, FTAG, RW_READER);
 	zio = zio_root(spa, NULL, NULL, 0);
 
@@ -2965,14 +3210,14 @@ zdb_read_block(char *thing, spa_t *spa)
 		/*
 		 * Treat this as a normal block read.
 		 */
-		zio_nowait(zio_read(zio, spa, bp, pbuf, psize, NULL, NULL,
+		zio_nowait(zio_read(zio, spa, bp, pabd, psize, NULL, NULL,
 		    ZIO_PRIORITY_SYNC_READ,
 		    ZIO_FLAG_CANFAIL | ZIO_FLAG_RAW, NULL));
 	} else {
 		/*
 		 * Treat this as a vdev child I/O.
 		 */
-		zio_nowait(zio_vdev_child_io(zio, bp, vd, offset, pbuf, psize,
+		zio_nowait(zio_vdev_child_io(zio, bp, vd, offset, pabd, psize,
 		    ZIO_TYPE_READ, ZIO_PRIORITY_SYNC_READ,
 		    ZIO_FLAG_DONT_CACHE | ZIO_FLAG_DONT_QUEUE |
 		    ZIO_FLAG_DONT_PROPAGATE | ZIO_FLAG_DONT_RETRY |
@@ -2981,6 +3226,7 @@ zdb_read_block(char *thing, spa_t *spa)
 
 	error = zio_wait(zio);
 	spa_config_exit(spa, SCL_STATE, FTAG);
+	abd_put(pabd);
 
 	if (error) {
 		(void) printf("Read of %s failed, error: %d\n", thing, error);
@@ -3007,9 +3253,9 @@ zdb_read_block(char *thing, spa_t *spa)
 		for (lsize = SPA_MAXBLOCKSIZE; lsize > psize;
 		    lsize -= SPA_MINBLOCKSIZE) {
 			for (c = 0; c < ZIO_COMPRESS_FUNCTIONS; c++) {
-				if (zio_decompress_data(c, pbuf, lbuf,
+				if (zio_decompress_data_buf(c, pbuf, lbuf,
 				    psize, lsize) == 0 &&
-				    zio_decompress_data(c, pbuf2, lbuf2,
+				    zio_decompress_data_buf(c, pbuf2, lbuf2,
 				    psize, lsize) == 0 &&
 				    bcmp(lbuf, lbuf2, lsize) == 0)
 					break;
@@ -3167,7 +3413,7 @@ main(int argc, char **argv)
 	if (spa_config_path_env != NULL)
 		spa_config_path = spa_config_path_env;
 
-	while ((c = getopt(argc, argv, "bcdhilmM:suCDRSAFLXevp:t:U:P"
+	while ((c = getopt(argc, argv, "bcdhilmM:suzCDRSAFLXevp:t:U:P"
 #ifdef __APPLE__
                        "Z"
 #endif
@@ -3183,6 +3429,7 @@ main(int argc, char **argv)
 		case 'm':
 		case 's':
 		case 'u':
+		case 'z':
 		case 'C':
 		case 'D':
 		case 'R':
@@ -3295,6 +3542,11 @@ main(int argc, char **argv)
 		return (0);
 	}
 
+	if (dump_opt['z']) {
+		dump_compress_bench(argc, argv);
+		return (0);
+	}
+
 	if (dump_opt['X'] || dump_opt['F'])
 		rewind = ZPOOL_DO_REWIND |
 		    (dump_opt['X'] ? ZPOOL_EXTREME_REWIND : 0);
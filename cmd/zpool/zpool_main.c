@@ -36,6 +36,7 @@
 #include <libintl.h>
 #include <libuutil.h>
 #include <locale.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -3862,17 +3863,20 @@ typedef struct status_cbdata {
 } status_cbdata_t;
 
 /*
- * Print out detailed scrub status.
+ * Print out detailed scrub status.  'psc' is the number of uint64_t
+ * elements in the ZPOOL_CONFIG_SCAN_STATS array, which is shorter than
+ * pool_scan_stat_t when the kernel module predates the issued counters.
  */
 void
-print_scan_status(pool_scan_stat_t *ps)
+print_scan_status(pool_scan_stat_t *ps, uint_t psc)
 {
 	time_t start, end;
 	uint64_t elapsed, mins_left, hours_left;
-	uint64_t pass_exam, examined, total;
-	uint_t rate;
+	uint64_t pass_exam, pass_issued, examined, issued, total;
+	uint_t rate, issue_rate;
 	double fraction_done;
 	char processed_buf[7], examined_buf[7], total_buf[7], rate_buf[7];
+	char issued_buf[7], issue_rate_buf[7];
 
 	(void) printf(gettext("  scan: "));
 
@@ -3936,7 +3940,6 @@ print_scan_status(pool_scan_stat_t *ps)
 
 	examined = ps->pss_examined ? ps->pss_examined : 1;
 	total = ps->pss_to_examine;
-	fraction_done = (double)examined / total;
 
 	/* elapsed time for this pass */
 	elapsed = time(NULL) - ps->pss_pass_start;
@@ -3944,18 +3947,39 @@ print_scan_status(pool_scan_stat_t *ps)
 	pass_exam = ps->pss_pass_exam ? ps->pss_pass_exam : 1;
 	rate = pass_exam / elapsed;
 	rate = rate ? rate : 1;
-	mins_left = ((total - examined) / rate) / 60;
+
+	/*
+	 * Blocks are examined well before their reads are issued, so
+	 * progress is measured by what has been issued.  A module that
+	 * doesn't report it has issued everything it examined.
+	 */
+	if (psc > offsetof(pool_scan_stat_t, pss_issued) / sizeof (uint64_t) &&
+	    ps->pss_issued != 0) {
+		issued = ps->pss_issued;
+		pass_issued = ps->pss_pass_issued;
+	} else {
+		issued = examined;
+		pass_issued = pass_exam;
+	}
+	issue_rate = pass_issued / elapsed;
+	issue_rate = issue_rate ? issue_rate : 1;
+	issued = (issued < total) ? issued : total;
+	fraction_done = (double)issued / total;
+	mins_left = ((total - issued) / issue_rate) / 60;
 	hours_left = mins_left / 60;
 
 	zfs_nicenum(examined, examined_buf, sizeof (examined_buf));
+	zfs_nicenum(issued, issued_buf, sizeof (issued_buf));
 	zfs_nicenum(total, total_buf, sizeof (total_buf));
 	zfs_nicenum(rate, rate_buf, sizeof (rate_buf));
+	zfs_nicenum(issue_rate, issue_rate_buf, sizeof (issue_rate_buf));
 
 	/*
 	 * do not print estimated time if hours_left is more than 30 days
 	 */
-	(void) printf(gettext("    %s scanned out of %s at %s/s"),
-	    examined_buf, total_buf, rate_buf);
+	(void) printf(gettext("    %s scanned at %s/s, %s issued at %s/s, "
+	    "%s total"), examined_buf, rate_buf, issued_buf, issue_rate_buf,
+	    total_buf);
 	if (hours_left < (30 * 24)) {
 		(void) printf(gettext(", %lluh%um to go\n"),
 		    (u_longlong_t)hours_left, (uint_t)(mins_left % 60));
@@ -4346,10 +4370,11 @@ status_callback(zpool_handle_t *zhp, void *data)
 		nvlist_t **spares, **l2cache;
 		uint_t nspares, nl2cache;
 		pool_scan_stat_t *ps = NULL;
+		uint_t psc = 0;
 
 		(void) nvlist_lookup_uint64_array(nvroot,
-		    ZPOOL_CONFIG_SCAN_STATS, (uint64_t **)&ps, &c);
-		print_scan_status(ps);
+		    ZPOOL_CONFIG_SCAN_STATS, (uint64_t **)&ps, &psc);
+		print_scan_status(ps, psc);
 
 		namewidth = max_width(zhp, nvroot, 0, 0);
 		if (namewidth < 10)
@@ -42,7 +42,7 @@ uint64_t total_stream_len = 0;
 FILE *send_stream = 0;
 boolean_t do_byteswap = B_FALSE;
 boolean_t do_cksum = B_TRUE;
-#define	INITIAL_BUFLEN (1<<20)
+#define	INITIAL_BUFLEN SPA_MAXBLOCKSIZE
 
 static void
 usage(void)
@@ -211,7 +211,7 @@ main(int argc, char *argv[])
 				nvlist_t *nv;
 				int sz = drr->drr_payloadlen;
 
-				if (sz > 1<<20) {
+				if (sz > INITIAL_BUFLEN) {
 					free(buf);
 					buf = malloc(sz);
 				}
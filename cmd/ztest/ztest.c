@@ -98,6 +98,7 @@
 #include <sys/mman.h>
 #include <sys/resource.h>
 #include <sys/zio.h>
+#include <sys/abd.h>
 #include <sys/zil.h>
 #include <sys/zil_impl.h>
 #include <sys/vdev_impl.h>
@@ -108,6 +109,7 @@
 #include <sys/dsl_dataset.h>
 #include <sys/dsl_destroy.h>
 #include <sys/dsl_scan.h>
+#include <sys/dsl_synctask.h>
 #include <sys/zio_checksum.h>
 #include <sys/refcount.h>
 #include <sys/zfeature.h>
@@ -317,7 +319,9 @@ static ztest_shared_callstate_t *ztest_shared_callstate;
  */
 ztest_func_t ztest_dmu_read_write;
 ztest_func_t ztest_dmu_write_parallel;
+ztest_func_t ztest_arc_evict;
 ztest_func_t ztest_dmu_object_alloc_free;
+ztest_func_t ztest_dmu_object_create_rate;
 ztest_func_t ztest_dmu_commit_callbacks;
 ztest_func_t ztest_zap;
 ztest_func_t ztest_zap_parallel;
@@ -355,6 +359,7 @@ ztest_info_t ztest_info[] = {
 	{ ztest_dmu_read_write,			1,	&zopt_always	},
 	{ ztest_dmu_write_parallel,		10,	&zopt_always	},
 	{ ztest_dmu_object_alloc_free,		1,	&zopt_always	},
+	{ ztest_dmu_object_create_rate,		1,	&zopt_always	},
 	{ ztest_dmu_commit_callbacks,		1,	&zopt_always	},
 	{ ztest_zap,				30,	&zopt_always	},
 	{ ztest_zap_parallel,			100,	&zopt_always	},
@@ -362,6 +367,7 @@ ztest_info_t ztest_info[] = {
 	{ ztest_zil_commit,			1,	&zopt_incessant	},
 	{ ztest_zil_remount,			1,	&zopt_sometimes	},
 	{ ztest_dmu_read_write_zcopy,		1,	&zopt_often	},
+	{ ztest_arc_evict,			1,	&zopt_rarely	},
 	{ ztest_dmu_objset_create_destroy,	1,	&zopt_often	},
 	{ ztest_dsl_prop_get_set,		1,	&zopt_often	},
 	{ ztest_spa_prop_get_set,		1,	&zopt_sometimes	},
@@ -418,6 +424,8 @@ typedef struct ztest_shared {
 	uint64_t	zs_metaslab_sz;
 	uint64_t	zs_metaslab_df_alloc_threshold;
 	uint64_t	zs_guid;
+	uint64_t	zs_create_count;
+	uint64_t	zs_create_time;
 } ztest_shared_t;
 
 #define	ID_PARALLEL	-1ULL
@@ -1033,8 +1041,16 @@ ztest_random_spa_version(uint64_t initial_version)
 static int
 ztest_random_blocksize(void)
 {
+	/*
+	 * If the pool can take large blocks, test up to 1MB ones.
+	 */
+	int maxbs = SPA_OLD_MAXBLOCKSHIFT;
+
+	if (spa_maxblocksize(ztest_spa) == SPA_MAXBLOCKSIZE)
+		maxbs = 20;
+
 	return (1 << (SPA_MINBLOCKSHIFT +
-	    ztest_random(SPA_MAXBLOCKSHIFT - SPA_MINBLOCKSHIFT + 1)));
+	    ztest_random(maxbs - SPA_MINBLOCKSHIFT + 1)));
 }
 
 static int
@@ -1883,13 +1899,14 @@ ztest_get_done(zgd_t *zgd, int error)
 	ztest_object_unlock(zd, object);
 
 	if (error == 0 && zgd->zgd_bp)
-		zil_add_block(zgd->zgd_zilog, zgd->zgd_bp);
+		zil_lwb_add_block(zgd->zgd_lwb, zgd->zgd_bp);
 
 	umem_free(zgd, sizeof (*zgd));
 }
 
 static int
-ztest_get_data(void *arg, lr_write_t *lr, char *buf, zio_t *zio)
+ztest_get_data(void *arg, lr_write_t *lr, char *buf, struct lwb *lwb,
+    zio_t *zio)
 {
 	ztest_ds_t *zd = arg;
 	objset_t *os = zd->zd_os;
@@ -1924,7 +1941,7 @@ ztest_get_data(void *arg, lr_write_t *lr, char *buf, zio_t *zio)
 	db = NULL;
 
 	zgd = umem_zalloc(sizeof (*zgd), UMEM_NOFAIL);
-	zgd->zgd_zilog = zd->zd_zilog;
+	zgd->zgd_lwb = lwb;
 	zgd->zgd_private = zd;
 
 	if (buf != NULL) {	/* immediate write */
@@ -3611,6 +3628,59 @@ ztest_dmu_object_alloc_free(ztest_ds_t *zd, uint64_t id)
 	umem_free(od, size);
 }
 
+/*
+ * Create-rate microbenchmark for dmu_object_alloc(): allocate a batch of
+ * objects in one tx, timing only the allocations, then free them again.
+ * Run with increasing -t to see how creates scale with the number of
+ * threads; the rate is reported in the -VV workload summary.
+ */
+#define	ZTEST_CREATE_BATCH	64
+
+void
+ztest_dmu_object_create_rate(ztest_ds_t *zd, uint64_t id)
+{
+	ztest_shared_t *zs = ztest_shared;
+	objset_t *os = zd->zd_os;
+	uint64_t object[ZTEST_CREATE_BATCH];
+	hrtime_t start, delta;
+	dmu_tx_t *tx;
+	int b;
+
+	tx = dmu_tx_create(os);
+	for (b = 0; b < ZTEST_CREATE_BATCH; b++)
+		dmu_tx_hold_bonus(tx, DMU_NEW_OBJECT);
+	if (ztest_tx_assign(tx, TXG_WAIT, FTAG) == 0)
+		return;
+
+	start = gethrtime();
+	for (b = 0; b < ZTEST_CREATE_BATCH; b++) {
+		object[b] = dmu_object_alloc(os, DMU_OT_UINT64_OTHER, 0,
+		    DMU_OT_NONE, 0, tx);
+	}
+	delta = gethrtime() - start;
+	dmu_tx_commit(tx);
+
+	atomic_add_64(&zs->zs_create_count, ZTEST_CREATE_BATCH);
+	atomic_add_64(&zs->zs_create_time, delta);
+
+	/*
+	 * The batch must not leak.  If the free can't be assigned (ENOSPC),
+	 * let a txg sync release some space and try again.
+	 */
+	for (;;) {
+		tx = dmu_tx_create(os);
+		for (b = 0; b < ZTEST_CREATE_BATCH; b++)
+			dmu_tx_hold_free(tx, object[b], 0, DMU_OBJECT_END);
+		if (ztest_tx_assign(tx, TXG_WAIT, FTAG) != 0)
+			break;
+		txg_wait_synced(dmu_objset_pool(os), 0);
+	}
+
+	for (b = 0; b < ZTEST_CREATE_BATCH; b++)
+		VERIFY3U(0, ==, dmu_object_free(os, object[b], tx));
+	dmu_tx_commit(tx);
+}
+
 #undef OD_ARRAY_SIZE
 #define OD_ARRAY_SIZE	2
 
@@ -4152,6 +4222,67 @@ ztest_dmu_write_parallel(ztest_ds_t *zd, uint64_t id)
 	umem_free(od, sizeof(ztest_od_t));
 }
 
+/*
+ * ARC eviction microbenchmark.  Each thread pulls the blocks of a private
+ * object into the ARC and then flushes the pool's buffers out again, so
+ * arc_read(), arc_change_state() and arc_evict() run concurrently on every
+ * thread.  The per-function totals printed with -VV show how the time per
+ * call, and so eviction throughput, scales as -t is raised.  arc_flush()
+ * empties the ARC of every other test's buffers too, so this only runs
+ * rarely.
+ */
+void
+ztest_arc_evict(ztest_ds_t *zd, uint64_t id)
+{
+	objset_t *os = zd->zd_os;
+	ztest_od_t *od;
+	dmu_object_info_t doi;
+	uint64_t nblocks = 32;
+	uint64_t blocksize, b;
+	void *data;
+	int pass;
+
+	od = umem_alloc(sizeof (ztest_od_t), UMEM_NOFAIL);
+
+	ztest_od_init(od, id, FTAG, 0, DMU_OT_UINT64_OTHER, 0, 0);
+
+	if (ztest_object_init(zd, od, sizeof (ztest_od_t), B_FALSE) != 0) {
+		umem_free(od, sizeof (ztest_od_t));
+		return;
+	}
+
+	VERIFY0(dmu_object_info(os, od->od_object, &doi));
+	blocksize = doi.doi_data_block_size;
+	data = umem_alloc(blocksize, UMEM_NOFAIL);
+
+	/*
+	 * Only dirty the object once in a while; the interesting part is
+	 * reading synced blocks back into the ARC and evicting them.
+	 */
+	if (doi.doi_max_offset < nblocks * blocksize ||
+	    ztest_random(10) == 0) {
+		(void) rw_enter(&zd->zd_zilog_lock, RW_READER);
+		for (b = 0; b < nblocks; b++) {
+			(void) memset(data, 'a' + (id + b) % 26, blocksize);
+			(void) ztest_write(zd, od->od_object, b * blocksize,
+			    blocksize, data);
+		}
+		(void) rw_exit(&zd->zd_zilog_lock);
+		txg_wait_synced(dmu_objset_pool(os), 0);
+	}
+
+	for (pass = 0; pass < 4; pass++) {
+		for (b = 0; b < nblocks; b++) {
+			(void) dmu_read(os, od->od_object, b * blocksize,
+			    blocksize, data, DMU_READ_NO_PREFETCH);
+		}
+		arc_flush(dmu_objset_spa(os));
+	}
+
+	umem_free(data, blocksize);
+	umem_free(od, sizeof (ztest_od_t));
+}
+
 void
 ztest_dmu_prealloc(ztest_ds_t *zd, uint64_t id)
 {
@@ -4906,7 +5037,8 @@ ztest_fault_inject(ztest_ds_t *zd, uint64_t id)
 	char *path0;
 	char *pathrand;
 	size_t fsize;
-	int bshift = SPA_MAXBLOCKSHIFT + 2;	/* don't scrog all labels */
+	/* don't scrog all labels */
+	int bshift = SPA_OLD_MAXBLOCKSHIFT + 2;
 	int iters = 1000;
 	int maxfaults;
 	int mirror_save;
@@ -5099,7 +5231,7 @@ ztest_ddt_repair(ztest_ds_t *zd, uint64_t id)
 	enum zio_checksum checksum = spa_dedup_checksum(spa);
 	dmu_buf_t *db;
 	dmu_tx_t *tx;
-	void *buf;
+	abd_t *abd;
 	blkptr_t blk;
 	int copies = 2 * ZIO_DEDUPDITTO_MIN;
 	int i;
@@ -5180,14 +5312,14 @@ ztest_ddt_repair(ztest_ds_t *zd, uint64_t id)
 	 * Damage the block.  Dedup-ditto will save us when we read it later.
 	 */
 	psize = BP_GET_PSIZE(&blk);
-	buf = zio_buf_alloc(psize);
-	ztest_pattern_set(buf, psize, ~pattern);
+	abd = abd_alloc_linear(psize, B_TRUE);
+	ztest_pattern_set(abd_to_buf(abd), psize, ~pattern);
 
 	(void) zio_wait(zio_rewrite(NULL, spa, 0, &blk,
-	    buf, psize, NULL, NULL, ZIO_PRIORITY_SYNC_WRITE,
+	    abd, psize, NULL, NULL, ZIO_PRIORITY_SYNC_WRITE,
 	    ZIO_FLAG_CANFAIL | ZIO_FLAG_INDUCE_DAMAGE, NULL));
 
-	zio_buf_free(buf, psize);
+	abd_free(abd);
 
 	(void) rw_exit(&ztest_name_lock);
 	umem_free(od, sizeof(ztest_od_t));
@@ -5982,6 +6114,17 @@ make_random_props(void)
 	return (props);
 }
 
+/* ARGSUSED */
+static void
+ztest_large_blocks_activate_sync(void *arg, dmu_tx_t *tx)
+{
+	spa_t *spa = dmu_tx_pool(tx)->dp_spa;
+	zfeature_info_t *feature = &spa_feature_table[SPA_FEATURE_LARGE_BLOCKS];
+
+	if (!spa_feature_is_active(spa, feature))
+		spa_feature_incr(spa, feature, tx);
+}
+
 /*
  * Create a storage pool with the given name and initial vdev size.
  * Then test spa_freeze() functionality.
@@ -6023,6 +6166,14 @@ ztest_init(ztest_shared_t *zs)
 	    1ULL << spa->spa_root_vdev->vdev_child[0]->vdev_ms_shift;
 	spa_close(spa, FTAG);
 
+	/*
+	 * ztest creates large-block objects straight through the DMU,
+	 * not through the recordsize property that normally activates
+	 * the feature, so activate it up front.
+	 */
+	VERIFY0(dsl_sync_task(ztest_opts.zo_pool, NULL,
+	    ztest_large_blocks_activate_sync, NULL, 0));
+
 	kernel_fini();
 
 	ztest_run_zdb(ztest_opts.zo_pool);
@@ -6347,6 +6498,8 @@ main(int argc, char **argv)
 			zc->zc_count = 0;
 			zc->zc_time = 0;
 		}
+		zs->zs_create_count = 0;
+		zs->zs_create_time = 0;
 
 		/* Set the allocation switch size */
 		zs->zs_metaslab_df_alloc_threshold =
@@ -6408,6 +6561,18 @@ main(int argc, char **argv)
 				    (u_longlong_t)zc->zc_count, timebuf,
 				    dli.dli_sname);
 			}
+			if (zs->zs_create_time != 0) {
+				uint64_t rate = zs->zs_create_count *
+				    NANOSEC / zs->zs_create_time;
+
+				/*
+				 * zs_create_time sums the time spent by all
+				 * threads, so this is the per-thread rate.
+				 */
+				(void) printf("\nObject creates: %llu/sec per "
+				    "thread (%d threads)\n", (u_longlong_t)rate,
+				    ztest_opts.zo_threads);
+			}
 			(void) printf("\n");
 		}
 
@@ -0,0 +1,161 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef _SYS_ABD_H
+#define	_SYS_ABD_H
+
+#include <sys/types.h>
+#include <sys/refcount.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * ARC buffer data (ABD).
+ *
+ * An abd_t describes the data of a block.  It is either linear, a single
+ * contiguous buffer, or scattered across a list of page sized chunks
+ * allocated from abd_chunk_cache.  Scattered buffers never require a large
+ * contiguous allocation, so they are used for anything which may be held
+ * for a long time.  Code which needs to touch the data does so through the
+ * abd_*() functions below, and only borrows a linear copy when a consumer
+ * (a compressor, say) really needs contiguous memory.
+ */
+
+typedef enum abd_flags {
+	ABD_FLAG_LINEAR	= 1 << 0,	/* is buffer linear (or scattered)? */
+	ABD_FLAG_OWNER	= 1 << 1,	/* does it own its data buffers? */
+	ABD_FLAG_META	= 1 << 2	/* does this represent FS metadata? */
+} abd_flags_t;
+
+typedef struct abd {
+	abd_flags_t	abd_flags;
+	uint_t		abd_size;	/* excludes scattered abd_offset */
+	struct abd	*abd_parent;
+	refcount_t	abd_children;
+	union {
+		struct abd_scatter {
+			uint_t	abd_offset;
+			uint_t	abd_chunk_size;
+			void	*abd_chunks[1];	/* actually variable */
+		} abd_scatter;
+		struct abd_linear {
+			void	*abd_buf;
+		} abd_linear;
+	} abd_u;
+} abd_t;
+
+typedef int abd_iter_func_t(void *buf, size_t len, void *private);
+typedef int abd_iter_func2_t(void *bufa, void *bufb, size_t len,
+    void *private);
+
+extern boolean_t zfs_abd_scatter_enabled;
+
+static inline boolean_t
+abd_is_linear(abd_t *abd)
+{
+	return ((abd->abd_flags & ABD_FLAG_LINEAR) != 0);
+}
+
+/*
+ * Allocations and deallocations
+ */
+extern abd_t *abd_alloc(size_t, boolean_t);
+extern abd_t *abd_alloc_linear(size_t, boolean_t);
+extern abd_t *abd_alloc_for_io(size_t, boolean_t);
+extern abd_t *abd_alloc_sametype(abd_t *, size_t);
+extern void abd_free(abd_t *);
+extern abd_t *abd_get_offset(abd_t *, size_t);
+extern abd_t *abd_get_offset_size(abd_t *, size_t, size_t);
+extern abd_t *abd_get_from_buf(void *, size_t);
+extern void abd_put(abd_t *);
+
+/*
+ * Conversion to and from a normal buffer
+ */
+extern void *abd_to_buf(abd_t *);
+extern void *abd_borrow_buf(abd_t *, size_t);
+extern void *abd_borrow_buf_copy(abd_t *, size_t);
+extern void abd_return_buf(abd_t *, void *, size_t);
+extern void abd_return_buf_copy(abd_t *, void *, size_t);
+extern void abd_take_ownership_of_buf(abd_t *, boolean_t);
+extern void abd_release_ownership_of_buf(abd_t *);
+
+/*
+ * ABD operations
+ */
+extern int abd_iterate_func(abd_t *, size_t, size_t, abd_iter_func_t *,
+    void *);
+extern int abd_iterate_func2(abd_t *, abd_t *, size_t, size_t, size_t,
+    abd_iter_func2_t *, void *);
+extern void abd_copy_off(abd_t *, abd_t *, size_t, size_t, size_t);
+extern void abd_copy_from_buf_off(abd_t *, const void *, size_t, size_t);
+extern void abd_copy_to_buf_off(void *, abd_t *, size_t, size_t);
+extern int abd_cmp(abd_t *, abd_t *, size_t);
+extern int abd_cmp_buf_off(abd_t *, const void *, size_t, size_t);
+extern void abd_zero_off(abd_t *, size_t, size_t);
+
+/*
+ * Wrappers for calls with offsets of 0
+ */
+
+static inline void
+abd_copy(abd_t *dabd, abd_t *sabd, size_t size)
+{
+	abd_copy_off(dabd, sabd, 0, 0, size);
+}
+
+static inline void
+abd_copy_from_buf(abd_t *abd, const void *buf, size_t size)
+{
+	abd_copy_from_buf_off(abd, buf, 0, size);
+}
+
+static inline void
+abd_copy_to_buf(void *buf, abd_t *abd, size_t size)
+{
+	abd_copy_to_buf_off(buf, abd, 0, size);
+}
+
+static inline int
+abd_cmp_buf(abd_t *abd, const void *buf, size_t size)
+{
+	return (abd_cmp_buf_off(abd, buf, 0, size));
+}
+
+static inline void
+abd_zero(abd_t *abd, size_t size)
+{
+	abd_zero_off(abd, 0, size);
+}
+
+/*
+ * Module lifecycle
+ */
+extern void abd_init(void);
+extern void abd_fini(void);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif /* _SYS_ABD_H */
@@ -138,6 +138,10 @@ void arc_flush(spa_t *spa);
 void arc_tempreserve_clear(uint64_t reserve);
 int arc_tempreserve_space(uint64_t reserve, uint64_t txg);
 
+void arc_dbuf_reclaim_enable(boolean_t enable);
+uint64_t arc_max_bytes(void);
+uint64_t arc_target_bytes(void);
+
 void arc_init(void);
 void arc_fini(void);
 int arc_referenced(arc_buf_t *buf);
@@ -154,11 +158,6 @@ void l2arc_fini(void);
 void l2arc_start(void);
 void l2arc_stop(void);
 
-/* Global tunings */
-extern int zfs_write_limit_shift;
-extern uint64_t zfs_write_limit_max;
-extern kmutex_t zfs_write_limit_lock;
-
 #ifdef	__cplusplus
 }
 #endif
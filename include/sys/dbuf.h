@@ -34,6 +34,7 @@
 #include <sys/zfs_context.h>
 #include <sys/refcount.h>
 #include <sys/zrlock.h>
+#include <sys/multilist.h>
 
 #ifdef	__cplusplus
 extern "C" {
@@ -75,6 +76,18 @@ typedef enum dbuf_states {
 	DB_EVICTING
 } dbuf_states_t;
 
+/*
+ * Unreferenced dbufs are kept on one of two dbuf caches, depending on
+ * whether they hold metadata, so that a burst of data reads cannot push
+ * the indirect blocks and dnode blocks out.
+ */
+typedef enum dbuf_cached_state {
+	DB_NO_CACHE = -1,
+	DB_DBUF_CACHE,
+	DB_DBUF_METADATA_CACHE,
+	DB_CACHE_MAX
+} dbuf_cached_state_t;
+
 struct dnode;
 struct dmu_tx;
 
@@ -111,6 +124,9 @@ typedef struct dbuf_dirty_record {
 	/* pointer to parent dirty record */
 	struct dbuf_dirty_record *dr_parent;
 
+	/* How much space was charged to dsl_pool_dirty_space() for this? */
+	unsigned int dr_accounted;
+
 	union dirty_types {
 		struct dirty_indirect {
 
@@ -214,6 +230,13 @@ typedef struct dmu_buf_impl {
 	 */
 	list_node_t db_link;
 
+	/*
+	 * Our link on the dbuf cache (see dbuf.c) while we are unreferenced,
+	 * and which of the caches we are on.  Protected by db_mtx.
+	 */
+	multilist_node_t db_cache_link;
+	dbuf_cached_state_t db_caching_status;
+
 	/* Data which is unique to data (leaf) blocks: */
 
 	/* stuff we store for the user (see dmu_buf_set_user) */
@@ -250,7 +273,7 @@ dmu_buf_impl_t *dbuf_hold_level(struct dnode *dn, int level, uint64_t blkid,
 int dbuf_hold_impl(struct dnode *dn, uint8_t level, uint64_t blkid, int create,
     void *tag, dmu_buf_impl_t **dbp);
 
-void dbuf_prefetch(struct dnode *dn, uint64_t blkid);
+void dbuf_prefetch(struct dnode *dn, int level, uint64_t blkid);
 
 void dbuf_add_ref(dmu_buf_impl_t *db, void *tag);
 uint64_t dbuf_refcount(dmu_buf_impl_t *db);
@@ -304,6 +327,7 @@ void dbuf_new_size(dmu_buf_impl_t *db, int size, dmu_tx_t *tx);
 
 void dbuf_init(void);
 void dbuf_fini(void);
+void dbuf_cache_reclaim(void);
 
 boolean_t dbuf_is_metadata(dmu_buf_impl_t *db);
 
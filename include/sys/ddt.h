@@ -109,15 +109,75 @@ struct ddt_entry {
 	ddt_key_t	dde_key;
 	ddt_phys_t	dde_phys[DDT_PHYS_TYPES];
 	zio_t		*dde_lead_zio[DDT_PHYS_TYPES];
-	void		*dde_repair_data;
+	abd_t		*dde_repair_abd;
 	enum ddt_type	dde_type;
 	enum ddt_class	dde_class;
+	enum ddt_type	dde_zap_type;	/* ZAP holding the key; lags */
+	enum ddt_class	dde_zap_class;	/* dde_type/class while logged */
 	uint8_t		dde_loading;
 	uint8_t		dde_loaded;
 	kcondvar_t	dde_cv;
 	avl_node_t	dde_node;
 };
 
+/*
+ * On-disk DDT log record: the state of an entry as of the txg it was
+ * appended in, and the ZAP object that held its key at the time.
+ */
+typedef struct ddt_log_record {
+	ddt_key_t	dlr_key;
+	uint64_t	dlr_info;	/* ZAP type and class */
+	ddt_phys_t	dlr_phys[DDT_PHYS_TYPES];
+} ddt_log_record_t;
+
+#define	DLR_GET_TYPE(dlr)	BF64_GET((dlr)->dlr_info, 0, 8)
+#define	DLR_SET_TYPE(dlr, x)	BF64_SET((dlr)->dlr_info, 0, 8, x)
+#define	DLR_GET_CLASS(dlr)	BF64_GET((dlr)->dlr_info, 8, 8)
+#define	DLR_SET_CLASS(dlr, x)	BF64_SET((dlr)->dlr_info, 8, 8, x)
+
+/*
+ * DDT log header, kept in the bonus buffer of the log object.
+ */
+typedef struct ddt_log_phys {
+	uint64_t	dlp_length;	/* bytes of records */
+	uint64_t	dlp_flags;	/* DDT_LOG_FLAG_* */
+	ddt_key_t	dlp_checkpoint;	/* last key written to the ZAPs */
+} ddt_log_phys_t;
+
+#define	DDT_LOG_FLAG_FLUSHING	(1ULL << 0)	/* being flushed */
+#define	DDT_LOG_FLAG_CHECKPOINT	(1ULL << 1)	/* dlp_checkpoint is valid */
+
+#define	DDT_LOG_BLOCKSHIFT	17
+
+/*
+ * In-core DDT log entry: the latest record for a key.
+ */
+typedef struct ddt_log_entry {
+	ddt_key_t	ddle_key;
+	ddt_phys_t	ddle_phys[DDT_PHYS_TYPES];
+	uint8_t		ddle_type;	/* ZAP holding the key, or DDT_TYPES */
+	uint8_t		ddle_class;	/* and its class, or DDT_CLASSES */
+	avl_node_t	ddle_node;
+} ddt_log_entry_t;
+
+typedef struct ddt_log {
+	uint64_t	ddl_object;
+	ddt_log_phys_t	ddl_phys;
+	avl_tree_t	ddl_tree;	/* ddt_log_entry_t, by key */
+	boolean_t	ddl_checkpoint_dirty; /* checkpoint not yet synced */
+} ddt_log_t;
+
+/*
+ * Records appended to the active log in one sync pass, batched into
+ * block-sized writes.
+ */
+typedef struct ddt_log_update {
+	dmu_tx_t	*dlu_tx;
+	ddt_log_record_t *dlu_buf;
+	int		dlu_count;
+	boolean_t	dlu_dirty;
+} ddt_log_update_t;
+
 /*
  * In-core ddt
  */
@@ -133,6 +193,10 @@ struct ddt {
 	ddt_histogram_t	ddt_histogram[DDT_TYPES][DDT_CLASSES];
 	ddt_histogram_t	ddt_histogram_cache[DDT_TYPES][DDT_CLASSES];
 	ddt_object_t	ddt_object_stats[DDT_TYPES][DDT_CLASSES];
+	ddt_log_t	ddt_log[2];
+	ddt_log_t	*ddt_log_active;	/* NULL if the ddt has no logs */
+	ddt_log_t	*ddt_log_flushing;
+	uint64_t	ddt_log_flush_rate;	/* entries to flush per txg */
 	avl_node_t	ddt_node;
 };
 
@@ -218,7 +282,7 @@ extern ddt_t *ddt_select(spa_t *spa, const blkptr_t *bp);
 extern void ddt_enter(ddt_t *ddt);
 extern void ddt_exit(ddt_t *ddt);
 extern ddt_entry_t *ddt_lookup(ddt_t *ddt, const blkptr_t *bp, boolean_t add);
-extern void ddt_prefetch(spa_t *spa, const blkptr_t *bp);
+extern boolean_t ddt_prefetch(spa_t *spa, const blkptr_t *bp);
 extern void ddt_remove(ddt_t *ddt, ddt_entry_t *dde);
 
 extern boolean_t ddt_class_contains(spa_t *spa, enum ddt_class max_class,
@@ -227,8 +291,12 @@ extern boolean_t ddt_class_contains(spa_t *spa, enum ddt_class max_class,
 extern ddt_entry_t *ddt_repair_start(ddt_t *ddt, const blkptr_t *bp);
 extern void ddt_repair_done(ddt_t *ddt, ddt_entry_t *dde);
 
+extern int ddt_key_compare(const ddt_key_t *k1, const ddt_key_t *k2);
 extern int ddt_entry_compare(const void *x1, const void *x2);
+extern enum ddt_class ddt_phys_class(const ddt_phys_t *ddp);
 
+extern void ddt_init(void);
+extern void ddt_fini(void);
 extern void ddt_create(spa_t *spa);
 extern int ddt_load(spa_t *spa);
 extern void ddt_unload(spa_t *spa);
@@ -239,6 +307,50 @@ extern int ddt_object_update(ddt_t *ddt, enum ddt_type type,
 
 extern const ddt_ops_t ddt_zap_ops;
 
+extern int zfs_dedup_log_flush_txgs;
+
+extern void ddt_log_cache_init(void);
+extern void ddt_log_cache_fini(void);
+extern void ddt_log_init(ddt_t *ddt);
+extern void ddt_log_fini(ddt_t *ddt);
+extern void ddt_log_create(ddt_t *ddt, dmu_tx_t *tx);
+extern int ddt_log_load(ddt_t *ddt);
+extern boolean_t ddt_log_pending(ddt_t *ddt);
+extern ddt_log_entry_t *ddt_log_find(ddt_t *ddt, const ddt_key_t *ddk);
+extern boolean_t ddt_log_lookup(ddt_t *ddt, ddt_entry_t *dde);
+extern void ddt_log_begin(ddt_t *ddt, ddt_log_update_t *dlu, dmu_tx_t *tx);
+extern void ddt_log_append(ddt_t *ddt, ddt_log_update_t *dlu,
+    const ddt_entry_t *dde);
+extern void ddt_log_commit(ddt_t *ddt, ddt_log_update_t *dlu);
+extern void ddt_log_flushed(ddt_t *ddt, ddt_log_entry_t *ddle);
+extern void ddt_log_checkpoint(ddt_t *ddt, dmu_tx_t *tx);
+extern boolean_t ddt_log_swap(ddt_t *ddt, dmu_tx_t *tx);
+extern int ddt_log_walk(ddt_t *ddt, ddt_entry_t *dde);
+
+/*
+ * DDT kstats, shared by ddt.c and ddt_log.c.
+ */
+typedef struct ddt_stats {
+	kstat_named_t ddtstat_lookups;
+	kstat_named_t ddtstat_lookup_hits;
+	kstat_named_t ddtstat_lookup_log_hits;
+	kstat_named_t ddtstat_lookup_misses;
+	kstat_named_t ddtstat_prefetches;
+	kstat_named_t ddtstat_log_entries;
+	kstat_named_t ddtstat_log_bytes;
+	kstat_named_t ddtstat_log_appended;
+	kstat_named_t ddtstat_log_flushed;
+	kstat_named_t ddtstat_log_flush_rate;
+	kstat_named_t ddtstat_log_flushed_forced;
+	kstat_named_t ddtstat_log_replayed;
+} ddt_stats_t;
+
+extern ddt_stats_t ddt_stats;
+
+#define	DDTSTAT_INCR(stat, val) \
+	atomic_add_64(&ddt_stats.stat.value.ui64, (val))
+#define	DDTSTAT_BUMP(stat)	DDTSTAT_INCR(stat, 1)
+
 #ifdef	__cplusplus
 }
 #endif
@@ -45,7 +45,7 @@ extern "C" {
  * bplist is self-contained
  * refcount is self-contained
  * txg is self-contained (hopefully!)
- * zst_lock
+ * zs_lock
  * zf_rwlock
  *
  * XXX try to improve evicting path?
@@ -67,9 +67,11 @@ extern "C" {
  * os_obj_lock
  *   must be held before:
  *   	everything except dp_config_rwlock
- *   protects os_obj_next
+ *   protects os_obj_next_chunk
  *   held from:
  *   	dmu_object_alloc: dn_dbufs_mtx, db_mtx, hash_mutexes, dn_struct_rwlock
+ *   	(only while handing out a new chunk of object numbers; the dnode
+ *   	hold and dnode_allocate() happen after it is dropped)
  *
  * dn_struct_rwlock
  *   must be held before:
@@ -85,7 +87,7 @@ extern "C" {
  *   	dmu_object_info_from_dnode: dn_dirty_mtx (dn_datablksz)
  *   	dmu_tx_count_free:
  *   	dbuf_read_impl: db_mtx, dmu_zfetch()
- *   	dmu_zfetch: zf_rwlock/r, zst_lock, dbuf_prefetch()
+ *   	dmu_zfetch: zf_rwlock/r, zs_lock, dbuf_prefetch()
  *   	dbuf_new_size: db_mtx
  *   	dbuf_dirty: db_mtx
  *	dbuf_findbp: (callers, phys? - the real need)
@@ -40,6 +40,7 @@ struct dsl_dir;
 struct dsl_dataset;
 struct dsl_pool;
 struct dmu_tx;
+struct dsl_scan_io_queue;
 
 /*
  * All members of this structure must be uint64_t, for byteswap
@@ -86,7 +87,26 @@ typedef struct dsl_scan {
 	/* for debugging / information */
 	uint64_t scn_visited_this_txg;
 
+	/*
+	 * Sorted scan state.  The traversal queues the reads it finds in
+	 * per top-level vdev queues (vdev_scan_io_queue) and they are issued
+	 * later in on-disk order.  scn_phys describes how far the traversal
+	 * has got; scn_phys_cached is the state as of the last checkpoint,
+	 * when every queued read had been issued, and is what goes on disk.
+	 */
+	boolean_t scn_is_sorted;	/* queue reads rather than issue */
+	boolean_t scn_traversal_done;	/* only queued reads remain */
+	boolean_t scn_clearing;		/* queues are full; issue only */
+	boolean_t scn_checkpointing;	/* draining for a checkpoint */
+	clock_t scn_last_checkpoint;	/* lbolt of the last checkpoint */
+	uint64_t scn_queues_mem;	/* memory used by queued reads */
+	uint64_t scn_issued_before_pass; /* bytes issued by earlier passes */
+
+	avl_tree_t scn_queue;		/* in-core queue of datasets */
+	boolean_t scn_queue_dirty;	/* differs from scn_queue_obj */
+
 	dsl_scan_phys_t scn_phys;
+	dsl_scan_phys_t scn_phys_cached;
 } dsl_scan_t;
 
 int dsl_scan_init(struct dsl_pool *dp, uint64_t txg);
@@ -96,6 +116,7 @@ int dsl_scan_cancel(struct dsl_pool *);
 int dsl_scan(struct dsl_pool *, pool_scan_func_t);
 void dsl_resilver_restart(struct dsl_pool *, uint64_t txg);
 boolean_t dsl_scan_resilvering(struct dsl_pool *dp);
+boolean_t dsl_scan_ddt_walking(dsl_scan_t *scn);
 boolean_t dsl_dataset_unstable(struct dsl_dataset *ds);
 void dsl_scan_ddt_entry(dsl_scan_t *scn, enum zio_checksum checksum,
     ddt_entry_t *dde, dmu_tx_t *tx);
@@ -104,6 +125,10 @@ void dsl_scan_ds_snapshotted(struct dsl_dataset *ds, struct dmu_tx *tx);
 void dsl_scan_ds_clone_swapped(struct dsl_dataset *ds1, struct dsl_dataset *ds2,
     struct dmu_tx *tx);
 boolean_t dsl_scan_active(dsl_scan_t *scn);
+void dsl_scan_freed(spa_t *spa, const blkptr_t *bp);
+void dsl_scan_io_queue_destroy(struct dsl_scan_io_queue *queue);
+void dsl_scan_global_init(void);
+void dsl_scan_global_fini(void);
 
 #ifdef	__cplusplus
 }
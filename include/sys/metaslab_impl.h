@@ -52,6 +52,17 @@ struct metaslab_class {
 	kmutex_t		mc_fastwrite_lock;
 };
 
+/*
+ * Per-group allocation throttle statistics, exported as the
+ * "vdev_alloc-<pool>-<vdev id>" kstat.
+ */
+typedef struct metaslab_group_stats {
+	kstat_named_t	mgs_alloc_queue_depth;	/* outstanding async allocs */
+	kstat_named_t	mgs_max_alloc_queue_depth;
+	kstat_named_t	mgs_allocations;	/* async allocs made here */
+	kstat_named_t	mgs_throttled;		/* times passed over */
+} metaslab_group_stats_t;
+
 struct metaslab_group {
 	kmutex_t		mg_lock;
 	avl_tree_t		mg_metaslab_tree;
@@ -64,6 +75,9 @@ struct metaslab_group {
 	vdev_t			*mg_vd;
 	metaslab_group_t	*mg_prev;
 	metaslab_group_t	*mg_next;
+	uint64_t		mg_alloc_queue_depth;
+	metaslab_group_stats_t	mg_stats;
+	kstat_t			*mg_ksp;
 };
 
 /*
@@ -90,15 +104,34 @@ struct metaslab_group {
  * eventually become space-inefficient. When the space map object is
  * zfs_condense_pct/100 times the size of the minimal on-disk representation,
  * we rewrite it in its minimized form.
+ *
+ * When the pool has a space map log, a metaslab's allocs and frees are
+ * appended to the log instead of its own space map, and collected in
+ * ms_unflushed_allocs and ms_unflushed_frees.  These two maps are disjoint:
+ * a free of a range in ms_unflushed_allocs cancels it out, and vice versa.
+ * Flushing the metaslab writes them to its space map and empties them.
+ * The space map plus the unflushed maps always describe the free space,
+ * so they are applied to the ms_map whenever it is loaded.  ms_smo's
+ * smo_alloc only counts what is in the space map itself.  ms_sync_lock
+ * keeps a load from reading the space map while a sync or a flush is
+ * moving records into it.
  */
 struct metaslab {
 	kmutex_t	ms_lock;	/* metaslab lock		*/
+	kmutex_t	ms_sync_lock;	/* held while writing space map	*/
+	uint64_t	ms_sync_txg;	/* txg being synced, or 0	*/
 	space_map_obj_t	ms_smo;		/* synced space map object	*/
 	space_map_obj_t	ms_smo_syncing;	/* syncing space map object	*/
 	space_map_t	*ms_allocmap[TXG_SIZE];	/* allocated this txg	*/
 	space_map_t	*ms_freemap[TXG_SIZE];	/* freed this txg	*/
 	space_map_t	*ms_defermap[TXG_DEFER_SIZE];	/* deferred frees */
 	space_map_t	*ms_map;	/* in-core free space map	*/
+	space_map_t	*ms_unflushed_allocs;	/* logged, not in smo	*/
+	space_map_t	*ms_unflushed_frees;	/* logged, not in smo	*/
+	uint64_t	ms_unflushed_txg; /* oldest logged txg, or 0	*/
+	uint64_t	ms_allocated;	/* allocated space, as synced	*/
+	boolean_t	ms_can_log;	/* smo has room for flushed txg	*/
+	avl_node_t	ms_unflushed_node; /* node in spa's unflushed tree */
 	int64_t		ms_deferspace;	/* sum of ms_defermap[] space	*/
 	uint64_t	ms_weight;	/* weight vs. others in group	*/
 	metaslab_group_t *ms_group;	/* metaslab group		*/
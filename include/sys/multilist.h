@@ -0,0 +1,92 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef	_SYS_MULTILIST_H
+#define	_SYS_MULTILIST_H
+
+#include <sys/zfs_context.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * A multilist is a list split into a number of sublists, each with a lock
+ * of its own, so that threads working on different parts of it do not
+ * contend.  Which sublist an object lives on is up to the index function
+ * given at creation, which must return the same index for an object for as
+ * long as it is on the list.
+ *
+ * multilist_insert() and multilist_remove() take the sublist lock unless the
+ * caller already holds it.  Anything walking a sublist locks it explicitly
+ * through multilist_sublist_lock() and uses the multilist_sublist_*()
+ * functions, which expect the lock to be held.
+ */
+typedef list_node_t multilist_node_t;
+typedef struct multilist multilist_t;
+typedef struct multilist_sublist multilist_sublist_t;
+typedef unsigned int multilist_sublist_index_func_t(multilist_t *, void *);
+
+struct multilist_sublist {
+	kmutex_t	mls_lock;
+	list_t		mls_list;
+} __attribute__((aligned(64)));		/* keep locks on separate lines */
+
+struct multilist {
+	size_t				ml_offset;
+	uint64_t			ml_num_sublists;
+	multilist_sublist_t		*ml_sublists;
+	multilist_sublist_index_func_t	*ml_index_func;
+};
+
+extern void multilist_create(multilist_t *, size_t, size_t, unsigned int,
+    multilist_sublist_index_func_t *);
+extern void multilist_destroy(multilist_t *);
+
+extern void multilist_insert(multilist_t *, void *);
+extern void multilist_remove(multilist_t *, void *);
+extern boolean_t multilist_is_empty(multilist_t *);
+
+extern unsigned int multilist_get_num_sublists(multilist_t *);
+extern unsigned int multilist_get_random_index(multilist_t *);
+
+extern multilist_sublist_t *multilist_sublist_lock(multilist_t *,
+    unsigned int);
+extern void multilist_sublist_unlock(multilist_sublist_t *);
+
+extern void multilist_sublist_insert_head(multilist_sublist_t *, void *);
+extern void multilist_sublist_insert_after(multilist_sublist_t *, void *,
+    void *);
+extern void multilist_sublist_remove(multilist_sublist_t *, void *);
+
+extern void *multilist_sublist_head(multilist_sublist_t *);
+extern void *multilist_sublist_tail(multilist_sublist_t *);
+extern void *multilist_sublist_next(multilist_sublist_t *, void *);
+extern void *multilist_sublist_prev(multilist_sublist_t *, void *);
+
+extern void multilist_link_init(multilist_node_t *);
+extern int multilist_link_active(multilist_node_t *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif /* _SYS_MULTILIST_H */
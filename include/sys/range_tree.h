@@ -0,0 +1,97 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef _SYS_RANGE_TREE_H
+#define	_SYS_RANGE_TREE_H
+
+#include <sys/avl.h>
+#include <sys/zfs_context.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define	RANGE_TREE_HISTOGRAM_SIZE	64
+
+typedef const struct range_tree_ops range_tree_ops_t;
+
+/*
+ * A range tree is the in-core set of disjoint [start, end) segments that
+ * backs every space map.  Besides the segments themselves it keeps their
+ * total size and a power-of-two histogram of their sizes, so consumers
+ * can tell how fragmented the set is without walking it.
+ */
+typedef struct range_tree {
+	avl_tree_t	rt_root;	/* offset-ordered segment AVL tree */
+	uint64_t	rt_space;	/* sum of all segments in the tree */
+	range_tree_ops_t *rt_ops;	/* segment change callbacks, or NULL */
+	void		*rt_arg;	/* argument passed to rt_ops */
+	kmutex_t	*rt_lock;	/* pointer to lock that protects tree */
+
+	/*
+	 * rt_histogram[i] is the number of segments whose size is in
+	 * [2^i, 2^(i+1)) bytes.
+	 */
+	uint64_t	rt_histogram[RANGE_TREE_HISTOGRAM_SIZE];
+} range_tree_t;
+
+typedef struct range_seg {
+	avl_node_t	rs_node;	/* AVL node */
+	avl_node_t	rs_pp_node;	/* AVL picker-private node */
+	uint64_t	rs_start;	/* starting offset of this segment */
+	uint64_t	rs_end;		/* ending offset (non-inclusive) */
+} range_seg_t;
+
+/*
+ * Callbacks that let a consumer keep its own index of the segments, such
+ * as the size-ordered tree of the metaslab block pickers.  rtop_remove is
+ * called before a segment changes and rtop_add once it has its new size.
+ */
+struct range_tree_ops {
+	void	(*rtop_add)(range_tree_t *rt, range_seg_t *rs, void *arg);
+	void	(*rtop_remove)(range_tree_t *rt, range_seg_t *rs, void *arg);
+	void	(*rtop_vacate)(range_tree_t *rt, void *arg);
+};
+
+extern void range_tree_init(void);
+extern void range_tree_fini(void);
+extern void range_tree_create(range_tree_t *rt, range_tree_ops_t *ops,
+    void *arg, kmutex_t *lp);
+extern void range_tree_destroy(range_tree_t *rt);
+extern void range_tree_set_ops(range_tree_t *rt, range_tree_ops_t *ops,
+    void *arg);
+extern void range_tree_add(range_tree_t *rt, uint64_t start, uint64_t size);
+extern void range_tree_remove(range_tree_t *rt, uint64_t start, uint64_t size);
+extern range_seg_t *range_tree_find(range_tree_t *rt, uint64_t start,
+    uint64_t size, avl_index_t *wherep);
+extern range_seg_t *range_tree_find_next(range_tree_t *rt, uint64_t offset);
+extern boolean_t range_tree_contains(range_tree_t *rt, uint64_t start,
+    uint64_t size);
+extern void range_tree_vacate(range_tree_t *rt);
+extern uint64_t range_tree_space(range_tree_t *rt);
+extern uint64_t range_tree_numsegs(range_tree_t *rt);
+extern uint64_t range_tree_max_segsize(range_tree_t *rt);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_RANGE_TREE_H */
@@ -234,7 +234,12 @@ struct sa_handle {
 #define	SA_BONUSTYPE_FROM_DB(db) \
 	(dmu_get_bonustype((dmu_buf_t *)db))
 
-#define	SA_BLKPTR_SPACE	(DN_MAX_BONUSLEN - sizeof (blkptr_t))
+/*
+ * Bonus space left over once the spill blkptr has been carved out of the
+ * end of the dnode; db is the bonus dbuf, whose size depends on the
+ * number of slots the dnode takes up.
+ */
+#define	SA_BLKPTR_SPACE(db)	((db)->db_size - sizeof (blkptr_t))
 
 #define	SA_LAYOUT_NUM(x, type) \
 	((!IS_SA_BONUSTYPE(type) ? 0 : (((IS_SA_BONUSTYPE(type)) && \
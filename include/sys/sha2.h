@@ -0,0 +1,67 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef _SYS_SHA2_H
+#define	_SYS_SHA2_H
+
+#include <sys/types.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * SHA-256 block transform engines.
+ *
+ * An engine folds nblocks consecutive 64 byte message blocks into the
+ * eight word hash state H[0..7] (a..h).  zio_checksum_SHA256() does the
+ * padding itself and hands whole blocks to the engine selected at load
+ * time by sha256_init(), which self-tests every supported engine against
+ * the generic one and picks the fastest.
+ */
+#define	SHA256_BLOCKSIZE	64
+
+extern const uint32_t sha256_k[64];
+
+typedef void (*sha256_transform_f)(uint32_t *, const void *, uint64_t);
+typedef boolean_t (*sha256_valid_f)(void);
+
+typedef struct sha256_ops {
+	sha256_transform_f	sha_transform;
+	sha256_valid_f		sha_valid;
+	const char		*sha_name;
+} sha256_ops_t;
+
+extern const sha256_ops_t sha256_generic_ops;
+#if defined(__x86_64) || defined(__x86_64__)
+extern const sha256_ops_t sha256_avx2_ops;
+extern const sha256_ops_t sha256_shani_ops;
+#endif
+
+extern void sha256_init(void);
+extern void sha256_fini(void);
+extern int sha256_impl_set(const char *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_SHA2_H */
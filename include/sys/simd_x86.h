@@ -0,0 +1,126 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef _SYS_SIMD_X86_H
+#define	_SYS_SIMD_X86_H
+
+/*
+ * Runtime detection of the x86 vector extensions used by the checksum and
+ * parity kernels, plus the bracketing required around any code touching
+ * the vector register file.
+ *
+ * The kernels themselves are written in inline assembly rather than with
+ * compiler intrinsics, since the kext is built with -mkernel which disables
+ * SSE code generation and the intrinsic headers are unavailable.
+ */
+
+#include <sys/types.h>
+
+#if defined(__x86_64) || defined(__x86_64__) || defined(__i386)
+
+#ifdef _KERNEL
+#include <i386/cpuid.h>
+
+/*
+ * XNU keeps a complete vector save area for every thread, kernel threads
+ * included, and saves it on context switch.  Nothing extra is required
+ * around kernel SIMD sections beyond not sleeping inside them.
+ */
+#define	kfpu_begin()	do { } while (0)
+#define	kfpu_end()	do { } while (0)
+
+static inline boolean_t
+zfs_sse2_available(void)
+{
+	return ((cpuid_features() & CPUID_FEATURE_SSE2) != 0);
+}
+
+static inline boolean_t
+zfs_ssse3_available(void)
+{
+	return ((cpuid_features() & CPUID_FEATURE_SSSE3) != 0);
+}
+
+static inline boolean_t
+zfs_avx2_available(void)
+{
+	return ((cpuid_leaf7_features() & CPUID_LEAF7_FEATURE_AVX2) != 0);
+}
+
+#ifndef CPUID_LEAF7_FEATURE_SHA
+#define	CPUID_LEAF7_FEATURE_SHA	(1ULL << 29)
+#endif
+
+static inline boolean_t
+zfs_shani_available(void)
+{
+	return ((cpuid_leaf7_features() & CPUID_LEAF7_FEATURE_SHA) != 0);
+}
+
+#else /* _KERNEL */
+
+#define	kfpu_begin()	do { } while (0)
+#define	kfpu_end()	do { } while (0)
+
+static inline boolean_t
+zfs_sse2_available(void)
+{
+	return (__builtin_cpu_supports("sse2") ? B_TRUE : B_FALSE);
+}
+
+static inline boolean_t
+zfs_ssse3_available(void)
+{
+	return (__builtin_cpu_supports("ssse3") ? B_TRUE : B_FALSE);
+}
+
+static inline boolean_t
+zfs_avx2_available(void)
+{
+	return (__builtin_cpu_supports("avx2") ? B_TRUE : B_FALSE);
+}
+
+/*
+ * Not every compiler knows the "sha" feature name, so ask cpuid directly:
+ * leaf 7, subleaf 0, ebx bit 29.
+ */
+static inline boolean_t
+zfs_shani_available(void)
+{
+	uint32_t eax, ebx, ecx, edx;
+
+	__asm__ __volatile__("cpuid"
+	    : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+	    : "a" (0), "c" (0));
+	if (eax < 7)
+		return (B_FALSE);
+
+	__asm__ __volatile__("cpuid"
+	    : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+	    : "a" (7), "c" (0));
+	return ((ebx & (1U << 29)) != 0 ? B_TRUE : B_FALSE);
+}
+
+#endif /* _KERNEL */
+
+#endif /* __x86_64 || __x86_64__ || __i386 */
+
+#endif /* _SYS_SIMD_X86_H */
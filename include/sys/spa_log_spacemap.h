@@ -0,0 +1,65 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef _SYS_SPA_LOG_SPACEMAP_H
+#define	_SYS_SPA_LOG_SPACEMAP_H
+
+#include <sys/spa.h>
+#include <sys/space_map.h>
+#include <sys/metaslab.h>
+#include <sys/dmu.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * Log space maps are written in large blocks: they are appended to once,
+ * in the txg they are named after, and only read back at import.
+ */
+#define	SPA_LOG_SM_BLOCKSHIFT	17
+
+/*
+ * One log space map.  It holds the allocs and frees that every logging
+ * metaslab made in sls_txg, in the order they were synced.
+ */
+typedef struct spa_log_sm {
+	uint64_t	sls_txg;	/* txg whose changes this log holds */
+	space_map_obj_t	sls_smo;	/* log object, size and net alloc */
+	list_node_t	sls_node;	/* node in spa_log_sm_list */
+} spa_log_sm_t;
+
+extern void spa_log_sm_init(spa_t *spa);
+extern void spa_log_sm_fini(spa_t *spa);
+extern int spa_log_sm_load(spa_t *spa);
+extern void spa_log_sm_unload(spa_t *spa);
+extern boolean_t spa_log_sm_active(spa_t *spa);
+extern void spa_log_sm_sync(spa_t *spa, dmu_tx_t *tx);
+extern void spa_log_sm_append(spa_t *spa, metaslab_t *msp,
+    space_map_t *allocmap, space_map_t *freemap, dmu_tx_t *tx);
+extern void spa_log_sm_add_metaslab(spa_t *spa, metaslab_t *msp);
+extern void spa_log_sm_remove_metaslab(spa_t *spa, metaslab_t *msp);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_SPA_LOG_SPACEMAP_H */
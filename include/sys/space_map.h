@@ -32,6 +32,7 @@
 
 #include <sys/avl.h>
 #include <sys/dmu.h>
+#include <sys/range_tree.h>
 
 #ifdef	__cplusplus
 extern "C" {
@@ -40,8 +41,7 @@ extern "C" {
 typedef const struct space_map_ops space_map_ops_t;
 
 typedef struct space_map {
-	avl_tree_t	sm_root;	/* offset-ordered segment AVL tree */
-	uint64_t	sm_space;	/* sum of all segments in the map */
+	range_tree_t	sm_rt;		/* in-core segments of the map */
 	uint64_t	sm_start;	/* start of map */
 	uint64_t	sm_size;	/* size of map */
 	uint8_t		sm_shift;	/* unit shift */
@@ -55,25 +55,36 @@ typedef struct space_map {
 	kmutex_t	*sm_lock;	/* pointer to lock that protects map */
 } space_map_t;
 
-typedef struct space_seg {
-	avl_node_t	ss_node;	/* AVL node */
-	avl_node_t	ss_pp_node;	/* AVL picker-private node */
-	uint64_t	ss_start;	/* starting offset of this segment */
-	uint64_t	ss_end;		/* ending offset (non-inclusive) */
-} space_seg_t;
-
 typedef struct space_ref {
 	avl_node_t	sr_node;	/* AVL node */
 	uint64_t	sr_offset;	/* offset (start or end) */
 	int64_t		sr_refcnt;	/* associated reference count */
 } space_ref_t;
 
+#define	SPACE_MAP_HISTOGRAM_SIZE	32
+
+/*
+ * The space map object's bonus buffer.  Objects created before the
+ * spacemap_histogram feature was enabled only have room for the first
+ * SPACE_MAP_SIZE_V0 bytes; the rest reads as zero.
+ */
 typedef struct space_map_obj {
 	uint64_t	smo_object;	/* on-disk space map object */
 	uint64_t	smo_objsize;	/* size of the object */
 	uint64_t	smo_alloc;	/* space allocated from the map */
+	uint64_t	smo_flushed_txg; /* last txg wholly in the map */
+	uint64_t	smo_pad[4];	/* reserved */
+
+	/*
+	 * smo_histogram[i] is the number of free segments whose size is
+	 * in [2^(i+sm_shift), 2^(i+sm_shift+1)) bytes; the last bucket
+	 * also counts every larger segment.
+	 */
+	uint64_t	smo_histogram[SPACE_MAP_HISTOGRAM_SIZE];
 } space_map_obj_t;
 
+#define	SPACE_MAP_SIZE_V0	(3 * sizeof (uint64_t))
+
 struct space_map_ops {
 	void	(*smop_load)(space_map_t *sm);
 	void	(*smop_unload)(space_map_t *sm);
@@ -128,6 +139,16 @@ struct space_map_ops {
 #define	SM_ALLOC	0x0
 #define	SM_FREE		0x1
 
+/*
+ * The pool-wide space map log (see spa_log_spacemap.c) holds the changes
+ * of many metaslabs in one object.  Debug entries with these actions
+ * carry a vdev id or a metaslab number in their txg field, and the
+ * entries that follow them belong to that metaslab, with offsets
+ * relative to its start.
+ */
+#define	SM_LOG_VDEV	0x4
+#define	SM_LOG_METASLAB	0x5
+
 /*
  * The data for a given space map can be kept on blocks of any size.
  * Larger blocks entail fewer i/o operations, but they also cause the
@@ -140,8 +161,6 @@ struct space_map_ops {
 
 typedef void space_map_func_t(space_map_t *sm, uint64_t start, uint64_t size);
 
-extern void space_map_init(void);
-extern void space_map_fini(void);
 extern void space_map_create(space_map_t *sm, uint64_t start, uint64_t size,
     uint8_t shift, kmutex_t *lp);
 extern void space_map_destroy(space_map_t *sm);
@@ -149,7 +168,7 @@ extern void space_map_add(space_map_t *sm, uint64_t start, uint64_t size);
 extern void space_map_remove(space_map_t *sm, uint64_t start, uint64_t size);
 extern boolean_t space_map_contains(space_map_t *sm,
     uint64_t start, uint64_t size);
-extern space_seg_t *space_map_find(space_map_t *sm, uint64_t start,
+extern range_seg_t *space_map_find(space_map_t *sm, uint64_t start,
     uint64_t size, avl_index_t *wherep);
 extern void space_map_swap(space_map_t **msrc, space_map_t **mdest);
 extern void space_map_vacate(space_map_t *sm,
@@ -171,6 +190,10 @@ extern void space_map_sync(space_map_t *sm, uint8_t maptype,
     space_map_obj_t *smo, objset_t *os, dmu_tx_t *tx);
 extern void space_map_truncate(space_map_obj_t *smo,
     objset_t *os, dmu_tx_t *tx);
+extern void space_map_histogram_update(space_map_t *sm,
+    space_map_obj_t *smo);
+extern uint64_t space_map_histogram_max_segsize(space_map_t *sm,
+    space_map_obj_t *smo);
 
 extern void space_map_ref_create(avl_tree_t *t);
 extern void space_map_ref_destroy(avl_tree_t *t);
@@ -82,6 +82,12 @@ extern void txg_register_callbacks(txg_handle_t *txghp, list_t *tx_callbacks);
  */
 extern void txg_delay(struct dsl_pool *dp, uint64_t txg, int ticks);
 
+/*
+ * Start quiescing the open txg if nothing is syncing or waiting to,
+ * so that accumulated dirty data begins to be written out.
+ */
+extern void txg_kick(struct dsl_pool *dp);
+
 /*
  * Wait until the given transaction group has finished syncing.
  * Try to make this happen as soon as possible (eg. kick off any
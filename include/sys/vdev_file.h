@@ -38,6 +38,7 @@ extern "C" {
 typedef struct vdev_file {
 	struct vnode	*vf_vnode;
     uint32_t	vf_vid;
+	taskq_t		*vf_taskq;	/* issues this file's I/O */
 } vdev_file_t;
 
 #ifdef	__cplusplus
@@ -26,6 +26,7 @@
 #ifndef _SYS_VDEV_IMPL_H
 #define	_SYS_VDEV_IMPL_H
 
+#include <sys/abd.h>
 #include <sys/avl.h>
 #include <sys/dmu.h>
 #include <sys/metaslab.h>
@@ -84,7 +85,7 @@ typedef const struct vdev_ops {
  * Virtual device properties
  */
 struct vdev_cache_entry {
-	char		*ve_data;
+	abd_t		*ve_abd;
 	uint64_t	ve_offset;
 	uint64_t	ve_lastused;
 	avl_node_t	ve_offset_node;
@@ -100,11 +101,24 @@ struct vdev_cache {
 	kmutex_t	vc_lock;
 };
 
+typedef struct vdev_queue_class {
+	uint32_t	vqc_active;
+
+	/*
+	 * Sorted by offset or timestamp, depending on whether the queue is
+	 * LBA-ordered or FIFO.
+	 */
+	avl_tree_t	vqc_queued_tree;
+} vdev_queue_class_t;
+
 struct vdev_queue {
-	avl_tree_t	vq_deadline_tree;
-	avl_tree_t	vq_read_tree;
-	avl_tree_t	vq_write_tree;
-	avl_tree_t	vq_pending_tree;
+	vdev_t		*vq_vdev;
+	vdev_queue_class_t vq_class[ZIO_PRIORITY_NUM_QUEUEABLE];
+	avl_tree_t	vq_active_tree;
+	avl_tree_t	vq_read_offset_tree;
+	avl_tree_t	vq_write_offset_tree;
+	uint64_t	vq_last_offset;
+	uint64_t	vq_lastoffset;	/* end of last read a mirror sent */
 	hrtime_t	vq_io_complete_ts;
 	hrtime_t	vq_io_delta_ts;
 	list_t		vq_io_list;
@@ -112,7 +126,7 @@ struct vdev_queue {
 };
 
 struct vdev_io {
-	char		vi_buffer[SPA_MAXBLOCKSIZE]; /* Must be first */
+	char		vi_buffer[SPA_OLD_MAXBLOCKSIZE]; /* Must be first */
 	list_node_t	vi_node;
 };
 
@@ -170,6 +184,7 @@ struct vdev {
 	uint64_t	vdev_deflate_ratio; /* deflation ratio (x512)	*/
 	uint64_t	vdev_islog;	/* is an intent log device	*/
 	uint64_t	vdev_ishole;	/* is a hole in the namespace 	*/
+	boolean_t	vdev_nonrot;	/* all of it is solid state	*/
 
 	/*
 	 * Leaf vdev state.
@@ -202,11 +217,12 @@ struct vdev {
 	uint8_t		vdev_cant_write; /* vdev is failing all writes	*/
 	uint64_t	vdev_isspare;	/* was a hot spare		*/
 	uint64_t	vdev_isl2cache;	/* was a l2cache device		*/
-	vdev_queue_t	vdev_queue;	/* I/O deadline schedule queue	*/
+	vdev_queue_t	vdev_queue;	/* I/O scheduler queue		*/
 	vdev_cache_t	vdev_cache;	/* physical block cache		*/
 	spa_aux_vdev_t	*vdev_aux;	/* for l2cache vdevs		*/
 	zio_t		*vdev_probe_zio; /* root of current probe	*/
 	vdev_aux_t	vdev_label_aux;	/* on-disk aux state		*/
+	struct dsl_scan_io_queue *vdev_scan_io_queue; /* queued scan reads */
 
 	/*
 	 * For DTrace to work in userland (libzpool) context, these fields must
@@ -218,6 +234,7 @@ struct vdev {
 	kmutex_t	vdev_dtl_lock;	/* vdev_dtl_{map,resilver}	*/
 	kmutex_t	vdev_stat_lock;	/* vdev_stat			*/
 	kmutex_t	vdev_probe_lock; /* protects vdev_probe_zio	*/
+	kmutex_t	vdev_scan_io_queue_lock; /* vdev_scan_io_queue	*/
 };
 
 #define	VDEV_RAIDZ_MAXPARITY	3
@@ -330,6 +347,11 @@ extern void vdev_set_min_asize(vdev_t *vd);
  */
 extern int zfs_vdev_cache_size;
 
+/*
+ * The allocation throttle sizes each metaslab group's queue from this.
+ */
+extern uint32_t zfs_vdev_async_write_max_active;
+
 #ifdef	__cplusplus
 }
 #endif
@@ -0,0 +1,116 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef _SYS_VDEV_RAIDZ_H
+#define	_SYS_VDEV_RAIDZ_H
+
+#include <sys/types.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * RAID-Z parity math engine.
+ *
+ * All parity generation and reconstruction in vdev_raidz.c is expressed in
+ * terms of the following GF(2^8) column operations, where every argument is
+ * a byte buffer of the given size:
+ *
+ *	xor(d, s)		d = d + s
+ *	mul2_xor(d, s)		d = 2 * d + s	(one step of Q generation)
+ *	mul4_xor(d, s)		d = 4 * d + s	(one step of R generation)
+ *	mul(d, s, c)		d = c * s	(d may equal s)
+ *	mul_xor(d, s, c)	d = d + c * s
+ *
+ * An engine provides these for sizes which are a multiple of
+ * RAIDZ_MATH_BLOCKSIZE; the vdev_raidz_math_*() wrappers below hand any
+ * remainder to the scalar engine.  The fastest supported engine is chosen
+ * at load time by vdev_raidz_math_init().
+ */
+#define	RAIDZ_MATH_BLOCKSIZE	64
+
+typedef void (*raidz_math_xor_f)(void *, const void *, size_t);
+typedef void (*raidz_math_mul_f)(void *, const void *, uint8_t, size_t);
+typedef boolean_t (*raidz_math_valid_f)(void);
+
+typedef struct raidz_math_ops {
+	raidz_math_xor_f	rmo_xor;
+	raidz_math_xor_f	rmo_mul2_xor;
+	raidz_math_xor_f	rmo_mul4_xor;
+	raidz_math_mul_f	rmo_mul;
+	raidz_math_mul_f	rmo_mul_xor;
+	raidz_math_valid_f	rmo_valid;
+	const char		*rmo_name;
+} raidz_math_ops_t;
+
+extern const raidz_math_ops_t vdev_raidz_scalar_ops;
+#if defined(__x86_64) || defined(__x86_64__) || defined(__i386)
+extern const raidz_math_ops_t vdev_raidz_ssse3_ops;
+extern const raidz_math_ops_t vdev_raidz_avx2_ops;
+#endif
+
+/*
+ * Multiply each byte of a 64-bit value by 2 in GF(2^8) at once, by
+ * creating a mask from the top bit in each byte and using that to
+ * conditionally apply the XOR of 0x1d.
+ */
+#define	VDEV_RAIDZ_64MUL_2(x, mask) \
+{ \
+	(mask) = (x) & 0x8080808080808080ULL; \
+	(mask) = ((mask) << 1) - ((mask) >> 7); \
+	(x) = (((x) << 1) & 0xfefefefefefefefeULL) ^ \
+	    ((mask) & 0x1d1d1d1d1d1d1d1dULL); \
+}
+
+#define	VDEV_RAIDZ_64MUL_4(x, mask) \
+{ \
+	VDEV_RAIDZ_64MUL_2((x), mask); \
+	VDEV_RAIDZ_64MUL_2((x), mask); \
+}
+
+/*
+ * Powers and logs of 2 in GF(2^8), see vdev_raidz.c.
+ */
+extern const uint8_t vdev_raidz_pow2[256];
+extern const uint8_t vdev_raidz_log2[256];
+
+/*
+ * Split multiplication by 'c' into two 16 entry lookups on the low and
+ * high nibble of the multiplicand, as used by the byte shuffle engines.
+ */
+extern void vdev_raidz_math_mul_tables(uint8_t c, uint8_t *lo, uint8_t *hi);
+
+extern void vdev_raidz_math_xor(void *, const void *, size_t);
+extern void vdev_raidz_math_mul2_xor(void *, const void *, size_t);
+extern void vdev_raidz_math_mul4_xor(void *, const void *, size_t);
+extern void vdev_raidz_math_mul(void *, const void *, uint8_t, size_t);
+extern void vdev_raidz_math_mul_xor(void *, const void *, uint8_t, size_t);
+
+extern void vdev_raidz_math_init(void);
+extern void vdev_raidz_math_fini(void);
+extern int vdev_raidz_impl_set(const char *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif /* _SYS_VDEV_RAIDZ_H */
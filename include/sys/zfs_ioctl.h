@@ -108,12 +108,17 @@ NOTE 3:  Fix to 7097870 (spill block can be dropped in some situations during
          of ZFS is required in destination for ZFS streams to work properly.
     */
 
+/* The stream may contain blocks larger than 128k */
+#define	DMU_BACKUP_FEATURE_LARGE_BLOCKS	(1 << 19)
+/* The stream may contain dnodes larger than 512 bytes */
+#define	DMU_BACKUP_FEATURE_LARGE_DNODE	(1 << 23)
 
 /*
  * Mask of all supported backup features
  */
 #define	DMU_BACKUP_FEATURE_MASK	(DMU_BACKUP_FEATURE_DEDUP | \
-		DMU_BACKUP_FEATURE_DEDUPPROPS | DMU_BACKUP_FEATURE_SA_SPILL)
+		DMU_BACKUP_FEATURE_DEDUPPROPS | DMU_BACKUP_FEATURE_SA_SPILL | \
+		DMU_BACKUP_FEATURE_LARGE_BLOCKS | DMU_BACKUP_FEATURE_LARGE_DNODE)
 
 /* Are all features in the given flag word currently supported? */
 #define	DMU_STREAM_SUPPORTED(x)	(!((x) & ~DMU_BACKUP_FEATURE_MASK))
@@ -195,7 +200,8 @@ typedef struct dmu_replay_record {
 			uint32_t drr_bonuslen;
 			uint8_t drr_checksumtype;
 			uint8_t drr_compress;
-			uint8_t drr_pad[6];
+			uint8_t drr_dn_slots;	/* 0 means 1, for old streams */
+			uint8_t drr_pad[5];
 			uint64_t drr_toguid;
 			/* bonus content follows */
 		} drr_object;
@@ -90,7 +90,7 @@ typedef struct zil_chain {
 } zil_chain_t;
 
 #define	ZIL_MIN_BLKSZ	4096ULL
-#define	ZIL_MAX_BLKSZ	SPA_MAXBLOCKSIZE
+#define	ZIL_MAX_BLKSZ	SPA_OLD_MAXBLOCKSIZE
 
 /*
  * The words of a log block checksum.
@@ -128,6 +128,7 @@ typedef enum zil_create {
 /*
  * Intent log transaction types and record structures
  */
+#define	TX_COMMIT		0	/* Commit marker (no on-disk state) */
 #define	TX_CREATE		1	/* Create file */
 #define	TX_MKDIR		2	/* Make directory */
 #define	TX_MKXATTR		3	/* Make XATTR directory */
@@ -207,6 +208,17 @@ typedef struct {
 	/* remainder of array and any additional fields */
 } lr_attr_t;
 
+/*
+ * The lr_foid of a create record also holds the number of dnode slots
+ * the object was created with, so that replay claims exactly as many.
+ * Records written before large dnodes read back as one slot.
+ */
+#define	LR_FOID_GET_SLOTS(oid)		(BF64_GET((oid), 56, 8) + 1)
+#define	LR_FOID_SET_SLOTS(oid, x)	BF64_SET((oid), 56, 8, (x) - 1)
+#define	LR_FOID_GET_OBJ(oid)		BF64_GET((oid), 0, DN_MAX_OBJECT_SHIFT)
+#define	LR_FOID_SET_OBJ(oid, x)		\
+	BF64_SET((oid), 0, DN_MAX_OBJECT_SHIFT, (x))
+
 /*
  * log record for creates without optional ACL.
  * This log record does support optional xvattr_t attributes.
@@ -214,7 +226,7 @@ typedef struct {
 typedef struct {
 	lr_t		lr_common;	/* common portion of log record */
 	uint64_t	lr_doid;	/* object id of directory */
-	uint64_t	lr_foid;	/* object id of created file object */
+	uint64_t	lr_foid;	/* obj id of created file; see above */
 	uint64_t	lr_mode;	/* mode of object */
 	uint64_t	lr_uid;		/* uid of object */
 	uint64_t	lr_gid;		/* gid of object */
@@ -383,9 +395,10 @@ typedef struct zil_stats {
 	kstat_named_t zil_commit_count;
 
 	/*
-	 * Number of times the ZIL has been flushed to stable storage.
-	 * This is less than zil_commit_count when commits are "merged"
-	 * (see the documentation above zil_commit()).
+	 * Number of times a zil_commit() caller became the issuer and
+	 * assigned the pending itxs to log blocks.  This is less than
+	 * zil_commit_count when another issuer has already handled a
+	 * caller's itxs (see the documentation above zil_commit()).
 	 */
 	kstat_named_t zil_commit_writer_count;
 
@@ -437,7 +450,8 @@ typedef int zil_parse_blk_func_t(zilog_t *zilog, blkptr_t *bp, void *arg,
 typedef int zil_parse_lr_func_t(zilog_t *zilog, lr_t *lr, void *arg,
     uint64_t txg);
 typedef int (*zil_replay_func_t)(void *, char *, boolean_t);
-typedef int zil_get_data_t(void *arg, lr_write_t *lr, char *dbuf, zio_t *zio);
+typedef int zil_get_data_t(void *arg, lr_write_t *lr, char *dbuf,
+    struct lwb *lwb, zio_t *zio);
 
 extern int zil_parse(zilog_t *zilog, zil_parse_blk_func_t *parse_blk_func,
     zil_parse_lr_func_t *parse_lr_func, void *arg, uint64_t txg);
@@ -473,7 +487,7 @@ extern void	zil_clean(zilog_t *zilog, uint64_t synced_txg);
 extern int	zil_suspend(const char *osname, void **cookiep);
 extern void	zil_resume(void *cookie);
 
-extern void	zil_add_block(zilog_t *zilog, const blkptr_t *bp);
+extern void	zil_lwb_add_block(struct lwb *lwb, const blkptr_t *bp);
 extern int	zil_bp_tree_add(zilog_t *zilog, const blkptr_t *bp);
 
 extern void	zil_set_sync(zilog_t *zilog, uint64_t syncval);
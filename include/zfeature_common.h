@@ -54,6 +54,14 @@ typedef enum spa_feature {
 	SPA_FEATURE_ASYNC_DESTROY,
 	SPA_FEATURE_EMPTY_BPOBJ,
 	SPA_FEATURE_LZ4_COMPRESS,
+	SPA_FEATURE_ZSTD_COMPRESS,
+	SPA_FEATURE_SHA512,
+	SPA_FEATURE_SPACEMAP_HISTOGRAM,
+	SPA_FEATURE_LOG_SPACEMAP,
+	SPA_FEATURE_LARGE_BLOCKS,
+	SPA_FEATURE_LARGE_DNODE,
+	SPA_FEATURE_EMBEDDED_DATA,
+	SPA_FEATURE_DEDUP_LOG,
 	SPA_FEATURES
 } spa_feature_t;
 
@@ -39,12 +39,53 @@ extern "C" {
 
 void fletcher_2_native(const void *, uint64_t, zio_cksum_t *);
 void fletcher_2_byteswap(const void *, uint64_t, zio_cksum_t *);
+void fletcher_2_incremental_native(const void *, uint64_t,
+    zio_cksum_t *);
+void fletcher_2_incremental_byteswap(const void *, uint64_t,
+    zio_cksum_t *);
 void fletcher_4_native(const void *, uint64_t, zio_cksum_t *);
 void fletcher_4_byteswap(const void *, uint64_t, zio_cksum_t *);
 void fletcher_4_incremental_native(const void *, uint64_t,
     zio_cksum_t *);
 void fletcher_4_incremental_byteswap(const void *, uint64_t,
     zio_cksum_t *);
+void fletcher_4_init(void);
+void fletcher_4_fini(void);
+int fletcher_4_impl_set(const char *);
+
+/*
+ * Vectorized fletcher-4 implementations.  Each implementation splits the
+ * input into 'f4_lanes' interleaved streams of 32-bit words, keeping
+ * separate a/b/c/d accumulators per stream, which are folded back into
+ * the scalar checksum once the run completes.  The compute routines only
+ * ever see a length which is a multiple of FLETCHER_4_BLOCKSIZE; the tail
+ * is finished by the scalar code.
+ */
+#define	FLETCHER_4_BLOCKSIZE	64
+#define	FLETCHER_4_MAX_LANES	4
+
+typedef struct fletcher_4_ctx {
+	uint64_t	f4_acc[4][FLETCHER_4_MAX_LANES];	/* a, b, c, d */
+} fletcher_4_ctx_t;
+
+typedef void (*fletcher_4_compute_f)(fletcher_4_ctx_t *, const void *,
+    uint64_t);
+typedef boolean_t (*fletcher_4_valid_f)(void);
+
+typedef struct fletcher_4_ops {
+	fletcher_4_compute_f	f4_native;
+	fletcher_4_compute_f	f4_byteswap;
+	fletcher_4_valid_f	f4_valid;
+	int			f4_lanes;
+	const char		*f4_name;
+} fletcher_4_ops_t;
+
+extern const fletcher_4_ops_t fletcher_4_superscalar4_ops;
+#if defined(__x86_64) || defined(__x86_64__) || defined(__i386)
+extern const fletcher_4_ops_t fletcher_4_sse2_ops;
+extern const fletcher_4_ops_t fletcher_4_ssse3_ops;
+extern const fletcher_4_ops_t fletcher_4_avx2_ops;
+#endif
 
 #ifdef	__cplusplus
 }
@@ -725,6 +725,9 @@ typedef struct kstat_txg {
 	hrtime_t		open_time;	/* open time */
 	hrtime_t		quiesce_time;	/* quiesce time */
 	hrtime_t		sync_time;	/* sync time */
+	u_longlong_t		ndirty;		/* dirty bytes when quiesced */
+	uint_t			delays;		/* write throttle delays */
+	hrtime_t		delay_time;	/* total write throttle delay */
 } kstat_txg_t;
 
 #endif
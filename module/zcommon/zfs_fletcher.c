@@ -123,6 +123,24 @@
  *
  * For both cached and uncached data, both fletcher checksums are much faster
  * than sha-256, and slower than 'off', which doesn't touch the data at all.
+ *
+ * ----------------------------
+ * Vectorized Fletcher-4 Kernels
+ * ----------------------------
+ *
+ * The recurrence above is inherently serial, but it can be split across N
+ * interleaved lanes: lane j accumulates f_j, f_(j+N), f_(j+2N), ... in its
+ * own a/b/c/d.  Expanding the series for each lane and regrouping gives the
+ * scalar a, b, c and d as fixed linear combinations of the lane
+ * accumulators, which is what fletcher_4_combine_lanes() computes.  All
+ * arithmetic is mod 2^64 in both forms, so the results are bit-for-bit
+ * identical to the scalar loop.
+ *
+ * The available implementations are benchmarked by fletcher_4_init() and
+ * the fastest is used unless zfs_fletcher_4_impl names a specific one.
+ * The incremental variants run the selected implementation over each chunk
+ * from a zero state and merge it into the running checksum with
+ * fletcher_4_incremental_combine().
  */
 
 #include <sys/types.h>
@@ -130,15 +148,23 @@
 #include <sys/byteorder.h>
 #include <sys/zio.h>
 #include <sys/spa.h>
+#include <sys/kstat.h>
+#include <zfs_fletcher.h>
 
 void
-fletcher_2_native(const void *buf, uint64_t size, zio_cksum_t *zcp)
+fletcher_2_incremental_native(const void *buf, uint64_t size,
+    zio_cksum_t *zcp)
 {
 	const uint64_t *ip = buf;
 	const uint64_t *ipend = ip + (size / sizeof (uint64_t));
 	uint64_t a0, b0, a1, b1;
 
-	for (a0 = b0 = a1 = b1 = 0; ip < ipend; ip += 2) {
+	a0 = zcp->zc_word[0];
+	a1 = zcp->zc_word[1];
+	b0 = zcp->zc_word[2];
+	b1 = zcp->zc_word[3];
+
+	for (; ip < ipend; ip += 2) {
 		a0 += ip[0];
 		a1 += ip[1];
 		b0 += a0;
@@ -149,13 +175,26 @@ fletcher_2_native(const void *buf, uint64_t size, zio_cksum_t *zcp)
 }
 
 void
-fletcher_2_byteswap(const void *buf, uint64_t size, zio_cksum_t *zcp)
+fletcher_2_native(const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+	ZIO_SET_CHECKSUM(zcp, 0, 0, 0, 0);
+	fletcher_2_incremental_native(buf, size, zcp);
+}
+
+void
+fletcher_2_incremental_byteswap(const void *buf, uint64_t size,
+    zio_cksum_t *zcp)
 {
 	const uint64_t *ip = buf;
 	const uint64_t *ipend = ip + (size / sizeof (uint64_t));
 	uint64_t a0, b0, a1, b1;
 
-	for (a0 = b0 = a1 = b1 = 0; ip < ipend; ip += 2) {
+	a0 = zcp->zc_word[0];
+	a1 = zcp->zc_word[1];
+	b0 = zcp->zc_word[2];
+	b1 = zcp->zc_word[3];
+
+	for (; ip < ipend; ip += 2) {
 		a0 += BSWAP_64(ip[0]);
 		a1 += BSWAP_64(ip[1]);
 		b0 += a0;
@@ -166,13 +205,25 @@ fletcher_2_byteswap(const void *buf, uint64_t size, zio_cksum_t *zcp)
 }
 
 void
-fletcher_4_native(const void *buf, uint64_t size, zio_cksum_t *zcp)
+fletcher_2_byteswap(const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+	ZIO_SET_CHECKSUM(zcp, 0, 0, 0, 0);
+	fletcher_2_incremental_byteswap(buf, size, zcp);
+}
+
+static void
+fletcher_4_scalar_native(const void *buf, uint64_t size, zio_cksum_t *zcp)
 {
 	const uint32_t *ip = buf;
 	const uint32_t *ipend = ip + (size / sizeof (uint32_t));
 	uint64_t a, b, c, d;
 
-	for (a = b = c = d = 0; ip < ipend; ip++) {
+	a = zcp->zc_word[0];
+	b = zcp->zc_word[1];
+	c = zcp->zc_word[2];
+	d = zcp->zc_word[3];
+
+	for (; ip < ipend; ip++) {
 		a += ip[0];
 		b += a;
 		c += b;
@@ -182,14 +233,19 @@ fletcher_4_native(const void *buf, uint64_t size, zio_cksum_t *zcp)
 	ZIO_SET_CHECKSUM(zcp, a, b, c, d);
 }
 
-void
-fletcher_4_byteswap(const void *buf, uint64_t size, zio_cksum_t *zcp)
+static void
+fletcher_4_scalar_byteswap(const void *buf, uint64_t size, zio_cksum_t *zcp)
 {
 	const uint32_t *ip = buf;
 	const uint32_t *ipend = ip + (size / sizeof (uint32_t));
 	uint64_t a, b, c, d;
 
-	for (a = b = c = d = 0; ip < ipend; ip++) {
+	a = zcp->zc_word[0];
+	b = zcp->zc_word[1];
+	c = zcp->zc_word[2];
+	d = zcp->zc_word[3];
+
+	for (; ip < ipend; ip++) {
 		a += BSWAP_32(ip[0]);
 		b += a;
 		c += b;
@@ -199,57 +255,389 @@ fletcher_4_byteswap(const void *buf, uint64_t size, zio_cksum_t *zcp)
 	ZIO_SET_CHECKSUM(zcp, a, b, c, d);
 }
 
-void
-fletcher_4_incremental_native(const void *buf, uint64_t size,
+static boolean_t
+fletcher_4_scalar_valid(void)
+{
+	return (B_TRUE);
+}
+
+/*
+ * The scalar entry is never called through f4_native/f4_byteswap; it only
+ * exists so that "scalar" can be benchmarked and selected by name.
+ */
+static const fletcher_4_ops_t fletcher_4_scalar_ops = {
+	.f4_native = NULL,
+	.f4_byteswap = NULL,
+	.f4_valid = fletcher_4_scalar_valid,
+	.f4_lanes = 1,
+	.f4_name = "scalar"
+};
+
+static const fletcher_4_ops_t *fletcher_4_impls[] = {
+	&fletcher_4_scalar_ops,
+	&fletcher_4_superscalar4_ops,
+#if defined(__x86_64) || defined(__x86_64__) || defined(__i386)
+	&fletcher_4_sse2_ops,
+	&fletcher_4_ssse3_ops,
+	&fletcher_4_avx2_ops,
+#endif
+};
+
+#define	FLETCHER_4_IMPL_COUNT	\
+	(sizeof (fletcher_4_impls) / sizeof (fletcher_4_impls[0]))
+
+/*
+ * Implementations which are supported by this CPU and passed the
+ * self-test in fletcher_4_init(), and the one currently in use.  Until
+ * fletcher_4_init() runs (e.g. in consumers which never call spa_init())
+ * everything goes through the scalar code.
+ */
+static boolean_t fletcher_4_supported[FLETCHER_4_IMPL_COUNT];
+static const fletcher_4_ops_t *fletcher_4_fastest = &fletcher_4_scalar_ops;
+static const fletcher_4_ops_t *fletcher_4_selected = &fletcher_4_scalar_ops;
+
+/*
+ * Name of the fletcher-4 implementation to use, or "fastest" to use the
+ * one which won the benchmark at load time.
+ */
+char zfs_fletcher_4_impl[16] = "fastest";
+
+/*
+ * Fold the per-lane accumulators of a vectorized run back into the scalar
+ * checksum.  The coefficients follow from expanding the series for each
+ * lane; see the comment at the top of this file.
+ */
+static void
+fletcher_4_combine_lanes(const fletcher_4_ctx_t *ctx, int lanes,
     zio_cksum_t *zcp)
 {
-	const uint32_t *ip = buf;
-	const uint32_t *ipend = ip + (size / sizeof (uint32_t));
-	uint64_t a, b, c, d;
+	const uint64_t *a = ctx->f4_acc[0];
+	const uint64_t *b = ctx->f4_acc[1];
+	const uint64_t *c = ctx->f4_acc[2];
+	const uint64_t *d = ctx->f4_acc[3];
+	uint64_t A, B, C, D;
 
-	a = zcp->zc_word[0];
-	b = zcp->zc_word[1];
-	c = zcp->zc_word[2];
-	d = zcp->zc_word[3];
+	if (lanes == 2) {
+		A = a[0] + a[1];
+		B = 2 * b[0] + 2 * b[1] - a[1];
+		C = 4 * c[0] - b[0] + 4 * c[1] - 3 * b[1];
+		D = 8 * d[0] - 4 * c[0] + 8 * d[1] - 8 * c[1] + b[1];
+	} else {
+		ASSERT3S(lanes, ==, 4);
+		A = a[0] + a[1] + a[2] + a[3];
+		B = 0 - a[1] - 2 * a[2] - 3 * a[3] +
+		    4 * b[0] + 4 * b[1] + 4 * b[2] + 4 * b[3];
+		C = a[2] + 3 * a[3] -
+		    6 * b[0] - 10 * b[1] - 14 * b[2] - 18 * b[3] +
+		    16 * c[0] + 16 * c[1] + 16 * c[2] + 16 * c[3];
+		D = 0 - a[3] +
+		    4 * b[0] + 10 * b[1] + 20 * b[2] + 34 * b[3] -
+		    48 * c[0] - 64 * c[1] - 80 * c[2] - 96 * c[3] +
+		    64 * d[0] + 64 * d[1] + 64 * d[2] + 64 * d[3];
+	}
 
-	for (; ip < ipend; ip++) {
-		a += ip[0];
-		b += a;
-		c += b;
-		d += c;
+	ZIO_SET_CHECKSUM(zcp, A, B, C, D);
+}
+
+static void
+fletcher_4_impl(const fletcher_4_ops_t *ops, const void *buf, uint64_t size,
+    zio_cksum_t *zcp, boolean_t byteswap)
+{
+	uint64_t p2size = P2ALIGN(size, FLETCHER_4_BLOCKSIZE);
+	fletcher_4_ctx_t ctx;
+
+	if (ops == &fletcher_4_scalar_ops || p2size == 0) {
+		ZIO_SET_CHECKSUM(zcp, 0, 0, 0, 0);
+		if (byteswap)
+			fletcher_4_scalar_byteswap(buf, size, zcp);
+		else
+			fletcher_4_scalar_native(buf, size, zcp);
+		return;
 	}
 
-	ZIO_SET_CHECKSUM(zcp, a, b, c, d);
+	if (byteswap)
+		ops->f4_byteswap(&ctx, buf, p2size);
+	else
+		ops->f4_native(&ctx, buf, p2size);
+	fletcher_4_combine_lanes(&ctx, ops->f4_lanes, zcp);
+
+	if (size > p2size) {
+		if (byteswap)
+			fletcher_4_scalar_byteswap((char *)buf + p2size,
+			    size - p2size, zcp);
+		else
+			fletcher_4_scalar_native((char *)buf + p2size,
+			    size - p2size, zcp);
+	}
+}
+
+void
+fletcher_4_native(const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+	fletcher_4_impl(fletcher_4_selected, buf, size, zcp, B_FALSE);
+}
+
+void
+fletcher_4_byteswap(const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+	fletcher_4_impl(fletcher_4_selected, buf, size, zcp, B_TRUE);
+}
+
+/*
+ * Merge the checksum 'nzcp' of a 'size' byte chunk, computed from a zero
+ * state, into the running checksum 'zcp'.  Shifting the running state by
+ * n = size / 4 words adds n*a to b, n(n+1)/2*a + n*b to c, and so on.
+ * The coefficient c3 overflows for chunks approaching 16M, which is why
+ * callers feed us at most FLETCHER_4_INC_MAX_SIZE at a time.
+ */
+#define	FLETCHER_4_INC_MAX_SIZE	(1ULL << 22)
+
+static void
+fletcher_4_incremental_combine(zio_cksum_t *zcp, uint64_t size,
+    const zio_cksum_t *nzcp)
+{
+	const uint64_t c1 = size / sizeof (uint32_t);
+	const uint64_t c2 = c1 * (c1 + 1) / 2;
+	const uint64_t c3 = c2 * (c1 + 2) / 3;
+
+	ASSERT3U(size, <=, FLETCHER_4_INC_MAX_SIZE);
+
+	zcp->zc_word[3] += nzcp->zc_word[3] + c1 * zcp->zc_word[2] +
+	    c2 * zcp->zc_word[1] + c3 * zcp->zc_word[0];
+	zcp->zc_word[2] += nzcp->zc_word[2] + c1 * zcp->zc_word[1] +
+	    c2 * zcp->zc_word[0];
+	zcp->zc_word[1] += nzcp->zc_word[1] + c1 * zcp->zc_word[0];
+	zcp->zc_word[0] += nzcp->zc_word[0];
+}
+
+static void
+fletcher_4_incremental_impl(const void *buf, uint64_t size, zio_cksum_t *zcp,
+    boolean_t byteswap)
+{
+	const fletcher_4_ops_t *ops = fletcher_4_selected;
+	zio_cksum_t nzc;
+
+	/* Short chunks aren't worth the setup cost of a vector pass. */
+	if (ops == &fletcher_4_scalar_ops || size < FLETCHER_4_BLOCKSIZE) {
+		if (byteswap)
+			fletcher_4_scalar_byteswap(buf, size, zcp);
+		else
+			fletcher_4_scalar_native(buf, size, zcp);
+		return;
+	}
+
+	while (size > 0) {
+		uint64_t len = MIN(size, FLETCHER_4_INC_MAX_SIZE);
+
+		fletcher_4_impl(ops, buf, len, &nzc, byteswap);
+		fletcher_4_incremental_combine(zcp, len, &nzc);
+
+		buf = (char *)buf + len;
+		size -= len;
+	}
+}
+
+void
+fletcher_4_incremental_native(const void *buf, uint64_t size,
+    zio_cksum_t *zcp)
+{
+	fletcher_4_incremental_impl(buf, size, zcp, B_FALSE);
 }
 
 void
 fletcher_4_incremental_byteswap(const void *buf, uint64_t size,
     zio_cksum_t *zcp)
 {
-	const uint32_t *ip = buf;
-	const uint32_t *ipend = ip + (size / sizeof (uint32_t));
-	uint64_t a, b, c, d;
+	fletcher_4_incremental_impl(buf, size, zcp, B_TRUE);
+}
 
-	a = zcp->zc_word[0];
-	b = zcp->zc_word[1];
-	c = zcp->zc_word[2];
-	d = zcp->zc_word[3];
+/*
+ * Select the implementation named by 'name', or the benchmark winner for
+ * "fastest".  Returns EINVAL for unknown names and ENOTSUP for
+ * implementations this CPU cannot run.
+ */
+int
+fletcher_4_impl_set(const char *name)
+{
+	int i;
 
-	for (; ip < ipend; ip++) {
-		a += BSWAP_32(ip[0]);
-		b += a;
-		c += b;
-		d += c;
+	if (strcmp(name, "fastest") == 0) {
+		fletcher_4_selected = fletcher_4_fastest;
+		(void) strlcpy(zfs_fletcher_4_impl, name,
+		    sizeof (zfs_fletcher_4_impl));
+		return (0);
 	}
 
-	ZIO_SET_CHECKSUM(zcp, a, b, c, d);
+	for (i = 0; i < FLETCHER_4_IMPL_COUNT; i++) {
+		if (strcmp(name, fletcher_4_impls[i]->f4_name) != 0)
+			continue;
+		if (!fletcher_4_supported[i])
+			return (ENOTSUP);
+		fletcher_4_selected = fletcher_4_impls[i];
+		(void) strlcpy(zfs_fletcher_4_impl, name,
+		    sizeof (zfs_fletcher_4_impl));
+		return (0);
+	}
+
+	return (EINVAL);
+}
+
+/*
+ * Benchmark results, in MB/s, for every implementation.  Unsupported
+ * implementations report zero.
+ */
+typedef struct fletcher_4_stats {
+	kstat_named_t f4stat_fastest;
+	kstat_named_t f4stat_bench[FLETCHER_4_IMPL_COUNT][2];
+} fletcher_4_stats_t;
+
+static fletcher_4_stats_t fletcher_4_stats;
+static kstat_t *fletcher_4_ksp;
+
+#define	FLETCHER_4_BENCH_SIZE	(128 * 1024)
+#define	FLETCHER_4_BENCH_NS	(NANOSEC / MILLISEC)	/* per impl */
+
+static uint64_t
+fletcher_4_bench_one(const fletcher_4_ops_t *ops, const void *buf,
+    boolean_t byteswap)
+{
+	zio_cksum_t zc;
+	hrtime_t start, delta;
+	uint64_t bytes = 0;
+
+	start = gethrtime();
+	do {
+		fletcher_4_impl(ops, buf, FLETCHER_4_BENCH_SIZE, &zc, byteswap);
+		bytes += FLETCHER_4_BENCH_SIZE;
+		delta = gethrtime() - start;
+	} while (delta < FLETCHER_4_BENCH_NS);
+
+	/* bytes per nanosecond * 1000 == MB/s */
+	return ((bytes * MILLISEC) / MAX(delta, 1));
+}
+
+void
+fletcher_4_init(void)
+{
+	zio_cksum_t ref[2], zc;
+	uint64_t *buf, best = 0;
+	int i, j;
+
+	buf = kmem_alloc(FLETCHER_4_BENCH_SIZE, KM_SLEEP);
+	for (i = 0; i < FLETCHER_4_BENCH_SIZE / sizeof (uint64_t); i++)
+		buf[i] = (i + 1) * 0x9e3779b97f4a7c15ULL;
+
+	ZIO_SET_CHECKSUM(&ref[0], 0, 0, 0, 0);
+	fletcher_4_scalar_native(buf, FLETCHER_4_BENCH_SIZE, &ref[0]);
+	ZIO_SET_CHECKSUM(&ref[1], 0, 0, 0, 0);
+	fletcher_4_scalar_byteswap(buf, FLETCHER_4_BENCH_SIZE, &ref[1]);
+
+	(void) strlcpy(fletcher_4_stats.f4stat_fastest.name, "fastest",
+	    KSTAT_STRLEN);
+	fletcher_4_stats.f4stat_fastest.data_type = KSTAT_DATA_CHAR;
+
+	for (i = 0; i < FLETCHER_4_IMPL_COUNT; i++) {
+		const fletcher_4_ops_t *ops = fletcher_4_impls[i];
+		uint64_t speed[2] = { 0, 0 };
+
+		fletcher_4_supported[i] = ops->f4_valid();
+
+		/*
+		 * Never pick an implementation which disagrees with the
+		 * scalar reference; a mismatch here would mean every block
+		 * it checksums fails verification.
+		 */
+		for (j = 0; j < 2 && fletcher_4_supported[i]; j++) {
+			fletcher_4_impl(ops, buf, FLETCHER_4_BENCH_SIZE, &zc, j);
+			if (!ZIO_CHECKSUM_EQUAL(zc, ref[j])) {
+				cmn_err(CE_WARN, "fletcher_4 %s implementation "
+				    "failed self-test, disabling", ops->f4_name);
+				fletcher_4_supported[i] = B_FALSE;
+			}
+		}
+
+		if (fletcher_4_supported[i]) {
+			speed[0] = fletcher_4_bench_one(ops, buf, B_FALSE);
+			speed[1] = fletcher_4_bench_one(ops, buf, B_TRUE);
+			if (speed[0] > best) {
+				best = speed[0];
+				fletcher_4_fastest = ops;
+			}
+		}
+
+		for (j = 0; j < 2; j++) {
+			kstat_named_t *knp = &fletcher_4_stats.f4stat_bench[i][j];
+
+			(void) snprintf(knp->name, KSTAT_STRLEN, "%s_%s",
+			    ops->f4_name, j ? "byteswap" : "native");
+			knp->data_type = KSTAT_DATA_UINT64;
+			knp->value.ui64 = speed[j];
+		}
+	}
+
+	kmem_free(buf, FLETCHER_4_BENCH_SIZE);
+
+	(void) strlcpy(fletcher_4_stats.f4stat_fastest.value.c,
+	    fletcher_4_fastest->f4_name,
+	    sizeof (fletcher_4_stats.f4stat_fastest.value.c));
+
+	if (fletcher_4_impl_set(zfs_fletcher_4_impl) != 0)
+		(void) fletcher_4_impl_set("fastest");
+
+	fletcher_4_ksp = kstat_create("zfs", 0, "fletcher_4_bench", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (fletcher_4_stats) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+
+	if (fletcher_4_ksp != NULL) {
+		fletcher_4_ksp->ks_data = &fletcher_4_stats;
+		kstat_install(fletcher_4_ksp);
+	}
+}
+
+void
+fletcher_4_fini(void)
+{
+	if (fletcher_4_ksp != NULL) {
+		kstat_delete(fletcher_4_ksp);
+		fletcher_4_ksp = NULL;
+	}
 }
 
 #if defined(_KERNEL) && defined(HAVE_SPL)
+static int
+fletcher_4_param_set(const char *val, struct kernel_param *kp)
+{
+	char name[sizeof (zfs_fletcher_4_impl)];
+	size_t len;
+
+	(void) strlcpy(name, val, sizeof (name));
+	len = strlen(name);
+	while (len > 0 && name[len - 1] == '\n')
+		name[--len] = '\0';
+
+	return (-fletcher_4_impl_set(name));
+}
+
+static int
+fletcher_4_param_get(char *buffer, struct kernel_param *kp)
+{
+	return (snprintf(buffer, PAGE_SIZE, "%s [%s]\n",
+	    zfs_fletcher_4_impl, fletcher_4_selected->f4_name));
+}
+
 EXPORT_SYMBOL(fletcher_2_native);
 EXPORT_SYMBOL(fletcher_2_byteswap);
+EXPORT_SYMBOL(fletcher_2_incremental_native);
+EXPORT_SYMBOL(fletcher_2_incremental_byteswap);
 EXPORT_SYMBOL(fletcher_4_native);
 EXPORT_SYMBOL(fletcher_4_byteswap);
 EXPORT_SYMBOL(fletcher_4_incremental_native);
 EXPORT_SYMBOL(fletcher_4_incremental_byteswap);
+EXPORT_SYMBOL(fletcher_4_init);
+EXPORT_SYMBOL(fletcher_4_fini);
+EXPORT_SYMBOL(fletcher_4_impl_set);
+
+module_param_call(zfs_fletcher_4_impl, fletcher_4_param_set,
+    fletcher_4_param_get, NULL, 0644);
+MODULE_PARM_DESC(zfs_fletcher_4_impl, "Select fletcher 4 implementation");
 #endif
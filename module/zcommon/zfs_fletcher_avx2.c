@@ -0,0 +1,130 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * AVX2 fletcher-4.  vpmovzxdq widens four 32-bit input words straight into
+ * the four 64-bit lanes of a ymm register, so each 16 byte step feeds one
+ * word to each of four interleaved lanes.
+ *
+ * ymm0-ymm3 hold a, b, c and d, ymm4 the widened input and xmm5/xmm7 the
+ * raw input and byteswap mask.
+ */
+
+#if defined(__x86_64) || defined(__x86_64__) || defined(__i386)
+
+#include <sys/types.h>
+#include <sys/spa.h>
+#include <sys/simd_x86.h>
+#include <zfs_fletcher.h>
+
+#define	FLETCHER_4_AVX2_PROLOGUE				\
+	"vpxor	%%ymm0, %%ymm0, %%ymm0\n"				\
+	"vpxor	%%ymm1, %%ymm1, %%ymm1\n"				\
+	"vpxor	%%ymm2, %%ymm2, %%ymm2\n"				\
+	"vpxor	%%ymm3, %%ymm3, %%ymm3\n"
+
+#define	FLETCHER_4_AVX2_ACCUMULATE				\
+	"vpaddq	%%ymm4, %%ymm0, %%ymm0\n"				\
+	"vpaddq	%%ymm0, %%ymm1, %%ymm1\n"				\
+	"vpaddq	%%ymm1, %%ymm2, %%ymm2\n"				\
+	"vpaddq	%%ymm2, %%ymm3, %%ymm3\n"				\
+	"add	$16, %[ip]\n"						\
+	"cmp	%[ipend], %[ip]\n"					\
+	"jb	1b\n"
+
+/* Offsets of f4_acc[0..3] within fletcher_4_ctx_t. */
+#define	FLETCHER_4_AVX2_EPILOGUE				\
+	"vmovdqu	%%ymm0, 0(%[ctx])\n"				\
+	"vmovdqu	%%ymm1, 32(%[ctx])\n"				\
+	"vmovdqu	%%ymm2, 64(%[ctx])\n"				\
+	"vmovdqu	%%ymm3, 96(%[ctx])\n"				\
+	"vzeroupper\n"
+
+static void
+fletcher_4_avx2_native(fletcher_4_ctx_t *ctx, const void *buf, uint64_t size)
+{
+	const uint8_t *ip = buf;
+	const uint8_t *ipend = ip + size;
+
+	ASSERT0(size % FLETCHER_4_BLOCKSIZE);
+	ASSERT3U(size, >, 0);
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    FLETCHER_4_AVX2_PROLOGUE
+	    "1:\n"
+	    "vpmovzxdq	(%[ip]), %%ymm4\n"
+	    FLETCHER_4_AVX2_ACCUMULATE
+	    FLETCHER_4_AVX2_EPILOGUE
+	    : [ip] "+r" (ip)
+	    : [ipend] "r" (ipend), [ctx] "r" (ctx)
+	    : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4");
+	kfpu_end();
+}
+
+static const uint8_t fletcher_4_avx2_bswap_mask[16]
+    __attribute__((aligned(16))) = {
+	3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12
+};
+
+static void
+fletcher_4_avx2_byteswap(fletcher_4_ctx_t *ctx, const void *buf,
+    uint64_t size)
+{
+	const uint8_t *ip = buf;
+	const uint8_t *ipend = ip + size;
+
+	ASSERT0(size % FLETCHER_4_BLOCKSIZE);
+	ASSERT3U(size, >, 0);
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    FLETCHER_4_AVX2_PROLOGUE
+	    "vmovdqa	(%[mask]), %%xmm7\n"
+	    "1:\n"
+	    "vmovdqu	(%[ip]), %%xmm5\n"
+	    "vpshufb	%%xmm7, %%xmm5, %%xmm5\n"
+	    "vpmovzxdq	%%xmm5, %%ymm4\n"
+	    FLETCHER_4_AVX2_ACCUMULATE
+	    FLETCHER_4_AVX2_EPILOGUE
+	    : [ip] "+r" (ip)
+	    : [ipend] "r" (ipend), [ctx] "r" (ctx),
+	    [mask] "r" (fletcher_4_avx2_bswap_mask)
+	    : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5",
+	    "xmm7");
+	kfpu_end();
+}
+
+static boolean_t
+fletcher_4_avx2_valid(void)
+{
+	return (zfs_avx2_available());
+}
+
+const fletcher_4_ops_t fletcher_4_avx2_ops = {
+	.f4_native = fletcher_4_avx2_native,
+	.f4_byteswap = fletcher_4_avx2_byteswap,
+	.f4_valid = fletcher_4_avx2_valid,
+	.f4_lanes = 4,
+	.f4_name = "avx2"
+};
+
+#endif /* __x86_64 || __x86_64__ || __i386 */
@@ -0,0 +1,187 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * SSE2 and SSSE3 fletcher-4.  Each 128-bit register holds two 64-bit
+ * accumulators, so the data is processed as two interleaved lanes: every
+ * 16 byte load is widened into {f0, f1} and {f2, f3} which are added in
+ * turn.  The SSSE3 variant only differs in using pshufb to byteswap the
+ * input words before widening them.
+ *
+ * xmm0-xmm3 hold a, b, c and d, xmm4 is kept zero for the widening
+ * unpacks and xmm7 holds the byteswap shuffle mask.
+ */
+
+#if defined(__x86_64) || defined(__x86_64__) || defined(__i386)
+
+#include <sys/types.h>
+#include <sys/spa.h>
+#include <sys/simd_x86.h>
+#include <zfs_fletcher.h>
+
+#define	FLETCHER_4_SSE_PROLOGUE					\
+	"pxor	%%xmm0, %%xmm0\n"					\
+	"pxor	%%xmm1, %%xmm1\n"					\
+	"pxor	%%xmm2, %%xmm2\n"					\
+	"pxor	%%xmm3, %%xmm3\n"					\
+	"pxor	%%xmm4, %%xmm4\n"
+
+#define	FLETCHER_4_SSE_ACCUMULATE				\
+	"movdqa	%%xmm5, %%xmm6\n"					\
+	"punpckldq	%%xmm4, %%xmm5\n"				\
+	"punpckhdq	%%xmm4, %%xmm6\n"				\
+	"paddq	%%xmm5, %%xmm0\n"					\
+	"paddq	%%xmm0, %%xmm1\n"					\
+	"paddq	%%xmm1, %%xmm2\n"					\
+	"paddq	%%xmm2, %%xmm3\n"					\
+	"paddq	%%xmm6, %%xmm0\n"					\
+	"paddq	%%xmm0, %%xmm1\n"					\
+	"paddq	%%xmm1, %%xmm2\n"					\
+	"paddq	%%xmm2, %%xmm3\n"					\
+	"add	$16, %[ip]\n"						\
+	"cmp	%[ipend], %[ip]\n"					\
+	"jb	1b\n"
+
+/* Offsets of f4_acc[0..3] within fletcher_4_ctx_t. */
+#define	FLETCHER_4_SSE_EPILOGUE					\
+	"movdqu	%%xmm0, 0(%[ctx])\n"					\
+	"movdqu	%%xmm1, 32(%[ctx])\n"					\
+	"movdqu	%%xmm2, 64(%[ctx])\n"					\
+	"movdqu	%%xmm3, 96(%[ctx])\n"
+
+static void
+fletcher_4_sse2_native(fletcher_4_ctx_t *ctx, const void *buf, uint64_t size)
+{
+	const uint8_t *ip = buf;
+	const uint8_t *ipend = ip + size;
+
+	ASSERT0(size % FLETCHER_4_BLOCKSIZE);
+	ASSERT3U(size, >, 0);
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    FLETCHER_4_SSE_PROLOGUE
+	    "1:\n"
+	    "movdqu	(%[ip]), %%xmm5\n"
+	    FLETCHER_4_SSE_ACCUMULATE
+	    FLETCHER_4_SSE_EPILOGUE
+	    : [ip] "+r" (ip)
+	    : [ipend] "r" (ipend), [ctx] "r" (ctx)
+	    : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5",
+	    "xmm6");
+	kfpu_end();
+}
+
+static void
+fletcher_4_sse2_byteswap(fletcher_4_ctx_t *ctx, const void *buf,
+    uint64_t size)
+{
+	const uint8_t *ip = buf;
+	const uint8_t *ipend = ip + size;
+
+	ASSERT0(size % FLETCHER_4_BLOCKSIZE);
+	ASSERT3U(size, >, 0);
+
+	/*
+	 * SSE2 has no byte shuffle, so swap the bytes within each 16-bit
+	 * half with shifts and then the halves themselves with
+	 * pshuflw/pshufhw.
+	 */
+	kfpu_begin();
+	__asm__ __volatile__(
+	    FLETCHER_4_SSE_PROLOGUE
+	    "1:\n"
+	    "movdqu	(%[ip]), %%xmm5\n"
+	    "movdqa	%%xmm5, %%xmm6\n"
+	    "psrlw	$8, %%xmm5\n"
+	    "psllw	$8, %%xmm6\n"
+	    "por	%%xmm6, %%xmm5\n"
+	    "pshuflw	$0xb1, %%xmm5, %%xmm5\n"
+	    "pshufhw	$0xb1, %%xmm5, %%xmm5\n"
+	    FLETCHER_4_SSE_ACCUMULATE
+	    FLETCHER_4_SSE_EPILOGUE
+	    : [ip] "+r" (ip)
+	    : [ipend] "r" (ipend), [ctx] "r" (ctx)
+	    : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5",
+	    "xmm6");
+	kfpu_end();
+}
+
+static boolean_t
+fletcher_4_sse2_valid(void)
+{
+	return (zfs_sse2_available());
+}
+
+const fletcher_4_ops_t fletcher_4_sse2_ops = {
+	.f4_native = fletcher_4_sse2_native,
+	.f4_byteswap = fletcher_4_sse2_byteswap,
+	.f4_valid = fletcher_4_sse2_valid,
+	.f4_lanes = 2,
+	.f4_name = "sse2"
+};
+
+static const uint8_t fletcher_4_bswap_mask[16] __attribute__((aligned(16))) = {
+	3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12
+};
+
+static void
+fletcher_4_ssse3_byteswap(fletcher_4_ctx_t *ctx, const void *buf,
+    uint64_t size)
+{
+	const uint8_t *ip = buf;
+	const uint8_t *ipend = ip + size;
+
+	ASSERT0(size % FLETCHER_4_BLOCKSIZE);
+	ASSERT3U(size, >, 0);
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    FLETCHER_4_SSE_PROLOGUE
+	    "movdqa	(%[mask]), %%xmm7\n"
+	    "1:\n"
+	    "movdqu	(%[ip]), %%xmm5\n"
+	    "pshufb	%%xmm7, %%xmm5\n"
+	    FLETCHER_4_SSE_ACCUMULATE
+	    FLETCHER_4_SSE_EPILOGUE
+	    : [ip] "+r" (ip)
+	    : [ipend] "r" (ipend), [ctx] "r" (ctx),
+	    [mask] "r" (fletcher_4_bswap_mask)
+	    : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5",
+	    "xmm6", "xmm7");
+	kfpu_end();
+}
+
+static boolean_t
+fletcher_4_ssse3_valid(void)
+{
+	return (zfs_sse2_available() && zfs_ssse3_available());
+}
+
+const fletcher_4_ops_t fletcher_4_ssse3_ops = {
+	.f4_native = fletcher_4_sse2_native,
+	.f4_byteswap = fletcher_4_ssse3_byteswap,
+	.f4_valid = fletcher_4_ssse3_valid,
+	.f4_lanes = 2,
+	.f4_name = "ssse3"
+};
+
+#endif /* __x86_64 || __x86_64__ || __i386 */
@@ -0,0 +1,152 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Portable four lane fletcher-4.  Keeping four independent dependency
+ * chains lets an out-of-order core retire several additions per cycle,
+ * which is most of what the SIMD versions buy us, on any architecture.
+ */
+
+#include <sys/types.h>
+#include <sys/sysmacros.h>
+#include <sys/byteorder.h>
+#include <sys/spa.h>
+#include <zfs_fletcher.h>
+
+static void
+fletcher_4_superscalar4_native(fletcher_4_ctx_t *ctx, const void *buf,
+    uint64_t size)
+{
+	const uint32_t *ip = buf;
+	const uint32_t *ipend = ip + (size / sizeof (uint32_t));
+	uint64_t a0, b0, c0, d0;
+	uint64_t a1, b1, c1, d1;
+	uint64_t a2, b2, c2, d2;
+	uint64_t a3, b3, c3, d3;
+
+	a0 = b0 = c0 = d0 = 0;
+	a1 = b1 = c1 = d1 = 0;
+	a2 = b2 = c2 = d2 = 0;
+	a3 = b3 = c3 = d3 = 0;
+
+	for (; ip < ipend; ip += 4) {
+		a0 += ip[0];
+		a1 += ip[1];
+		a2 += ip[2];
+		a3 += ip[3];
+		b0 += a0;
+		b1 += a1;
+		b2 += a2;
+		b3 += a3;
+		c0 += b0;
+		c1 += b1;
+		c2 += b2;
+		c3 += b3;
+		d0 += c0;
+		d1 += c1;
+		d2 += c2;
+		d3 += c3;
+	}
+
+	ctx->f4_acc[0][0] = a0;
+	ctx->f4_acc[0][1] = a1;
+	ctx->f4_acc[0][2] = a2;
+	ctx->f4_acc[0][3] = a3;
+	ctx->f4_acc[1][0] = b0;
+	ctx->f4_acc[1][1] = b1;
+	ctx->f4_acc[1][2] = b2;
+	ctx->f4_acc[1][3] = b3;
+	ctx->f4_acc[2][0] = c0;
+	ctx->f4_acc[2][1] = c1;
+	ctx->f4_acc[2][2] = c2;
+	ctx->f4_acc[2][3] = c3;
+	ctx->f4_acc[3][0] = d0;
+	ctx->f4_acc[3][1] = d1;
+	ctx->f4_acc[3][2] = d2;
+	ctx->f4_acc[3][3] = d3;
+}
+
+static void
+fletcher_4_superscalar4_byteswap(fletcher_4_ctx_t *ctx, const void *buf,
+    uint64_t size)
+{
+	const uint32_t *ip = buf;
+	const uint32_t *ipend = ip + (size / sizeof (uint32_t));
+	uint64_t a0, b0, c0, d0;
+	uint64_t a1, b1, c1, d1;
+	uint64_t a2, b2, c2, d2;
+	uint64_t a3, b3, c3, d3;
+
+	a0 = b0 = c0 = d0 = 0;
+	a1 = b1 = c1 = d1 = 0;
+	a2 = b2 = c2 = d2 = 0;
+	a3 = b3 = c3 = d3 = 0;
+
+	for (; ip < ipend; ip += 4) {
+		a0 += BSWAP_32(ip[0]);
+		a1 += BSWAP_32(ip[1]);
+		a2 += BSWAP_32(ip[2]);
+		a3 += BSWAP_32(ip[3]);
+		b0 += a0;
+		b1 += a1;
+		b2 += a2;
+		b3 += a3;
+		c0 += b0;
+		c1 += b1;
+		c2 += b2;
+		c3 += b3;
+		d0 += c0;
+		d1 += c1;
+		d2 += c2;
+		d3 += c3;
+	}
+
+	ctx->f4_acc[0][0] = a0;
+	ctx->f4_acc[0][1] = a1;
+	ctx->f4_acc[0][2] = a2;
+	ctx->f4_acc[0][3] = a3;
+	ctx->f4_acc[1][0] = b0;
+	ctx->f4_acc[1][1] = b1;
+	ctx->f4_acc[1][2] = b2;
+	ctx->f4_acc[1][3] = b3;
+	ctx->f4_acc[2][0] = c0;
+	ctx->f4_acc[2][1] = c1;
+	ctx->f4_acc[2][2] = c2;
+	ctx->f4_acc[2][3] = c3;
+	ctx->f4_acc[3][0] = d0;
+	ctx->f4_acc[3][1] = d1;
+	ctx->f4_acc[3][2] = d2;
+	ctx->f4_acc[3][3] = d3;
+}
+
+static boolean_t
+fletcher_4_superscalar4_valid(void)
+{
+	return (B_TRUE);
+}
+
+const fletcher_4_ops_t fletcher_4_superscalar4_ops = {
+	.f4_native = fletcher_4_superscalar4_native,
+	.f4_byteswap = fletcher_4_superscalar4_byteswap,
+	.f4_valid = fletcher_4_superscalar4_valid,
+	.f4_lanes = 4,
+	.f4_name = "superscalar4"
+};
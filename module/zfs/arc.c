@@ -118,6 +118,13 @@
  * Note that the majority of the performance stats are manipulated
  * with atomic operations.
  *
+ * Compressed blocks read from the main pool are cached in their on-disk
+ * form: the hdr keeps the physical (compressed) data in b_pabd and each
+ * arc_buf_t is decompressed from it on demand.  Decompressed buffers
+ * which are no longer referenced are dropped ahead of the compressed
+ * copy, so an idle hdr only costs its compressed size.  The compressed
+ * copy is also what gets written to the L2ARC.
+ *
  * The L2ARC uses the l2arc_buflist_mtx global mutex for the following:
  *
  *	- L2ARC buflist creation
@@ -131,6 +138,8 @@
 #include <sys/spa.h>
 #include <sys/zio.h>
 #include <sys/zio_compress.h>
+#include <sys/abd.h>
+#include <sys/multilist.h>
 #include <sys/zfs_context.h>
 #include <sys/arc.h>
 #include <sys/vdev.h>
@@ -144,6 +153,8 @@
 #include <sys/callb.h>
 #include <sys/kstat.h>
 #include <sys/dmu_tx.h>
+#include <sys/dbuf.h>
+#include <sys/dsl_pool.h>
 #include <zfs_fletcher.h>
 #include <sys/sysctl.h>
 
@@ -186,8 +197,21 @@ int zfs_arc_memory_throttle_disable = 1;
 /* disable duplicate buffer eviction */
 int zfs_disable_dup_eviction = 0;
 
+/* cache compressed blocks in their on-disk form */
+int zfs_compressed_arc_enabled = 1;
+
+/* number of sublists per ARC state list, 0 means one per CPU */
+int zfs_arc_num_sublists_per_state = 0;
+
 static int arc_dead;
 
+/*
+ * Whether the reclaim thread may call dbuf_cache_reclaim().  Only changed
+ * under arc_reclaim_thr_lock, which the thread holds while it works, so
+ * dbuf_fini() can't tear the dbuf caches down under it.
+ */
+static boolean_t arc_dbuf_reclaim = B_FALSE;
+
 /* expiration time for arc_no_grow */
 static clock_t arc_grow_time = 0;
 
@@ -214,6 +238,8 @@ SYSCTL_QUAD(_zfs, OID_AUTO, arc_max, CTLFLAG_RW,
             &zfs_arc_max, "Maximum ARC size");
 SYSCTL_QUAD(_zfs, OID_AUTO, arc_min, CTLFLAG_RW,
             &zfs_arc_min, "Minimum ARC size")
+SYSCTL_INT(_zfs, OID_AUTO, compressed_arc_enabled, CTLFLAG_RW,
+           &zfs_compressed_arc_enabled, 0, "Cache compressed blocks");
 
 extern int debug_vnop_osx_printf;
 SYSCTL_INT(_zfs, OID_AUTO, vnops_osx_debug,
@@ -255,11 +281,17 @@ SYSCTL_INT(_zfs, OID_AUTO, vnops_osx_debug,
  * second level ARC benefit from these fast lookups.
  */
 
+/*
+ * The lists of evictable buffers are multilists, split into sublists with
+ * locks of their own, so that threads adding and removing references to
+ * different buffers, or evicting, do not serialize on a single lock.  A
+ * buffer's sublist is chosen by the hash of its identity, so it sits on
+ * the same sublist index in every state.
+ */
 typedef struct arc_state {
-	list_t	arcs_list[ARC_BUFC_NUMTYPES];	/* list of evictable buffers */
+	multilist_t arcs_list[ARC_BUFC_NUMTYPES]; /* evictable buffers */
 	uint64_t arcs_lsize[ARC_BUFC_NUMTYPES];	/* amount of evictable data */
 	uint64_t arcs_size;	/* total amount of data in this state */
-	kmutex_t arcs_mtx;
 } arc_state_t;
 
 /* The 6 states: */
@@ -342,10 +374,24 @@ typedef struct arc_stats {
 	kstat_named_t arcstat_l2_compress_successes;
 	kstat_named_t arcstat_l2_compress_zeros;
 	kstat_named_t arcstat_l2_compress_failures;
+	kstat_named_t arcstat_l2_log_blk_writes;
+	kstat_named_t arcstat_l2_rebuild_successes;
+	kstat_named_t arcstat_l2_rebuild_unsupported;
+	kstat_named_t arcstat_l2_rebuild_io_errors;
+	kstat_named_t arcstat_l2_rebuild_cksum_lb_errors;
+	kstat_named_t arcstat_l2_rebuild_lowmem;
+	kstat_named_t arcstat_l2_rebuild_time_ms;
+	kstat_named_t arcstat_l2_rebuild_log_blks;
+	kstat_named_t arcstat_l2_rebuild_bufs;
+	kstat_named_t arcstat_l2_rebuild_bufs_precached;
+	kstat_named_t arcstat_l2_rebuild_size;
+	kstat_named_t arcstat_l2_rebuild_asize;
 	kstat_named_t arcstat_memory_throttle_count;
 	kstat_named_t arcstat_duplicate_buffers;
 	kstat_named_t arcstat_duplicate_buffers_size;
 	kstat_named_t arcstat_duplicate_reads;
+	kstat_named_t arcstat_compressed_size;
+	kstat_named_t arcstat_uncompressed_size;
 	kstat_named_t arcstat_memory_direct_count;
 	kstat_named_t arcstat_memory_indirect_count;
 	kstat_named_t arcstat_no_grow;
@@ -429,10 +475,24 @@ static arc_stats_t arc_stats = {
 	{ "l2_compress_successes",	KSTAT_DATA_UINT64 },
 	{ "l2_compress_zeros",		KSTAT_DATA_UINT64 },
 	{ "l2_compress_failures",	KSTAT_DATA_UINT64 },
+	{ "l2_log_blk_writes",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_successes",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_unsupported",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_io_errors",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_cksum_lb_errors",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_lowmem",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_time_ms",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_log_blks",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_bufs",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_bufs_precached",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_size",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_asize",		KSTAT_DATA_UINT64 },
 	{ "memory_throttle_count",	KSTAT_DATA_UINT64 },
 	{ "duplicate_buffers",		KSTAT_DATA_UINT64 },
 	{ "duplicate_buffers_size",	KSTAT_DATA_UINT64 },
 	{ "duplicate_reads",		KSTAT_DATA_UINT64 },
+	{ "compressed_size",		KSTAT_DATA_UINT64 },
+	{ "uncompressed_size",		KSTAT_DATA_UINT64 },
 	{ "memory_direct_count",	KSTAT_DATA_UINT64 },
 	{ "memory_indirect_count",	KSTAT_DATA_UINT64 },
 	{ "arc_no_grow",		KSTAT_DATA_UINT64 },
@@ -519,9 +579,6 @@ SYSCTL_QUAD(_zfs, OID_AUTO, arc_meta_limit,
 #define	arc_meta_limit	ARCSTAT(arcstat_meta_limit)
 #define	arc_meta_max	ARCSTAT(arcstat_meta_max)
 
-#define	L2ARC_IS_VALID_COMPRESS(_c_) \
-	((_c_) == ZIO_COMPRESS_LZ4 || (_c_) == ZIO_COMPRESS_EMPTY)
-
 typedef struct l2arc_buf_hdr l2arc_buf_hdr_t;
 
 typedef struct arc_callback arc_callback_t;
@@ -575,6 +632,11 @@ struct arc_buf_hdr {
 	/* self protecting */
 	refcount_t		b_refcnt;
 
+	/* compressed copy of the block, protected by hash lock */
+	abd_t			*b_pabd;
+	uint64_t		b_psize;
+	enum zio_compress	b_compress;
+
 	l2arc_buf_hdr_t		*b_l2hdr;
 	list_node_t		b_l2node;
 };
@@ -703,6 +765,7 @@ int l2arc_noprefetch = B_TRUE;			/* don't cache prefetch bufs */
 int l2arc_nocompress = B_FALSE;			/* don't compress bufs */
 int l2arc_feed_again = B_TRUE;			/* turbo warmup */
 int l2arc_norw = B_FALSE;			/* no reads during writes */
+int l2arc_rebuild_enabled = B_TRUE;		/* rebuild from device log */
 
 #ifdef _KERNEL
 SYSCTL_QUAD(_zfs, OID_AUTO, l2arc_write_max, CTLFLAG_RW,
@@ -722,6 +785,8 @@ SYSCTL_INT(_zfs, OID_AUTO, l2arc_feed_again, CTLFLAG_RW,
     &l2arc_feed_again, 0, "turbo warmup");
 SYSCTL_INT(_zfs, OID_AUTO, l2arc_norw, CTLFLAG_RW,
     &l2arc_norw, 0, "no reads during writes");
+SYSCTL_INT(_zfs, OID_AUTO, l2arc_rebuild_enabled, CTLFLAG_RW,
+    &l2arc_rebuild_enabled, 0, "rebuild L2ARC from device log");
 
 SYSCTL_QUAD(_zfs, OID_AUTO, anon_size, CTLFLAG_RD,
     &ARC_anon.arcs_size, "size of anonymous state");
@@ -770,6 +835,82 @@ SYSCTL_QUAD(_zfs, OID_AUTO, l2c_only_size, CTLFLAG_RD,
 /*
  * L2ARC Internals
  */
+
+/*
+ * Persistent L2ARC on-disk structures, see "Persistence" in the L2ARC
+ * comment further down.  These are always written in host byte order.
+ */
+#define	L2ARC_DEV_HDR_MAGIC	0x4c3241524344484cULL	/* "L2ARCDHL" */
+#define	L2ARC_LOG_BLK_MAGIC	0x4c3241524c4f4742ULL	/* "L2ARLOGB" */
+#define	L2ARC_PERSIST_VERSION	1ULL
+
+/* dh_flags */
+#define	L2ARC_DEV_HDR_FIRST	(1ULL << 0)	/* l2ad_first was set */
+
+/*
+ * Location and checksum of a log block.  An lbp_daddr of zero, which is
+ * within the vdev labels, marks the end of the log.
+ */
+typedef struct l2arc_log_blkptr {
+	uint64_t		lbp_daddr;	/* device address */
+	uint64_t		lbp_size;	/* size, as written */
+	zio_cksum_t		lbp_cksum;	/* fletcher-4 of the block */
+} l2arc_log_blkptr_t;
+
+/*
+ * The device header, at the start of the device right after the vdev
+ * labels.  It is rewritten at the end of every feed cycle.
+ */
+typedef struct l2arc_dev_hdr_phys {
+	uint64_t		dh_magic;
+	uint64_t		dh_version;
+	uint64_t		dh_spa_guid;	/* pool the device belongs to */
+	uint64_t		dh_vdev_guid;
+	uint64_t		dh_flags;
+	uint64_t		dh_start;	/* l2arc_dev_t fields */
+	uint64_t		dh_end;
+	uint64_t		dh_hand;
+	uint64_t		dh_evict;
+	l2arc_log_blkptr_t	dh_head;	/* newest log block */
+	uint64_t		dh_pad[45];	/* pad to 512 bytes */
+	zio_cksum_t		dh_self_cksum;	/* fletcher-4 of the above */
+} l2arc_dev_hdr_phys_t;
+
+/*
+ * A log entry describes one buffer written to the device: its ARC
+ * identity, where it went and the checksum of what was written.
+ */
+typedef struct l2arc_log_ent_phys {
+	dva_t			le_dva;
+	uint64_t		le_birth;
+	uint64_t		le_cksum0;
+	uint64_t		le_prop;	/* see L2BLK_* below */
+	uint64_t		le_daddr;
+	zio_cksum_t		le_cksum;	/* l2arc_buf_hdr_t b_cksum */
+} l2arc_log_ent_phys_t;
+
+#define	L2BLK_GET_LSIZE(field)	\
+	BF64_GET_SB((field), 0, 16, SPA_MINBLOCKSHIFT, 1)
+#define	L2BLK_SET_LSIZE(field, x)	\
+	BF64_SET_SB((field), 0, 16, SPA_MINBLOCKSHIFT, 1, x)
+#define	L2BLK_GET_COMPRESS(field)	BF64_GET((field), 16, 8)
+#define	L2BLK_SET_COMPRESS(field, x)	BF64_SET((field), 16, 8, x)
+#define	L2BLK_GET_TYPE(field)		BF64_GET((field), 24, 1)
+#define	L2BLK_SET_TYPE(field, x)	BF64_SET((field), 24, 1, x)
+#define	L2BLK_GET_INDIRECT(field)	BF64_GET((field), 25, 1)
+#define	L2BLK_SET_INDIRECT(field, x)	BF64_SET((field), 25, 1, x)
+#define	L2BLK_GET_ASIZE(field)		BF64_GET((field), 32, 32)
+#define	L2BLK_SET_ASIZE(field, x)	BF64_SET((field), 32, 32, x)
+
+#define	L2ARC_LOG_BLK_ENTRIES	1022
+
+typedef struct l2arc_log_blk_phys {
+	uint64_t		lb_magic;
+	uint64_t		lb_nents;
+	l2arc_log_blkptr_t	lb_prev;	/* previous log block */
+	l2arc_log_ent_phys_t	lb_entries[L2ARC_LOG_BLK_ENTRIES];
+} l2arc_log_blk_phys_t;
+
 typedef struct l2arc_dev {
 	vdev_t			*l2ad_vdev;	/* vdev */
 	spa_t			*l2ad_spa;	/* spa */
@@ -781,11 +922,16 @@ typedef struct l2arc_dev {
 	boolean_t		l2ad_writing;	/* currently writing */
 	list_t			*l2ad_buflist;	/* buffer list */
 	list_node_t		l2ad_node;	/* device list node */
+	struct l2arc_log_blk_phys *l2ad_log_blk; /* log block being filled */
+	l2arc_log_blkptr_t	l2ad_log_head;	/* newest log block written */
+	boolean_t		l2ad_rebuild;	/* rebuild in progress */
+	boolean_t		l2ad_rebuild_cancel; /* device being removed */
 } l2arc_dev_t;
 
 static list_t L2ARC_dev_list;			/* device list */
 static list_t *l2arc_dev_list;			/* device list pointer */
 static kmutex_t l2arc_dev_mtx;			/* device list mutex */
+static kcondvar_t l2arc_rebuild_cv;		/* signals rebuild done */
 static l2arc_dev_t *l2arc_dev_last;		/* last device used */
 static kmutex_t l2arc_buflist_mtx;		/* mutex for all buflists */
 static list_t L2ARC_free_on_write;		/* free after write buf list */
@@ -800,6 +946,7 @@ typedef struct l2arc_read_callback {
 	zbookmark_t		l2rcb_zb;		/* original bookmark */
 	int			l2rcb_flags;		/* original flags */
 	enum zio_compress	l2rcb_compress;		/* applied compress */
+	zio_cksum_t		l2rcb_cksum;		/* checksum as written */
 } l2arc_read_callback_t;
 
 typedef struct l2arc_write_callback {
@@ -817,6 +964,10 @@ struct l2arc_buf_hdr {
 	int			b_asize;
 	/* temporary buffer holder for in-flight compressed data */
 	void			*b_tmp_cdata;
+	/* the hdr's compressed copy, while it is being written */
+	abd_t			*b_tmp_cabd;
+	/* fletcher-4 of the data as written to the device */
+	zio_cksum_t		b_cksum;
 };
 
 typedef struct l2arc_data_free {
@@ -840,6 +991,11 @@ static void l2arc_decompress_zio(zio_t *zio, arc_buf_hdr_t *hdr,
     enum zio_compress c);
 static void l2arc_release_cdata_buf(arc_buf_hdr_t *ab);
 
+static uint64_t l2arc_log_blk_overhead(l2arc_dev_t *dev, uint64_t write_sz);
+static uint64_t l2arc_log_blk_append(l2arc_dev_t *dev, arc_buf_hdr_t *ab,
+    zio_t *pio);
+static void l2arc_dev_hdr_update(l2arc_dev_t *dev, zio_t *pio);
+
 static uint64_t
 buf_hash(uint64_t spa, const dva_t *dva, uint64_t birth)
 {
@@ -1128,20 +1284,6 @@ arc_cksum_verify(arc_buf_t *buf)
 	mutex_exit(&buf->b_hdr->b_freeze_lock);
 }
 
-static int
-arc_cksum_equal(arc_buf_t *buf)
-{
-	zio_cksum_t zc;
-	int equal;
-
-	mutex_enter(&buf->b_hdr->b_freeze_lock);
-	fletcher_2_native(buf->b_data, buf->b_hdr->b_size, &zc);
-	equal = ZIO_CHECKSUM_EQUAL(*buf->b_hdr->b_freeze_cksum, zc);
-	mutex_exit(&buf->b_hdr->b_freeze_lock);
-
-	return (equal);
-}
-
 static void
 arc_cksum_compute(arc_buf_t *buf, boolean_t force)
 {
@@ -1197,6 +1339,20 @@ arc_buf_freeze(arc_buf_t *buf)
 	mutex_exit(hash_lock);
 }
 
+/*
+ * The space a hdr occupies in its state: all of its data buffers plus
+ * its compressed copy, if it has one.
+ */
+static uint64_t
+arc_hdr_size(arc_buf_hdr_t *ab)
+{
+	uint64_t size = ab->b_size * ab->b_datacnt;
+
+	if (ab->b_pabd != NULL)
+		size += ab->b_psize;
+	return (size);
+}
+
 static void
 add_reference(arc_buf_hdr_t *ab, kmutex_t *hash_lock, void *tag)
 {
@@ -1204,23 +1360,19 @@ add_reference(arc_buf_hdr_t *ab, kmutex_t *hash_lock, void *tag)
 
 	if ((refcount_add(&ab->b_refcnt, tag) == 1) &&
 	    (ab->b_state != arc_anon)) {
-		uint64_t delta = ab->b_size * ab->b_datacnt;
-		list_t *list = &ab->b_state->arcs_list[ab->b_type];
+		uint64_t delta = arc_hdr_size(ab);
 		uint64_t *size = &ab->b_state->arcs_lsize[ab->b_type];
 
-		ASSERT(!MUTEX_HELD(&ab->b_state->arcs_mtx));
-		mutex_enter(&ab->b_state->arcs_mtx);
-		ASSERT(list_link_active(&ab->b_arc_node));
-		list_remove(list, ab);
+		multilist_remove(&ab->b_state->arcs_list[ab->b_type], ab);
 		if (GHOST_STATE(ab->b_state)) {
 			ASSERT3U(ab->b_datacnt, ==, 0);
 			ASSERT3P(ab->b_buf, ==, NULL);
+			ASSERT3P(ab->b_pabd, ==, NULL);
 			delta = ab->b_size;
 		}
 		ASSERT(delta > 0);
 		ASSERT3U(*size, >=, delta);
 		atomic_add_64(size, -delta);
-		mutex_exit(&ab->b_state->arcs_mtx);
 		/* remove the prefetch flag if we get a reference */
 		if (ab->b_flags & ARC_PREFETCH)
 			ab->b_flags &= ~ARC_PREFETCH;
@@ -1240,13 +1392,9 @@ remove_reference(arc_buf_hdr_t *ab, kmutex_t *hash_lock, void *tag)
 	    (state != arc_anon)) {
 		uint64_t *size = &state->arcs_lsize[ab->b_type];
 
-		ASSERT(!MUTEX_HELD(&state->arcs_mtx));
-		mutex_enter(&state->arcs_mtx);
-		ASSERT(!list_link_active(&ab->b_arc_node));
-		list_insert_head(&state->arcs_list[ab->b_type], ab);
+		multilist_insert(&state->arcs_list[ab->b_type], ab);
 		ASSERT(ab->b_datacnt > 0);
-		atomic_add_64(size, ab->b_size * ab->b_datacnt);
-		mutex_exit(&state->arcs_mtx);
+		atomic_add_64(size, arc_hdr_size(ab));
 	}
 	return (cnt);
 }
@@ -1266,9 +1414,10 @@ arc_change_state(arc_state_t *new_state, arc_buf_hdr_t *ab, kmutex_t *hash_lock)
 	ASSERT(new_state != old_state);
 	ASSERT(refcnt == 0 || ab->b_datacnt > 0);
 	ASSERT(ab->b_datacnt == 0 || !GHOST_STATE(new_state));
+	ASSERT(ab->b_pabd == NULL || !GHOST_STATE(new_state));
 	ASSERT(ab->b_datacnt <= 1 || old_state != arc_anon);
 
-	from_delta = to_delta = ab->b_datacnt * ab->b_size;
+	from_delta = to_delta = arc_hdr_size(ab);
 
 	/*
 	 * If this buffer is evictable, transfer it from the
@@ -1276,14 +1425,9 @@ arc_change_state(arc_state_t *new_state, arc_buf_hdr_t *ab, kmutex_t *hash_lock)
 	 */
 	if (refcnt == 0) {
 		if (old_state != arc_anon) {
-			int use_mutex = !MUTEX_HELD(&old_state->arcs_mtx);
 			uint64_t *size = &old_state->arcs_lsize[ab->b_type];
 
-			if (use_mutex)
-				mutex_enter(&old_state->arcs_mtx);
-
-			ASSERT(list_link_active(&ab->b_arc_node));
-			list_remove(&old_state->arcs_list[ab->b_type], ab);
+			multilist_remove(&old_state->arcs_list[ab->b_type], ab);
 
 			/*
 			 * If prefetching out of the ghost cache,
@@ -1296,18 +1440,11 @@ arc_change_state(arc_state_t *new_state, arc_buf_hdr_t *ab, kmutex_t *hash_lock)
 			}
 			ASSERT3U(*size, >=, from_delta);
 			atomic_add_64(size, -from_delta);
-
-			if (use_mutex)
-				mutex_exit(&old_state->arcs_mtx);
 		}
 		if (new_state != arc_anon) {
-			int use_mutex = !MUTEX_HELD(&new_state->arcs_mtx);
 			uint64_t *size = &new_state->arcs_lsize[ab->b_type];
 
-			if (use_mutex)
-				mutex_enter(&new_state->arcs_mtx);
-
-			list_insert_head(&new_state->arcs_list[ab->b_type], ab);
+			multilist_insert(&new_state->arcs_list[ab->b_type], ab);
 
 			/* ghost elements have a ghost size */
 			if (GHOST_STATE(new_state)) {
@@ -1316,9 +1453,6 @@ arc_change_state(arc_state_t *new_state, arc_buf_hdr_t *ab, kmutex_t *hash_lock)
 				to_delta = ab->b_size;
 			}
 			atomic_add_64(size, to_delta);
-
-			if (use_mutex)
-				mutex_exit(&new_state->arcs_mtx);
 		}
 	}
 
@@ -1511,6 +1645,43 @@ arc_buf_clone(arc_buf_t *from)
 	return (buf);
 }
 
+/*
+ * Attach a new buffer to a hdr which only has its compressed copy cached,
+ * and decompress the block into it.  The caller must hold the hash lock
+ * and a reference on the hdr.  If the compressed copy doesn't decompress,
+ * the buffer is torn down again, the hdr is marked ARC_IO_ERROR and EIO
+ * is returned.
+ */
+static int
+arc_buf_decompress(arc_buf_hdr_t *hdr, arc_buf_t **bufp)
+{
+	arc_buf_t *buf;
+
+	ASSERT(hdr->b_pabd != NULL);
+	ASSERT3P(hdr->b_buf, ==, NULL);
+	ASSERT0(hdr->b_datacnt);
+	ASSERT(!refcount_is_zero(&hdr->b_refcnt));
+
+	buf = kmem_cache_alloc(buf_cache, KM_PUSHPAGE);
+	buf->b_hdr = hdr;
+	buf->b_data = NULL;
+	buf->b_efunc = NULL;
+	buf->b_private = NULL;
+	buf->b_next = NULL;
+	hdr->b_buf = buf;
+	hdr->b_datacnt = 1;
+	arc_get_data_buf(buf);
+	if (zio_decompress_data(hdr->b_compress, hdr->b_pabd,
+	    buf->b_data, hdr->b_psize, hdr->b_size) != 0) {
+		hdr->b_flags |= ARC_IO_ERROR;
+		arc_buf_destroy(buf, B_FALSE, B_TRUE);
+		return (EIO);
+	}
+	arc_cksum_verify(buf);
+	*bufp = buf;
+	return (0);
+}
+
 void
 arc_buf_add_ref(arc_buf_t *buf, void* tag)
 {
@@ -1567,6 +1738,79 @@ arc_buf_data_free(arc_buf_hdr_t *hdr, void (*free_func)(void *, size_t),
 	}
 }
 
+static void
+arc_abd_free(void *abd, size_t size)
+{
+	ASSERT3U(((abd_t *)abd)->abd_size, ==, size);
+	abd_free(abd);
+}
+
+/*
+ * Allocate the hdr's compressed copy of the block described by bp, which
+ * the block is then read into directly.  It is accounted for just like a
+ * data buffer of the hdr.
+ */
+static void
+arc_hdr_alloc_pabd(arc_buf_hdr_t *hdr, const blkptr_t *bp)
+{
+	arc_state_t *state = hdr->b_state;
+	uint64_t psize = BP_GET_PSIZE(bp);
+
+	ASSERT3P(hdr->b_pabd, ==, NULL);
+	ASSERT(!GHOST_STATE(state));
+	ASSERT3U(psize, <, hdr->b_size);
+
+	hdr->b_pabd = abd_alloc(psize, hdr->b_type == ARC_BUFC_METADATA);
+	hdr->b_psize = psize;
+	hdr->b_compress = BP_GET_COMPRESS(bp);
+
+	if (hdr->b_type == ARC_BUFC_METADATA) {
+		arc_space_consume(psize, ARC_SPACE_DATA);
+	} else {
+		ARCSTAT_INCR(arcstat_data_size, psize);
+		atomic_add_64(&arc_size, psize);
+	}
+	atomic_add_64(&state->arcs_size, psize);
+	if (list_link_active(&hdr->b_arc_node)) {
+		ASSERT(refcount_is_zero(&hdr->b_refcnt));
+		atomic_add_64(&state->arcs_lsize[hdr->b_type], psize);
+	}
+	ARCSTAT_INCR(arcstat_compressed_size, psize);
+	ARCSTAT_INCR(arcstat_uncompressed_size, hdr->b_size);
+}
+
+static void
+arc_hdr_free_pabd(arc_buf_hdr_t *hdr)
+{
+	arc_state_t *state = hdr->b_state;
+	uint64_t psize = hdr->b_psize;
+
+	ASSERT(hdr->b_pabd != NULL);
+
+	arc_buf_data_free(hdr, arc_abd_free, hdr->b_pabd, psize);
+	if (hdr->b_type == ARC_BUFC_METADATA) {
+		arc_space_return(psize, ARC_SPACE_DATA);
+	} else {
+		ARCSTAT_INCR(arcstat_data_size, -psize);
+		atomic_add_64(&arc_size, -psize);
+	}
+	if (list_link_active(&hdr->b_arc_node)) {
+		uint64_t *cnt = &state->arcs_lsize[hdr->b_type];
+
+		ASSERT(refcount_is_zero(&hdr->b_refcnt));
+		ASSERT3U(*cnt, >=, psize);
+		atomic_add_64(cnt, -psize);
+	}
+	ASSERT3U(state->arcs_size, >=, psize);
+	atomic_add_64(&state->arcs_size, -psize);
+	ARCSTAT_INCR(arcstat_compressed_size, -psize);
+	ARCSTAT_INCR(arcstat_uncompressed_size, -hdr->b_size);
+
+	hdr->b_pabd = NULL;
+	hdr->b_psize = 0;
+	hdr->b_compress = ZIO_COMPRESS_OFF;
+}
+
 static void
 arc_buf_destroy(arc_buf_t *buf, boolean_t recycle, boolean_t all)
 {
@@ -1699,6 +1943,8 @@ arc_hdr_destroy(arc_buf_hdr_t *hdr)
 			arc_buf_destroy(hdr->b_buf, FALSE, TRUE);
 		}
 	}
+	if (hdr->b_pabd != NULL)
+		arc_hdr_free_pabd(hdr);
 	if (hdr->b_freeze_cksum != NULL) {
 		kmem_free(hdr->b_freeze_cksum, sizeof (zio_cksum_t));
 		hdr->b_freeze_cksum = NULL;
@@ -1726,8 +1972,11 @@ arc_buf_free(arc_buf_t *buf, void *tag)
 		hdr = buf->b_hdr;
 		ASSERT3P(hash_lock, ==, HDR_LOCK(hdr));
 
-		(void) remove_reference(hdr, hash_lock, tag);
-		if (hdr->b_datacnt > 1) {
+		if (remove_reference(hdr, hash_lock, tag) == 0 &&
+		    hdr->b_pabd != NULL) {
+			/* keep only the compressed copy cached */
+			arc_buf_destroy(buf, FALSE, TRUE);
+		} else if (hdr->b_datacnt > 1) {
 			arc_buf_destroy(buf, FALSE, TRUE);
 		} else {
 			ASSERT(buf == hdr->b_buf);
@@ -1763,6 +2012,7 @@ arc_buf_remove_ref(arc_buf_t *buf, void* tag)
 	arc_buf_hdr_t *hdr = buf->b_hdr;
 	kmutex_t *hash_lock = HDR_LOCK(hdr);
 	int no_callback = (buf->b_efunc == NULL);
+	int cnt;
 
 	if (hdr->b_state == arc_anon) {
 		ASSERT(hdr->b_datacnt == 1);
@@ -1776,8 +2026,12 @@ arc_buf_remove_ref(arc_buf_t *buf, void* tag)
 	ASSERT(hdr->b_state != arc_anon);
 	ASSERT(buf->b_data != NULL);
 
-	(void) remove_reference(hdr, hash_lock, tag);
-	if (hdr->b_datacnt > 1) {
+	cnt = remove_reference(hdr, hash_lock, tag);
+	if (hdr->b_datacnt > 1 || (cnt == 0 && hdr->b_pabd != NULL)) {
+		/*
+		 * Drop duplicates, and the last decompressed buffer of a
+		 * hdr which keeps its compressed copy cached.
+		 */
 		if (no_callback)
 			arc_buf_destroy(buf, FALSE, TRUE);
 	} else if (no_callback) {
@@ -1840,76 +2094,62 @@ arc_buf_eviction_needed(arc_buf_t *buf)
 }
 
 /*
- * Evict buffers from list until we've removed the specified number of
- * bytes.  Move the removed buffers to the appropriate evict state.
- * If the recycle flag is set, then attempt to "recycle" a buffer:
- * - look for a buffer to evict that is `bytes' long.
- * - return the data block from this buffer rather than freeing it.
- * This flag is used by callers that are trying to make space for a
- * new buffer in a full arc cache.
- *
- * This function makes a "best effort".  It skips over any buffers
- * it can't get a hash_lock on, and so may not catch all candidates.
- * It may also return without evicting as much space as requested.
+ * Evict buffers from the tail of one sublist of a state, as arc_evict()
+ * does, until target bytes are evicted.  The recycle state is carried
+ * across all the sublists a single arc_evict() call walks.
  */
-static void *
-arc_evict(arc_state_t *state, uint64_t spa, int64_t bytes, boolean_t recycle,
-    arc_buf_contents_t type)
+static uint64_t
+arc_evict_sublist(multilist_sublist_t *mls, arc_state_t *evicted_state,
+    uint64_t spa, int64_t bytes, uint64_t target, boolean_t *recycle,
+    void **stolen, arc_buf_contents_t type, uint64_t *skipped,
+    uint64_t *missed)
 {
-	arc_state_t *evicted_state;
-	uint64_t bytes_evicted = 0, skipped = 0, missed = 0;
+	uint64_t bytes_evicted = 0;
 	arc_buf_hdr_t *ab, *ab_prev = NULL;
-	list_t *list = &state->arcs_list[type];
 	kmutex_t *hash_lock;
 	boolean_t have_lock;
-	void *stolen = NULL;
-
-	ASSERT(state == arc_mru || state == arc_mfu);
-
-	evicted_state = (state == arc_mru) ? arc_mru_ghost : arc_mfu_ghost;
 
-	mutex_enter(&state->arcs_mtx);
-	mutex_enter(&evicted_state->arcs_mtx);
-
-	for (ab = list_tail(list); ab; ab = ab_prev) {
-		ab_prev = list_prev(list, ab);
+	for (ab = multilist_sublist_tail(mls); ab; ab = ab_prev) {
+		ab_prev = multilist_sublist_prev(mls, ab);
 		/* prefetch buffers have a minimum lifespan */
 		if (HDR_IO_IN_PROGRESS(ab) ||
 		    (spa && ab->b_spa != spa) ||
 		    (ab->b_flags & (ARC_PREFETCH|ARC_INDIRECT) &&
 		    ddi_get_lbolt() - ab->b_arc_access <
 		    zfs_arc_min_prefetch_lifespan)) {
-			skipped++;
+			(*skipped)++;
 			continue;
 		}
 		/* "lookahead" for better eviction candidate */
-		if (recycle && ab->b_size != bytes &&
+		if (*recycle && ab->b_size != bytes &&
 		    ab_prev && ab_prev->b_size == bytes)
 			continue;
 		hash_lock = HDR_LOCK(ab);
 		have_lock = MUTEX_HELD(hash_lock);
 		if (have_lock || mutex_tryenter(hash_lock)) {
+			boolean_t had_bufs = (ab->b_buf != NULL);
+
 			ASSERT3U(refcount_count(&ab->b_refcnt), ==, 0);
-			ASSERT(ab->b_datacnt > 0);
+			ASSERT(ab->b_datacnt > 0 || ab->b_pabd != NULL);
 			while (ab->b_buf) {
 				arc_buf_t *buf = ab->b_buf;
 				if (!mutex_tryenter(&buf->b_evict_lock)) {
-					missed += 1;
+					(*missed)++;
 					break;
 				}
 				if (buf->b_data) {
 					bytes_evicted += ab->b_size;
-					if (recycle && ab->b_type == type &&
+					if (*recycle && ab->b_type == type &&
 					    ab->b_size == bytes &&
 					    !HDR_L2_WRITING(ab)) {
-						stolen = buf->b_data;
-						recycle = FALSE;
+						*stolen = buf->b_data;
+						*recycle = FALSE;
 					}
 				}
 				if (buf->b_efunc) {
 					mutex_enter(&arc_eviction_mtx);
 					arc_buf_destroy(buf,
-					    buf->b_data == stolen, FALSE);
+					    buf->b_data == *stolen, FALSE);
 					ab->b_buf = buf->b_next;
 					buf->b_hdr = &arc_eviction_hdr;
 					buf->b_next = arc_eviction_list;
@@ -1919,15 +2159,27 @@ arc_evict(arc_state_t *state, uint64_t spa, int64_t bytes, boolean_t recycle,
 				} else {
 					mutex_exit(&buf->b_evict_lock);
 					arc_buf_destroy(buf,
-					    buf->b_data == stolen, TRUE);
+					    buf->b_data == *stolen, TRUE);
 				}
 			}
 
-			if (ab->b_l2hdr) {
-				ARCSTAT_INCR(arcstat_evict_l2_cached,
-				    ab->b_size);
-			} else {
-				if (l2arc_write_eligible(ab->b_spa, ab)) {
+			/*
+			 * A compressed copy outlives the decompressed
+			 * buffers: it is only dropped once it is the tail
+			 * of the list on its own, or when flushing.
+			 */
+			if (ab->b_pabd != NULL && ab->b_datacnt == 0 &&
+			    (!had_bufs || bytes < 0)) {
+				bytes_evicted += ab->b_psize;
+				arc_hdr_free_pabd(ab);
+			}
+
+			if (ab->b_datacnt == 0 && ab->b_pabd == NULL) {
+				if (ab->b_l2hdr) {
+					ARCSTAT_INCR(arcstat_evict_l2_cached,
+					    ab->b_size);
+				} else if (l2arc_write_eligible(ab->b_spa,
+				    ab)) {
 					ARCSTAT_INCR(arcstat_evict_l2_eligible,
 					    ab->b_size);
 				} else {
@@ -1935,9 +2187,7 @@ arc_evict(arc_state_t *state, uint64_t spa, int64_t bytes, boolean_t recycle,
 					    arcstat_evict_l2_ineligible,
 					    ab->b_size);
 				}
-			}
 
-			if (ab->b_datacnt == 0) {
 				arc_change_state(evicted_state, ab, hash_lock);
 				ASSERT(HDR_IN_HASH_TABLE(ab));
 				ab->b_flags |= ARC_IN_HASH_TABLE;
@@ -1946,15 +2196,70 @@ arc_evict(arc_state_t *state, uint64_t spa, int64_t bytes, boolean_t recycle,
 			}
 			if (!have_lock)
 				mutex_exit(hash_lock);
-			if (bytes >= 0 && bytes_evicted >= bytes)
+			if (bytes >= 0 && bytes_evicted >= target)
 				break;
 		} else {
-			missed += 1;
+			(*missed)++;
 		}
 	}
 
-	mutex_exit(&evicted_state->arcs_mtx);
-	mutex_exit(&state->arcs_mtx);
+	return (bytes_evicted);
+}
+
+/*
+ * Evict buffers from list until we've removed the specified number of
+ * bytes.  Move the removed buffers to the appropriate evict state.
+ * If the recycle flag is set, then attempt to "recycle" a buffer:
+ * - look for a buffer to evict that is `bytes' long.
+ * - return the data block from this buffer rather than freeing it.
+ * This flag is used by callers that are trying to make space for a
+ * new buffer in a full arc cache.
+ *
+ * This function makes a "best effort".  It skips over any buffers
+ * it can't get a hash_lock on, and so may not catch all candidates.
+ * It may also return without evicting as much space as requested.
+ */
+static void *
+arc_evict(arc_state_t *state, uint64_t spa, int64_t bytes, boolean_t recycle,
+    arc_buf_contents_t type)
+{
+	arc_state_t *evicted_state;
+	uint64_t bytes_evicted = 0, skipped = 0, missed = 0;
+	uint64_t share, progress = 0;
+	multilist_t *ml = &state->arcs_list[type];
+	multilist_sublist_t *mls;
+	void *stolen = NULL;
+	int num_sublists, idx, i;
+
+	ASSERT(state == arc_mru || state == arc_mfu);
+
+	evicted_state = (state == arc_mru) ? arc_mru_ghost : arc_mfu_ghost;
+
+	/*
+	 * Walk the sublists round-robin from a random one, taking an equal
+	 * share from each so that no part of the list gets evicted far
+	 * ahead of the rest.  Go around again as long as that gets closer
+	 * to the target.
+	 */
+	num_sublists = multilist_get_num_sublists(ml);
+	idx = multilist_get_random_index(ml);
+	share = (bytes > 0) ? MAX(bytes / num_sublists, 1) : 0;
+
+	for (i = 0; bytes < 0 || bytes_evicted < bytes; i++) {
+		if (i > 0 && i % num_sublists == 0) {
+			if (bytes < 0 || bytes_evicted == progress)
+				break;
+			progress = bytes_evicted;
+		}
+
+		mls = multilist_sublist_lock(ml, idx);
+		bytes_evicted += arc_evict_sublist(mls, evicted_state, spa,
+		    bytes, MIN(share, bytes - bytes_evicted), &recycle,
+		    &stolen, type, &skipped, &missed);
+		multilist_sublist_unlock(mls);
+
+		idx = (idx + 1) % num_sublists;
+	}
 
 	if (bytes_evicted < bytes)
 		dprintf("only evicted %lld bytes from %x\n",
@@ -2002,71 +2307,82 @@ arc_evict_ghost(arc_state_t *state, uint64_t spa, int64_t bytes,
 {
 	arc_buf_hdr_t *ab, *ab_prev;
 	arc_buf_hdr_t marker;
-	list_t *list = &state->arcs_list[type];
+	multilist_t *ml = &state->arcs_list[type];
+	multilist_sublist_t *mls;
 	kmutex_t *hash_lock;
 	uint64_t bytes_deleted = 0;
 	uint64_t bufs_skipped = 0;
+	int num_sublists, idx, i;
 
 	ASSERT(GHOST_STATE(state));
 	bzero(&marker, sizeof(marker));
 top:
-	mutex_enter(&state->arcs_mtx);
-	for (ab = list_tail(list); ab; ab = ab_prev) {
-		ab_prev = list_prev(list, ab);
-		if (spa && ab->b_spa != spa)
-			continue;
+	num_sublists = multilist_get_num_sublists(ml);
+	idx = multilist_get_random_index(ml);
+	for (i = 0; i < num_sublists; i++, idx = (idx + 1) % num_sublists) {
+		mls = multilist_sublist_lock(ml, idx);
+		for (ab = multilist_sublist_tail(mls); ab; ab = ab_prev) {
+			ab_prev = multilist_sublist_prev(mls, ab);
+			if (spa && ab->b_spa != spa)
+				continue;
 
-		/* ignore markers */
-		if (ab->b_spa == 0)
-			continue;
+			/* ignore markers */
+			if (ab->b_spa == 0)
+				continue;
 
-		hash_lock = HDR_LOCK(ab);
-		/* caller may be trying to modify this buffer, skip it */
-		if (MUTEX_HELD(hash_lock))
-			continue;
-		if (mutex_tryenter(hash_lock)) {
-			ASSERT(!HDR_IO_IN_PROGRESS(ab));
-			ASSERT(ab->b_buf == NULL);
-			ARCSTAT_BUMP(arcstat_deleted);
-			bytes_deleted += ab->b_size;
+			hash_lock = HDR_LOCK(ab);
+			/* caller may be trying to modify this buffer */
+			if (MUTEX_HELD(hash_lock))
+				continue;
+			if (mutex_tryenter(hash_lock)) {
+				ASSERT(!HDR_IO_IN_PROGRESS(ab));
+				ASSERT(ab->b_buf == NULL);
+				ARCSTAT_BUMP(arcstat_deleted);
+				bytes_deleted += ab->b_size;
+
+				if (ab->b_l2hdr != NULL) {
+					/*
+					 * This buffer is cached on the 2nd
+					 * Level ARC; don't destroy the header.
+					 */
+					arc_change_state(arc_l2c_only, ab,
+					    hash_lock);
+					mutex_exit(hash_lock);
+				} else {
+					arc_change_state(arc_anon, ab,
+					    hash_lock);
+					mutex_exit(hash_lock);
+					arc_hdr_destroy(ab);
+				}
 
-			if (ab->b_l2hdr != NULL) {
+				DTRACE_PROBE1(arc__delete, arc_buf_hdr_t *, ab);
+				if (bytes >= 0 && bytes_deleted >= bytes)
+					break;
+			} else if (bytes < 0) {
 				/*
-				 * This buffer is cached on the 2nd Level ARC;
-				 * don't destroy the header.
+				 * Insert a list marker and then wait for the
+				 * hash lock to become available. Once its
+				 * available, restart from where we left off.
 				 */
-				arc_change_state(arc_l2c_only, ab, hash_lock);
-				mutex_exit(hash_lock);
-			} else {
-				arc_change_state(arc_anon, ab, hash_lock);
+				multilist_sublist_insert_after(mls, ab,
+				    &marker);
+				multilist_sublist_unlock(mls);
+				mutex_enter(hash_lock);
 				mutex_exit(hash_lock);
-				arc_hdr_destroy(ab);
-			}
-
-			DTRACE_PROBE1(arc__delete, arc_buf_hdr_t *, ab);
-			if (bytes >= 0 && bytes_deleted >= bytes)
-				break;
-		} else if (bytes < 0) {
-			/*
-			 * Insert a list marker and then wait for the
-			 * hash lock to become available. Once its
-			 * available, restart from where we left off.
-			 */
-			list_insert_after(list, ab, &marker);
-			mutex_exit(&state->arcs_mtx);
-			mutex_enter(hash_lock);
-			mutex_exit(hash_lock);
-			mutex_enter(&state->arcs_mtx);
-			ab_prev = list_prev(list, &marker);
-			list_remove(list, &marker);
-		} else
-			bufs_skipped += 1;
+				mls = multilist_sublist_lock(ml, idx);
+				ab_prev = multilist_sublist_prev(mls, &marker);
+				multilist_sublist_remove(mls, &marker);
+			} else
+				bufs_skipped += 1;
+		}
+		multilist_sublist_unlock(mls);
+		if (bytes >= 0 && bytes_deleted >= bytes)
+			break;
 	}
-	mutex_exit(&state->arcs_mtx);
 
-	if (list == &state->arcs_list[ARC_BUFC_DATA] &&
+	if (ml == &state->arcs_list[ARC_BUFC_DATA] &&
 	    (bytes < 0 || bytes_deleted < bytes)) {
-		list = &state->arcs_list[ARC_BUFC_METADATA];
+		ml = &state->arcs_list[ARC_BUFC_METADATA];
 		goto top;
 	}
 
@@ -2257,22 +2573,22 @@ arc_flush(spa_t *spa)
 	if (spa)
 		guid = spa_load_guid(spa);
 
-	while (list_head(&arc_mru->arcs_list[ARC_BUFC_DATA])) {
+	while (!multilist_is_empty(&arc_mru->arcs_list[ARC_BUFC_DATA])) {
 		(void) arc_evict(arc_mru, guid, -1, FALSE, ARC_BUFC_DATA);
 		if (spa)
 			break;
 	}
-	while (list_head(&arc_mru->arcs_list[ARC_BUFC_METADATA])) {
+	while (!multilist_is_empty(&arc_mru->arcs_list[ARC_BUFC_METADATA])) {
 		(void) arc_evict(arc_mru, guid, -1, FALSE, ARC_BUFC_METADATA);
 		if (spa)
 			break;
 	}
-	while (list_head(&arc_mfu->arcs_list[ARC_BUFC_DATA])) {
+	while (!multilist_is_empty(&arc_mfu->arcs_list[ARC_BUFC_DATA])) {
 		(void) arc_evict(arc_mfu, guid, -1, FALSE, ARC_BUFC_DATA);
 		if (spa)
 			break;
 	}
-	while (list_head(&arc_mfu->arcs_list[ARC_BUFC_METADATA])) {
+	while (!multilist_is_empty(&arc_mfu->arcs_list[ARC_BUFC_METADATA])) {
 		(void) arc_evict(arc_mfu, guid, -1, FALSE, ARC_BUFC_METADATA);
 		if (spa)
 			break;
@@ -2538,6 +2854,13 @@ arc_reclaim_thread(void *dummy __unused)
 
         arc_adjust();
 
+        /*
+         * The dbuf caches pin arc buffers; trim them so the ARC can
+         * actually get back under arc_c.
+         */
+        if (arc_dbuf_reclaim && arc_size > arc_c)
+            dbuf_cache_reclaim();
+
 
 #ifdef _KARNEL
         {
@@ -3159,20 +3482,38 @@ arc_read_done(zio_t *zio)
 	buf = zio->io_private;
 	hdr = buf->b_hdr;
 
+	/*
+	 * Compressed blocks are read into the hdr's compressed copy,
+	 * otherwise b_data was only wrapped in an ABD for the read.
+	 */
+	if (zio->io_abd != hdr->b_pabd)
+		abd_put(zio->io_abd);
+	else if (zio->io_error == 0 &&
+	    zio_decompress_data(hdr->b_compress, hdr->b_pabd, buf->b_data,
+	    hdr->b_psize, hdr->b_size) != 0)
+		zio->io_error = EIO;
+
 	/*
 	 * The hdr was inserted into hash-table and removed from lists
 	 * prior to starting I/O.  We should find this header, since
 	 * it's in the hash table, and it should be legit since it's
 	 * not possible to evict it during the I/O.  The only possible
 	 * reason for it not to be found is if we were freed during the
-	 * read.
+	 * read.  Embedded blocks are never put in the hash table.
 	 */
-	found = buf_hash_find(hdr->b_spa, &hdr->b_dva, hdr->b_birth,
-	    &hash_lock);
-
-	ASSERT((found == NULL && HDR_FREED_IN_READ(hdr) && hash_lock == NULL) ||
-	    (found == hdr && DVA_EQUAL(&hdr->b_dva, BP_IDENTITY(zio->io_bp))) ||
-	    (found == hdr && HDR_L2_READING(hdr)));
+	if (HDR_IN_HASH_TABLE(hdr)) {
+		found = buf_hash_find(hdr->b_spa, &hdr->b_dva, hdr->b_birth,
+		    &hash_lock);
+
+		ASSERT((found == NULL && HDR_FREED_IN_READ(hdr) &&
+		    hash_lock == NULL) ||
+		    (found == hdr &&
+		    DVA_EQUAL(&hdr->b_dva, BP_IDENTITY(zio->io_bp))) ||
+		    (found == hdr && HDR_L2_READING(hdr)));
+	} else {
+		ASSERT(BP_IS_EMBEDDED(zio->io_bp));
+		hash_lock = NULL;
+	}
 
 	hdr->b_flags &= ~ARC_L2_EVICTED;
 	if (l2arc_noprefetch && (hdr->b_flags & ARC_PREFETCH))
@@ -3227,6 +3568,8 @@ arc_read_done(zio_t *zio)
 
 	if (zio->io_error != 0) {
 		hdr->b_flags |= ARC_IO_ERROR;
+		if (hdr->b_pabd != NULL)
+			arc_hdr_free_pabd(hdr);
 		if (hdr->b_state != arc_anon)
 			arc_change_state(arc_anon, hdr, hash_lock);
 		if (HDR_IN_HASH_TABLE(hdr))
@@ -3248,7 +3591,7 @@ arc_read_done(zio_t *zio)
 		 * This block was freed while we waited for the read to
 		 * complete.  It has been removed from the hash table and
 		 * moved to the anonymous state (so that it won't show up
-		 * in the cache).
+		 * in the cache).  Embedded blocks are always anonymous.
 		 */
 		ASSERT3P(hdr->b_state, ==, arc_anon);
 		freeable = refcount_is_zero(&hdr->b_refcnt);
@@ -3300,16 +3643,28 @@ arc_read(zio_t *pio, spa_t *spa, const blkptr_t *bp,
     arc_done_func_t *done, void *private, int priority, int zio_flags,
     uint32_t *arc_flags, const zbookmark_t *zb)
 {
-	arc_buf_hdr_t *hdr;
+	arc_buf_hdr_t *hdr = NULL;
 	arc_buf_t *buf = NULL;
-	kmutex_t *hash_lock;
+	kmutex_t *hash_lock = NULL;
 	zio_t *rzio;
 	uint64_t guid = spa_load_guid(spa);
+	boolean_t embedded_bp = !!BP_IS_EMBEDDED(bp);
+	boolean_t freeable;
+
+	/*
+	 * Embedded BP's have no DVA and require no I/O to "read", so they
+	 * are never cached: each read decodes the bp into a new anonymous
+	 * buffer.  That makes a prefetch of one pointless.
+	 */
+	if (embedded_bp && done == NULL)
+		return (0);
 
 top:
-	hdr = buf_hash_find(guid, BP_IDENTITY(bp), BP_PHYSICAL_BIRTH(bp),
-	    &hash_lock);
-	if (hdr && hdr->b_datacnt > 0) {
+	if (!embedded_bp) {
+		hdr = buf_hash_find(guid, BP_IDENTITY(bp),
+		    BP_PHYSICAL_BIRTH(bp), &hash_lock);
+	}
+	if (hdr && (hdr->b_datacnt > 0 || hdr->b_pabd != NULL)) {
 
 		*arc_flags |= ARC_CACHED;
 
@@ -3354,14 +3709,33 @@ top:
 			 * that arc_release() will always succeed.
 			 */
 			buf = hdr->b_buf;
-			ASSERT(buf);
-			ASSERT(buf->b_data);
-			if (HDR_BUF_AVAILABLE(hdr)) {
+			if (buf == NULL) {
+				/* only the compressed copy is cached */
+				if (arc_buf_decompress(hdr, &buf) != 0) {
+					/*
+					 * The copy is bad.  Drop the hdr from
+					 * the cache as arc_read_done() does
+					 * after a failed read, and read the
+					 * block again.  If it is corrupt on
+					 * disk too, that read returns EIO.
+					 */
+					arc_hdr_free_pabd(hdr);
+					arc_change_state(arc_anon, hdr,
+					    hash_lock);
+					freeable = (remove_reference(hdr,
+					    hash_lock, private) == 0);
+					mutex_exit(hash_lock);
+					if (freeable)
+						arc_hdr_destroy(hdr);
+					goto top;
+				}
+			} else if (HDR_BUF_AVAILABLE(hdr)) {
 				ASSERT(buf->b_efunc == NULL);
 				hdr->b_flags &= ~ARC_BUF_AVAILABLE;
 			} else {
 				buf = arc_buf_clone(buf);
 			}
+			ASSERT(buf->b_data);
 
 		} else if (*arc_flags & ARC_PREFETCH &&
 		    refcount_count(&hdr->b_refcnt) == 0) {
@@ -3390,14 +3764,16 @@ top:
 
 		if (hdr == NULL) {
 			/* this block is not in the cache */
-			arc_buf_hdr_t	*exists;
+			arc_buf_hdr_t	*exists = NULL;
 			arc_buf_contents_t type = BP_GET_BUFC_TYPE(bp);
 			buf = arc_buf_alloc(spa, size, private, type);
 			hdr = buf->b_hdr;
-			hdr->b_dva = *BP_IDENTITY(bp);
-			hdr->b_birth = BP_PHYSICAL_BIRTH(bp);
-			hdr->b_cksum0 = bp->blk_cksum.zc_word[0];
-			exists = buf_hash_insert(hdr, &hash_lock);
+			if (!embedded_bp) {
+				hdr->b_dva = *BP_IDENTITY(bp);
+				hdr->b_birth = BP_PHYSICAL_BIRTH(bp);
+				hdr->b_cksum0 = bp->blk_cksum.zc_word[0];
+				exists = buf_hash_insert(hdr, &hash_lock);
+			}
 			if (exists) {
 				/* somebody beat us to the hash insert */
 				mutex_exit(hash_lock);
@@ -3468,7 +3844,18 @@ top:
 				vd = NULL;
 		}
 
-		mutex_exit(hash_lock);
+		/*
+		 * Unless it is coming from the L2ARC, read a compressed
+		 * block as-is into a compressed copy kept by the hdr;
+		 * arc_read_done() decompresses it into the buffer.
+		 */
+		if (zfs_compressed_arc_enabled && vd == NULL && !embedded_bp &&
+		    BP_GET_COMPRESS(bp) != ZIO_COMPRESS_OFF &&
+		    BP_GET_PSIZE(bp) < size && !BP_SHOULD_BYTESWAP(bp))
+			arc_hdr_alloc_pabd(hdr, bp);
+
+		if (hash_lock != NULL)
+			mutex_exit(hash_lock);
 
 		ASSERT3U(hdr->b_size, ==, size);
 		DTRACE_PROBE4(arc__miss, arc_buf_hdr_t *, hdr, blkptr_t *, bp,
@@ -3504,6 +3891,7 @@ top:
 				cb->l2rcb_zb = *zb;
 				cb->l2rcb_flags = zio_flags;
 				cb->l2rcb_compress = hdr->b_l2hdr->b_compress;
+				cb->l2rcb_cksum = hdr->b_l2hdr->b_cksum;
 
 				/*
 				 * l2arc read.  The SCL_L2ARC lock will be
@@ -3522,7 +3910,9 @@ top:
 				} else {
 					rzio = zio_read_phys(pio, vd, addr,
 					    hdr->b_l2hdr->b_asize,
-					    buf->b_data, ZIO_CHECKSUM_OFF,
+					    abd_get_from_buf(buf->b_data,
+					    hdr->b_l2hdr->b_asize),
+					    ZIO_CHECKSUM_OFF,
 					    l2arc_read_done, cb, priority,
 					    zio_flags | ZIO_FLAG_DONT_CACHE |
 					    ZIO_FLAG_CANFAIL |
@@ -3562,8 +3952,15 @@ top:
 			}
 		}
 
-		rzio = zio_read(pio, spa, bp, buf->b_data, size,
-		    arc_read_done, buf, priority, zio_flags, zb);
+		if (hdr->b_pabd != NULL) {
+			rzio = zio_read(pio, spa, bp, hdr->b_pabd,
+			    hdr->b_psize, arc_read_done, buf, priority,
+			    zio_flags | ZIO_FLAG_RAW, zb);
+		} else {
+			rzio = zio_read(pio, spa, bp,
+			    abd_get_from_buf(buf->b_data, size), size,
+			    arc_read_done, buf, priority, zio_flags, zb);
+		}
 
 		if (*arc_flags & ARC_WAIT)
 			return (zio_wait(rzio));
@@ -3669,7 +4066,7 @@ arc_buf_evict(arc_buf_t *buf)
 	ASSERT(buf->b_data != NULL);
 	arc_buf_destroy(buf, FALSE, FALSE);
 
-	if (hdr->b_datacnt == 0) {
+	if (hdr->b_datacnt == 0 && hdr->b_pabd == NULL) {
 		arc_state_t *old_state = hdr->b_state;
 		arc_state_t *evicted_state;
 
@@ -3679,16 +4076,10 @@ arc_buf_evict(arc_buf_t *buf)
 		evicted_state =
 		    (old_state == arc_mru) ? arc_mru_ghost : arc_mfu_ghost;
 
-		mutex_enter(&old_state->arcs_mtx);
-		mutex_enter(&evicted_state->arcs_mtx);
-
 		arc_change_state(evicted_state, hdr, hash_lock);
 		ASSERT(HDR_IN_HASH_TABLE(hdr));
 		hdr->b_flags |= ARC_IN_HASH_TABLE;
 		hdr->b_flags &= ~ARC_BUF_AVAILABLE;
-
-		mutex_exit(&evicted_state->arcs_mtx);
-		mutex_exit(&old_state->arcs_mtx);
 	}
 	mutex_exit(hash_lock);
 	mutex_exit(&buf->b_evict_lock);
@@ -3812,6 +4203,9 @@ arc_release(arc_buf_t *buf, void *tag)
 		ASSERT(!HDR_IO_IN_PROGRESS(hdr));
 		if (hdr->b_state != arc_anon)
 			arc_change_state(arc_anon, hdr, hash_lock);
+		/* the buffer is about to be modified */
+		if (hdr->b_pabd != NULL)
+			arc_hdr_free_pabd(hdr);
 		hdr->b_arc_access = 0;
 		if (hash_lock)
 			mutex_exit(hash_lock);
@@ -3917,19 +4311,25 @@ arc_write_done(zio_t *zio)
 
 	ASSERT(hdr->b_acb == NULL);
 
+	abd_put(zio->io_abd);
+
 	if (zio->io_error == 0) {
-		hdr->b_dva = *BP_IDENTITY(zio->io_bp);
-		hdr->b_birth = BP_PHYSICAL_BIRTH(zio->io_bp);
-		hdr->b_cksum0 = zio->io_bp->blk_cksum.zc_word[0];
+		if (BP_IS_HOLE(zio->io_bp) || BP_IS_EMBEDDED(zio->io_bp)) {
+			buf_discard_identity(hdr);
+		} else {
+			hdr->b_dva = *BP_IDENTITY(zio->io_bp);
+			hdr->b_birth = BP_PHYSICAL_BIRTH(zio->io_bp);
+			hdr->b_cksum0 = zio->io_bp->blk_cksum.zc_word[0];
+		}
 	} else {
 		ASSERT(BUF_EMPTY(hdr));
 	}
 
 	/*
-	 * If the block to be written was all-zero, we may have
-	 * compressed it away.  In this case no write was performed
-	 * so there will be no dva/birth/checksum.  The buffer must
-	 * therefore remain anonymous (and uncached).
+	 * If the block to be written was all-zero or was embedded in its
+	 * bp, we may have compressed it away.  In this case no write was
+	 * performed so there will be no dva/birth/checksum.  The buffer
+	 * must therefore remain anonymous (and uncached).
 	 */
 	if (!BUF_EMPTY(hdr)) {
 		arc_buf_hdr_t *exists;
@@ -4004,7 +4404,8 @@ arc_write(zio_t *pio, spa_t *spa, uint64_t txg,
 	callback->awcb_private = private;
 	callback->awcb_buf = buf;
 
-	zio = zio_write(pio, spa, txg, bp, buf->b_data, hdr->b_size, zp,
+	zio = zio_write(pio, spa, txg, bp,
+	    abd_get_from_buf(buf->b_data, hdr->b_size), hdr->b_size, zp,
 	    arc_write_ready, arc_write_done, callback, priority, zio_flags, zb);
 
 	return (zio);
@@ -4028,7 +4429,7 @@ arc_memory_throttle(uint64_t reserve, uint64_t inflight_data, uint64_t txg)
     //available_memory >>= 2;
 #endif
 
-	if (available_memory <= zfs_write_limit_max) {
+	if (available_memory <= zfs_dirty_data_max) {
 		ARCSTAT_INCR(arcstat_memory_throttle_count, 1);
 		DMU_TX_STAT_BUMP(dmu_tx_memory_reclaim);
 		return (EAGAIN);
@@ -4152,6 +4553,62 @@ arc_kstat_update(kstat_t *ksp, int rw)
 	return (0);
 }
 
+/*
+ * Spread buffers across the sublists of a state by the hash of their
+ * identity, which does not change while they are on any of the lists.
+ */
+static unsigned int
+arc_state_multilist_index_func(multilist_t *ml, void *obj)
+{
+	arc_buf_hdr_t *hdr = obj;
+
+	ASSERT(!BUF_EMPTY(hdr));
+	return ((unsigned int)(buf_hash(hdr->b_spa, &hdr->b_dva,
+	    hdr->b_birth) % multilist_get_num_sublists(ml)));
+}
+
+static void
+arc_state_init(arc_state_t *state)
+{
+	int t;
+
+	for (t = 0; t < ARC_BUFC_NUMTYPES; t++) {
+		multilist_create(&state->arcs_list[t], sizeof (arc_buf_hdr_t),
+		    offsetof(arc_buf_hdr_t, b_arc_node),
+		    zfs_arc_num_sublists_per_state,
+		    arc_state_multilist_index_func);
+	}
+}
+
+static void
+arc_state_fini(arc_state_t *state)
+{
+	int t;
+
+	for (t = 0; t < ARC_BUFC_NUMTYPES; t++)
+		multilist_destroy(&state->arcs_list[t]);
+}
+
+void
+arc_dbuf_reclaim_enable(boolean_t enable)
+{
+	mutex_enter(&arc_reclaim_thr_lock);
+	arc_dbuf_reclaim = enable;
+	mutex_exit(&arc_reclaim_thr_lock);
+}
+
+uint64_t
+arc_max_bytes(void)
+{
+	return (arc_c_max);
+}
+
+uint64_t
+arc_target_bytes(void)
+{
+	return (arc_c);
+}
+
 void
 arc_init(void)
 {
@@ -4231,33 +4688,14 @@ arc_init(void)
 	arc_l2c_only = &ARC_l2c_only;
 	arc_size = 0;
 
-	mutex_init(&arc_anon->arcs_mtx, NULL, MUTEX_DEFAULT, NULL);
-	mutex_init(&arc_mru->arcs_mtx, NULL, MUTEX_DEFAULT, NULL);
-	mutex_init(&arc_mru_ghost->arcs_mtx, NULL, MUTEX_DEFAULT, NULL);
-	mutex_init(&arc_mfu->arcs_mtx, NULL, MUTEX_DEFAULT, NULL);
-	mutex_init(&arc_mfu_ghost->arcs_mtx, NULL, MUTEX_DEFAULT, NULL);
-	mutex_init(&arc_l2c_only->arcs_mtx, NULL, MUTEX_DEFAULT, NULL);
-
-	list_create(&arc_mru->arcs_list[ARC_BUFC_METADATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
-	list_create(&arc_mru->arcs_list[ARC_BUFC_DATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
-	list_create(&arc_mru_ghost->arcs_list[ARC_BUFC_METADATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
-	list_create(&arc_mru_ghost->arcs_list[ARC_BUFC_DATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
-	list_create(&arc_mfu->arcs_list[ARC_BUFC_METADATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
-	list_create(&arc_mfu->arcs_list[ARC_BUFC_DATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
-	list_create(&arc_mfu_ghost->arcs_list[ARC_BUFC_METADATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
-	list_create(&arc_mfu_ghost->arcs_list[ARC_BUFC_DATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
-	list_create(&arc_l2c_only->arcs_list[ARC_BUFC_METADATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
-	list_create(&arc_l2c_only->arcs_list[ARC_BUFC_DATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
+	if (zfs_arc_num_sublists_per_state < 1)
+		zfs_arc_num_sublists_per_state = MAX(max_ncpus, 1);
+
+	arc_state_init(arc_mru);
+	arc_state_init(arc_mru_ghost);
+	arc_state_init(arc_mfu);
+	arc_state_init(arc_mfu_ghost);
+	arc_state_init(arc_l2c_only);
 
 	buf_init();
 
@@ -4291,11 +4729,24 @@ arc_init(void)
 	arc_dead = FALSE;
 	arc_warm = B_FALSE;
 
-	if (zfs_write_limit_max == 0)
-		zfs_write_limit_max = ptob(physmem) >> zfs_write_limit_shift;
-	else
-		zfs_write_limit_shift = 0;
-	mutex_init(&zfs_write_limit_lock, NULL, MUTEX_DEFAULT, NULL);
+	/*
+	 * Calculate maximum amount of dirty data per pool.
+	 *
+	 * If it has been set by a module parameter, take that.
+	 * Otherwise, use a percentage of physical memory defined by
+	 * zfs_dirty_data_max_percent (default 10%) with a cap at
+	 * zfs_dirty_data_max_max (default 25% of physical memory).
+	 */
+	if (zfs_dirty_data_max_max == 0)
+		zfs_dirty_data_max_max = ptob(physmem) *
+		    zfs_dirty_data_max_max_percent / 100;
+
+	if (zfs_dirty_data_max == 0) {
+		zfs_dirty_data_max = ptob(physmem) *
+		    zfs_dirty_data_max_percent / 100;
+		zfs_dirty_data_max = MIN(zfs_dirty_data_max,
+		    zfs_dirty_data_max_max);
+	}
 
 #ifdef _KERNEL
     arc_register_oids();
@@ -4355,23 +4806,11 @@ arc_fini(void)
 	cv_destroy(&arc_vmpressure_thr_cv);
 #endif
 
-	list_destroy(&arc_mru->arcs_list[ARC_BUFC_METADATA]);
-	list_destroy(&arc_mru_ghost->arcs_list[ARC_BUFC_METADATA]);
-	list_destroy(&arc_mfu->arcs_list[ARC_BUFC_METADATA]);
-	list_destroy(&arc_mfu_ghost->arcs_list[ARC_BUFC_METADATA]);
-	list_destroy(&arc_mru->arcs_list[ARC_BUFC_DATA]);
-	list_destroy(&arc_mru_ghost->arcs_list[ARC_BUFC_DATA]);
-	list_destroy(&arc_mfu->arcs_list[ARC_BUFC_DATA]);
-	list_destroy(&arc_mfu_ghost->arcs_list[ARC_BUFC_DATA]);
-
-	mutex_destroy(&arc_anon->arcs_mtx);
-	mutex_destroy(&arc_mru->arcs_mtx);
-	mutex_destroy(&arc_mru_ghost->arcs_mtx);
-	mutex_destroy(&arc_mfu->arcs_mtx);
-	mutex_destroy(&arc_mfu_ghost->arcs_mtx);
-	mutex_destroy(&arc_l2c_only->arcs_mtx);
-
-	mutex_destroy(&zfs_write_limit_lock);
+	arc_state_fini(arc_mru);
+	arc_state_fini(arc_mru_ghost);
+	arc_state_fini(arc_mfu);
+	arc_state_fini(arc_mfu_ghost);
+	arc_state_fini(arc_l2c_only);
 
 	buf_fini();
 
@@ -4500,6 +4939,28 @@ arc_fini(void)
  * 8. If an ARC buffer is written (and dirtied) which also exists in the
  * L2ARC, the now stale L2ARC buffer is immediately dropped.
  *
+ * 9. Persistence.  So that a cache device does not start out cold after a
+ * reboot or pool import, the L2ARC also writes down which buffers it holds.
+ * Every buffer written is described by a log entry, and once enough entries
+ * have accumulated they are written out as a log block, inline with the
+ * buffers at the write hand.  Each log block points back to the one written
+ * before it, and a device header right after the vdev labels points to the
+ * newest one:
+ *
+ *	+-----+---------+-----+---------+-----+-- ... --+-----+---------+
+ *	| hdr | buffers | lb0 | buffers | lb1 |         | lbN | buffers |
+ *	+-----+---------+-----+---------+-----+-- ... --+-----+---------+
+ *	                                                           ^
+ *	hdr --> lbN --> ... --> lb1 --> lb0                   write hand
+ *
+ * When the device is added back to the L2ARC, l2arc_dev_rebuild_thread()
+ * walks the log blocks from the newest to the oldest and recreates an
+ * arc_l2c_only header for every buffer the write hand has not since passed
+ * over.  Meanwhile the device is left alone by the feed thread, but buffers
+ * already restored can be read.  Log blocks carry a checksum in the
+ * pointer to them, and entries the checksum of the buffer as written, which
+ * l2arc_read_done() verifies.
+ *
  * The performance of the L2ARC can be tweaked by a number of tunables, which
  * may be necessary for different workloads:
  *
@@ -4514,6 +4975,8 @@ arc_fini(void)
  *				since more compressed buffers are likely to
  *				be present
  *	l2arc_feed_secs		seconds between L2ARC writing
+ *	l2arc_rebuild_enabled	restore the L2ARC from the device log when
+ *				a cache device is added
  *
  * Tunables may be removed or added as future performance improvements are
  * integrated, and also may become zpool properties.
@@ -4629,7 +5092,10 @@ l2arc_dev_get_next(void)
 	first = NULL;
 	next = l2arc_dev_last;
 	do {
-		/* loop around the list looking for a non-faulted vdev */
+		/*
+		 * loop around the list looking for a non-faulted vdev
+		 * which is not being rebuilt
+		 */
 		if (next == NULL) {
 			next = list_head(l2arc_dev_list);
 		} else {
@@ -4644,10 +5110,10 @@ l2arc_dev_get_next(void)
 		else if (next == first)
 			break;
 
-	} while (vdev_is_dead(next->l2ad_vdev));
+	} while (vdev_is_dead(next->l2ad_vdev) || next->l2ad_rebuild);
 
 	/* if we were unable to find any usable vdevs, return NULL */
-	if (vdev_is_dead(next->l2ad_vdev))
+	if (vdev_is_dead(next->l2ad_vdev) || next->l2ad_rebuild)
 		next = NULL;
 
 	l2arc_dev_last = next;
@@ -4690,6 +5156,16 @@ l2arc_do_free_on_write(void)
 	mutex_exit(&l2arc_free_on_write_mtx);
 }
 
+/*
+ * A single buffer write to a cache device has completed; release the ABD
+ * wrapped around its data.  The buffer itself is freed by l2arc_write_done().
+ */
+static void
+l2arc_write_buf_done(zio_t *zio)
+{
+	abd_put(zio->io_abd);
+}
+
 /*
  * A write to a cache device has completed.  Update all headers to allow
  * reads from these buffers to begin.
@@ -4804,16 +5280,25 @@ l2arc_read_done(zio_t *zio)
 	ASSERT3P(hash_lock, ==, HDR_LOCK(hdr));
 
 	/*
-	 * If the buffer was compressed, decompress it first.
+	 * Check this survived the L2ARC journey.  The data is checked as it
+	 * was written to the device, before it is decompressed.  This needs
+	 * nothing but the l2hdr, so it also covers headers which were
+	 * rebuilt from the device's log after a reboot.
 	 */
-	if (cb->l2rcb_compress != ZIO_COMPRESS_OFF)
-		l2arc_decompress_zio(zio, hdr, cb->l2rcb_compress);
-	ASSERT(zio->io_data != NULL);
+	equal = B_TRUE;
+	if (zio->io_error == 0) {
+		zio_cksum_t zc;
+
+		fletcher_4_native(buf->b_data, zio->io_size, &zc);
+		equal = ZIO_CHECKSUM_EQUAL(cb->l2rcb_cksum, zc);
+	}
 
 	/*
-	 * Check this survived the L2ARC journey.
+	 * If the buffer was compressed, decompress it.
 	 */
-	equal = arc_cksum_equal(buf);
+	if (equal && cb->l2rcb_compress != ZIO_COMPRESS_OFF)
+		l2arc_decompress_zio(zio, hdr, cb->l2rcb_compress);
+
 	if (equal && zio->io_error == 0 && !HDR_L2_EVICTED(hdr)) {
 		mutex_exit(hash_lock);
 		zio->io_private = buf;
@@ -4821,6 +5306,13 @@ l2arc_read_done(zio_t *zio)
 		zio->io_bp = &zio->io_bp_copy;	/* XXX fix in L2ARC 2.0	*/
 		arc_read_done(zio);
 	} else {
+		/*
+		 * A bad checksum skipped the decompression above, so the
+		 * sizes are still the compressed size on the cache device.
+		 * The pool read is of the whole logical block into b_data,
+		 * as arc_read() issues it for a buffer headed for the L2ARC.
+		 */
+		zio->io_orig_size = zio->io_size = hdr->b_size;
 		mutex_exit(hash_lock);
 		/*
 		 * Buffer didn't survive caching.  Increment stats and
@@ -4834,6 +5326,9 @@ l2arc_read_done(zio_t *zio)
 		if (!equal)
 			ARCSTAT_BUMP(arcstat_l2_cksum_bad);
 
+		if (zio->io_abd != NULL)
+			abd_put(zio->io_abd);
+
 		/*
 		 * If there's no waiter, issue an async i/o to the primary
 		 * storage now.  If there *is* a waiter, the caller must
@@ -4845,7 +5340,8 @@ l2arc_read_done(zio_t *zio)
 			ASSERT(!pio || pio->io_child_type == ZIO_CHILD_LOGICAL);
 
 			zio_nowait(zio_read(pio, cb->l2rcb_spa, &cb->l2rcb_bp,
-			    buf->b_data, zio->io_size, arc_read_done, buf,
+			    abd_get_from_buf(buf->b_data, zio->io_size),
+			    zio->io_size, arc_read_done, buf,
 			    zio->io_priority, cb->l2rcb_flags, &cb->l2rcb_zb));
 		}
 	}
@@ -4860,38 +5356,36 @@ l2arc_read_done(zio_t *zio)
  * performance.
  *
  * Currently the metadata lists are hit first, MFU then MRU, followed by
- * the data lists.  This function returns a locked list, and also returns
- * the lock pointer.
+ * the data lists.  This function returns a locked sublist of the given
+ * list.
  */
-static list_t *
-l2arc_list_locked(int list_num, kmutex_t **lock)
+static multilist_sublist_t *
+l2arc_sublist_lock(int list_num)
 {
-	list_t *list = NULL;
+	multilist_t *ml = NULL;
 
 	ASSERT(list_num >= 0 && list_num <= 3);
 
 	switch (list_num) {
 	case 0:
-		list = &arc_mfu->arcs_list[ARC_BUFC_METADATA];
-		*lock = &arc_mfu->arcs_mtx;
+		ml = &arc_mfu->arcs_list[ARC_BUFC_METADATA];
 		break;
 	case 1:
-		list = &arc_mru->arcs_list[ARC_BUFC_METADATA];
-		*lock = &arc_mru->arcs_mtx;
+		ml = &arc_mru->arcs_list[ARC_BUFC_METADATA];
 		break;
 	case 2:
-		list = &arc_mfu->arcs_list[ARC_BUFC_DATA];
-		*lock = &arc_mfu->arcs_mtx;
+		ml = &arc_mfu->arcs_list[ARC_BUFC_DATA];
 		break;
 	case 3:
-		list = &arc_mru->arcs_list[ARC_BUFC_DATA];
-		*lock = &arc_mru->arcs_mtx;
+		ml = &arc_mru->arcs_list[ARC_BUFC_DATA];
 		break;
 	}
 
-	ASSERT(!(MUTEX_HELD(*lock)));
-	mutex_enter(*lock);
-	return (list);
+	/*
+	 * A feed cycle only writes a few megabytes, so scanning one sublist
+	 * picked at random is enough; later cycles pick others.
+	 */
+	return (multilist_sublist_lock(ml, multilist_get_random_index(ml)));
 }
 
 /*
@@ -5043,11 +5537,10 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz,
     boolean_t *headroom_boost)
 {
 	arc_buf_hdr_t *ab, *ab_prev, *head;
-	list_t *list;
-	uint64_t write_asize, write_psize, write_sz, headroom,
+	uint64_t write_asize, write_psize, write_sz, log_psize, headroom,
 	    buf_compress_minsz;
 	void *buf_data;
-	kmutex_t *list_lock = NULL;
+	multilist_sublist_t *mls;
 	boolean_t full;
 	l2arc_write_callback_t *cb;
 	zio_t *pio, *wzio;
@@ -5061,7 +5554,7 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz,
 	*headroom_boost = B_FALSE;
 
 	pio = NULL;
-	write_sz = write_asize = write_psize = 0;
+	write_sz = write_asize = write_psize = log_psize = 0;
 	full = B_FALSE;
 	head = kmem_cache_alloc(hdr_cache, KM_PUSHPAGE);
 	head->b_flags |= ARC_L2_WRITE_HEAD;
@@ -5079,7 +5572,7 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz,
 	for (try = 0; try <= 3; try++) {
 		uint64_t passed_sz = 0;
 
-		list = l2arc_list_locked(try, &list_lock);
+		mls = l2arc_sublist_lock(try);
 
 		/*
 		 * L2ARC fast warmup.
@@ -5088,9 +5581,9 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz,
 		 * head of the ARC lists rather than the tail.
 		 */
 		if (arc_warm == B_FALSE)
-			ab = list_head(list);
+			ab = multilist_sublist_head(mls);
 		else
-			ab = list_tail(list);
+			ab = multilist_sublist_tail(mls);
 
 		headroom = target_sz * l2arc_headroom;
 		if (do_headroom_boost)
@@ -5102,9 +5595,9 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz,
 			uint64_t buf_sz;
 
 			if (arc_warm == B_FALSE)
-				ab_prev = list_next(list, ab);
+				ab_prev = multilist_sublist_next(mls, ab);
 			else
-				ab_prev = list_prev(list, ab);
+				ab_prev = multilist_sublist_prev(mls, ab);
 
 			hash_lock = HDR_LOCK(ab);
 			if (!mutex_tryenter(hash_lock)) {
@@ -5167,29 +5660,36 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz,
 			 * without holding the hash_lock, which we in turn
 			 * can't access without holding the ARC list locks
 			 * (which we want to avoid during compression/writing)
+			 *
+			 * A hdr with a compressed copy has it written as is
+			 * rather than compressing the data again; the copy
+			 * cannot be freed before the write completes since
+			 * the hdr is now flagged ARC_L2_WRITING.
 			 */
-			l2hdr->b_compress = ZIO_COMPRESS_OFF;
-			l2hdr->b_asize = ab->b_size;
-			l2hdr->b_tmp_cdata = ab->b_buf->b_data;
+			if (ab->b_pabd != NULL) {
+				l2hdr->b_compress = ab->b_compress;
+				l2hdr->b_asize = ab->b_psize;
+				l2hdr->b_tmp_cabd = ab->b_pabd;
+			} else {
+				l2hdr->b_compress = ZIO_COMPRESS_OFF;
+				l2hdr->b_asize = ab->b_size;
+				l2hdr->b_tmp_cdata = ab->b_buf->b_data;
+
+				/* On debug, the buffer is verified first. */
+				arc_cksum_verify(ab->b_buf);
+			}
 
 			buf_sz = ab->b_size;
 			ab->b_l2hdr = l2hdr;
 
 			list_insert_head(dev->l2ad_buflist, ab);
 
-			/*
-			 * Compute and store the buffer cksum before
-			 * writing.  On debug the cksum is verified first.
-			 */
-			arc_cksum_verify(ab->b_buf);
-			arc_cksum_compute(ab->b_buf, B_TRUE);
-
 			mutex_exit(hash_lock);
 
 			write_sz += buf_sz;
 		}
 
-		mutex_exit(list_lock);
+		multilist_sublist_unlock(mls);
 
 		if (full == B_TRUE)
 			break;
@@ -5223,6 +5723,7 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz,
 		l2hdr->b_daddr = dev->l2ad_hand;
 
 		if (!l2arc_nocompress && (ab->b_flags & ARC_L2COMPRESS) &&
+		    l2hdr->b_compress == ZIO_COMPRESS_OFF &&
 		    l2hdr->b_asize >= buf_compress_minsz) {
 			if (l2arc_compress_buf(l2hdr)) {
 				/*
@@ -5243,10 +5744,28 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz,
 		/* Compression may have squashed the buffer to zero length. */
 		if (buf_sz != 0) {
 			uint64_t buf_p_sz;
+			abd_t *abd;
+
+			/*
+			 * Checksum the data as it goes to the device, so
+			 * that reads can verify it without the ARC having
+			 * to keep a checksum of its own.
+			 */
+			if (l2hdr->b_tmp_cabd != NULL) {
+				abd = abd_get_offset(l2hdr->b_tmp_cabd, 0);
+				buf_data = abd_borrow_buf_copy(abd, buf_sz);
+				fletcher_4_native(buf_data, buf_sz,
+				    &l2hdr->b_cksum);
+				abd_return_buf(abd, buf_data, buf_sz);
+			} else {
+				abd = abd_get_from_buf(buf_data, buf_sz);
+				fletcher_4_native(buf_data, buf_sz,
+				    &l2hdr->b_cksum);
+			}
 
 			wzio = zio_write_phys(pio, dev->l2ad_vdev,
-			    dev->l2ad_hand, buf_sz, buf_data, ZIO_CHECKSUM_OFF,
-			    NULL, NULL, ZIO_PRIORITY_ASYNC_WRITE,
+			    dev->l2ad_hand, buf_sz, abd, ZIO_CHECKSUM_OFF,
+			    l2arc_write_buf_done, NULL, ZIO_PRIORITY_ASYNC_WRITE,
 			    ZIO_FLAG_CANFAIL, B_FALSE);
 
 			DTRACE_PROBE2(l2arc__write, vdev_t *, dev->l2ad_vdev,
@@ -5261,6 +5780,12 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz,
 			write_psize += buf_p_sz;
 			dev->l2ad_hand += buf_p_sz;
 		}
+
+		/*
+		 * Record the buffer in the device's log, which may in turn
+		 * write out a log block at the hand.
+		 */
+		log_psize += l2arc_log_blk_append(dev, ab, pio);
 	}
 
     mutex_exit(&l2arc_buflist_mtx);
@@ -5275,13 +5800,14 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz,
 	ARCSTAT_INCR(arcstat_l2_write_bytes, write_asize);
 	ARCSTAT_INCR(arcstat_l2_size, write_sz);
 	ARCSTAT_INCR(arcstat_l2_asize, write_asize);
-	vdev_space_update(dev->l2ad_vdev, write_psize, 0, 0);
+	vdev_space_update(dev->l2ad_vdev, write_psize + log_psize, 0, 0);
 
 	/*
 	 * Bump device hand to the device start if it is approaching the end.
 	 * l2arc_evict() will already have evicted ahead for this case.
 	 */
-	if (dev->l2ad_hand >= (dev->l2ad_end - target_sz)) {
+	if (dev->l2ad_hand >= (dev->l2ad_end - target_sz -
+	    l2arc_log_blk_overhead(dev, target_sz))) {
 		vdev_space_update(dev->l2ad_vdev,
 		    dev->l2ad_end - dev->l2ad_hand, 0, 0);
 		dev->l2ad_hand = dev->l2ad_start;
@@ -5289,6 +5815,12 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz,
 		dev->l2ad_first = B_FALSE;
 	}
 
+	/*
+	 * Point the device header at the newest log block and record where
+	 * the hand is, so that what was written can be found again.
+	 */
+	l2arc_dev_hdr_update(dev, pio);
+
 	dev->l2ad_writing = B_TRUE;
 	(void) zio_wait(pio);
 	dev->l2ad_writing = B_FALSE;
@@ -5319,6 +5851,7 @@ static boolean_t
 l2arc_compress_buf(l2arc_buf_hdr_t *l2hdr)
 {
 	void *cdata;
+	abd_t *abd;
 	size_t csize, len;
 
 	ASSERT(l2hdr->b_compress == ZIO_COMPRESS_OFF);
@@ -5326,8 +5859,9 @@ l2arc_compress_buf(l2arc_buf_hdr_t *l2hdr)
 
 	len = l2hdr->b_asize;
 	cdata = zio_data_buf_alloc(len);
-	csize = zio_compress_data(ZIO_COMPRESS_LZ4, l2hdr->b_tmp_cdata,
-	    cdata, l2hdr->b_asize);
+	abd = abd_get_from_buf(l2hdr->b_tmp_cdata, len);
+	csize = zio_compress_data(ZIO_COMPRESS_LZ4, abd, cdata, len);
+	abd_put(abd);
 
 	if (csize == 0) {
 		/* zero block, indicate that there's nothing to write */
@@ -5360,7 +5894,7 @@ l2arc_compress_buf(l2arc_buf_hdr_t *l2hdr)
 
 /*
  * Decompresses a zio read back from an l2arc device. On success, the
- * underlying zio's io_data buffer is overwritten by the uncompressed
+ * underlying zio's io_abd buffer is overwritten by the uncompressed
  * version. On decompression error (corrupt compressed stream), the
  * zio->io_error value is set to signal an I/O error.
  *
@@ -5375,7 +5909,7 @@ l2arc_decompress_zio(zio_t *zio, arc_buf_hdr_t *hdr, enum zio_compress c)
 	uint64_t csize;
 	void *cdata;
 
-	ASSERT(L2ARC_IS_VALID_COMPRESS(c));
+	ASSERT(c != ZIO_COMPRESS_OFF && c < ZIO_COMPRESS_FUNCTIONS);
 
 	if (zio->io_error != 0) {
 		/*
@@ -5389,14 +5923,15 @@ l2arc_decompress_zio(zio_t *zio, arc_buf_hdr_t *hdr, enum zio_compress c)
 	if (c == ZIO_COMPRESS_EMPTY) {
 		/*
 		 * An empty buffer results in a null zio, which means we
-		 * need to fill its io_data after we're done restoring the
+		 * need to fill its io_abd after we're done restoring the
 		 * buffer's contents.
 		 */
 		ASSERT(hdr->b_buf != NULL);
 		bzero(hdr->b_buf->b_data, hdr->b_size);
-		zio->io_data = zio->io_orig_data = hdr->b_buf->b_data;
+		zio->io_abd = zio->io_orig_abd =
+		    abd_get_from_buf(hdr->b_buf->b_data, hdr->b_size);
 	} else {
-		ASSERT(zio->io_data != NULL);
+		ASSERT(zio->io_abd != NULL);
 		/*
 		 * We copy the compressed data from the start of the arc buffer
 		 * (the zio_read will have pulled in only what we need, the
@@ -5409,9 +5944,9 @@ l2arc_decompress_zio(zio_t *zio, arc_buf_hdr_t *hdr, enum zio_compress c)
 		 */
 		csize = zio->io_size;
 		cdata = zio_data_buf_alloc(csize);
-		bcopy(zio->io_data, cdata, csize);
-		if (zio_decompress_data(c, cdata, zio->io_data, csize,
-		    hdr->b_size) != 0)
+		abd_copy_to_buf(cdata, zio->io_abd, csize);
+		if (zio_decompress_data_buf(c, cdata, abd_to_buf(zio->io_abd),
+		    csize, hdr->b_size) != 0)
 			zio->io_error = EIO;
 		zio_data_buf_free(cdata, csize);
 	}
@@ -5431,7 +5966,13 @@ l2arc_release_cdata_buf(arc_buf_hdr_t *ab)
 {
 	l2arc_buf_hdr_t *l2hdr = ab->b_l2hdr;
 
-	if (l2hdr->b_compress == ZIO_COMPRESS_LZ4) {
+	if (l2hdr->b_tmp_cabd != NULL) {
+		/*
+		 * The hdr's compressed copy was written, it stays with
+		 * the hdr.
+		 */
+		l2hdr->b_tmp_cabd = NULL;
+	} else if (l2hdr->b_compress == ZIO_COMPRESS_LZ4) {
 		/*
 		 * If the data was compressed, then we've allocated a
 		 * temporary buffer for it, so now we need to release it.
@@ -5518,9 +6059,11 @@ l2arc_feed_thread(void)
 		size = l2arc_write_size();
 
 		/*
-		 * Evict L2ARC buffers that will be overwritten.
+		 * Evict L2ARC buffers that will be overwritten, by both
+		 * buffers and log blocks.
 		 */
-		l2arc_evict(dev, size, B_FALSE);
+		l2arc_evict(dev, size + l2arc_log_blk_overhead(dev, size),
+		    B_FALSE);
 
 		/*
 		 * Write ARC buffers.
@@ -5540,6 +6083,450 @@ l2arc_feed_thread(void)
 	thread_exit();
 }
 
+/*
+ * Persistent L2ARC support.
+ */
+
+/*
+ * The most device space that log blocks can take up in a single feed cycle
+ * writing write_sz bytes of buffers.  Every buffer is at least
+ * SPA_MINBLOCKSIZE, and the log block in progress may be nearly full.
+ */
+static uint64_t
+l2arc_log_blk_overhead(l2arc_dev_t *dev, uint64_t write_sz)
+{
+	uint64_t nblks;
+
+	nblks = write_sz / (SPA_MINBLOCKSIZE * L2ARC_LOG_BLK_ENTRIES) + 1;
+
+	return (nblks * vdev_psize_to_asize(dev->l2ad_vdev,
+	    sizeof (l2arc_log_blk_phys_t)));
+}
+
+static void
+l2arc_log_write_done(zio_t *zio)
+{
+	abd_free(zio->io_abd);
+}
+
+/*
+ * Write out the log block being filled at the device write hand, and make
+ * it the newest one.  Returns the device space it took up.
+ */
+static uint64_t
+l2arc_log_blk_commit(l2arc_dev_t *dev, zio_t *pio)
+{
+	l2arc_log_blk_phys_t *lb = dev->l2ad_log_blk;
+	l2arc_log_blkptr_t *lbp = &dev->l2ad_log_head;
+	uint64_t size = sizeof (l2arc_log_blk_phys_t);
+	uint64_t asize = vdev_psize_to_asize(dev->l2ad_vdev, size);
+	abd_t *abd;
+
+	ASSERT(MUTEX_HELD(&l2arc_buflist_mtx));
+	ASSERT3U(dev->l2ad_hand + asize, <=, dev->l2ad_end);
+
+	lb->lb_magic = L2ARC_LOG_BLK_MAGIC;
+	lb->lb_prev = *lbp;
+
+	abd = abd_alloc_linear(size, B_TRUE);
+	abd_copy_from_buf(abd, lb, size);
+
+	lbp->lbp_daddr = dev->l2ad_hand;
+	lbp->lbp_size = size;
+	fletcher_4_native(lb, size, &lbp->lbp_cksum);
+
+	(void) zio_nowait(zio_write_phys(pio, dev->l2ad_vdev,
+	    dev->l2ad_hand, size, abd, ZIO_CHECKSUM_OFF,
+	    l2arc_log_write_done, NULL, ZIO_PRIORITY_ASYNC_WRITE,
+	    ZIO_FLAG_CANFAIL, B_FALSE));
+
+	dev->l2ad_hand += asize;
+	bzero(lb, size);
+	ARCSTAT_BUMP(arcstat_l2_log_blk_writes);
+
+	return (asize);
+}
+
+/*
+ * Describe a buffer which is being written to the device in the log block
+ * being filled, writing the log block out once it is full.  The buffer's
+ * identity is stable, since l2arc_buflist_mtx keeps it from being released.
+ * Returns the device space taken up by the log, if any was written.
+ */
+static uint64_t
+l2arc_log_blk_append(l2arc_dev_t *dev, arc_buf_hdr_t *ab, zio_t *pio)
+{
+	l2arc_log_blk_phys_t *lb = dev->l2ad_log_blk;
+	l2arc_buf_hdr_t *l2hdr = ab->b_l2hdr;
+	l2arc_log_ent_phys_t *le;
+
+	ASSERT(MUTEX_HELD(&l2arc_buflist_mtx));
+	ASSERT3U(lb->lb_nents, <, L2ARC_LOG_BLK_ENTRIES);
+
+	le = &lb->lb_entries[lb->lb_nents++];
+	le->le_dva = ab->b_dva;
+	le->le_birth = ab->b_birth;
+	le->le_cksum0 = ab->b_cksum0;
+	le->le_daddr = l2hdr->b_daddr;
+	le->le_cksum = l2hdr->b_cksum;
+	le->le_prop = 0;
+	L2BLK_SET_LSIZE(le->le_prop, ab->b_size);
+	L2BLK_SET_ASIZE(le->le_prop, l2hdr->b_asize);
+	L2BLK_SET_COMPRESS(le->le_prop, l2hdr->b_compress);
+	L2BLK_SET_TYPE(le->le_prop, ab->b_type);
+	L2BLK_SET_INDIRECT(le->le_prop, (ab->b_flags & ARC_INDIRECT) != 0);
+
+	if (lb->lb_nents < L2ARC_LOG_BLK_ENTRIES)
+		return (0);
+
+	return (l2arc_log_blk_commit(dev, pio));
+}
+
+/*
+ * Write out the device header with the current write hand and newest log
+ * block, at the end of a feed cycle.
+ */
+static void
+l2arc_dev_hdr_update(l2arc_dev_t *dev, zio_t *pio)
+{
+	l2arc_dev_hdr_phys_t *dh;
+	abd_t *abd;
+
+	abd = abd_alloc_linear(sizeof (l2arc_dev_hdr_phys_t), B_TRUE);
+	dh = abd_to_buf(abd);
+	bzero(dh, sizeof (l2arc_dev_hdr_phys_t));
+
+	dh->dh_magic = L2ARC_DEV_HDR_MAGIC;
+	dh->dh_version = L2ARC_PERSIST_VERSION;
+	dh->dh_spa_guid = spa_guid(dev->l2ad_spa);
+	dh->dh_vdev_guid = dev->l2ad_vdev->vdev_guid;
+	if (dev->l2ad_first)
+		dh->dh_flags |= L2ARC_DEV_HDR_FIRST;
+	dh->dh_start = dev->l2ad_start;
+	dh->dh_end = dev->l2ad_end;
+	dh->dh_hand = dev->l2ad_hand;
+	dh->dh_evict = dev->l2ad_evict;
+	dh->dh_head = dev->l2ad_log_head;
+	fletcher_4_native(dh, offsetof(l2arc_dev_hdr_phys_t, dh_self_cksum),
+	    &dh->dh_self_cksum);
+
+	(void) zio_nowait(zio_write_phys(pio, dev->l2ad_vdev,
+	    VDEV_LABEL_START_SIZE, sizeof (l2arc_dev_hdr_phys_t), abd,
+	    ZIO_CHECKSUM_OFF, l2arc_log_write_done, NULL,
+	    ZIO_PRIORITY_ASYNC_WRITE, ZIO_FLAG_CANFAIL, B_FALSE));
+}
+
+/*
+ * Read some persistent L2ARC metadata from the device, and check it against
+ * the checksum it was written with.
+ */
+static int
+l2arc_log_read(l2arc_dev_t *dev, uint64_t daddr, uint64_t size, abd_t *abd,
+    const zio_cksum_t *cksum)
+{
+	zio_cksum_t zc;
+	int err;
+
+	err = zio_wait(zio_read_phys(NULL, dev->l2ad_vdev, daddr, size, abd,
+	    ZIO_CHECKSUM_OFF, NULL, NULL, ZIO_PRIORITY_ASYNC_READ,
+	    ZIO_FLAG_DONT_CACHE | ZIO_FLAG_CANFAIL |
+	    ZIO_FLAG_DONT_PROPAGATE | ZIO_FLAG_DONT_RETRY, B_FALSE));
+	if (err != 0)
+		return (err);
+
+	fletcher_4_native(abd_to_buf(abd), size, &zc);
+	if (!ZIO_CHECKSUM_EQUAL(zc, *cksum))
+		return (ECKSUM);
+
+	return (0);
+}
+
+/*
+ * Read the device header, and check that it describes this device.
+ */
+static int
+l2arc_dev_hdr_read(l2arc_dev_t *dev, l2arc_dev_hdr_phys_t *dh)
+{
+	uint64_t size = sizeof (l2arc_dev_hdr_phys_t);
+	zio_cksum_t zc;
+	abd_t *abd;
+	int err;
+
+	abd = abd_alloc_linear(size, B_TRUE);
+	err = zio_wait(zio_read_phys(NULL, dev->l2ad_vdev,
+	    VDEV_LABEL_START_SIZE, size, abd, ZIO_CHECKSUM_OFF, NULL, NULL,
+	    ZIO_PRIORITY_ASYNC_READ, ZIO_FLAG_DONT_CACHE | ZIO_FLAG_CANFAIL |
+	    ZIO_FLAG_DONT_PROPAGATE | ZIO_FLAG_DONT_RETRY, B_FALSE));
+	abd_copy_to_buf(dh, abd, size);
+	abd_free(abd);
+	if (err != 0)
+		return (err);
+
+	fletcher_4_native(dh, offsetof(l2arc_dev_hdr_phys_t, dh_self_cksum),
+	    &zc);
+	if (dh->dh_magic != L2ARC_DEV_HDR_MAGIC ||
+	    dh->dh_version != L2ARC_PERSIST_VERSION ||
+	    !ZIO_CHECKSUM_EQUAL(zc, dh->dh_self_cksum) ||
+	    dh->dh_spa_guid != spa_guid(dev->l2ad_spa) ||
+	    dh->dh_vdev_guid != dev->l2ad_vdev->vdev_guid ||
+	    dh->dh_start != dev->l2ad_start || dh->dh_end != dev->l2ad_end ||
+	    dh->dh_hand < dh->dh_start || dh->dh_hand > dh->dh_end ||
+	    dh->dh_evict < dh->dh_start || dh->dh_evict > dh->dh_end)
+		return (ENOTSUP);
+
+	return (0);
+}
+
+/*
+ * Only what the write hand has not passed over since it was written can be
+ * restored: going backwards from the hand, everything up to the point where
+ * l2arc_evict() left off, or to the start of the device on the first sweep.
+ * Within that window, each log block must be older (further behind the
+ * hand) than the one pointing to it, and each buffer older than the log
+ * block describing it; ref_dist is that distance for the referrer.
+ */
+static boolean_t
+l2arc_rebuild_valid(l2arc_dev_t *dev, uint64_t daddr, uint64_t size,
+    uint64_t ref_dist, uint64_t *distp)
+{
+	uint64_t dist, window;
+
+	if (daddr < dev->l2ad_start || daddr + size > dev->l2ad_end)
+		return (B_FALSE);
+
+	if (daddr < dev->l2ad_hand) {
+		if (daddr + size > dev->l2ad_hand)
+			return (B_FALSE);
+		dist = dev->l2ad_hand - daddr;
+	} else {
+		dist = (dev->l2ad_end - daddr) +
+		    (dev->l2ad_hand - dev->l2ad_start);
+	}
+
+	window = dev->l2ad_hand - dev->l2ad_start;
+	if (!dev->l2ad_first)
+		window += dev->l2ad_end - dev->l2ad_evict;
+
+	if (distp != NULL)
+		*distp = dist;
+
+	return (dist > ref_dist && dist <= window);
+}
+
+/*
+ * Recreate the header of a buffer described by a log entry, unless the
+ * ARC already knows of the buffer.  lb_dist is the distance of its log
+ * block behind the write hand.
+ */
+static void
+l2arc_hdr_restore(l2arc_dev_t *dev, const l2arc_log_ent_phys_t *le,
+    uint64_t lb_dist)
+{
+	uint64_t lsize = L2BLK_GET_LSIZE(le->le_prop);
+	uint64_t asize = L2BLK_GET_ASIZE(le->le_prop);
+	enum zio_compress compress = L2BLK_GET_COMPRESS(le->le_prop);
+	arc_buf_hdr_t *hdr, *exists;
+	l2arc_buf_hdr_t *l2hdr;
+	kmutex_t *hash_lock;
+
+	if (lsize > SPA_MAXBLOCKSIZE || asize > lsize ||
+	    compress >= ZIO_COMPRESS_FUNCTIONS ||
+	    (compress == ZIO_COMPRESS_OFF && asize != lsize) ||
+	    (compress == ZIO_COMPRESS_EMPTY && asize != 0))
+		return;
+	if (asize != 0 && !l2arc_rebuild_valid(dev, le->le_daddr,
+	    vdev_psize_to_asize(dev->l2ad_vdev, asize), lb_dist, NULL))
+		return;
+
+	hdr = kmem_cache_alloc(hdr_cache, KM_PUSHPAGE);
+	ASSERT(BUF_EMPTY(hdr));
+	hdr->b_dva = le->le_dva;
+	hdr->b_birth = le->le_birth;
+	hdr->b_cksum0 = le->le_cksum0;
+	hdr->b_size = lsize;
+	hdr->b_type = L2BLK_GET_TYPE(le->le_prop);
+	hdr->b_spa = spa_load_guid(dev->l2ad_spa);
+	hdr->b_state = arc_anon;
+	hdr->b_arc_access = 0;
+	hdr->b_flags = ARC_L2CACHE;
+	if (L2BLK_GET_INDIRECT(le->le_prop))
+		hdr->b_flags |= ARC_INDIRECT;
+
+	exists = buf_hash_insert(hdr, &hash_lock);
+	if (exists != NULL) {
+		/* the ARC already has this buffer, maybe even on L2ARC */
+		mutex_exit(hash_lock);
+		buf_discard_identity(hdr);
+		kmem_cache_free(hdr_cache, hdr);
+		ARCSTAT_BUMP(arcstat_l2_rebuild_bufs_precached);
+		return;
+	}
+
+	l2hdr = kmem_zalloc(sizeof (l2arc_buf_hdr_t), KM_PUSHPAGE);
+	l2hdr->b_dev = dev;
+	l2hdr->b_daddr = le->le_daddr;
+	l2hdr->b_compress = compress;
+	l2hdr->b_asize = asize;
+	l2hdr->b_cksum = le->le_cksum;
+	arc_space_consume(L2HDR_SIZE, ARC_SPACE_L2HDRS);
+	hdr->b_l2hdr = l2hdr;
+
+	arc_change_state(arc_l2c_only, hdr, hash_lock);
+
+	/*
+	 * Entries are restored newest first, so the buflist keeps the order
+	 * l2arc_evict() relies upon.
+	 */
+	mutex_enter(&l2arc_buflist_mtx);
+	list_insert_tail(dev->l2ad_buflist, hdr);
+	mutex_exit(&l2arc_buflist_mtx);
+	mutex_exit(hash_lock);
+
+	ARCSTAT_INCR(arcstat_l2_size, lsize);
+	ARCSTAT_INCR(arcstat_l2_asize, asize);
+	ARCSTAT_BUMP(arcstat_l2_rebuild_bufs);
+	ARCSTAT_INCR(arcstat_l2_rebuild_size, lsize);
+	ARCSTAT_INCR(arcstat_l2_rebuild_asize, asize);
+}
+
+/*
+ * Restore the device's write position and the buffers on it from the
+ * device header and log blocks.  Called with the spa config lock held.
+ */
+static void
+l2arc_rebuild(l2arc_dev_t *dev)
+{
+	l2arc_dev_hdr_phys_t *dh;
+	l2arc_log_blk_phys_t *lb;
+	l2arc_log_blkptr_t lbp;
+	uint64_t lb_asize, lb_dist, dist, nblks, max_blks;
+	abd_t *abd;
+	int err, i;
+
+	dh = kmem_alloc(sizeof (l2arc_dev_hdr_phys_t), KM_SLEEP);
+	err = l2arc_dev_hdr_read(dev, dh);
+	if (err != 0) {
+		if (err == ENOTSUP) {
+			ARCSTAT_BUMP(arcstat_l2_rebuild_unsupported);
+		} else {
+			ARCSTAT_BUMP(arcstat_l2_rebuild_io_errors);
+		}
+		kmem_free(dh, sizeof (l2arc_dev_hdr_phys_t));
+		return;
+	}
+
+	/*
+	 * Carry on writing where the device left off, so that the window
+	 * of valid buffers stays intact.
+	 */
+	dev->l2ad_hand = dh->dh_hand;
+	dev->l2ad_evict = dh->dh_evict;
+	dev->l2ad_first = (dh->dh_flags & L2ARC_DEV_HDR_FIRST) != 0;
+	dev->l2ad_log_head = dh->dh_head;
+	lbp = dh->dh_head;
+	kmem_free(dh, sizeof (l2arc_dev_hdr_phys_t));
+
+	vdev_space_update(dev->l2ad_vdev, dev->l2ad_hand - dev->l2ad_start +
+	    (dev->l2ad_first ? 0 : dev->l2ad_end - dev->l2ad_evict), 0, 0);
+
+	lb_asize = vdev_psize_to_asize(dev->l2ad_vdev,
+	    sizeof (l2arc_log_blk_phys_t));
+	max_blks = (dev->l2ad_end - dev->l2ad_start) / lb_asize;
+	abd = abd_alloc_linear(sizeof (l2arc_log_blk_phys_t), B_FALSE);
+	lb = abd_to_buf(abd);
+
+	for (lb_dist = 0, nblks = 0; lbp.lbp_daddr != 0; nblks++) {
+		if (dev->l2ad_rebuild_cancel)
+			break;
+
+		if (nblks >= max_blks ||
+		    lbp.lbp_size != sizeof (l2arc_log_blk_phys_t) ||
+		    !l2arc_rebuild_valid(dev, lbp.lbp_daddr, lb_asize, lb_dist,
+		    &dist)) {
+			/* reached the end of what is left of the log */
+			ARCSTAT_BUMP(arcstat_l2_rebuild_successes);
+			break;
+		}
+
+		/*
+		 * The rebuilt headers are ARC metadata, stop rather than
+		 * pushing the ARC into evicting to make room for them.
+		 */
+		if (arc_meta_used > arc_meta_limit) {
+			ARCSTAT_BUMP(arcstat_l2_rebuild_lowmem);
+			break;
+		}
+
+		err = l2arc_log_read(dev, lbp.lbp_daddr, lbp.lbp_size, abd,
+		    &lbp.lbp_cksum);
+		if (err == 0 && (lb->lb_magic != L2ARC_LOG_BLK_MAGIC ||
+		    lb->lb_nents > L2ARC_LOG_BLK_ENTRIES))
+			err = ECKSUM;
+		if (err == ECKSUM) {
+			ARCSTAT_BUMP(arcstat_l2_rebuild_cksum_lb_errors);
+			break;
+		} else if (err != 0) {
+			ARCSTAT_BUMP(arcstat_l2_rebuild_io_errors);
+			break;
+		}
+
+		for (i = lb->lb_nents - 1; i >= 0; i--)
+			l2arc_hdr_restore(dev, &lb->lb_entries[i], dist);
+
+		ARCSTAT_BUMP(arcstat_l2_rebuild_log_blks);
+		lb_dist = dist;
+		lbp = lb->lb_prev;
+	}
+
+	if (lbp.lbp_daddr == 0)
+		ARCSTAT_BUMP(arcstat_l2_rebuild_successes);
+
+	abd_free(abd);
+}
+
+/*
+ * Rebuild a newly added device in the background.
+ */
+static void
+l2arc_dev_rebuild_thread(l2arc_dev_t *dev)
+{
+	spa_t *spa = dev->l2ad_spa;
+	hrtime_t begin = gethrtime();
+	boolean_t locked = B_FALSE;
+
+	/*
+	 * The device is usually added while the pool is being loaded, with
+	 * the config lock held as writer; and if that fails, the device is
+	 * removed again before the lock is dropped.  So rather than blocking
+	 * on the lock, poll for it until l2arc_remove_vdev() says to give up.
+	 */
+	mutex_enter(&l2arc_dev_mtx);
+	while (!dev->l2ad_rebuild_cancel) {
+		if (spa_config_tryenter(spa, SCL_L2ARC, dev, RW_READER)) {
+			locked = B_TRUE;
+			break;
+		}
+		(void) cv_timedwait(&l2arc_rebuild_cv, &l2arc_dev_mtx,
+		    ddi_get_lbolt() + hz / 10);
+	}
+	mutex_exit(&l2arc_dev_mtx);
+
+	if (locked) {
+		l2arc_rebuild(dev);
+		spa_config_exit(spa, SCL_L2ARC, dev);
+	}
+
+	ARCSTAT_INCR(arcstat_l2_rebuild_time_ms,
+	    (gethrtime() - begin) / (NANOSEC / MILLISEC));
+
+	mutex_enter(&l2arc_dev_mtx);
+	dev->l2ad_rebuild = B_FALSE;
+	cv_broadcast(&l2arc_rebuild_cv);
+	mutex_exit(&l2arc_dev_mtx);
+
+	thread_exit();
+}
+
 boolean_t
 l2arc_vdev_present(vdev_t *vd)
 {
@@ -5573,12 +6560,17 @@ l2arc_add_vdev(spa_t *spa, vdev_t *vd)
 	adddev = kmem_zalloc(sizeof (l2arc_dev_t), KM_SLEEP);
 	adddev->l2ad_spa = spa;
 	adddev->l2ad_vdev = vd;
-	adddev->l2ad_start = VDEV_LABEL_START_SIZE;
+	/* leave room for the persistent L2ARC device header */
+	adddev->l2ad_start = VDEV_LABEL_START_SIZE +
+	    vdev_psize_to_asize(vd, sizeof (l2arc_dev_hdr_phys_t));
 	adddev->l2ad_end = VDEV_LABEL_START_SIZE + vdev_get_min_asize(vd);
 	adddev->l2ad_hand = adddev->l2ad_start;
 	adddev->l2ad_evict = adddev->l2ad_start;
 	adddev->l2ad_first = B_TRUE;
 	adddev->l2ad_writing = B_FALSE;
+	adddev->l2ad_log_blk = kmem_zalloc(sizeof (l2arc_log_blk_phys_t),
+	    KM_SLEEP);
+	adddev->l2ad_rebuild = (l2arc_rebuild_enabled != 0);
 	list_link_init(&adddev->l2ad_node);
 
 	/*
@@ -5598,6 +6590,15 @@ l2arc_add_vdev(spa_t *spa, vdev_t *vd)
 	list_insert_head(l2arc_dev_list, adddev);
 	atomic_inc_64(&l2arc_ndev);
 	mutex_exit(&l2arc_dev_mtx);
+
+	/*
+	 * Restore what the device held before, in the background.  The feed
+	 * thread leaves the device alone until this is done.
+	 */
+	if (adddev->l2ad_rebuild) {
+		(void) thread_create(NULL, 0, l2arc_dev_rebuild_thread,
+		    adddev, 0, &p0, TS_RUN, minclsyspri);
+	}
 }
 
 /*
@@ -5621,6 +6622,14 @@ l2arc_remove_vdev(vdev_t *vd)
 	}
 	ASSERT(remdev != NULL);
 
+	/*
+	 * Stop any rebuild still in progress.
+	 */
+	remdev->l2ad_rebuild_cancel = B_TRUE;
+	cv_broadcast(&l2arc_rebuild_cv);
+	while (remdev->l2ad_rebuild)
+		cv_wait(&l2arc_rebuild_cv, &l2arc_dev_mtx);
+
 	/*
 	 * Remove device from global list
 	 */
@@ -5635,6 +6644,7 @@ l2arc_remove_vdev(vdev_t *vd)
 	l2arc_evict(remdev, 0, B_TRUE);
 	list_destroy(remdev->l2ad_buflist);
 	kmem_free(remdev->l2ad_buflist, sizeof (list_t));
+	kmem_free(remdev->l2ad_log_blk, sizeof (l2arc_log_blk_phys_t));
 	kmem_free(remdev, sizeof (l2arc_dev_t));
 }
 
@@ -5649,6 +6659,7 @@ l2arc_init(void)
 	mutex_init(&l2arc_feed_thr_lock, NULL, MUTEX_DEFAULT, NULL);
 	cv_init(&l2arc_feed_thr_cv, NULL, CV_DEFAULT, NULL);
 	mutex_init(&l2arc_dev_mtx, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&l2arc_rebuild_cv, NULL, CV_DEFAULT, NULL);
 	mutex_init(&l2arc_buflist_mtx, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&l2arc_free_on_write_mtx, NULL, MUTEX_DEFAULT, NULL);
 
@@ -5674,6 +6685,7 @@ l2arc_fini(void)
 	mutex_destroy(&l2arc_feed_thr_lock);
 	cv_destroy(&l2arc_feed_thr_cv);
 	mutex_destroy(&l2arc_dev_mtx);
+	cv_destroy(&l2arc_rebuild_cv);
 	mutex_destroy(&l2arc_buflist_mtx);
 	mutex_destroy(&l2arc_free_on_write_mtx);
 
@@ -5736,6 +6748,12 @@ MODULE_PARM_DESC(zfs_arc_p_min_shift, "arc_c shift to calc min/max arc_p");
 module_param(zfs_disable_dup_eviction, int, 0644);
 MODULE_PARM_DESC(zfs_disable_dup_eviction, "disable duplicate buffer eviction");
 
+module_param(zfs_compressed_arc_enabled, int, 0644);
+MODULE_PARM_DESC(zfs_compressed_arc_enabled, "Cache compressed blocks");
+
+module_param(zfs_arc_num_sublists_per_state, int, 0644);
+MODULE_PARM_DESC(zfs_arc_num_sublists_per_state, "Sublists per ARC state");
+
 module_param(zfs_arc_memory_throttle_disable, int, 0644);
 MODULE_PARM_DESC(zfs_arc_memory_throttle_disable, "disable memory throttle");
 
@@ -5772,6 +6790,9 @@ MODULE_PARM_DESC(l2arc_feed_again, "Turbo L2ARC warmup");
 module_param(l2arc_norw, int, 0644);
 MODULE_PARM_DESC(l2arc_norw, "No reads during writes");
 
+module_param(l2arc_rebuild_enabled, int, 0644);
+MODULE_PARM_DESC(l2arc_rebuild_enabled, "Rebuild L2ARC from device log");
+
 #endif
 
 #ifdef _KERNEL
@@ -5782,6 +6803,7 @@ void arc_register_oids(void)
     sysctl_register_oid(&sysctl__zfs_arc_min);
     sysctl_register_oid(&sysctl__zfs_arc_meta_used);
     sysctl_register_oid(&sysctl__zfs_arc_meta_limit);
+    sysctl_register_oid(&sysctl__zfs_compressed_arc_enabled);
     sysctl_register_oid(&sysctl__zfs_l2arc_write_max);
     sysctl_register_oid(&sysctl__zfs_l2arc_write_boost);
     sysctl_register_oid(&sysctl__zfs_l2arc_headroom);
@@ -5790,6 +6812,7 @@ void arc_register_oids(void)
     sysctl_register_oid(&sysctl__zfs_l2arc_noprefetch);
     sysctl_register_oid(&sysctl__zfs_l2arc_feed_again);
     sysctl_register_oid(&sysctl__zfs_l2arc_norw);
+    sysctl_register_oid(&sysctl__zfs_l2arc_rebuild_enabled);
     sysctl_register_oid(&sysctl__zfs_anon_size);
     sysctl_register_oid(&sysctl__zfs_anon_metadata_lsize);
     sysctl_register_oid(&sysctl__zfs_anon_data_lsize);
@@ -5818,6 +6841,7 @@ void arc_unregister_oids(void)
     sysctl_unregister_oid(&sysctl__zfs_arc_min);
     sysctl_unregister_oid(&sysctl__zfs_arc_meta_used);
     sysctl_unregister_oid(&sysctl__zfs_arc_meta_limit);
+    sysctl_unregister_oid(&sysctl__zfs_compressed_arc_enabled);
     sysctl_unregister_oid(&sysctl__zfs_l2arc_write_max);
     sysctl_unregister_oid(&sysctl__zfs_l2arc_write_boost);
     sysctl_unregister_oid(&sysctl__zfs_l2arc_headroom);
@@ -5826,6 +6850,7 @@ void arc_unregister_oids(void)
     sysctl_unregister_oid(&sysctl__zfs_l2arc_noprefetch);
     sysctl_unregister_oid(&sysctl__zfs_l2arc_feed_again);
     sysctl_unregister_oid(&sysctl__zfs_l2arc_norw);
+    sysctl_unregister_oid(&sysctl__zfs_l2arc_rebuild_enabled);
     sysctl_unregister_oid(&sysctl__zfs_anon_size);
     sysctl_unregister_oid(&sysctl__zfs_anon_metadata_lsize);
     sysctl_unregister_oid(&sysctl__zfs_anon_data_lsize);
@@ -33,12 +33,16 @@
 #include <sys/dmu_objset.h>
 #include <sys/dsl_dataset.h>
 #include <sys/dsl_dir.h>
+#include <sys/dsl_pool.h>
 #include <sys/dmu_tx.h>
 #include <sys/spa.h>
 #include <sys/zio.h>
+#include <sys/abd.h>
 #include <sys/dmu_zfetch.h>
 #include <sys/sa.h>
 #include <sys/sa_impl.h>
+#include <sys/kstat.h>
+#include <sys/callb.h>
 
 //
 // FIXME
@@ -88,6 +92,7 @@ dbuf_cons(void *vdb, void *unused, int kmflag)
 	cv_init(&db->db_changed, NULL, CV_DEFAULT, NULL);
 	refcount_create(&db->db_holds);
 	list_link_init(&db->db_link);
+	multilist_link_init(&db->db_cache_link);
 	return (0);
 }
 
@@ -285,6 +290,314 @@ dbuf_evict(dmu_buf_impl_t *db)
 	dbuf_destroy(db);
 }
 
+/*
+ * The dbuf cache.
+ *
+ * A dbuf that drops its reference on its arc buffer lives only as long as
+ * the ARC keeps that buffer, so hot indirect blocks and dnode blocks would
+ * be recreated over and over, each time paying for dbuf_create(),
+ * dbuf_hash_insert() and an arc_read().
+ *
+ * Instead, an unreferenced dbuf keeps its arc buffer referenced and is
+ * put on one of two size-bounded LRU lists, one for metadata and one for
+ * data.  A dbuf_hold() that finds the dbuf on a list simply takes it off
+ * again, with no ARC interaction at all.  The dbuf_evict_thread trims the
+ * lists back below their low water mark from the cold end, at which point
+ * the dbuf drops its arc reference and reverts to the old behaviour.  If a
+ * list grows past its high water mark before the thread catches up, newly
+ * released dbufs bypass it altogether.
+ */
+typedef struct dbuf_cache {
+	multilist_t	cache;		/* unreferenced dbufs, MRU at head */
+	uint64_t	size;		/* bytes of db_size on the list */
+} dbuf_cache_t;
+
+static dbuf_cache_t dbuf_caches[DB_CACHE_MAX];
+
+/*
+ * Upper bounds for the data and metadata dbuf caches, in bytes.  When
+ * left at zero they default to arc_c_max >> dbuf_cache_shift and
+ * arc_c_max >> dbuf_metadata_cache_shift.  Either way a cache never
+ * targets more than the same fraction of the current ARC target, so it
+ * shrinks along with the ARC under memory pressure.
+ */
+unsigned long dbuf_cache_max_bytes = 0;
+unsigned long dbuf_metadata_cache_max_bytes = 0;
+int dbuf_cache_shift = 5;
+int dbuf_metadata_cache_shift = 6;
+
+/*
+ * The evict thread trims a cache once it is dbuf_cache_lowater_pct percent
+ * under its limit; above dbuf_cache_hiwater_pct percent over the limit,
+ * released dbufs are no longer added to it.
+ */
+unsigned int dbuf_cache_hiwater_pct = 10;
+unsigned int dbuf_cache_lowater_pct = 10;
+
+static kmutex_t dbuf_evict_lock;
+static kcondvar_t dbuf_evict_cv;
+static boolean_t dbuf_evict_thread_exit;
+
+typedef struct dbuf_cache_stats {
+	kstat_named_t dbcstat_hits;
+	kstat_named_t dbcstat_misses;
+	kstat_named_t dbcstat_evictions;
+	kstat_named_t dbcstat_overflows;
+	kstat_named_t dbcstat_size;
+	kstat_named_t dbcstat_max_bytes;
+	kstat_named_t dbcstat_metadata_size;
+	kstat_named_t dbcstat_metadata_max_bytes;
+} dbuf_cache_stats_t;
+
+static dbuf_cache_stats_t dbuf_cache_stats = {
+	{ "hits",			KSTAT_DATA_UINT64 },
+	{ "misses",			KSTAT_DATA_UINT64 },
+	{ "evictions",			KSTAT_DATA_UINT64 },
+	{ "overflows",			KSTAT_DATA_UINT64 },
+	{ "size",			KSTAT_DATA_UINT64 },
+	{ "max_bytes",			KSTAT_DATA_UINT64 },
+	{ "metadata_size",		KSTAT_DATA_UINT64 },
+	{ "metadata_max_bytes",		KSTAT_DATA_UINT64 }
+};
+
+static kstat_t *dbuf_cache_ksp = NULL;
+
+#define	DBUFCACHESTAT_BUMP(stat) \
+	atomic_add_64(&dbuf_cache_stats.stat.value.ui64, 1)
+
+static uint64_t
+dbuf_cache_target_bytes(dbuf_cached_state_t cs)
+{
+	uint64_t max_bytes = dbuf_cache_max_bytes;
+	int shift = dbuf_cache_shift;
+
+	if (cs == DB_DBUF_METADATA_CACHE) {
+		max_bytes = dbuf_metadata_cache_max_bytes;
+		shift = dbuf_metadata_cache_shift;
+	}
+
+	/*
+	 * dbuf_init() runs before arc_init(), so the default is worked out
+	 * here rather than there.
+	 */
+	if (max_bytes == 0 || max_bytes >= arc_max_bytes())
+		max_bytes = arc_max_bytes() >> shift;
+
+	return (MIN(max_bytes, arc_target_bytes() >> shift));
+}
+
+static boolean_t
+dbuf_cache_above_hiwater(dbuf_cached_state_t cs)
+{
+	uint64_t target = dbuf_cache_target_bytes(cs);
+
+	return (dbuf_caches[cs].size >
+	    target + target * dbuf_cache_hiwater_pct / 100);
+}
+
+static boolean_t
+dbuf_cache_above_lowater(dbuf_cached_state_t cs)
+{
+	uint64_t target = dbuf_cache_target_bytes(cs);
+
+	return (dbuf_caches[cs].size >
+	    target - target * dbuf_cache_lowater_pct / 100);
+}
+
+static int
+dbuf_cache_kstat_update(kstat_t *ksp, int rw)
+{
+	dbuf_cache_stats_t *dcs = ksp->ks_data;
+
+	if (rw == KSTAT_WRITE)
+		return (EACCES);
+
+	dcs->dbcstat_size.value.ui64 = dbuf_caches[DB_DBUF_CACHE].size;
+	dcs->dbcstat_max_bytes.value.ui64 =
+	    dbuf_cache_target_bytes(DB_DBUF_CACHE);
+	dcs->dbcstat_metadata_size.value.ui64 =
+	    dbuf_caches[DB_DBUF_METADATA_CACHE].size;
+	dcs->dbcstat_metadata_max_bytes.value.ui64 =
+	    dbuf_cache_target_bytes(DB_DBUF_METADATA_CACHE);
+
+	return (0);
+}
+
+static unsigned int
+dbuf_cache_multilist_index_func(multilist_t *ml, void *obj)
+{
+	dmu_buf_impl_t *db = obj;
+
+	/*
+	 * The hash only has to spread dbufs over the sublists; it is stable
+	 * for the dbuf's lifetime, which is all multilist_remove() needs.
+	 */
+	return ((unsigned int)(dbuf_hash(db->db_objset, db->db.db_object,
+	    db->db_level, db->db_blkid) % multilist_get_num_sublists(ml)));
+}
+
+/*
+ * Put a dbuf whose last hold was just released on the dbuf cache.  It
+ * keeps its reference on db_buf.  Returns B_FALSE, leaving the dbuf
+ * alone, if the cache is too far over its limit to take it.
+ */
+static boolean_t
+dbuf_cache_insert(dmu_buf_impl_t *db)
+{
+	dbuf_cached_state_t cs;
+
+	ASSERT(MUTEX_HELD(&db->db_mtx));
+	ASSERT(refcount_is_zero(&db->db_holds));
+	ASSERT3S(db->db_caching_status, ==, DB_NO_CACHE);
+	ASSERT(db->db_buf != NULL);
+
+	cs = dbuf_is_metadata(db) ? DB_DBUF_METADATA_CACHE : DB_DBUF_CACHE;
+	if (dbuf_cache_above_hiwater(cs)) {
+		DBUFCACHESTAT_BUMP(dbcstat_overflows);
+		return (B_FALSE);
+	}
+
+	db->db_caching_status = cs;
+	multilist_insert(&dbuf_caches[cs].cache, db);
+	atomic_add_64(&dbuf_caches[cs].size, db->db.db_size);
+
+	if (dbuf_cache_above_lowater(cs))
+		cv_signal(&dbuf_evict_cv);
+
+	return (B_TRUE);
+}
+
+/*
+ * Take a dbuf off the dbuf cache, either because it is being held again
+ * or because it is being evicted.  The caller owns its db_buf reference.
+ */
+static void
+dbuf_cache_remove(dmu_buf_impl_t *db)
+{
+	dbuf_cache_t *dc;
+
+	ASSERT(MUTEX_HELD(&db->db_mtx));
+	ASSERT3S(db->db_caching_status, !=, DB_NO_CACHE);
+
+	dc = &dbuf_caches[db->db_caching_status];
+	multilist_remove(&dc->cache, db);
+	atomic_add_64(&dc->size, -db->db.db_size);
+	db->db_caching_status = DB_NO_CACHE;
+}
+
+/*
+ * Drop the arc reference of an unreferenced dbuf, and clear it right away
+ * if the ARC already caches another copy of the block.  Exits db_mtx.
+ */
+static void
+dbuf_release_arcbuf(dmu_buf_impl_t *db)
+{
+	ASSERT(MUTEX_HELD(&db->db_mtx));
+	ASSERT(refcount_is_zero(&db->db_holds));
+
+	VERIFY(!arc_buf_remove_ref(db->db_buf, db));
+
+	/*
+	 * To decide if our buffer is considered a duplicate, we must
+	 * call into the arc to determine if multiple buffers are
+	 * referencing the same block on-disk.  If so, then we simply
+	 * evict ourselves.
+	 */
+	if (arc_buf_eviction_needed(db->db_buf))
+		dbuf_clear(db);
+	else
+		mutex_exit(&db->db_mtx);
+}
+
+/*
+ * Evict the least recently used dbuf from a random sublist of the given
+ * cache.  Returns B_FALSE if nothing on that sublist could be evicted.
+ */
+static boolean_t
+dbuf_evict_one(dbuf_cached_state_t cs)
+{
+	multilist_t *ml = &dbuf_caches[cs].cache;
+	multilist_sublist_t *mls;
+	dmu_buf_impl_t *db;
+
+	mls = multilist_sublist_lock(ml, multilist_get_random_index(ml));
+
+	/*
+	 * Lock order is db_mtx before the sublist lock, so only try for
+	 * each dbuf's mutex and move on to a warmer one if it is busy.
+	 */
+	for (db = multilist_sublist_tail(mls); db != NULL;
+	    db = multilist_sublist_prev(mls, db)) {
+		if (mutex_tryenter(&db->db_mtx))
+			break;
+	}
+	if (db == NULL) {
+		multilist_sublist_unlock(mls);
+		return (B_FALSE);
+	}
+
+	multilist_sublist_remove(mls, db);
+	multilist_sublist_unlock(mls);
+	atomic_add_64(&dbuf_caches[cs].size, -db->db.db_size);
+	db->db_caching_status = DB_NO_CACHE;
+	DBUFCACHESTAT_BUMP(dbcstat_evictions);
+
+	dbuf_release_arcbuf(db);
+	return (B_TRUE);
+}
+
+static void
+dbuf_evict_thread(void *dummy __unused)
+{
+	callb_cpr_t cpr;
+	dbuf_cached_state_t cs;
+
+	CALLB_CPR_INIT(&cpr, &dbuf_evict_lock, callb_generic_cpr, FTAG);
+
+	mutex_enter(&dbuf_evict_lock);
+	while (!dbuf_evict_thread_exit) {
+		mutex_exit(&dbuf_evict_lock);
+
+		for (cs = DB_DBUF_CACHE; cs < DB_CACHE_MAX; cs++) {
+			while (dbuf_cache_above_lowater(cs) &&
+			    !dbuf_evict_thread_exit) {
+				if (!dbuf_evict_one(cs) &&
+				    multilist_is_empty(&dbuf_caches[cs].cache))
+					break;
+			}
+		}
+
+		mutex_enter(&dbuf_evict_lock);
+		if (dbuf_evict_thread_exit)
+			break;
+
+		/* block until needed, or one second, whichever is shorter */
+		CALLB_CPR_SAFE_BEGIN(&cpr);
+		(void) cv_timedwait_interruptible(&dbuf_evict_cv,
+		    &dbuf_evict_lock, (ddi_get_lbolt() + hz));
+		CALLB_CPR_SAFE_END(&cpr, &dbuf_evict_lock);
+	}
+
+	dbuf_evict_thread_exit = B_FALSE;
+	cv_broadcast(&dbuf_evict_cv);
+	CALLB_CPR_EXIT(&cpr);		/* drops dbuf_evict_lock */
+	thread_exit();
+}
+
+/*
+ * Called from the ARC reclaim path once the ARC is over its target.  The
+ * cache targets follow arc_c, so waking the evict thread is enough to trim
+ * both caches down to their (now smaller) low water marks and hand the
+ * pinned arc buffers back for eviction.
+ */
+void
+dbuf_cache_reclaim(void)
+{
+	mutex_enter(&dbuf_evict_lock);
+	cv_signal(&dbuf_evict_cv);
+	mutex_exit(&dbuf_evict_lock);
+}
+
 void
 dbuf_init(void)
 {
@@ -324,6 +637,29 @@ retry:
 
 	for (i = 0; i < DBUF_MUTEXES; i++)
 		mutex_init(&h->hash_mutexes[i], NULL, MUTEX_DEFAULT, NULL);
+
+	for (i = 0; i < DB_CACHE_MAX; i++) {
+		multilist_create(&dbuf_caches[i].cache,
+		    sizeof (dmu_buf_impl_t),
+		    offsetof(dmu_buf_impl_t, db_cache_link),
+		    MAX(max_ncpus, 1), dbuf_cache_multilist_index_func);
+		dbuf_caches[i].size = 0;
+	}
+
+	dbuf_cache_ksp = kstat_create("zfs", 0, "dbufcachestats", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (dbuf_cache_stats) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+	if (dbuf_cache_ksp != NULL) {
+		dbuf_cache_ksp->ks_data = &dbuf_cache_stats;
+		dbuf_cache_ksp->ks_update = dbuf_cache_kstat_update;
+		kstat_install(dbuf_cache_ksp);
+	}
+
+	mutex_init(&dbuf_evict_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&dbuf_evict_cv, NULL, CV_DEFAULT, NULL);
+	dbuf_evict_thread_exit = B_FALSE;
+	(void) thread_create(NULL, 0, dbuf_evict_thread, NULL, 0, &p0,
+	    TS_RUN, minclsyspri);
 }
 
 void
@@ -332,6 +668,26 @@ dbuf_fini(void)
 	dbuf_hash_table_t *h = &dbuf_hash_table;
 	int i;
 
+	mutex_enter(&dbuf_evict_lock);
+	dbuf_evict_thread_exit = B_TRUE;
+	while (dbuf_evict_thread_exit) {
+		cv_signal(&dbuf_evict_cv);
+		cv_wait(&dbuf_evict_cv, &dbuf_evict_lock);
+	}
+	mutex_exit(&dbuf_evict_lock);
+	mutex_destroy(&dbuf_evict_lock);
+	cv_destroy(&dbuf_evict_cv);
+
+	if (dbuf_cache_ksp != NULL) {
+		kstat_delete(dbuf_cache_ksp);
+		dbuf_cache_ksp = NULL;
+	}
+
+	for (i = 0; i < DB_CACHE_MAX; i++) {
+		ASSERT0(dbuf_caches[i].size);
+		multilist_destroy(&dbuf_caches[i].cache);
+	}
+
 	for (i = 0; i < DBUF_MUTEXES; i++)
 		mutex_destroy(&h->hash_mutexes[i]);
 #if defined(_KERNEL) && defined(HAVE_SPL)
@@ -581,13 +937,14 @@ dbuf_read_impl(dmu_buf_impl_t *db, zio_t *zio, uint32_t *flags)
 
 	if (db->db_blkid == DMU_BONUS_BLKID) {
 		int bonuslen = MIN(dn->dn_bonuslen, dn->dn_phys->dn_bonuslen);
+		int max_bonuslen = DN_SLOTS_TO_BONUSLEN(dn->dn_num_slots);
 
 		ASSERT3U(bonuslen, <=, db->db.db_size);
-		db->db.db_data = zio_buf_alloc(DN_MAX_BONUSLEN);
-		arc_space_consume(DN_MAX_BONUSLEN, ARC_SPACE_OTHER);
+		db->db.db_data = zio_buf_alloc(max_bonuslen);
+		arc_space_consume(max_bonuslen, ARC_SPACE_OTHER);
         bonusholds++;
-		if (bonuslen < DN_MAX_BONUSLEN)
-			bzero(db->db.db_data, DN_MAX_BONUSLEN);
+		if (bonuslen < max_bonuslen)
+			bzero(db->db.db_data, max_bonuslen);
 		if (bonuslen)
 			bcopy(DN_BONUS(dn->dn_phys), db->db.db_data, bonuslen);
 		DB_DNODE_EXIT(db);
@@ -673,8 +1030,7 @@ dbuf_read(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags)
 	if (db->db_state == DB_CACHED) {
 		mutex_exit(&db->db_mtx);
 		if (prefetch)
-			dmu_zfetch(&dn->dn_zfetch, db->db.db_offset,
-			    db->db.db_size, TRUE);
+			dmu_zfetch(&dn->dn_zfetch, db->db_blkid, 1);
 		if ((flags & DB_RF_HAVESTRUCT) == 0)
 			rw_exit(&dn->dn_struct_rwlock);
 		DB_DNODE_EXIT(db);
@@ -688,8 +1044,7 @@ dbuf_read(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags)
 		/* dbuf_read_impl has dropped db_mtx for us */
 
 		if (prefetch)
-			dmu_zfetch(&dn->dn_zfetch, db->db.db_offset,
-			    db->db.db_size, flags & DB_RF_CACHED);
+			dmu_zfetch(&dn->dn_zfetch, db->db_blkid, 1);
 
 		if ((flags & DB_RF_HAVESTRUCT) == 0)
 			rw_exit(&dn->dn_struct_rwlock);
@@ -700,8 +1055,7 @@ dbuf_read(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags)
 	} else {
 		mutex_exit(&db->db_mtx);
 		if (prefetch)
-			dmu_zfetch(&dn->dn_zfetch, db->db.db_offset,
-			    db->db.db_size, TRUE);
+			dmu_zfetch(&dn->dn_zfetch, db->db_blkid, 1);
 		if ((flags & DB_RF_HAVESTRUCT) == 0)
 			rw_exit(&dn->dn_struct_rwlock);
 		DB_DNODE_EXIT(db);
@@ -786,11 +1140,17 @@ dbuf_fix_old_data(dmu_buf_impl_t *db, uint64_t txg)
 	 */
 	ASSERT(dr->dr_txg >= txg - 2);
 	if (db->db_blkid == DMU_BONUS_BLKID) {
+		int max_bonuslen;
+
+		DB_DNODE_ENTER(db);
+		max_bonuslen = DN_SLOTS_TO_BONUSLEN(DB_DNODE(db)->dn_num_slots);
+		DB_DNODE_EXIT(db);
+
 		/* Note that the data bufs here are zio_bufs */
-		dr->dt.dl.dr_data = zio_buf_alloc(DN_MAX_BONUSLEN);
-		arc_space_consume(DN_MAX_BONUSLEN, ARC_SPACE_OTHER);
+		dr->dt.dl.dr_data = zio_buf_alloc(max_bonuslen);
+		arc_space_consume(max_bonuslen, ARC_SPACE_OTHER);
         bonusholds++;
-		bcopy(db->db.db_data, dr->dt.dl.dr_data, DN_MAX_BONUSLEN);
+		bcopy(db->db.db_data, dr->dt.dl.dr_data, max_bonuslen);
 	} else if (refcount_count(&db->db_holds) > db->db_dirtycnt) {
 		int size = db->db.db_size;
 		arc_buf_contents_t type = DBUF_GET_BUFC_TYPE(db);
@@ -1213,6 +1573,16 @@ dbuf_dirty(dmu_buf_impl_t *db, dmu_tx_t *tx)
 	dr->dr_next = *drp;
 	*drp = dr;
 
+	/*
+	 * Charge the buffer to the pool's dirty data for the write throttle.
+	 * Changes made in syncing context are written out by the sync that
+	 * made them and are not throttled.
+	 */
+	if (db->db_blkid != DMU_BONUS_BLKID && !dmu_tx_is_syncing(tx)) {
+		dr->dr_accounted = db->db.db_size;
+		dsl_pool_dirty_space(dmu_objset_pool(os), dr->dr_accounted, tx);
+	}
+
 	/*
 	 * We could have been freed_in_flight between the dbuf_noread
 	 * and dbuf_dirty.  We win, as though the dbuf_noread() had
@@ -1256,7 +1626,7 @@ dbuf_dirty(dmu_buf_impl_t *db, dmu_tx_t *tx)
 		 * db_blkptr, but since this is just a guess,
 		 * it's OK if we get an odd answer.
 		 */
-		ddt_prefetch(os->os_spa, bp);
+		(void) ddt_prefetch(os->os_spa, bp);
 		dnode_willuse_space(dn, -willfree, tx);
 	}
 
@@ -1391,6 +1761,7 @@ dbuf_undirty(dmu_buf_impl_t *db, dmu_tx_t *tx)
 		if (dr->dt.dl.dr_data != db->db_buf)
 			VERIFY(arc_buf_remove_ref(dr->dt.dl.dr_data, db));
 	}
+	dsl_pool_undirty_space(tx->tx_pool, dr->dr_accounted, txg);
 	kmem_free(dr, sizeof (dbuf_dirty_record_t));
 
 	ASSERT(db->db_dirtycnt > 0);
@@ -1562,13 +1933,29 @@ dbuf_clear(dmu_buf_impl_t *db)
 	ASSERT(MUTEX_HELD(&db->db_mtx));
 	ASSERT(refcount_is_zero(&db->db_holds));
 
+	/*
+	 * A dbuf sitting on the dbuf cache still references its arc
+	 * buffer; give that up before arc_buf_evict() below.
+	 */
+	if (db->db_caching_status != DB_NO_CACHE) {
+		dbuf_cache_remove(db);
+		VERIFY(!arc_buf_remove_ref(db->db_buf, db));
+	}
+
 	dbuf_evict_user(db);
 
 	if (db->db_state == DB_CACHED) {
 		ASSERT(db->db.db_data != NULL);
 		if (db->db_blkid == DMU_BONUS_BLKID) {
-			zio_buf_free(db->db.db_data, DN_MAX_BONUSLEN);
-			arc_space_return(DN_MAX_BONUSLEN, ARC_SPACE_OTHER);
+			int max_bonuslen;
+
+			DB_DNODE_ENTER(db);
+			max_bonuslen =
+			    DN_SLOTS_TO_BONUSLEN(DB_DNODE(db)->dn_num_slots);
+			DB_DNODE_EXIT(db);
+
+			zio_buf_free(db->db.db_data, max_bonuslen);
+			arc_space_return(max_bonuslen, ARC_SPACE_OTHER);
             bonusholds--;
 		}
 		db->db.db_data = NULL;
@@ -1633,7 +2020,7 @@ dbuf_findbp(dnode_t *dn, int level, uint64_t blkid, int fail_sparse,
 		mutex_enter(&dn->dn_mtx);
 		if (dn->dn_have_spill &&
 		    (dn->dn_phys->dn_flags & DNODE_FLAG_SPILL_BLKPTR))
-			*bpp = &dn->dn_phys->dn_spill;
+			*bpp = DN_SPILL_BLKPTR(dn->dn_phys);
 		else
 			*bpp = NULL;
 		dbuf_add_ref(dn->dn_dbuf, NULL);
@@ -1721,10 +2108,11 @@ dbuf_create(dnode_t *dn, uint8_t level, uint64_t blkid,
 	db->db_evict_func = NULL;
 	db->db_immediate_evict = 0;
 	db->db_freed_in_flight = 0;
+	db->db_caching_status = DB_NO_CACHE;
 
 	if (blkid == DMU_BONUS_BLKID) {
 		ASSERT3P(parent, ==, dn->dn_dbuf);
-		db->db.db_size = DN_MAX_BONUSLEN -
+		db->db.db_size = DN_SLOTS_TO_BONUSLEN(dn->dn_num_slots) -
 		    (dn->dn_nblkptr-1) * sizeof (blkptr_t);
 		ASSERT3U(db->db.db_size, >=, dn->dn_bonuslen);
 		db->db.db_offset = DMU_BONUS_BLKID;
@@ -1846,8 +2234,13 @@ dbuf_destroy(dmu_buf_impl_t *db)
     dmubufholds--;
 }
 
+/*
+ * Issue an asynchronous read of the given block into the ARC, unless its
+ * dbuf already exists.  Level 0 prefetches a data block; higher levels
+ * prefetch the indirect block at that level.
+ */
 void
-dbuf_prefetch(dnode_t *dn, uint64_t blkid)
+dbuf_prefetch(dnode_t *dn, int level, uint64_t blkid)
 {
 	dmu_buf_impl_t *db = NULL;
 	blkptr_t *bp = NULL;
@@ -1855,11 +2248,11 @@ dbuf_prefetch(dnode_t *dn, uint64_t blkid)
 	ASSERT(blkid != DMU_BONUS_BLKID);
 	ASSERT(RW_LOCK_HELD(&dn->dn_struct_rwlock));
 
-	if (dnode_block_freed(dn, blkid))
+	if (level == 0 && dnode_block_freed(dn, blkid))
 		return;
 
 	/* dbuf_find() returns with db_mtx held */
-	if ((db = dbuf_find(dn, 0, blkid))) {
+	if ((db = dbuf_find(dn, level, blkid))) {
 		/*
 		 * This dbuf is already in the cache.  We assume that
 		 * it is already CACHED, or else about to be either
@@ -1869,19 +2262,17 @@ dbuf_prefetch(dnode_t *dn, uint64_t blkid)
 		return;
 	}
 
-	if (dbuf_findbp(dn, 0, blkid, TRUE, &db, &bp, NULL) == 0) {
+	if (dbuf_findbp(dn, level, blkid, TRUE, &db, &bp, NULL) == 0) {
 		if (bp && !BP_IS_HOLE(bp)) {
-			int priority = dn->dn_type == DMU_OT_DDT_ZAP ?
-			    ZIO_PRIORITY_DDT_PREFETCH : ZIO_PRIORITY_ASYNC_READ;
 			dsl_dataset_t *ds = dn->dn_objset->os_dsl_dataset;
 			uint32_t aflags = ARC_NOWAIT | ARC_PREFETCH;
 			zbookmark_t zb;
 
 			SET_BOOKMARK(&zb, ds ? ds->ds_object : DMU_META_OBJSET,
-			    dn->dn_object, 0, blkid);
+			    dn->dn_object, level, blkid);
 
 			(void) arc_read(NULL, dn->dn_objset->os_spa,
-                            bp, NULL, NULL, priority,
+                            bp, NULL, NULL, ZIO_PRIORITY_ASYNC_READ,
 			    ZIO_FLAG_CANFAIL | ZIO_FLAG_SPECULATIVE,
 			    &aflags, &zb);
 		}
@@ -1931,9 +2322,21 @@ top:
 			return (dh->dh_err);
 		dh->dh_db = dbuf_create(dh->dh_dn, dh->dh_level, dh->dh_blkid,
 					dh->dh_parent, dh->dh_bp);
+		DBUFCACHESTAT_BUMP(dbcstat_misses);
 	}
 
-	if (dh->dh_db->db_buf && refcount_is_zero(&dh->dh_db->db_holds)) {
+	if (dh->dh_db->db_caching_status != DB_NO_CACHE) {
+		/*
+		 * An unreferenced dbuf on the dbuf cache: it kept its arc
+		 * buffer referenced, so just take it off the cache.
+		 */
+		ASSERT(refcount_is_zero(&dh->dh_db->db_holds));
+		ASSERT(dh->dh_db->db_buf != NULL);
+		dbuf_cache_remove(dh->dh_db);
+		DBUFCACHESTAT_BUMP(dbcstat_hits);
+	} else if (dh->dh_db->db_buf &&
+	    refcount_is_zero(&dh->dh_db->db_holds)) {
+		DBUFCACHESTAT_BUMP(dbcstat_misses);
 		arc_buf_add_ref(dh->dh_db->db_buf, dh->dh_db);
 		if (dh->dh_db->db_buf->b_data == NULL) {
 			dbuf_clear(dh->dh_db);
@@ -2061,8 +2464,8 @@ dbuf_spill_set_blksz(dmu_buf_t *db_fake, uint64_t blksz, dmu_tx_t *tx)
 		return (ENOTSUP);
 	if (blksz == 0)
 		blksz = SPA_MINBLOCKSIZE;
-	if (blksz > SPA_MAXBLOCKSIZE)
-		blksz = SPA_MAXBLOCKSIZE;
+	if (blksz > SPA_OLD_MAXBLOCKSIZE)
+		blksz = SPA_OLD_MAXBLOCKSIZE;
 	else
 		blksz = P2ROUNDUP(blksz, SPA_MINBLOCKSIZE);
 
@@ -2168,29 +2571,19 @@ dbuf_rele_and_unlock(dmu_buf_impl_t *db, void *tag)
 			dbuf_set_data(db, NULL);
 			VERIFY(arc_buf_remove_ref(buf, db));
 			dbuf_evict(db);
-		} else {
-			VERIFY(!arc_buf_remove_ref(db->db_buf, db));
-
+		} else if (!DBUF_IS_CACHEABLE(db)) {
 			/*
-			 * A dbuf will be eligible for eviction if either the
-			 * 'primarycache' property is set or a duplicate
-			 * copy of this buffer is already cached in the arc.
-			 *
-			 * In the case of the 'primarycache' a buffer
-			 * is considered for eviction if it matches the
-			 * criteria set in the property.
-			 *
-			 * To decide if our buffer is considered a
-			 * duplicate, we must call into the arc to determine
-			 * if multiple buffers are referencing the same
-			 * block on-disk. If so, then we simply evict
-			 * ourselves.
+			 * A dbuf will be eligible for eviction if the
+			 * 'primarycache' property is set and the buffer
+			 * does not match the criteria set in the property.
 			 */
-			if (!DBUF_IS_CACHEABLE(db) ||
-			    arc_buf_eviction_needed(db->db_buf))
-				dbuf_clear(db);
-			else
-				mutex_exit(&db->db_mtx);
+			VERIFY(!arc_buf_remove_ref(db->db_buf, db));
+			dbuf_clear(db);
+		} else if (!arc_buf_eviction_needed(db->db_buf) &&
+		    dbuf_cache_insert(db)) {
+			mutex_exit(&db->db_mtx);
+		} else {
+			dbuf_release_arcbuf(db);
 		}
 	} else {
 		mutex_exit(&db->db_mtx);
@@ -2287,7 +2680,7 @@ dbuf_check_blkptr(dnode_t *dn, dmu_buf_impl_t *db)
 		return;
 
 	if (db->db_blkid == DMU_SPILL_BLKID) {
-		db->db_blkptr = &dn->dn_phys->dn_spill;
+		db->db_blkptr = DN_SPILL_BLKPTR(dn->dn_phys);
 		BP_ZERO(db->db_blkptr);
 		return;
 	}
@@ -2420,15 +2813,17 @@ dbuf_sync_leaf(dbuf_dirty_record_t *dr, dmu_tx_t *tx)
 	if (db->db_blkid == DMU_BONUS_BLKID) {
 		dbuf_dirty_record_t **drp;
 
+		int max_bonuslen = DN_SLOTS_TO_BONUSLEN(dn->dn_num_slots);
+
 		ASSERT(*datap != NULL);
 		ASSERT0(db->db_level);
-		ASSERT3U(dn->dn_phys->dn_bonuslen, <=, DN_MAX_BONUSLEN);
+		ASSERT3U(dn->dn_phys->dn_bonuslen, <=, max_bonuslen);
 		bcopy(*datap, DN_BONUS(dn->dn_phys), dn->dn_phys->dn_bonuslen);
 		DB_DNODE_EXIT(db);
 
 		if (*datap != db->db.db_data) {
-			zio_buf_free(*datap, DN_MAX_BONUSLEN);
-			arc_space_return(DN_MAX_BONUSLEN, ARC_SPACE_OTHER);
+			zio_buf_free(*datap, max_bonuslen);
+			arc_space_return(max_bonuslen, ARC_SPACE_OTHER);
             bonusholds--;
 		}
 		db->db_data_pending = NULL;
@@ -2578,7 +2973,7 @@ dbuf_write_ready(zio_t *zio, arc_buf_t *buf, void *vdb)
 	if (db->db_blkid == DMU_SPILL_BLKID) {
 		ASSERT(dn->dn_phys->dn_flags & DNODE_FLAG_SPILL_BLKPTR);
 		ASSERT(!(BP_IS_HOLE(db->db_blkptr)) &&
-		    db->db_blkptr == &dn->dn_phys->dn_spill);
+		    db->db_blkptr == DN_SPILL_BLKPTR(dn->dn_phys));
 	}
 #endif
 
@@ -2587,13 +2982,23 @@ dbuf_write_ready(zio_t *zio, arc_buf_t *buf, void *vdb)
 		if (db->db_blkid > dn->dn_phys->dn_maxblkid &&
 		    db->db_blkid != DMU_SPILL_BLKID)
 			dn->dn_phys->dn_maxblkid = db->db_blkid;
+		/*
+		 * Keep track of whether compression pays off for this
+		 * object, for dmu_write_policy().
+		 */
+		if (zio->io_prop.zp_compress != ZIO_COMPRESS_OFF) {
+			if (BP_GET_COMPRESS(bp) != ZIO_COMPRESS_OFF)
+				dn->dn_compress_misses = 0;
+			else if (dn->dn_compress_misses < UINT8_MAX)
+				dn->dn_compress_misses++;
+		}
 		mutex_exit(&dn->dn_mtx);
 
 		if (dn->dn_type == DMU_OT_DNODE) {
 			dnode_phys_t *dnp = db->db.db_data;
-			for (i = db->db.db_size >> DNODE_SHIFT; i > 0;
-			    i--, dnp++) {
-				if (dnp->dn_type != DMU_OT_NONE)
+			for (i = 0; i < db->db.db_size >> DNODE_SHIFT;
+			    i += dnp[i].dn_extra_slots + 1) {
+				if (dnp[i].dn_type != DMU_OT_NONE)
 					fill++;
 			}
 		} else {
@@ -2605,12 +3010,14 @@ dbuf_write_ready(zio_t *zio, arc_buf_t *buf, void *vdb)
 		for (i = db->db.db_size >> SPA_BLKPTRSHIFT; i > 0; i--, ibp++) {
 			if (BP_IS_HOLE(ibp))
 				continue;
-			fill += ibp->blk_fill;
+			fill += BP_GET_FILL(ibp);
 		}
 	}
 	DB_DNODE_EXIT(db);
 
-	bp->blk_fill = fill;
+	/* An embedded bp keeps part of its payload where the fill goes. */
+	if (!BP_IS_EMBEDDED(bp))
+		bp->blk_fill = fill;
 
 	mutex_exit(&db->db_mtx);
 }
@@ -2664,7 +3071,7 @@ dbuf_write_done(zio_t *zio, arc_buf_t *buf, void *vdb)
 		dn = DB_DNODE(db);
 		ASSERT(dn->dn_phys->dn_flags & DNODE_FLAG_SPILL_BLKPTR);
 		ASSERT(!(BP_IS_HOLE(db->db_blkptr)) &&
-		    db->db_blkptr == &dn->dn_phys->dn_spill);
+		    db->db_blkptr == DN_SPILL_BLKPTR(dn->dn_phys));
 		DB_DNODE_EXIT(db);
 	}
 #endif
@@ -2699,6 +3106,7 @@ dbuf_write_done(zio_t *zio, arc_buf_t *buf, void *vdb)
 		mutex_destroy(&dr->dt.di.dr_mtx);
 		list_destroy(&dr->dt.di.dr_children);
 	}
+	dsl_pool_undirty_space(spa_get_dsl(zio->io_spa), dr->dr_accounted, txg);
 	kmem_free(dr, sizeof (dbuf_dirty_record_t));
 
 	cv_broadcast(&db->db_changed);
@@ -2745,6 +3153,8 @@ dbuf_write_override_done(zio_t *zio)
 	mutex_exit(&db->db_mtx);
 
 	dbuf_write_done(zio, NULL, db);
+
+	abd_put(zio->io_abd);
 }
 
 static void
@@ -2812,8 +3222,9 @@ dbuf_write(dbuf_dirty_record_t *dr, arc_buf_t *data, dmu_tx_t *tx)
 
 	if (db->db_level == 0 && dr->dt.dl.dr_override_state == DR_OVERRIDDEN) {
 		ASSERT(db->db_state != DB_NOFILL);
-		dr->dr_zio = zio_write(zio, os->os_spa, txg,
-		    db->db_blkptr, data->b_data, arc_buf_size(data), &zp,
+		dr->dr_zio = zio_write(zio, os->os_spa, txg, db->db_blkptr,
+		    abd_get_from_buf(data->b_data, arc_buf_size(data)),
+		    arc_buf_size(data), &zp,
 		    dbuf_write_override_ready, dbuf_write_override_done, dr,
 		    ZIO_PRIORITY_ASYNC_WRITE, ZIO_FLAG_MUSTSUCCEED, &zb);
 		mutex_enter(&db->db_mtx);
@@ -2839,6 +3250,31 @@ dbuf_write(dbuf_dirty_record_t *dr, arc_buf_t *data, dmu_tx_t *tx)
 }
 
 #if defined(_KERNEL) && defined(HAVE_SPL)
+module_param(dbuf_cache_max_bytes, ulong, 0644);
+MODULE_PARM_DESC(dbuf_cache_max_bytes,
+	"Maximum size in bytes of the dbuf cache for data blocks");
+
+module_param(dbuf_metadata_cache_max_bytes, ulong, 0644);
+MODULE_PARM_DESC(dbuf_metadata_cache_max_bytes,
+	"Maximum size in bytes of the dbuf cache for metadata blocks");
+
+module_param(dbuf_cache_shift, int, 0644);
+MODULE_PARM_DESC(dbuf_cache_shift,
+	"Set the size of the dbuf cache to a log2 fraction of the ARC");
+
+module_param(dbuf_metadata_cache_shift, int, 0644);
+MODULE_PARM_DESC(dbuf_metadata_cache_shift,
+	"Set the size of the dbuf metadata cache to a log2 fraction of the ARC");
+
+module_param(dbuf_cache_hiwater_pct, uint, 0644);
+MODULE_PARM_DESC(dbuf_cache_hiwater_pct,
+	"Percentage over the dbuf cache limit at which released dbufs "
+	"bypass the cache");
+
+module_param(dbuf_cache_lowater_pct, uint, 0644);
+MODULE_PARM_DESC(dbuf_cache_lowater_pct,
+	"Percentage below the dbuf cache limit the evict thread trims to");
+
 EXPORT_SYMBOL(dbuf_find);
 EXPORT_SYMBOL(dbuf_is_metadata);
 EXPORT_SYMBOL(dbuf_evict);
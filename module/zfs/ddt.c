@@ -36,12 +36,51 @@
 #include <sys/zio_checksum.h>
 #include <sys/zio_compress.h>
 #include <sys/dsl_scan.h>
+#include <sys/zfeature.h>
 
 /*
- * Enable/disable prefetching of dedup-ed blocks which are going to be freed.
+ * Enable/disable prefetching of the DDT entries of dedup-ed blocks which
+ * are going to be freed or written.
  */
 int zfs_dedup_prefetch = 1;
 
+/*
+ * Each txg, write at least this many entries of the flushing DDT log to
+ * the DDT ZAPs, or the log's size spread over zfs_dedup_log_flush_txgs
+ * txgs, whichever is larger.  See ddt_log.c.
+ */
+int zfs_dedup_log_flush_entries_min = 1000;
+int zfs_dedup_log_flush_txgs = 100;
+
+/*
+ * If the logs hold more than this many bytes of entries in core, flush
+ * the rest of the flushing log at once.
+ */
+unsigned long zfs_dedup_log_mem_max = 128 * 1024 * 1024;
+
+/*
+ * How many entries ahead of the one being flushed to prefetch the ZAP
+ * leaves of.
+ */
+int zfs_dedup_log_flush_prefetch = 256;
+
+ddt_stats_t ddt_stats = {
+	{ "lookups",			KSTAT_DATA_UINT64 },
+	{ "lookup_hits",		KSTAT_DATA_UINT64 },
+	{ "lookup_log_hits",		KSTAT_DATA_UINT64 },
+	{ "lookup_misses",		KSTAT_DATA_UINT64 },
+	{ "prefetches",			KSTAT_DATA_UINT64 },
+	{ "log_entries",		KSTAT_DATA_UINT64 },
+	{ "log_bytes",			KSTAT_DATA_UINT64 },
+	{ "log_appended",		KSTAT_DATA_UINT64 },
+	{ "log_flushed",		KSTAT_DATA_UINT64 },
+	{ "log_flush_rate",		KSTAT_DATA_UINT64 },
+	{ "log_flushed_forced",		KSTAT_DATA_UINT64 },
+	{ "log_replayed",		KSTAT_DATA_UINT64 },
+};
+
+static kstat_t *ddt_ksp;
+
 static const ddt_ops_t *ddt_ops[DDT_TYPES] = {
 	&ddt_zap_ops,
 };
@@ -176,15 +215,16 @@ ddt_object_lookup(ddt_t *ddt, enum ddt_type type, enum ddt_class class,
 	    ddt->ddt_object[type][class], dde));
 }
 
-static void
+static boolean_t
 ddt_object_prefetch(ddt_t *ddt, enum ddt_type type, enum ddt_class class,
     ddt_entry_t *dde)
 {
 	if (!ddt_object_exists(ddt, type, class))
-		return;
+		return (B_FALSE);
 
 	ddt_ops[type]->ddt_op_prefetch(ddt->ddt_os,
 	    ddt->ddt_object[type][class], dde);
+	return (B_TRUE);
 }
 
 int
@@ -365,6 +405,28 @@ ddt_phys_total_refcnt(const ddt_entry_t *dde)
 	return (refcnt);
 }
 
+/*
+ * The class an entry with these phys belongs in, or DDT_CLASSES if it
+ * has no references left.
+ */
+enum ddt_class
+ddt_phys_class(const ddt_phys_t *ddp)
+{
+	uint64_t refcnt = 0;
+	int p;
+
+	for (p = DDT_PHYS_SINGLE; p <= DDT_PHYS_TRIPLE; p++)
+		refcnt += ddp[p].ddp_refcnt;
+
+	if (refcnt == 0)
+		return (DDT_CLASSES);
+	if (ddp[DDT_PHYS_DITTO].ddp_phys_birth != 0)
+		return (DDT_CLASS_DITTO);
+	if (refcnt > 1)
+		return (DDT_CLASS_DUPLICATE);
+	return (DDT_CLASS_UNIQUE);
+}
+
 static void
 ddt_stat_generate(ddt_t *ddt, ddt_entry_t *dde, ddt_stat_t *dds)
 {
@@ -683,9 +745,8 @@ ddt_free(ddt_entry_t *dde)
 	for (p = 0; p < DDT_PHYS_TYPES; p++)
 		ASSERT(dde->dde_lead_zio[p] == NULL);
 
-	if (dde->dde_repair_data != NULL)
-		zio_buf_free(dde->dde_repair_data,
-		    DDK_GET_PSIZE(&dde->dde_key));
+	if (dde->dde_repair_abd != NULL)
+		abd_free(dde->dde_repair_abd);
 
 	cv_destroy(&dde->dde_cv);
 	kmem_free(dde, sizeof (*dde));
@@ -711,6 +772,8 @@ ddt_lookup(ddt_t *ddt, const blkptr_t *bp, boolean_t add)
 
 	ASSERT(MUTEX_HELD(&ddt->ddt_lock));
 
+	DDTSTAT_BUMP(ddtstat_lookups);
+
 	ddt_key_fill(&dde_search.dde_key, bp);
 
 	dde = avl_find(&ddt->ddt_tree, &dde_search, &where);
@@ -719,6 +782,8 @@ ddt_lookup(ddt_t *ddt, const blkptr_t *bp, boolean_t add)
 			return (NULL);
 		dde = ddt_alloc(&dde_search.dde_key);
 		avl_insert(&ddt->ddt_tree, dde, where);
+	} else {
+		DDTSTAT_BUMP(ddtstat_lookup_hits);
 	}
 
 	while (dde->dde_loading)
@@ -727,6 +792,20 @@ ddt_lookup(ddt_t *ddt, const blkptr_t *bp, boolean_t add)
 	if (dde->dde_loaded)
 		return (dde);
 
+	/*
+	 * An entry that changed recently is in the logs, and is more
+	 * current there than in the ZAPs.
+	 */
+	if (ddt_log_lookup(ddt, dde)) {
+		DDTSTAT_BUMP(ddtstat_lookup_log_hits);
+		dde->dde_loaded = B_TRUE;
+		if (dde->dde_type != DDT_TYPES)
+			ddt_stat_update(ddt, dde, -1ULL);
+		return (dde);
+	}
+
+	DDTSTAT_BUMP(ddtstat_lookup_misses);
+
 	dde->dde_loading = B_TRUE;
 
 	ddt_exit(ddt);
@@ -752,6 +831,8 @@ ddt_lookup(ddt_t *ddt, const blkptr_t *bp, boolean_t add)
 
 	dde->dde_type = type;	/* will be DDT_TYPES if no entry found */
 	dde->dde_class = class;	/* will be DDT_CLASSES if no entry found */
+	dde->dde_zap_type = type;
+	dde->dde_zap_class = class;
 	dde->dde_loaded = B_TRUE;
 	dde->dde_loading = B_FALSE;
 
@@ -763,16 +844,21 @@ ddt_lookup(ddt_t *ddt, const blkptr_t *bp, boolean_t add)
 	return (dde);
 }
 
-void
+/*
+ * Start reading the ZAP leaves that may hold bp's entry, unless the entry
+ * is already in core.  Returns B_TRUE if any reads were issued.
+ */
+boolean_t
 ddt_prefetch(spa_t *spa, const blkptr_t *bp)
 {
 	ddt_t *ddt;
 	ddt_entry_t dde;
 	enum ddt_type type;
 	enum ddt_class class;
+	boolean_t cached, issued = B_FALSE;
 
 	if (!zfs_dedup_prefetch || bp == NULL || !BP_GET_DEDUP(bp))
-		return;
+		return (B_FALSE);
 
 	/*
 	 * We only remove the DDT once all tables are empty and only
@@ -782,20 +868,32 @@ ddt_prefetch(spa_t *spa, const blkptr_t *bp)
 	ddt = ddt_select(spa, bp);
 	ddt_key_fill(&dde.dde_key, bp);
 
+	ddt_enter(ddt);
+	cached = (avl_find(&ddt->ddt_tree, &dde, NULL) != NULL ||
+	    ddt_log_find(ddt, &dde.dde_key) != NULL);
+	ddt_exit(ddt);
+
+	if (cached)
+		return (B_FALSE);
+
 	for (type = 0; type < DDT_TYPES; type++) {
 		for (class = 0; class < DDT_CLASSES; class++) {
-			ddt_object_prefetch(ddt, type, class, &dde);
+			if (ddt_object_prefetch(ddt, type, class, &dde))
+				issued = B_TRUE;
 		}
 	}
+
+	if (issued)
+		DDTSTAT_BUMP(ddtstat_prefetches);
+
+	return (issued);
 }
 
 int
-ddt_entry_compare(const void *x1, const void *x2)
+ddt_key_compare(const ddt_key_t *k1, const ddt_key_t *k2)
 {
-	const ddt_entry_t *dde1 = x1;
-	const ddt_entry_t *dde2 = x2;
-	const uint64_t *u1 = (const uint64_t *)&dde1->dde_key;
-	const uint64_t *u2 = (const uint64_t *)&dde2->dde_key;
+	const uint64_t *u1 = (const uint64_t *)k1;
+	const uint64_t *u2 = (const uint64_t *)k2;
 	int i;
 
 	for (i = 0; i < DDT_KEY_WORDS; i++) {
@@ -808,6 +906,15 @@ ddt_entry_compare(const void *x1, const void *x2)
 	return (0);
 }
 
+int
+ddt_entry_compare(const void *x1, const void *x2)
+{
+	const ddt_entry_t *dde1 = x1;
+	const ddt_entry_t *dde2 = x2;
+
+	return (ddt_key_compare(&dde1->dde_key, &dde2->dde_key));
+}
+
 static ddt_t *
 ddt_table_alloc(spa_t *spa, enum zio_checksum c)
 {
@@ -824,6 +931,7 @@ ddt_table_alloc(spa_t *spa, enum zio_checksum c)
 	ddt->ddt_checksum = c;
 	ddt->ddt_spa = spa;
 	ddt->ddt_os = spa->spa_meta_objset;
+	ddt_log_init(ddt);
 
 	return (ddt);
 }
@@ -833,12 +941,38 @@ ddt_table_free(ddt_t *ddt)
 {
 	ASSERT(avl_numnodes(&ddt->ddt_tree) == 0);
 	ASSERT(avl_numnodes(&ddt->ddt_repair_tree) == 0);
+	ddt_log_fini(ddt);
 	avl_destroy(&ddt->ddt_tree);
 	avl_destroy(&ddt->ddt_repair_tree);
 	mutex_destroy(&ddt->ddt_lock);
 	kmem_free(ddt, sizeof (*ddt));
 }
 
+void
+ddt_init(void)
+{
+	ddt_log_cache_init();
+
+	ddt_ksp = kstat_create("zfs", 0, "ddt_stats", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (ddt_stats) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+	if (ddt_ksp != NULL) {
+		ddt_ksp->ks_data = &ddt_stats;
+		kstat_install(ddt_ksp);
+	}
+}
+
+void
+ddt_fini(void)
+{
+	if (ddt_ksp != NULL) {
+		kstat_delete(ddt_ksp);
+		ddt_ksp = NULL;
+	}
+
+	ddt_log_cache_fini();
+}
+
 void
 ddt_create(spa_t *spa)
 {
@@ -878,6 +1012,10 @@ ddt_load(spa_t *spa)
 			}
 		}
 
+		error = ddt_log_load(ddt);
+		if (error != 0)
+			return (error);
+
 		/*
 		 * Seed the cached histograms.
 		 */
@@ -920,6 +1058,15 @@ ddt_class_contains(spa_t *spa, enum ddt_class max_class, const blkptr_t *bp)
 
 	ddt_key_fill(&(dde->dde_key), bp);
 
+	ddt_enter(ddt);
+	if (ddt_log_lookup(ddt, dde)) {
+		ddt_exit(ddt);
+		class = dde->dde_class;
+		kmem_free(dde, sizeof(ddt_entry_t));
+		return (class <= max_class);
+	}
+	ddt_exit(ddt);
+
 	for (type = 0; type < DDT_TYPES; type++) {
 		for (class = 0; class <= max_class; class++) {
 			if (ddt_object_lookup(ddt, type, class, dde) == 0) {
@@ -945,6 +1092,16 @@ ddt_repair_start(ddt_t *ddt, const blkptr_t *bp)
 
 	dde = ddt_alloc(&ddk);
 
+	ddt_enter(ddt);
+	if (ddt_log_lookup(ddt, dde)) {
+		ddt_exit(ddt);
+		if (dde->dde_class == DDT_CLASS_UNIQUE ||
+		    dde->dde_class == DDT_CLASSES)
+			bzero(dde->dde_phys, sizeof (dde->dde_phys));
+		return (dde);
+	}
+	ddt_exit(ddt);
+
 	for (type = 0; type < DDT_TYPES; type++) {
 		for (class = 0; class < DDT_CLASSES; class++) {
 			/*
@@ -970,7 +1127,7 @@ ddt_repair_done(ddt_t *ddt, ddt_entry_t *dde)
 
 	ddt_enter(ddt);
 
-	if (dde->dde_repair_data != NULL && spa_writeable(ddt->ddt_spa) &&
+	if (dde->dde_repair_abd != NULL && spa_writeable(ddt->ddt_spa) &&
 	    avl_find(&ddt->ddt_repair_tree, dde, &where) == NULL)
 		avl_insert(&ddt->ddt_repair_tree, dde, where);
 	else
@@ -1008,7 +1165,7 @@ ddt_repair_entry(ddt_t *ddt, ddt_entry_t *dde, ddt_entry_t *rdde, zio_t *rio)
 			continue;
 		ddt_bp_create(ddt->ddt_checksum, ddk, ddp, &blk);
 		zio_nowait(zio_rewrite(zio, zio->io_spa, 0, &blk,
-		    rdde->dde_repair_data, DDK_GET_PSIZE(rddk), NULL, NULL,
+		    rdde->dde_repair_abd, DDK_GET_PSIZE(rddk), NULL, NULL,
 		    ZIO_PRIORITY_SYNC_WRITE, ZIO_DDT_CHILD_FLAGS(zio), NULL));
 	}
 
@@ -1040,8 +1197,13 @@ ddt_repair_table(ddt_t *ddt, zio_t *rio)
 	ddt_exit(ddt);
 }
 
+/*
+ * Write dde's new state out: to the active log if dlu is set, or straight
+ * to the ZAPs otherwise.
+ */
 static void
-ddt_sync_entry(ddt_t *ddt, ddt_entry_t *dde, dmu_tx_t *tx, uint64_t txg)
+ddt_sync_entry(ddt_t *ddt, ddt_entry_t *dde, ddt_log_update_t *dlu,
+    dmu_tx_t *tx, uint64_t txg)
 {
 	dsl_pool_t *dp = ddt->ddt_spa->spa_dsl_pool;
 	ddt_phys_t *ddp = dde->dde_phys;
@@ -1079,7 +1241,13 @@ ddt_sync_entry(ddt_t *ddt, ddt_entry_t *dde, dmu_tx_t *tx, uint64_t txg)
 	else
 		nclass = DDT_CLASS_UNIQUE;
 
-	if (otype != DDT_TYPES &&
+	if (dlu != NULL) {
+		/*
+		 * The ZAPs are brought up to date when the record is
+		 * flushed; see ddt_log_flush().
+		 */
+		ddt_log_append(ddt, dlu, dde);
+	} else if (otype != DDT_TYPES &&
 	    (otype != ntype || oclass != nclass || total_refcnt == 0)) {
 		VERIFY(ddt_object_remove(ddt, otype, oclass, dde, tx) == 0);
 		ASSERT(ddt_object_lookup(ddt, otype, oclass, dde) == ENOENT);
@@ -1091,7 +1259,10 @@ ddt_sync_entry(ddt_t *ddt, ddt_entry_t *dde, dmu_tx_t *tx, uint64_t txg)
 		ddt_stat_update(ddt, dde, 0);
 		if (!ddt_object_exists(ddt, ntype, nclass))
 			ddt_object_create(ddt, ntype, nclass, tx);
-		VERIFY(ddt_object_update(ddt, ntype, nclass, dde, tx) == 0);
+		if (dlu == NULL) {
+			VERIFY(ddt_object_update(ddt, ntype, nclass, dde,
+			    tx) == 0);
+		}
 
 		/*
 		 * If the class changes, the order that we scan this bp
@@ -1107,16 +1278,160 @@ ddt_sync_entry(ddt_t *ddt, ddt_entry_t *dde, dmu_tx_t *tx, uint64_t txg)
 	}
 }
 
+/*
+ * Write a flushing-log entry to the ZAPs: remove the key from the ZAP
+ * that held it when it was logged, and add it to the one for its class
+ * now.  dde is scratch space.
+ */
+static void
+ddt_flush_entry(ddt_t *ddt, ddt_log_entry_t *ddle, ddt_entry_t *dde,
+    dmu_tx_t *tx)
+{
+	enum ddt_type otype = ddle->ddle_type;
+	enum ddt_class oclass = ddle->ddle_class;
+	enum ddt_type ntype = DDT_TYPE_CURRENT;
+	enum ddt_class nclass = ddt_phys_class(ddle->ddle_phys);
+
+	dde->dde_key = ddle->ddle_key;
+	bcopy(ddle->ddle_phys, dde->dde_phys, sizeof (dde->dde_phys));
+
+	if (otype != DDT_TYPES &&
+	    (otype != ntype || oclass != nclass || nclass == DDT_CLASSES)) {
+		VERIFY(ddt_object_remove(ddt, otype, oclass, dde, tx) == 0);
+	}
+
+	if (nclass != DDT_CLASSES) {
+		if (!ddt_object_exists(ddt, ntype, nclass))
+			ddt_object_create(ddt, ntype, nclass, tx);
+		VERIFY(ddt_object_update(ddt, ntype, nclass, dde, tx) == 0);
+	}
+}
+
+static void
+ddt_flush_prefetch(ddt_t *ddt, ddt_log_entry_t *ddle, ddt_entry_t *dde)
+{
+	enum ddt_class nclass = ddt_phys_class(ddle->ddle_phys);
+
+	dde->dde_key = ddle->ddle_key;
+	if (ddle->ddle_type != DDT_TYPES) {
+		(void) ddt_object_prefetch(ddt, ddle->ddle_type,
+		    ddle->ddle_class, dde);
+	}
+	if (nclass != DDT_CLASSES && nclass != ddle->ddle_class)
+		(void) ddt_object_prefetch(ddt, DDT_TYPE_CURRENT, nclass, dde);
+}
+
+/*
+ * Write up to nflush entries of the flushing log to the ZAPs, in key
+ * order, swapping the logs whenever the flushing log runs dry.  Entries
+ * the active log supersedes are dropped unwritten.
+ */
+static void
+ddt_log_flush(ddt_t *ddt, uint64_t nflush, dmu_tx_t *tx)
+{
+	ddt_log_entry_t *ddle, *pf = NULL;
+	ddt_entry_t *dde;
+	avl_tree_t *t;
+	uint64_t n = 0, ahead = 0;
+
+	dde = kmem_zalloc(sizeof (ddt_entry_t), KM_PUSHPAGE);
+
+	while (n < nflush) {
+		t = &ddt->ddt_log_flushing->ddl_tree;
+		ddle = avl_first(t);
+		if (ddle == NULL) {
+			if (!ddt_log_swap(ddt, tx))
+				break;
+			pf = NULL;
+			ahead = 0;
+			continue;
+		}
+
+		/*
+		 * Keep the ZAP reads zfs_dedup_log_flush_prefetch entries
+		 * ahead of the updates.
+		 */
+		if (ahead == 0)
+			pf = ddle;
+		while (pf != NULL && ahead < zfs_dedup_log_flush_prefetch &&
+		    n + ahead < nflush) {
+			ddt_flush_prefetch(ddt, pf, dde);
+			pf = AVL_NEXT(t, pf);
+			ahead++;
+		}
+
+		if (avl_find(&ddt->ddt_log_active->ddl_tree, ddle,
+		    NULL) == NULL)
+			ddt_flush_entry(ddt, ddle, dde, tx);
+		ddt_log_flushed(ddt, ddle);
+		if (ahead > 0)
+			ahead--;
+		n++;
+	}
+
+	/*
+	 * The last entry flushed may have emptied the log just as n reached
+	 * nflush.  Truncate it now, rather than leave records on disk that
+	 * are already in the ZAPs to be replayed and flushed again.
+	 */
+	if (avl_numnodes(&ddt->ddt_log_flushing->ddl_tree) == 0)
+		(void) ddt_log_swap(ddt, tx);
+
+	ddt_log_checkpoint(ddt, tx);
+
+	kmem_free(dde, sizeof (ddt_entry_t));
+}
+
+/*
+ * Decide how much of the flushing log to write to the ZAPs this txg.
+ */
+static void
+ddt_sync_flush(ddt_t *ddt, dmu_tx_t *tx)
+{
+	dsl_scan_t *scn = ddt->ddt_spa->spa_dsl_pool->dp_scan;
+	uint64_t nflush, mem;
+
+	if (scn != NULL && dsl_scan_ddt_walking(scn)) {
+		/*
+		 * The scan walks the ZAPs, so keep them complete until it
+		 * is done with them; see dsl_scan_ddt().
+		 */
+		nflush = UINT64_MAX;
+	} else if (spa_sync_pass(ddt->ddt_spa) > 1) {
+		return;
+	} else {
+		nflush = MAX(zfs_dedup_log_flush_entries_min,
+		    ddt->ddt_log_flush_rate);
+
+		mem = (avl_numnodes(&ddt->ddt_log_active->ddl_tree) +
+		    avl_numnodes(&ddt->ddt_log_flushing->ddl_tree)) *
+		    sizeof (ddt_log_entry_t);
+		if (mem > zfs_dedup_log_mem_max) {
+			nflush = MAX(nflush,
+			    avl_numnodes(&ddt->ddt_log_flushing->ddl_tree));
+			DDTSTAT_BUMP(ddtstat_log_flushed_forced);
+		}
+	}
+
+	ddt_log_flush(ddt, nflush, tx);
+}
+
 static void
 ddt_sync_table(ddt_t *ddt, dmu_tx_t *tx, uint64_t txg)
 {
 	spa_t *spa = ddt->ddt_spa;
+	ddt_log_update_t dlu, *dlup = NULL;
 	ddt_entry_t *dde;
 	void *cookie = NULL;
 	enum ddt_type type;
 	enum ddt_class class;
 
-	if (avl_numnodes(&ddt->ddt_tree) == 0)
+	/*
+	 * Only flush the logs in the first pass, so that a txg with
+	 * nothing else to do still converges.
+	 */
+	if (avl_numnodes(&ddt->ddt_tree) == 0 &&
+	    (spa_sync_pass(spa) > 1 || !ddt_log_pending(ddt)))
 		return;
 
 	ASSERT(spa->spa_uberblock.ub_version >= SPA_VERSION_DEDUP);
@@ -1127,11 +1442,26 @@ ddt_sync_table(ddt_t *ddt, dmu_tx_t *tx, uint64_t txg)
 		    DMU_POOL_DDT_STATS, tx);
 	}
 
+	if (ddt->ddt_log_active == NULL &&
+	    spa_feature_is_enabled(spa,
+	    &spa_feature_table[SPA_FEATURE_DEDUP_LOG]))
+		ddt_log_create(ddt, tx);
+
+	if (ddt->ddt_log_active != NULL) {
+		dlup = &dlu;
+		ddt_log_begin(ddt, dlup, tx);
+	}
+
 	while ((dde = avl_destroy_nodes(&ddt->ddt_tree, &cookie)) != NULL) {
-		ddt_sync_entry(ddt, dde, tx, txg);
+		ddt_sync_entry(ddt, dde, dlup, tx, txg);
 		ddt_free(dde);
 	}
 
+	if (dlup != NULL) {
+		ddt_log_commit(ddt, dlup);
+		ddt_sync_flush(ddt, tx);
+	}
+
 	for (type = 0; type < DDT_TYPES; type++) {
 		uint64_t add, count = 0;
 		for (class = 0; class < DDT_CLASSES; class++) {
@@ -1143,7 +1473,8 @@ ddt_sync_table(ddt_t *ddt, dmu_tx_t *tx, uint64_t txg)
 			}
 		}
 		for (class = 0; class < DDT_CLASSES; class++) {
-			if (count == 0 && ddt_object_exists(ddt, type, class))
+			if (count == 0 && !ddt_log_pending(ddt) &&
+			    ddt_object_exists(ddt, type, class))
 				ddt_object_destroy(ddt, type, class, tx);
 		}
 	}
@@ -1210,4 +1541,20 @@ ddt_walk(spa_t *spa, ddt_bookmark_t *ddb, ddt_entry_t *dde)
 #if defined(_KERNEL) && defined(HAVE_SPL)
 module_param(zfs_dedup_prefetch, int, 0644);
 MODULE_PARM_DESC(zfs_dedup_prefetch,"Enable prefetching dedup-ed blks");
+
+module_param(zfs_dedup_log_flush_entries_min, int, 0644);
+MODULE_PARM_DESC(zfs_dedup_log_flush_entries_min,
+	"Min DDT log entries to flush per txg");
+
+module_param(zfs_dedup_log_flush_txgs, int, 0644);
+MODULE_PARM_DESC(zfs_dedup_log_flush_txgs,
+	"Txgs to spread the flush of a DDT log over");
+
+module_param(zfs_dedup_log_mem_max, ulong, 0644);
+MODULE_PARM_DESC(zfs_dedup_log_mem_max,
+	"Max bytes of DDT log entries in core before forcing a flush");
+
+module_param(zfs_dedup_log_flush_prefetch, int, 0644);
+MODULE_PARM_DESC(zfs_dedup_log_flush_prefetch,
+	"DDT log entries to prefetch ahead of the flush");
 #endif
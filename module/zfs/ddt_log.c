@@ -0,0 +1,575 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/spa.h>
+#include <sys/spa_impl.h>
+#include <sys/zio.h>
+#include <sys/ddt.h>
+#include <sys/zap.h>
+#include <sys/dmu_tx.h>
+#include <sys/zio_checksum.h>
+#include <sys/zfeature.h>
+
+/*
+ * DDT log
+ *
+ * Without the log, ddt_sync() writes every entry that changed in a txg
+ * to the DDT ZAPs in that txg.  Each of those is a random update of a
+ * ZAP leaf, and once the DDT no longer fits in the ARC each of them
+ * starts with a random read.
+ *
+ * With the dedup_log feature active, each ddt has two log objects in the
+ * MOS.  ddt_sync() appends the changed entries to the active log as
+ * fixed-size records, and keeps the latest record for each key in core,
+ * in the log's AVL tree.  Meanwhile it writes the entries of the other,
+ * flushing, log to the ZAPs a few at a time (see ddt_sync_flush()), in
+ * key order, which is also the order of the ZAP leaves.  Once the
+ * flushing log is empty it is truncated, and the logs trade places.
+ *
+ * Lookups search the in-core trees before the ZAPs, the active log first,
+ * so an entry that changed recently never costs a read.  Each record
+ * notes which ZAP object held the key when it was appended, so that the
+ * flush knows where to remove it from; since an entry that is also in the
+ * active log is dropped from the flushing log without being written, the
+ * ZAPs don't change under a record before it is flushed.
+ *
+ * The logs, their headers and the ZAPs all change in the same txg.  The
+ * flushing log's header records the last key it wrote to the ZAPs, so at
+ * import ddt_log_load() skips the records that have been flushed already.
+ *
+ * The trees are only changed in syncing context, or while the pool is
+ * being loaded or unloaded, and always under ddt_lock, since lookups from
+ * open context (ddt_prefetch() and scrub repair) search them too.
+ */
+
+#define	DDT_LOG_BATCH \
+	((1 << DDT_LOG_BLOCKSHIFT) / sizeof (ddt_log_record_t))
+
+static kmem_cache_t *ddt_log_entry_cache;
+
+static int
+ddt_log_entry_compare(const void *x1, const void *x2)
+{
+	const ddt_log_entry_t *ddle1 = x1;
+	const ddt_log_entry_t *ddle2 = x2;
+
+	return (ddt_key_compare(&ddle1->ddle_key, &ddle2->ddle_key));
+}
+
+static void
+ddt_log_name(ddt_t *ddt, int n, char *name)
+{
+	(void) snprintf(name, DDT_NAMELEN, DMU_POOL_DDT_LOG,
+	    zio_checksum_table[ddt->ddt_checksum].ci_name, n);
+}
+
+void
+ddt_log_init(ddt_t *ddt)
+{
+	int n;
+
+	for (n = 0; n < 2; n++) {
+		avl_create(&ddt->ddt_log[n].ddl_tree, ddt_log_entry_compare,
+		    sizeof (ddt_log_entry_t),
+		    offsetof(ddt_log_entry_t, ddle_node));
+	}
+}
+
+void
+ddt_log_fini(ddt_t *ddt)
+{
+	ddt_log_entry_t *ddle;
+	void *cookie;
+	int n;
+
+	for (n = 0; n < 2; n++) {
+		ddt_log_t *ddl = &ddt->ddt_log[n];
+
+		cookie = NULL;
+		while ((ddle = avl_destroy_nodes(&ddl->ddl_tree,
+		    &cookie)) != NULL) {
+			kmem_cache_free(ddt_log_entry_cache, ddle);
+			DDTSTAT_INCR(ddtstat_log_entries, -1);
+		}
+		avl_destroy(&ddl->ddl_tree);
+		if (ddt->ddt_log_active != NULL) {
+			DDTSTAT_INCR(ddtstat_log_bytes,
+			    -ddl->ddl_phys.dlp_length);
+		}
+	}
+
+	DDTSTAT_INCR(ddtstat_log_flush_rate, -ddt->ddt_log_flush_rate);
+	ddt->ddt_log_active = NULL;
+	ddt->ddt_log_flushing = NULL;
+}
+
+void
+ddt_log_cache_init(void)
+{
+	ddt_log_entry_cache = kmem_cache_create("ddt_log_entry_cache",
+	    sizeof (ddt_log_entry_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
+}
+
+void
+ddt_log_cache_fini(void)
+{
+	kmem_cache_destroy(ddt_log_entry_cache);
+}
+
+static void
+ddt_log_sync_phys(ddt_t *ddt, ddt_log_t *ddl, dmu_tx_t *tx)
+{
+	dmu_buf_t *db;
+
+	VERIFY0(dmu_bonus_hold(ddt->ddt_os, ddl->ddl_object, FTAG, &db));
+	dmu_buf_will_dirty(db, tx);
+	bcopy(&ddl->ddl_phys, db->db_data, sizeof (ddt_log_phys_t));
+	dmu_buf_rele(db, FTAG);
+}
+
+/*
+ * Create the ddt's logs, the first time it syncs with the feature
+ * enabled.  Like the DDT ZAPs, they are named in the pool directory.
+ */
+void
+ddt_log_create(ddt_t *ddt, dmu_tx_t *tx)
+{
+	spa_t *spa = ddt->ddt_spa;
+	objset_t *os = ddt->ddt_os;
+	char name[DDT_NAMELEN];
+	int n;
+
+	ASSERT(ddt->ddt_log_active == NULL);
+
+	for (n = 0; n < 2; n++) {
+		ddt_log_t *ddl = &ddt->ddt_log[n];
+
+		ddl->ddl_object = dmu_object_alloc(os,
+		    DMU_OTN_UINT64_METADATA, 1 << DDT_LOG_BLOCKSHIFT,
+		    DMU_OTN_UINT64_METADATA, sizeof (ddt_log_phys_t), tx);
+		bzero(&ddl->ddl_phys, sizeof (ddt_log_phys_t));
+
+		ddt_log_name(ddt, n, name);
+		VERIFY0(zap_add(os, DMU_POOL_DIRECTORY_OBJECT, name,
+		    sizeof (uint64_t), 1, &ddl->ddl_object, tx));
+	}
+
+	ddt_enter(ddt);
+	ddt->ddt_log_active = &ddt->ddt_log[0];
+	ddt->ddt_log_flushing = &ddt->ddt_log[1];
+	ddt_exit(ddt);
+
+	spa_feature_incr(spa, &spa_feature_table[SPA_FEATURE_DEDUP_LOG], tx);
+}
+
+/*
+ * Make dlr the latest state of its key in ddl.
+ */
+static void
+ddt_log_insert(ddt_log_t *ddl, const ddt_log_record_t *dlr)
+{
+	ddt_log_entry_t *ddle, search;
+	avl_index_t where;
+
+	search.ddle_key = dlr->dlr_key;
+	ddle = avl_find(&ddl->ddl_tree, &search, &where);
+	if (ddle == NULL) {
+		ddle = kmem_cache_alloc(ddt_log_entry_cache, KM_PUSHPAGE);
+		ddle->ddle_key = dlr->dlr_key;
+		avl_insert(&ddl->ddl_tree, ddle, where);
+		DDTSTAT_BUMP(ddtstat_log_entries);
+	}
+
+	bcopy(dlr->dlr_phys, ddle->ddle_phys, sizeof (ddle->ddle_phys));
+	ddle->ddle_type = DLR_GET_TYPE(dlr);
+	ddle->ddle_class = DLR_GET_CLASS(dlr);
+}
+
+/*
+ * Read a log's records into its tree.  Records of the flushing log up to
+ * its checkpoint are already in the ZAPs.
+ */
+static int
+ddt_log_replay(ddt_t *ddt, ddt_log_t *ddl)
+{
+	ddt_log_phys_t *dlp = &ddl->ddl_phys;
+	ddt_log_record_t *buf, *dlr;
+	uint64_t bufsize, offset, size, replayed = 0;
+	int error = 0;
+	int i;
+
+	if (P2PHASE(dlp->dlp_length, sizeof (ddt_log_record_t)) != 0)
+		return (SET_ERROR(EIO));
+
+	bufsize = DDT_LOG_BATCH * sizeof (ddt_log_record_t);
+	buf = kmem_alloc(bufsize, KM_PUSHPAGE);
+
+	if (dlp->dlp_length > bufsize)
+		dmu_prefetch(ddt->ddt_os, ddl->ddl_object, bufsize,
+		    dlp->dlp_length - bufsize);
+
+	for (offset = 0; offset < dlp->dlp_length; offset += size) {
+		size = MIN(dlp->dlp_length - offset, bufsize);
+
+		error = dmu_read(ddt->ddt_os, ddl->ddl_object, offset, size,
+		    buf, DMU_READ_PREFETCH);
+		if (error != 0)
+			break;
+
+		for (i = 0; i < size / sizeof (ddt_log_record_t); i++) {
+			dlr = &buf[i];
+			if ((dlp->dlp_flags & DDT_LOG_FLAG_CHECKPOINT) &&
+			    ddt_key_compare(&dlr->dlr_key,
+			    &dlp->dlp_checkpoint) <= 0)
+				continue;
+			ddt_log_insert(ddl, dlr);
+			replayed++;
+		}
+	}
+
+	kmem_free(buf, bufsize);
+
+	DDTSTAT_INCR(ddtstat_log_replayed, replayed);
+
+	return (error);
+}
+
+/*
+ * Find the ddt's logs, if it has any, and read them into core.
+ */
+int
+ddt_log_load(ddt_t *ddt)
+{
+	char name[DDT_NAMELEN];
+	dmu_buf_t *db;
+	ddt_log_t *ddl;
+	int error, n;
+
+	for (n = 0; n < 2; n++) {
+		ddl = &ddt->ddt_log[n];
+
+		ddt_log_name(ddt, n, name);
+		error = zap_lookup(ddt->ddt_os, DMU_POOL_DIRECTORY_OBJECT,
+		    name, sizeof (uint64_t), 1, &ddl->ddl_object);
+		if (error == ENOENT && n == 0)
+			return (0);
+		if (error != 0)
+			return (error);
+
+		error = dmu_bonus_hold(ddt->ddt_os, ddl->ddl_object, FTAG, &db);
+		if (error != 0)
+			return (error);
+		bcopy(db->db_data, &ddl->ddl_phys, sizeof (ddt_log_phys_t));
+		dmu_buf_rele(db, FTAG);
+	}
+
+	if (ddt->ddt_log[0].ddl_phys.dlp_flags & DDT_LOG_FLAG_FLUSHING) {
+		ddt->ddt_log_flushing = &ddt->ddt_log[0];
+		ddt->ddt_log_active = &ddt->ddt_log[1];
+	} else {
+		ddt->ddt_log_active = &ddt->ddt_log[0];
+		ddt->ddt_log_flushing = &ddt->ddt_log[1];
+	}
+
+	for (n = 0; n < 2; n++) {
+		DDTSTAT_INCR(ddtstat_log_bytes,
+		    ddt->ddt_log[n].ddl_phys.dlp_length);
+	}
+
+	for (n = 0; n < 2; n++) {
+		error = ddt_log_replay(ddt, &ddt->ddt_log[n]);
+		if (error != 0)
+			return (error);
+	}
+
+	ddt->ddt_log_flush_rate = howmany(
+	    avl_numnodes(&ddt->ddt_log_flushing->ddl_tree),
+	    MAX(zfs_dedup_log_flush_txgs, 1));
+	DDTSTAT_INCR(ddtstat_log_flush_rate, ddt->ddt_log_flush_rate);
+
+	return (0);
+}
+
+/*
+ * Are there entries in the logs that haven't reached the ZAPs?
+ */
+boolean_t
+ddt_log_pending(ddt_t *ddt)
+{
+	return (ddt->ddt_log_active != NULL &&
+	    (avl_numnodes(&ddt->ddt_log_active->ddl_tree) != 0 ||
+	    avl_numnodes(&ddt->ddt_log_flushing->ddl_tree) != 0));
+}
+
+/*
+ * Return the latest logged state of a key, or NULL if it has none.
+ */
+ddt_log_entry_t *
+ddt_log_find(ddt_t *ddt, const ddt_key_t *ddk)
+{
+	ddt_log_entry_t *ddle, search;
+
+	ASSERT(MUTEX_HELD(&ddt->ddt_lock));
+
+	if (ddt->ddt_log_active == NULL)
+		return (NULL);
+
+	search.ddle_key = *ddk;
+	ddle = avl_find(&ddt->ddt_log_active->ddl_tree, &search, NULL);
+	if (ddle == NULL)
+		ddle = avl_find(&ddt->ddt_log_flushing->ddl_tree, &search,
+		    NULL);
+
+	return (ddle);
+}
+
+static void
+ddt_log_entry_load(const ddt_log_entry_t *ddle, ddt_entry_t *dde)
+{
+	bcopy(ddle->ddle_phys, dde->dde_phys, sizeof (dde->dde_phys));
+	dde->dde_class = ddt_phys_class(dde->dde_phys);
+	dde->dde_type = (dde->dde_class == DDT_CLASSES) ?
+	    DDT_TYPES : DDT_TYPE_CURRENT;
+	dde->dde_zap_type = ddle->ddle_type;
+	dde->dde_zap_class = ddle->ddle_class;
+}
+
+/*
+ * Fill in dde from the logs, if its key is logged.  dde_type and
+ * dde_class are DDT_TYPES and DDT_CLASSES if the entry was removed.
+ */
+boolean_t
+ddt_log_lookup(ddt_t *ddt, ddt_entry_t *dde)
+{
+	ddt_log_entry_t *ddle;
+
+	ddle = ddt_log_find(ddt, &dde->dde_key);
+	if (ddle == NULL)
+		return (B_FALSE);
+
+	ddt_log_entry_load(ddle, dde);
+
+	return (B_TRUE);
+}
+
+void
+ddt_log_begin(ddt_t *ddt, ddt_log_update_t *dlu, dmu_tx_t *tx)
+{
+	ASSERT(ddt->ddt_log_active != NULL);
+
+	dlu->dlu_tx = tx;
+	dlu->dlu_buf = kmem_alloc(DDT_LOG_BATCH * sizeof (ddt_log_record_t),
+	    KM_PUSHPAGE);
+	dlu->dlu_count = 0;
+	dlu->dlu_dirty = B_FALSE;
+}
+
+static void
+ddt_log_write(ddt_t *ddt, ddt_log_update_t *dlu)
+{
+	ddt_log_t *ddl = ddt->ddt_log_active;
+	uint64_t size = dlu->dlu_count * sizeof (ddt_log_record_t);
+
+	if (size == 0)
+		return;
+
+	dmu_write(ddt->ddt_os, ddl->ddl_object, ddl->ddl_phys.dlp_length,
+	    size, dlu->dlu_buf, dlu->dlu_tx);
+	ddl->ddl_phys.dlp_length += size;
+
+	DDTSTAT_INCR(ddtstat_log_bytes, size);
+	DDTSTAT_INCR(ddtstat_log_appended, dlu->dlu_count);
+
+	dlu->dlu_count = 0;
+	dlu->dlu_dirty = B_TRUE;
+}
+
+/*
+ * Append dde's new state to the active log.  ddt_sync_entry() calls this
+ * in place of updating the ZAPs.
+ */
+void
+ddt_log_append(ddt_t *ddt, ddt_log_update_t *dlu, const ddt_entry_t *dde)
+{
+	ddt_log_record_t *dlr = &dlu->dlu_buf[dlu->dlu_count];
+
+	dlr->dlr_key = dde->dde_key;
+	dlr->dlr_info = 0;
+	DLR_SET_TYPE(dlr, dde->dde_zap_type);
+	DLR_SET_CLASS(dlr, dde->dde_zap_class);
+	bcopy(dde->dde_phys, dlr->dlr_phys, sizeof (dlr->dlr_phys));
+
+	ddt_enter(ddt);
+	ddt_log_insert(ddt->ddt_log_active, dlr);
+	ddt_exit(ddt);
+
+	if (++dlu->dlu_count == DDT_LOG_BATCH)
+		ddt_log_write(ddt, dlu);
+}
+
+void
+ddt_log_commit(ddt_t *ddt, ddt_log_update_t *dlu)
+{
+	ddt_log_write(ddt, dlu);
+
+	if (dlu->dlu_dirty)
+		ddt_log_sync_phys(ddt, ddt->ddt_log_active, dlu->dlu_tx);
+
+	kmem_free(dlu->dlu_buf, DDT_LOG_BATCH * sizeof (ddt_log_record_t));
+	dlu->dlu_buf = NULL;
+}
+
+/*
+ * The caller has written ddle to the ZAPs, or found that the active log
+ * supersedes it: drop it from the flushing log and move the checkpoint
+ * past it.  The checkpoint reaches disk in ddt_log_checkpoint().
+ */
+void
+ddt_log_flushed(ddt_t *ddt, ddt_log_entry_t *ddle)
+{
+	ddt_log_t *ddl = ddt->ddt_log_flushing;
+
+	ASSERT3P(avl_first(&ddl->ddl_tree), ==, ddle);
+
+	ddl->ddl_phys.dlp_checkpoint = ddle->ddle_key;
+	ddl->ddl_phys.dlp_flags |= DDT_LOG_FLAG_CHECKPOINT;
+	ddl->ddl_checkpoint_dirty = B_TRUE;
+
+	ddt_enter(ddt);
+	avl_remove(&ddl->ddl_tree, ddle);
+	ddt_exit(ddt);
+
+	kmem_cache_free(ddt_log_entry_cache, ddle);
+	DDTSTAT_INCR(ddtstat_log_entries, -1);
+	DDTSTAT_BUMP(ddtstat_log_flushed);
+}
+
+/*
+ * Write the flushing log's checkpoint, once this txg's share of it has
+ * been flushed.  The caller has already swapped an emptied log out, so
+ * any checkpoint still pending here belongs to a log with records left.
+ */
+void
+ddt_log_checkpoint(ddt_t *ddt, dmu_tx_t *tx)
+{
+	ddt_log_t *ddl = ddt->ddt_log_flushing;
+
+	if (ddl->ddl_checkpoint_dirty) {
+		ddt_log_sync_phys(ddt, ddl, tx);
+		ddl->ddl_checkpoint_dirty = B_FALSE;
+	}
+}
+
+/*
+ * Once the flushing log is empty, truncate it, and if the active log has
+ * anything in it, swap the two.  Returns B_FALSE if there is nothing left
+ * to flush.
+ */
+boolean_t
+ddt_log_swap(ddt_t *ddt, dmu_tx_t *tx)
+{
+	ddt_log_t *ddl = ddt->ddt_log_flushing;
+	ddt_log_t *active = ddt->ddt_log_active;
+	uint64_t rate;
+
+	ASSERT0(avl_numnodes(&ddl->ddl_tree));
+
+	if (ddl->ddl_phys.dlp_length != 0 || ddl->ddl_phys.dlp_flags != 0) {
+		VERIFY0(dmu_free_range(ddt->ddt_os, ddl->ddl_object,
+		    0, DMU_OBJECT_END, tx));
+		DDTSTAT_INCR(ddtstat_log_bytes, -ddl->ddl_phys.dlp_length);
+		bzero(&ddl->ddl_phys, sizeof (ddt_log_phys_t));
+		ddt_log_sync_phys(ddt, ddl, tx);
+	}
+	ddl->ddl_checkpoint_dirty = B_FALSE;
+
+	if (avl_numnodes(&active->ddl_tree) == 0)
+		return (B_FALSE);
+
+	active->ddl_phys.dlp_flags |= DDT_LOG_FLAG_FLUSHING;
+	ddt_log_sync_phys(ddt, active, tx);
+
+	ddt_enter(ddt);
+	ddt->ddt_log_flushing = active;
+	ddt->ddt_log_active = ddl;
+	ddt_exit(ddt);
+
+	rate = howmany(avl_numnodes(&active->ddl_tree),
+	    MAX(zfs_dedup_log_flush_txgs, 1));
+	DDTSTAT_INCR(ddtstat_log_flush_rate, rate - ddt->ddt_log_flush_rate);
+	ddt->ddt_log_flush_rate = rate;
+
+	return (B_TRUE);
+}
+
+static ddt_log_entry_t *
+ddt_log_next(avl_tree_t *t, ddt_log_entry_t *search)
+{
+	ddt_log_entry_t *ddle;
+	avl_index_t where;
+
+	ddle = avl_find(t, search, &where);
+	if (ddle != NULL)
+		return (AVL_NEXT(t, ddle));
+
+	return (avl_nearest(t, where, AVL_AFTER));
+}
+
+/*
+ * Walk the logged entries in key order, starting after dde->dde_key (start
+ * with a zeroed dde), and fill in dde with the latest state of each.
+ * Removed entries are skipped.  ddt_walk() still returns the ZAP copy of
+ * a logged entry, so a caller that wants each entry once must skip those
+ * itself with ddt_log_find(), as zdb's leak detection does.
+ */
+int
+ddt_log_walk(ddt_t *ddt, ddt_entry_t *dde)
+{
+	ddt_log_entry_t *a, *f, *ddle, search;
+
+	if (ddt->ddt_log_active == NULL)
+		return (SET_ERROR(ENOENT));
+
+	search.ddle_key = dde->dde_key;
+
+	ddt_enter(ddt);
+	do {
+		a = ddt_log_next(&ddt->ddt_log_active->ddl_tree, &search);
+		f = ddt_log_next(&ddt->ddt_log_flushing->ddl_tree, &search);
+		if (a == NULL && f == NULL) {
+			ddt_exit(ddt);
+			return (SET_ERROR(ENOENT));
+		}
+		if (a == NULL || (f != NULL &&
+		    ddt_key_compare(&f->ddle_key, &a->ddle_key) < 0))
+			ddle = f;
+		else
+			ddle = a;
+		search.ddle_key = ddle->ddle_key;
+	} while (ddt_phys_class(ddle->ddle_phys) == DDT_CLASSES);
+
+	dde->dde_key = ddle->ddle_key;
+	ddt_log_entry_load(ddle, dde);
+	ddt_exit(ddt);
+
+	return (0);
+}
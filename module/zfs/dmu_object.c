@@ -27,36 +27,108 @@
 #include <sys/dmu_tx.h>
 #include <sys/dnode.h>
 
+/*
+ * Each CPU allocates object numbers from its own chunk of
+ * 2^dmu_object_alloc_chunk_shift dnodes, so creates on different CPUs
+ * neither share os_obj_lock nor dirty the same dnode blocks.  os_obj_lock
+ * is only taken to hand out the next chunk.
+ */
+int dmu_object_alloc_chunk_shift = 7;
+
 uint64_t
 dmu_object_alloc(objset_t *os, dmu_object_type_t ot, int blocksize,
     dmu_object_type_t bonustype, int bonuslen, dmu_tx_t *tx)
+{
+	return (dmu_object_alloc_dnsize(os, ot, blocksize, bonustype, bonuslen,
+	    0, tx));
+}
+
+uint64_t
+dmu_object_alloc_dnsize(objset_t *os, dmu_object_type_t ot, int blocksize,
+    dmu_object_type_t bonustype, int bonuslen, int dnodesize, dmu_tx_t *tx)
 {
 	uint64_t object;
 	uint64_t L2_dnode_count = DNODES_PER_BLOCK <<
 	    (DMU_META_DNODE(os)->dn_indblkshift - SPA_BLKPTRSHIFT);
+	uint64_t dnodes_per_chunk = 1ULL << dmu_object_alloc_chunk_shift;
+	uint64_t *cpuobj;
 	dnode_t *dn = NULL;
+	int dn_slots = dnodesize >> DNODE_SHIFT;
 	int restarted = B_FALSE;
 
-	mutex_enter(&os->os_obj_lock);
+	if (dn_slots == 0)
+		dn_slots = DNODE_MIN_SLOTS;
+	ASSERT3S(dn_slots, >=, DNODE_MIN_SLOTS);
+	ASSERT3S(dn_slots, <=, DNODE_MAX_SLOTS);
+
+	kpreempt_disable();
+	cpuobj = &os->os_obj_next_percpu[CPU_SEQID %
+	    os->os_obj_next_percpu_len];
+	kpreempt_enable();
+
+	/*
+	 * A chunk must cover at least one dnode block, so that CPUs don't
+	 * contend on the same dbuf, and at most one L2 bp worth of dnodes,
+	 * so that the sparse-block search below still kicks in.
+	 */
+	dnodes_per_chunk = MAX(dnodes_per_chunk, DNODES_PER_BLOCK);
+	dnodes_per_chunk = MIN(dnodes_per_chunk, L2_dnode_count);
+
+	object = *cpuobj;
 	for (;;) {
-		object = os->os_obj_next;
 		/*
-		 * Each time we polish off an L2 bp worth of dnodes
-		 * (2^13 objects), move to another L2 bp that's still
-		 * reasonably sparse (at most 1/4 full).  Look from the
-		 * beginning once, but after that keep looking from here.
-		 * If we can't find one, just keep going from here.
+		 * If we finished a chunk of dnodes, get a new one from
+		 * the objset-wide cursor.
 		 */
-		if (P2PHASE(object, L2_dnode_count) == 0) {
-			uint64_t offset = restarted ? object << DNODE_SHIFT : 0;
-			int error = dnode_next_offset(DMU_META_DNODE(os),
-			    DNODE_FIND_HOLE,
-			    &offset, 2, DNODES_PER_BLOCK >> 2, 0);
-			restarted = B_TRUE;
-			if (error == 0)
-				object = offset >> DNODE_SHIFT;
+		if (P2PHASE(object, dnodes_per_chunk) == 0) {
+			mutex_enter(&os->os_obj_lock);
+			ASSERT0(P2PHASE(os->os_obj_next_chunk,
+			    dnodes_per_chunk));
+			object = os->os_obj_next_chunk;
+
+			/*
+			 * Each time we polish off an L2 bp worth of dnodes
+			 * (2^13 objects), move to another L2 bp that's still
+			 * reasonably sparse (at most 1/4 full).  Look from the
+			 * beginning once, but after that keep looking from
+			 * here.  If we can't find one, just keep going from
+			 * here.
+			 */
+			if (P2PHASE(object, L2_dnode_count) == 0) {
+				uint64_t offset = restarted ?
+				    object << DNODE_SHIFT : 0;
+				int error = dnode_next_offset(
+				    DMU_META_DNODE(os), DNODE_FIND_HOLE,
+				    &offset, 2, DNODES_PER_BLOCK >> 2, 0);
+				restarted = B_TRUE;
+				if (error == 0)
+					object = offset >> DNODE_SHIFT;
+			}
+			os->os_obj_next_chunk =
+			    P2ALIGN(object, dnodes_per_chunk) +
+			    dnodes_per_chunk;
+			(void) atomic_swap_64(cpuobj, object);
+			mutex_exit(&os->os_obj_lock);
+		}
+
+		/*
+		 * The value of *cpuobj before the add is the object number
+		 * assigned to us; the value after is the one assigned to
+		 * the next allocation on this CPU.
+		 */
+		object = atomic_add_64_nv(cpuobj, dn_slots) - dn_slots;
+
+		/*
+		 * A dnode's slots can't straddle two dnode blocks.  If there
+		 * isn't room left in this one, start over at the next block,
+		 * which also keeps us from running off the end of the chunk.
+		 */
+		if (P2PHASE(object, DNODES_PER_BLOCK) + dn_slots >
+		    DNODES_PER_BLOCK) {
+			object = P2ROUNDUP(object + 1, DNODES_PER_BLOCK);
+			(void) atomic_swap_64(cpuobj, object);
+			continue;
 		}
-		os->os_obj_next = ++object;
 
 		/*
 		 * XXX We should check for an i/o error here and return
@@ -65,19 +137,35 @@ dmu_object_alloc(objset_t *os, dmu_object_type_t ot, int blocksize,
 		 * to do so.
 		 */
 		(void) dnode_hold_impl(os, object, DNODE_MUST_BE_FREE,
-		    FTAG, &dn);
-		if (dn)
-			break;
+		    dn_slots, FTAG, &dn);
+		if (dn != NULL) {
+			rw_enter(&dn->dn_struct_rwlock, RW_WRITER);
+			/*
+			 * Another CPU's cursor can wander into our chunk
+			 * after dmu_object_next() below, so check again now
+			 * that we have the struct lock.
+			 */
+			if (dn->dn_type == DMU_OT_NONE) {
+				dnode_allocate(dn, ot, blocksize, 0,
+				    bonustype, bonuslen, dn_slots, tx);
+				rw_exit(&dn->dn_struct_rwlock);
+				dnode_rele(dn, FTAG);
+				break;
+			}
+			rw_exit(&dn->dn_struct_rwlock);
+			dnode_rele(dn, FTAG);
+			dn = NULL;
+		}
 
-		if (dmu_object_next(os, &object, B_TRUE, 0) == 0)
-			os->os_obj_next = object - 1;
+		/*
+		 * Skip to the next free object, or failing that to the
+		 * start of the next block of dnodes.
+		 */
+		if (dmu_object_next(os, &object, B_TRUE, 0) != 0)
+			object = P2ROUNDUP(object + 1, DNODES_PER_BLOCK);
+		(void) atomic_swap_64(cpuobj, object);
 	}
 
-	dnode_allocate(dn, ot, blocksize, 0, bonustype, bonuslen, tx);
-	dnode_rele(dn, FTAG);
-
-	mutex_exit(&os->os_obj_lock);
-
 	dmu_tx_add_new_object(tx, os, object);
 	return (object);
 }
@@ -85,17 +173,33 @@ dmu_object_alloc(objset_t *os, dmu_object_type_t ot, int blocksize,
 int
 dmu_object_claim(objset_t *os, uint64_t object, dmu_object_type_t ot,
     int blocksize, dmu_object_type_t bonustype, int bonuslen, dmu_tx_t *tx)
+{
+	return (dmu_object_claim_dnsize(os, object, ot, blocksize, bonustype,
+	    bonuslen, 0, tx));
+}
+
+int
+dmu_object_claim_dnsize(objset_t *os, uint64_t object, dmu_object_type_t ot,
+    int blocksize, dmu_object_type_t bonustype, int bonuslen,
+    int dnodesize, dmu_tx_t *tx)
 {
 	dnode_t *dn;
+	int dn_slots = dnodesize >> DNODE_SHIFT;
 	int err;
 
+	if (dn_slots == 0)
+		dn_slots = DNODE_MIN_SLOTS;
+	ASSERT3S(dn_slots, >=, DNODE_MIN_SLOTS);
+	ASSERT3S(dn_slots, <=, DNODE_MAX_SLOTS);
+
 	if (object == DMU_META_DNODE_OBJECT && !dmu_tx_private_ok(tx))
 		return (EBADF);
 
-	err = dnode_hold_impl(os, object, DNODE_MUST_BE_FREE, FTAG, &dn);
+	err = dnode_hold_impl(os, object, DNODE_MUST_BE_FREE, dn_slots,
+	    FTAG, &dn);
 	if (err)
 		return (err);
-	dnode_allocate(dn, ot, blocksize, 0, bonustype, bonuslen, tx);
+	dnode_allocate(dn, ot, blocksize, 0, bonustype, bonuslen, dn_slots, tx);
 	dnode_rele(dn, FTAG);
 
 	dmu_tx_add_new_object(tx, os, object);
@@ -105,20 +209,40 @@ dmu_object_claim(objset_t *os, uint64_t object, dmu_object_type_t ot,
 int
 dmu_object_reclaim(objset_t *os, uint64_t object, dmu_object_type_t ot,
     int blocksize, dmu_object_type_t bonustype, int bonuslen)
+{
+	return (dmu_object_reclaim_dnsize(os, object, ot, blocksize, bonustype,
+	    bonuslen, 0));
+}
+
+/*
+ * The object keeps the slots it has; a caller that needs a dnode of a
+ * different size must free the object and claim it again.
+ */
+int
+dmu_object_reclaim_dnsize(objset_t *os, uint64_t object, dmu_object_type_t ot,
+    int blocksize, dmu_object_type_t bonustype, int bonuslen, int dnodesize)
 {
 	dnode_t *dn;
 	dmu_tx_t *tx;
 	int nblkptr;
+	int dn_slots = dnodesize >> DNODE_SHIFT;
 	int err;
 
 	if (object == DMU_META_DNODE_OBJECT)
 		return (EBADF);
 
-	err = dnode_hold_impl(os, object, DNODE_MUST_BE_ALLOCATED,
+	err = dnode_hold_impl(os, object, DNODE_MUST_BE_ALLOCATED, 0,
 	    FTAG, &dn);
 	if (err)
 		return (err);
 
+	if (dn_slots == 0)
+		dn_slots = dn->dn_num_slots;
+	if (dn_slots != dn->dn_num_slots) {
+		dnode_rele(dn, FTAG);
+		return (EINVAL);
+	}
+
 	if (dn->dn_type == ot && dn->dn_datablksz == blocksize &&
 	    dn->dn_bonustype == bonustype && dn->dn_bonuslen == bonuslen) {
 		/* nothing is changing, this is a noop */
@@ -129,7 +253,9 @@ dmu_object_reclaim(objset_t *os, uint64_t object, dmu_object_type_t ot,
 	if (bonustype == DMU_OT_SA) {
 		nblkptr = 1;
 	} else {
-		nblkptr = 1 + ((DN_MAX_BONUSLEN - bonuslen) >> SPA_BLKPTRSHIFT);
+		nblkptr = MIN(DN_MAX_NBLKPTR, 1 +
+		    ((DN_SLOTS_TO_BONUSLEN(dn_slots) - bonuslen) >>
+		    SPA_BLKPTRSHIFT));
 	}
 
 	/*
@@ -151,7 +277,7 @@ dmu_object_reclaim(objset_t *os, uint64_t object, dmu_object_type_t ot,
 		goto out;
 	}
 
-	dnode_reallocate(dn, ot, blocksize, bonustype, bonuslen, tx);
+	dnode_reallocate(dn, ot, blocksize, bonustype, bonuslen, dn_slots, tx);
 
 	dmu_tx_commit(tx);
 out:
@@ -168,7 +294,7 @@ dmu_object_free(objset_t *os, uint64_t object, dmu_tx_t *tx)
 
 	ASSERT(object != DMU_META_DNODE_OBJECT || dmu_tx_private_ok(tx));
 
-	err = dnode_hold_impl(os, object, DNODE_MUST_BE_ALLOCATED,
+	err = dnode_hold_impl(os, object, DNODE_MUST_BE_ALLOCATED, 0,
 	    FTAG, &dn);
 	if (err)
 		return (err);
@@ -185,8 +311,18 @@ int
 dmu_object_next(objset_t *os, uint64_t *objectp, boolean_t hole, uint64_t txg)
 {
 	uint64_t offset = (*objectp + 1) << DNODE_SHIFT;
+	dnode_t *dn;
 	int error;
 
+	/*
+	 * Start past all of the slots of the current object, or we would
+	 * land in the middle of a large dnode.
+	 */
+	if (*objectp != 0 && dnode_hold(os, *objectp, FTAG, &dn) == 0) {
+		offset = (*objectp + dn->dn_num_slots) << DNODE_SHIFT;
+		dnode_rele(dn, FTAG);
+	}
+
 	error = dnode_next_offset(DMU_META_DNODE(os),
 	    (hole ? DNODE_FIND_HOLE : 0), &offset, 0, DNODES_PER_BLOCK, txg);
 
@@ -197,8 +333,15 @@ dmu_object_next(objset_t *os, uint64_t *objectp, boolean_t hole, uint64_t txg)
 
 #if defined(_KERNEL) && defined(HAVE_SPL)
 EXPORT_SYMBOL(dmu_object_alloc);
+EXPORT_SYMBOL(dmu_object_alloc_dnsize);
 EXPORT_SYMBOL(dmu_object_claim);
+EXPORT_SYMBOL(dmu_object_claim_dnsize);
 EXPORT_SYMBOL(dmu_object_reclaim);
+EXPORT_SYMBOL(dmu_object_reclaim_dnsize);
 EXPORT_SYMBOL(dmu_object_free);
 EXPORT_SYMBOL(dmu_object_next);
+
+module_param(dmu_object_alloc_chunk_shift, int, 0644);
+MODULE_PARM_DESC(dmu_object_alloc_chunk_shift,
+	"CPU-specific allocator grabs 2^N objects at once");
 #endif
@@ -50,6 +50,7 @@
 #include <sys/zfs_onexit.h>
 #include <sys/dmu_send.h>
 #include <sys/dsl_destroy.h>
+#include <sys/zfeature.h>
 
 
 /* Set this tunable to TRUE to replace corrupt data with 0x2f5baddb10c */
@@ -197,13 +198,24 @@ dump_data(dmu_sendarg_t *dsp, dmu_object_type_t type,
 	drrw->drr_offset = offset;
 	drrw->drr_length = blksz;
 	drrw->drr_toguid = dsp->dsa_toguid;
-	drrw->drr_checksumtype = BP_GET_CHECKSUM(bp);
-	if (zio_checksum_table[drrw->drr_checksumtype].ci_dedup)
-		drrw->drr_checksumflags |= DRR_CHECKSUM_DEDUP;
-	DDK_SET_LSIZE(&drrw->drr_key, BP_GET_LSIZE(bp));
-	DDK_SET_PSIZE(&drrw->drr_key, BP_GET_PSIZE(bp));
-	DDK_SET_COMPRESS(&drrw->drr_key, BP_GET_COMPRESS(bp));
-	drrw->drr_key.ddk_cksum = bp->blk_cksum;
+	if (BP_IS_EMBEDDED(bp)) {
+		/*
+		 * Embedded blocks go out as ordinary writes, so the stream
+		 * stays receivable anywhere; the receiving pool embeds them
+		 * again if it can.  There's no checksum in the bp, so (like
+		 * fletcher4-checksummed blocks) userland will have to
+		 * compute a dedup-capable checksum itself.
+		 */
+		drrw->drr_checksumtype = ZIO_CHECKSUM_OFF;
+	} else {
+		drrw->drr_checksumtype = BP_GET_CHECKSUM(bp);
+		if (zio_checksum_table[drrw->drr_checksumtype].ci_dedup)
+			drrw->drr_checksumflags |= DRR_CHECKSUM_DEDUP;
+		DDK_SET_LSIZE(&drrw->drr_key, BP_GET_LSIZE(bp));
+		DDK_SET_PSIZE(&drrw->drr_key, BP_GET_PSIZE(bp));
+		DDK_SET_COMPRESS(&drrw->drr_key, BP_GET_COMPRESS(bp));
+		drrw->drr_key.ddk_cksum = bp->blk_cksum;
+	}
 
 	if (dump_bytes(dsp, dsp->dsa_drr, sizeof (dmu_replay_record_t)) != 0)
 		return (EINTR);
@@ -311,6 +323,7 @@ dump_dnode(dmu_sendarg_t *dsp, uint64_t object, dnode_phys_t *dnp)
 	drro->drr_bonuslen = dnp->dn_bonuslen;
 	drro->drr_checksumtype = dnp->dn_checksum;
 	drro->drr_compress = dnp->dn_compress;
+	drro->drr_dn_slots = dnp->dn_extra_slots + 1;
 	drro->drr_toguid = dsp->dsa_toguid;
 
 	if (dump_bytes(dsp, dsp->dsa_drr, sizeof (dmu_replay_record_t)) != 0)
@@ -369,7 +382,8 @@ backup_cb(spa_t *spa, zilog_t *zilog, const blkptr_t *bp,
 			return (EIO);
 
 		blk = abuf->b_data;
-		for (i = 0; i < blksz >> DNODE_SHIFT; i++) {
+		for (i = 0; i < blksz >> DNODE_SHIFT;
+		    i += blk[i].dn_extra_slots + 1) {
 			uint64_t dnobj = (zb->zb_blkid <<
 			    (DNODE_BLOCK_SHIFT - DNODE_SHIFT)) + i;
 			err = dump_dnode(dsp, dnobj, blk+i);
@@ -474,6 +488,28 @@ dmu_send_impl(void *tag, dsl_pool_t *dp, dsl_dataset_t *ds,
 	}
 #endif
 
+	/*
+	 * Once the pool has written blocks larger than 128k, any dataset
+	 * may hold them, and a receiver without large block support must
+	 * refuse the stream rather than fail on the first such record.
+	 */
+	if (spa_feature_is_active(dp->dp_spa,
+	    &spa_feature_table[SPA_FEATURE_LARGE_BLOCKS])) {
+		DMU_SET_FEATUREFLAGS(drr->drr_u.drr_begin.drr_versioninfo,
+		    DMU_GET_FEATUREFLAGS(
+		    drr->drr_u.drr_begin.drr_versioninfo) |
+		    DMU_BACKUP_FEATURE_LARGE_BLOCKS);
+	}
+
+	/* The same goes for dnodes larger than 512 bytes. */
+	if (spa_feature_is_active(dp->dp_spa,
+	    &spa_feature_table[SPA_FEATURE_LARGE_DNODE])) {
+		DMU_SET_FEATUREFLAGS(drr->drr_u.drr_begin.drr_versioninfo,
+		    DMU_GET_FEATUREFLAGS(
+		    drr->drr_u.drr_begin.drr_versioninfo) |
+		    DMU_BACKUP_FEATURE_LARGE_DNODE);
+	}
+
 	drr->drr_u.drr_begin.drr_creation_time =
 	    ds->ds_phys->ds_creation_time;
 	drr->drr_u.drr_begin.drr_type = dmu_objset_type(os);
@@ -782,6 +818,22 @@ dmu_recv_begin_check(void *arg, dmu_tx_t *tx)
 		return (ENOTSUP);
 	}
 
+	/* Verify pool supports large blocks if LARGE_BLOCKS feature set */
+	if ((DMU_GET_FEATUREFLAGS(drrb->drr_versioninfo) &
+	    DMU_BACKUP_FEATURE_LARGE_BLOCKS) &&
+	    !spa_feature_is_enabled(dp->dp_spa,
+	    &spa_feature_table[SPA_FEATURE_LARGE_BLOCKS])) {
+		return (ENOTSUP);
+	}
+
+	/* Verify pool supports large dnodes if LARGE_DNODE feature set */
+	if ((DMU_GET_FEATUREFLAGS(drrb->drr_versioninfo) &
+	    DMU_BACKUP_FEATURE_LARGE_DNODE) &&
+	    !spa_feature_is_enabled(dp->dp_spa,
+	    &spa_feature_table[SPA_FEATURE_LARGE_DNODE])) {
+		return (ENOTSUP);
+	}
+
 	error = dsl_dataset_hold(dp, tofs, FTAG, &ds);
 	if (error == 0) {
 		/* target fs already exists; recv into temp clone */
@@ -853,6 +905,22 @@ dmu_recv_begin_sync(void *arg, dmu_tx_t *tx)
 	crflags = (drrb->drr_flags & DRR_FLAG_CI_DATA) ?
 	    DS_FLAG_CI_DATASET : 0;
 
+	if ((DMU_GET_FEATUREFLAGS(drrb->drr_versioninfo) &
+	    DMU_BACKUP_FEATURE_LARGE_BLOCKS) &&
+	    !spa_feature_is_active(dp->dp_spa,
+	    &spa_feature_table[SPA_FEATURE_LARGE_BLOCKS])) {
+		spa_feature_incr(dp->dp_spa,
+		    &spa_feature_table[SPA_FEATURE_LARGE_BLOCKS], tx);
+	}
+
+	if ((DMU_GET_FEATUREFLAGS(drrb->drr_versioninfo) &
+	    DMU_BACKUP_FEATURE_LARGE_DNODE) &&
+	    !spa_feature_is_active(dp->dp_spa,
+	    &spa_feature_table[SPA_FEATURE_LARGE_DNODE])) {
+		spa_feature_incr(dp->dp_spa,
+		    &spa_feature_table[SPA_FEATURE_LARGE_DNODE], tx);
+	}
+
 	error = dsl_dataset_hold(dp, tofs, FTAG, &ds);
 	if (error == 0) {
 		/* create temporary clone */
@@ -959,6 +1027,7 @@ struct restorearg {
 	int bufsize; /* amount of memory allocated for buf */
 	zio_cksum_t cksum;
 	avl_tree_t *guid_to_ds_map;
+	uint64_t featureflags;
 };
 
 typedef struct guid_map_entry {
@@ -1003,6 +1072,7 @@ restore_read(struct restorearg *ra, int len)
 
 	/* some things will require 8-byte alignment, so everything must */
 	ASSERT0(len % 8);
+	ASSERT3U(len, <=, ra->bufsize);
 
 	while (done < len) {
 		ssize_t resid;
@@ -1116,7 +1186,10 @@ restore_object(struct restorearg *ra, objset_t *os, struct drr_object *drro)
 {
 	int err;
 	dmu_tx_t *tx;
+	dmu_object_info_t doi;
 	void *data = NULL;
+	int dn_slots = drro->drr_dn_slots != 0 ?
+	    drro->drr_dn_slots : DNODE_MIN_SLOTS;
 
 	if (drro->drr_type == DMU_OT_NONE ||
 	    !DMU_OT_IS_VALID(drro->drr_type) ||
@@ -1125,16 +1198,53 @@ restore_object(struct restorearg *ra, objset_t *os, struct drr_object *drro)
 	    drro->drr_compress >= ZIO_COMPRESS_FUNCTIONS ||
 	    P2PHASE(drro->drr_blksz, SPA_MINBLOCKSIZE) ||
 	    drro->drr_blksz < SPA_MINBLOCKSIZE ||
-	    drro->drr_blksz > SPA_MAXBLOCKSIZE ||
-	    drro->drr_bonuslen > DN_MAX_BONUSLEN) {
+	    drro->drr_blksz > spa_maxblocksize(dmu_objset_spa(os)) ||
+	    dn_slots > DNODE_MAX_SLOTS ||
+	    drro->drr_bonuslen > DN_SLOTS_TO_BONUSLEN(dn_slots)) {
 		return (EINVAL);
 	}
 
-	err = dmu_object_info(os, drro->drr_object, NULL);
+	/*
+	 * Only a stream that advertises large dnodes may carry them.
+	 */
+	if (dn_slots > 1 &&
+	    !(ra->featureflags & DMU_BACKUP_FEATURE_LARGE_DNODE))
+		return (EINVAL);
+
+	err = dmu_object_info(os, drro->drr_object, &doi);
 
 	if (err != 0 && err != ENOENT)
 		return (EINVAL);
 
+	/*
+	 * A dnode can't change size in place.  If the object now takes a
+	 * different number of slots, free it and claim it afresh; likewise
+	 * free anything in the slots a larger dnode is about to take over.
+	 * The frees only take effect once they sync.
+	 */
+	if (err == 0 && doi.doi_dnodesize != (dn_slots << DNODE_SHIFT)) {
+		err = dmu_free_object(os, drro->drr_object);
+		if (err != 0)
+			return (EINVAL);
+		err = ENOENT;
+		txg_wait_synced(dmu_objset_pool(os), 0);
+	}
+	if (err == ENOENT && dn_slots > DNODE_MIN_SLOTS) {
+		uint64_t obj;
+		boolean_t freed = B_FALSE;
+
+		for (obj = drro->drr_object + 1;
+		    obj < drro->drr_object + dn_slots; obj++) {
+			if (dmu_object_info(os, obj, NULL) != 0)
+				continue;
+			if (dmu_free_object(os, obj) != 0)
+				return (EINVAL);
+			freed = B_TRUE;
+		}
+		if (freed)
+			txg_wait_synced(dmu_objset_pool(os), 0);
+	}
+
 	if (drro->drr_bonuslen) {
 		data = restore_read(ra, P2ROUNDUP(drro->drr_bonuslen, 8));
 		if (ra->err != 0)
@@ -1150,15 +1260,17 @@ restore_object(struct restorearg *ra, objset_t *os, struct drr_object *drro)
 			dmu_tx_abort(tx);
 			return (err);
 		}
-		err = dmu_object_claim(os, drro->drr_object,
+		err = dmu_object_claim_dnsize(os, drro->drr_object,
 		    drro->drr_type, drro->drr_blksz,
-		    drro->drr_bonustype, drro->drr_bonuslen, tx);
+		    drro->drr_bonustype, drro->drr_bonuslen,
+		    dn_slots << DNODE_SHIFT, tx);
 		dmu_tx_commit(tx);
 	} else {
 		/* currently allocated, want to be allocated */
-		err = dmu_object_reclaim(os, drro->drr_object,
+		err = dmu_object_reclaim_dnsize(os, drro->drr_object,
 		    drro->drr_type, drro->drr_blksz,
-		    drro->drr_bonustype, drro->drr_bonuslen);
+		    drro->drr_bonustype, drro->drr_bonuslen,
+		    dn_slots << DNODE_SHIFT);
 	}
 	if (err != 0) {
 		return (EINVAL);
@@ -1230,6 +1342,7 @@ restore_write(struct restorearg *ra, objset_t *os,
 	int err;
 
 	if (drrw->drr_offset + drrw->drr_length < drrw->drr_offset ||
+	    drrw->drr_length > SPA_MAXBLOCKSIZE ||
 	    !DMU_OT_IS_VALID(drrw->drr_type))
 		return (EINVAL);
 
@@ -1328,7 +1441,7 @@ restore_spill(struct restorearg *ra, objset_t *os, struct drr_spill *drrs)
 	int err;
 
 	if (drrs->drr_length < SPA_MINBLOCKSIZE ||
-	    drrs->drr_length > SPA_MAXBLOCKSIZE)
+	    drrs->drr_length > SPA_OLD_MAXBLOCKSIZE)
 		return (EINVAL);
 
 	data = restore_read(ra, drrs->drr_length);
@@ -1417,7 +1530,7 @@ dmu_recv_stream(dmu_recv_cookie_t *drc, struct vnode *vp, offset_t *voffp,
 	ra.vp = vp;
 
 	ra.voff = *voffp;
-	ra.bufsize = 1<<20;
+	ra.bufsize = SPA_MAXBLOCKSIZE;
 	ra.buf = vmem_alloc(ra.bufsize, KM_SLEEP);
 
 	/* these were verified in dmu_recv_begin */
@@ -1433,6 +1546,7 @@ dmu_recv_stream(dmu_recv_cookie_t *drc, struct vnode *vp, offset_t *voffp,
 	ASSERT(drc->drc_ds->ds_phys->ds_flags & DS_FLAG_INCONSISTENT);
 
 	featureflags = DMU_GET_FEATUREFLAGS(drc->drc_drrb->drr_versioninfo);
+	ra.featureflags = featureflags;
 
 	/* if this stream is dedup'ed, set up the avl tree for guid mapping */
 	if (featureflags & DMU_BACKUP_FEATURE_DEDUP) {
@@ -105,6 +105,7 @@ dnode_cons(void *arg, void *unused, int kmflag)
 	dn->dn_assigned_txg = 0;
 	dn->dn_dirtyctx = 0;
 	dn->dn_dirtyctx_firstset = NULL;
+	dn->dn_compress_misses = 0;
 	dn->dn_bonus = NULL;
 	dn->dn_have_spill = B_FALSE;
 	dn->dn_zio = NULL;
@@ -121,6 +122,7 @@ dnode_cons(void *arg, void *unused, int kmflag)
 	    offsetof(dmu_buf_impl_t, db_link));
 
 	dn->dn_moved = 0;
+	dn->dn_num_slots = 0;
 	return (0);
 }
 
@@ -157,6 +159,7 @@ dnode_dest(void *arg, void *unused)
 	ASSERT0(dn->dn_assigned_txg);
 	ASSERT0(dn->dn_dirtyctx);
 	ASSERT3P(dn->dn_dirtyctx_firstset, ==, NULL);
+	ASSERT0(dn->dn_compress_misses);
 	ASSERT3P(dn->dn_bonus, ==, NULL);
 	ASSERT(!dn->dn_have_spill);
 	ASSERT3P(dn->dn_zio, ==, NULL);
@@ -210,6 +213,7 @@ dnode_verify(dnode_t *dn)
 	}
 	if (dn->dn_phys->dn_type != DMU_OT_NONE || dn->dn_allocated_txg != 0) {
 		int i;
+		int max_bonuslen = DN_SLOTS_TO_BONUSLEN(dn->dn_num_slots);
 		ASSERT3U(dn->dn_indblkshift, <=, SPA_MAXBLOCKSHIFT);
 		if (dn->dn_datablkshift) {
 			ASSERT3U(dn->dn_datablkshift, >=, SPA_MINBLOCKSHIFT);
@@ -220,12 +224,12 @@ dnode_verify(dnode_t *dn)
 		ASSERT(DMU_OT_IS_VALID(dn->dn_type));
 		ASSERT3U(dn->dn_nblkptr, >=, 1);
 		ASSERT3U(dn->dn_nblkptr, <=, DN_MAX_NBLKPTR);
-		ASSERT3U(dn->dn_bonuslen, <=, DN_MAX_BONUSLEN);
+		ASSERT3U(dn->dn_bonuslen, <=, max_bonuslen);
 		ASSERT3U(dn->dn_datablksz, ==,
 		    dn->dn_datablkszsec << SPA_MINBLOCKSHIFT);
 		ASSERT3U(ISP2(dn->dn_datablksz), ==, dn->dn_datablkshift != 0);
 		ASSERT3U((dn->dn_nblkptr - 1) * sizeof (blkptr_t) +
-		    dn->dn_bonuslen, <=, DN_MAX_BONUSLEN);
+		    dn->dn_bonuslen, <=, max_bonuslen);
 		for (i = 0; i < TXG_SIZE; i++) {
 			ASSERT3U(dn->dn_next_nlevels[i], <=, dn->dn_nlevels);
 		}
@@ -254,6 +258,8 @@ dnode_byteswap(dnode_phys_t *dnp)
 		return;
 	}
 
+	/* dn_extra_slots is only one byte, so it needs no swapping. */
+
 	dnp->dn_datablkszsec = BSWAP_16(dnp->dn_datablkszsec);
 	dnp->dn_bonuslen = BSWAP_16(dnp->dn_bonuslen);
 	dnp->dn_maxblkid = BSWAP_64(dnp->dn_maxblkid);
@@ -282,7 +288,8 @@ dnode_byteswap(dnode_phys_t *dnp)
 		 * dnode buffer).
 		 */
 		int off = (dnp->dn_nblkptr-1) * sizeof (blkptr_t);
-		size_t len = DN_MAX_BONUSLEN - off;
+		size_t len = DN_SLOTS_TO_BONUSLEN(dnp->dn_extra_slots + 1) -
+		    off;
 		dmu_object_byteswap_t byteswap;
 		ASSERT(DMU_OT_IS_VALID(dnp->dn_bonustype));
 		byteswap = DMU_OT_BYTESWAP(dnp->dn_bonustype);
@@ -291,23 +298,29 @@ dnode_byteswap(dnode_phys_t *dnp)
 
 	/* Swap SPILL block if we have one */
 	if (dnp->dn_flags & DNODE_FLAG_SPILL_BLKPTR)
-		byteswap_uint64_array(&dnp->dn_spill, sizeof (blkptr_t));
+		byteswap_uint64_array(DN_SPILL_BLKPTR(dnp), sizeof (blkptr_t));
 
 }
 
 void
 dnode_buf_byteswap(void *vbuf, size_t size)
 {
-	dnode_phys_t *buf = vbuf;
-	int i;
+	int i = 0;
 
 	ASSERT3U(sizeof (dnode_phys_t), ==, (1<<DNODE_SHIFT));
 	ASSERT((size & (sizeof (dnode_phys_t)-1)) == 0);
 
-	size >>= DNODE_SHIFT;
-	for (i = 0; i < size; i++) {
-		dnode_byteswap(buf);
-		buf++;
+	/*
+	 * Step over the slots of each dnode as a whole; the trailing
+	 * slots of a large dnode hold its bonus buffer, not dnodes.
+	 */
+	while (i < size) {
+		dnode_phys_t *dnp = (void *)(((char *)vbuf) + i);
+		dnode_byteswap(dnp);
+
+		i += DNODE_MIN_SIZE;
+		if (dnp->dn_type != DMU_OT_NONE)
+			i += dnp->dn_extra_slots * DNODE_MIN_SIZE;
 	}
 }
 
@@ -331,7 +344,7 @@ dnode_setbonuslen(dnode_t *dn, int newsize, dmu_tx_t *tx)
 
 	dnode_setdirty(dn, tx);
 	rw_enter(&dn->dn_struct_rwlock, RW_WRITER);
-	ASSERT3U(newsize, <=, DN_MAX_BONUSLEN -
+	ASSERT3U(newsize, <=, DN_SLOTS_TO_BONUSLEN(dn->dn_num_slots) -
 	    (dn->dn_nblkptr-1) * sizeof (blkptr_t));
 	dn->dn_bonuslen = newsize;
 	if (newsize == 0)
@@ -409,8 +422,11 @@ dnode_create(objset_t *os, dnode_phys_t *dnp, dmu_buf_impl_t *db,
 	dn->dn_bonustype = dnp->dn_bonustype;
 	dn->dn_bonuslen = dnp->dn_bonuslen;
 	dn->dn_maxblkid = dnp->dn_maxblkid;
+	dn->dn_num_slots = (dnp->dn_type == DMU_OT_NONE) ?
+	    DNODE_MIN_SLOTS : dnp->dn_extra_slots + 1;
 	dn->dn_have_spill = ((dnp->dn_flags & DNODE_FLAG_SPILL_BLKPTR) != 0);
 	dn->dn_id_flags = 0;
+	dn->dn_compress_misses = 0;
 
 	dmu_zfetch_init(&dn->dn_zfetch, dn);
 
@@ -474,6 +490,8 @@ dnode_destroy(dnode_t *dn)
 	dn->dn_newuid = 0;
 	dn->dn_newgid = 0;
 	dn->dn_id_flags = 0;
+	dn->dn_compress_misses = 0;
+	dn->dn_num_slots = 0;
 
 	dmu_zfetch_rele(&dn->dn_zfetch);
 	kmem_cache_free(dnode_cache, dn);
@@ -483,10 +501,13 @@ dnode_destroy(dnode_t *dn)
 
 void
 dnode_allocate(dnode_t *dn, dmu_object_type_t ot, int blocksize, int ibs,
-    dmu_object_type_t bonustype, int bonuslen, dmu_tx_t *tx)
+    dmu_object_type_t bonustype, int bonuslen, int dn_slots, dmu_tx_t *tx)
 {
 	int i;
 
+	ASSERT3S(dn_slots, >=, DNODE_MIN_SLOTS);
+	ASSERT3S(dn_slots, <=, DNODE_MAX_SLOTS);
+
 	if (blocksize == 0)
 		blocksize = 1 << zfs_default_bs;
 	else if (blocksize > SPA_MAXBLOCKSIZE)
@@ -499,8 +520,8 @@ dnode_allocate(dnode_t *dn, dmu_object_type_t ot, int blocksize, int ibs,
 
 	ibs = MIN(MAX(ibs, DN_MIN_INDBLKSHIFT), DN_MAX_INDBLKSHIFT);
 
-	dprintf("os=%p obj=%llu txg=%llu blocksize=%d ibs=%d\n", dn->dn_objset,
-	    dn->dn_object, tx->tx_txg, blocksize, ibs);
+	dprintf("os=%p obj=%llu txg=%llu blocksize=%d ibs=%d dn_slots=%d\n",
+	    dn->dn_objset, dn->dn_object, tx->tx_txg, blocksize, ibs, dn_slots);
 
 	ASSERT(dn->dn_type == DMU_OT_NONE);
 	ASSERT(bcmp(dn->dn_phys, &dnode_phys_zero, sizeof (dnode_phys_t)) == 0);
@@ -511,7 +532,7 @@ dnode_allocate(dnode_t *dn, dmu_object_type_t ot, int blocksize, int ibs,
 	    (bonustype == DMU_OT_SA && bonuslen == 0) ||
 	    (bonustype != DMU_OT_NONE && bonuslen != 0));
 	ASSERT(DMU_OT_IS_VALID(bonustype));
-	ASSERT3U(bonuslen, <=, DN_MAX_BONUSLEN);
+	ASSERT3U(bonuslen, <=, DN_SLOTS_TO_BONUSLEN(dn_slots));
 	ASSERT(dn->dn_type == DMU_OT_NONE);
 	ASSERT0(dn->dn_maxblkid);
 	ASSERT0(dn->dn_allocated_txg);
@@ -537,11 +558,13 @@ dnode_allocate(dnode_t *dn, dmu_object_type_t ot, int blocksize, int ibs,
 	dnode_setdblksz(dn, blocksize);
 	dn->dn_indblkshift = ibs;
 	dn->dn_nlevels = 1;
+	dn->dn_num_slots = dn_slots;
 	if (bonustype == DMU_OT_SA) /* Maximize bonus space for SA */
 		dn->dn_nblkptr = 1;
 	else
-		dn->dn_nblkptr = 1 +
-		    ((DN_MAX_BONUSLEN - bonuslen) >> SPA_BLKPTRSHIFT);
+		dn->dn_nblkptr = MIN(DN_MAX_NBLKPTR, 1 +
+		    ((DN_SLOTS_TO_BONUSLEN(dn_slots) - bonuslen) >>
+		    SPA_BLKPTRSHIFT));
 	dn->dn_bonustype = bonustype;
 	dn->dn_bonuslen = bonuslen;
 	dn->dn_checksum = ZIO_CHECKSUM_INHERIT;
@@ -556,6 +579,7 @@ dnode_allocate(dnode_t *dn, dmu_object_type_t ot, int blocksize, int ibs,
 
 	dn->dn_allocated_txg = tx->tx_txg;
 	dn->dn_id_flags = 0;
+	dn->dn_compress_misses = 0;
 
 	dnode_setdirty(dn, tx);
 	dn->dn_next_indblkshift[tx->tx_txg & TXG_MASK] = ibs;
@@ -566,7 +590,7 @@ dnode_allocate(dnode_t *dn, dmu_object_type_t ot, int blocksize, int ibs,
 
 void
 dnode_reallocate(dnode_t *dn, dmu_object_type_t ot, int blocksize,
-    dmu_object_type_t bonustype, int bonuslen, dmu_tx_t *tx)
+    dmu_object_type_t bonustype, int bonuslen, int dn_slots, dmu_tx_t *tx)
 {
 	int nblkptr;
 
@@ -579,12 +603,19 @@ dnode_reallocate(dnode_t *dn, dmu_object_type_t ot, int blocksize,
 	    (bonustype != DMU_OT_NONE && bonuslen != 0) ||
 	    (bonustype == DMU_OT_SA && bonuslen == 0));
 	ASSERT(DMU_OT_IS_VALID(bonustype));
-	ASSERT3U(bonuslen, <=, DN_MAX_BONUSLEN);
+	ASSERT3U(bonuslen, <=, DN_SLOTS_TO_BONUSLEN(dn_slots));
+
+	/*
+	 * The slots a dnode occupies can't change in place; callers that
+	 * need a different size free the object and claim it again.
+	 */
+	ASSERT3U(dn_slots, ==, dn->dn_num_slots);
 
 	/* clean up any unreferenced dbufs */
 	dnode_evict_dbufs(dn);
 
 	dn->dn_id_flags = 0;
+	dn->dn_compress_misses = 0;
 
 	rw_enter(&dn->dn_struct_rwlock, RW_WRITER);
 	dnode_setdirty(dn, tx);
@@ -602,7 +633,9 @@ dnode_reallocate(dnode_t *dn, dmu_object_type_t ot, int blocksize,
 	if (bonustype == DMU_OT_SA) /* Maximize bonus space for SA */
 		nblkptr = 1;
 	else
-		nblkptr = 1 + ((DN_MAX_BONUSLEN - bonuslen) >> SPA_BLKPTRSHIFT);
+		nblkptr = MIN(DN_MAX_NBLKPTR, 1 +
+		    ((DN_SLOTS_TO_BONUSLEN(dn_slots) - bonuslen) >>
+		    SPA_BLKPTRSHIFT));
 	if (dn->dn_bonustype != bonustype)
 		dn->dn_next_bonustype[tx->tx_txg&TXG_MASK] = bonustype;
 	if (dn->dn_nblkptr != nblkptr)
@@ -627,8 +660,8 @@ dnode_reallocate(dnode_t *dn, dmu_object_type_t ot, int blocksize,
 
 	/* fix up the bonus db_size */
 	if (dn->dn_bonus) {
-		dn->dn_bonus->db.db_size =
-		    DN_MAX_BONUSLEN - (dn->dn_nblkptr-1) * sizeof (blkptr_t);
+		dn->dn_bonus->db.db_size = DN_SLOTS_TO_BONUSLEN(dn_slots) -
+		    (dn->dn_nblkptr-1) * sizeof (blkptr_t);
 		ASSERT(dn->dn_bonuslen <= dn->dn_bonus->db.db_size);
 	}
 
@@ -676,6 +709,7 @@ dnode_move_impl(dnode_t *odn, dnode_t *ndn)
 	ndn->dn_datablkshift = odn->dn_datablkshift;
 	ndn->dn_datablkszsec = odn->dn_datablkszsec;
 	ndn->dn_datablksz = odn->dn_datablksz;
+	ndn->dn_num_slots = odn->dn_num_slots;
 	ndn->dn_maxblkid = odn->dn_maxblkid;
 	bcopy(&odn->dn_next_nblkptr[0], &ndn->dn_next_nblkptr[0],
 	    sizeof (odn->dn_next_nblkptr));
@@ -701,6 +735,7 @@ dnode_move_impl(dnode_t *odn, dnode_t *ndn)
 	ndn->dn_assigned_txg = odn->dn_assigned_txg;
 	ndn->dn_dirtyctx = odn->dn_dirtyctx;
 	ndn->dn_dirtyctx_firstset = odn->dn_dirtyctx_firstset;
+	ndn->dn_compress_misses = odn->dn_compress_misses;
 	ASSERT(refcount_count(&odn->dn_tx_holds) == 0);
 	refcount_transfer(&ndn->dn_holds, &odn->dn_holds);
 	ASSERT(list_is_empty(&ndn->dn_dbufs));
@@ -720,7 +755,6 @@ dnode_move_impl(dnode_t *odn, dnode_t *ndn)
 	list_move_tail(&ndn->dn_zfetch.zf_stream, &odn->dn_zfetch.zf_stream);
 	ndn->dn_zfetch.zf_dnode = odn->dn_zfetch.zf_dnode;
 	ndn->dn_zfetch.zf_stream_cnt = odn->dn_zfetch.zf_stream_cnt;
-	ndn->dn_zfetch.zf_alloc_fail = odn->dn_zfetch.zf_alloc_fail;
 
 	/*
 	 * Update back pointers. Updating the handle fixes the back pointer of
@@ -770,6 +804,7 @@ dnode_move_impl(dnode_t *odn, dnode_t *ndn)
 	odn->dn_assigned_txg = 0;
 	odn->dn_dirtyctx = 0;
 	odn->dn_dirtyctx_firstset = NULL;
+	odn->dn_compress_misses = 0;
 	odn->dn_have_spill = B_FALSE;
 	odn->dn_zio = NULL;
 	odn->dn_oldused = 0;
@@ -1005,18 +1040,96 @@ dnode_buf_pageout(dmu_buf_t *db, void *arg)
 		zrl_destroy(&dnh->dnh_zrlock);
 		dnh->dnh_dnode = NULL;
 	}
+	mutex_destroy(&children_dnodes->dnc_slot_lock);
 	kmem_free(children_dnodes, sizeof (dnode_children_t) +
 	    (epb - 1) * sizeof (dnode_handle_t));
 }
 
+/*
+ * Return the number of slots taken by whatever starts at slot idx of a
+ * dnode block: the in-core dnode is authoritative, since an allocation or
+ * free in open context isn't reflected in the dnode_phys_t until it syncs.
+ * A free dnode that is held counts as well, so that slots reserved by a
+ * DNODE_MUST_BE_FREE hold can't be handed out twice.
+ */
+static int
+dnode_slot_span(dnode_children_t *dnc, dnode_phys_t *dnp, int idx)
+{
+	dnode_t *dn = dnc->dnc_children[idx].dnh_dnode;
+
+	if (dn != NULL) {
+		if (dn->dn_type != DMU_OT_NONE || dn->dn_free_txg != 0 ||
+		    !refcount_is_zero(&dn->dn_holds))
+			return (MAX(dn->dn_num_slots, DNODE_MIN_SLOTS));
+		return (DNODE_MIN_SLOTS);
+	}
+
+	if (dnp[idx].dn_type != DMU_OT_NONE)
+		return (dnp[idx].dn_extra_slots + 1);
+	return (DNODE_MIN_SLOTS);
+}
+
+/*
+ * Is slot idx part of a dnode that starts in an earlier slot?  Only the
+ * first slot of each dnode is meaningful, so walk them from the start of
+ * the block.
+ */
+static boolean_t
+dnode_slot_is_interior(dnode_children_t *dnc, dnode_phys_t *dnp, int idx)
+{
+	int i = 0;
+
+	while (i < idx) {
+		int span = dnode_slot_span(dnc, dnp, i);
+		if (i + span > idx)
+			return (B_TRUE);
+		i += span;
+	}
+	return (B_FALSE);
+}
+
+/*
+ * Are slots idx through idx + slots - 1 all unused?
+ */
+static boolean_t
+dnode_slots_are_free(dnode_children_t *dnc, dnode_phys_t *dnp, int idx,
+    int slots)
+{
+	int i;
+
+	if (idx + slots > dnc->dnc_count)
+		return (B_FALSE);
+	if (dnode_slot_is_interior(dnc, dnp, idx))
+		return (B_FALSE);
+
+	for (i = idx + 1; i < idx + slots; i++) {
+		dnode_t *dn = dnc->dnc_children[i].dnh_dnode;
+
+		if (dn != NULL) {
+			if (dn->dn_type != DMU_OT_NONE || dn->dn_free_txg != 0 ||
+			    !refcount_is_zero(&dn->dn_holds))
+				return (B_FALSE);
+		} else if (dnp[i].dn_type != DMU_OT_NONE) {
+			return (B_FALSE);
+		}
+	}
+	return (B_TRUE);
+}
+
 /*
  * errors:
  * EINVAL - invalid object number.
+ * ENOENT - the object isn't allocated, or is an interior slot of a
+ *          larger dnode (DNODE_MUST_BE_ALLOCATED).
+ * EEXIST - any of the 'slots' slots starting at the object is in use
+ *          (DNODE_MUST_BE_FREE).
+ * ENOSPC - the requested slots would run past the end of the dnode
+ *          block (DNODE_MUST_BE_FREE).
  * EIO - i/o error.
  * succeeds even for free dnodes.
  */
 int
-dnode_hold_impl(objset_t *os, uint64_t object, int flag,
+dnode_hold_impl(objset_t *os, uint64_t object, int flag, int slots,
     void *tag, dnode_t **dnp)
 {
 	int epb, idx, err;
@@ -1027,6 +1140,10 @@ dnode_hold_impl(objset_t *os, uint64_t object, int flag,
 	dmu_buf_impl_t *db;
 	dnode_children_t *children_dnodes;
 	dnode_handle_t *dnh;
+	dnode_phys_t *dn_block;
+
+	ASSERT(!(flag & DNODE_MUST_BE_ALLOCATED) || slots == 0);
+	ASSERT(!(flag & DNODE_MUST_BE_FREE) || slots > 0);
 
 	/*
 	 * If you are holding the spa config lock as writer, you shouldn't
@@ -1094,6 +1211,8 @@ dnode_hold_impl(objset_t *os, uint64_t object, int flag,
 		children_dnodes = kmem_alloc(sizeof (dnode_children_t) +
 		    (epb - 1) * sizeof (dnode_handle_t),
 		    KM_PUSHPAGE | KM_NODEBUG);
+		mutex_init(&children_dnodes->dnc_slot_lock, NULL,
+		    MUTEX_DEFAULT, NULL);
 		children_dnodes->dnc_count = epb;
 		dnh = &children_dnodes->dnc_children[0];
 		for (i = 0; i < epb; i++) {
@@ -1102,6 +1221,9 @@ dnode_hold_impl(objset_t *os, uint64_t object, int flag,
 		}
 		if ((winner = dmu_buf_set_user(&db->db, children_dnodes, NULL,
 		    dnode_buf_pageout))) {
+			for (i = 0; i < epb; i++)
+				zrl_destroy(&dnh[i].dnh_zrlock);
+			mutex_destroy(&children_dnodes->dnc_slot_lock);
 			kmem_free(children_dnodes, sizeof (dnode_children_t) +
 			    (epb - 1) * sizeof (dnode_handle_t));
 			children_dnodes = winner;
@@ -1109,10 +1231,34 @@ dnode_hold_impl(objset_t *os, uint64_t object, int flag,
 	}
 	ASSERT(children_dnodes->dnc_count == epb);
 
+	dn_block = (dnode_phys_t *)db->db.db_data;
+
+	/*
+	 * Slot reservation is serialized per dnode block, so that two
+	 * allocations can't both claim overlapping ranges of slots.
+	 */
+	if (flag & DNODE_MUST_BE_FREE) {
+		mutex_enter(&children_dnodes->dnc_slot_lock);
+		if (idx + slots > epb) {
+			mutex_exit(&children_dnodes->dnc_slot_lock);
+			dbuf_rele(db, FTAG);
+			return (ENOSPC);
+		}
+		if (!dnode_slots_are_free(children_dnodes, dn_block, idx,
+		    slots)) {
+			mutex_exit(&children_dnodes->dnc_slot_lock);
+			dbuf_rele(db, FTAG);
+			return (EEXIST);
+		}
+	} else if (dnode_slot_is_interior(children_dnodes, dn_block, idx)) {
+		dbuf_rele(db, FTAG);
+		return (ENOENT);
+	}
+
 	dnh = &children_dnodes->dnc_children[idx];
 	zrl_add(&dnh->dnh_zrlock);
 	if ((dn = dnh->dnh_dnode) == NULL) {
-		dnode_phys_t *phys = (dnode_phys_t *)db->db.db_data+idx;
+		dnode_phys_t *phys = dn_block + idx;
 		dnode_t *winner;
 
 		dn = dnode_create(os, phys, db, object, dnh);
@@ -1131,15 +1277,26 @@ dnode_hold_impl(objset_t *os, uint64_t object, int flag,
 	    ((flag & DNODE_MUST_BE_FREE) &&
 	    (type != DMU_OT_NONE || !refcount_is_zero(&dn->dn_holds)))) {
 		mutex_exit(&dn->dn_mtx);
+		if (flag & DNODE_MUST_BE_FREE)
+			mutex_exit(&children_dnodes->dnc_slot_lock);
 		zrl_remove(&dnh->dnh_zrlock);
 		dbuf_rele(db, FTAG);
 		return (type == DMU_OT_NONE ? ENOENT : EEXIST);
 	}
+	/*
+	 * Record the reservation; it stands for as long as the hold does,
+	 * and dnode_allocate() makes it permanent.
+	 */
+	if (flag & DNODE_MUST_BE_FREE)
+		dn->dn_num_slots = slots;
 	mutex_exit(&dn->dn_mtx);
 
 	if (refcount_add(&dn->dn_holds, tag) == 1)
 		dbuf_add_ref(db, dnh);
 
+	if (flag & DNODE_MUST_BE_FREE)
+		mutex_exit(&children_dnodes->dnc_slot_lock);
+
     dprintf("dnode: 2+dn_hold %d\n", refcount_count(&dn->dn_holds));
 
 	/* Now we can rely on the hold to prevent the dnode from moving. */
@@ -1160,7 +1317,8 @@ dnode_hold_impl(objset_t *os, uint64_t object, int flag,
 int
 dnode_hold(objset_t *os, uint64_t object, void *tag, dnode_t **dnp)
 {
-	return (dnode_hold_impl(os, object, DNODE_MUST_BE_ALLOCATED, tag, dnp));
+	return (dnode_hold_impl(os, object, DNODE_MUST_BE_ALLOCATED, 0,
+	    tag, dnp));
 }
 
 /*
@@ -1900,9 +2058,18 @@ dnode_next_offset_level(dnode_t *dn, int flags, uint64_t *offset,
 		    i >= 0 && i < blkfill; i += inc) {
 			if ((dnp[i].dn_type == DMU_OT_NONE) == hole)
 				break;
+			/*
+			 * Going forward, step over the trailing slots of a
+			 * large dnode; they hold its bonus, not dnodes.
+			 */
+			if (inc > 0 && dnp[i].dn_type != DMU_OT_NONE) {
+				*offset += (1ULL << span) *
+				    dnp[i].dn_extra_slots;
+				i += dnp[i].dn_extra_slots;
+			}
 			*offset += (1ULL << span) * inc;
 		}
-		if (i < 0 || i == blkfill)
+		if (i < 0 || i >= blkfill)
 			error = ESRCH;
 	} else {
 		blkptr_t *bp = data;
@@ -1919,8 +2086,8 @@ dnode_next_offset_level(dnode_t *dn, int flags, uint64_t *offset,
 		*offset = *offset >> span;
 		for (i = BF64_GET(*offset, 0, epbs);
 		    i >= 0 && i < epb; i += inc) {
-			if (bp[i].blk_fill >= minfill &&
-			    bp[i].blk_fill <= maxfill &&
+			if (BP_GET_FILL(&bp[i]) >= minfill &&
+			    BP_GET_FILL(&bp[i]) <= maxfill &&
 			    (hole || bp[i].blk_birth > txg))
 				break;
 			if (inc > 0 || *offset > 0)
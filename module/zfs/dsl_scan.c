@@ -35,6 +35,7 @@
 #include <sys/arc.h>
 #include <sys/zap.h>
 #include <sys/zio.h>
+#include <sys/abd.h>
 #include <sys/zfs_context.h>
 #include <sys/fs/zfs.h>
 #include <sys/zfs_znode.h>
@@ -55,6 +56,8 @@ typedef int (scan_cb_t)(dsl_pool_t *, const blkptr_t *, const zbookmark_t *);
 static scan_cb_t dsl_scan_scrub_cb;
 static void dsl_scan_cancel_sync(void *, dmu_tx_t *);
 static void dsl_scan_sync_state(dsl_scan_t *, dmu_tx_t *tx);
+static void dsl_scan_traverse(dsl_scan_t *, dmu_tx_t *);
+static void dsl_scan_issue(dsl_scan_t *);
 
 int zfs_top_maxinflight = 32;		/* maximum I/Os per top-level */
 int zfs_resilver_delay = 2;		/* number of ticks to delay resilver */
@@ -69,10 +72,71 @@ int zfs_no_scrub_prefetch = B_FALSE; /* set to disable srub prefetching */
 enum ddt_class zfs_scrub_ddt_class_max = DDT_CLASS_DUPLICATE;
 int dsl_scan_delay_completion = B_FALSE; /* set to delay scan completion */
 
+/*
+ * Sorted scrub and resilver.
+ *
+ * Reading blocks in the order the traversal finds them makes a scan of a
+ * fragmented pool almost entirely random I/O.  Instead the traversal only
+ * reads metadata, and the data reads it would have issued are queued on
+ * the top-level vdev holding the block's first copy, sorted by offset.
+ * Once the traversal is done, or the queues have grown to their share of
+ * memory, the queues are drained by sweeping across each vdev in offset
+ * order, issuing nearby reads back to back so that the vdev queue can
+ * aggregate them.
+ *
+ * Queued reads have been examined but not yet issued, so the traversal
+ * position is only written to disk at a checkpoint, when all the queues
+ * are empty; until then the previous checkpoint is written instead (see
+ * dsl_scan_sync_state()).  For the same reason the queue of datasets
+ * still to visit is kept in core (scn_queue) and only written out to
+ * scn_queue_obj at a checkpoint.  A checkpoint is forced every
+ * zfs_scan_checkpoint_intval seconds so that not too much work is lost
+ * if the scan has to resume after an import.
+ *
+ * A block freed while its read is still queued is taken out of the
+ * queue by dsl_scan_freed(); freed space is not reallocated for a few
+ * txgs, so nothing can be read from space that has since been reused.
+ */
+int zfs_scan_legacy = B_FALSE;		/* issue reads in traversal order */
+int zfs_scan_mem_lim_fact = 20;		/* queues may use 1/20th of RAM */
+int zfs_scan_checkpoint_intval = 7200;	/* seconds between checkpoints */
+unsigned long zfs_scan_max_ext_gap = 2 << 20; /* max gap within a run */
+
 #define	DSL_SCAN_IS_SCRUB_RESILVER(scn) \
 	((scn)->scn_phys.scn_func == POOL_SCAN_SCRUB || \
 	(scn)->scn_phys.scn_func == POOL_SCAN_RESILVER)
 
+/*
+ * A read waiting in a top-level vdev's queue.  The whole block pointer is
+ * kept so that all copies of the block are still read, and repaired from
+ * each other, together; the queue is sorted by the first copy's offset.
+ */
+typedef struct scan_io {
+	avl_node_t	sio_node;
+	blkptr_t	sio_bp;
+	zbookmark_t	sio_zb;
+	int		sio_flags;
+} scan_io_t;
+
+#define	SIO_OFFSET(sio)	DVA_GET_OFFSET(&(sio)->sio_bp.blk_dva[0])
+#define	SIO_ASIZE(sio)	DVA_GET_ASIZE(&(sio)->sio_bp.blk_dva[0])
+
+typedef struct dsl_scan_io_queue {
+	dsl_scan_t	*q_scn;
+	vdev_t		*q_vd;
+	avl_tree_t	q_sios;		/* scan_io_t, sorted by offset */
+	uint64_t	q_cursor;	/* where the next run starts */
+} dsl_scan_io_queue_t;
+
+/* An entry in the in-core queue of datasets to visit. */
+typedef struct scan_ds {
+	avl_node_t	sds_node;
+	uint64_t	sds_dsobj;
+	uint64_t	sds_txg;
+} scan_ds_t;
+
+static kmem_cache_t *sio_cache;
+
 /* the order has to match pool_scan_type */
 static scan_cb_t *scan_funcs[POOL_SCAN_FUNCS] = {
 	NULL,
@@ -80,6 +144,193 @@ static scan_cb_t *scan_funcs[POOL_SCAN_FUNCS] = {
 	dsl_scan_scrub_cb,	/* POOL_SCAN_RESILVER */
 };
 
+static int
+sio_compare(const void *x1, const void *x2)
+{
+	uint64_t o1 = SIO_OFFSET((const scan_io_t *)x1);
+	uint64_t o2 = SIO_OFFSET((const scan_io_t *)x2);
+
+	if (o1 < o2)
+		return (-1);
+	if (o1 > o2)
+		return (1);
+	return (0);
+}
+
+static int
+scan_ds_compare(const void *x1, const void *x2)
+{
+	const scan_ds_t *sds1 = x1;
+	const scan_ds_t *sds2 = x2;
+
+	if (sds1->sds_dsobj < sds2->sds_dsobj)
+		return (-1);
+	if (sds1->sds_dsobj > sds2->sds_dsobj)
+		return (1);
+	return (0);
+}
+
+void
+dsl_scan_global_init(void)
+{
+	sio_cache = kmem_cache_create("sio_cache", sizeof (scan_io_t), 0,
+	    NULL, NULL, NULL, NULL, NULL, 0);
+}
+
+void
+dsl_scan_global_fini(void)
+{
+	kmem_cache_destroy(sio_cache);
+}
+
+static boolean_t
+scan_ds_queue_contains(dsl_scan_t *scn, uint64_t dsobj, uint64_t *txg)
+{
+	scan_ds_t srch, *sds;
+
+	srch.sds_dsobj = dsobj;
+	sds = avl_find(&scn->scn_queue, &srch, NULL);
+	if (sds != NULL && txg != NULL)
+		*txg = sds->sds_txg;
+	return (sds != NULL);
+}
+
+static void
+scan_ds_queue_insert(dsl_scan_t *scn, uint64_t dsobj, uint64_t txg)
+{
+	scan_ds_t *sds;
+	avl_index_t where;
+
+	sds = kmem_zalloc(sizeof (scan_ds_t), KM_PUSHPAGE);
+	sds->sds_dsobj = dsobj;
+	sds->sds_txg = txg;
+	VERIFY3P(avl_find(&scn->scn_queue, sds, &where), ==, NULL);
+	avl_insert(&scn->scn_queue, sds, where);
+	scn->scn_queue_dirty = B_TRUE;
+}
+
+static void
+scan_ds_queue_remove(dsl_scan_t *scn, uint64_t dsobj)
+{
+	scan_ds_t srch, *sds;
+
+	srch.sds_dsobj = dsobj;
+	sds = avl_find(&scn->scn_queue, &srch, NULL);
+	VERIFY(sds != NULL);
+	avl_remove(&scn->scn_queue, sds);
+	kmem_free(sds, sizeof (scan_ds_t));
+	scn->scn_queue_dirty = B_TRUE;
+}
+
+static void
+scan_ds_queue_clear(dsl_scan_t *scn)
+{
+	void *cookie = NULL;
+	scan_ds_t *sds;
+
+	while ((sds = avl_destroy_nodes(&scn->scn_queue, &cookie)) != NULL)
+		kmem_free(sds, sizeof (scan_ds_t));
+	scn->scn_queue_dirty = B_FALSE;
+}
+
+/*
+ * Replace scn_queue_obj with the contents of the in-core dataset queue.
+ * Only done at a checkpoint, so the queue on disk always goes with the
+ * traversal position on disk.
+ */
+static void
+scan_ds_queue_sync(dsl_scan_t *scn, dmu_tx_t *tx)
+{
+	dsl_pool_t *dp = scn->scn_dp;
+	dmu_object_type_t ot = DMU_OT_SCAN_QUEUE;
+	scan_ds_t *sds;
+
+	if (!scn->scn_queue_dirty || scn->scn_phys.scn_queue_obj == 0)
+		return;
+
+	if (spa_version(dp->dp_spa) < SPA_VERSION_DSL_SCRUB)
+		ot = DMU_OT_ZAP_OTHER;
+
+	VERIFY0(dmu_object_free(dp->dp_meta_objset,
+	    scn->scn_phys.scn_queue_obj, tx));
+	scn->scn_phys.scn_queue_obj = zap_create(dp->dp_meta_objset,
+	    ot, DMU_OT_NONE, 0, tx);
+	for (sds = avl_first(&scn->scn_queue); sds != NULL;
+	    sds = AVL_NEXT(&scn->scn_queue, sds)) {
+		VERIFY0(zap_add_int_key(dp->dp_meta_objset,
+		    scn->scn_phys.scn_queue_obj, sds->sds_dsobj,
+		    sds->sds_txg, tx));
+	}
+	scn->scn_queue_dirty = B_FALSE;
+}
+
+static dsl_scan_io_queue_t *
+dsl_scan_io_queue_create(dsl_scan_t *scn, vdev_t *vd)
+{
+	dsl_scan_io_queue_t *q;
+
+	q = kmem_zalloc(sizeof (dsl_scan_io_queue_t), KM_PUSHPAGE);
+	q->q_scn = scn;
+	q->q_vd = vd;
+	avl_create(&q->q_sios, sio_compare, sizeof (scan_io_t),
+	    offsetof(scan_io_t, sio_node));
+	return (q);
+}
+
+/*
+ * Throw away a vdev's queue and the reads still in it.  The caller holds
+ * vdev_scan_io_queue_lock.
+ */
+void
+dsl_scan_io_queue_destroy(dsl_scan_io_queue_t *q)
+{
+	void *cookie = NULL;
+	scan_io_t *sio;
+	uint64_t mem = 0;
+
+	ASSERT(MUTEX_HELD(&q->q_vd->vdev_scan_io_queue_lock));
+
+	while ((sio = avl_destroy_nodes(&q->q_sios, &cookie)) != NULL) {
+		kmem_cache_free(sio_cache, sio);
+		mem += sizeof (scan_io_t);
+	}
+	atomic_add_64(&q->q_scn->scn_queues_mem, -(int64_t)mem);
+	avl_destroy(&q->q_sios);
+	kmem_free(q, sizeof (dsl_scan_io_queue_t));
+}
+
+static void
+dsl_scan_io_queues_destroy(dsl_scan_t *scn)
+{
+	vdev_t *rvd = scn->scn_dp->dp_spa->spa_root_vdev;
+	int c;
+
+	if (rvd == NULL)
+		return;
+
+	for (c = 0; c < rvd->vdev_children; c++) {
+		vdev_t *vd = rvd->vdev_child[c];
+
+		mutex_enter(&vd->vdev_scan_io_queue_lock);
+		if (vd->vdev_scan_io_queue != NULL) {
+			dsl_scan_io_queue_destroy(vd->vdev_scan_io_queue);
+			vd->vdev_scan_io_queue = NULL;
+		}
+		mutex_exit(&vd->vdev_scan_io_queue_lock);
+	}
+	ASSERT0(scn->scn_queues_mem);
+}
+
+/*
+ * Memory the queued reads may use before the traversal stops to let them
+ * drain.
+ */
+static uint64_t
+dsl_scan_mem_limit(void)
+{
+	return (ptob(physmem) / MAX(zfs_scan_mem_lim_fact, 1));
+}
+
 int
 dsl_scan_init(dsl_pool_t *dp, uint64_t txg)
 {
@@ -90,6 +341,10 @@ dsl_scan_init(dsl_pool_t *dp, uint64_t txg)
 
 	scn = dp->dp_scan = kmem_zalloc(sizeof (dsl_scan_t), KM_SLEEP);
 	scn->scn_dp = dp;
+	avl_create(&scn->scn_queue, scan_ds_compare, sizeof (scan_ds_t),
+	    offsetof(scan_ds_t, sds_node));
+	scn->scn_is_sorted = !zfs_scan_legacy;
+	scn->scn_last_checkpoint = ddi_get_lbolt();
 
 	err = zap_lookup(dp->dp_meta_objset, DMU_POOL_DIRECTORY_OBJECT,
 	    "scrub_func", sizeof (uint64_t), 1, &f);
@@ -135,6 +390,34 @@ dsl_scan_init(dsl_pool_t *dp, uint64_t txg)
 		}
 	}
 
+	/*
+	 * Reload the queue of datasets still to visit.  Everything before
+	 * the on-disk position has been issued, so that much of the scan
+	 * counts as issued.
+	 */
+	if (scn->scn_phys.scn_state == DSS_SCANNING &&
+	    scn->scn_phys.scn_queue_obj != 0 && scn->scn_restart_txg == 0) {
+		zap_cursor_t *zc = kmem_alloc(sizeof (zap_cursor_t),
+		    KM_PUSHPAGE);
+		zap_attribute_t *za = kmem_alloc(sizeof (zap_attribute_t),
+		    KM_PUSHPAGE);
+
+		for (zap_cursor_init(zc, dp->dp_meta_objset,
+		    scn->scn_phys.scn_queue_obj);
+		    zap_cursor_retrieve(zc, za) == 0;
+		    (void) zap_cursor_advance(zc)) {
+			scan_ds_queue_insert(scn, strtonum(za->za_name, NULL),
+			    za->za_first_integer);
+		}
+		zap_cursor_fini(zc);
+		scn->scn_queue_dirty = B_FALSE;
+
+		kmem_free(za, sizeof (zap_attribute_t));
+		kmem_free(zc, sizeof (zap_cursor_t));
+	}
+	bcopy(&scn->scn_phys, &scn->scn_phys_cached, sizeof (dsl_scan_phys_t));
+	scn->scn_issued_before_pass = scn->scn_phys.scn_examined;
+
 	spa_scan_stat_init(spa);
 	return (0);
 }
@@ -142,8 +425,13 @@ dsl_scan_init(dsl_pool_t *dp, uint64_t txg)
 void
 dsl_scan_fini(dsl_pool_t *dp)
 {
-	if (dp->dp_scan) {
-		kmem_free(dp->dp_scan, sizeof (dsl_scan_t));
+	dsl_scan_t *scn = dp->dp_scan;
+
+	if (scn != NULL) {
+		dsl_scan_io_queues_destroy(scn);
+		scan_ds_queue_clear(scn);
+		avl_destroy(&scn->scn_queue);
+		kmem_free(scn, sizeof (dsl_scan_t));
 		dp->dp_scan = NULL;
 	}
 }
@@ -181,6 +469,12 @@ dsl_scan_setup_sync(void *arg, dmu_tx_t *tx)
 	scn->scn_phys.scn_errors = 0;
 	scn->scn_phys.scn_to_examine = spa->spa_root_vdev->vdev_stat.vs_alloc;
 	scn->scn_restart_txg = 0;
+	scn->scn_is_sorted = !zfs_scan_legacy;
+	scn->scn_traversal_done = B_FALSE;
+	scn->scn_clearing = B_FALSE;
+	scn->scn_checkpointing = B_FALSE;
+	scn->scn_last_checkpoint = ddi_get_lbolt();
+	scn->scn_issued_before_pass = 0;
 	spa_scan_stat_init(spa);
 
 	if (DSL_SCAN_IS_SCRUB_RESILVER(scn)) {
@@ -254,6 +548,13 @@ dsl_scan_done(dsl_scan_t *scn, boolean_t complete, dmu_tx_t *tx)
 		    DMU_POOL_DIRECTORY_OBJECT, old_names[i], tx);
 	}
 
+	/* Nothing more will be issued; drop whatever is still queued. */
+	dsl_scan_io_queues_destroy(scn);
+	scan_ds_queue_clear(scn);
+	scn->scn_traversal_done = B_FALSE;
+	scn->scn_clearing = B_FALSE;
+	scn->scn_checkpointing = B_FALSE;
+
 	if (scn->scn_phys.scn_queue_obj != 0) {
 		VERIFY(0 == dmu_object_free(dp->dp_meta_objset,
 		    scn->scn_phys.scn_queue_obj, tx));
@@ -386,21 +687,64 @@ dsl_scan_ds_maxtxg(dsl_dataset_t *ds)
 	return (smt);
 }
 
+/*
+ * Write out the scan state.  While reads are still queued, the traversal
+ * position in scn_phys is ahead of what has actually been read, so the
+ * last checkpoint is written instead and an imported pool resumes the
+ * scan from there.  Once the queues are empty this is a new checkpoint.
+ */
 static void
 dsl_scan_sync_state(dsl_scan_t *scn, dmu_tx_t *tx)
 {
+	dsl_scan_phys_t *phys = &scn->scn_phys;
+
+	if (scn->scn_queues_mem == 0) {
+		scan_ds_queue_sync(scn, tx);
+		bcopy(&scn->scn_phys, &scn->scn_phys_cached,
+		    sizeof (dsl_scan_phys_t));
+		if (scn->scn_checkpointing) {
+			zfs_dbgmsg("finished scan checkpoint txg %llu",
+			    (longlong_t)tx->tx_txg);
+		}
+		scn->scn_checkpointing = B_FALSE;
+		scn->scn_last_checkpoint = ddi_get_lbolt();
+	} else {
+		/* These don't depend on the traversal position. */
+		scn->scn_phys_cached.scn_errors = scn->scn_phys.scn_errors;
+		scn->scn_phys_cached.scn_processed =
+		    scn->scn_phys.scn_processed;
+		phys = &scn->scn_phys_cached;
+	}
+
 	VERIFY0(zap_update(scn->scn_dp->dp_meta_objset,
 	    DMU_POOL_DIRECTORY_OBJECT,
 	    DMU_POOL_SCAN, sizeof (uint64_t), SCAN_PHYS_NUMINTS,
-	    &scn->scn_phys, tx));
+	    phys, tx));
 }
 
+/*
+ * Has this txg's scan had its share of the sync?
+ */
 static boolean_t
-dsl_scan_check_pause(dsl_scan_t *scn, const zbookmark_t *zb)
+dsl_scan_time_up(dsl_scan_t *scn)
 {
 	uint64_t elapsed_nanosecs;
 	int mintime;
 
+	mintime = (scn->scn_phys.scn_func == POOL_SCAN_RESILVER) ?
+	    zfs_resilver_min_time_ms : zfs_scan_min_time_ms;
+	elapsed_nanosecs = gethrtime() - scn->scn_sync_start_time;
+	return (elapsed_nanosecs / NANOSEC > zfs_txg_timeout ||
+	    (elapsed_nanosecs / MICROSEC > mintime &&
+	    txg_sync_waiting(scn->scn_dp)) ||
+	    spa_shutting_down(scn->scn_dp->dp_spa));
+}
+
+static boolean_t
+dsl_scan_check_pause(dsl_scan_t *scn, const zbookmark_t *zb)
+{
+	boolean_t full;
+
 	/* we never skip user/group accounting objects */
 	if (zb && (int64_t)zb->zb_object < 0)
 		return (B_FALSE);
@@ -415,13 +759,12 @@ dsl_scan_check_pause(dsl_scan_t *scn, const zbookmark_t *zb)
 	if (zb && zb->zb_level != 0)
 		return (B_FALSE);
 
-	mintime = (scn->scn_phys.scn_func == POOL_SCAN_RESILVER) ?
-	    zfs_resilver_min_time_ms : zfs_scan_min_time_ms;
-	elapsed_nanosecs = gethrtime() - scn->scn_sync_start_time;
-	if (elapsed_nanosecs / NANOSEC > zfs_txg_timeout ||
-	    (elapsed_nanosecs / MICROSEC > mintime &&
-	    txg_sync_waiting(scn->scn_dp)) ||
-	    spa_shutting_down(scn->scn_dp->dp_spa)) {
+	full = (scn->scn_queues_mem >= dsl_scan_mem_limit());
+	if (full || dsl_scan_time_up(scn)) {
+		if (full) {
+			zfs_dbgmsg("scan queues full; draining");
+			scn->scn_clearing = B_TRUE;
+		}
 		if (zb) {
 			dprintf("pausing at bookmark %llx/%llx/%llx/%llx\n",
 			    (longlong_t)zb->zb_objset,
@@ -646,14 +989,18 @@ dsl_scan_recurse(dsl_scan_t *scn, dsl_dataset_t *ds, dmu_objset_type_t ostype,
 			scn->scn_phys.scn_errors++;
 			return (err);
 		}
-		for (i = 0, cdnp = (*bufp)->b_data; i < epb; i++, cdnp++) {
+		for (i = 0, cdnp = (*bufp)->b_data; i < epb;
+		    i += cdnp->dn_extra_slots + 1,
+		    cdnp += cdnp->dn_extra_slots + 1) {
 			for (j = 0; j < cdnp->dn_nblkptr; j++) {
 				blkptr_t *cbp = &cdnp->dn_blkptr[j];
 				dsl_scan_prefetch(scn, *bufp, cbp,
 				    zb->zb_objset, zb->zb_blkid * epb + i, j);
 			}
 		}
-		for (i = 0, cdnp = (*bufp)->b_data; i < epb; i++, cdnp++) {
+		for (i = 0, cdnp = (*bufp)->b_data; i < epb;
+		    i += cdnp->dn_extra_slots + 1,
+		    cdnp += cdnp->dn_extra_slots + 1) {
 			dsl_scan_visitdnode(scn, ds, ostype,
 			    cdnp, *bufp, zb->zb_blkid * epb + i, tx);
 		}
@@ -713,7 +1060,7 @@ dsl_scan_visitdnode(dsl_scan_t *scn, dsl_dataset_t *ds,
 		zbookmark_t czb;
 		SET_BOOKMARK(&czb, ds ? ds->ds_object : 0, object,
 		    0, DMU_SPILL_BLKID);
-		dsl_scan_visitbp(&dnp->dn_spill,
+		dsl_scan_visitbp(DN_SPILL_BLKPTR(dnp),
 		    &czb, dnp, buf, ds, scn, ostype, tx);
 	}
 }
@@ -809,6 +1156,35 @@ dsl_scan_visit_rootbp(dsl_scan_t *scn, dsl_dataset_t *ds, blkptr_t *bp,
 	dprintf_ds(ds, "finished scan%s", "");
 }
 
+/*
+ * The bookmark fixups below are applied both to the traversal position
+ * and to the last checkpoint, which is what is on disk.  Likewise the
+ * dataset queue is fixed up both in core and in scn_queue_obj.
+ */
+static void
+ds_destroyed_scn_phys(dsl_dataset_t *ds, dsl_scan_phys_t *scn_phys)
+{
+	if (scn_phys->scn_bookmark.zb_objset != ds->ds_object)
+		return;
+
+	if (dsl_dataset_is_snapshot(ds)) {
+		/* Note, scn_cur_{min,max}_txg stays the same. */
+		scn_phys->scn_bookmark.zb_objset =
+		    ds->ds_phys->ds_next_snap_obj;
+		zfs_dbgmsg("destroying ds %llu; currently traversing; "
+		    "reset zb_objset to %llu",
+		    (u_longlong_t)ds->ds_object,
+		    (u_longlong_t)ds->ds_phys->ds_next_snap_obj);
+		scn_phys->scn_flags |= DSF_VISIT_DS_AGAIN;
+	} else {
+		SET_BOOKMARK(&scn_phys->scn_bookmark,
+		    ZB_DESTROYED_OBJSET, 0, 0, 0);
+		zfs_dbgmsg("destroying ds %llu; currently traversing; "
+		    "reset bookmark to -1,0,0,0",
+		    (u_longlong_t)ds->ds_object);
+	}
+}
+
 void
 dsl_scan_ds_destroyed(dsl_dataset_t *ds, dmu_tx_t *tx)
 {
@@ -819,24 +1195,18 @@ dsl_scan_ds_destroyed(dsl_dataset_t *ds, dmu_tx_t *tx)
 	if (scn->scn_phys.scn_state != DSS_SCANNING)
 		return;
 
-	if (scn->scn_phys.scn_bookmark.zb_objset == ds->ds_object) {
+	ds_destroyed_scn_phys(ds, &scn->scn_phys);
+	ds_destroyed_scn_phys(ds, &scn->scn_phys_cached);
+
+	if (scan_ds_queue_contains(scn, ds->ds_object, &mintxg)) {
+		scan_ds_queue_remove(scn, ds->ds_object);
 		if (dsl_dataset_is_snapshot(ds)) {
-			/* Note, scn_cur_{min,max}_txg stays the same. */
-			scn->scn_phys.scn_bookmark.zb_objset =
-			    ds->ds_phys->ds_next_snap_obj;
-			zfs_dbgmsg("destroying ds %llu; currently traversing; "
-			    "reset zb_objset to %llu",
-			    (u_longlong_t)ds->ds_object,
-			    (u_longlong_t)ds->ds_phys->ds_next_snap_obj);
-			scn->scn_phys.scn_flags |= DSF_VISIT_DS_AGAIN;
-		} else {
-			SET_BOOKMARK(&scn->scn_phys.scn_bookmark,
-			    ZB_DESTROYED_OBJSET, 0, 0, 0);
-			zfs_dbgmsg("destroying ds %llu; currently traversing; "
-			    "reset bookmark to -1,0,0,0",
-			    (u_longlong_t)ds->ds_object);
+			scan_ds_queue_insert(scn,
+			    ds->ds_phys->ds_next_snap_obj, mintxg);
 		}
-	} else if (zap_lookup_int_key(dp->dp_meta_objset,
+	}
+
+	if (zap_lookup_int_key(dp->dp_meta_objset,
 	    scn->scn_phys.scn_queue_obj, ds->ds_object, &mintxg) == 0) {
 		ASSERT3U(ds->ds_phys->ds_num_children, <=, 1);
 		VERIFY3U(0, ==, zap_remove_int(dp->dp_meta_objset,
@@ -858,9 +1228,6 @@ dsl_scan_ds_destroyed(dsl_dataset_t *ds, dmu_tx_t *tx)
 			zfs_dbgmsg("destroying ds %llu; in queue; removing",
 			    (u_longlong_t)ds->ds_object);
 		}
-	} else {
-		zfs_dbgmsg("destroying ds %llu; ignoring",
-		    (u_longlong_t)ds->ds_object);
 	}
 
 	/*
@@ -870,6 +1237,19 @@ dsl_scan_ds_destroyed(dsl_dataset_t *ds, dmu_tx_t *tx)
 	dsl_scan_sync_state(scn, tx);
 }
 
+static void
+ds_snapshotted_scn_phys(dsl_dataset_t *ds, dsl_scan_phys_t *scn_phys)
+{
+	if (scn_phys->scn_bookmark.zb_objset == ds->ds_object) {
+		scn_phys->scn_bookmark.zb_objset =
+		    ds->ds_phys->ds_prev_snap_obj;
+		zfs_dbgmsg("snapshotting ds %llu; currently traversing; "
+		    "reset zb_objset to %llu",
+		    (u_longlong_t)ds->ds_object,
+		    (u_longlong_t)ds->ds_phys->ds_prev_snap_obj);
+	}
+}
+
 void
 dsl_scan_ds_snapshotted(dsl_dataset_t *ds, dmu_tx_t *tx)
 {
@@ -882,14 +1262,16 @@ dsl_scan_ds_snapshotted(dsl_dataset_t *ds, dmu_tx_t *tx)
 
 	ASSERT(ds->ds_phys->ds_prev_snap_obj != 0);
 
-	if (scn->scn_phys.scn_bookmark.zb_objset == ds->ds_object) {
-		scn->scn_phys.scn_bookmark.zb_objset =
-		    ds->ds_phys->ds_prev_snap_obj;
-		zfs_dbgmsg("snapshotting ds %llu; currently traversing; "
-		    "reset zb_objset to %llu",
-		    (u_longlong_t)ds->ds_object,
-		    (u_longlong_t)ds->ds_phys->ds_prev_snap_obj);
-	} else if (zap_lookup_int_key(dp->dp_meta_objset,
+	ds_snapshotted_scn_phys(ds, &scn->scn_phys);
+	ds_snapshotted_scn_phys(ds, &scn->scn_phys_cached);
+
+	if (scan_ds_queue_contains(scn, ds->ds_object, &mintxg)) {
+		scan_ds_queue_remove(scn, ds->ds_object);
+		scan_ds_queue_insert(scn, ds->ds_phys->ds_prev_snap_obj,
+		    mintxg);
+	}
+
+	if (zap_lookup_int_key(dp->dp_meta_objset,
 	    scn->scn_phys.scn_queue_obj, ds->ds_object, &mintxg) == 0) {
 		VERIFY3U(0, ==, zap_remove_int(dp->dp_meta_objset,
 		    scn->scn_phys.scn_queue_obj, ds->ds_object, tx));
@@ -904,6 +1286,25 @@ dsl_scan_ds_snapshotted(dsl_dataset_t *ds, dmu_tx_t *tx)
 	dsl_scan_sync_state(scn, tx);
 }
 
+static void
+ds_clone_swapped_scn_phys(dsl_dataset_t *ds1, dsl_dataset_t *ds2,
+    dsl_scan_phys_t *scn_phys)
+{
+	if (scn_phys->scn_bookmark.zb_objset == ds1->ds_object) {
+		scn_phys->scn_bookmark.zb_objset = ds2->ds_object;
+		zfs_dbgmsg("clone_swap ds %llu; currently traversing; "
+		    "reset zb_objset to %llu",
+		    (u_longlong_t)ds1->ds_object,
+		    (u_longlong_t)ds2->ds_object);
+	} else if (scn_phys->scn_bookmark.zb_objset == ds2->ds_object) {
+		scn_phys->scn_bookmark.zb_objset = ds1->ds_object;
+		zfs_dbgmsg("clone_swap ds %llu; currently traversing; "
+		    "reset zb_objset to %llu",
+		    (u_longlong_t)ds2->ds_object,
+		    (u_longlong_t)ds1->ds_object);
+	}
+}
+
 void
 dsl_scan_ds_clone_swapped(dsl_dataset_t *ds1, dsl_dataset_t *ds2, dmu_tx_t *tx)
 {
@@ -914,18 +1315,20 @@ dsl_scan_ds_clone_swapped(dsl_dataset_t *ds1, dsl_dataset_t *ds2, dmu_tx_t *tx)
 	if (scn->scn_phys.scn_state != DSS_SCANNING)
 		return;
 
-	if (scn->scn_phys.scn_bookmark.zb_objset == ds1->ds_object) {
-		scn->scn_phys.scn_bookmark.zb_objset = ds2->ds_object;
-		zfs_dbgmsg("clone_swap ds %llu; currently traversing; "
-		    "reset zb_objset to %llu",
-		    (u_longlong_t)ds1->ds_object,
-		    (u_longlong_t)ds2->ds_object);
-	} else if (scn->scn_phys.scn_bookmark.zb_objset == ds2->ds_object) {
-		scn->scn_phys.scn_bookmark.zb_objset = ds1->ds_object;
-		zfs_dbgmsg("clone_swap ds %llu; currently traversing; "
-		    "reset zb_objset to %llu",
-		    (u_longlong_t)ds2->ds_object,
-		    (u_longlong_t)ds1->ds_object);
+	ds_clone_swapped_scn_phys(ds1, ds2, &scn->scn_phys);
+	ds_clone_swapped_scn_phys(ds1, ds2, &scn->scn_phys_cached);
+
+	if (scan_ds_queue_contains(scn, ds1->ds_object, &mintxg)) {
+		scan_ds_queue_remove(scn, ds1->ds_object);
+		if (scan_ds_queue_contains(scn, ds2->ds_object, NULL)) {
+			/* Both were there to begin with */
+			scan_ds_queue_insert(scn, ds1->ds_object, mintxg);
+		} else {
+			scan_ds_queue_insert(scn, ds2->ds_object, mintxg);
+		}
+	} else if (scan_ds_queue_contains(scn, ds2->ds_object, &mintxg)) {
+		scan_ds_queue_remove(scn, ds2->ds_object);
+		scan_ds_queue_insert(scn, ds1->ds_object, mintxg);
 	}
 
 	if (zap_lookup_int_key(dp->dp_meta_objset, scn->scn_phys.scn_queue_obj,
@@ -997,9 +1400,8 @@ enqueue_clones_cb(dsl_pool_t *dp, dsl_dataset_t *hds, void *arg)
 			return (err);
 		ds = prev;
 	}
-	VERIFY(zap_add_int_key(dp->dp_meta_objset,
-	    scn->scn_phys.scn_queue_obj, ds->ds_object,
-	    ds->ds_phys->ds_prev_snap_txg, eca->tx) == 0);
+	scan_ds_queue_insert(scn, ds->ds_object,
+	    ds->ds_phys->ds_prev_snap_txg);
 	dsl_dataset_rele(ds, FTAG);
 	return (0);
 }
@@ -1056,9 +1458,8 @@ dsl_scan_visitds(dsl_scan_t *scn, uint64_t dsobj, dmu_tx_t *tx)
 	if (scn->scn_phys.scn_flags & DSF_VISIT_DS_AGAIN) {
 		zfs_dbgmsg("incomplete pass; visiting again");
 		scn->scn_phys.scn_flags &= ~DSF_VISIT_DS_AGAIN;
-		VERIFY(zap_add_int_key(dp->dp_meta_objset,
-		    scn->scn_phys.scn_queue_obj, ds->ds_object,
-		    scn->scn_phys.scn_cur_max_txg, tx) == 0);
+		scan_ds_queue_insert(scn, ds->ds_object,
+		    scn->scn_phys.scn_cur_max_txg);
 		goto out;
 	}
 
@@ -1066,9 +1467,8 @@ dsl_scan_visitds(dsl_scan_t *scn, uint64_t dsobj, dmu_tx_t *tx)
 	 * Add descendent datasets to work queue.
 	 */
 	if (ds->ds_phys->ds_next_snap_obj != 0) {
-		VERIFY(zap_add_int_key(dp->dp_meta_objset,
-		    scn->scn_phys.scn_queue_obj, ds->ds_phys->ds_next_snap_obj,
-		    ds->ds_phys->ds_creation_txg, tx) == 0);
+		scan_ds_queue_insert(scn, ds->ds_phys->ds_next_snap_obj,
+		    ds->ds_phys->ds_creation_txg);
 	}
 	if (ds->ds_phys->ds_num_children > 1) {
 		boolean_t usenext = B_FALSE;
@@ -1089,10 +1489,23 @@ dsl_scan_visitds(dsl_scan_t *scn, uint64_t dsobj, dmu_tx_t *tx)
 		}
 
 		if (usenext) {
-			VERIFY0(zap_join_key(dp->dp_meta_objset,
-			    ds->ds_phys->ds_next_clones_obj,
-			    scn->scn_phys.scn_queue_obj,
-			    ds->ds_phys->ds_creation_txg, tx));
+			zap_cursor_t *zc = kmem_alloc(sizeof (zap_cursor_t),
+			    KM_PUSHPAGE);
+			zap_attribute_t *za = kmem_alloc(
+			    sizeof (zap_attribute_t), KM_PUSHPAGE);
+
+			for (zap_cursor_init(zc, dp->dp_meta_objset,
+			    ds->ds_phys->ds_next_clones_obj);
+			    zap_cursor_retrieve(zc, za) == 0;
+			    (void) zap_cursor_advance(zc)) {
+				scan_ds_queue_insert(scn,
+				    strtonum(za->za_name, NULL),
+				    ds->ds_phys->ds_creation_txg);
+			}
+			zap_cursor_fini(zc);
+
+			kmem_free(za, sizeof (zap_attribute_t));
+			kmem_free(zc, sizeof (zap_cursor_t));
 		} else {
 			struct enqueue_clones_arg eca;
 			eca.tx = tx;
@@ -1111,7 +1524,6 @@ out:
 static int
 enqueue_cb(dsl_pool_t *dp, dsl_dataset_t *hds, void *arg)
 {
-	dmu_tx_t *tx = arg;
 	dsl_dataset_t *ds;
 	int err;
 	dsl_scan_t *scn = dp->dp_scan;
@@ -1141,8 +1553,8 @@ enqueue_cb(dsl_pool_t *dp, dsl_dataset_t *hds, void *arg)
 		ds = prev;
 	}
 
-	VERIFY(zap_add_int_key(dp->dp_meta_objset, scn->scn_phys.scn_queue_obj,
-	    ds->ds_object, ds->ds_phys->ds_prev_snap_txg, tx) == 0);
+	scan_ds_queue_insert(scn, ds->ds_object,
+	    ds->ds_phys->ds_prev_snap_txg);
 	dsl_dataset_rele(ds, FTAG);
 	return (0);
 }
@@ -1185,9 +1597,23 @@ dsl_scan_ddt(dsl_scan_t *scn, dmu_tx_t *tx)
 {
 	ddt_bookmark_t *ddb = &scn->scn_phys.scn_ddt_bookmark;
 	ddt_entry_t dde;
+	enum zio_checksum c;
 	int error;
 	uint64_t n = 0;
 
+	/*
+	 * The walk only sees the DDT ZAPs, so wait for ddt_sync() to flush
+	 * the DDT logs into them; it flushes them completely while
+	 * dsl_scan_ddt_walking().
+	 */
+	for (c = 0; c < ZIO_CHECKSUM_FUNCTIONS; c++) {
+		ddt_t *ddt = scn->scn_dp->dp_spa->spa_ddt[c];
+		if (ddt != NULL && ddt_log_pending(ddt)) {
+			scn->scn_pausing = B_TRUE;
+			return;
+		}
+	}
+
 	bzero(&dde, sizeof (ddt_entry_t));
 
 	while ((error = ddt_walk(scn->scn_dp->dp_spa, ddb, &dde)) == 0) {
@@ -1250,8 +1676,7 @@ static void
 dsl_scan_visit(dsl_scan_t *scn, dmu_tx_t *tx)
 {
 	dsl_pool_t *dp = scn->scn_dp;
-	zap_cursor_t *zc;
-	zap_attribute_t *za;
+	scan_ds_t *sds;
 
 	if (scn->scn_phys.scn_ddt_bookmark.ddb_class <=
 	    scn->scn_phys.scn_ddt_class_max) {
@@ -1299,26 +1724,20 @@ dsl_scan_visit(dsl_scan_t *scn, dmu_tx_t *tx)
 	 * bookmark so we don't think that we're still trying to resume.
 	 */
 	bzero(&scn->scn_phys.scn_bookmark, sizeof (zbookmark_t));
-	zc = kmem_alloc(sizeof(zap_cursor_t), KM_PUSHPAGE);
-	za = kmem_alloc(sizeof(zap_attribute_t), KM_PUSHPAGE);
 
-	/* keep pulling things out of the zap-object-as-queue */
-	while (zap_cursor_init(zc, dp->dp_meta_objset,
-	    scn->scn_phys.scn_queue_obj),
-	    zap_cursor_retrieve(zc, za) == 0) {
+	/* keep pulling things out of the dataset queue */
+	while ((sds = avl_first(&scn->scn_queue)) != NULL) {
 		dsl_dataset_t *ds;
-		uint64_t dsobj;
+		uint64_t dsobj = sds->sds_dsobj;
+		uint64_t txg = sds->sds_txg;
 
-		dsobj = strtonum(za->za_name, NULL);
-		VERIFY3U(0, ==, zap_remove_int(dp->dp_meta_objset,
-		    scn->scn_phys.scn_queue_obj, dsobj, tx));
+		scan_ds_queue_remove(scn, dsobj);
 
 		/* Set up min/max txg */
 		VERIFY3U(0, ==, dsl_dataset_hold_obj(dp, dsobj, FTAG, &ds));
-		if (za->za_first_integer != 0) {
+		if (txg != 0) {
 			scn->scn_phys.scn_cur_min_txg =
-			    MAX(scn->scn_phys.scn_min_txg,
-			    za->za_first_integer);
+			    MAX(scn->scn_phys.scn_min_txg, txg);
 		} else {
 			scn->scn_phys.scn_cur_min_txg =
 			    MAX(scn->scn_phys.scn_min_txg,
@@ -1328,14 +1747,9 @@ dsl_scan_visit(dsl_scan_t *scn, dmu_tx_t *tx)
 		dsl_dataset_rele(ds, FTAG);
 
 		dsl_scan_visitds(scn, dsobj, tx);
-		zap_cursor_fini(zc);
 		if (scn->scn_pausing)
-			goto out;
+			return;
 	}
-	zap_cursor_fini(zc);
-out:
-	kmem_free(za, sizeof(zap_attribute_t));
-	kmem_free(zc, sizeof(zap_cursor_t));
 }
 
 static boolean_t
@@ -1486,6 +1900,72 @@ dsl_scan_sync(dsl_pool_t *dp, dmu_tx_t *tx)
 	if (scn->scn_phys.scn_state != DSS_SCANNING)
 		return;
 
+	/*
+	 * Switching between sorted and legacy reads is only safe while
+	 * nothing is queued.
+	 */
+	if (scn->scn_queues_mem == 0)
+		scn->scn_is_sorted = !zfs_scan_legacy;
+
+	if (scn->scn_is_sorted && !scn->scn_traversal_done &&
+	    !scn->scn_checkpointing &&
+	    ddi_get_lbolt() - scn->scn_last_checkpoint >
+	    SEC_TO_TICK(zfs_scan_checkpoint_intval)) {
+		zfs_dbgmsg("starting scan checkpoint txg %llu",
+		    (longlong_t)tx->tx_txg);
+		scn->scn_checkpointing = B_TRUE;
+	}
+
+	if (!scn->scn_traversal_done && !scn->scn_clearing &&
+	    !scn->scn_checkpointing)
+		dsl_scan_traverse(scn, tx);
+
+	/*
+	 * Issue the queued reads once there is nothing more to queue, or
+	 * while draining the queues for memory or for a checkpoint.
+	 */
+	if (scn->scn_queues_mem != 0 && (scn->scn_traversal_done ||
+	    scn->scn_clearing || scn->scn_checkpointing)) {
+		uint64_t mem = scn->scn_queues_mem;
+
+		dsl_scan_issue(scn);
+		zfs_dbgmsg("issued %llu queued reads in %llums",
+		    (longlong_t)(mem - scn->scn_queues_mem) /
+		    sizeof (scan_io_t),
+		    (longlong_t)(gethrtime() - scn->scn_sync_start_time) /
+		    MICROSEC);
+		if (scn->scn_clearing &&
+		    scn->scn_queues_mem <= dsl_scan_mem_limit() / 2)
+			scn->scn_clearing = B_FALSE;
+	}
+
+	if (DSL_SCAN_IS_SCRUB_RESILVER(scn)) {
+		mutex_enter(&spa->spa_scrub_lock);
+		while (spa->spa_scrub_inflight > 0) {
+			cv_wait(&spa->spa_scrub_io_cv,
+			    &spa->spa_scrub_lock);
+		}
+		mutex_exit(&spa->spa_scrub_lock);
+	}
+
+	if (scn->scn_traversal_done && scn->scn_queues_mem == 0) {
+		/* finished with scan. */
+		zfs_dbgmsg("finished scan txg %llu", (longlong_t)tx->tx_txg);
+		dsl_scan_done(scn, B_TRUE, tx);
+	}
+
+	dsl_scan_sync_state(scn, tx);
+}
+
+/*
+ * Run this txg's share of the traversal, which queues the reads it finds
+ * (or issues them, for a legacy scan).
+ */
+static void
+dsl_scan_traverse(dsl_scan_t *scn, dmu_tx_t *tx)
+{
+	dsl_pool_t *dp = scn->scn_dp;
+
 	if (scn->scn_phys.scn_ddt_bookmark.ddb_class <=
 	    scn->scn_phys.scn_ddt_class_max) {
 		zfs_dbgmsg("doing scan sync txg %llu; "
@@ -1521,21 +2001,10 @@ dsl_scan_sync(dsl_pool_t *dp, dmu_tx_t *tx)
 	    (longlong_t)(gethrtime() - scn->scn_sync_start_time) / MICROSEC);
 
 	if (!scn->scn_pausing) {
-		/* finished with scan. */
-		zfs_dbgmsg("finished scan txg %llu", (longlong_t)tx->tx_txg);
-		dsl_scan_done(scn, B_TRUE, tx);
+		zfs_dbgmsg("finished scan traversal txg %llu",
+		    (longlong_t)tx->tx_txg);
+		scn->scn_traversal_done = B_TRUE;
 	}
-
-	if (DSL_SCAN_IS_SCRUB_RESILVER(scn)) {
-		mutex_enter(&spa->spa_scrub_lock);
-		while (spa->spa_scrub_inflight > 0) {
-			cv_wait(&spa->spa_scrub_io_cv,
-			    &spa->spa_scrub_lock);
-		}
-		mutex_exit(&spa->spa_scrub_lock);
-	}
-
-	dsl_scan_sync_state(scn, tx);
 }
 
 /*
@@ -1565,6 +2034,17 @@ dsl_scan_resilvering(dsl_pool_t *dp)
 	    dp->dp_scan->scn_phys.scn_func == POOL_SCAN_RESILVER);
 }
 
+/*
+ * Is the scan still walking the DDT?
+ */
+boolean_t
+dsl_scan_ddt_walking(dsl_scan_t *scn)
+{
+	return (scn->scn_phys.scn_state == DSS_SCANNING &&
+	    scn->scn_phys.scn_ddt_bookmark.ddb_class <=
+	    scn->scn_phys.scn_ddt_class_max);
+}
+
 /*
  * scrub consumers
  */
@@ -1624,7 +2104,7 @@ dsl_scan_scrub_done(zio_t *zio)
 {
 	spa_t *spa = zio->io_spa;
 
-	zio_data_buf_free(zio->io_data, zio->io_size);
+	abd_free(zio->io_abd);
 
 	mutex_enter(&spa->spa_scrub_lock);
 	spa->spa_scrub_inflight--;
@@ -1637,20 +2117,104 @@ dsl_scan_scrub_done(zio_t *zio)
 	mutex_exit(&spa->spa_scrub_lock);
 }
 
+/*
+ * Count a block as issued: either its read has been started, or it
+ * doesn't need one.
+ */
+static void
+dsl_scan_count_issued(spa_t *spa, const blkptr_t *bp)
+{
+	uint64_t asize = 0;
+	int d;
+
+	for (d = 0; d < BP_GET_NDVAS(bp); d++)
+		asize += DVA_GET_ASIZE(&bp->blk_dva[d]);
+	atomic_add_64(&spa->spa_scan_pass_issued, asize);
+}
+
+static void
+scan_exec_io(dsl_pool_t *dp, const blkptr_t *bp, int zio_flags,
+    const zbookmark_t *zb)
+{
+	dsl_scan_t *scn = dp->dp_scan;
+	spa_t *spa = dp->dp_spa;
+	vdev_t *rvd = spa->spa_root_vdev;
+	uint64_t maxinflight = rvd->vdev_children * zfs_top_maxinflight;
+	size_t size = BP_GET_PSIZE(bp);
+	int scan_delay;
+
+	scan_delay = (scn->scn_phys.scn_func == POOL_SCAN_RESILVER) ?
+	    zfs_resilver_delay : zfs_scrub_delay;
+
+	mutex_enter(&spa->spa_scrub_lock);
+	while (spa->spa_scrub_inflight >= maxinflight)
+		cv_wait(&spa->spa_scrub_io_cv, &spa->spa_scrub_lock);
+	spa->spa_scrub_inflight++;
+	mutex_exit(&spa->spa_scrub_lock);
+
+	/*
+	 * If we're seeing recent (zfs_scan_idle) "important" I/Os
+	 * then throttle our workload to limit the impact of a scan.
+	 */
+	if (ddi_get_lbolt64() - spa->spa_last_io <= zfs_scan_idle)
+		delay(scan_delay);
+
+	dsl_scan_count_issued(spa, bp);
+	zio_nowait(zio_read(NULL, spa, bp, abd_alloc(size, B_FALSE), size,
+	    dsl_scan_scrub_done, NULL, ZIO_PRIORITY_SCRUB, zio_flags, zb));
+}
+
+/*
+ * Queue a read on the top-level vdev holding the block's first copy.
+ */
+static void
+dsl_scan_enqueue(dsl_pool_t *dp, const blkptr_t *bp, int zio_flags,
+    const zbookmark_t *zb)
+{
+	dsl_scan_t *scn = dp->dp_scan;
+	spa_t *spa = dp->dp_spa;
+	vdev_t *vd = vdev_lookup_top(spa, DVA_GET_VDEV(&bp->blk_dva[0]));
+	scan_io_t *sio;
+	avl_index_t where;
+
+	sio = kmem_cache_alloc(sio_cache, KM_PUSHPAGE);
+	sio->sio_bp = *bp;
+	sio->sio_zb = *zb;
+	sio->sio_flags = zio_flags;
+
+	mutex_enter(&vd->vdev_scan_io_queue_lock);
+	if (vd->vdev_scan_io_queue == NULL)
+		vd->vdev_scan_io_queue = dsl_scan_io_queue_create(scn, vd);
+	if (avl_find(&vd->vdev_scan_io_queue->q_sios, sio, &where) != NULL) {
+		/* The same block reached through a second path. */
+		mutex_exit(&vd->vdev_scan_io_queue_lock);
+		dsl_scan_count_issued(spa, bp);
+		kmem_cache_free(sio_cache, sio);
+		return;
+	}
+	avl_insert(&vd->vdev_scan_io_queue->q_sios, sio, where);
+	atomic_add_64(&scn->scn_queues_mem, sizeof (scan_io_t));
+	mutex_exit(&vd->vdev_scan_io_queue_lock);
+}
+
 static int
 dsl_scan_scrub_cb(dsl_pool_t *dp,
     const blkptr_t *bp, const zbookmark_t *zb)
 {
 	dsl_scan_t *scn = dp->dp_scan;
-	size_t size = BP_GET_PSIZE(bp);
 	spa_t *spa = dp->dp_spa;
 	uint64_t phys_birth = BP_PHYSICAL_BIRTH(bp);
 	boolean_t needs_io = B_FALSE;
 	int zio_flags = ZIO_FLAG_SCAN_THREAD | ZIO_FLAG_RAW | ZIO_FLAG_CANFAIL;
-	int zio_priority = 0;
-	int scan_delay = 0;
 	int d;
 
+	/*
+	 * An embedded block lives entirely in its parent, which the scan
+	 * has already read and verified, so there is nothing left to do.
+	 */
+	if (BP_IS_EMBEDDED(bp))
+		return (0);
+
 	if (phys_birth <= scn->scn_phys.scn_min_txg ||
 	    phys_birth >= scn->scn_phys.scn_max_txg)
 		return (0);
@@ -1660,14 +2224,10 @@ dsl_scan_scrub_cb(dsl_pool_t *dp,
 	ASSERT(DSL_SCAN_IS_SCRUB_RESILVER(scn));
 	if (scn->scn_phys.scn_func == POOL_SCAN_SCRUB) {
 		zio_flags |= ZIO_FLAG_SCRUB;
-		zio_priority = ZIO_PRIORITY_SCRUB;
 		needs_io = B_TRUE;
-		scan_delay = zfs_scrub_delay;
 	} else if (scn->scn_phys.scn_func == POOL_SCAN_RESILVER) {
 		zio_flags |= ZIO_FLAG_RESILVER;
-		zio_priority = ZIO_PRIORITY_RESILVER;
 		needs_io = B_FALSE;
-		scan_delay = zfs_resilver_delay;
 	}
 
 	/* If it's an intent log block, failure is expected. */
@@ -1704,33 +2264,127 @@ dsl_scan_scrub_cb(dsl_pool_t *dp,
 		}
 	}
 
-	if (needs_io && !zfs_no_scrub_io) {
-		vdev_t *rvd = spa->spa_root_vdev;
-		uint64_t maxinflight = rvd->vdev_children * zfs_top_maxinflight;
-		void *data = zio_data_buf_alloc(size);
-
-		mutex_enter(&spa->spa_scrub_lock);
-		while (spa->spa_scrub_inflight >= maxinflight)
-			cv_wait(&spa->spa_scrub_io_cv, &spa->spa_scrub_lock);
-		spa->spa_scrub_inflight++;
-		mutex_exit(&spa->spa_scrub_lock);
-
+	if (!needs_io || zfs_no_scrub_io) {
+		dsl_scan_count_issued(spa, bp);
+	} else if (!scn->scn_is_sorted || BP_IS_GANG(bp) ||
+	    zb->zb_level == ZB_ZIL_LEVEL) {
 		/*
-		 * If we're seeing recent (zfs_scan_idle) "important" I/Os
-		 * then throttle our workload to limit the impact of a scan.
+		 * A gang block's data is wherever its members are, so
+		 * there is nothing to sort it by.
 		 */
-		if (ddi_get_lbolt64() - spa->spa_last_io <= zfs_scan_idle)
-			delay(scan_delay);
-
-		zio_nowait(zio_read(NULL, spa, bp, data, size,
-		    dsl_scan_scrub_done, NULL, zio_priority,
-		    zio_flags, zb));
+		scan_exec_io(dp, bp, zio_flags, zb);
+	} else {
+		dsl_scan_enqueue(dp, bp, zio_flags, zb);
 	}
 
 	/* do not relocate this block */
 	return (0);
 }
 
+/*
+ * Issue the next run of queued reads on a vdev: up to zfs_top_maxinflight
+ * reads from the cursor on, as long as no two are further apart than
+ * zfs_scan_max_ext_gap.  Past the last read the cursor starts over, as
+ * the traversal may have queued reads behind it.  Returns the number of
+ * reads issued.
+ */
+static int
+dsl_scan_io_queue_issue_run(dsl_scan_io_queue_t *q)
+{
+	dsl_scan_t *scn = q->q_scn;
+	vdev_t *vd = q->q_vd;
+	scan_io_t srch, *sio;
+	avl_index_t where;
+	int n = 0;
+
+	bzero(&srch, sizeof (srch));
+	while (n < zfs_top_maxinflight) {
+		mutex_enter(&vd->vdev_scan_io_queue_lock);
+		DVA_SET_OFFSET(&srch.sio_bp.blk_dva[0], q->q_cursor);
+		sio = avl_find(&q->q_sios, &srch, &where);
+		if (sio == NULL)
+			sio = avl_nearest(&q->q_sios, where, AVL_AFTER);
+		if (sio == NULL && n == 0)
+			sio = avl_first(&q->q_sios);
+		if (sio == NULL || (n > 0 &&
+		    SIO_OFFSET(sio) - q->q_cursor > zfs_scan_max_ext_gap)) {
+			mutex_exit(&vd->vdev_scan_io_queue_lock);
+			break;
+		}
+		avl_remove(&q->q_sios, sio);
+		atomic_add_64(&scn->scn_queues_mem,
+		    -(int64_t)sizeof (scan_io_t));
+		q->q_cursor = SIO_OFFSET(sio) + SIO_ASIZE(sio);
+		mutex_exit(&vd->vdev_scan_io_queue_lock);
+
+		scan_exec_io(scn->scn_dp, &sio->sio_bp, sio->sio_flags,
+		    &sio->sio_zb);
+		kmem_cache_free(sio_cache, sio);
+		n++;
+	}
+	return (n);
+}
+
+/*
+ * Drain the queues, a run from each top-level vdev in turn so they are all
+ * kept busy, until they are empty or this txg's time is up.
+ */
+static void
+dsl_scan_issue(dsl_scan_t *scn)
+{
+	vdev_t *rvd = scn->scn_dp->dp_spa->spa_root_vdev;
+	boolean_t issued;
+	int c;
+
+	do {
+		issued = B_FALSE;
+		for (c = 0; c < rvd->vdev_children; c++) {
+			dsl_scan_io_queue_t *q =
+			    rvd->vdev_child[c]->vdev_scan_io_queue;
+
+			if (q != NULL && dsl_scan_io_queue_issue_run(q) != 0)
+				issued = B_TRUE;
+		}
+	} while (issued && !dsl_scan_time_up(scn));
+}
+
+/*
+ * A block is being freed; if its read is still queued, drop it.
+ */
+void
+dsl_scan_freed(spa_t *spa, const blkptr_t *bp)
+{
+	dsl_pool_t *dp = spa->spa_dsl_pool;
+	dsl_scan_t *scn;
+	dsl_scan_io_queue_t *q;
+	scan_io_t srch, *sio;
+	vdev_t *vd;
+
+	if (dp == NULL || (scn = dp->dp_scan) == NULL ||
+	    scn->scn_queues_mem == 0 || BP_IS_HOLE(bp) || BP_IS_GANG(bp))
+		return;
+
+	vd = vdev_lookup_top(spa, DVA_GET_VDEV(&bp->blk_dva[0]));
+	if (vd == NULL)
+		return;
+
+	mutex_enter(&vd->vdev_scan_io_queue_lock);
+	q = vd->vdev_scan_io_queue;
+	if (q != NULL) {
+		srch.sio_bp = *bp;
+		sio = avl_find(&q->q_sios, &srch, NULL);
+		if (sio != NULL && sio->sio_bp.blk_birth == bp->blk_birth &&
+		    DVA_EQUAL(&sio->sio_bp.blk_dva[0], &bp->blk_dva[0])) {
+			avl_remove(&q->q_sios, sio);
+			atomic_add_64(&scn->scn_queues_mem,
+			    -(int64_t)sizeof (scan_io_t));
+			dsl_scan_count_issued(spa, bp);
+			kmem_cache_free(sio_cache, sio);
+		}
+	}
+	mutex_exit(&vd->vdev_scan_io_queue_lock);
+}
+
 int
 dsl_scan(dsl_pool_t *dp, pool_scan_func_t func)
 {
@@ -1780,4 +2434,17 @@ MODULE_PARM_DESC(zfs_no_scrub_io, "Set to disable scrub I/O");
 
 module_param(zfs_no_scrub_prefetch, int, 0644);
 MODULE_PARM_DESC(zfs_no_scrub_prefetch, "Set to disable scrub prefetching");
+
+module_param(zfs_scan_legacy, int, 0644);
+MODULE_PARM_DESC(zfs_scan_legacy, "Issue scan reads in traversal order");
+
+module_param(zfs_scan_mem_lim_fact, int, 0644);
+MODULE_PARM_DESC(zfs_scan_mem_lim_fact, "Fraction of RAM for scan queues");
+
+module_param(zfs_scan_checkpoint_intval, int, 0644);
+MODULE_PARM_DESC(zfs_scan_checkpoint_intval,
+	"Seconds between scan checkpoints");
+
+module_param(zfs_scan_max_ext_gap, ulong, 0644);
+MODULE_PARM_DESC(zfs_scan_max_ext_gap, "Max gap in bytes within a scan run");
 #endif
@@ -148,7 +148,7 @@ dsl_sync_task_sync(dsl_sync_task_t *dst, dmu_tx_t *tx)
 	 * Check for sufficient space.  We just check against what's
 	 * on-disk; we don't want any in-flight accounting to get in our
 	 * way, because open context may have already used up various
-	 * in-core limits (arc_tempreserve, dsl_pool_tempreserve).
+	 * in-core limits (arc_tempreserve, dirty data accounting).
 	 */
 	quota = dsl_pool_adjustedsize(dp, B_FALSE) -
 	    metaslab_class_get_deferred(spa_normal_class(dp->dp_spa));
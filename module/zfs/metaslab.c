@@ -28,8 +28,10 @@
 #include <sys/dmu_tx.h>
 #include <sys/space_map.h>
 #include <sys/metaslab_impl.h>
+#include <sys/spa_log_spacemap.h>
 #include <sys/vdev_impl.h>
 #include <sys/zio.h>
+#include <sys/zfeature.h>
 
 #define WITH_DF_BLOCK_ALLOCATOR
 
@@ -74,7 +76,7 @@ int metaslab_debug = 0;
  * an allocation of this size then it switches to using more
  * aggressive strategy (i.e search by size rather than offset).
  */
-uint64_t metaslab_df_alloc_threshold = SPA_MAXBLOCKSIZE;
+uint64_t metaslab_df_alloc_threshold = SPA_OLD_MAXBLOCKSIZE;
 
 /*
  * The minimum free space, in percent, which must be available
@@ -100,6 +102,14 @@ int metaslab_prefetch_limit = SPA_DVAS_PER_BP;
  */
 int metaslab_smo_bonus_pct = 150;
 
+/*
+ * A metaslab group may have this percentage of zfs_vdev_async_write_max_active
+ * async write allocations outstanding, i.e. allocated but not yet written,
+ * before the rotor passes it over for a group whose device is keeping up.
+ * Faster devices retire their writes sooner and so take more of them.
+ */
+int zfs_vdev_queue_depth_pct = 1000;
+
 /*
  * ==========================================================================
  * Metaslab classes
@@ -222,10 +232,44 @@ metaslab_compare(const void *x1, const void *x2)
 	return (0);
 }
 
+static uint64_t
+metaslab_group_max_queue_depth(metaslab_group_t *mg)
+{
+	return (MAX((uint64_t)zfs_vdev_async_write_max_active *
+	    zfs_vdev_queue_depth_pct / 100, 1));
+}
+
+static const metaslab_group_stats_t metaslab_group_stats_template = {
+	{ "alloc_queue_depth",		KSTAT_DATA_UINT64 },
+	{ "max_alloc_queue_depth",	KSTAT_DATA_UINT64 },
+	{ "allocations",		KSTAT_DATA_UINT64 },
+	{ "throttled",			KSTAT_DATA_UINT64 }
+};
+
+#define	MGSTAT_BUMP(mg, stat) \
+	atomic_add_64(&(mg)->mg_stats.stat.value.ui64, 1)
+
+static int
+metaslab_group_kstat_update(kstat_t *ksp, int rw)
+{
+	metaslab_group_t *mg = ksp->ks_private;
+
+	if (rw == KSTAT_WRITE)
+		return (EACCES);
+
+	mg->mg_stats.mgs_alloc_queue_depth.value.ui64 =
+	    mg->mg_alloc_queue_depth;
+	mg->mg_stats.mgs_max_alloc_queue_depth.value.ui64 =
+	    metaslab_group_max_queue_depth(mg);
+
+	return (0);
+}
+
 metaslab_group_t *
 metaslab_group_create(metaslab_class_t *mc, vdev_t *vd)
 {
 	metaslab_group_t *mg;
+	char name[KSTAT_STRLEN];
 
 	mg = kmem_zalloc(sizeof (metaslab_group_t), KM_PUSHPAGE);
 	mutex_init(&mg->mg_lock, NULL, MUTEX_DEFAULT, NULL);
@@ -235,6 +279,19 @@ metaslab_group_create(metaslab_class_t *mc, vdev_t *vd)
 	mg->mg_class = mc;
 	mg->mg_activation_count = 0;
 
+	mg->mg_stats = metaslab_group_stats_template;
+	(void) snprintf(name, KSTAT_STRLEN, "vdev_alloc-%s-%llu",
+	    spa_name(vd->vdev_spa), (u_longlong_t)vd->vdev_id);
+	mg->mg_ksp = kstat_create("zfs", 0, name, "misc", KSTAT_TYPE_NAMED,
+	    sizeof (mg->mg_stats) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+	if (mg->mg_ksp != NULL) {
+		mg->mg_ksp->ks_data = &mg->mg_stats;
+		mg->mg_ksp->ks_private = mg;
+		mg->mg_ksp->ks_update = metaslab_group_kstat_update;
+		kstat_install(mg->mg_ksp);
+	}
+
 	return (mg);
 }
 
@@ -250,6 +307,9 @@ metaslab_group_destroy(metaslab_group_t *mg)
 	 */
 	ASSERT(mg->mg_activation_count <= 0);
 
+	if (mg->mg_ksp != NULL)
+		kstat_delete(mg->mg_ksp);
+
 	avl_destroy(&mg->mg_metaslab_tree);
 	mutex_destroy(&mg->mg_lock);
 	kmem_free(mg, sizeof (metaslab_group_t));
@@ -364,19 +424,19 @@ metaslab_group_sort(metaslab_group_t *mg, metaslab_t *msp, uint64_t weight)
 static int
 metaslab_segsize_compare(const void *x1, const void *x2)
 {
-	const space_seg_t *s1 = x1;
-	const space_seg_t *s2 = x2;
-	uint64_t ss_size1 = s1->ss_end - s1->ss_start;
-	uint64_t ss_size2 = s2->ss_end - s2->ss_start;
+	const range_seg_t *s1 = x1;
+	const range_seg_t *s2 = x2;
+	uint64_t rs_size1 = s1->rs_end - s1->rs_start;
+	uint64_t rs_size2 = s2->rs_end - s2->rs_start;
 
-	if (ss_size1 < ss_size2)
+	if (rs_size1 < rs_size2)
 		return (-1);
-	if (ss_size1 > ss_size2)
+	if (rs_size1 > rs_size2)
 		return (1);
 
-	if (s1->ss_start < s2->ss_start)
+	if (s1->rs_start < s2->rs_start)
 		return (-1);
-	if (s1->ss_start > s2->ss_start)
+	if (s1->rs_start > s2->rs_start)
 		return (1);
 
 	return (0);
@@ -394,24 +454,24 @@ static uint64_t
 metaslab_block_picker(avl_tree_t *t, uint64_t *cursor, uint64_t size,
     uint64_t align)
 {
-	space_seg_t *ss, ssearch;
+	range_seg_t *rs, rsearch;
 	avl_index_t where;
 
-	ssearch.ss_start = *cursor;
-	ssearch.ss_end = *cursor + size;
+	rsearch.rs_start = *cursor;
+	rsearch.rs_end = *cursor + size;
 
-	ss = avl_find(t, &ssearch, &where);
-	if (ss == NULL)
-		ss = avl_nearest(t, where, AVL_AFTER);
+	rs = avl_find(t, &rsearch, &where);
+	if (rs == NULL)
+		rs = avl_nearest(t, where, AVL_AFTER);
 
-	while (ss != NULL) {
-		uint64_t offset = P2ROUNDUP(ss->ss_start, align);
+	while (rs != NULL) {
+		uint64_t offset = P2ROUNDUP(rs->rs_start, align);
 
-		if (offset + size <= ss->ss_end) {
+		if (offset + size <= rs->rs_end) {
 			*cursor = offset + size;
 			return (offset);
 		}
-		ss = AVL_NEXT(t, ss);
+		rs = AVL_NEXT(t, rs);
 	}
 
 	/*
@@ -426,34 +486,74 @@ metaslab_block_picker(avl_tree_t *t, uint64_t *cursor, uint64_t size,
 }
 #endif /* WITH_FF/DF/CDF_BLOCK_ALLOCATOR */
 
+/*
+ * The size-ordered picker-private tree is kept in step with the space
+ * map's range tree through these callbacks while the map is loaded.
+ */
+/* ARGSUSED */
+static void
+metaslab_rt_add(range_tree_t *rt, range_seg_t *rs, void *arg)
+{
+	space_map_t *sm = arg;
+
+	avl_add(sm->sm_pp_root, rs);
+}
+
+/* ARGSUSED */
+static void
+metaslab_rt_remove(range_tree_t *rt, range_seg_t *rs, void *arg)
+{
+	space_map_t *sm = arg;
+
+	avl_remove(sm->sm_pp_root, rs);
+}
+
+/* ARGSUSED */
+static void
+metaslab_rt_vacate(range_tree_t *rt, void *arg)
+{
+	space_map_t *sm = arg;
+	void *cookie = NULL;
+
+	while (avl_destroy_nodes(sm->sm_pp_root, &cookie) != NULL) {
+		/* tear down the tree */
+	}
+}
+
+static range_tree_ops_t metaslab_rt_ops = {
+	metaslab_rt_add,
+	metaslab_rt_remove,
+	metaslab_rt_vacate
+};
+
 static void
 metaslab_pp_load(space_map_t *sm)
 {
-	space_seg_t *ss;
+	avl_tree_t *t = &sm->sm_rt.rt_root;
+	range_seg_t *rs;
 
 	ASSERT(sm->sm_ppd == NULL);
 	sm->sm_ppd = kmem_zalloc(64 * sizeof (uint64_t), KM_PUSHPAGE);
 
 	sm->sm_pp_root = kmem_alloc(sizeof (avl_tree_t), KM_PUSHPAGE);
 	avl_create(sm->sm_pp_root, metaslab_segsize_compare,
-	    sizeof (space_seg_t), offsetof(struct space_seg, ss_pp_node));
+	    sizeof (range_seg_t), offsetof(struct range_seg, rs_pp_node));
 
-	for (ss = avl_first(&sm->sm_root); ss; ss = AVL_NEXT(&sm->sm_root, ss))
-		avl_add(sm->sm_pp_root, ss);
+	for (rs = avl_first(t); rs != NULL; rs = AVL_NEXT(t, rs))
+		avl_add(sm->sm_pp_root, rs);
+
+	range_tree_set_ops(&sm->sm_rt, &metaslab_rt_ops, sm);
 }
 
 static void
 metaslab_pp_unload(space_map_t *sm)
 {
-	void *cookie = NULL;
+	range_tree_set_ops(&sm->sm_rt, NULL, NULL);
 
 	kmem_free(sm->sm_ppd, 64 * sizeof (uint64_t));
 	sm->sm_ppd = NULL;
 
-	while (avl_destroy_nodes(sm->sm_pp_root, &cookie) != NULL) {
-		/* tear down the tree */
-	}
-
+	metaslab_rt_vacate(&sm->sm_rt, sm);
 	avl_destroy(sm->sm_pp_root);
 	kmem_free(sm->sm_pp_root, sizeof (avl_tree_t));
 	sm->sm_pp_root = NULL;
@@ -480,12 +580,12 @@ uint64_t
 metaslab_pp_maxsize(space_map_t *sm)
 {
 	avl_tree_t *t = sm->sm_pp_root;
-	space_seg_t *ss;
+	range_seg_t *rs;
 
-	if (t == NULL || (ss = avl_last(t)) == NULL)
+	if (t == NULL || (rs = avl_last(t)) == NULL)
 		return (0ULL);
 
-	return (ss->ss_end - ss->ss_start);
+	return (rs->rs_end - rs->rs_start);
 }
 
 #if defined(WITH_FF_BLOCK_ALLOCATOR)
@@ -497,7 +597,7 @@ metaslab_pp_maxsize(space_map_t *sm)
 static uint64_t
 metaslab_ff_alloc(space_map_t *sm, uint64_t size)
 {
-	avl_tree_t *t = &sm->sm_root;
+	avl_tree_t *t = &sm->sm_rt.rt_root;
 	uint64_t align = size & -size;
 	uint64_t *cursor = (uint64_t *)sm->sm_ppd + highbit(align) - 1;
 
@@ -536,14 +636,15 @@ space_map_ops_t *zfs_metaslab_ops = &metaslab_ff_ops;
 static uint64_t
 metaslab_df_alloc(space_map_t *sm, uint64_t size)
 {
-	avl_tree_t *t = &sm->sm_root;
+	avl_tree_t *t = &sm->sm_rt.rt_root;
 	uint64_t align = size & -size;
 	uint64_t *cursor = (uint64_t *)sm->sm_ppd + highbit(align) - 1;
 	uint64_t max_size = metaslab_pp_maxsize(sm);
-	int free_pct = sm->sm_space * 100 / sm->sm_size;
+	int free_pct = sm->sm_rt.rt_space * 100 / sm->sm_size;
 
 	ASSERT(MUTEX_HELD(sm->sm_lock));
-	ASSERT3U(avl_numnodes(&sm->sm_root), ==, avl_numnodes(sm->sm_pp_root));
+	ASSERT3U(range_tree_numsegs(&sm->sm_rt), ==,
+	    avl_numnodes(sm->sm_pp_root));
 
 	if (max_size < size)
 		return (-1ULL);
@@ -565,7 +666,7 @@ static boolean_t
 metaslab_df_fragmented(space_map_t *sm)
 {
 	uint64_t max_size = metaslab_pp_maxsize(sm);
-	int free_pct = sm->sm_space * 100 / sm->sm_size;
+	int free_pct = sm->sm_rt.rt_space * 100 / sm->sm_size;
 
 	if (max_size >= metaslab_df_alloc_threshold &&
 	    free_pct >= metaslab_df_free_pct)
@@ -596,7 +697,7 @@ space_map_ops_t *zfs_metaslab_ops = &metaslab_df_ops;
 static uint64_t
 metaslab_cdf_alloc(space_map_t *sm, uint64_t size)
 {
-	avl_tree_t *t = &sm->sm_root;
+	avl_tree_t *t = &sm->sm_rt.rt_root;
 	uint64_t *cursor = (uint64_t *)sm->sm_ppd;
 	uint64_t *extent_end = (uint64_t *)sm->sm_ppd + 1;
 	uint64_t max_size = metaslab_pp_maxsize(sm);
@@ -604,7 +705,8 @@ metaslab_cdf_alloc(space_map_t *sm, uint64_t size)
 	uint64_t offset = 0;
 
 	ASSERT(MUTEX_HELD(sm->sm_lock));
-	ASSERT3U(avl_numnodes(&sm->sm_root), ==, avl_numnodes(sm->sm_pp_root));
+	ASSERT3U(range_tree_numsegs(&sm->sm_rt), ==,
+	    avl_numnodes(sm->sm_pp_root));
 
 	if (max_size < size)
 		return (-1ULL);
@@ -620,7 +722,7 @@ metaslab_cdf_alloc(space_map_t *sm, uint64_t size)
 		t = sm->sm_pp_root;
 		*cursor = *extent_end = 0;
 
-		if (max_size > 2 * SPA_MAXBLOCKSIZE)
+		if (max_size > 2 * SPA_OLD_MAXBLOCKSIZE)
 			rsize = MIN(metaslab_min_alloc_size, max_size);
 		offset = metaslab_block_picker(t, extent_end, rsize, 1ULL);
 		if (offset != -1)
@@ -661,39 +763,40 @@ uint64_t metaslab_ndf_clump_shift = 4;
 static uint64_t
 metaslab_ndf_alloc(space_map_t *sm, uint64_t size)
 {
-	avl_tree_t *t = &sm->sm_root;
+	avl_tree_t *t = &sm->sm_rt.rt_root;
 	avl_index_t where;
-	space_seg_t *ss, ssearch;
+	range_seg_t *rs, rsearch;
 	uint64_t hbit = highbit(size);
 	uint64_t *cursor = (uint64_t *)sm->sm_ppd + hbit - 1;
 	uint64_t max_size = metaslab_pp_maxsize(sm);
 
 	ASSERT(MUTEX_HELD(sm->sm_lock));
-	ASSERT3U(avl_numnodes(&sm->sm_root), ==, avl_numnodes(sm->sm_pp_root));
+	ASSERT3U(range_tree_numsegs(&sm->sm_rt), ==,
+	    avl_numnodes(sm->sm_pp_root));
 
 	if (max_size < size)
 		return (-1ULL);
 
-	ssearch.ss_start = *cursor;
-	ssearch.ss_end = *cursor + size;
+	rsearch.rs_start = *cursor;
+	rsearch.rs_end = *cursor + size;
 
-	ss = avl_find(t, &ssearch, &where);
-	if (ss == NULL || (ss->ss_start + size > ss->ss_end)) {
+	rs = avl_find(t, &rsearch, &where);
+	if (rs == NULL || (rs->rs_start + size > rs->rs_end)) {
 		t = sm->sm_pp_root;
 
-		ssearch.ss_start = 0;
-		ssearch.ss_end = MIN(max_size,
+		rsearch.rs_start = 0;
+		rsearch.rs_end = MIN(max_size,
 		    1ULL << (hbit + metaslab_ndf_clump_shift));
-		ss = avl_find(t, &ssearch, &where);
-		if (ss == NULL)
-			ss = avl_nearest(t, where, AVL_AFTER);
-		ASSERT(ss != NULL);
+		rs = avl_find(t, &rsearch, &where);
+		if (rs == NULL)
+			rs = avl_nearest(t, where, AVL_AFTER);
+		ASSERT(rs != NULL);
 	}
 
-	if (ss != NULL) {
-		if (ss->ss_start + size <= ss->ss_end) {
-			*cursor = ss->ss_start + size;
-			return (ss->ss_start);
+	if (rs != NULL) {
+		if (rs->rs_start + size <= rs->rs_end) {
+			*cursor = rs->rs_start + size;
+			return (rs->rs_start);
 		}
 	}
 	return (-1ULL);
@@ -733,13 +836,24 @@ metaslab_init(metaslab_group_t *mg, space_map_obj_t *smo,
 	uint64_t start, uint64_t size, uint64_t txg)
 {
 	vdev_t *vd = mg->mg_vd;
+	objset_t *mos = spa_meta_objset(vd->vdev_spa);
+	dmu_object_info_t doi;
 	metaslab_t *msp;
 
 	msp = kmem_zalloc(sizeof (metaslab_t), KM_PUSHPAGE);
 	mutex_init(&msp->ms_lock, NULL, MUTEX_DEFAULT, NULL);
+	mutex_init(&msp->ms_sync_lock, NULL, MUTEX_DEFAULT, NULL);
 
 	msp->ms_smo_syncing = *smo;
 
+	/*
+	 * Only a space map whose bonus has room for smo_flushed_txg can
+	 * leave changes in the space map log.
+	 */
+	if (smo->smo_object != 0 &&
+	    dmu_object_info(mos, smo->smo_object, &doi) == 0)
+		msp->ms_can_log = (doi.doi_bonus_size >= sizeof (*smo));
+
 	/*
 	 * We create the main space map here, but we don't create the
 	 * allocmaps and freemaps until metaslab_sync_done().  This serves
@@ -751,12 +865,21 @@ metaslab_init(metaslab_group_t *mg, space_map_obj_t *smo,
 	space_map_create(msp->ms_map, start, size,
 	    vd->vdev_ashift, &msp->ms_lock);
 
+	msp->ms_unflushed_allocs = kmem_zalloc(sizeof (space_map_t),
+	    KM_PUSHPAGE);
+	space_map_create(msp->ms_unflushed_allocs, start, size,
+	    vd->vdev_ashift, &msp->ms_lock);
+	msp->ms_unflushed_frees = kmem_zalloc(sizeof (space_map_t),
+	    KM_PUSHPAGE);
+	space_map_create(msp->ms_unflushed_frees, start, size,
+	    vd->vdev_ashift, &msp->ms_lock);
+
 	metaslab_group_add(mg, msp);
 
 	if (metaslab_debug && smo->smo_object != 0) {
 		mutex_enter(&msp->ms_lock);
 		VERIFY(space_map_load(msp->ms_map, mg->mg_class->mc_ops,
-		    SM_FREE, smo, spa_meta_objset(vd->vdev_spa)) == 0);
+		    SM_FREE, smo, mos) == 0);
 		mutex_exit(&msp->ms_lock);
 	}
 
@@ -784,7 +907,7 @@ metaslab_fini(metaslab_t *msp)
 	int t;
 
 	vdev_space_update(mg->mg_vd,
-	    -msp->ms_smo.smo_alloc, 0, -msp->ms_map->sm_size);
+	    -msp->ms_allocated, 0, -msp->ms_map->sm_size);
 
 	metaslab_group_remove(mg, msp);
 
@@ -794,6 +917,13 @@ metaslab_fini(metaslab_t *msp)
 	space_map_destroy(msp->ms_map);
 	kmem_free(msp->ms_map, sizeof (*msp->ms_map));
 
+	metaslab_unflushed_drop(msp);
+	space_map_destroy(msp->ms_unflushed_allocs);
+	space_map_destroy(msp->ms_unflushed_frees);
+	kmem_free(msp->ms_unflushed_allocs,
+	    sizeof (*msp->ms_unflushed_allocs));
+	kmem_free(msp->ms_unflushed_frees, sizeof (*msp->ms_unflushed_frees));
+
 	for (t = 0; t < TXG_SIZE; t++) {
 		space_map_destroy(msp->ms_allocmap[t]);
 		space_map_destroy(msp->ms_freemap[t]);
@@ -810,6 +940,7 @@ metaslab_fini(metaslab_t *msp)
 
 	mutex_exit(&msp->ms_lock);
 	mutex_destroy(&msp->ms_lock);
+	mutex_destroy(&msp->ms_sync_lock);
 
 	kmem_free(msp, sizeof (metaslab_t));
 }
@@ -819,21 +950,38 @@ metaslab_fini(metaslab_t *msp)
 #define	METASLAB_ACTIVE_MASK		\
 	(METASLAB_WEIGHT_PRIMARY | METASLAB_WEIGHT_SECONDARY)
 
+/*
+ * Return an upper bound on the largest free segment in the metaslab,
+ * without loading its space map.
+ */
+static uint64_t
+metaslab_max_segsize(metaslab_t *msp)
+{
+	space_map_t *sm = msp->ms_map;
+
+	if (sm->sm_loaded)
+		return (range_tree_max_segsize(&sm->sm_rt));
+	return (space_map_histogram_max_segsize(sm, &msp->ms_smo));
+}
+
 static uint64_t
 metaslab_weight(metaslab_t *msp)
 {
 	metaslab_group_t *mg = msp->ms_group;
 	space_map_t *sm = msp->ms_map;
-	space_map_obj_t *smo = &msp->ms_smo;
 	vdev_t *vd = mg->mg_vd;
 	uint64_t weight, space;
 
 	ASSERT(MUTEX_HELD(&msp->ms_lock));
 
 	/*
-	 * The baseline weight is the metaslab's free space.
+	 * The baseline weight is the largest free segment of the metaslab,
+	 * which bounds the largest allocation it can satisfy.  It comes from
+	 * the in-core segments if the map is loaded and from the histogram
+	 * kept with the space map otherwise; without a histogram we fall
+	 * back to the free space.
 	 */
-	space = sm->sm_size - smo->smo_alloc;
+	space = metaslab_max_segsize(msp);
 	weight = space;
 
 	/*
@@ -900,31 +1048,68 @@ metaslab_prefetch(metaslab_group_t *mg)
 	mutex_exit(&mg->mg_lock);
 }
 
+/*
+ * Load the in-core free map.  We read the syncing space map, so hold
+ * ms_sync_lock to keep metaslab_sync() and metaslab_flush() from moving
+ * records into it meanwhile, then apply what it doesn't have yet: the
+ * unflushed changes, and the frees of the syncing txg and of the deferred
+ * txgs, which aren't free for allocation yet.
+ */
 static int
-metaslab_activate(metaslab_t *msp, uint64_t activation_weight)
+metaslab_load(metaslab_t *msp)
 {
-	metaslab_group_t *mg = msp->ms_group;
 	space_map_t *sm = msp->ms_map;
 	space_map_ops_t *sm_ops = msp->ms_group->mg_class->mc_ops;
+	int error = 0;
 	int t;
 
 	ASSERT(MUTEX_HELD(&msp->ms_lock));
 
+	mutex_exit(&msp->ms_lock);
+	mutex_enter(&msp->ms_sync_lock);
+	mutex_enter(&msp->ms_lock);
+
+	space_map_load_wait(sm);
+	if (!sm->sm_loaded) {
+		error = space_map_load(sm, sm_ops, SM_FREE,
+		    &msp->ms_smo_syncing,
+		    spa_meta_objset(msp->ms_group->mg_vd->vdev_spa));
+		if (error == 0) {
+			space_map_walk(msp->ms_unflushed_allocs,
+			    space_map_claim, sm);
+			space_map_walk(msp->ms_unflushed_frees,
+			    space_map_free, sm);
+			if (msp->ms_sync_txg != 0)
+				space_map_walk(msp->ms_freemap[
+				    TXG_CLEAN(msp->ms_sync_txg) & TXG_MASK],
+				    space_map_claim, sm);
+			for (t = 0; t < TXG_DEFER_SIZE; t++)
+				space_map_walk(msp->ms_defermap[t],
+				    space_map_claim, sm);
+		}
+	}
+
+	mutex_exit(&msp->ms_sync_lock);
+
+	return (error);
+}
+
+static int
+metaslab_activate(metaslab_t *msp, uint64_t activation_weight)
+{
+	metaslab_group_t *mg = msp->ms_group;
+	space_map_t *sm = msp->ms_map;
+
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+
 	if ((msp->ms_weight & METASLAB_ACTIVE_MASK) == 0) {
 		space_map_load_wait(sm);
 		if (!sm->sm_loaded) {
-			space_map_obj_t *smo = &msp->ms_smo;
-
-			int error = space_map_load(sm, sm_ops, SM_FREE, smo,
-			    spa_meta_objset(msp->ms_group->mg_vd->vdev_spa));
+			int error = metaslab_load(msp);
 			if (error)  {
 				metaslab_group_sort(msp->ms_group, msp, 0);
 				return (error);
 			}
-			for (t = 0; t < TXG_DEFER_SIZE; t++)
-				space_map_walk(msp->ms_defermap[t],
-				    space_map_claim, sm);
-
 		}
 
 		/*
@@ -953,7 +1138,7 @@ metaslab_passivate(metaslab_t *msp, uint64_t size)
 	 * this metaslab again.  In that case, it had better be empty,
 	 * or we would be leaving space on the table.
 	 */
-	ASSERT(size >= SPA_MINBLOCKSIZE || msp->ms_map->sm_space == 0);
+	ASSERT(size >= SPA_MINBLOCKSIZE || msp->ms_map->sm_rt.rt_space == 0);
 	metaslab_group_sort(msp->ms_group, msp, MIN(msp->ms_weight, size));
 	ASSERT((msp->ms_weight & METASLAB_ACTIVE_MASK) == 0);
 }
@@ -985,7 +1170,7 @@ metaslab_should_condense(metaslab_t *msp)
 {
 	space_map_t *sm = msp->ms_map;
 	space_map_obj_t *smo = &msp->ms_smo_syncing;
-	space_seg_t *ss;
+	range_seg_t *rs;
 	uint64_t size, entries, segsz;
 
 	ASSERT(MUTEX_HELD(&msp->ms_lock));
@@ -996,8 +1181,8 @@ metaslab_should_condense(metaslab_t *msp)
 	 * the largest segment in the in-core free map. If the tree is
 	 * empty then we should condense the map.
 	 */
-	ss = avl_last(sm->sm_pp_root);
-	if (ss == NULL)
+	rs = avl_last(sm->sm_pp_root);
+	if (rs == NULL)
 		return (B_TRUE);
 
 	/*
@@ -1006,13 +1191,49 @@ metaslab_should_condense(metaslab_t *msp)
 	 * larger on-disk than the entire current on-disk structure, then
 	 * clearly condensing will increase the on-disk structure size.
 	 */
-	size = (ss->ss_end - ss->ss_start) >> sm->sm_shift;
+	size = (rs->rs_end - rs->rs_start) >> sm->sm_shift;
 	entries = size / (MIN(size, SM_RUN_MAX));
 	segsz = entries * sizeof (uint64_t);
 
 	return (segsz <= smo->smo_objsize &&
 	    smo->smo_objsize >= (zfs_condense_pct *
-	    sizeof (uint64_t) * avl_numnodes(&sm->sm_root)) / 100);
+	    sizeof (uint64_t) * range_tree_numsegs(&sm->sm_rt)) / 100);
+}
+
+/*
+ * Allocate a new space map object for this metaslab and record it in the
+ * vdev's metaslab array.  If the spacemap_histogram feature is enabled
+ * the object's bonus has room for the free segment histogram, and each
+ * such object holds a reference on the feature.
+ */
+static void
+metaslab_smo_alloc(metaslab_t *msp, dmu_tx_t *tx)
+{
+	vdev_t *vd = msp->ms_group->mg_vd;
+	spa_t *spa = vd->vdev_spa;
+	objset_t *mos = spa_meta_objset(spa);
+	space_map_obj_t *smo = &msp->ms_smo_syncing;
+	zfeature_info_t *histogram_feat =
+	    &spa_feature_table[SPA_FEATURE_SPACEMAP_HISTOGRAM];
+	int bonuslen = SPACE_MAP_SIZE_V0;
+
+	ASSERT(smo->smo_objsize == 0);
+	ASSERT(smo->smo_alloc == 0);
+
+	if (spa_feature_is_enabled(spa, histogram_feat)) {
+		bonuslen = sizeof (*smo);
+		spa_feature_incr(spa, histogram_feat, tx);
+	}
+
+	smo->smo_object = dmu_object_alloc(mos,
+	    DMU_OT_SPACE_MAP, 1 << SPACE_MAP_BLOCKSHIFT,
+	    DMU_OT_SPACE_MAP_HEADER, bonuslen, tx);
+	ASSERT(smo->smo_object != 0);
+	smo->smo_flushed_txg = dmu_tx_get_txg(tx);
+	msp->ms_can_log = (bonuslen == sizeof (*smo));
+	dmu_write(mos, vd->vdev_ms_array, sizeof (uint64_t) *
+	    (msp->ms_map->sm_start >> vd->vdev_ms_shift),
+	    sizeof (uint64_t), &smo->smo_object, tx);
 }
 
 /*
@@ -1036,9 +1257,9 @@ metaslab_condense(metaslab_t *msp, uint64_t txg, dmu_tx_t *tx)
 	ASSERT(sm->sm_loaded);
 
 	spa_dbgmsg(spa, "condensing: txg %llu, msp[%llu] %p, "
-	    "smo size %llu, segments %lu", txg,
+	    "smo size %llu, segments %llu", txg,
 	    (msp->ms_map->sm_start / msp->ms_map->sm_size), msp,
-	    smo->smo_objsize, avl_numnodes(&sm->sm_root));
+	    smo->smo_objsize, range_tree_numsegs(&sm->sm_rt));
 
 	/*
 	 * Create an map that is a 100% allocated map. We remove segments
@@ -1080,6 +1301,23 @@ metaslab_condense(metaslab_t *msp, uint64_t txg, dmu_tx_t *tx)
 
 	mutex_exit(&msp->ms_lock);
 	space_map_truncate(smo, mos, tx);
+
+	/*
+	 * The bonus of an object created before the spacemap_histogram
+	 * feature was enabled can't grow in place.  Since we rewrite the
+	 * whole map anyway, move it to a new object that has room for
+	 * the histogram.
+	 */
+	if (spa_feature_is_enabled(spa,
+	    &spa_feature_table[SPA_FEATURE_SPACEMAP_HISTOGRAM])) {
+		dmu_object_info_t doi;
+
+		VERIFY0(dmu_object_info(mos, smo->smo_object, &doi));
+		if (doi.doi_bonus_size < sizeof (*smo)) {
+			VERIFY0(dmu_object_free(mos, smo->smo_object, tx));
+			metaslab_smo_alloc(msp, tx);
+		}
+	}
 	mutex_enter(&msp->ms_lock);
 
 	/*
@@ -1105,6 +1343,172 @@ metaslab_condense(metaslab_t *msp, uint64_t txg, dmu_tx_t *tx)
 	    smo->smo_objsize);
 }
 
+/*
+ * Record that a range was allocated or freed without writing it to the
+ * space map.  A change that undoes an unflushed change of the other kind
+ * cancels it out; the rest is added to the unflushed map of its kind.
+ */
+static void
+metaslab_unflushed_add(metaslab_t *msp, uint8_t maptype, uint64_t start,
+    uint64_t size, uint64_t txg)
+{
+	spa_t *spa = msp->ms_group->mg_vd->vdev_spa;
+	space_map_t *addmap, *cancelmap;
+	uint64_t end = start + size;
+	range_seg_t *rs;
+
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+
+	if (maptype == SM_ALLOC) {
+		addmap = msp->ms_unflushed_allocs;
+		cancelmap = msp->ms_unflushed_frees;
+	} else {
+		addmap = msp->ms_unflushed_frees;
+		cancelmap = msp->ms_unflushed_allocs;
+	}
+
+	while (start < end) {
+		rs = range_tree_find_next(&cancelmap->sm_rt, start);
+		if (rs == NULL || rs->rs_start >= end) {
+			space_map_add(addmap, start, end - start);
+			break;
+		}
+		if (rs->rs_start > start) {
+			space_map_add(addmap, start, rs->rs_start - start);
+			start = rs->rs_start;
+		}
+		size = MIN(rs->rs_end, end) - start;
+		space_map_remove(cancelmap, start, size);
+		start += size;
+	}
+
+	/*
+	 * Even if everything cancelled out, the log holds records for this
+	 * metaslab now, so it must stay around until we flush.
+	 */
+	if (msp->ms_unflushed_txg == 0) {
+		msp->ms_unflushed_txg = txg;
+		spa_log_sm_add_metaslab(spa, msp);
+	}
+}
+
+static void
+metaslab_unflushed_add_map(metaslab_t *msp, space_map_t *sm, uint8_t maptype,
+    uint64_t txg)
+{
+	avl_tree_t *t = &sm->sm_rt.rt_root;
+	range_seg_t *rs;
+
+	for (rs = avl_first(t); rs != NULL; rs = AVL_NEXT(t, rs))
+		metaslab_unflushed_add(msp, maptype, rs->rs_start,
+		    rs->rs_end - rs->rs_start, txg);
+}
+
+/*
+ * Forget the metaslab's unflushed changes, because they have been written
+ * to its space map or because the space map no longer matters.
+ */
+void
+metaslab_unflushed_drop(metaslab_t *msp)
+{
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+
+	space_map_vacate(msp->ms_unflushed_allocs, NULL, NULL);
+	space_map_vacate(msp->ms_unflushed_frees, NULL, NULL);
+
+	if (msp->ms_unflushed_txg != 0) {
+		spa_log_sm_remove_metaslab(msp->ms_group->mg_vd->vdev_spa, msp);
+		msp->ms_unflushed_txg = 0;
+	}
+}
+
+/*
+ * Called for each record of the space map log that belongs to this
+ * metaslab and postdates its last flush, while the pool is being loaded.
+ */
+void
+metaslab_log_replay(metaslab_t *msp, uint8_t maptype, uint64_t start,
+    uint64_t size, uint64_t txg)
+{
+	space_map_t *sm = msp->ms_map;
+	int64_t delta = (maptype == SM_ALLOC) ? size : -size;
+
+	mutex_enter(&msp->ms_lock);
+	metaslab_unflushed_add(msp, maptype, start, size, txg);
+	if (sm->sm_loaded) {
+		if (maptype == SM_ALLOC)
+			space_map_claim(sm, start, size);
+		else
+			space_map_free(sm, start, size);
+	}
+	msp->ms_allocated += delta;
+	mutex_exit(&msp->ms_lock);
+
+	vdev_space_update(msp->ms_group->mg_vd, delta, 0, 0);
+}
+
+static boolean_t
+metaslab_should_log(metaslab_t *msp, uint64_t txg)
+{
+	return (spa_log_sm_active(msp->ms_group->mg_vd->vdev_spa) &&
+	    msp->ms_can_log && msp->ms_smo_syncing.smo_flushed_txg != txg);
+}
+
+static void
+metaslab_sync_bonus(metaslab_t *msp, dmu_tx_t *tx)
+{
+	objset_t *mos = spa_meta_objset(msp->ms_group->mg_vd->vdev_spa);
+	space_map_obj_t *smo = &msp->ms_smo_syncing;
+	dmu_object_info_t doi;
+	dmu_buf_t *db;
+
+	VERIFY0(dmu_bonus_hold(mos, smo->smo_object, FTAG, &db));
+	dmu_buf_will_dirty(db, tx);
+	dmu_object_info_from_db(db, &doi);
+	ASSERT3U(doi.doi_bonus_size, >=, SPACE_MAP_SIZE_V0);
+	bcopy(smo, db->db_data, MIN(doi.doi_bonus_size, sizeof (*smo)));
+	dmu_buf_rele(db, FTAG);
+}
+
+/*
+ * Write the metaslab's unflushed changes to its space map, so that the
+ * space map log no longer needs to hold them.  Called in syncing context
+ * by spa_log_sm_sync().
+ */
+void
+metaslab_flush(metaslab_t *msp, dmu_tx_t *tx)
+{
+	vdev_t *vd = msp->ms_group->mg_vd;
+	objset_t *mos = spa_meta_objset(vd->vdev_spa);
+	space_map_obj_t *smo = &msp->ms_smo_syncing;
+	uint64_t txg = dmu_tx_get_txg(tx);
+
+	ASSERT(msp->ms_unflushed_txg != 0);
+	ASSERT(smo->smo_object != 0);
+
+	mutex_enter(&msp->ms_sync_lock);
+	mutex_enter(&msp->ms_lock);
+
+	space_map_sync(msp->ms_unflushed_allocs, SM_ALLOC, smo, mos, tx);
+	space_map_sync(msp->ms_unflushed_frees, SM_FREE, smo, mos, tx);
+	metaslab_unflushed_drop(msp);
+	smo->smo_flushed_txg = txg;
+
+	if (msp->ms_map->sm_loaded)
+		space_map_histogram_update(msp->ms_map, smo);
+
+	mutex_exit(&msp->ms_lock);
+
+	metaslab_sync_bonus(msp, tx);
+
+	mutex_exit(&msp->ms_sync_lock);
+
+	/*
+	 * Make sure metaslab_sync_done() picks up the new space map.
+	 */
+	vdev_dirty(vd, VDD_METASLAB, msp, txg);
+}
+
 /*
  * Write a metaslab to disk in the context of the specified transaction group.
  */
@@ -1119,7 +1523,8 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 	space_map_t **freed_map = &msp->ms_freemap[TXG_CLEAN(txg) & TXG_MASK];
 	space_map_t *sm = msp->ms_map;
 	space_map_obj_t *smo = &msp->ms_smo_syncing;
-	dmu_buf_t *db;
+	boolean_t logged = B_FALSE;
+	boolean_t freed;
 	dmu_tx_t *tx;
 
 	ASSERT(!vd->vdev_ishole);
@@ -1136,9 +1541,11 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 	ASSERT3P(*freemap, !=, NULL);
 	ASSERT3P(*freed_map, !=, NULL);
 
-	if (allocmap->sm_space == 0 && (*freemap)->sm_space == 0)
+	if (allocmap->sm_rt.rt_space == 0 && (*freemap)->sm_rt.rt_space == 0)
 		return;
 
+	freed = ((*freemap)->sm_rt.rt_space != 0);
+
 	/*
 	 * The only state that can actually be changing concurrently with
 	 * metaslab_sync() is the metaslab's ms_map.  No other thread can
@@ -1150,24 +1557,31 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 
 	tx = dmu_tx_create_assigned(spa_get_dsl(spa), txg);
 
-	if (smo->smo_object == 0) {
-		ASSERT(smo->smo_objsize == 0);
-		ASSERT(smo->smo_alloc == 0);
-		smo->smo_object = dmu_object_alloc(mos,
-		    DMU_OT_SPACE_MAP, 1 << SPACE_MAP_BLOCKSHIFT,
-		    DMU_OT_SPACE_MAP_HEADER, sizeof (*smo), tx);
-		ASSERT(smo->smo_object != 0);
-		dmu_write(mos, vd->vdev_ms_array, sizeof (uint64_t) *
-		    (sm->sm_start >> vd->vdev_ms_shift),
-		    sizeof (uint64_t), &smo->smo_object, tx);
-	}
+	mutex_enter(&msp->ms_sync_lock);
+
+	if (smo->smo_object == 0)
+		metaslab_smo_alloc(msp, tx);
 
 	mutex_enter(&msp->ms_lock);
 
+	msp->ms_sync_txg = txg;
+
 	if (sm->sm_loaded && spa_sync_pass(spa) == 1 &&
 	    metaslab_should_condense(msp)) {
+		/*
+		 * The condensed map is written from the in-core map, which
+		 * already includes the unflushed changes.
+		 */
+		metaslab_unflushed_drop(msp);
 		metaslab_condense(msp, txg, tx);
+		smo->smo_flushed_txg = txg;
+	} else if (metaslab_should_log(msp, txg)) {
+		spa_log_sm_append(spa, msp, allocmap, *freemap, tx);
+		metaslab_unflushed_add_map(msp, allocmap, SM_ALLOC, txg);
+		metaslab_unflushed_add_map(msp, *freemap, SM_FREE, txg);
+		logged = B_TRUE;
 	} else {
+		ASSERT0(msp->ms_unflushed_txg);
 		space_map_sync(allocmap, SM_ALLOC, smo, mos, tx);
 		space_map_sync(*freemap, SM_FREE, smo, mos, tx);
 	}
@@ -1181,23 +1595,40 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 	 * guaranteed to be empty on the initial pass.
 	 */
 	if (spa_sync_pass(spa) == 1) {
-		ASSERT0((*freed_map)->sm_space);
-		ASSERT0(avl_numnodes(&(*freed_map)->sm_root));
+		ASSERT0((*freed_map)->sm_rt.rt_space);
+		ASSERT0(range_tree_numsegs(&(*freed_map)->sm_rt));
 		space_map_swap(freemap, freed_map);
 	} else {
 		space_map_vacate(*freemap, space_map_add, *freed_map);
 	}
 
-	ASSERT0(msp->ms_allocmap[txg & TXG_MASK]->sm_space);
-	ASSERT0(msp->ms_freemap[txg & TXG_MASK]->sm_space);
+	ASSERT0(msp->ms_allocmap[txg & TXG_MASK]->sm_rt.rt_space);
+	ASSERT0(msp->ms_freemap[txg & TXG_MASK]->sm_rt.rt_space);
+
+	/*
+	 * While the map is loaded its in-core segments are exactly the
+	 * metaslab's free space, so refresh the histogram from them.
+	 * Otherwise frees may have grown or merged segments the histogram
+	 * doesn't know about, and metaslab_weight() and
+	 * metaslab_group_alloc() rely on it as an upper bound.  Clear it,
+	 * so the bound falls back to the free space until the map is
+	 * next loaded.
+	 */
+	if (sm->sm_loaded)
+		space_map_histogram_update(sm, smo);
+	else if (freed)
+		bzero(smo->smo_histogram, sizeof (smo->smo_histogram));
 
 	mutex_exit(&msp->ms_lock);
 
-	VERIFY0(dmu_bonus_hold(mos, smo->smo_object, FTAG, &db));
-	dmu_buf_will_dirty(db, tx);
-	ASSERT3U(db->db_size, >=, sizeof (*smo));
-	bcopy(smo, db->db_data, sizeof (*smo));
-	dmu_buf_rele(db, FTAG);
+	/*
+	 * A logged sync leaves the space map untouched; its bonus is
+	 * written when the metaslab is flushed.
+	 */
+	if (!logged)
+		metaslab_sync_bonus(msp, tx);
+
+	mutex_exit(&msp->ms_sync_lock);
 
 	dmu_tx_commit(tx);
 }
@@ -1217,6 +1648,7 @@ metaslab_sync_done(metaslab_t *msp, uint64_t txg)
 	metaslab_group_t *mg = msp->ms_group;
 	vdev_t *vd = mg->mg_vd;
 	int64_t alloc_delta, defer_delta;
+	uint64_t alloc;
 	int t;
 
 	ASSERT(!vd->vdev_ishole);
@@ -1253,13 +1685,21 @@ metaslab_sync_done(metaslab_t *msp, uint64_t txg)
 		vdev_space_update(vd, 0, 0, sm->sm_size);
 	}
 
-	alloc_delta = smosync->smo_alloc - smo->smo_alloc;
-	defer_delta = freed_map->sm_space - defer_map->sm_space;
+	/*
+	 * The allocated space is what the space map says, corrected by the
+	 * changes that only the space map log has so far.
+	 */
+	alloc = smosync->smo_alloc +
+	    msp->ms_unflushed_allocs->sm_rt.rt_space -
+	    msp->ms_unflushed_frees->sm_rt.rt_space;
+	alloc_delta = alloc - msp->ms_allocated;
+	msp->ms_allocated = alloc;
+	defer_delta = freed_map->sm_rt.rt_space - defer_map->sm_rt.rt_space;
 
 	vdev_space_update(vd, alloc_delta + defer_delta, defer_delta, 0);
 
-	ASSERT(msp->ms_allocmap[txg & TXG_MASK]->sm_space == 0);
-	ASSERT(msp->ms_freemap[txg & TXG_MASK]->sm_space == 0);
+	ASSERT(msp->ms_allocmap[txg & TXG_MASK]->sm_rt.rt_space == 0);
+	ASSERT(msp->ms_freemap[txg & TXG_MASK]->sm_rt.rt_space == 0);
 
 	/*
 	 * If there's a space_map_load() in progress, wait for it to complete
@@ -1272,6 +1712,7 @@ metaslab_sync_done(metaslab_t *msp, uint64_t txg)
 	space_map_vacate(freed_map, space_map_add, defer_map);
 
 	*smo = *smosync;
+	msp->ms_sync_txg = 0;
 
 	msp->ms_deferspace += defer_delta;
 	ASSERT3S(msp->ms_deferspace, >=, 0);
@@ -1292,9 +1733,13 @@ metaslab_sync_done(metaslab_t *msp, uint64_t txg)
 	if (sm->sm_loaded && (msp->ms_weight & METASLAB_ACTIVE_MASK) == 0) {
 		int evictable = 1;
 
-		for (t = 1; t < TXG_CONCURRENT_STATES; t++)
-			if (msp->ms_allocmap[(txg + t) & TXG_MASK]->sm_space)
+		for (t = 1; t < TXG_CONCURRENT_STATES; t++) {
+			space_map_t *allocmap =
+			    msp->ms_allocmap[(txg + t) & TXG_MASK];
+
+			if (allocmap->sm_rt.rt_space != 0)
 				evictable = 0;
+		}
 
 		if (evictable && !metaslab_debug)
 			space_map_unload(sm);
@@ -1388,12 +1833,22 @@ metaslab_group_alloc(metaslab_group_t *mg, uint64_t psize, uint64_t asize,
 				mutex_exit(&mg->mg_lock);
 				return (-1ULL);
 			}
+			/*
+			 * The weight is scaled up for locality, so it may
+			 * still admit a metaslab whose largest free segment
+			 * is too small.  Skip those rather than loading them;
+			 * without ms_lock the histogram is only a hint.
+			 */
+			if (!msp->ms_map->sm_loaded &&
+			    metaslab_max_segsize(msp) < asize)
+				continue;
+
 			was_active = msp->ms_weight & METASLAB_ACTIVE_MASK;
 			if (activation_weight == METASLAB_WEIGHT_PRIMARY)
 				break;
 
 			target_distance = min_distance +
-			    (msp->ms_smo.smo_alloc ? 0 : min_distance >> 1);
+			    (msp->ms_allocated ? 0 : min_distance >> 1);
 
 			for (i = 0; i < d; i++)
 				if (metaslab_distance(msp, &dva[i]) <
@@ -1473,7 +1928,7 @@ metaslab_group_alloc(metaslab_group_t *mg, uint64_t psize, uint64_t asize,
 		mutex_exit(&msp->ms_lock);
 	}
 
-	if (msp->ms_allocmap[txg & TXG_MASK]->sm_space == 0)
+	if (msp->ms_allocmap[txg & TXG_MASK]->sm_rt.rt_space == 0)
 		vdev_dirty(mg->mg_vd, VDD_METASLAB, msp, txg);
 
 	space_map_add(msp->ms_allocmap[txg & TXG_MASK], offset, asize);
@@ -1483,6 +1938,35 @@ metaslab_group_alloc(metaslab_group_t *mg, uint64_t psize, uint64_t asize,
 	return (offset);
 }
 
+/*
+ * Can this group take another async write allocation?  It can while it has
+ * fewer than its maximum outstanding, and also when every group in the
+ * class is saturated, since then there is nowhere better to go.
+ */
+static boolean_t
+metaslab_group_allocatable(metaslab_group_t *mg)
+{
+	metaslab_group_t *other;
+
+	if (mg->mg_alloc_queue_depth < metaslab_group_max_queue_depth(mg))
+		return (B_TRUE);
+
+	for (other = mg->mg_next; other != mg; other = other->mg_next) {
+		if (other->mg_alloc_queue_depth <
+		    metaslab_group_max_queue_depth(other) &&
+		    vdev_allocatable(other->mg_vd))
+			return (B_FALSE);
+	}
+	return (B_TRUE);
+}
+
+static void
+metaslab_group_unthrottle(metaslab_group_t *mg)
+{
+	ASSERT3U(mg->mg_alloc_queue_depth, >, 0);
+	atomic_dec_64(&mg->mg_alloc_queue_depth);
+}
+
 /*
  * Allocate a block for the specified i/o.
  */
@@ -1604,6 +2088,17 @@ top:
 			goto next;
 		}
 
+		/*
+		 * Pass over a group whose device is behind on its writes,
+		 * on the first trip around the rotor only.
+		 */
+		if ((flags & METASLAB_ASYNC_ALLOC) && dshift == 3 &&
+		    !metaslab_group_allocatable(mg)) {
+			MGSTAT_BUMP(mg, mgs_throttled);
+			all_zero = B_FALSE;
+			goto next;
+		}
+
 		ASSERT(mg->mg_class == mc);
 
 		distance = vd->vdev_asize >> dshift;
@@ -1660,6 +2155,11 @@ top:
 			DVA_SET_GANG(&dva[d], !!(flags & METASLAB_GANG_HEADER));
 			DVA_SET_ASIZE(&dva[d], asize);
 
+			if (flags & METASLAB_ASYNC_ALLOC) {
+				atomic_inc_64(&mg->mg_alloc_queue_depth);
+				MGSTAT_BUMP(mg, mgs_allocations);
+			}
+
 			if (flags & METASLAB_FASTWRITE) {
 				atomic_add_64(&vd->vdev_pending_fastwrite,
 				    psize);
@@ -1730,7 +2230,7 @@ metaslab_free_dva(spa_t *spa, const dva_t *dva, uint64_t txg, boolean_t now)
 		    offset, size);
 		space_map_free(msp->ms_map, offset, size);
 	} else {
-		if (msp->ms_freemap[txg & TXG_MASK]->sm_space == 0)
+		if (msp->ms_freemap[txg & TXG_MASK]->sm_rt.rt_space == 0)
 			vdev_dirty(vd, VDD_METASLAB, msp, txg);
 		space_map_add(msp->ms_freemap[txg & TXG_MASK], offset, size);
 	}
@@ -1781,7 +2281,7 @@ metaslab_claim_dva(spa_t *spa, const dva_t *dva, uint64_t txg)
 	space_map_claim(msp->ms_map, offset, size);
 
 	if (spa_writeable(spa)) {	/* don't dirty if we're zdb(1M) */
-		if (msp->ms_allocmap[txg & TXG_MASK]->sm_space == 0)
+		if (msp->ms_allocmap[txg & TXG_MASK]->sm_rt.rt_space == 0)
 			vdev_dirty(vd, VDD_METASLAB, msp, txg);
 		space_map_add(msp->ms_allocmap[txg & TXG_MASK], offset, size);
 	}
@@ -1818,6 +2318,10 @@ metaslab_alloc(spa_t *spa, metaslab_class_t *mc, uint64_t psize, blkptr_t *bp,
 		    txg, flags);
 		if (error) {
 			for (d--; d >= 0; d--) {
+				if (flags & METASLAB_ASYNC_ALLOC)
+					metaslab_group_unthrottle(
+					    vdev_lookup_top(spa,
+					    DVA_GET_VDEV(&dva[d]))->vdev_mg);
 				metaslab_free_dva(spa, &dva[d], txg, B_TRUE);
 				bzero(&dva[d], sizeof (dva_t));
 			}
@@ -1928,16 +2432,39 @@ void metaslab_fastwrite_unmark(spa_t *spa, const blkptr_t *bp)
 	spa_config_exit(spa, SCL_VDEV, FTAG);
 }
 
+/*
+ * The writes to this block's DVAs have finished; give their groups back
+ * the allocation throttle slots that metaslab_alloc() took.
+ */
+void
+metaslab_group_alloc_decrement(spa_t *spa, const blkptr_t *bp)
+{
+	const dva_t *dva = bp->blk_dva;
+	int ndvas = BP_GET_NDVAS(bp);
+	int d;
+	vdev_t *vd;
+
+	spa_config_enter(spa, SCL_VDEV, FTAG, RW_READER);
+
+	for (d = 0; d < ndvas; d++) {
+		if ((vd = vdev_lookup_top(spa, DVA_GET_VDEV(&dva[d]))) == NULL)
+			continue;
+		metaslab_group_unthrottle(vd->vdev_mg);
+	}
+
+	spa_config_exit(spa, SCL_VDEV, FTAG);
+}
+
 static void
 checkmap(space_map_t *sm, uint64_t off, uint64_t size)
 {
-	space_seg_t *ss;
+	range_seg_t *rs;
 	avl_index_t where;
 
 	mutex_enter(sm->sm_lock);
-	ss = space_map_find(sm, off, size, &where);
-	if (ss != NULL)
-		panic("freeing free block; ss=%p", (void *)ss);
+	rs = space_map_find(sm, off, size, &where);
+	if (rs != NULL)
+		panic("freeing free block; rs=%p", (void *)rs);
 	mutex_exit(sm->sm_lock);
 }
 
@@ -1971,4 +2498,9 @@ metaslab_check_free(spa_t *spa, const blkptr_t *bp)
 #if defined(_KERNEL) && defined(HAVE_SPL)
 module_param(metaslab_debug, int, 0644);
 MODULE_PARM_DESC(metaslab_debug, "keep space maps in core to verify frees");
+
+module_param(zfs_vdev_queue_depth_pct, int, 0644);
+MODULE_PARM_DESC(zfs_vdev_queue_depth_pct,
+	"Outstanding async write allocations per vdev, in percent of "
+	"zfs_vdev_async_write_max_active");
 #endif /* _KERNEL && HAVE_SPL */
@@ -0,0 +1,255 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/spa.h>
+#include <sys/multilist.h>
+
+static unsigned int
+multilist_sublist_index(multilist_t *ml, void *obj)
+{
+	unsigned int idx = ml->ml_index_func(ml, obj);
+
+	ASSERT3U(idx, <, ml->ml_num_sublists);
+	return (idx);
+}
+
+/*
+ * Create a multilist of num sublists, holding objects of the given size
+ * linked through the multilist_node_t at offset.
+ */
+void
+multilist_create(multilist_t *ml, size_t size, size_t offset,
+    unsigned int num, multilist_sublist_index_func_t *index_func)
+{
+	int i;
+
+	ASSERT3U(size, >, 0);
+	ASSERT3U(size, >=, offset + sizeof (multilist_node_t));
+	ASSERT3U(num, >, 0);
+	ASSERT3P(index_func, !=, NULL);
+
+	ml->ml_offset = offset;
+	ml->ml_num_sublists = num;
+	ml->ml_index_func = index_func;
+	ml->ml_sublists = vmem_zalloc(sizeof (multilist_sublist_t) * num,
+	    KM_SLEEP);
+
+	for (i = 0; i < num; i++) {
+		multilist_sublist_t *mls = &ml->ml_sublists[i];
+
+		mutex_init(&mls->mls_lock, NULL, MUTEX_DEFAULT, NULL);
+		list_create(&mls->mls_list, size, offset);
+	}
+}
+
+void
+multilist_destroy(multilist_t *ml)
+{
+	int i;
+
+	ASSERT(multilist_is_empty(ml));
+
+	for (i = 0; i < ml->ml_num_sublists; i++) {
+		multilist_sublist_t *mls = &ml->ml_sublists[i];
+
+		list_destroy(&mls->mls_list);
+		mutex_destroy(&mls->mls_lock);
+	}
+
+	vmem_free(ml->ml_sublists,
+	    sizeof (multilist_sublist_t) * ml->ml_num_sublists);
+	ml->ml_sublists = NULL;
+	ml->ml_num_sublists = 0;
+	ml->ml_offset = 0;
+}
+
+/*
+ * Insert obj at the head of its sublist.  The sublist lock is taken unless
+ * the caller holds it already.
+ */
+void
+multilist_insert(multilist_t *ml, void *obj)
+{
+	multilist_sublist_t *mls;
+	boolean_t need_lock;
+
+	mls = &ml->ml_sublists[multilist_sublist_index(ml, obj)];
+
+	need_lock = !MUTEX_HELD(&mls->mls_lock);
+	if (need_lock)
+		mutex_enter(&mls->mls_lock);
+
+	ASSERT(!multilist_link_active((multilist_node_t *)
+	    ((char *)obj + ml->ml_offset)));
+	list_insert_head(&mls->mls_list, obj);
+
+	if (need_lock)
+		mutex_exit(&mls->mls_lock);
+}
+
+/*
+ * Remove obj from its sublist.  The sublist lock is taken unless the caller
+ * holds it already.
+ */
+void
+multilist_remove(multilist_t *ml, void *obj)
+{
+	multilist_sublist_t *mls;
+	boolean_t need_lock;
+
+	mls = &ml->ml_sublists[multilist_sublist_index(ml, obj)];
+
+	need_lock = !MUTEX_HELD(&mls->mls_lock);
+	if (need_lock)
+		mutex_enter(&mls->mls_lock);
+
+	ASSERT(multilist_link_active((multilist_node_t *)
+	    ((char *)obj + ml->ml_offset)));
+	list_remove(&mls->mls_list, obj);
+
+	if (need_lock)
+		mutex_exit(&mls->mls_lock);
+}
+
+/*
+ * Only a hint unless all sublist locks are held, since other threads may
+ * insert into any sublist right after it was found empty.
+ */
+boolean_t
+multilist_is_empty(multilist_t *ml)
+{
+	int i;
+
+	for (i = 0; i < ml->ml_num_sublists; i++) {
+		multilist_sublist_t *mls = &ml->ml_sublists[i];
+		boolean_t need_lock = !MUTEX_HELD(&mls->mls_lock);
+		boolean_t empty;
+
+		if (need_lock)
+			mutex_enter(&mls->mls_lock);
+		empty = list_is_empty(&mls->mls_list);
+		if (need_lock)
+			mutex_exit(&mls->mls_lock);
+
+		if (!empty)
+			return (B_FALSE);
+	}
+
+	return (B_TRUE);
+}
+
+unsigned int
+multilist_get_num_sublists(multilist_t *ml)
+{
+	return (ml->ml_num_sublists);
+}
+
+unsigned int
+multilist_get_random_index(multilist_t *ml)
+{
+	return (spa_get_random(ml->ml_num_sublists));
+}
+
+multilist_sublist_t *
+multilist_sublist_lock(multilist_t *ml, unsigned int idx)
+{
+	multilist_sublist_t *mls;
+
+	ASSERT3U(idx, <, ml->ml_num_sublists);
+	mls = &ml->ml_sublists[idx];
+	mutex_enter(&mls->mls_lock);
+
+	return (mls);
+}
+
+void
+multilist_sublist_unlock(multilist_sublist_t *mls)
+{
+	mutex_exit(&mls->mls_lock);
+}
+
+void
+multilist_sublist_insert_head(multilist_sublist_t *mls, void *obj)
+{
+	ASSERT(MUTEX_HELD(&mls->mls_lock));
+	list_insert_head(&mls->mls_list, obj);
+}
+
+/*
+ * Insert obj after prev, which is already on the sublist.  Unlike
+ * multilist_insert() this does not consult the index function, so it can
+ * be used for markers which are not real objects.
+ */
+void
+multilist_sublist_insert_after(multilist_sublist_t *mls, void *prev,
+    void *obj)
+{
+	ASSERT(MUTEX_HELD(&mls->mls_lock));
+	list_insert_after(&mls->mls_list, prev, obj);
+}
+
+void
+multilist_sublist_remove(multilist_sublist_t *mls, void *obj)
+{
+	ASSERT(MUTEX_HELD(&mls->mls_lock));
+	list_remove(&mls->mls_list, obj);
+}
+
+void *
+multilist_sublist_head(multilist_sublist_t *mls)
+{
+	ASSERT(MUTEX_HELD(&mls->mls_lock));
+	return (list_head(&mls->mls_list));
+}
+
+void *
+multilist_sublist_tail(multilist_sublist_t *mls)
+{
+	ASSERT(MUTEX_HELD(&mls->mls_lock));
+	return (list_tail(&mls->mls_list));
+}
+
+void *
+multilist_sublist_next(multilist_sublist_t *mls, void *obj)
+{
+	ASSERT(MUTEX_HELD(&mls->mls_lock));
+	return (list_next(&mls->mls_list, obj));
+}
+
+void *
+multilist_sublist_prev(multilist_sublist_t *mls, void *obj)
+{
+	ASSERT(MUTEX_HELD(&mls->mls_lock));
+	return (list_prev(&mls->mls_list, obj));
+}
+
+void
+multilist_link_init(multilist_node_t *link)
+{
+	list_link_init(link);
+}
+
+int
+multilist_link_active(multilist_node_t *link)
+{
+	return (list_link_active(link));
+}
@@ -0,0 +1,338 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/spa.h>
+#include <sys/range_tree.h>
+
+static kmem_cache_t *range_seg_cache;
+
+void
+range_tree_init(void)
+{
+	ASSERT(range_seg_cache == NULL);
+	range_seg_cache = kmem_cache_create("range_seg_cache",
+	    sizeof (range_seg_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
+}
+
+void
+range_tree_fini(void)
+{
+	kmem_cache_destroy(range_seg_cache);
+	range_seg_cache = NULL;
+}
+
+/*
+ * Range tree routines.
+ * NOTE: caller is responsible for all locking.
+ */
+static int
+range_tree_seg_compare(const void *x1, const void *x2)
+{
+	const range_seg_t *r1 = x1;
+	const range_seg_t *r2 = x2;
+
+	if (r1->rs_start < r2->rs_start) {
+		if (r1->rs_end > r2->rs_start)
+			return (0);
+		return (-1);
+	}
+	if (r1->rs_start > r2->rs_start) {
+		if (r1->rs_start < r2->rs_end)
+			return (0);
+		return (1);
+	}
+	return (0);
+}
+
+/*
+ * Every segment enters the histogram through range_tree_seg_added() and
+ * leaves it through range_tree_seg_removed(); a segment that changes size
+ * is removed and added back around the change.  The same two points are
+ * where the consumer's rt_ops are told about it.
+ */
+static void
+range_tree_seg_added(range_tree_t *rt, range_seg_t *rs)
+{
+	int idx = highbit(rs->rs_end - rs->rs_start) - 1;
+
+	ASSERT3S(idx, >=, 0);
+	ASSERT3S(idx, <, RANGE_TREE_HISTOGRAM_SIZE);
+	rt->rt_histogram[idx]++;
+
+	if (rt->rt_ops != NULL)
+		rt->rt_ops->rtop_add(rt, rs, rt->rt_arg);
+}
+
+static void
+range_tree_seg_removed(range_tree_t *rt, range_seg_t *rs)
+{
+	int idx = highbit(rs->rs_end - rs->rs_start) - 1;
+
+	ASSERT3S(idx, >=, 0);
+	ASSERT3S(idx, <, RANGE_TREE_HISTOGRAM_SIZE);
+	ASSERT3U(rt->rt_histogram[idx], !=, 0);
+	rt->rt_histogram[idx]--;
+
+	if (rt->rt_ops != NULL)
+		rt->rt_ops->rtop_remove(rt, rs, rt->rt_arg);
+}
+
+void
+range_tree_create(range_tree_t *rt, range_tree_ops_t *ops, void *arg,
+    kmutex_t *lp)
+{
+	bzero(rt, sizeof (*rt));
+
+	avl_create(&rt->rt_root, range_tree_seg_compare,
+	    sizeof (range_seg_t), offsetof(range_seg_t, rs_node));
+
+	rt->rt_ops = ops;
+	rt->rt_arg = arg;
+	rt->rt_lock = lp;
+}
+
+void
+range_tree_destroy(range_tree_t *rt)
+{
+	VERIFY0(rt->rt_space);
+	avl_destroy(&rt->rt_root);
+}
+
+/*
+ * Install (or, with ops == NULL, remove) the callbacks of a tree that may
+ * already hold segments.  The consumer indexes the existing segments
+ * itself before installing its ops, and tears its index down after
+ * removing them.
+ */
+void
+range_tree_set_ops(range_tree_t *rt, range_tree_ops_t *ops, void *arg)
+{
+	ASSERT(MUTEX_HELD(rt->rt_lock));
+
+	rt->rt_ops = ops;
+	rt->rt_arg = arg;
+}
+
+void
+range_tree_add(range_tree_t *rt, uint64_t start, uint64_t size)
+{
+	avl_index_t where;
+	range_seg_t rsearch, *rs_before, *rs_after, *rs;
+	uint64_t end = start + size;
+	boolean_t merge_before, merge_after;
+
+	ASSERT(MUTEX_HELD(rt->rt_lock));
+	VERIFY(size != 0);
+
+	rsearch.rs_start = start;
+	rsearch.rs_end = end;
+	rs = avl_find(&rt->rt_root, &rsearch, &where);
+
+	if (rs != NULL && rs->rs_start <= start && rs->rs_end >= end) {
+		zfs_panic_recover("zfs: allocating allocated segment"
+		    "(offset=%llu size=%llu)\n",
+		    (longlong_t)start, (longlong_t)size);
+		return;
+	}
+
+	/* Make sure we don't overlap with either of our neighbors */
+	VERIFY(rs == NULL);
+
+	rs_before = avl_nearest(&rt->rt_root, where, AVL_BEFORE);
+	rs_after = avl_nearest(&rt->rt_root, where, AVL_AFTER);
+
+	merge_before = (rs_before != NULL && rs_before->rs_end == start);
+	merge_after = (rs_after != NULL && rs_after->rs_start == end);
+
+	if (merge_before && merge_after) {
+		range_tree_seg_removed(rt, rs_before);
+		range_tree_seg_removed(rt, rs_after);
+		avl_remove(&rt->rt_root, rs_before);
+		rs_after->rs_start = rs_before->rs_start;
+		kmem_cache_free(range_seg_cache, rs_before);
+		rs = rs_after;
+	} else if (merge_before) {
+		range_tree_seg_removed(rt, rs_before);
+		rs_before->rs_end = end;
+		rs = rs_before;
+	} else if (merge_after) {
+		range_tree_seg_removed(rt, rs_after);
+		rs_after->rs_start = start;
+		rs = rs_after;
+	} else {
+		rs = kmem_cache_alloc(range_seg_cache, KM_PUSHPAGE);
+		rs->rs_start = start;
+		rs->rs_end = end;
+		avl_insert(&rt->rt_root, rs, where);
+	}
+
+	range_tree_seg_added(rt, rs);
+
+	rt->rt_space += size;
+}
+
+void
+range_tree_remove(range_tree_t *rt, uint64_t start, uint64_t size)
+{
+	avl_index_t where;
+	range_seg_t *rs, *newseg;
+	uint64_t end = start + size;
+	boolean_t left_over, right_over;
+
+	ASSERT(MUTEX_HELD(rt->rt_lock));
+	VERIFY(size != 0);
+
+	rs = range_tree_find(rt, start, size, &where);
+
+	/* Make sure we completely overlap with someone */
+	if (rs == NULL) {
+		zfs_panic_recover("zfs: freeing free segment "
+		    "(offset=%llu size=%llu)",
+		    (longlong_t)start, (longlong_t)size);
+		return;
+	}
+	VERIFY3U(rs->rs_start, <=, start);
+	VERIFY3U(rs->rs_end, >=, end);
+	VERIFY3U(rt->rt_space, >=, size);
+
+	left_over = (rs->rs_start != start);
+	right_over = (rs->rs_end != end);
+
+	range_tree_seg_removed(rt, rs);
+
+	if (left_over && right_over) {
+		newseg = kmem_cache_alloc(range_seg_cache, KM_PUSHPAGE);
+		newseg->rs_start = end;
+		newseg->rs_end = rs->rs_end;
+		rs->rs_end = start;
+		avl_insert_here(&rt->rt_root, newseg, rs, AVL_AFTER);
+		range_tree_seg_added(rt, newseg);
+	} else if (left_over) {
+		rs->rs_end = start;
+	} else if (right_over) {
+		rs->rs_start = end;
+	} else {
+		avl_remove(&rt->rt_root, rs);
+		kmem_cache_free(range_seg_cache, rs);
+		rs = NULL;
+	}
+
+	if (rs != NULL)
+		range_tree_seg_added(rt, rs);
+
+	rt->rt_space -= size;
+}
+
+range_seg_t *
+range_tree_find(range_tree_t *rt, uint64_t start, uint64_t size,
+    avl_index_t *wherep)
+{
+	range_seg_t rsearch, *rs;
+
+	ASSERT(MUTEX_HELD(rt->rt_lock));
+	VERIFY(size != 0);
+
+	rsearch.rs_start = start;
+	rsearch.rs_end = start + size;
+	rs = avl_find(&rt->rt_root, &rsearch, wherep);
+
+	if (rs != NULL && rs->rs_start <= start && rs->rs_end >= start + size)
+		return (rs);
+	return (NULL);
+}
+
+/*
+ * Return the segment that contains offset, or else the first segment
+ * after it, or NULL if there is none.
+ */
+range_seg_t *
+range_tree_find_next(range_tree_t *rt, uint64_t offset)
+{
+	range_seg_t rsearch, *rs;
+	avl_index_t where;
+
+	ASSERT(MUTEX_HELD(rt->rt_lock));
+
+	rsearch.rs_start = offset;
+	rsearch.rs_end = offset + 1;
+	rs = avl_find(&rt->rt_root, &rsearch, &where);
+	if (rs == NULL)
+		rs = avl_nearest(&rt->rt_root, where, AVL_AFTER);
+	return (rs);
+}
+
+boolean_t
+range_tree_contains(range_tree_t *rt, uint64_t start, uint64_t size)
+{
+	avl_index_t where;
+
+	return (range_tree_find(rt, start, size, &where) != NULL);
+}
+
+void
+range_tree_vacate(range_tree_t *rt)
+{
+	range_seg_t *rs;
+	void *cookie = NULL;
+
+	ASSERT(MUTEX_HELD(rt->rt_lock));
+
+	if (rt->rt_ops != NULL)
+		rt->rt_ops->rtop_vacate(rt, rt->rt_arg);
+
+	while ((rs = avl_destroy_nodes(&rt->rt_root, &cookie)) != NULL)
+		kmem_cache_free(range_seg_cache, rs);
+
+	bzero(rt->rt_histogram, sizeof (rt->rt_histogram));
+	rt->rt_space = 0;
+}
+
+uint64_t
+range_tree_space(range_tree_t *rt)
+{
+	return (rt->rt_space);
+}
+
+uint64_t
+range_tree_numsegs(range_tree_t *rt)
+{
+	return (avl_numnodes(&rt->rt_root));
+}
+
+/*
+ * Return an upper bound on the size of the largest segment in the tree,
+ * from the histogram alone.
+ */
+uint64_t
+range_tree_max_segsize(range_tree_t *rt)
+{
+	int i;
+
+	for (i = RANGE_TREE_HISTOGRAM_SIZE - 1; i >= 0; i--) {
+		if (rt->rt_histogram[i] == 0)
+			continue;
+		if (i == RANGE_TREE_HISTOGRAM_SIZE - 1)
+			return (rt->rt_space);
+		return (MIN(rt->rt_space, (1ULL << (i + 1)) - 1));
+	}
+	return (0);
+}
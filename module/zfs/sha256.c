@@ -26,13 +26,14 @@
 #include <sys/zfs_context.h>
 #include <sys/zio.h>
 #include <sys/zio_checksum.h>
+#include <sys/sha2.h>
 
 /*
  * SHA-256 checksum, as specified in FIPS 180-3, available at:
  * http://csrc.nist.gov/publications/PubsFIPS.html
  *
- * This is a very compact implementation of SHA-256.
- * It is designed to be simple and portable, not to be fast.
+ * The generic engine below is a compact C implementation.  Faster engines
+ * for particular CPUs live in sha256_*.c; see <sys/sha2.h>.
  */
 
 /*
@@ -51,7 +52,7 @@
 #define	sigma0(x)	(Rot32(x, 7) ^ Rot32(x, 18) ^ ((x) >> 3))
 #define	sigma1(x)	(Rot32(x, 17) ^ Rot32(x, 19) ^ ((x) >> 10))
 
-static const uint32_t SHA256_K[64] = {
+const uint32_t sha256_k[64] = {
 	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
 	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
 	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
@@ -86,7 +87,7 @@ SHA256Transform(uint32_t *H, const uint8_t *cp)
 	e = H[4]; f = H[5]; g = H[6]; h = H[7];
 
 	for (t = 0; t < 64; t++) {
-		T1 = h + SIGMA1(e) + Ch(e, f, g) + SHA256_K[t] + W[t];
+		T1 = h + SIGMA1(e) + Ch(e, f, g) + sha256_k[t] + W[t];
 		T2 = SIGMA0(a) + Maj(a, b, c);
 		h = g; g = f; f = e; e = d + T1;
 		d = c; c = b; b = a; a = T1 + T2;
@@ -96,17 +97,69 @@ SHA256Transform(uint32_t *H, const uint8_t *cp)
 	H[4] += e; H[5] += f; H[6] += g; H[7] += h;
 }
 
-void
-zio_checksum_SHA256(const void *buf, uint64_t size, zio_cksum_t *zcp)
+static void
+sha256_generic_transform(uint32_t *H, const void *buf, uint64_t nblocks)
+{
+	const uint8_t *cp = buf;
+
+	while (nblocks-- > 0) {
+		SHA256Transform(H, cp);
+		cp += SHA256_BLOCKSIZE;
+	}
+}
+
+static boolean_t
+sha256_generic_valid(void)
+{
+	return (B_TRUE);
+}
+
+const sha256_ops_t sha256_generic_ops = {
+	.sha_transform = sha256_generic_transform,
+	.sha_valid = sha256_generic_valid,
+	.sha_name = "generic"
+};
+
+static const sha256_ops_t *sha256_impls[] = {
+	&sha256_generic_ops,
+#if defined(__x86_64) || defined(__x86_64__)
+	&sha256_avx2_ops,
+	&sha256_shani_ops,
+#endif
+};
+
+#define	SHA256_IMPL_COUNT	\
+	(sizeof (sha256_impls) / sizeof (sha256_impls[0]))
+
+/*
+ * Engines which are supported by this CPU and passed the self-test in
+ * sha256_init(), and the one currently in use.  Until sha256_init() runs
+ * everything goes through the generic engine.
+ */
+static boolean_t sha256_supported[SHA256_IMPL_COUNT];
+static const sha256_ops_t *sha256_fastest = &sha256_generic_ops;
+static const sha256_ops_t *sha256_selected = &sha256_generic_ops;
+
+/*
+ * Name of the SHA-256 engine to use, or "fastest" to use the one which won
+ * the benchmark at load time.
+ */
+char zfs_sha256_impl[16] = "fastest";
+
+static void
+sha256_impl(const sha256_ops_t *ops, const void *buf, uint64_t size,
+    zio_cksum_t *zcp)
 {
 	uint32_t H[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
 	    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+	uint64_t nblocks = size / SHA256_BLOCKSIZE;
 	uint8_t pad[128];
 	int i, padsize;
 
-	for (i = 0; i < (size & ~63ULL); i += 64)
-		SHA256Transform(H, (uint8_t *)buf + i);
+	if (nblocks > 0)
+		ops->sha_transform(H, buf, nblocks);
 
+	i = nblocks * SHA256_BLOCKSIZE;
 	for (padsize = 0; i < size; i++)
 		pad[padsize++] = *((uint8_t *)buf + i);
 
@@ -116,8 +169,7 @@ zio_checksum_SHA256(const void *buf, uint64_t size, zio_cksum_t *zcp)
 	for (i = 56; i >= 0; i -= 8)
 		pad[padsize++] = (size << 3) >> i;
 
-	for (i = 0; i < padsize; i += 64)
-		SHA256Transform(H, pad + i);
+	ops->sha_transform(H, pad, padsize / SHA256_BLOCKSIZE);
 
 	ZIO_SET_CHECKSUM(zcp,
 	    (uint64_t)H[0] << 32 | H[1],
@@ -125,3 +177,200 @@ zio_checksum_SHA256(const void *buf, uint64_t size, zio_cksum_t *zcp)
 	    (uint64_t)H[4] << 32 | H[5],
 	    (uint64_t)H[6] << 32 | H[7]);
 }
+
+void
+zio_checksum_SHA256(const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+	sha256_impl(sha256_selected, buf, size, zcp);
+}
+
+/*
+ * Select the engine named by 'name', or the benchmark winner for
+ * "fastest".  Returns EINVAL for unknown names and ENOTSUP for engines
+ * this CPU cannot run.
+ */
+int
+sha256_impl_set(const char *name)
+{
+	int i;
+
+	if (strcmp(name, "fastest") == 0) {
+		sha256_selected = sha256_fastest;
+		(void) strlcpy(zfs_sha256_impl, name,
+		    sizeof (zfs_sha256_impl));
+		return (0);
+	}
+
+	for (i = 0; i < SHA256_IMPL_COUNT; i++) {
+		if (strcmp(name, sha256_impls[i]->sha_name) != 0)
+			continue;
+		if (!sha256_supported[i])
+			return (ENOTSUP);
+		sha256_selected = sha256_impls[i];
+		(void) strlcpy(zfs_sha256_impl, name,
+		    sizeof (zfs_sha256_impl));
+		return (0);
+	}
+
+	return (EINVAL);
+}
+
+/*
+ * Benchmark results, in MB/s, for every engine.  Unsupported engines
+ * report zero.
+ */
+typedef struct sha256_stats {
+	kstat_named_t shastat_fastest;
+	kstat_named_t shastat_bench[SHA256_IMPL_COUNT];
+} sha256_stats_t;
+
+static sha256_stats_t sha256_stats;
+static kstat_t *sha256_ksp;
+
+#define	SHA256_BENCH_SIZE	(128 * 1024)
+#define	SHA256_BENCH_NS		(NANOSEC / MILLISEC)	/* per engine */
+
+static uint64_t
+sha256_bench_one(const sha256_ops_t *ops, const void *buf)
+{
+	zio_cksum_t zc;
+	hrtime_t start, delta;
+	uint64_t bytes = 0;
+
+	start = gethrtime();
+	do {
+		sha256_impl(ops, buf, SHA256_BENCH_SIZE, &zc);
+		bytes += SHA256_BENCH_SIZE;
+		delta = gethrtime() - start;
+	} while (delta < SHA256_BENCH_NS);
+
+	/* bytes per nanosecond * 1000 == MB/s */
+	return ((bytes * MILLISEC) / MAX(delta, 1));
+}
+
+/*
+ * The self-test hashes every length from 0 to three blocks, so that each
+ * engine sees both one and several blocks per call, odd block counts, and
+ * every padding case.
+ */
+#define	SHA256_TEST_SIZE	(3 * SHA256_BLOCKSIZE)
+
+static boolean_t
+sha256_selftest(const sha256_ops_t *ops, const uint8_t *buf)
+{
+	zio_cksum_t ref, zc;
+	int len;
+
+	for (len = 0; len <= SHA256_TEST_SIZE; len++) {
+		sha256_impl(&sha256_generic_ops, buf, len, &ref);
+		sha256_impl(ops, buf, len, &zc);
+		if (!ZIO_CHECKSUM_EQUAL(zc, ref))
+			return (B_FALSE);
+	}
+
+	sha256_impl(&sha256_generic_ops, buf, SHA256_BENCH_SIZE, &ref);
+	sha256_impl(ops, buf, SHA256_BENCH_SIZE, &zc);
+
+	return (ZIO_CHECKSUM_EQUAL(zc, ref));
+}
+
+void
+sha256_init(void)
+{
+	uint64_t *buf, best = 0;
+	int i;
+
+	buf = kmem_alloc(SHA256_BENCH_SIZE, KM_SLEEP);
+	for (i = 0; i < SHA256_BENCH_SIZE / sizeof (uint64_t); i++)
+		buf[i] = (i + 1) * 0x9e3779b97f4a7c15ULL;
+
+	(void) strlcpy(sha256_stats.shastat_fastest.name, "fastest",
+	    KSTAT_STRLEN);
+	sha256_stats.shastat_fastest.data_type = KSTAT_DATA_CHAR;
+
+	for (i = 0; i < SHA256_IMPL_COUNT; i++) {
+		const sha256_ops_t *ops = sha256_impls[i];
+		kstat_named_t *knp = &sha256_stats.shastat_bench[i];
+		uint64_t speed = 0;
+
+		sha256_supported[i] = ops->sha_valid();
+
+		/*
+		 * Never pick an engine which disagrees with the generic one;
+		 * a mismatch here would mean every block it checksums fails
+		 * verification.
+		 */
+		if (sha256_supported[i] &&
+		    !sha256_selftest(ops, (uint8_t *)buf)) {
+			cmn_err(CE_WARN, "sha256 %s implementation failed "
+			    "self-test, disabling", ops->sha_name);
+			sha256_supported[i] = B_FALSE;
+		}
+
+		if (sha256_supported[i]) {
+			speed = sha256_bench_one(ops, buf);
+			if (speed > best) {
+				best = speed;
+				sha256_fastest = ops;
+			}
+		}
+
+		(void) strlcpy(knp->name, ops->sha_name, KSTAT_STRLEN);
+		knp->data_type = KSTAT_DATA_UINT64;
+		knp->value.ui64 = speed;
+	}
+
+	kmem_free(buf, SHA256_BENCH_SIZE);
+
+	(void) strlcpy(sha256_stats.shastat_fastest.value.c,
+	    sha256_fastest->sha_name,
+	    sizeof (sha256_stats.shastat_fastest.value.c));
+
+	if (sha256_impl_set(zfs_sha256_impl) != 0)
+		(void) sha256_impl_set("fastest");
+
+	sha256_ksp = kstat_create("zfs", 0, "sha256_bench", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (sha256_stats) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+
+	if (sha256_ksp != NULL) {
+		sha256_ksp->ks_data = &sha256_stats;
+		kstat_install(sha256_ksp);
+	}
+}
+
+void
+sha256_fini(void)
+{
+	if (sha256_ksp != NULL) {
+		kstat_delete(sha256_ksp);
+		sha256_ksp = NULL;
+	}
+}
+
+#if defined(_KERNEL) && defined(HAVE_SPL)
+static int
+sha256_param_set(const char *val, struct kernel_param *kp)
+{
+	char name[sizeof (zfs_sha256_impl)];
+	size_t len;
+
+	(void) strlcpy(name, val, sizeof (name));
+	len = strlen(name);
+	while (len > 0 && name[len - 1] == '\n')
+		name[--len] = '\0';
+
+	return (-sha256_impl_set(name));
+}
+
+static int
+sha256_param_get(char *buffer, struct kernel_param *kp)
+{
+	return (snprintf(buffer, PAGE_SIZE, "%s [%s]\n",
+	    zfs_sha256_impl, sha256_selected->sha_name));
+}
+
+module_param_call(zfs_sha256_impl, sha256_param_set, sha256_param_get,
+    NULL, 0644);
+MODULE_PARM_DESC(zfs_sha256_impl, "Select SHA-256 implementation");
+#endif
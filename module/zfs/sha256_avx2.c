@@ -0,0 +1,209 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * AVX2 SHA-256 engine.  The message schedule of two consecutive blocks is
+ * expanded at once, one block in each 128-bit half of the ymm registers,
+ * four words per step; the round constants are added on the way out.  The
+ * rounds themselves are inherently serial and stay in scalar code.
+ *
+ * ymm0-ymm3 hold the last sixteen schedule words, ymm4-ymm9 are scratch
+ * and ymm10 holds the byteswap mask.
+ */
+
+#if defined(__x86_64) || defined(__x86_64__)
+
+#include <sys/zfs_context.h>
+#include <sys/simd_x86.h>
+#include <sys/sha2.h>
+
+#define	Ch(x, y, z)	((z) ^ ((x) & ((y) ^ (z))))
+#define	Maj(x, y, z)	(((x) & (y)) ^ ((z) & ((x) ^ (y))))
+#define	Rot32(x, s)	(((x) >> s) | ((x) << (32 - s)))
+#define	SIGMA0(x)	(Rot32(x, 2) ^ Rot32(x, 13) ^ Rot32(x, 22))
+#define	SIGMA1(x)	(Rot32(x, 6) ^ Rot32(x, 11) ^ Rot32(x, 25))
+
+/*
+ * One round, with the variables renamed by the caller instead of shifted.
+ */
+#define	SHA256_ROUND(a, b, c, d, e, f, g, h, wk) {			\
+	uint32_t T1 = h + SIGMA1(e) + Ch(e, f, g) + (wk);		\
+	d += T1;							\
+	h = T1 + SIGMA0(a) + Maj(a, b, c);				\
+}
+
+static void
+sha256_avx2_rounds(uint32_t *H, const uint32_t *wk)
+{
+	uint32_t a = H[0], b = H[1], c = H[2], d = H[3];
+	uint32_t e = H[4], f = H[5], g = H[6], h = H[7];
+	int t;
+
+	for (t = 0; t < 64; t += 8) {
+		SHA256_ROUND(a, b, c, d, e, f, g, h, wk[t + 0]);
+		SHA256_ROUND(h, a, b, c, d, e, f, g, wk[t + 1]);
+		SHA256_ROUND(g, h, a, b, c, d, e, f, wk[t + 2]);
+		SHA256_ROUND(f, g, h, a, b, c, d, e, wk[t + 3]);
+		SHA256_ROUND(e, f, g, h, a, b, c, d, wk[t + 4]);
+		SHA256_ROUND(d, e, f, g, h, a, b, c, wk[t + 5]);
+		SHA256_ROUND(c, d, e, f, g, h, a, b, wk[t + 6]);
+		SHA256_ROUND(b, c, d, e, f, g, h, a, wk[t + 7]);
+	}
+
+	H[0] += a; H[1] += b; H[2] += c; H[3] += d;
+	H[4] += e; H[5] += f; H[6] += g; H[7] += h;
+}
+
+static const uint8_t sha256_avx2_bswap_mask[32]
+    __attribute__((aligned(32))) = {
+	3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+	3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12
+};
+
+/* Load four big-endian words of each block into both halves of reg. */
+#define	SHA256_AVX2_LOAD(off, reg)					\
+	"vmovdqu	" #off "(%[p0]), %%xmm" #reg "\n"		\
+	"vinserti128	$1, " #off "(%[p1]), %%ymm" #reg ", %%ymm" #reg "\n" \
+	"vpshufb	%%ymm10, %%ymm" #reg ", %%ymm" #reg "\n"
+
+/* Add the round constants to reg and store each half to its block. */
+#define	SHA256_AVX2_STORE(off, reg)					\
+	"vbroadcasti128	" #off "(%[k]), %%ymm4\n"			\
+	"vpaddd		%%ymm" #reg ", %%ymm4, %%ymm4\n"		\
+	"vmovdqu	%%xmm4, " #off "(%[wk0])\n"			\
+	"vextracti128	$1, %%ymm4, " #off "(%[wk1])\n"
+
+/* dst = sigma1(src) = ror(src, 17) ^ ror(src, 19) ^ (src >> 10) */
+#define	SHA256_AVX2_SIGMA1(src, dst)					\
+	"vpsrld		$17, %%ymm" #src ", %%ymm" #dst "\n"		\
+	"vpslld		$15, %%ymm" #src ", %%ymm7\n"			\
+	"vpxor		%%ymm7, %%ymm" #dst ", %%ymm" #dst "\n"		\
+	"vpsrld		$19, %%ymm" #src ", %%ymm7\n"			\
+	"vpxor		%%ymm7, %%ymm" #dst ", %%ymm" #dst "\n"		\
+	"vpslld		$13, %%ymm" #src ", %%ymm7\n"			\
+	"vpxor		%%ymm7, %%ymm" #dst ", %%ymm" #dst "\n"		\
+	"vpsrld		$10, %%ymm" #src ", %%ymm7\n"			\
+	"vpxor		%%ymm7, %%ymm" #dst ", %%ymm" #dst "\n"
+
+/*
+ * Expand the schedule of the blocks at p0 and p1 into wk0 and wk1, as
+ * W[t] + K[t] for t = 0..63.
+ */
+static void
+sha256_avx2_schedule(const uint8_t *p0, const uint8_t *p1, uint32_t *wk0,
+    uint32_t *wk1)
+{
+	const uint32_t *k = sha256_k;
+	uint64_t n = 12;
+
+	__asm__ __volatile__(
+	    "vmovdqa	(%[mask]), %%ymm10\n"
+	    SHA256_AVX2_LOAD(0, 0)
+	    SHA256_AVX2_LOAD(16, 1)
+	    SHA256_AVX2_LOAD(32, 2)
+	    SHA256_AVX2_LOAD(48, 3)
+	    SHA256_AVX2_STORE(0, 0)
+	    SHA256_AVX2_STORE(16, 1)
+	    SHA256_AVX2_STORE(32, 2)
+	    SHA256_AVX2_STORE(48, 3)
+	    "add	$48, %[k]\n"
+	    "add	$48, %[wk0]\n"
+	    "add	$48, %[wk1]\n"
+	    "1:\n"
+	    "add	$16, %[k]\n"
+	    "add	$16, %[wk0]\n"
+	    "add	$16, %[wk1]\n"
+	    /* ymm4 = W[t-15..t-12], ymm5 = W[t-7..t-4] */
+	    "vpalignr	$4, %%ymm0, %%ymm1, %%ymm4\n"
+	    "vpalignr	$4, %%ymm2, %%ymm3, %%ymm5\n"
+	    /* ymm6 = sigma0(W[t-15..t-12]) */
+	    "vpsrld	$7, %%ymm4, %%ymm6\n"
+	    "vpslld	$25, %%ymm4, %%ymm7\n"
+	    "vpxor	%%ymm7, %%ymm6, %%ymm6\n"
+	    "vpsrld	$18, %%ymm4, %%ymm7\n"
+	    "vpxor	%%ymm7, %%ymm6, %%ymm6\n"
+	    "vpslld	$14, %%ymm4, %%ymm7\n"
+	    "vpxor	%%ymm7, %%ymm6, %%ymm6\n"
+	    "vpsrld	$3, %%ymm4, %%ymm7\n"
+	    "vpxor	%%ymm7, %%ymm6, %%ymm6\n"
+	    /* ymm5 = W[t-16..t-13] + sigma0 + W[t-7..t-4] */
+	    "vpaddd	%%ymm0, %%ymm5, %%ymm5\n"
+	    "vpaddd	%%ymm6, %%ymm5, %%ymm5\n"
+	    /* W[t], W[t+1] need sigma1 of W[t-2], W[t-1] */
+	    "vpshufd	$0x0e, %%ymm3, %%ymm4\n"
+	    SHA256_AVX2_SIGMA1(4, 6)
+	    "vpaddd	%%ymm6, %%ymm5, %%ymm8\n"
+	    /* W[t+2], W[t+3] need sigma1 of W[t], W[t+1] */
+	    "vpshufd	$0x40, %%ymm8, %%ymm4\n"
+	    SHA256_AVX2_SIGMA1(4, 6)
+	    "vpaddd	%%ymm6, %%ymm5, %%ymm9\n"
+	    "vpblendd	$0xcc, %%ymm9, %%ymm8, %%ymm8\n"
+	    "vmovdqa	%%ymm1, %%ymm0\n"
+	    "vmovdqa	%%ymm2, %%ymm1\n"
+	    "vmovdqa	%%ymm3, %%ymm2\n"
+	    "vmovdqa	%%ymm8, %%ymm3\n"
+	    SHA256_AVX2_STORE(0, 3)
+	    "dec	%[n]\n"
+	    "jnz	1b\n"
+	    "vzeroupper\n"
+	    : [k] "+r" (k), [wk0] "+r" (wk0), [wk1] "+r" (wk1), [n] "+r" (n)
+	    : [p0] "r" (p0), [p1] "r" (p1), [mask] "r" (sha256_avx2_bswap_mask)
+	    : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5",
+	    "xmm6", "xmm7", "xmm8", "xmm9", "xmm10");
+}
+
+static void
+sha256_avx2_transform(uint32_t *H, const void *buf, uint64_t nblocks)
+{
+	const uint8_t *cp = buf;
+	uint32_t wk[2][64];
+
+	kfpu_begin();
+	while (nblocks > 0) {
+		/* A lone last block is expanded twice and used once. */
+		const uint8_t *next = (nblocks > 1) ?
+		    cp + SHA256_BLOCKSIZE : cp;
+
+		sha256_avx2_schedule(cp, next, wk[0], wk[1]);
+		sha256_avx2_rounds(H, wk[0]);
+		if (nblocks > 1) {
+			sha256_avx2_rounds(H, wk[1]);
+			nblocks--;
+		}
+		nblocks--;
+		cp += 2 * SHA256_BLOCKSIZE;
+	}
+	kfpu_end();
+}
+
+static boolean_t
+sha256_avx2_valid(void)
+{
+	return (zfs_avx2_available());
+}
+
+const sha256_ops_t sha256_avx2_ops = {
+	.sha_transform = sha256_avx2_transform,
+	.sha_valid = sha256_avx2_valid,
+	.sha_name = "avx2"
+};
+
+#endif /* __x86_64 || __x86_64__ */
@@ -0,0 +1,164 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * SHA-256 engine using the x86 SHA extensions.  sha256rnds2 performs two
+ * rounds on a state split into ABEF and CDGH halves, taking W[t] + K[t]
+ * for both from the low half of xmm0; sha256msg1 and sha256msg2 do the
+ * two halves of expanding the next four schedule words.
+ *
+ * xmm0 holds the round input, xmm1/xmm2 the ABEF/CDGH state, xmm3-xmm6
+ * the last sixteen schedule words, xmm7 is scratch, xmm8 the byteswap
+ * mask and xmm9/xmm10 the state at the start of the block.
+ */
+
+#if defined(__x86_64) || defined(__x86_64__)
+
+#include <sys/zfs_context.h>
+#include <sys/simd_x86.h>
+#include <sys/sha2.h>
+
+static const uint8_t sha256_shani_bswap_mask[16]
+    __attribute__((aligned(16))) = {
+	3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12
+};
+
+/*
+ * Four rounds, using schedule words W[4i..4i+3] from register m.  Groups
+ * 1-12 also start expanding a later set of words (msg1), and groups 3-14
+ * finish expanding the next one (msg2); p is the register holding the
+ * previous four words and n the one receiving the next four.
+ */
+#define	SHA256_SHANI_RNDS(i, m)						\
+	"movdqa		%%xmm" #m ", %%xmm0\n"				\
+	"paddd		" #i "*16(%[k]), %%xmm0\n"			\
+	"sha256rnds2	%%xmm1, %%xmm2\n"				\
+	"pshufd		$0x0e, %%xmm0, %%xmm0\n"			\
+	"sha256rnds2	%%xmm2, %%xmm1\n"
+
+#define	SHA256_SHANI_MSG2(m, p, n)					\
+	"movdqa		%%xmm" #m ", %%xmm7\n"				\
+	"palignr	$4, %%xmm" #p ", %%xmm7\n"			\
+	"paddd		%%xmm7, %%xmm" #n "\n"				\
+	"sha256msg2	%%xmm" #m ", %%xmm" #n "\n"
+
+#define	SHA256_SHANI_MSG1(m, p)						\
+	"sha256msg1	%%xmm" #m ", %%xmm" #p "\n"
+
+#define	SHA256_SHANI_LOAD(i, m)						\
+	"movdqu		" #i "*16(%[buf]), %%xmm" #m "\n"		\
+	"pshufb		%%xmm8, %%xmm" #m "\n"
+
+static void
+sha256_shani_transform(uint32_t *H, const void *buf, uint64_t nblocks)
+{
+	kfpu_begin();
+	__asm__ __volatile__(
+	    "movdqa	(%[mask]), %%xmm8\n"
+	    /* Rearrange a..h into ABEF and CDGH. */
+	    "movdqu	0(%[H]), %%xmm1\n"
+	    "movdqu	16(%[H]), %%xmm2\n"
+	    "pshufd	$0xb1, %%xmm1, %%xmm1\n"
+	    "pshufd	$0x1b, %%xmm2, %%xmm2\n"
+	    "movdqa	%%xmm1, %%xmm7\n"
+	    "palignr	$8, %%xmm2, %%xmm1\n"
+	    "pblendw	$0xf0, %%xmm7, %%xmm2\n"
+	    "1:\n"
+	    "movdqa	%%xmm1, %%xmm9\n"
+	    "movdqa	%%xmm2, %%xmm10\n"
+	    SHA256_SHANI_LOAD(0, 3)
+	    SHA256_SHANI_RNDS(0, 3)
+	    SHA256_SHANI_LOAD(1, 4)
+	    SHA256_SHANI_RNDS(1, 4)
+	    SHA256_SHANI_MSG1(4, 3)
+	    SHA256_SHANI_LOAD(2, 5)
+	    SHA256_SHANI_RNDS(2, 5)
+	    SHA256_SHANI_MSG1(5, 4)
+	    SHA256_SHANI_LOAD(3, 6)
+	    SHA256_SHANI_MSG2(6, 5, 3)
+	    SHA256_SHANI_RNDS(3, 6)
+	    SHA256_SHANI_MSG1(6, 5)
+	    SHA256_SHANI_MSG2(3, 6, 4)
+	    SHA256_SHANI_RNDS(4, 3)
+	    SHA256_SHANI_MSG1(3, 6)
+	    SHA256_SHANI_MSG2(4, 3, 5)
+	    SHA256_SHANI_RNDS(5, 4)
+	    SHA256_SHANI_MSG1(4, 3)
+	    SHA256_SHANI_MSG2(5, 4, 6)
+	    SHA256_SHANI_RNDS(6, 5)
+	    SHA256_SHANI_MSG1(5, 4)
+	    SHA256_SHANI_MSG2(6, 5, 3)
+	    SHA256_SHANI_RNDS(7, 6)
+	    SHA256_SHANI_MSG1(6, 5)
+	    SHA256_SHANI_MSG2(3, 6, 4)
+	    SHA256_SHANI_RNDS(8, 3)
+	    SHA256_SHANI_MSG1(3, 6)
+	    SHA256_SHANI_MSG2(4, 3, 5)
+	    SHA256_SHANI_RNDS(9, 4)
+	    SHA256_SHANI_MSG1(4, 3)
+	    SHA256_SHANI_MSG2(5, 4, 6)
+	    SHA256_SHANI_RNDS(10, 5)
+	    SHA256_SHANI_MSG1(5, 4)
+	    SHA256_SHANI_MSG2(6, 5, 3)
+	    SHA256_SHANI_RNDS(11, 6)
+	    SHA256_SHANI_MSG1(6, 5)
+	    SHA256_SHANI_MSG2(3, 6, 4)
+	    SHA256_SHANI_RNDS(12, 3)
+	    SHA256_SHANI_MSG1(3, 6)
+	    SHA256_SHANI_MSG2(4, 3, 5)
+	    SHA256_SHANI_RNDS(13, 4)
+	    SHA256_SHANI_MSG2(5, 4, 6)
+	    SHA256_SHANI_RNDS(14, 5)
+	    SHA256_SHANI_RNDS(15, 6)
+	    "paddd	%%xmm9, %%xmm1\n"
+	    "paddd	%%xmm10, %%xmm2\n"
+	    "add	$64, %[buf]\n"
+	    "dec	%[n]\n"
+	    "jnz	1b\n"
+	    /* And back to a..h. */
+	    "pshufd	$0x1b, %%xmm1, %%xmm1\n"
+	    "pshufd	$0xb1, %%xmm2, %%xmm2\n"
+	    "movdqa	%%xmm1, %%xmm7\n"
+	    "pblendw	$0xf0, %%xmm2, %%xmm1\n"
+	    "palignr	$8, %%xmm7, %%xmm2\n"
+	    "movdqu	%%xmm1, 0(%[H])\n"
+	    "movdqu	%%xmm2, 16(%[H])\n"
+	    : [buf] "+r" (buf), [n] "+r" (nblocks)
+	    : [H] "r" (H), [k] "r" (sha256_k),
+	    [mask] "r" (sha256_shani_bswap_mask)
+	    : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5",
+	    "xmm6", "xmm7", "xmm8", "xmm9", "xmm10");
+	kfpu_end();
+}
+
+static boolean_t
+sha256_shani_valid(void)
+{
+	return (zfs_shani_available());
+}
+
+const sha256_ops_t sha256_shani_ops = {
+	.sha_transform = sha256_shani_transform,
+	.sha_valid = sha256_shani_valid,
+	.sha_name = "shani"
+};
+
+#endif /* __x86_64 || __x86_64__ */
@@ -0,0 +1,152 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/zio.h>
+#include <sys/zio_checksum.h>
+
+/*
+ * SHA-512/256 checksum, as specified in FIPS 180-4, available at:
+ * http://csrc.nist.gov/publications/PubsFIPS.html
+ *
+ * This is SHA-512 with its own initial hash value, truncated to 256 bits.
+ * Working on 64-bit words it needs fewer operations per byte than SHA-256
+ * on 64-bit CPUs, which makes it the faster strong checksum for dedup on
+ * machines without SHA-256 instructions.
+ *
+ * The on-disk checksum is the big-endian digest stored as-is in the four
+ * checksum words, which keeps pools compatible with other implementations
+ * of the org.illumos:sha512 feature.
+ */
+#define	SHA512_BLOCKSIZE	128
+
+#define	Ch(x, y, z)	((z) ^ ((x) & ((y) ^ (z))))
+#define	Maj(x, y, z)	(((x) & (y)) ^ ((z) & ((x) ^ (y))))
+#define	Rot64(x, s)	(((x) >> s) | ((x) << (64 - s)))
+#define	SIGMA0(x)	(Rot64(x, 28) ^ Rot64(x, 34) ^ Rot64(x, 39))
+#define	SIGMA1(x)	(Rot64(x, 14) ^ Rot64(x, 18) ^ Rot64(x, 41))
+#define	sigma0(x)	(Rot64(x, 1) ^ Rot64(x, 8) ^ ((x) >> 7))
+#define	sigma1(x)	(Rot64(x, 19) ^ Rot64(x, 61) ^ ((x) >> 6))
+
+static const uint64_t SHA512_K[80] = {
+	0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL,
+	0xe9b5dba58189dbbcULL, 0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL,
+	0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL, 0xd807aa98a3030242ULL,
+	0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+	0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL,
+	0xc19bf174cf692694ULL, 0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL,
+	0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL, 0x2de92c6f592b0275ULL,
+	0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+	0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL,
+	0xbf597fc7beef0ee4ULL, 0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL,
+	0x06ca6351e003826fULL, 0x142929670a0e6e70ULL, 0x27b70a8546d22ffcULL,
+	0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+	0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL,
+	0x92722c851482353bULL, 0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL,
+	0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL, 0xd192e819d6ef5218ULL,
+	0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+	0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL,
+	0x34b0bcb5e19b48a8ULL, 0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL,
+	0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL, 0x748f82ee5defb2fcULL,
+	0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+	0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL,
+	0xc67178f2e372532bULL, 0xca273eceea26619cULL, 0xd186b8c721c0c207ULL,
+	0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL, 0x06f067aa72176fbaULL,
+	0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+	0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL,
+	0x431d67c49c100d4cULL, 0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL,
+	0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL
+};
+
+static void
+SHA512Transform(uint64_t *H, const uint8_t *cp)
+{
+	uint64_t a, b, c, d, e, f, g, h, T1, T2, W[80];
+	int t, i;
+
+	for (t = 0; t < 16; t++) {
+		for (W[t] = 0, i = 0; i < 8; i++)
+			W[t] = (W[t] << 8) | *cp++;
+	}
+
+	for (t = 16; t < 80; t++)
+		W[t] = sigma1(W[t - 2]) + W[t - 7] +
+		    sigma0(W[t - 15]) + W[t - 16];
+
+	a = H[0]; b = H[1]; c = H[2]; d = H[3];
+	e = H[4]; f = H[5]; g = H[6]; h = H[7];
+
+	for (t = 0; t < 80; t++) {
+		T1 = h + SIGMA1(e) + Ch(e, f, g) + SHA512_K[t] + W[t];
+		T2 = SIGMA0(a) + Maj(a, b, c);
+		h = g; g = f; f = e; e = d + T1;
+		d = c; c = b; b = a; a = T1 + T2;
+	}
+
+	H[0] += a; H[1] += b; H[2] += c; H[3] += d;
+	H[4] += e; H[5] += f; H[6] += g; H[7] += h;
+}
+
+void
+zio_checksum_SHA512_native(const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+	uint64_t H[8] = {
+	    0x22312194fc2bf72cULL, 0x9f555fa3c84c64c2ULL,
+	    0x2393b86b6f53b151ULL, 0x963877195940eabdULL,
+	    0x96283ee2a88effe3ULL, 0xbe5e1e2553863992ULL,
+	    0x2b0199fc2c85b8aaULL, 0x0eb72ddc81c52ca2ULL };
+	uint8_t pad[256], *digest = (uint8_t *)zcp;
+	uint64_t i;
+	int padsize, j;
+
+	for (i = 0; i + SHA512_BLOCKSIZE <= size; i += SHA512_BLOCKSIZE)
+		SHA512Transform(H, (uint8_t *)buf + i);
+
+	for (padsize = 0; i < size; i++)
+		pad[padsize++] = *((uint8_t *)buf + i);
+
+	for (pad[padsize++] = 0x80; (padsize & 127) != 112; padsize++)
+		pad[padsize] = 0;
+
+	/* The message length is 128 bits; ours always fits in the low 64. */
+	for (j = 0; j < 8; j++)
+		pad[padsize++] = 0;
+	for (j = 56; j >= 0; j -= 8)
+		pad[padsize++] = (size << 3) >> j;
+
+	for (j = 0; j < padsize; j += SHA512_BLOCKSIZE)
+		SHA512Transform(H, pad + j);
+
+	for (j = 0; j < 32; j++)
+		digest[j] = H[j / 8] >> (56 - 8 * (j % 8));
+}
+
+void
+zio_checksum_SHA512_byteswap(const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+	zio_cksum_t tmp;
+
+	zio_checksum_SHA512_native(buf, size, &tmp);
+	zcp->zc_word[0] = BSWAP_64(tmp.zc_word[0]);
+	zcp->zc_word[1] = BSWAP_64(tmp.zc_word[1]);
+	zcp->zc_word[2] = BSWAP_64(tmp.zc_word[2]);
+	zcp->zc_word[3] = BSWAP_64(tmp.zc_word[3]);
+}
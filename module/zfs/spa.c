@@ -36,6 +36,7 @@
 #include <sys/spa_impl.h>
 #include <sys/zio.h>
 #include <sys/zio_checksum.h>
+#include <sys/abd.h>
 #include <sys/dmu.h>
 #include <sys/dmu_tx.h>
 #include <sys/zap.h>
@@ -45,6 +46,7 @@
 #include <sys/vdev_disk.h>
 #include <sys/metaslab.h>
 #include <sys/metaslab_impl.h>
+#include <sys/spa_log_spacemap.h>
 #include <sys/uberblock_impl.h>
 #include <sys/txg.h>
 #include <sys/avl.h>
@@ -1099,6 +1101,8 @@ spa_activate(spa_t *spa, int mode)
 	avl_create(&spa->spa_errlist_last,
 	    spa_error_entry_compare, sizeof (spa_error_entry_t),
 	    offsetof(spa_error_entry_t, se_avl));
+
+	spa_log_sm_init(spa);
 }
 
 /*
@@ -1120,6 +1124,8 @@ spa_deactivate(spa_t *spa)
 	list_destroy(&spa->spa_config_dirty_list);
 	list_destroy(&spa->spa_state_dirty_list);
 
+	spa_log_sm_fini(spa);
+
 #ifdef __linux__
 	taskq_cancel_id(system_taskq, spa->spa_deadman_tqid);
 #endif
@@ -1279,6 +1285,8 @@ spa_unload(spa_t *spa)
 		vdev_free(spa->spa_root_vdev);
 	ASSERT(spa->spa_root_vdev == NULL);
 
+	spa_log_sm_unload(spa);
+
 	for (i = 0; i < spa->spa_spares.sav_count; i++)
 		vdev_free(spa->spa_spares.sav_vdevs[i]);
 	if (spa->spa_spares.sav_vdevs) {
@@ -1856,7 +1864,7 @@ spa_load_verify_done(zio_t *zio)
 		else
 			atomic_add_64(&sle->sle_data_count, 1);
 	}
-	zio_data_buf_free(zio->io_data, zio->io_size);
+	abd_free(zio->io_abd);
 }
 
 /*ARGSUSED*/
@@ -1867,7 +1875,7 @@ spa_load_verify_cb(spa_t *spa, zilog_t *zilog, const blkptr_t *bp,
 	if (bp != NULL) {
 		zio_t *rio = arg;
 		size_t size = BP_GET_PSIZE(bp);
-		void *data = zio_data_buf_alloc(size);
+		abd_t *data = abd_alloc(size, B_FALSE);
 
 		zio_nowait(zio_read(rio, spa, bp, data, size,
 		    spa_load_verify_done, rio->io_private, ZIO_PRIORITY_SCRUB,
@@ -2391,6 +2399,9 @@ spa_load_impl(spa_t *spa, uint64_t pool_guid, nvlist_t *config,
 			return (spa_vdev_err(rvd, VDEV_AUX_UNSUP_FEAT,
 			    ENOTSUP));
 		}
+
+		spa->spa_embedded_data = spa_feature_is_active(spa,
+		    &spa_feature_table[SPA_FEATURE_EMBEDDED_DATA]);
 	}
 
 	spa->spa_is_initializing = B_TRUE;
@@ -2579,6 +2590,13 @@ spa_load_impl(spa_t *spa, uint64_t pool_guid, nvlist_t *config,
 	 */
 	vdev_load(rvd);
 
+	/*
+	 * Replay the space map log onto the metaslabs we just loaded.
+	 */
+	error = spa_log_sm_load(spa);
+	if (error != 0)
+		return (spa_vdev_err(rvd, VDEV_AUX_CORRUPT_DATA, EIO));
+
 	/*
 	 * Propagate the leaf DTLs we just loaded all the way up the tree.
 	 */
@@ -6104,6 +6122,25 @@ spa_sync_upgrades(spa_t *spa, dmu_tx_t *tx)
 	rrw_exit(&dp->dp_config_rwlock, FTAG);
 }
 
+/*
+ * Blocks are only embedded in their bp's once the embedded_data feature
+ * is active, so activate it the first time we sync after it is enabled.
+ * This is cached in spa_embedded_data for zio_write_bp_init().
+ */
+static void
+spa_sync_embedded_data(spa_t *spa, dmu_tx_t *tx)
+{
+	zfeature_info_t *feat = &spa_feature_table[SPA_FEATURE_EMBEDDED_DATA];
+
+	ASSERT(spa->spa_sync_pass == 1);
+
+	if (spa->spa_embedded_data || !spa_feature_is_enabled(spa, feat))
+		return;
+
+	spa_feature_incr(spa, feat, tx);
+	spa->spa_embedded_data = B_TRUE;
+}
+
 /*
  * Sync the specified transaction group.  New blocks may be dirtied as
  * part of the process, so we iterate until it converges.
@@ -6231,11 +6268,16 @@ spa_sync(spa_t *spa, uint64_t txg)
 		ddt_sync(spa, txg);
 		dsl_scan_sync(dp, tx);
 
+		if (pass == 1)
+			spa_log_sm_sync(spa, tx);
+
 		while ((vd = txg_list_remove(&spa->spa_vdev_txg_list, txg)))
 			vdev_sync(vd, txg);
 
-		if (pass == 1)
+		if (pass == 1) {
 			spa_sync_upgrades(spa, tx);
+			spa_sync_embedded_data(spa, tx);
+		}
 
 	} while (dmu_objset_is_dirty(mos, txg));
 
@@ -0,0 +1,525 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/dmu.h>
+#include <sys/dmu_tx.h>
+#include <sys/spa_impl.h>
+#include <sys/spa_log_spacemap.h>
+#include <sys/metaslab_impl.h>
+#include <sys/vdev_impl.h>
+#include <sys/zap.h>
+#include <sys/zio.h>
+#include <sys/zfeature.h>
+#include <sys/kstat.h>
+
+/*
+ * Space map log
+ *
+ * Without the log, every metaslab that allocated or freed anything in a
+ * txg appends those changes to its own space map in that txg.  On a pool
+ * with many metaslabs and a random write workload that is a small write
+ * to almost every space map, every txg.
+ *
+ * With the log_spacemap feature active, metaslab_sync() appends them to
+ * a single log space map for the txg instead, and keeps them in core in
+ * the metaslab's unflushed maps (see metaslab_impl.h).  The records of
+ * each metaslab are introduced by two debug entries, SM_LOG_VDEV and
+ * SM_LOG_METASLAB, naming the metaslab; their offsets are relative to the
+ * metaslab's start, as they would be in its own space map.
+ *
+ * In syncing context spa_log_sm_sync() flushes a few metaslabs each txg,
+ * oldest changes first, so that every metaslab is flushed about once every
+ * zfs_log_sm_flush_txgs txgs.  Flushing writes the unflushed maps to the
+ * metaslab's space map and records the txg in its smo_flushed_txg.  A log
+ * is destroyed once no metaslab has unflushed changes from its txg, and if
+ * the logs grow beyond zfs_log_sm_max_size we flush more aggressively.
+ *
+ * Since the log objects, the logs' ZAP, the metaslabs' space maps and
+ * their flushed txgs all change in the same txg, the on-disk state is
+ * always consistent.  At import, spa_log_sm_load() replays every log in
+ * txg order, skipping the records of metaslabs that were flushed in or
+ * after the log's txg.
+ *
+ * The per-pool state (spa_log_sm_list, spa_log_sm_unflushed and the
+ * metaslabs' unflushed maps) is only changed in syncing context, or while
+ * the pool is being loaded or unloaded.
+ */
+
+/*
+ * Spread the flushing of all metaslabs over this many txgs.
+ */
+int zfs_log_sm_flush_txgs = 64;
+
+/*
+ * When the log space maps take up more than this many bytes, flush all
+ * the metaslabs that are keeping the oldest log around.
+ */
+unsigned long zfs_log_sm_max_size = 128ULL << 20;
+
+typedef struct log_sm_stats {
+	kstat_named_t logsmstat_logs;
+	kstat_named_t logsmstat_log_bytes;
+	kstat_named_t logsmstat_unflushed_metaslabs;
+	kstat_named_t logsmstat_flushed;
+	kstat_named_t logsmstat_flushed_over_size;
+	kstat_named_t logsmstat_logs_destroyed;
+	kstat_named_t logsmstat_replayed_entries;
+} log_sm_stats_t;
+
+static log_sm_stats_t log_sm_stats = {
+	{ "logs",			KSTAT_DATA_UINT64 },
+	{ "log_bytes",			KSTAT_DATA_UINT64 },
+	{ "unflushed_metaslabs",	KSTAT_DATA_UINT64 },
+	{ "flushed",			KSTAT_DATA_UINT64 },
+	{ "flushed_over_size",		KSTAT_DATA_UINT64 },
+	{ "logs_destroyed",		KSTAT_DATA_UINT64 },
+	{ "replayed_entries",		KSTAT_DATA_UINT64 }
+};
+
+static kstat_t *log_sm_ksp = NULL;
+
+#define	LOGSMSTAT_INCR(stat, val) \
+	atomic_add_64(&log_sm_stats.stat.value.ui64, (val))
+#define	LOGSMSTAT_BUMP(stat)	LOGSMSTAT_INCR(stat, 1)
+
+void
+spa_log_sm_stat_init(void)
+{
+	log_sm_ksp = kstat_create("zfs", 0, "log_spacemap_stats", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (log_sm_stats) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+	if (log_sm_ksp != NULL) {
+		log_sm_ksp->ks_data = &log_sm_stats;
+		kstat_install(log_sm_ksp);
+	}
+}
+
+void
+spa_log_sm_stat_fini(void)
+{
+	if (log_sm_ksp != NULL) {
+		kstat_delete(log_sm_ksp);
+		log_sm_ksp = NULL;
+	}
+}
+
+/*
+ * Order metaslabs by the txg of their oldest unflushed change, so that
+ * the first one in the tree is the next to flush.
+ */
+static int
+spa_log_sm_metaslab_compare(const void *x1, const void *x2)
+{
+	const metaslab_t *m1 = x1;
+	const metaslab_t *m2 = x2;
+
+	if (m1->ms_unflushed_txg < m2->ms_unflushed_txg)
+		return (-1);
+	if (m1->ms_unflushed_txg > m2->ms_unflushed_txg)
+		return (1);
+
+	if (m1->ms_group->mg_vd->vdev_id < m2->ms_group->mg_vd->vdev_id)
+		return (-1);
+	if (m1->ms_group->mg_vd->vdev_id > m2->ms_group->mg_vd->vdev_id)
+		return (1);
+
+	if (m1->ms_map->sm_start < m2->ms_map->sm_start)
+		return (-1);
+	if (m1->ms_map->sm_start > m2->ms_map->sm_start)
+		return (1);
+
+	ASSERT3P(m1, ==, m2);
+
+	return (0);
+}
+
+void
+spa_log_sm_init(spa_t *spa)
+{
+	list_create(&spa->spa_log_sm_list, sizeof (spa_log_sm_t),
+	    offsetof(spa_log_sm_t, sls_node));
+	avl_create(&spa->spa_log_sm_unflushed, spa_log_sm_metaslab_compare,
+	    sizeof (metaslab_t), offsetof(metaslab_t, ms_unflushed_node));
+}
+
+void
+spa_log_sm_fini(spa_t *spa)
+{
+	ASSERT(list_is_empty(&spa->spa_log_sm_list));
+	ASSERT0(avl_numnodes(&spa->spa_log_sm_unflushed));
+
+	list_destroy(&spa->spa_log_sm_list);
+	avl_destroy(&spa->spa_log_sm_unflushed);
+}
+
+boolean_t
+spa_log_sm_active(spa_t *spa)
+{
+	return (spa->spa_log_sm_zap != 0);
+}
+
+void
+spa_log_sm_add_metaslab(spa_t *spa, metaslab_t *msp)
+{
+	ASSERT(msp->ms_unflushed_txg != 0);
+
+	avl_add(&spa->spa_log_sm_unflushed, msp);
+	LOGSMSTAT_BUMP(logsmstat_unflushed_metaslabs);
+}
+
+void
+spa_log_sm_remove_metaslab(spa_t *spa, metaslab_t *msp)
+{
+	ASSERT(msp->ms_unflushed_txg != 0);
+
+	avl_remove(&spa->spa_log_sm_unflushed, msp);
+	LOGSMSTAT_INCR(logsmstat_unflushed_metaslabs, -1);
+}
+
+/*
+ * Create the log space map for this txg.  Its ZAP entry and its bonus are
+ * written in the same txg, so a log that exists on disk is always whole.
+ */
+static spa_log_sm_t *
+spa_log_sm_create(spa_t *spa, dmu_tx_t *tx)
+{
+	objset_t *mos = spa_meta_objset(spa);
+	uint64_t txg = dmu_tx_get_txg(tx);
+	spa_log_sm_t *sls;
+
+	sls = kmem_zalloc(sizeof (spa_log_sm_t), KM_PUSHPAGE);
+	sls->sls_txg = txg;
+	sls->sls_smo.smo_object = dmu_object_alloc(mos,
+	    DMU_OT_SPACE_MAP, 1 << SPA_LOG_SM_BLOCKSHIFT,
+	    DMU_OT_SPACE_MAP_HEADER, SPACE_MAP_SIZE_V0, tx);
+	VERIFY0(zap_add_int_key(mos, spa->spa_log_sm_zap, txg,
+	    sls->sls_smo.smo_object, tx));
+
+	list_insert_tail(&spa->spa_log_sm_list, sls);
+	LOGSMSTAT_BUMP(logsmstat_logs);
+
+	return (sls);
+}
+
+static void
+spa_log_sm_destroy(spa_t *spa, spa_log_sm_t *sls, dmu_tx_t *tx)
+{
+	objset_t *mos = spa_meta_objset(spa);
+
+	ASSERT3U(sls->sls_txg, <, dmu_tx_get_txg(tx));
+
+	VERIFY0(dmu_object_free(mos, sls->sls_smo.smo_object, tx));
+	VERIFY0(zap_remove_int(mos, spa->spa_log_sm_zap, sls->sls_txg, tx));
+
+	spa->spa_log_sm_size -= sls->sls_smo.smo_objsize;
+	LOGSMSTAT_INCR(logsmstat_log_bytes, -sls->sls_smo.smo_objsize);
+	LOGSMSTAT_INCR(logsmstat_logs, -1);
+	LOGSMSTAT_BUMP(logsmstat_logs_destroyed);
+
+	list_remove(&spa->spa_log_sm_list, sls);
+	kmem_free(sls, sizeof (spa_log_sm_t));
+}
+
+/*
+ * Append a metaslab's allocs and frees for this sync pass to the log.
+ * Like space_map_sync(), this drops the metaslab's lock around the DMU.
+ */
+void
+spa_log_sm_append(spa_t *spa, metaslab_t *msp, space_map_t *allocmap,
+    space_map_t *freemap, dmu_tx_t *tx)
+{
+	objset_t *mos = spa_meta_objset(spa);
+	vdev_t *vd = msp->ms_group->mg_vd;
+	uint64_t txg = dmu_tx_get_txg(tx);
+	int pass = spa_sync_pass(spa);
+	spa_log_sm_t *sls;
+	uint64_t hdr[2], objsize;
+	dmu_buf_t *db;
+
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+	ASSERT(spa_log_sm_active(spa));
+
+	mutex_exit(&msp->ms_lock);
+
+	sls = list_tail(&spa->spa_log_sm_list);
+	if (sls == NULL || sls->sls_txg != txg)
+		sls = spa_log_sm_create(spa, tx);
+	objsize = sls->sls_smo.smo_objsize;
+
+	hdr[0] = SM_DEBUG_ENCODE(1) |
+	    SM_DEBUG_ACTION_ENCODE(SM_LOG_VDEV) |
+	    SM_DEBUG_SYNCPASS_ENCODE(pass) |
+	    SM_DEBUG_TXG_ENCODE(vd->vdev_id);
+	hdr[1] = SM_DEBUG_ENCODE(1) |
+	    SM_DEBUG_ACTION_ENCODE(SM_LOG_METASLAB) |
+	    SM_DEBUG_SYNCPASS_ENCODE(pass) |
+	    SM_DEBUG_TXG_ENCODE(msp->ms_map->sm_start >> vd->vdev_ms_shift);
+	dmu_write(mos, sls->sls_smo.smo_object, sls->sls_smo.smo_objsize,
+	    sizeof (hdr), hdr, tx);
+	sls->sls_smo.smo_objsize += sizeof (hdr);
+
+	mutex_enter(&msp->ms_lock);
+	space_map_sync(allocmap, SM_ALLOC, &sls->sls_smo, mos, tx);
+	space_map_sync(freemap, SM_FREE, &sls->sls_smo, mos, tx);
+	mutex_exit(&msp->ms_lock);
+
+	VERIFY0(dmu_bonus_hold(mos, sls->sls_smo.smo_object, FTAG, &db));
+	dmu_buf_will_dirty(db, tx);
+	bcopy(&sls->sls_smo, db->db_data, SPACE_MAP_SIZE_V0);
+	dmu_buf_rele(db, FTAG);
+
+	spa->spa_log_sm_size += sls->sls_smo.smo_objsize - objsize;
+	LOGSMSTAT_INCR(logsmstat_log_bytes, sls->sls_smo.smo_objsize - objsize);
+
+	mutex_enter(&msp->ms_lock);
+}
+
+/*
+ * Called in the first sync pass, before the vdevs are synced: activate
+ * the log if the feature has just been enabled, flush this txg's share of
+ * metaslabs, and destroy the logs no metaslab depends on any more.
+ */
+void
+spa_log_sm_sync(spa_t *spa, dmu_tx_t *tx)
+{
+	objset_t *mos = spa_meta_objset(spa);
+	zfeature_info_t *feat = &spa_feature_table[SPA_FEATURE_LOG_SPACEMAP];
+	avl_tree_t *t = &spa->spa_log_sm_unflushed;
+	spa_log_sm_t *sls;
+	metaslab_t *msp;
+	uint64_t nflush, oldest = 0;
+
+	ASSERT3U(spa_sync_pass(spa), ==, 1);
+
+	if (!spa_log_sm_active(spa)) {
+		if (!spa_feature_is_enabled(spa, feat))
+			return;
+		spa->spa_log_sm_zap = zap_create_link(mos,
+		    DMU_OTN_ZAP_METADATA, DMU_POOL_DIRECTORY_OBJECT,
+		    DMU_POOL_LOG_SPACEMAP_ZAP, tx);
+		spa_feature_incr(spa, feat, tx);
+	}
+
+	nflush = howmany(avl_numnodes(t), MAX(zfs_log_sm_flush_txgs, 1));
+	if (spa->spa_log_sm_size > zfs_log_sm_max_size &&
+	    (msp = avl_first(t)) != NULL)
+		oldest = msp->ms_unflushed_txg;
+
+	while ((msp = avl_first(t)) != NULL) {
+		if (nflush != 0) {
+			nflush--;
+		} else if (msp->ms_unflushed_txg == oldest) {
+			LOGSMSTAT_BUMP(logsmstat_flushed_over_size);
+		} else {
+			break;
+		}
+		metaslab_flush(msp, tx);
+		LOGSMSTAT_BUMP(logsmstat_flushed);
+	}
+
+	msp = avl_first(t);
+	while ((sls = list_head(&spa->spa_log_sm_list)) != NULL &&
+	    (msp == NULL || sls->sls_txg < msp->ms_unflushed_txg))
+		spa_log_sm_destroy(spa, sls, tx);
+}
+
+/*
+ * Apply one log's records to the metaslabs they belong to.
+ */
+static int
+spa_log_sm_replay(spa_t *spa, spa_log_sm_t *sls)
+{
+	objset_t *mos = spa_meta_objset(spa);
+	vdev_t *rvd = spa->spa_root_vdev;
+	vdev_t *vd = NULL;
+	metaslab_t *msp = NULL;
+	uint64_t *entry, *entry_map, *entry_map_end;
+	uint64_t bufsize, offset, size, end, replayed = 0;
+	int error = 0;
+
+	end = sls->sls_smo.smo_objsize;
+	bufsize = 1ULL << SPA_LOG_SM_BLOCKSHIFT;
+	entry_map = zio_buf_alloc(bufsize);
+
+	if (end > bufsize)
+		dmu_prefetch(mos, sls->sls_smo.smo_object, bufsize,
+		    end - bufsize);
+
+	for (offset = 0; offset < end; offset += bufsize) {
+		size = MIN(end - offset, bufsize);
+		VERIFY(P2PHASE(size, sizeof (uint64_t)) == 0);
+
+		error = dmu_read(mos, sls->sls_smo.smo_object, offset, size,
+		    entry_map, DMU_READ_PREFETCH);
+		if (error != 0)
+			break;
+
+		entry_map_end = entry_map + (size / sizeof (uint64_t));
+		for (entry = entry_map; entry < entry_map_end; entry++) {
+			uint64_t e = *entry;
+			uint64_t id;
+
+			if (SM_DEBUG_DECODE(e)) {
+				id = SM_DEBUG_TXG_DECODE(e);
+				switch (SM_DEBUG_ACTION_DECODE(e)) {
+				case SM_LOG_VDEV:
+					vd = NULL;
+					if (id < rvd->vdev_children)
+						vd = rvd->vdev_child[id];
+					msp = NULL;
+					break;
+				case SM_LOG_METASLAB:
+					msp = NULL;
+					if (vd != NULL && vd->vdev_ms != NULL &&
+					    id < vd->vdev_ms_count)
+						msp = vd->vdev_ms[id];
+					/*
+					 * Skip the records of metaslabs that
+					 * have been flushed since, and of
+					 * metaslabs whose vdev was removed
+					 * and whose space was added again.
+					 */
+					if (msp != NULL &&
+					    (msp->ms_smo.smo_object == 0 ||
+					    sls->sls_txg <=
+					    msp->ms_smo.smo_flushed_txg))
+						msp = NULL;
+					break;
+				}
+				continue;
+			}
+
+			if (msp == NULL)
+				continue;
+
+			metaslab_log_replay(msp, SM_TYPE_DECODE(e),
+			    (SM_OFFSET_DECODE(e) << msp->ms_map->sm_shift) +
+			    msp->ms_map->sm_start,
+			    SM_RUN_DECODE(e) << msp->ms_map->sm_shift,
+			    sls->sls_txg);
+			replayed++;
+		}
+	}
+
+	zio_buf_free(entry_map, bufsize);
+
+	LOGSMSTAT_INCR(logsmstat_replayed_entries, replayed);
+
+	return (error);
+}
+
+/*
+ * Read the pool's log space maps, if it has any, and replay them onto the
+ * metaslabs.  Called once the vdevs' metaslabs have been loaded.
+ */
+int
+spa_log_sm_load(spa_t *spa)
+{
+	objset_t *mos = spa_meta_objset(spa);
+	zap_cursor_t zc;
+	zap_attribute_t za;
+	spa_log_sm_t *sls, *prev;
+	dmu_buf_t *db;
+	int error;
+
+	ASSERT(list_is_empty(&spa->spa_log_sm_list));
+
+	error = zap_lookup(mos, DMU_POOL_DIRECTORY_OBJECT,
+	    DMU_POOL_LOG_SPACEMAP_ZAP, sizeof (uint64_t), 1,
+	    &spa->spa_log_sm_zap);
+	if (error == ENOENT)
+		return (0);
+	if (error != 0)
+		return (error);
+
+	for (zap_cursor_init(&zc, mos, spa->spa_log_sm_zap);
+	    (error = zap_cursor_retrieve(&zc, &za)) == 0;
+	    zap_cursor_advance(&zc)) {
+		sls = kmem_zalloc(sizeof (spa_log_sm_t), KM_PUSHPAGE);
+		sls->sls_txg = strtonum(za.za_name, NULL);
+		sls->sls_smo.smo_object = za.za_first_integer;
+
+		/* ZAP order is arbitrary; keep the list sorted by txg */
+		for (prev = list_tail(&spa->spa_log_sm_list);
+		    prev != NULL && prev->sls_txg > sls->sls_txg;
+		    prev = list_prev(&spa->spa_log_sm_list, prev))
+			continue;
+		if (prev == NULL)
+			list_insert_head(&spa->spa_log_sm_list, sls);
+		else
+			list_insert_after(&spa->spa_log_sm_list, prev, sls);
+	}
+	zap_cursor_fini(&zc);
+	if (error != ENOENT)
+		return (error);
+
+	for (sls = list_head(&spa->spa_log_sm_list); sls != NULL;
+	    sls = list_next(&spa->spa_log_sm_list, sls)) {
+		error = dmu_bonus_hold(mos, sls->sls_smo.smo_object,
+		    FTAG, &db);
+		if (error != 0)
+			return (error);
+		bcopy(db->db_data, &sls->sls_smo, SPACE_MAP_SIZE_V0);
+		dmu_buf_rele(db, FTAG);
+
+		spa->spa_log_sm_size += sls->sls_smo.smo_objsize;
+		LOGSMSTAT_BUMP(logsmstat_logs);
+		LOGSMSTAT_INCR(logsmstat_log_bytes, sls->sls_smo.smo_objsize);
+
+		error = spa_log_sm_replay(spa, sls);
+		if (error != 0)
+			return (error);
+	}
+
+	return (0);
+}
+
+/*
+ * Forget the pool's logs.  The metaslabs must already be gone.
+ */
+void
+spa_log_sm_unload(spa_t *spa)
+{
+	spa_log_sm_t *sls;
+
+	ASSERT0(avl_numnodes(&spa->spa_log_sm_unflushed));
+
+	while ((sls = list_head(&spa->spa_log_sm_list)) != NULL) {
+		LOGSMSTAT_INCR(logsmstat_logs, -1);
+		LOGSMSTAT_INCR(logsmstat_log_bytes, -sls->sls_smo.smo_objsize);
+		list_remove(&spa->spa_log_sm_list, sls);
+		kmem_free(sls, sizeof (spa_log_sm_t));
+	}
+
+	spa->spa_log_sm_zap = 0;
+	spa->spa_log_sm_size = 0;
+}
+
+#if defined(_KERNEL) && defined(HAVE_SPL)
+module_param(zfs_log_sm_flush_txgs, int, 0644);
+MODULE_PARM_DESC(zfs_log_sm_flush_txgs,
+	"Number of txgs over which all metaslabs are flushed");
+
+module_param(zfs_log_sm_max_size, ulong, 0644);
+MODULE_PARM_DESC(zfs_log_sm_max_size,
+	"Log space map size at which metaslabs are flushed early");
+#endif
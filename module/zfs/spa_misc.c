@@ -29,6 +29,7 @@
 #include <sys/zio.h>
 #include <sys/zio_checksum.h>
 #include <sys/zio_compress.h>
+#include <sys/abd.h>
 #include <sys/dmu.h>
 #include <sys/dmu_tx.h>
 #include <sys/zap.h>
@@ -46,11 +47,15 @@
 #include <sys/dsl_scan.h>
 #include <sys/fs/zfs.h>
 #include <sys/metaslab_impl.h>
+#include <sys/vdev_raidz.h>
+#include <sys/sha2.h>
 #include <sys/arc.h>
 #include <sys/ddt.h>
+#include <sys/zfeature.h>
 #include <sys/stropts.h>
 #include "zfs_prop.h"
 #include "zfeature_common.h"
+#include <zfs_fletcher.h>
 
 /*
  * SPA locking
@@ -1503,6 +1508,20 @@ spa_deflate(spa_t *spa)
 	return (spa->spa_deflate);
 }
 
+/*
+ * Largest block size this pool may be asked to write: SPA_MAXBLOCKSIZE
+ * once the large_blocks feature is enabled, the historical 128K before.
+ */
+uint64_t
+spa_maxblocksize(spa_t *spa)
+{
+	if (spa_feature_is_enabled(spa,
+	    &spa_feature_table[SPA_FEATURE_LARGE_BLOCKS]))
+		return (SPA_MAXBLOCKSIZE);
+	else
+		return (SPA_OLD_MAXBLOCKSIZE);
+}
+
 metaslab_class_t *
 spa_normal_class(spa_t *spa)
 {
@@ -1637,13 +1656,22 @@ spa_init(int mode)
 	spa_mode_global = mode;
 
 	fm_init();
+	fletcher_4_init();
+	sha256_init();
 	refcount_init();
 	unique_init();
-	space_map_init();
+	range_tree_init();
 	zio_init();
+	abd_init();
 	dmu_init();
 	zil_init();
+	dsl_scan_global_init();
 	vdev_cache_stat_init();
+	vdev_queue_stat_init();
+	vdev_mirror_stat_init();
+	spa_log_sm_stat_init();
+	ddt_init();
+	vdev_raidz_math_init();
 	zfs_prop_init();
 	zpool_prop_init();
 	zpool_feature_init();
@@ -1658,13 +1686,22 @@ spa_fini(void)
 
 	spa_evict_all();
 
+	vdev_raidz_math_fini();
+	ddt_fini();
+	spa_log_sm_stat_fini();
+	vdev_mirror_stat_fini();
+	vdev_queue_stat_fini();
 	vdev_cache_stat_fini();
+	dsl_scan_global_fini();
 	zil_fini();
 	dmu_fini();
+	abd_fini();
 	zio_fini();
-	space_map_fini();
+	range_tree_fini();
 	unique_fini();
 	refcount_fini();
+	sha256_fini();
+	fletcher_4_fini();
 	fm_fini();
 
 	avl_destroy(&spa_namespace_avl);
@@ -1751,6 +1788,7 @@ spa_scan_stat_init(spa_t *spa)
 	/* data not stored on disk */
 	spa->spa_scan_pass_start = gethrestime_sec();
 	spa->spa_scan_pass_exam = 0;
+	spa->spa_scan_pass_issued = 0;
 	vdev_scan_stat_init(spa->spa_root_vdev);
 }
 
@@ -1780,6 +1818,9 @@ spa_scan_get_stats(spa_t *spa, pool_scan_stat_t *ps)
 	/* data not stored on disk */
 	ps->pss_pass_start = spa->spa_scan_pass_start;
 	ps->pss_pass_exam = spa->spa_scan_pass_exam;
+	ps->pss_pass_issued = spa->spa_scan_pass_issued;
+	ps->pss_issued = scn->scn_issued_before_pass +
+	    spa->spa_scan_pass_issued;
 
 	return (0);
 }
@@ -1837,6 +1878,7 @@ EXPORT_SYMBOL(spa_get_asize);
 EXPORT_SYMBOL(spa_get_dspace);
 EXPORT_SYMBOL(spa_update_dspace);
 EXPORT_SYMBOL(spa_deflate);
+EXPORT_SYMBOL(spa_maxblocksize);
 EXPORT_SYMBOL(spa_normal_class);
 EXPORT_SYMBOL(spa_log_class);
 EXPORT_SYMBOL(spa_max_replication);
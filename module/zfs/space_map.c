@@ -32,46 +32,10 @@
 #include <sys/zio.h>
 #include <sys/space_map.h>
 
-static kmem_cache_t *space_seg_cache;
-
-void
-space_map_init(void)
-{
-	ASSERT(space_seg_cache == NULL);
-	space_seg_cache = kmem_cache_create("space_seg_cache",
-	    sizeof (space_seg_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
-}
-
-void
-space_map_fini(void)
-{
-	kmem_cache_destroy(space_seg_cache);
-	space_seg_cache = NULL;
-}
-
 /*
  * Space map routines.
  * NOTE: caller is responsible for all locking.
  */
-static int
-space_map_seg_compare(const void *x1, const void *x2)
-{
-	const space_seg_t *s1 = x1;
-	const space_seg_t *s2 = x2;
-
-	if (s1->ss_start < s2->ss_start) {
-		if (s1->ss_end > s2->ss_start)
-			return (0);
-		return (-1);
-	}
-	if (s1->ss_start > s2->ss_start) {
-		if (s1->ss_start < s2->ss_end)
-			return (0);
-		return (1);
-	}
-	return (0);
-}
-
 void
 space_map_create(space_map_t *sm, uint64_t start, uint64_t size, uint8_t shift,
 	kmutex_t *lp)
@@ -80,8 +44,7 @@ space_map_create(space_map_t *sm, uint64_t start, uint64_t size, uint8_t shift,
 
 	cv_init(&sm->sm_load_cv, NULL, CV_DEFAULT, NULL);
 
-	avl_create(&sm->sm_root, space_map_seg_compare,
-	    sizeof (space_seg_t), offsetof(struct space_seg, ss_node));
+	range_tree_create(&sm->sm_rt, NULL, NULL, lp);
 
 	sm->sm_start = start;
 	sm->sm_size = size;
@@ -93,147 +56,45 @@ void
 space_map_destroy(space_map_t *sm)
 {
 	ASSERT(!sm->sm_loaded && !sm->sm_loading);
-	VERIFY0(sm->sm_space);
-	avl_destroy(&sm->sm_root);
+	range_tree_destroy(&sm->sm_rt);
 	cv_destroy(&sm->sm_load_cv);
 }
 
 void
 space_map_add(space_map_t *sm, uint64_t start, uint64_t size)
 {
-	avl_index_t where;
-	space_seg_t *ss_before, *ss_after, *ss;
 	uint64_t end = start + size;
-	int merge_before, merge_after;
 
 	ASSERT(MUTEX_HELD(sm->sm_lock));
 	VERIFY(!sm->sm_condensing);
 	VERIFY(size != 0);
 	VERIFY3U(start, >=, sm->sm_start);
 	VERIFY3U(end, <=, sm->sm_start + sm->sm_size);
-	VERIFY(sm->sm_space + size <= sm->sm_size);
+	VERIFY(sm->sm_rt.rt_space + size <= sm->sm_size);
 	VERIFY(P2PHASE(start, 1ULL << sm->sm_shift) == 0);
 	VERIFY(P2PHASE(size, 1ULL << sm->sm_shift) == 0);
 
-	ss = space_map_find(sm, start, size, &where);
-	if (ss != NULL) {
-		zfs_panic_recover("zfs: allocating allocated segment"
-		    "(offset=%llu size=%llu)\n",
-		    (longlong_t)start, (longlong_t)size);
-		return;
-	}
-
-	/* Make sure we don't overlap with either of our neighbors */
-	VERIFY(ss == NULL);
-
-	ss_before = avl_nearest(&sm->sm_root, where, AVL_BEFORE);
-	ss_after = avl_nearest(&sm->sm_root, where, AVL_AFTER);
-
-	merge_before = (ss_before != NULL && ss_before->ss_end == start);
-	merge_after = (ss_after != NULL && ss_after->ss_start == end);
-
-	if (merge_before && merge_after) {
-		avl_remove(&sm->sm_root, ss_before);
-		if (sm->sm_pp_root) {
-			avl_remove(sm->sm_pp_root, ss_before);
-			avl_remove(sm->sm_pp_root, ss_after);
-		}
-		ss_after->ss_start = ss_before->ss_start;
-		kmem_cache_free(space_seg_cache, ss_before);
-		ss = ss_after;
-	} else if (merge_before) {
-		ss_before->ss_end = end;
-		if (sm->sm_pp_root)
-			avl_remove(sm->sm_pp_root, ss_before);
-		ss = ss_before;
-	} else if (merge_after) {
-		ss_after->ss_start = start;
-		if (sm->sm_pp_root)
-			avl_remove(sm->sm_pp_root, ss_after);
-		ss = ss_after;
-	} else {
-		ss = kmem_cache_alloc(space_seg_cache, KM_PUSHPAGE);
-		ss->ss_start = start;
-		ss->ss_end = end;
-		avl_insert(&sm->sm_root, ss, where);
-	}
-
-	if (sm->sm_pp_root)
-		avl_add(sm->sm_pp_root, ss);
-
-	sm->sm_space += size;
+	range_tree_add(&sm->sm_rt, start, size);
 }
 
 void
 space_map_remove(space_map_t *sm, uint64_t start, uint64_t size)
 {
-	avl_index_t where;
-	space_seg_t *ss, *newseg;
-	uint64_t end = start + size;
-	int left_over, right_over;
-
 	VERIFY(!sm->sm_condensing);
-	ss = space_map_find(sm, start, size, &where);
-
-	/* Make sure we completely overlap with someone */
-	if (ss == NULL) {
-		zfs_panic_recover("zfs: freeing free segment "
-		    "(offset=%llu size=%llu)",
-		    (longlong_t)start, (longlong_t)size);
-		return;
-	}
-	VERIFY3U(ss->ss_start, <=, start);
-	VERIFY3U(ss->ss_end, >=, end);
-	VERIFY(sm->sm_space - size <= sm->sm_size);
-
-	left_over = (ss->ss_start != start);
-	right_over = (ss->ss_end != end);
-
-	if (sm->sm_pp_root)
-		avl_remove(sm->sm_pp_root, ss);
-
-	if (left_over && right_over) {
-		newseg = kmem_cache_alloc(space_seg_cache, KM_PUSHPAGE);
-		newseg->ss_start = end;
-		newseg->ss_end = ss->ss_end;
-		ss->ss_end = start;
-		avl_insert_here(&sm->sm_root, newseg, ss, AVL_AFTER);
-		if (sm->sm_pp_root)
-			avl_add(sm->sm_pp_root, newseg);
-	} else if (left_over) {
-		ss->ss_end = start;
-	} else if (right_over) {
-		ss->ss_start = end;
-	} else {
-		avl_remove(&sm->sm_root, ss);
-		kmem_cache_free(space_seg_cache, ss);
-		ss = NULL;
-	}
-
-	if (sm->sm_pp_root && ss != NULL)
-		avl_add(sm->sm_pp_root, ss);
+	VERIFY(P2PHASE(start, 1ULL << sm->sm_shift) == 0);
+	VERIFY(P2PHASE(size, 1ULL << sm->sm_shift) == 0);
 
-	sm->sm_space -= size;
+	range_tree_remove(&sm->sm_rt, start, size);
 }
 
-space_seg_t *
+range_seg_t *
 space_map_find(space_map_t *sm, uint64_t start, uint64_t size,
     avl_index_t *wherep)
 {
-	space_seg_t ssearch, *ss;
-
-	ASSERT(MUTEX_HELD(sm->sm_lock));
-	VERIFY(size != 0);
 	VERIFY(P2PHASE(start, 1ULL << sm->sm_shift) == 0);
 	VERIFY(P2PHASE(size, 1ULL << sm->sm_shift) == 0);
 
-	ssearch.ss_start = start;
-	ssearch.ss_end = start + size;
-	ss = avl_find(&sm->sm_root, &ssearch, wherep);
-
-	if (ss != NULL && ss->ss_start <= start && ss->ss_end >= start + size)
-		return (ss);
-	return (NULL);
+	return (range_tree_find(&sm->sm_rt, start, size, wherep));
 }
 
 boolean_t
@@ -241,7 +102,7 @@ space_map_contains(space_map_t *sm, uint64_t start, uint64_t size)
 {
 	avl_index_t where;
 
-	return (space_map_find(sm, start, size, &where) != 0);
+	return (space_map_find(sm, start, size, &where) != NULL);
 }
 
 void
@@ -250,8 +111,8 @@ space_map_swap(space_map_t **msrc, space_map_t **mdst)
 	space_map_t *sm;
 
 	ASSERT(MUTEX_HELD((*msrc)->sm_lock));
-	ASSERT0((*mdst)->sm_space);
-	ASSERT0(avl_numnodes(&(*mdst)->sm_root));
+	ASSERT0((*mdst)->sm_rt.rt_space);
+	ASSERT0(range_tree_numsegs(&(*mdst)->sm_rt));
 
 	sm = *msrc;
 	*msrc = *mdst;
@@ -261,28 +122,23 @@ space_map_swap(space_map_t **msrc, space_map_t **mdst)
 void
 space_map_vacate(space_map_t *sm, space_map_func_t *func, space_map_t *mdest)
 {
-	space_seg_t *ss;
-	void *cookie = NULL;
-
 	ASSERT(MUTEX_HELD(sm->sm_lock));
 
-	while ((ss = avl_destroy_nodes(&sm->sm_root, &cookie)) != NULL) {
-		if (func != NULL)
-			func(mdest, ss->ss_start, ss->ss_end - ss->ss_start);
-		kmem_cache_free(space_seg_cache, ss);
-	}
-	sm->sm_space = 0;
+	if (func != NULL)
+		space_map_walk(sm, func, mdest);
+	range_tree_vacate(&sm->sm_rt);
 }
 
 void
 space_map_walk(space_map_t *sm, space_map_func_t *func, space_map_t *mdest)
 {
-	space_seg_t *ss;
+	avl_tree_t *t = &sm->sm_rt.rt_root;
+	range_seg_t *rs;
 
 	ASSERT(MUTEX_HELD(sm->sm_lock));
 
-	for (ss = avl_first(&sm->sm_root); ss; ss = AVL_NEXT(&sm->sm_root, ss))
-		func(mdest, ss->ss_start, ss->ss_end - ss->ss_start);
+	for (rs = avl_first(t); rs != NULL; rs = AVL_NEXT(t, rs))
+		func(mdest, rs->rs_start, rs->rs_end - rs->rs_start);
 }
 
 /*
@@ -321,7 +177,7 @@ space_map_load(space_map_t *sm, space_map_ops_t *ops, uint8_t maptype,
 	space = smo->smo_alloc;
 
 	ASSERT(sm->sm_ops == NULL);
-	VERIFY0(sm->sm_space);
+	VERIFY0(sm->sm_rt.rt_space);
 
 	if (maptype == SM_FREE) {
 		space_map_add(sm, sm->sm_start, sm->sm_size);
@@ -366,7 +222,7 @@ space_map_load(space_map_t *sm, space_map_ops_t *ops, uint8_t maptype,
 	}
 
 	if (error == 0) {
-		VERIFY3U(sm->sm_space, ==, space);
+		VERIFY3U(sm->sm_rt.rt_space, ==, space);
 
 		sm->sm_loaded = B_TRUE;
 		sm->sm_ops = ops;
@@ -439,27 +295,27 @@ space_map_sync(space_map_t *sm, uint8_t maptype,
 	space_map_obj_t *smo, objset_t *os, dmu_tx_t *tx)
 {
 	spa_t *spa = dmu_objset_spa(os);
-	avl_tree_t *t = &sm->sm_root;
-	space_seg_t *ss;
+	avl_tree_t *t = &sm->sm_rt.rt_root;
+	range_seg_t *rs;
 	uint64_t bufsize, start, size, run_len, total, sm_space, nodes;
 	uint64_t *entry, *entry_map, *entry_map_end;
 
 	ASSERT(MUTEX_HELD(sm->sm_lock));
 
-	if (sm->sm_space == 0)
+	if (sm->sm_rt.rt_space == 0)
 		return;
 
-	dprintf("object %4llu, txg %llu, pass %d, %c, count %lu, space %llx\n",
+	dprintf("object %4llu, txg %llu, pass %d, %c, count %llu, space %llx\n",
 	    smo->smo_object, dmu_tx_get_txg(tx), spa_sync_pass(spa),
-	    maptype == SM_ALLOC ? 'A' : 'F', avl_numnodes(&sm->sm_root),
-	    sm->sm_space);
+	    maptype == SM_ALLOC ? 'A' : 'F', range_tree_numsegs(&sm->sm_rt),
+	    sm->sm_rt.rt_space);
 
 	if (maptype == SM_ALLOC)
-		smo->smo_alloc += sm->sm_space;
+		smo->smo_alloc += sm->sm_rt.rt_space;
 	else
-		smo->smo_alloc -= sm->sm_space;
+		smo->smo_alloc -= sm->sm_rt.rt_space;
 
-	bufsize = (8 + avl_numnodes(&sm->sm_root)) * sizeof (uint64_t);
+	bufsize = (8 + range_tree_numsegs(&sm->sm_rt)) * sizeof (uint64_t);
 	bufsize = MIN(bufsize, 1ULL << SPACE_MAP_BLOCKSHIFT);
 	entry_map = zio_buf_alloc(bufsize);
 	entry_map_end = entry_map + (bufsize / sizeof (uint64_t));
@@ -471,11 +327,11 @@ space_map_sync(space_map_t *sm, uint8_t maptype,
 	    SM_DEBUG_TXG_ENCODE(dmu_tx_get_txg(tx));
 
 	total = 0;
-	nodes = avl_numnodes(&sm->sm_root);
-	sm_space = sm->sm_space;
-	for (ss = avl_first(t); ss != NULL; ss = AVL_NEXT(t, ss)) {
-		size = ss->ss_end - ss->ss_start;
-		start = (ss->ss_start - sm->sm_start) >> sm->sm_shift;
+	nodes = range_tree_numsegs(&sm->sm_rt);
+	sm_space = sm->sm_rt.rt_space;
+	for (rs = avl_first(t); rs != NULL; rs = AVL_NEXT(t, rs)) {
+		size = rs->rs_end - rs->rs_start;
+		start = (rs->rs_start - sm->sm_start) >> sm->sm_shift;
 
 		total += size;
 		size >>= sm->sm_shift;
@@ -514,9 +370,9 @@ space_map_sync(space_map_t *sm, uint8_t maptype,
 	 * Ensure that the space_map's accounting wasn't changed
 	 * while we were in the middle of writing it out.
 	 */
-	VERIFY3U(nodes, ==, avl_numnodes(&sm->sm_root));
-	VERIFY3U(sm->sm_space, ==, sm_space);
-	VERIFY3U(sm->sm_space, ==, total);
+	VERIFY3U(nodes, ==, range_tree_numsegs(&sm->sm_rt));
+	VERIFY3U(sm->sm_rt.rt_space, ==, sm_space);
+	VERIFY3U(sm->sm_rt.rt_space, ==, total);
 
 	zio_buf_free(entry_map, bufsize);
 }
@@ -530,6 +386,48 @@ space_map_truncate(space_map_obj_t *smo, objset_t *os, dmu_tx_t *tx)
 	smo->smo_alloc = 0;
 }
 
+/*
+ * Record the size distribution of the map's in-core segments in the
+ * on-disk histogram, which counts sizes in sm_shift units.
+ */
+void
+space_map_histogram_update(space_map_t *sm, space_map_obj_t *smo)
+{
+	int i, idx;
+
+	ASSERT(MUTEX_HELD(sm->sm_lock));
+
+	bzero(smo->smo_histogram, sizeof (smo->smo_histogram));
+
+	for (i = 0; i < RANGE_TREE_HISTOGRAM_SIZE; i++) {
+		if (sm->sm_rt.rt_histogram[i] == 0)
+			continue;
+		ASSERT3U(i, >=, sm->sm_shift);
+		idx = MIN(i - sm->sm_shift, SPACE_MAP_HISTOGRAM_SIZE - 1);
+		smo->smo_histogram[idx] += sm->sm_rt.rt_histogram[i];
+	}
+}
+
+/*
+ * Return an upper bound on the largest free segment recorded in the
+ * on-disk histogram, or the free space if the map has no histogram.
+ */
+uint64_t
+space_map_histogram_max_segsize(space_map_t *sm, space_map_obj_t *smo)
+{
+	uint64_t space = sm->sm_size - smo->smo_alloc;
+	int i;
+
+	for (i = SPACE_MAP_HISTOGRAM_SIZE - 1; i >= 0; i--) {
+		if (smo->smo_histogram[i] == 0)
+			continue;
+		if (i == SPACE_MAP_HISTOGRAM_SIZE - 1)
+			return (space);
+		return (MIN(space, (1ULL << (i + sm->sm_shift + 1)) - 1));
+	}
+	return (space);
+}
+
 /*
  * Space map reference trees.
  *
@@ -615,12 +513,13 @@ space_map_ref_add_seg(avl_tree_t *t, uint64_t start, uint64_t end,
 void
 space_map_ref_add_map(avl_tree_t *t, space_map_t *sm, int64_t refcnt)
 {
-	space_seg_t *ss;
+	range_seg_t *rs;
 
 	ASSERT(MUTEX_HELD(sm->sm_lock));
 
-	for (ss = avl_first(&sm->sm_root); ss; ss = AVL_NEXT(&sm->sm_root, ss))
-		space_map_ref_add_seg(t, ss->ss_start, ss->ss_end, refcnt);
+	for (rs = avl_first(&sm->sm_rt.rt_root); rs != NULL;
+	    rs = AVL_NEXT(&sm->sm_rt.rt_root, rs))
+		space_map_ref_add_seg(t, rs->rs_start, rs->rs_end, refcnt);
 }
 
 /*
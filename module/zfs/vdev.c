@@ -37,12 +37,14 @@
 #include <sys/metaslab_impl.h>
 #include <sys/space_map.h>
 #include <sys/zio.h>
+#include <sys/abd.h>
 #include <sys/zap.h>
 #include <sys/fs/zfs.h>
 #include <sys/arc.h>
 #include <sys/zil.h>
 #include <sys/dsl_scan.h>
 #include <sys/zvol.h>
+#include <sys/zfeature.h>
 
 /*
  * Virtual device management.
@@ -322,6 +324,7 @@ vdev_alloc_common(spa_t *spa, uint_t id, uint64_t guid, vdev_ops_t *ops)
 	mutex_init(&vd->vdev_dtl_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&vd->vdev_stat_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&vd->vdev_probe_lock, NULL, MUTEX_DEFAULT, NULL);
+	mutex_init(&vd->vdev_scan_io_queue_lock, NULL, MUTEX_DEFAULT, NULL);
 	for (t = 0; t < DTL_TYPES; t++) {
 		space_map_create(&vd->vdev_dtl[t], 0, -1ULL, 0,
 		    &vd->vdev_dtl_lock);
@@ -608,6 +611,16 @@ vdev_free(vdev_t *vd)
 
 	ASSERT(vd->vdev_parent == NULL);
 
+	/*
+	 * Drop any scan reads still queued for this vdev.
+	 */
+	if (vd->vdev_scan_io_queue != NULL) {
+		mutex_enter(&vd->vdev_scan_io_queue_lock);
+		dsl_scan_io_queue_destroy(vd->vdev_scan_io_queue);
+		vd->vdev_scan_io_queue = NULL;
+		mutex_exit(&vd->vdev_scan_io_queue_lock);
+	}
+
 	/*
 	 * Clean up vdev structure.
 	 */
@@ -641,6 +654,7 @@ vdev_free(vdev_t *vd)
 	mutex_destroy(&vd->vdev_dtl_lock);
 	mutex_destroy(&vd->vdev_stat_lock);
 	mutex_destroy(&vd->vdev_probe_lock);
+	mutex_destroy(&vd->vdev_scan_io_queue_lock);
 
 	if (vd == spa->spa_root_vdev)
 		spa->spa_root_vdev = NULL;
@@ -860,8 +874,9 @@ vdev_metaslab_init(vdev_t *vd, uint64_t txg)
 				error = dmu_bonus_hold(mos, object, FTAG, &db);
 				if (error)
 					return (error);
-				ASSERT3U(db->db_size, >=, sizeof (smo));
-				bcopy(db->db_data, &smo, sizeof (smo));
+				ASSERT3U(db->db_size, >=, SPACE_MAP_SIZE_V0);
+				bcopy(db->db_data, &smo,
+				    MIN(db->db_size, sizeof (smo)));
 				ASSERT3U(smo.smo_object, ==, object);
 				dmu_buf_rele(db, FTAG);
 			}
@@ -925,16 +940,16 @@ vdev_probe_done(zio_t *zio)
 			vps->vps_readable = 1;
 		if (zio->io_error == 0 && spa_writeable(spa)) {
 			zio_nowait(zio_write_phys(vd->vdev_probe_zio, vd,
-			    zio->io_offset, zio->io_size, zio->io_data,
+			    zio->io_offset, zio->io_size, zio->io_abd,
 			    ZIO_CHECKSUM_OFF, vdev_probe_done, vps,
 			    ZIO_PRIORITY_SYNC_WRITE, vps->vps_flags, B_TRUE));
 		} else {
-			zio_buf_free(zio->io_data, zio->io_size);
+			abd_free(zio->io_abd);
 		}
 	} else if (zio->io_type == ZIO_TYPE_WRITE) {
 		if (zio->io_error == 0)
 			vps->vps_writeable = 1;
-		zio_buf_free(zio->io_data, zio->io_size);
+		abd_free(zio->io_abd);
 	} else if (zio->io_type == ZIO_TYPE_NULL) {
 		zio_t *pio;
 
@@ -1049,7 +1064,7 @@ vdev_probe(vdev_t *vd, zio_t *zio)
 		zio_nowait(zio_read_phys(pio, vd,
 		    vdev_label_offset(vd->vdev_psize, l,
 		    offsetof(vdev_label_t, vl_pad2)),
-		    VDEV_PAD_SIZE, zio_buf_alloc(VDEV_PAD_SIZE),
+		    VDEV_PAD_SIZE, abd_alloc_for_io(VDEV_PAD_SIZE, B_TRUE),
 		    ZIO_CHECKSUM_OFF, vdev_probe_done, vps,
 		    ZIO_PRIORITY_SYNC_READ, vps->vps_flags, B_TRUE));
 	}
@@ -1106,16 +1121,20 @@ vdev_open_children(vdev_t *vd)
 		for (c = 0; c < children; c++)
 			vd->vdev_child[c]->vdev_open_error =
 			    vdev_open(vd->vdev_child[c]);
-		return;
+	} else {
+		tq = taskq_create("vdev_open", children, minclsyspri,
+		    children, children, TASKQ_PREPOPULATE);
+
+		for (c = 0; c < children; c++)
+			VERIFY(taskq_dispatch(tq, vdev_open_child,
+			    vd->vdev_child[c], TQ_SLEEP) != 0);
+
+		taskq_destroy(tq);
 	}
-	tq = taskq_create("vdev_open", children, minclsyspri,
-	    children, children, TASKQ_PREPOPULATE);
 
+	vd->vdev_nonrot = B_TRUE;
 	for (c = 0; c < children; c++)
-		VERIFY(taskq_dispatch(tq, vdev_open_child, vd->vdev_child[c],
-		    TQ_SLEEP) != 0);
-
-	taskq_destroy(tq);
+		vd->vdev_nonrot &= vd->vdev_child[c]->vdev_nonrot;
 }
 
 /*
@@ -1661,7 +1680,7 @@ vdev_dtl_contains(vdev_t *vd, vdev_dtl_type_t t, uint64_t txg, uint64_t size)
 	ASSERT(vd != vd->vdev_spa->spa_root_vdev);
 
 	mutex_enter(sm->sm_lock);
-	if (sm->sm_space != 0)
+	if (sm->sm_rt.rt_space != 0)
 		dirty = space_map_contains(sm, txg, size);
 	mutex_exit(sm->sm_lock);
 
@@ -1675,7 +1694,7 @@ vdev_dtl_empty(vdev_t *vd, vdev_dtl_type_t t)
 	boolean_t empty;
 
 	mutex_enter(sm->sm_lock);
-	empty = (sm->sm_space == 0);
+	empty = (sm->sm_rt.rt_space == 0);
 	mutex_exit(sm->sm_lock);
 
 	return (empty);
@@ -1796,8 +1815,8 @@ vdev_dtl_load(vdev_t *vd)
 	if ((error = dmu_bonus_hold(mos, smo->smo_object, FTAG, &db)) != 0)
 		return (error);
 
-	ASSERT3U(db->db_size, >=, sizeof (*smo));
-	bcopy(db->db_data, smo, sizeof (*smo));
+	ASSERT3U(db->db_size, >=, SPACE_MAP_SIZE_V0);
+	bcopy(db->db_data, smo, SPACE_MAP_SIZE_V0);
 	dmu_buf_rele(db, FTAG);
 
 	mutex_enter(&vd->vdev_dtl_lock);
@@ -1838,7 +1857,7 @@ vdev_dtl_sync(vdev_t *vd, uint64_t txg)
 		ASSERT(smo->smo_alloc == 0);
 		smo->smo_object = dmu_object_alloc(mos,
 		    DMU_OT_SPACE_MAP, 1 << SPACE_MAP_BLOCKSHIFT,
-		    DMU_OT_SPACE_MAP_HEADER, sizeof (*smo), tx);
+		    DMU_OT_SPACE_MAP_HEADER, SPACE_MAP_SIZE_V0, tx);
 		ASSERT(smo->smo_object != 0);
 		vdev_config_dirty(vd->vdev_top);
 	}
@@ -1865,8 +1884,8 @@ vdev_dtl_sync(vdev_t *vd, uint64_t txg)
 
 	VERIFY(0 == dmu_bonus_hold(mos, smo->smo_object, FTAG, &db));
 	dmu_buf_will_dirty(db, tx);
-	ASSERT3U(db->db_size, >=, sizeof (*smo));
-	bcopy(smo, db->db_data, sizeof (*smo));
+	ASSERT3U(db->db_size, >=, SPACE_MAP_SIZE_V0);
+	bcopy(smo, db->db_data, SPACE_MAP_SIZE_V0);
 	dmu_buf_rele(db, FTAG);
 
 	dmu_tx_commit(tx);
@@ -1919,14 +1938,16 @@ vdev_resilver_needed(vdev_t *vd, uint64_t *minp, uint64_t *maxp)
 
 	if (vd->vdev_children == 0) {
 		mutex_enter(&vd->vdev_dtl_lock);
-		if (vd->vdev_dtl[DTL_MISSING].sm_space != 0 &&
+		if (vd->vdev_dtl[DTL_MISSING].sm_rt.rt_space != 0 &&
 		    vdev_writeable(vd)) {
-			space_seg_t *ss;
-
-			ss = avl_first(&vd->vdev_dtl[DTL_MISSING].sm_root);
-			thismin = ss->ss_start - 1;
-			ss = avl_last(&vd->vdev_dtl[DTL_MISSING].sm_root);
-			thismax = ss->ss_end;
+			space_map_t *sm = &vd->vdev_dtl[DTL_MISSING];
+			avl_tree_t *t = &sm->sm_rt.rt_root;
+			range_seg_t *rs;
+
+			rs = avl_first(t);
+			thismin = rs->rs_start - 1;
+			rs = avl_last(t);
+			thismax = rs->rs_end;
 			needed = B_TRUE;
 		}
 		mutex_exit(&vd->vdev_dtl_lock);
@@ -2020,6 +2041,21 @@ vdev_validate_aux(vdev_t *vd)
 	return (0);
 }
 
+/*
+ * Drop the spacemap_histogram reference held by a metaslab's space map
+ * object that is about to be freed, if it has a histogram.
+ */
+static void
+vdev_metaslab_histogram_decr(spa_t *spa, uint64_t object, dmu_tx_t *tx)
+{
+	dmu_object_info_t doi;
+
+	if (dmu_object_info(spa->spa_meta_objset, object, &doi) == 0 &&
+	    doi.doi_bonus_size == sizeof (space_map_obj_t))
+		spa_feature_decr(spa,
+		    &spa_feature_table[SPA_FEATURE_SPACEMAP_HISTOGRAM], tx);
+}
+
 void
 vdev_remove(vdev_t *vd, uint64_t txg)
 {
@@ -2043,7 +2079,16 @@ vdev_remove(vdev_t *vd, uint64_t txg)
 			if (msp == NULL || msp->ms_smo.smo_object == 0)
 				continue;
 
-			ASSERT0(msp->ms_smo.smo_alloc);
+			/*
+			 * The vdev is empty, so whatever the space map log
+			 * still holds for it nets out to nothing.
+			 */
+			ASSERT0(msp->ms_allocated);
+			mutex_enter(&msp->ms_lock);
+			metaslab_unflushed_drop(msp);
+			mutex_exit(&msp->ms_lock);
+			vdev_metaslab_histogram_decr(spa,
+			    msp->ms_smo.smo_object, tx);
 			(void) dmu_object_free(mos, msp->ms_smo.smo_object, tx);
 			msp->ms_smo.smo_object = 0;
 		}
@@ -3209,7 +3254,7 @@ vdev_deadman(vdev_t *vd)
 		vdev_queue_t *vq = &vd->vdev_queue;
 
 		mutex_enter(&vq->vq_lock);
-		if (avl_numnodes(&vq->vq_pending_tree) > 0) {
+		if (avl_numnodes(&vq->vq_active_tree) > 0) {
 			spa_t *spa = vd->vdev_spa;
 			zio_t *fio;
 			uint64_t delta;
@@ -3219,7 +3264,7 @@ vdev_deadman(vdev_t *vd)
 			 * if any I/O has been outstanding for longer than
 			 * the spa_deadman_synctime we log a zevent.
 			 */
-			fio = avl_first(&vq->vq_pending_tree);
+			fio = avl_first(&vq->vq_active_tree);
 			delta = gethrtime() - fio->io_timestamp;
 			if (delta > spa_deadman_synctime(spa)) {
 				zfs_dbgmsg("SLOW IO: zio timestamp %lluns, "
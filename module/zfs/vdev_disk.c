@@ -31,6 +31,7 @@
 #include <sys/vdev_impl.h>
 #include <sys/fs/zfs.h>
 #include <sys/zio.h>
+#include <sys/abd.h>
 #ifdef __APPLE__
 #include <sys/mount.h>
 #else
@@ -140,6 +141,21 @@ vdev_disk_open(vdev_t *vd, uint64_t *size, uint64_t *max_size, uint64_t *ashift)
 	}
 	*size = blkcnt * (uint64_t)blksize;
 
+	/*
+	 * Solid state devices don't pay for seeks, which mirrors take into
+	 * account when choosing a child to read from.
+	 */
+	vd->vdev_nonrot = B_FALSE;
+#ifdef DKIOCISSOLIDSTATE
+	{
+		uint32_t ssd = 0;
+
+		if (VNOP_IOCTL(devvp, DKIOCISSOLIDSTATE, (caddr_t)&ssd, 0,
+		    context) == 0 && ssd != 0)
+			vd->vdev_nonrot = B_TRUE;
+	}
+#endif
+
 	/*
 	 *  ### APPLE TODO ###
 	 * If we own the whole disk, try to enable disk write caching.
@@ -211,12 +227,23 @@ static void
 vdev_disk_io_intr(struct buf *bp, void *arg)
 {
 	zio_t *zio = (zio_t *)arg;
+	void *data = (void *)buf_dataptr(bp);
 
     zio->io_error = buf_error(bp);
 
 	if (zio->io_error == 0 && buf_resid(bp) != 0) {
 		zio->io_error = EIO;
 	}
+
+	/*
+	 * The strategy routine needs a flat buffer, so the data was borrowed
+	 * from the (possibly scattered) ABD; hand it back.
+	 */
+	if (zio->io_type == ZIO_TYPE_READ)
+		abd_return_buf_copy(zio->io_abd, data, zio->io_size);
+	else
+		abd_return_buf(zio->io_abd, data, zio->io_size);
+
 	buf_free(bp);
 	//zio_next_stage_async(zio);
     zio_interrupt(zio);
@@ -240,6 +267,7 @@ vdev_disk_io_start(zio_t *zio)
 	vdev_disk_t *dvd = vd->vdev_tsd;
 	struct buf *bp;
 	vfs_context_t context;
+	void *data;
 	int flags, error = 0;
 
 	if (zio->io_type == ZIO_TYPE_IOCTL) {
@@ -336,12 +364,17 @@ vdev_disk_io_start(zio_t *zio)
 	bp = buf_alloc(dvd->vd_devvp);
 
 	ASSERT(bp != NULL);
-	ASSERT(zio->io_data != NULL);
+	ASSERT(zio->io_abd != NULL);
 	ASSERT(zio->io_size != 0);
 
+	if (zio->io_type == ZIO_TYPE_READ)
+		data = abd_borrow_buf(zio->io_abd, zio->io_size);
+	else
+		data = abd_borrow_buf_copy(zio->io_abd, zio->io_size);
+
 	buf_setflags(bp, flags);
 	buf_setcount(bp, zio->io_size);
-	buf_setdataptr(bp, (uintptr_t)zio->io_data);
+	buf_setdataptr(bp, (uintptr_t)data);
     if (dvd->vd_ashift) {
         buf_setlblkno(bp, zio->io_offset>>dvd->vd_ashift);
         buf_setblkno(bp,  zio->io_offset>>dvd->vd_ashift);
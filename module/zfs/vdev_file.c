@@ -29,6 +29,7 @@
 #include <sys/vdev_file.h>
 #include <sys/vdev_impl.h>
 #include <sys/zio.h>
+#include <sys/abd.h>
 #include <sys/fs/zfs.h>
 #include <sys/fm/fs/zfs.h>
 #include <sys/vnode.h>
@@ -38,6 +39,17 @@
  * Virtual device vector for files.
  */
 
+/*
+ * Reads and writes to a file block the thread issuing them, so each file
+ * vdev has a taskq of its own to issue them from, keeping up to
+ * zfs_vdev_file_threads of them in flight.  Flushes go through the same
+ * taskq; by the time the pipeline issues one, the writes it has to cover
+ * have completed.  With zfs_vdev_file_async clear, or if the taskq could
+ * not be created, I/O is done inline by the thread starting it.
+ */
+int zfs_vdev_file_async = B_TRUE;
+int zfs_vdev_file_threads = 16;
+
 static void
 vdev_file_hold(vdev_t *vd)
 {
@@ -61,6 +73,7 @@ vdev_file_open(vdev_t *vd, uint64_t *psize, uint64_t *max_psize,
 	static vattr_t vattr;
 	vdev_file_t *vf;
 	struct vnode *vp;
+	taskq_t *tq = NULL;
 	int error = 0;
     struct vnode *rootdir;
 
@@ -88,7 +101,22 @@ vdev_file_open(vdev_t *vd, uint64_t *psize, uint64_t *max_psize,
 	}
 #endif
 
+#ifndef _KERNEL
+	/* Userland opens the file again on a reopen; keep the taskq. */
+	if (vd->vdev_tsd != NULL) {
+		ASSERT(vd->vdev_reopening);
+		tq = ((vdev_file_t *)vd->vdev_tsd)->vf_taskq;
+		kmem_free(vd->vdev_tsd, sizeof (vdev_file_t));
+	}
+#endif
+	if (tq == NULL) {
+		tq = taskq_create("vdev_file_taskq",
+		    MAX(zfs_vdev_file_threads, 1), maxclsyspri,
+		    MAX(zfs_vdev_file_threads, 1), INT_MAX, TASKQ_PREPOPULATE);
+	}
+
 	vf = vd->vdev_tsd = kmem_zalloc(sizeof (vdev_file_t), KM_PUSHPAGE);
+	vf->vf_taskq = tq;
 
 	/*
 	 * We always open the files from the root of the global zone, even if
@@ -163,6 +191,9 @@ skip_open:
 
 	*max_psize = *psize = vattr.va_size;
 
+	/* There is no telling what is under a file; don't add seek costs. */
+	vd->vdev_nonrot = B_TRUE;
+
 
     if (1) {
         *ashift = SPA_MINBLOCKSHIFT;
@@ -185,6 +216,10 @@ vdev_file_close(vdev_t *vd)
 	if (vd->vdev_reopening || vf == NULL)
 		return;
 
+	/* Wait for the I/O still in flight. */
+	if (vf->vf_taskq != NULL)
+		taskq_destroy(vf->vf_taskq);
+
 	if (vf->vf_vnode != NULL) {
         vnode_getwithvid(vf->vf_vnode, vf->vf_vid);
         // Also commented out in MacZFS
@@ -198,13 +233,65 @@ vdev_file_close(vdev_t *vd)
 	vd->vdev_tsd = NULL;
 }
 
-static int
-vdev_file_io_start(zio_t *zio)
+static void
+vdev_file_io_strategy(void *arg)
 {
+    zio_t *zio = arg;
     vdev_t *vd = zio->io_vd;
     vdev_file_t *vf = vd->vdev_tsd;
     ssize_t resid = 0;
+    void *data;
+
+    if (zio->io_type == ZIO_TYPE_READ)
+        data = abd_borrow_buf(zio->io_abd, zio->io_size);
+    else
+        data = abd_borrow_buf_copy(zio->io_abd, zio->io_size);
 
+    vnode_getwithvid(vf->vf_vnode, vf->vf_vid);
+    zio->io_error = vn_rdwr(zio->io_type == ZIO_TYPE_READ ?
+                            UIO_READ : UIO_WRITE, vf->vf_vnode, data,
+                            zio->io_size, zio->io_offset, UIO_SYSSPACE,
+                            0, RLIM64_INFINITY, kcred, &resid);
+    vnode_put(vf->vf_vnode);
+
+    if (zio->io_type == ZIO_TYPE_READ)
+        abd_return_buf_copy(zio->io_abd, data, zio->io_size);
+    else
+        abd_return_buf(zio->io_abd, data, zio->io_size);
+
+    if (resid != 0 && zio->io_error == 0)
+        zio->io_error = ENOSPC;
+
+    zio_interrupt(zio);
+}
+
+static int
+vdev_file_io_fsync(zio_t *zio)
+{
+    vdev_file_t *vf = zio->io_vd->vdev_tsd;
+    int error;
+
+    vnode_getwithvid(vf->vf_vnode, vf->vf_vid);
+    error = VOP_FSYNC(vf->vf_vnode, FSYNC | FDSYNC, kcred, NULL);
+    vnode_put(vf->vf_vnode);
+    return (error);
+}
+
+static void
+vdev_file_io_fsync_task(void *arg)
+{
+    zio_t *zio = arg;
+
+    zio->io_error = vdev_file_io_fsync(zio);
+    zio_interrupt(zio);
+}
+
+static int
+vdev_file_io_start(zio_t *zio)
+{
+    vdev_t *vd = zio->io_vd;
+    vdev_file_t *vf = vd->vdev_tsd;
+    boolean_t async = (zfs_vdev_file_async && vf->vf_taskq != NULL);
 
     if (zio->io_type == ZIO_TYPE_IOCTL) {
 
@@ -215,11 +302,13 @@ vdev_file_io_start(zio_t *zio)
 
         switch (zio->io_cmd) {
         case DKIOCFLUSHWRITECACHE:
-            vnode_getwithvid(vf->vf_vnode, vf->vf_vid);
-            zio->io_error = VOP_FSYNC(vf->vf_vnode, FSYNC | FDSYNC,
-                                      kcred, NULL);
-            vnode_put(vf->vf_vnode);
-                        break;
+            if (async) {
+                VERIFY(taskq_dispatch(vf->vf_taskq,
+                    vdev_file_io_fsync_task, zio, TQ_SLEEP) != 0);
+                return (ZIO_PIPELINE_STOP);
+            }
+            zio->io_error = vdev_file_io_fsync(zio);
+            break;
         default:
             zio->io_error = ENOTSUP;
         }
@@ -227,18 +316,12 @@ vdev_file_io_start(zio_t *zio)
         return (ZIO_PIPELINE_CONTINUE);
     }
 
-    vnode_getwithvid(vf->vf_vnode, vf->vf_vid);
-    zio->io_error = vn_rdwr(zio->io_type == ZIO_TYPE_READ ?
-                            UIO_READ : UIO_WRITE, vf->vf_vnode, zio->io_data,
-                            zio->io_size, zio->io_offset, UIO_SYSSPACE,
-                            0, RLIM64_INFINITY, kcred, &resid);
-    vnode_put(vf->vf_vnode);
-
-
-    if (resid != 0 && zio->io_error == 0)
-        zio->io_error = ENOSPC;
-
-    zio_interrupt(zio);
+    if (async) {
+        VERIFY(taskq_dispatch(vf->vf_taskq, vdev_file_io_strategy, zio,
+            TQ_SLEEP) != 0);
+    } else {
+        vdev_file_io_strategy(zio);
+    }
 
     return (ZIO_PIPELINE_STOP);
 }
@@ -282,3 +365,11 @@ vdev_ops_t vdev_disk_ops = {
 };
 
 #endif
+
+#if defined(_KERNEL) && defined(HAVE_SPL)
+module_param(zfs_vdev_file_async, int, 0644);
+MODULE_PARM_DESC(zfs_vdev_file_async, "Issue file vdev I/O from a taskq");
+
+module_param(zfs_vdev_file_threads, int, 0644);
+MODULE_PARM_DESC(zfs_vdev_file_threads, "Threads issuing each file's I/O");
+#endif
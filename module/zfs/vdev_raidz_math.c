@@ -0,0 +1,474 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/vdev_raidz.h>
+
+/*
+ * RAID-Z parity math engines; see sys/vdev_raidz.h for the operations an
+ * engine provides.  This file holds the scalar engine, which is the
+ * original 64-bit-at-a-time code, the dispatch wrappers used by
+ * vdev_raidz.c, and the load time self-test and benchmark which pick the
+ * engine to use.
+ */
+
+static void
+vdev_raidz_scalar_xor(void *dst, const void *src, size_t size)
+{
+	uint64_t *d = dst;
+	const uint64_t *s = src;
+	size_t i;
+
+	for (i = 0; i < size / sizeof (uint64_t); i++)
+		d[i] ^= s[i];
+}
+
+static void
+vdev_raidz_scalar_mul2_xor(void *dst, const void *src, size_t size)
+{
+	uint64_t *d = dst;
+	const uint64_t *s = src;
+	uint64_t mask;
+	size_t i;
+
+	for (i = 0; i < size / sizeof (uint64_t); i++) {
+		VDEV_RAIDZ_64MUL_2(d[i], mask);
+		d[i] ^= s[i];
+	}
+}
+
+static void
+vdev_raidz_scalar_mul4_xor(void *dst, const void *src, size_t size)
+{
+	uint64_t *d = dst;
+	const uint64_t *s = src;
+	uint64_t mask;
+	size_t i;
+
+	for (i = 0; i < size / sizeof (uint64_t); i++) {
+		VDEV_RAIDZ_64MUL_4(d[i], mask);
+		d[i] ^= s[i];
+	}
+}
+
+static void
+vdev_raidz_scalar_mul(void *dst, const void *src, uint8_t c, size_t size)
+{
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+	int log, exp;
+	size_t i;
+
+	if (c == 0) {
+		bzero(dst, size);
+		return;
+	}
+
+	log = vdev_raidz_log2[c];
+	for (i = 0; i < size; i++) {
+		if (s[i] == 0) {
+			d[i] = 0;
+			continue;
+		}
+		if ((exp = vdev_raidz_log2[s[i]] + log) >= 255)
+			exp -= 255;
+		d[i] = vdev_raidz_pow2[exp];
+	}
+}
+
+static void
+vdev_raidz_scalar_mul_xor(void *dst, const void *src, uint8_t c, size_t size)
+{
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+	int log, exp;
+	size_t i;
+
+	if (c == 0)
+		return;
+
+	log = vdev_raidz_log2[c];
+	for (i = 0; i < size; i++) {
+		if (s[i] == 0)
+			continue;
+		if ((exp = vdev_raidz_log2[s[i]] + log) >= 255)
+			exp -= 255;
+		d[i] ^= vdev_raidz_pow2[exp];
+	}
+}
+
+static boolean_t
+vdev_raidz_scalar_valid(void)
+{
+	return (B_TRUE);
+}
+
+const raidz_math_ops_t vdev_raidz_scalar_ops = {
+	.rmo_xor = vdev_raidz_scalar_xor,
+	.rmo_mul2_xor = vdev_raidz_scalar_mul2_xor,
+	.rmo_mul4_xor = vdev_raidz_scalar_mul4_xor,
+	.rmo_mul = vdev_raidz_scalar_mul,
+	.rmo_mul_xor = vdev_raidz_scalar_mul_xor,
+	.rmo_valid = vdev_raidz_scalar_valid,
+	.rmo_name = "scalar"
+};
+
+static const raidz_math_ops_t *vdev_raidz_impls[] = {
+	&vdev_raidz_scalar_ops,
+#if defined(__x86_64) || defined(__x86_64__) || defined(__i386)
+	&vdev_raidz_ssse3_ops,
+	&vdev_raidz_avx2_ops,
+#endif
+};
+
+#define	RAIDZ_IMPL_COUNT	\
+	(sizeof (vdev_raidz_impls) / sizeof (vdev_raidz_impls[0]))
+
+static boolean_t vdev_raidz_supported[RAIDZ_IMPL_COUNT];
+static const raidz_math_ops_t *vdev_raidz_fastest = &vdev_raidz_scalar_ops;
+static const raidz_math_ops_t *vdev_raidz_selected = &vdev_raidz_scalar_ops;
+
+/*
+ * Name of the parity engine to use, or "fastest" for the benchmark winner.
+ */
+char zfs_vdev_raidz_impl[16] = "fastest";
+
+void
+vdev_raidz_math_mul_tables(uint8_t c, uint8_t *lo, uint8_t *hi)
+{
+	int i;
+
+	for (i = 0; i < 16; i++) {
+		lo[i] = (c == 0 || i == 0) ? 0 : vdev_raidz_pow2[
+		    (vdev_raidz_log2[c] + vdev_raidz_log2[i]) % 255];
+		hi[i] = (c == 0 || i == 0) ? 0 : vdev_raidz_pow2[
+		    (vdev_raidz_log2[c] + vdev_raidz_log2[i << 4]) % 255];
+	}
+}
+
+/*
+ * Dispatch wrappers.  The engine handles the RAIDZ_MATH_BLOCKSIZE aligned
+ * part of the buffer and the scalar code finishes the rest, which in
+ * practice is never more than a partial sector.
+ */
+#define	RAIDZ_MATH_SPLIT(size, head, tail)				\
+	(head) = P2ALIGN((size), RAIDZ_MATH_BLOCKSIZE);			\
+	(tail) = (size) - (head);
+
+void
+vdev_raidz_math_xor(void *dst, const void *src, size_t size)
+{
+	const raidz_math_ops_t *ops = vdev_raidz_selected;
+	size_t head, tail;
+
+	RAIDZ_MATH_SPLIT(size, head, tail);
+	if (head != 0)
+		ops->rmo_xor(dst, src, head);
+	if (tail != 0)
+		vdev_raidz_scalar_xor((char *)dst + head,
+		    (const char *)src + head, tail);
+}
+
+void
+vdev_raidz_math_mul2_xor(void *dst, const void *src, size_t size)
+{
+	const raidz_math_ops_t *ops = vdev_raidz_selected;
+	size_t head, tail;
+
+	RAIDZ_MATH_SPLIT(size, head, tail);
+	if (head != 0)
+		ops->rmo_mul2_xor(dst, src, head);
+	if (tail != 0)
+		vdev_raidz_scalar_mul2_xor((char *)dst + head,
+		    (const char *)src + head, tail);
+}
+
+void
+vdev_raidz_math_mul4_xor(void *dst, const void *src, size_t size)
+{
+	const raidz_math_ops_t *ops = vdev_raidz_selected;
+	size_t head, tail;
+
+	RAIDZ_MATH_SPLIT(size, head, tail);
+	if (head != 0)
+		ops->rmo_mul4_xor(dst, src, head);
+	if (tail != 0)
+		vdev_raidz_scalar_mul4_xor((char *)dst + head,
+		    (const char *)src + head, tail);
+}
+
+void
+vdev_raidz_math_mul(void *dst, const void *src, uint8_t c, size_t size)
+{
+	const raidz_math_ops_t *ops = vdev_raidz_selected;
+	size_t head, tail;
+
+	RAIDZ_MATH_SPLIT(size, head, tail);
+	if (head != 0)
+		ops->rmo_mul(dst, src, c, head);
+	if (tail != 0)
+		vdev_raidz_scalar_mul((char *)dst + head,
+		    (const char *)src + head, c, tail);
+}
+
+void
+vdev_raidz_math_mul_xor(void *dst, const void *src, uint8_t c, size_t size)
+{
+	const raidz_math_ops_t *ops = vdev_raidz_selected;
+	size_t head, tail;
+
+	RAIDZ_MATH_SPLIT(size, head, tail);
+	if (head != 0)
+		ops->rmo_mul_xor(dst, src, c, head);
+	if (tail != 0)
+		vdev_raidz_scalar_mul_xor((char *)dst + head,
+		    (const char *)src + head, c, tail);
+}
+
+int
+vdev_raidz_impl_set(const char *name)
+{
+	int i;
+
+	if (strcmp(name, "fastest") == 0) {
+		vdev_raidz_selected = vdev_raidz_fastest;
+		(void) strlcpy(zfs_vdev_raidz_impl, name,
+		    sizeof (zfs_vdev_raidz_impl));
+		return (0);
+	}
+
+	for (i = 0; i < RAIDZ_IMPL_COUNT; i++) {
+		if (strcmp(name, vdev_raidz_impls[i]->rmo_name) != 0)
+			continue;
+		if (!vdev_raidz_supported[i])
+			return (ENOTSUP);
+		vdev_raidz_selected = vdev_raidz_impls[i];
+		(void) strlcpy(zfs_vdev_raidz_impl, name,
+		    sizeof (zfs_vdev_raidz_impl));
+		return (0);
+	}
+
+	return (EINVAL);
+}
+
+/*
+ * Self-test.  Every operation of an engine is run against the scalar
+ * engine over the same random input, for a range of multipliers, and the
+ * engine is disabled if any byte differs.
+ */
+#define	RAIDZ_TEST_SIZE		(4 * 1024)
+
+static boolean_t
+vdev_raidz_math_selftest(const raidz_math_ops_t *ops, const uint8_t *src,
+    const uint8_t *init, uint8_t *ref, uint8_t *dst)
+{
+	static const uint8_t consts[] = { 0, 1, 2, 3, 0x1d, 0x80, 0x8e, 0xff };
+	int i;
+
+#define	RAIDZ_TEST_XOR(op)						\
+	bcopy(init, ref, RAIDZ_TEST_SIZE);				\
+	bcopy(init, dst, RAIDZ_TEST_SIZE);				\
+	vdev_raidz_scalar_ops.op(ref, src, RAIDZ_TEST_SIZE);		\
+	ops->op(dst, src, RAIDZ_TEST_SIZE);				\
+	if (bcmp(ref, dst, RAIDZ_TEST_SIZE) != 0)			\
+		return (B_FALSE);
+
+#define	RAIDZ_TEST_MUL(op, c)						\
+	bcopy(init, ref, RAIDZ_TEST_SIZE);				\
+	bcopy(init, dst, RAIDZ_TEST_SIZE);				\
+	vdev_raidz_scalar_ops.op(ref, src, c, RAIDZ_TEST_SIZE);		\
+	ops->op(dst, src, c, RAIDZ_TEST_SIZE);				\
+	if (bcmp(ref, dst, RAIDZ_TEST_SIZE) != 0)			\
+		return (B_FALSE);
+
+	RAIDZ_TEST_XOR(rmo_xor);
+	RAIDZ_TEST_XOR(rmo_mul2_xor);
+	RAIDZ_TEST_XOR(rmo_mul4_xor);
+
+	for (i = 0; i < sizeof (consts); i++) {
+		RAIDZ_TEST_MUL(rmo_mul, consts[i]);
+		RAIDZ_TEST_MUL(rmo_mul_xor, consts[i]);
+	}
+
+	/* In-place multiplication, as used by Q-only reconstruction. */
+	bcopy(src, ref, RAIDZ_TEST_SIZE);
+	bcopy(src, dst, RAIDZ_TEST_SIZE);
+	vdev_raidz_scalar_ops.rmo_mul(ref, ref, 0x8e, RAIDZ_TEST_SIZE);
+	ops->rmo_mul(dst, dst, 0x8e, RAIDZ_TEST_SIZE);
+	if (bcmp(ref, dst, RAIDZ_TEST_SIZE) != 0)
+		return (B_FALSE);
+
+#undef	RAIDZ_TEST_XOR
+#undef	RAIDZ_TEST_MUL
+
+	return (B_TRUE);
+}
+
+/*
+ * Benchmark results in MB/s.  "gen" is the cost of folding one data column
+ * into P and Q, "rec" the cost of one multiply-accumulate as done by
+ * reconstruction.
+ */
+typedef struct vdev_raidz_stats {
+	kstat_named_t rzstat_fastest;
+	kstat_named_t rzstat_bench[RAIDZ_IMPL_COUNT][2];
+} vdev_raidz_stats_t;
+
+static vdev_raidz_stats_t vdev_raidz_stats;
+static kstat_t *vdev_raidz_ksp;
+
+#define	RAIDZ_BENCH_SIZE	(64 * 1024)
+#define	RAIDZ_BENCH_NS		(NANOSEC / MILLISEC)
+
+static uint64_t
+vdev_raidz_math_bench(const raidz_math_ops_t *ops, uint8_t *p, uint8_t *q,
+    const uint8_t *src, boolean_t rec)
+{
+	hrtime_t start, delta;
+	uint64_t bytes = 0;
+
+	start = gethrtime();
+	do {
+		if (rec) {
+			ops->rmo_mul_xor(p, src, 0x8e, RAIDZ_BENCH_SIZE);
+		} else {
+			ops->rmo_xor(p, src, RAIDZ_BENCH_SIZE);
+			ops->rmo_mul2_xor(q, src, RAIDZ_BENCH_SIZE);
+		}
+		bytes += RAIDZ_BENCH_SIZE;
+		delta = gethrtime() - start;
+	} while (delta < RAIDZ_BENCH_NS);
+
+	return ((bytes * MILLISEC) / MAX(delta, 1));
+}
+
+void
+vdev_raidz_math_init(void)
+{
+	uint8_t *src, *p, *q;
+	uint64_t seed = 0x9e3779b97f4a7c15ULL, best = 0;
+	int i, j;
+
+	src = kmem_alloc(RAIDZ_BENCH_SIZE, KM_SLEEP);
+	p = kmem_zalloc(RAIDZ_BENCH_SIZE, KM_SLEEP);
+	q = kmem_zalloc(RAIDZ_BENCH_SIZE, KM_SLEEP);
+
+	for (i = 0; i < RAIDZ_BENCH_SIZE; i++) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		src[i] = seed >> 56;
+	}
+
+	(void) strlcpy(vdev_raidz_stats.rzstat_fastest.name, "fastest",
+	    KSTAT_STRLEN);
+	vdev_raidz_stats.rzstat_fastest.data_type = KSTAT_DATA_CHAR;
+
+	for (i = 0; i < RAIDZ_IMPL_COUNT; i++) {
+		const raidz_math_ops_t *ops = vdev_raidz_impls[i];
+		uint64_t speed[2] = { 0, 0 };
+
+		vdev_raidz_supported[i] = ops->rmo_valid();
+
+		/*
+		 * The second half of the source doubles as the initial
+		 * destination contents for the accumulating operations.
+		 */
+		if (vdev_raidz_supported[i] && !vdev_raidz_math_selftest(ops,
+		    src, src + RAIDZ_BENCH_SIZE / 2, p, q)) {
+			cmn_err(CE_WARN, "vdev_raidz %s implementation "
+			    "failed self-test, disabling", ops->rmo_name);
+			vdev_raidz_supported[i] = B_FALSE;
+		}
+
+		if (vdev_raidz_supported[i]) {
+			speed[0] = vdev_raidz_math_bench(ops, p, q, src, B_FALSE);
+			speed[1] = vdev_raidz_math_bench(ops, p, q, src, B_TRUE);
+			if (speed[0] + speed[1] > best) {
+				best = speed[0] + speed[1];
+				vdev_raidz_fastest = ops;
+			}
+		}
+
+		for (j = 0; j < 2; j++) {
+			kstat_named_t *knp = &vdev_raidz_stats.rzstat_bench[i][j];
+
+			(void) snprintf(knp->name, KSTAT_STRLEN, "%s_%s",
+			    ops->rmo_name, j ? "rec" : "gen");
+			knp->data_type = KSTAT_DATA_UINT64;
+			knp->value.ui64 = speed[j];
+		}
+	}
+
+	kmem_free(src, RAIDZ_BENCH_SIZE);
+	kmem_free(p, RAIDZ_BENCH_SIZE);
+	kmem_free(q, RAIDZ_BENCH_SIZE);
+
+	(void) strlcpy(vdev_raidz_stats.rzstat_fastest.value.c,
+	    vdev_raidz_fastest->rmo_name,
+	    sizeof (vdev_raidz_stats.rzstat_fastest.value.c));
+
+	if (vdev_raidz_impl_set(zfs_vdev_raidz_impl) != 0)
+		(void) vdev_raidz_impl_set("fastest");
+
+	vdev_raidz_ksp = kstat_create("zfs", 0, "vdev_raidz_bench", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (vdev_raidz_stats) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+
+	if (vdev_raidz_ksp != NULL) {
+		vdev_raidz_ksp->ks_data = &vdev_raidz_stats;
+		kstat_install(vdev_raidz_ksp);
+	}
+}
+
+void
+vdev_raidz_math_fini(void)
+{
+	if (vdev_raidz_ksp != NULL) {
+		kstat_delete(vdev_raidz_ksp);
+		vdev_raidz_ksp = NULL;
+	}
+}
+
+#if defined(_KERNEL) && defined(HAVE_SPL)
+static int
+vdev_raidz_param_set(const char *val, struct kernel_param *kp)
+{
+	char name[sizeof (zfs_vdev_raidz_impl)];
+	size_t len;
+
+	(void) strlcpy(name, val, sizeof (name));
+	len = strlen(name);
+	while (len > 0 && name[len - 1] == '\n')
+		name[--len] = '\0';
+
+	return (-vdev_raidz_impl_set(name));
+}
+
+static int
+vdev_raidz_param_get(char *buffer, struct kernel_param *kp)
+{
+	return (snprintf(buffer, PAGE_SIZE, "%s [%s]\n",
+	    zfs_vdev_raidz_impl, vdev_raidz_selected->rmo_name));
+}
+
+module_param_call(zfs_vdev_raidz_impl, vdev_raidz_param_set,
+    vdev_raidz_param_get, NULL, 0644);
+MODULE_PARM_DESC(zfs_vdev_raidz_impl, "Select RAID-Z parity implementation");
+#endif
@@ -0,0 +1,217 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * AVX2 RAID-Z parity engine, 32 bytes per step.  The algorithms are those
+ * of the SSSE3 engine; vpshufb shuffles within each 128-bit half, so the
+ * nibble tables are broadcast to both halves.
+ */
+
+#if defined(__x86_64) || defined(__x86_64__) || defined(__i386)
+
+#include <sys/zfs_context.h>
+#include <sys/simd_x86.h>
+#include <sys/vdev_raidz.h>
+
+static const uint8_t raidz_avx2_0x1d[16] __attribute__((aligned(16))) = {
+	0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d,
+	0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d
+};
+
+static const uint8_t raidz_avx2_0x0f[16] __attribute__((aligned(16))) = {
+	0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f,
+	0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f
+};
+
+/* ymm0 = 2 * ymm0, using ymm1 as scratch and ymm7 = 0x1d.. */
+#define	RAIDZ_AVX2_MUL2							\
+	"vpxor	%%ymm1, %%ymm1, %%ymm1\n"				\
+	"vpcmpgtb	%%ymm0, %%ymm1, %%ymm1\n"			\
+	"vpand	%%ymm7, %%ymm1, %%ymm1\n"				\
+	"vpaddb	%%ymm0, %%ymm0, %%ymm0\n"				\
+	"vpxor	%%ymm1, %%ymm0, %%ymm0\n"
+
+#define	RAIDZ_AVX2_LOOP_END						\
+	"add	$32, %[s]\n"						\
+	"add	$32, %[d]\n"						\
+	"cmp	%[end], %[s]\n"						\
+	"jb	1b\n"							\
+	"vzeroupper\n"
+
+static void
+vdev_raidz_avx2_xor(void *dst, const void *src, size_t size)
+{
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+	const uint8_t *end = s + size;
+
+	ASSERT0(size % RAIDZ_MATH_BLOCKSIZE);
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    "1:\n"
+	    "vmovdqu	(%[s]), %%ymm0\n"
+	    "vpxor	(%[d]), %%ymm0, %%ymm0\n"
+	    "vmovdqu	%%ymm0, (%[d])\n"
+	    RAIDZ_AVX2_LOOP_END
+	    : [d] "+r" (d), [s] "+r" (s)
+	    : [end] "r" (end)
+	    : "cc", "memory", "xmm0");
+	kfpu_end();
+}
+
+static void
+vdev_raidz_avx2_mul2_xor(void *dst, const void *src, size_t size)
+{
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+	const uint8_t *end = s + size;
+
+	ASSERT0(size % RAIDZ_MATH_BLOCKSIZE);
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    "vbroadcasti128	(%[c1d]), %%ymm7\n"
+	    "1:\n"
+	    "vmovdqu	(%[d]), %%ymm0\n"
+	    RAIDZ_AVX2_MUL2
+	    "vpxor	(%[s]), %%ymm0, %%ymm0\n"
+	    "vmovdqu	%%ymm0, (%[d])\n"
+	    RAIDZ_AVX2_LOOP_END
+	    : [d] "+r" (d), [s] "+r" (s)
+	    : [end] "r" (end), [c1d] "r" (raidz_avx2_0x1d)
+	    : "cc", "memory", "xmm0", "xmm1", "xmm7");
+	kfpu_end();
+}
+
+static void
+vdev_raidz_avx2_mul4_xor(void *dst, const void *src, size_t size)
+{
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+	const uint8_t *end = s + size;
+
+	ASSERT0(size % RAIDZ_MATH_BLOCKSIZE);
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    "vbroadcasti128	(%[c1d]), %%ymm7\n"
+	    "1:\n"
+	    "vmovdqu	(%[d]), %%ymm0\n"
+	    RAIDZ_AVX2_MUL2
+	    RAIDZ_AVX2_MUL2
+	    "vpxor	(%[s]), %%ymm0, %%ymm0\n"
+	    "vmovdqu	%%ymm0, (%[d])\n"
+	    RAIDZ_AVX2_LOOP_END
+	    : [d] "+r" (d), [s] "+r" (s)
+	    : [end] "r" (end), [c1d] "r" (raidz_avx2_0x1d)
+	    : "cc", "memory", "xmm0", "xmm1", "xmm7");
+	kfpu_end();
+}
+
+/*
+ * ymm0 = c * (s), with ymm5 = 0x0f.., ymm6 = low nibble table and
+ * ymm4 = high nibble table.
+ */
+#define	RAIDZ_AVX2_MULC							\
+	"vmovdqu	(%[s]), %%ymm1\n"				\
+	"vpsrlw	$4, %%ymm1, %%ymm2\n"					\
+	"vpand	%%ymm5, %%ymm1, %%ymm1\n"				\
+	"vpand	%%ymm5, %%ymm2, %%ymm2\n"				\
+	"vpshufb	%%ymm1, %%ymm6, %%ymm0\n"			\
+	"vpshufb	%%ymm2, %%ymm4, %%ymm3\n"			\
+	"vpxor	%%ymm3, %%ymm0, %%ymm0\n"
+
+#define	RAIDZ_AVX2_MULC_SETUP						\
+	"vbroadcasti128	(%[c0f]), %%ymm5\n"				\
+	"vbroadcasti128	0(%[tbl]), %%ymm6\n"				\
+	"vbroadcasti128	16(%[tbl]), %%ymm4\n"
+
+static void
+vdev_raidz_avx2_mul(void *dst, const void *src, uint8_t c, size_t size)
+{
+	uint8_t tbl[32] __attribute__((aligned(16)));
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+	const uint8_t *end = s + size;
+
+	ASSERT0(size % RAIDZ_MATH_BLOCKSIZE);
+
+	vdev_raidz_math_mul_tables(c, &tbl[0], &tbl[16]);
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    RAIDZ_AVX2_MULC_SETUP
+	    "1:\n"
+	    RAIDZ_AVX2_MULC
+	    "vmovdqu	%%ymm0, (%[d])\n"
+	    RAIDZ_AVX2_LOOP_END
+	    : [d] "+r" (d), [s] "+r" (s)
+	    : [end] "r" (end), [c0f] "r" (raidz_avx2_0x0f), [tbl] "r" (tbl)
+	    : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5",
+	    "xmm6");
+	kfpu_end();
+}
+
+static void
+vdev_raidz_avx2_mul_xor(void *dst, const void *src, uint8_t c, size_t size)
+{
+	uint8_t tbl[32] __attribute__((aligned(16)));
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+	const uint8_t *end = s + size;
+
+	ASSERT0(size % RAIDZ_MATH_BLOCKSIZE);
+
+	vdev_raidz_math_mul_tables(c, &tbl[0], &tbl[16]);
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    RAIDZ_AVX2_MULC_SETUP
+	    "1:\n"
+	    RAIDZ_AVX2_MULC
+	    "vpxor	(%[d]), %%ymm0, %%ymm0\n"
+	    "vmovdqu	%%ymm0, (%[d])\n"
+	    RAIDZ_AVX2_LOOP_END
+	    : [d] "+r" (d), [s] "+r" (s)
+	    : [end] "r" (end), [c0f] "r" (raidz_avx2_0x0f), [tbl] "r" (tbl)
+	    : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5",
+	    "xmm6");
+	kfpu_end();
+}
+
+static boolean_t
+vdev_raidz_avx2_valid(void)
+{
+	return (zfs_avx2_available());
+}
+
+const raidz_math_ops_t vdev_raidz_avx2_ops = {
+	.rmo_xor = vdev_raidz_avx2_xor,
+	.rmo_mul2_xor = vdev_raidz_avx2_mul2_xor,
+	.rmo_mul4_xor = vdev_raidz_avx2_mul4_xor,
+	.rmo_mul = vdev_raidz_avx2_mul,
+	.rmo_mul_xor = vdev_raidz_avx2_mul_xor,
+	.rmo_valid = vdev_raidz_avx2_valid,
+	.rmo_name = "avx2"
+};
+
+#endif /* __x86_64 || __x86_64__ || __i386 */
@@ -0,0 +1,227 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * SSSE3 RAID-Z parity engine, 16 bytes per step.
+ *
+ * Multiplication by 2 uses the same trick as VDEV_RAIDZ_64MUL_2: pcmpgtb
+ * against zero turns the top bit of each byte into a full byte mask which
+ * selects the 0x1d reduction, and paddb does the per-byte shift.
+ * Multiplication by an arbitrary constant splits each byte into nibbles
+ * and looks both up with pshufb in the tables built by
+ * vdev_raidz_math_mul_tables().
+ */
+
+#if defined(__x86_64) || defined(__x86_64__) || defined(__i386)
+
+#include <sys/zfs_context.h>
+#include <sys/simd_x86.h>
+#include <sys/vdev_raidz.h>
+
+static const uint8_t raidz_ssse3_0x1d[16] __attribute__((aligned(16))) = {
+	0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d,
+	0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d
+};
+
+static const uint8_t raidz_ssse3_0x0f[16] __attribute__((aligned(16))) = {
+	0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f,
+	0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f
+};
+
+/* xmm0 = 2 * xmm0, using xmm1 as scratch and xmm7 = 0x1d.. */
+#define	RAIDZ_SSSE3_MUL2						\
+	"pxor	%%xmm1, %%xmm1\n"					\
+	"pcmpgtb	%%xmm0, %%xmm1\n"				\
+	"pand	%%xmm7, %%xmm1\n"					\
+	"paddb	%%xmm0, %%xmm0\n"					\
+	"pxor	%%xmm1, %%xmm0\n"
+
+#define	RAIDZ_SSSE3_LOOP_END						\
+	"add	$16, %[s]\n"						\
+	"add	$16, %[d]\n"						\
+	"cmp	%[end], %[s]\n"						\
+	"jb	1b\n"
+
+static void
+vdev_raidz_ssse3_xor(void *dst, const void *src, size_t size)
+{
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+	const uint8_t *end = s + size;
+
+	ASSERT0(size % RAIDZ_MATH_BLOCKSIZE);
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    "1:\n"
+	    "movdqu	(%[s]), %%xmm0\n"
+	    "movdqu	(%[d]), %%xmm1\n"
+	    "pxor	%%xmm1, %%xmm0\n"
+	    "movdqu	%%xmm0, (%[d])\n"
+	    RAIDZ_SSSE3_LOOP_END
+	    : [d] "+r" (d), [s] "+r" (s)
+	    : [end] "r" (end)
+	    : "cc", "memory", "xmm0", "xmm1");
+	kfpu_end();
+}
+
+static void
+vdev_raidz_ssse3_mul2_xor(void *dst, const void *src, size_t size)
+{
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+	const uint8_t *end = s + size;
+
+	ASSERT0(size % RAIDZ_MATH_BLOCKSIZE);
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    "movdqa	(%[c1d]), %%xmm7\n"
+	    "1:\n"
+	    "movdqu	(%[d]), %%xmm0\n"
+	    RAIDZ_SSSE3_MUL2
+	    "movdqu	(%[s]), %%xmm2\n"
+	    "pxor	%%xmm2, %%xmm0\n"
+	    "movdqu	%%xmm0, (%[d])\n"
+	    RAIDZ_SSSE3_LOOP_END
+	    : [d] "+r" (d), [s] "+r" (s)
+	    : [end] "r" (end), [c1d] "r" (raidz_ssse3_0x1d)
+	    : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm7");
+	kfpu_end();
+}
+
+static void
+vdev_raidz_ssse3_mul4_xor(void *dst, const void *src, size_t size)
+{
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+	const uint8_t *end = s + size;
+
+	ASSERT0(size % RAIDZ_MATH_BLOCKSIZE);
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    "movdqa	(%[c1d]), %%xmm7\n"
+	    "1:\n"
+	    "movdqu	(%[d]), %%xmm0\n"
+	    RAIDZ_SSSE3_MUL2
+	    RAIDZ_SSSE3_MUL2
+	    "movdqu	(%[s]), %%xmm2\n"
+	    "pxor	%%xmm2, %%xmm0\n"
+	    "movdqu	%%xmm0, (%[d])\n"
+	    RAIDZ_SSSE3_LOOP_END
+	    : [d] "+r" (d), [s] "+r" (s)
+	    : [end] "r" (end), [c1d] "r" (raidz_ssse3_0x1d)
+	    : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm7");
+	kfpu_end();
+}
+
+/*
+ * xmm0 = c * (s), with xmm5 = 0x0f.., xmm6 = low nibble table and
+ * xmm4 = high nibble table.
+ */
+#define	RAIDZ_SSSE3_MULC						\
+	"movdqu	(%[s]), %%xmm1\n"					\
+	"movdqa	%%xmm1, %%xmm2\n"					\
+	"psrlw	$4, %%xmm2\n"						\
+	"pand	%%xmm5, %%xmm1\n"					\
+	"pand	%%xmm5, %%xmm2\n"					\
+	"movdqa	%%xmm6, %%xmm0\n"					\
+	"pshufb	%%xmm1, %%xmm0\n"					\
+	"movdqa	%%xmm4, %%xmm3\n"					\
+	"pshufb	%%xmm2, %%xmm3\n"					\
+	"pxor	%%xmm3, %%xmm0\n"
+
+static void
+vdev_raidz_ssse3_mul(void *dst, const void *src, uint8_t c, size_t size)
+{
+	uint8_t tbl[32] __attribute__((aligned(16)));
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+	const uint8_t *end = s + size;
+
+	ASSERT0(size % RAIDZ_MATH_BLOCKSIZE);
+
+	vdev_raidz_math_mul_tables(c, &tbl[0], &tbl[16]);
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    "movdqa	(%[c0f]), %%xmm5\n"
+	    "movdqa	0(%[tbl]), %%xmm6\n"
+	    "movdqa	16(%[tbl]), %%xmm4\n"
+	    "1:\n"
+	    RAIDZ_SSSE3_MULC
+	    "movdqu	%%xmm0, (%[d])\n"
+	    RAIDZ_SSSE3_LOOP_END
+	    : [d] "+r" (d), [s] "+r" (s)
+	    : [end] "r" (end), [c0f] "r" (raidz_ssse3_0x0f), [tbl] "r" (tbl)
+	    : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5",
+	    "xmm6");
+	kfpu_end();
+}
+
+static void
+vdev_raidz_ssse3_mul_xor(void *dst, const void *src, uint8_t c, size_t size)
+{
+	uint8_t tbl[32] __attribute__((aligned(16)));
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+	const uint8_t *end = s + size;
+
+	ASSERT0(size % RAIDZ_MATH_BLOCKSIZE);
+
+	vdev_raidz_math_mul_tables(c, &tbl[0], &tbl[16]);
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    "movdqa	(%[c0f]), %%xmm5\n"
+	    "movdqa	0(%[tbl]), %%xmm6\n"
+	    "movdqa	16(%[tbl]), %%xmm4\n"
+	    "1:\n"
+	    RAIDZ_SSSE3_MULC
+	    "movdqu	(%[d]), %%xmm1\n"
+	    "pxor	%%xmm1, %%xmm0\n"
+	    "movdqu	%%xmm0, (%[d])\n"
+	    RAIDZ_SSSE3_LOOP_END
+	    : [d] "+r" (d), [s] "+r" (s)
+	    : [end] "r" (end), [c0f] "r" (raidz_ssse3_0x0f), [tbl] "r" (tbl)
+	    : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5",
+	    "xmm6");
+	kfpu_end();
+}
+
+static boolean_t
+vdev_raidz_ssse3_valid(void)
+{
+	return (zfs_sse2_available() && zfs_ssse3_available());
+}
+
+const raidz_math_ops_t vdev_raidz_ssse3_ops = {
+	.rmo_xor = vdev_raidz_ssse3_xor,
+	.rmo_mul2_xor = vdev_raidz_ssse3_mul2_xor,
+	.rmo_mul4_xor = vdev_raidz_ssse3_mul4_xor,
+	.rmo_mul = vdev_raidz_ssse3_mul,
+	.rmo_mul_xor = vdev_raidz_ssse3_mul_xor,
+	.rmo_valid = vdev_raidz_ssse3_valid,
+	.rmo_name = "ssse3"
+};
+
+#endif /* __x86_64 || __x86_64__ || __i386 */
@@ -155,6 +155,11 @@ zfeature_register(int fid, const char *guid, const char *name, const char *desc,
 void
 zpool_feature_init(void)
 {
+	static zfeature_info_t *log_spacemap_deps[] = {
+		&spa_feature_table[SPA_FEATURE_SPACEMAP_HISTOGRAM],
+		NULL
+	};
+
 	zfeature_register(SPA_FEATURE_ASYNC_DESTROY,
 	    "com.delphix:async_destroy", "async_destroy",
 	    "Destroy filesystems asynchronously.", B_TRUE, B_FALSE, NULL);
@@ -164,4 +169,31 @@ zpool_feature_init(void)
 	zfeature_register(SPA_FEATURE_LZ4_COMPRESS,
 	    "org.illumos:lz4_compress", "lz4_compress",
 	    "LZ4 compression algorithm support.", B_FALSE, B_FALSE, NULL);
+	zfeature_register(SPA_FEATURE_ZSTD_COMPRESS,
+	    "org.openzfsonosx:zstd_compress", "zstd_compress",
+	    "zstd compression algorithm support.", B_FALSE, B_FALSE, NULL);
+	zfeature_register(SPA_FEATURE_SHA512,
+	    "org.illumos:sha512", "sha512",
+	    "SHA-512/256 hash algorithm.", B_FALSE, B_FALSE, NULL);
+	zfeature_register(SPA_FEATURE_SPACEMAP_HISTOGRAM,
+	    "com.delphix:spacemap_histogram", "spacemap_histogram",
+	    "Spacemaps maintain space histograms.", B_TRUE, B_FALSE, NULL);
+	zfeature_register(SPA_FEATURE_LOG_SPACEMAP,
+	    "com.delphix:log_spacemap", "log_spacemap",
+	    "Log metaslab changes on a single spacemap and "
+	    "flush them periodically.", B_TRUE, B_FALSE, log_spacemap_deps);
+	zfeature_register(SPA_FEATURE_LARGE_BLOCKS,
+	    "org.open-zfs:large_blocks", "large_blocks",
+	    "Support for blocks larger than 128KB.", B_FALSE, B_FALSE, NULL);
+	zfeature_register(SPA_FEATURE_LARGE_DNODE,
+	    "org.zfsonlinux:large_dnode", "large_dnode",
+	    "Variable on-disk size of dnodes.", B_FALSE, B_FALSE, NULL);
+	zfeature_register(SPA_FEATURE_EMBEDDED_DATA,
+	    "com.delphix:embedded_data", "embedded_data",
+	    "Blocks which compress very well use even less space.",
+	    B_FALSE, B_FALSE, NULL);
+	zfeature_register(SPA_FEATURE_DEDUP_LOG,
+	    "org.openzfsonosx:dedup_log", "dedup_log",
+	    "Log dedup table changes and flush them to the table "
+	    "incrementally.", B_TRUE, B_FALSE, NULL);
 }
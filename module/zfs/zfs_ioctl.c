@@ -2342,17 +2342,21 @@ zfs_prop_set_special(const char *dsname, zprop_source_t source,
 	}
 	case ZFS_PROP_COMPRESSION:
 	{
-		if (intval == ZIO_COMPRESS_LZ4) {
+		if (intval == ZIO_COMPRESS_LZ4 ||
+		    (intval >= ZIO_COMPRESS_ZSTD_1 &&
+		    intval <= ZIO_COMPRESS_ZSTD_19)) {
 			zfeature_info_t *feature =
-			    &spa_feature_table[SPA_FEATURE_LZ4_COMPRESS];
+			    &spa_feature_table[intval == ZIO_COMPRESS_LZ4 ?
+			    SPA_FEATURE_LZ4_COMPRESS :
+			    SPA_FEATURE_ZSTD_COMPRESS];
 			spa_t *spa;
 
 			if ((err = spa_open(dsname, &spa, FTAG)) != 0)
 				return (err);
 
 			/*
-			 * Setting the LZ4 compression algorithm activates
-			 * the feature.
+			 * Setting the LZ4 or zstd compression algorithm
+			 * activates the matching feature.
 			 */
 			if (!spa_feature_is_active(spa, feature)) {
 				if ((err = zfs_prop_activate_feature(spa,
@@ -2371,6 +2375,91 @@ zfs_prop_set_special(const char *dsname, zprop_source_t source,
 		err = -1;
 		break;
 	}
+	case ZFS_PROP_CHECKSUM:
+	case ZFS_PROP_DEDUP:
+	{
+		if ((intval & ZIO_CHECKSUM_MASK) == ZIO_CHECKSUM_SHA512) {
+			zfeature_info_t *feature =
+			    &spa_feature_table[SPA_FEATURE_SHA512];
+			spa_t *spa;
+
+			if ((err = spa_open(dsname, &spa, FTAG)) != 0)
+				return (err);
+
+			/*
+			 * The first sha512 block pointer makes the pool
+			 * unreadable without the feature, so activate it now.
+			 */
+			if (!spa_feature_is_active(spa, feature)) {
+				if ((err = zfs_prop_activate_feature(spa,
+				    feature)) != 0) {
+					spa_close(spa, FTAG);
+					return (err);
+				}
+			}
+
+			spa_close(spa, FTAG);
+		}
+		err = -1;
+		break;
+	}
+	case ZFS_PROP_RECORDSIZE:
+	{
+		if (intval > SPA_OLD_MAXBLOCKSIZE) {
+			zfeature_info_t *feature =
+			    &spa_feature_table[SPA_FEATURE_LARGE_BLOCKS];
+			spa_t *spa;
+
+			if ((err = spa_open(dsname, &spa, FTAG)) != 0)
+				return (err);
+
+			/*
+			 * A block larger than 128k can't be read without
+			 * the feature, so activate it before the first one
+			 * is written.
+			 */
+			if (!spa_feature_is_active(spa, feature)) {
+				if ((err = zfs_prop_activate_feature(spa,
+				    feature)) != 0) {
+					spa_close(spa, FTAG);
+					return (err);
+				}
+			}
+
+			spa_close(spa, FTAG);
+		}
+		err = -1;
+		break;
+	}
+
+	case ZFS_PROP_DNODESIZE:
+	{
+		if (intval != ZFS_DNSIZE_LEGACY) {
+			zfeature_info_t *feature =
+			    &spa_feature_table[SPA_FEATURE_LARGE_DNODE];
+			spa_t *spa;
+
+			if ((err = spa_open(dsname, &spa, FTAG)) != 0)
+				return (err);
+
+			/*
+			 * A dnode larger than 512 bytes can't be read
+			 * without the feature, so activate it before the
+			 * first one is allocated.
+			 */
+			if (!spa_feature_is_active(spa, feature)) {
+				if ((err = zfs_prop_activate_feature(spa,
+				    feature)) != 0) {
+					spa_close(spa, FTAG);
+					return (err);
+				}
+			}
+
+			spa_close(spa, FTAG);
+		}
+		err = -1;
+		break;
+	}
 
 	default:
 		err = -1;
@@ -3145,6 +3234,29 @@ zfs_ioc_create(const char *fsname, nvlist_t *innvl, nvlist_t *outnvl)
 		    (error = zvol_check_volsize(volsize,
 		    volblocksize)) != 0)
 			return (error);
+
+		/*
+		 * Volume blocks larger than 128k need the large_blocks
+		 * feature, which must be active before the first one is
+		 * written.
+		 */
+		if (volblocksize > SPA_OLD_MAXBLOCKSIZE) {
+			zfeature_info_t *feature =
+			    &spa_feature_table[SPA_FEATURE_LARGE_BLOCKS];
+			spa_t *spa;
+
+			if ((error = spa_open(fsname, &spa, FTAG)) != 0)
+				return (error);
+
+			if (!spa_feature_is_enabled(spa, feature))
+				error = ENOTSUP;
+			else if (!spa_feature_is_active(spa, feature))
+				error = zfs_prop_activate_feature(spa, feature);
+
+			spa_close(spa, FTAG);
+			if (error != 0)
+				return (error);
+		}
 	} else if (type == DMU_OST_ZFS) {
 		int error;
 
@@ -3686,6 +3798,23 @@ zfs_check_settable(const char *dsname, nvpair_t *pair, cred_t *cr)
 				spa_close(spa, FTAG);
 			}
 
+			if (intval >= ZIO_COMPRESS_ZSTD_1 &&
+			    intval <= ZIO_COMPRESS_ZSTD_19) {
+				zfeature_info_t *feature =
+				    &spa_feature_table[
+				    SPA_FEATURE_ZSTD_COMPRESS];
+				spa_t *spa;
+
+				if ((err = spa_open(dsname, &spa, FTAG)) != 0)
+					return (err);
+
+				if (!spa_feature_is_enabled(spa, feature)) {
+					spa_close(spa, FTAG);
+					return (ENOTSUP);
+				}
+				spa_close(spa, FTAG);
+			}
+
 			/*
 			 * If this is a bootable dataset then
 			 * verify that the compression algorithm
@@ -3708,6 +3837,88 @@ zfs_check_settable(const char *dsname, nvpair_t *pair, cred_t *cr)
 	case ZFS_PROP_DEDUP:
 		if (zfs_earlier_version(dsname, SPA_VERSION_DEDUP))
 			return (ENOTSUP);
+		/* FALLTHROUGH */
+
+	case ZFS_PROP_CHECKSUM:
+		if (nvpair_type(pair) == DATA_TYPE_UINT64 &&
+		    nvpair_value_uint64(pair, &intval) == 0 &&
+		    (intval & ZIO_CHECKSUM_MASK) == ZIO_CHECKSUM_SHA512) {
+			zfeature_info_t *feature =
+			    &spa_feature_table[SPA_FEATURE_SHA512];
+			spa_t *spa;
+
+			if ((err = spa_open(dsname, &spa, FTAG)) != 0)
+				return (err);
+
+			if (!spa_feature_is_enabled(spa, feature)) {
+				spa_close(spa, FTAG);
+				return (ENOTSUP);
+			}
+			spa_close(spa, FTAG);
+		}
+		break;
+
+	case ZFS_PROP_RECORDSIZE:
+		/* Record sizes above 128k need the feature to be enabled */
+		if (nvpair_type(pair) == DATA_TYPE_UINT64 &&
+		    nvpair_value_uint64(pair, &intval) == 0 &&
+		    intval > SPA_OLD_MAXBLOCKSIZE) {
+			zfeature_info_t *feature =
+			    &spa_feature_table[SPA_FEATURE_LARGE_BLOCKS];
+			spa_t *spa;
+
+			/*
+			 * Boot loaders can't read blocks larger than 128k,
+			 * so keep them off bootable datasets.  As for
+			 * compression, this must not be ENOTSUP.
+			 */
+			if (zfs_is_bootfs(dsname))
+				return (ERANGE);
+
+			/*
+			 * We don't allow setting the property above 1MB,
+			 * unless the tunable has been changed.
+			 */
+			if (intval > zfs_max_recordsize ||
+			    intval > SPA_MAXBLOCKSIZE)
+				return (EDOM);
+
+			if ((err = spa_open(dsname, &spa, FTAG)) != 0)
+				return (err);
+
+			if (!spa_feature_is_enabled(spa, feature)) {
+				spa_close(spa, FTAG);
+				return (ENOTSUP);
+			}
+			spa_close(spa, FTAG);
+		}
+		break;
+
+	case ZFS_PROP_DNODESIZE:
+		/* Dnode sizes above 512 need the feature to be enabled */
+		if (nvpair_type(pair) == DATA_TYPE_UINT64 &&
+		    nvpair_value_uint64(pair, &intval) == 0 &&
+		    intval != ZFS_DNSIZE_LEGACY) {
+			zfeature_info_t *feature =
+			    &spa_feature_table[SPA_FEATURE_LARGE_DNODE];
+			spa_t *spa;
+
+			/*
+			 * Boot loaders can't read dnodes larger than 512
+			 * bytes, so keep them off bootable datasets.
+			 */
+			if (zfs_is_bootfs(dsname))
+				return (ERANGE);
+
+			if ((err = spa_open(dsname, &spa, FTAG)) != 0)
+				return (err);
+
+			if (!spa_feature_is_enabled(spa, feature)) {
+				spa_close(spa, FTAG);
+				return (ENOTSUP);
+			}
+			spa_close(spa, FTAG);
+		}
 		break;
 
 	case ZFS_PROP_SHARESMB:
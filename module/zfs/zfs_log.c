@@ -39,6 +39,7 @@
 #include <sys/stat.h>
 #include <sys/acl.h>
 #include <sys/dmu.h>
+#include <sys/dnode.h>
 #include <sys/spa.h>
 #include <sys/zfs_fuid.h>
 #include <sys/dsl_dataset.h>
@@ -215,6 +216,23 @@ zfs_log_fuid_domains(zfs_fuid_info_t *fuidp, void *start)
 	return (start);
 }
 
+/*
+ * The lr_foid of a create record: the object number, and how many dnode
+ * slots the object takes, for zfs_mknode() to claim on replay.
+ */
+static uint64_t
+zfs_log_create_foid(znode_t *zp)
+{
+	dmu_object_info_t doi;
+	uint64_t foid = 0;
+
+	dmu_object_info_from_db(sa_get_db(zp->z_sa_hdl), &doi);
+	LR_FOID_SET_OBJ(foid, zp->z_id);
+	LR_FOID_SET_SLOTS(foid, doi.doi_dnodesize >> DNODE_SHIFT);
+
+	return (foid);
+}
+
 /*
  * zfs_log_create() is used to handle TX_CREATE, TX_CREATE_ATTR, TX_MKDIR,
  * TX_MKDIR_ATTR and TX_MKXATTR
@@ -283,7 +301,7 @@ zfs_log_create(zilog_t *zilog, dmu_tx_t *tx, uint64_t txtype,
 
 	lr = (lr_create_t *)&itx->itx_lr;
 	lr->lr_doid = dzp->z_id;
-	lr->lr_foid = zp->z_id;
+	lr->lr_foid = zfs_log_create_foid(zp);
 	lr->lr_mode = zp->z_mode;
 	if (!IS_EPHEMERAL(zp->z_uid)) {
 		lr->lr_uid = (uint64_t)zp->z_uid;
@@ -409,7 +427,7 @@ zfs_log_symlink(zilog_t *zilog, dmu_tx_t *tx, uint64_t txtype,
 	itx = zil_itx_create(txtype, sizeof (*lr) + namesize + linksize);
 	lr = (lr_create_t *)&itx->itx_lr;
 	lr->lr_doid = dzp->z_id;
-	lr->lr_foid = zp->z_id;
+	lr->lr_foid = zfs_log_create_foid(zp);
 	lr->lr_uid = zp->z_uid;
 	lr->lr_gid = zp->z_gid;
 	lr->lr_mode = zp->z_mode;
@@ -491,7 +509,7 @@ zfs_log_write(zilog_t *zilog, dmu_tx_t *tx, uint64_t txtype,
 		 * If the write would overflow the largest block then split it.
 		 */
 		if (write_state != WR_INDIRECT && resid > ZIL_MAX_LOG_DATA)
-			len = SPA_MAXBLOCKSIZE >> 1;
+			len = SPA_OLD_MAXBLOCKSIZE >> 1;
 		else
 			len = resid;
 
@@ -41,6 +41,7 @@
 #include <sys/zfs_vnops.h>
 #include <sys/spa.h>
 #include <sys/zil.h>
+#include <sys/dnode.h>
 #include <sys/byteorder.h>
 #include <sys/stat.h>
 #include <sys/mode.h>
@@ -313,11 +314,14 @@ zfs_replay_create_acl(zfsvfs_t *zsb, lr_acl_create_t *lracl, boolean_t byteswap)
 	 * creation time and generation number.  The generic zfs_create()
 	 * doesn't have either concept, so we smuggle the values inside
 	 * the vattr's otherwise unused va_ctime and va_nblocks fields.
+	 * The dnode slot count rides along in va_nodeid, still encoded
+	 * as in lr_foid.
 	 */
 	ZFS_TIME_DECODE(&xva.xva_vattr.va_ctime, lr->lr_crtime);
 	xva.xva_vattr.va_nblocks = lr->lr_gen;
 
-	error = dmu_object_info(zsb->z_os, lr->lr_foid, NULL);
+	error = dmu_object_info(zsb->z_os, LR_FOID_GET_OBJ(lr->lr_foid),
+	    NULL);
 	if (error != ENOENT)
 		goto bail;
 
@@ -440,11 +444,14 @@ zfs_replay_create(zfsvfs_t *zsb, lr_create_t *lr, boolean_t byteswap)
 	 * creation time and generation number.  The generic zfs_create()
 	 * doesn't have either concept, so we smuggle the values inside
 	 * the vattr's otherwise unused va_ctime and va_nblocks fields.
+	 * The dnode slot count rides along in va_nodeid, still encoded
+	 * as in lr_foid.
 	 */
 	ZFS_TIME_DECODE(&xva.xva_vattr.va_ctime, lr->lr_crtime);
 	xva.xva_vattr.va_nblocks = lr->lr_gen;
 
-	error = dmu_object_info(zsb->z_os, lr->lr_foid, NULL);
+	error = dmu_object_info(zsb->z_os, LR_FOID_GET_OBJ(lr->lr_foid),
+	    NULL);
 	if (error != ENOENT)
 		goto out;
 
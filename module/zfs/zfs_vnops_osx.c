@@ -1001,6 +1001,7 @@ zfs_vnop_pageout(
     znode_t         *zp = VTOZ(vp);
     zfsvfs_t        *zfsvfs = zp->z_zfsvfs;
     dmu_tx_t        *tx;
+    boolean_t       waited = B_FALSE;
     rl_t            *rl;
     uint64_t        filesz;
     int             err = 0;
@@ -1086,10 +1087,11 @@ zfs_vnop_pageout(
     tx = dmu_tx_create(zfsvfs->z_os);
     dmu_tx_hold_write(tx, zp->z_id, off, len);
     dmu_tx_hold_bonus(tx, zp->z_id);
-    err = dmu_tx_assign(tx, TXG_NOWAIT);
+    err = dmu_tx_assign(tx, waited ? TXG_WAITED : TXG_NOWAIT);
     if (err != 0) {
         if (err == ERESTART) {
             zfs_range_unlock(rl);
+            waited = B_TRUE;
             dmu_tx_wait(tx);
             dmu_tx_abort(tx);
             goto top;
@@ -455,6 +455,7 @@ zfs_obtain_xattr(znode_t *dzp, const char *name, mode_t mode, cred_t *cr,
 	zilog_t  *zilog;
 	zfs_dirlock_t  *dl;
 	dmu_tx_t  *tx;
+	boolean_t waited = B_FALSE;
 	struct vnode_attr  vattr;
 	int error;
 	struct componentname cn;
@@ -500,14 +501,15 @@ zfs_obtain_xattr(znode_t *dzp, const char *name, mode_t mode, cred_t *cr,
 
 #if 1 // FIXME
 	if (dzp->z_pflags & ZFS_INHERIT_ACE) {
-		dmu_tx_hold_write(tx, DMU_NEW_OBJECT, 0, SPA_MAXBLOCKSIZE);
+		dmu_tx_hold_write(tx, DMU_NEW_OBJECT, 0, SPA_OLD_MAXBLOCKSIZE);
 	}
 #endif
     zfs_sa_upgrade_txholds(tx, dzp);
-	error = dmu_tx_assign(tx, TXG_NOWAIT);
+	error = dmu_tx_assign(tx, waited ? TXG_WAITED : TXG_NOWAIT);
 	if (error) {
 		zfs_dirent_unlock(dl);
 		if ((error == ERESTART)) {
+			waited = B_TRUE;
 			dmu_tx_wait(tx);
 			dmu_tx_abort(tx);
 			goto top;
@@ -30,6 +30,7 @@
 #include <sys/dmu.h>
 #include <sys/zap.h>
 #include <sys/arc.h>
+#include <sys/abd.h>
 #include <sys/stat.h>
 #include <sys/resource.h>
 #include <sys/zil.h>
@@ -87,6 +88,22 @@ zil_stats_t zil_stats = {
 
 static kstat_t *zil_ksp;
 
+/*
+ * Latency histograms, in power-of-two microsecond buckets.  Bucket N counts
+ * latencies in [2^N, 2^(N+1)) us and the last bucket also takes everything
+ * longer.  The "commit" buckets time a whole zil_commit() call; the "lwb"
+ * buckets time one log block from issue until its vdevs have been flushed.
+ */
+#define	ZIL_LAT_BUCKETS	24
+
+typedef struct zil_lat_stats {
+	kstat_named_t	zls_commit[ZIL_LAT_BUCKETS];
+	kstat_named_t	zls_lwb[ZIL_LAT_BUCKETS];
+} zil_lat_stats_t;
+
+static zil_lat_stats_t zil_lat_stats;
+static kstat_t *zil_lat_ksp;
+
 /*
  * This global ZIL switch affects all pools
  */
@@ -100,6 +117,7 @@ int zil_replay_disable = 0;    /* disable intent logging replay */
 int zfs_nocacheflush = 0;
 
 static kmem_cache_t *zil_lwb_cache;
+static kmem_cache_t *zil_zcw_cache;
 
 static void zil_async_to_sync(zilog_t *zilog, uint64_t foid);
 
@@ -336,7 +354,7 @@ zil_parse(zilog_t *zilog, zil_parse_blk_func_t *parse_blk_func,
 	 * If the log has been claimed, stop if we encounter a sequence
 	 * number greater than the highest claimed sequence number.
 	 */
-	lrbuf = zio_buf_alloc(SPA_MAXBLOCKSIZE);
+	lrbuf = zio_buf_alloc(SPA_OLD_MAXBLOCKSIZE);
 	zil_bp_tree_init(zilog);
 
 	for (blk = zh->zh_log; !BP_IS_HOLE(&blk); blk = next_blk) {
@@ -383,7 +401,7 @@ done:
 	    (max_blk_seq == claim_blk_seq && max_lr_seq == claim_lr_seq));
 
 	zil_bp_tree_fini(zilog);
-	zio_buf_free(lrbuf, SPA_MAXBLOCKSIZE);
+	zio_buf_free(lrbuf, SPA_OLD_MAXBLOCKSIZE);
 
 	return (error);
 }
@@ -462,8 +480,11 @@ zil_alloc_lwb(zilog_t *zilog, blkptr_t *bp, uint64_t txg, boolean_t fastwrite)
 	lwb->lwb_fastwrite = fastwrite;
 	lwb->lwb_buf = zio_buf_alloc(BP_GET_LSIZE(bp));
 	lwb->lwb_max_txg = txg;
-	lwb->lwb_zio = NULL;
+	lwb->lwb_state = LWB_STATE_CLOSED;
+	lwb->lwb_write_zio = NULL;
+	lwb->lwb_root_zio = NULL;
 	lwb->lwb_tx = NULL;
+	lwb->lwb_issued_timestamp = 0;
 	if (BP_GET_CHECKSUM(bp) == ZIO_CHECKSUM_ZILOG2) {
 		lwb->lwb_nused = sizeof (zil_chain_t);
 		lwb->lwb_sz = BP_GET_LSIZE(bp);
@@ -622,7 +643,9 @@ zil_destroy(zilog_t *zilog, boolean_t keep_first)
 		ASSERT(zh->zh_claim_txg == 0);
 		VERIFY(!keep_first);
 		while ((lwb = list_head(&zilog->zl_lwb_list)) != NULL) {
-			ASSERT(lwb->lwb_zio == NULL);
+			ASSERT(lwb->lwb_state == LWB_STATE_CLOSED ||
+			    lwb->lwb_state == LWB_STATE_FLUSH_DONE);
+			ASSERT(list_is_empty(&lwb->lwb_waiters));
 			if (lwb->lwb_fastwrite)
 				metaslab_fastwrite_unmark(zilog->zl_spa,
 				    &lwb->lwb_blk);
@@ -632,6 +655,7 @@ zil_destroy(zilog_t *zilog, boolean_t keep_first)
 			zio_free_zil(zilog->zl_spa, txg, &lwb->lwb_blk);
 			kmem_cache_free(zil_lwb_cache, lwb);
 		}
+		zilog->zl_last_lwb_opened = NULL;
 	} else if (!keep_first) {
 		zil_destroy_sync(zilog, tx);
 	}
@@ -777,9 +801,9 @@ zil_vdev_compare(const void *x1, const void *x2)
 }
 
 void
-zil_add_block(zilog_t *zilog, const blkptr_t *bp)
+zil_lwb_add_block(lwb_t *lwb, const blkptr_t *bp)
 {
-	avl_tree_t *t = &zilog->zl_vdev_tree;
+	avl_tree_t *t = &lwb->lwb_vdev_tree;
 	avl_index_t where;
 	zil_vdev_node_t *zv, zvsearch;
 	int ndvas = BP_GET_NDVAS(bp);
@@ -788,14 +812,14 @@ zil_add_block(zilog_t *zilog, const blkptr_t *bp)
 	if (zfs_nocacheflush)
 		return;
 
-	ASSERT(zilog->zl_writer);
+	ASSERT(lwb->lwb_state == LWB_STATE_OPENED ||
+	    lwb->lwb_state == LWB_STATE_ISSUED);
 
 	/*
-	 * Even though we're zl_writer, we still need a lock because the
-	 * zl_get_data() callbacks may have dmu_sync() done callbacks
-	 * that will run concurrently.
+	 * The zl_get_data() callbacks may have dmu_sync() done callbacks
+	 * that run concurrently with the issuer, so we need a lock here.
 	 */
-	mutex_enter(&zilog->zl_vdev_lock);
+	mutex_enter(&lwb->lwb_vdev_lock);
 	for (i = 0; i < ndvas; i++) {
 		zvsearch.zv_vdev = DVA_GET_VDEV(&bp->blk_dva[i]);
 		if (avl_find(t, &zvsearch, &where) == NULL) {
@@ -804,56 +828,122 @@ zil_add_block(zilog_t *zilog, const blkptr_t *bp)
 			avl_insert(t, zv, where);
 		}
 	}
-	mutex_exit(&zilog->zl_vdev_lock);
+	mutex_exit(&lwb->lwb_vdev_lock);
 }
 
 static void
-zil_flush_vdevs(zilog_t *zilog)
+zil_lat_histogram_add(kstat_named_t *hist, hrtime_t delta)
 {
-	spa_t *spa = zilog->zl_spa;
-	avl_tree_t *t = &zilog->zl_vdev_tree;
-	void *cookie = NULL;
-	zil_vdev_node_t *zv;
-	zio_t *zio;
+	uint64_t us = delta / (NANOSEC / MICROSEC);
+	int b = (us == 0) ? 0 : highbit(us) - 1;
 
-	ASSERT(zilog->zl_writer);
+	atomic_add_64(&hist[MIN(b, ZIL_LAT_BUCKETS - 1)].value.ui64, 1);
+}
 
-	/*
-	 * We don't need zl_vdev_lock here because we're the zl_writer,
-	 * and all zl_get_data() callbacks are done.
-	 */
-	if (avl_numnodes(t) == 0)
-		return;
+static void
+zil_commit_waiter_done(zil_commit_waiter_t *zcw, int error)
+{
+	mutex_enter(&zcw->zcw_lock);
+	ASSERT(!zcw->zcw_done);
+	zcw->zcw_lwb = NULL;
+	zcw->zcw_zio_error = error;
+	zcw->zcw_done = B_TRUE;
+	cv_broadcast(&zcw->zcw_cv);
+	mutex_exit(&zcw->zcw_lock);
+}
 
-	spa_config_enter(spa, SCL_STATE, FTAG, RW_READER);
+/*
+ * The waiter's itxs are already on stable storage (or their txg has
+ * synced), so there is no lwb to wait for.
+ */
+static void
+zil_commit_waiter_skip(zil_commit_waiter_t *zcw)
+{
+	zil_commit_waiter_done(zcw, 0);
+}
 
-	zio = zio_root(spa, NULL, NULL, ZIO_FLAG_CANFAIL);
+/*
+ * Link the waiter to an lwb; it is signalled when that lwb's flushes
+ * complete.  Called with zl_lock held.
+ */
+static void
+zil_commit_waiter_link(lwb_t *lwb, zil_commit_waiter_t *zcw)
+{
+	ASSERT(MUTEX_HELD(&lwb->lwb_zilog->zl_lock));
+	ASSERT(lwb->lwb_state != LWB_STATE_FLUSH_DONE);
+
+	mutex_enter(&zcw->zcw_lock);
+	ASSERT(!list_link_active(&zcw->zcw_node));
+	ASSERT3P(zcw->zcw_lwb, ==, NULL);
+	ASSERT(!zcw->zcw_done);
+	list_insert_tail(&lwb->lwb_waiters, zcw);
+	zcw->zcw_lwb = lwb;
+	mutex_exit(&zcw->zcw_lock);
+}
 
-	while ((zv = avl_destroy_nodes(t, &cookie)) != NULL) {
-		vdev_t *vd = vdev_lookup_top(spa, zv->zv_vdev);
-		if (vd != NULL)
-			zio_flush(zio, vd);
-		kmem_free(zv, sizeof (*zv));
-	}
+/*
+ * Called when the root zio of an lwb completes: the log block has been
+ * written, the vdevs it touched have been flushed, and (through the chain
+ * of root zios built in zil_lwb_write_init()) the same is true of every
+ * lwb before it.  Any error along the way is reported to the waiters,
+ * which then fall back to txg_wait_synced().
+ */
+static void
+zil_lwb_flush_vdevs_done(zio_t *zio)
+{
+	lwb_t *lwb = zio->io_private;
+	zilog_t *zilog = lwb->lwb_zilog;
+	dmu_tx_t *tx = lwb->lwb_tx;
+	zil_commit_waiter_t *zcw;
+
+	spa_config_exit(zilog->zl_spa, SCL_STATE, lwb);
+
+	zil_lat_histogram_add(zil_lat_stats.zls_lwb,
+	    gethrtime() - lwb->lwb_issued_timestamp);
+
+	mutex_enter(&zilog->zl_lock);
+
+	ASSERT3S(lwb->lwb_state, ==, LWB_STATE_WRITE_DONE);
+	lwb->lwb_state = LWB_STATE_FLUSH_DONE;
+	lwb->lwb_root_zio = NULL;
+	lwb->lwb_tx = NULL;
 
 	/*
-	 * Wait for all the flushes to complete.  Not all devices actually
-	 * support the DKIOCFLUSHWRITECACHE ioctl, so it's OK if it fails.
+	 * Remember the highest committed log sequence number for ztest.
+	 * We only update this value when all the log writes succeeded,
+	 * because ztest wants to ASSERT that it got the whole log chain.
 	 */
-	(void) zio_wait(zio);
+	if (zio->io_error == 0)
+		zilog->zl_commit_lr_seq = zilog->zl_lr_seq;
 
-	spa_config_exit(spa, SCL_STATE, FTAG);
+	while ((zcw = list_head(&lwb->lwb_waiters)) != NULL) {
+		list_remove(&lwb->lwb_waiters, zcw);
+		zil_commit_waiter_done(zcw, zio->io_error);
+	}
+
+	mutex_exit(&zilog->zl_lock);
+
+	/*
+	 * Now that this log block is durable, we have a stable pointer to
+	 * the next block in the chain, so it's OK to let the txg in which
+	 * we allocated the next block sync.
+	 */
+	dmu_tx_commit(tx);
 }
 
 /*
- * Function called when a log block write completes
+ * Function called when a log block write completes.  Issue the cache
+ * flushes for every vdev the lwb touched as children of its root zio.
  */
 static void
 zil_lwb_write_done(zio_t *zio)
 {
 	lwb_t *lwb = zio->io_private;
+	spa_t *spa = zio->io_spa;
 	zilog_t *zilog = lwb->lwb_zilog;
-	dmu_tx_t *tx = lwb->lwb_tx;
+	avl_tree_t *t = &lwb->lwb_vdev_tree;
+	void *cookie = NULL;
+	zil_vdev_node_t *zv;
 
 	ASSERT(BP_GET_COMPRESS(zio->io_bp) == ZIO_COMPRESS_OFF);
 	ASSERT(BP_GET_TYPE(zio->io_bp) == DMU_OT_INTENT_LOG);
@@ -863,59 +953,87 @@ zil_lwb_write_done(zio_t *zio)
 	ASSERT(!BP_IS_HOLE(zio->io_bp));
 	ASSERT(zio->io_bp->blk_fill == 0);
 
-	/*
-	 * Ensure the lwb buffer pointer is cleared before releasing
-	 * the txg. If we have had an allocation failure and
-	 * the txg is waiting to sync then we want want zil_sync()
-	 * to remove the lwb so that it's not picked up as the next new
-	 * one in zil_commit_writer(). zil_sync() will only remove
-	 * the lwb if lwb_buf is null.
-	 */
+	abd_put(zio->io_abd);
 	zio_buf_free(lwb->lwb_buf, lwb->lwb_sz);
+
 	mutex_enter(&zilog->zl_lock);
-	lwb->lwb_zio = NULL;
+	ASSERT3S(lwb->lwb_state, ==, LWB_STATE_ISSUED);
+	lwb->lwb_state = LWB_STATE_WRITE_DONE;
+	lwb->lwb_write_zio = NULL;
 	lwb->lwb_fastwrite = FALSE;
 	lwb->lwb_buf = NULL;
-	lwb->lwb_tx = NULL;
 	mutex_exit(&zilog->zl_lock);
 
 	/*
-	 * Now that we've written this log block, we have a stable pointer
-	 * to the next block in the chain, so it's OK to let the txg in
-	 * which we allocated the next block sync.
+	 * All dmu_sync() children of the write are done, so no one else
+	 * touches lwb_vdev_tree now.  If the write failed there is no point
+	 * in flushing; the error has already reached the root zio.
 	 */
-	dmu_tx_commit(tx);
+	while ((zv = avl_destroy_nodes(t, &cookie)) != NULL) {
+		if (zio->io_error == 0) {
+			vdev_t *vd = vdev_lookup_top(spa, zv->zv_vdev);
+			if (vd != NULL)
+				zio_flush(lwb->lwb_root_zio, vd);
+		}
+		kmem_free(zv, sizeof (*zv));
+	}
 }
 
 /*
- * Initialize the io for a log block.
+ * Open an lwb: create its root and write zios so that itxs can be
+ * assigned to it.
  */
 static void
 zil_lwb_write_init(zilog_t *zilog, lwb_t *lwb)
 {
 	zbookmark_t zb;
+	abd_t *lwb_abd;
+	lwb_t *prev;
 
 	SET_BOOKMARK(&zb, lwb->lwb_blk.blk_cksum.zc_word[ZIL_ZC_OBJSET],
 	    ZB_ZIL_OBJECT, ZB_ZIL_LEVEL,
 	    lwb->lwb_blk.blk_cksum.zc_word[ZIL_ZC_SEQ]);
 
-	if (zilog->zl_root_zio == NULL) {
-		zilog->zl_root_zio = zio_root(zilog->zl_spa, NULL, NULL,
-		    ZIO_FLAG_CANFAIL);
-	}
-
 	/* Lock so zil_sync() doesn't fastwrite_unmark after zio is created */
 	mutex_enter(&zilog->zl_lock);
-	if (lwb->lwb_zio == NULL) {
+	if (lwb->lwb_state == LWB_STATE_CLOSED) {
+		ASSERT3P(lwb->lwb_root_zio, ==, NULL);
+		ASSERT3P(lwb->lwb_write_zio, ==, NULL);
+
 		if (!lwb->lwb_fastwrite) {
 			metaslab_fastwrite_mark(zilog->zl_spa, &lwb->lwb_blk);
 			lwb->lwb_fastwrite = 1;
 		}
-		lwb->lwb_zio = zio_rewrite(zilog->zl_root_zio, zilog->zl_spa,
-		    0, &lwb->lwb_blk, lwb->lwb_buf, BP_GET_LSIZE(&lwb->lwb_blk),
-		    zil_lwb_write_done, lwb, ZIO_PRIORITY_LOG_WRITE,
-		    ZIO_FLAG_CANFAIL | ZIO_FLAG_DONT_PROPAGATE |
+		lwb_abd = abd_get_from_buf(lwb->lwb_buf,
+		    BP_GET_LSIZE(&lwb->lwb_blk));
+		lwb->lwb_root_zio = zio_root(zilog->zl_spa,
+		    zil_lwb_flush_vdevs_done, lwb, ZIO_FLAG_CANFAIL);
+
+		/*
+		 * The write propagates its errors to the root zio so that
+		 * they reach the waiters on this lwb.
+		 */
+		lwb->lwb_write_zio = zio_rewrite(lwb->lwb_root_zio,
+		    zilog->zl_spa, 0, &lwb->lwb_blk, lwb_abd,
+		    BP_GET_LSIZE(&lwb->lwb_blk), zil_lwb_write_done, lwb,
+		    ZIO_PRIORITY_SYNC_WRITE, ZIO_FLAG_CANFAIL |
 		    ZIO_FLAG_FASTWRITE, &zb);
+
+		/*
+		 * Waiters on this lwb also depend on every earlier lwb being
+		 * durable, so make the previous lwb's root zio a child of
+		 * ours.  Its completion (and any error) then has to happen
+		 * before ours, which lets lwbs be in flight concurrently
+		 * while waiters are still woken in log order.
+		 */
+		prev = zilog->zl_last_lwb_opened;
+		if (prev != NULL && prev->lwb_state != LWB_STATE_FLUSH_DONE) {
+			ASSERT(prev->lwb_state == LWB_STATE_ISSUED ||
+			    prev->lwb_state == LWB_STATE_WRITE_DONE);
+			zio_add_child(lwb->lwb_root_zio, prev->lwb_root_zio);
+		}
+		zilog->zl_last_lwb_opened = lwb;
+		lwb->lwb_state = LWB_STATE_OPENED;
 	}
 	mutex_exit(&zilog->zl_lock);
 }
@@ -924,7 +1042,7 @@ zil_lwb_write_init(zilog_t *zilog, lwb_t *lwb)
  * Define a limited set of intent log block sizes.
  * These must be a multiple of 4KB. Note only the amount used (again
  * aligned to 4KB) actually gets written. However, we can't always just
- * allocate SPA_MAXBLOCKSIZE as the slog space could be exhausted.
+ * allocate SPA_OLD_MAXBLOCKSIZE as the slog space could be exhausted.
  */
 uint64_t zil_block_buckets[] = {
     4096,		/* non TX_WRITE */
@@ -943,11 +1061,11 @@ unsigned long zil_slog_limit = 1024 * 1024;
 	((zilog)->zl_itx_list_sz < (zil_slog_limit << 1)))
 
 /*
- * Start a log block write and advance to the next log block.
- * Calls are serialized.
+ * Issue a log block write and advance to the next log block.
+ * Calls are serialized by zl_issuer_lock.
  */
 static lwb_t *
-zil_lwb_write_start(zilog_t *zilog, lwb_t *lwb)
+zil_lwb_write_issue(zilog_t *zilog, lwb_t *lwb)
 {
 	lwb_t *nlwb = NULL;
 	zil_chain_t *zilc;
@@ -967,6 +1085,8 @@ zil_lwb_write_start(zilog_t *zilog, lwb_t *lwb)
 		bp = &zilc->zc_next_blk;
 	}
 
+	ASSERT(MUTEX_HELD(&zilog->zl_issuer_lock));
+	ASSERT3S(lwb->lwb_state, ==, LWB_STATE_OPENED);
 	ASSERT(lwb->lwb_nused <= lwb->lwb_sz);
 
 	/*
@@ -974,7 +1094,8 @@ zil_lwb_write_start(zilog_t *zilog, lwb_t *lwb)
 	 * before writing it in order to establish the log chain.
 	 * Note that if the allocation of nlwb synced before we wrote
 	 * the block that points at it (lwb), we'd leak it if we crashed.
-	 * Therefore, we don't do dmu_tx_commit() until zil_lwb_write_done().
+	 * Therefore, we don't do dmu_tx_commit() until
+	 * zil_lwb_flush_vdevs_done().
 	 * We dirty the dataset to ensure that zil_sync() will be called
 	 * to clean up in the event of allocation failure or I/O failure.
 	 */
@@ -1006,7 +1127,7 @@ zil_lwb_write_start(zilog_t *zilog, lwb_t *lwb)
 		continue;
 	zil_blksz = zil_block_buckets[i];
 	if (zil_blksz == UINT64_MAX)
-		zil_blksz = SPA_MAXBLOCKSIZE;
+		zil_blksz = SPA_OLD_MAXBLOCKSIZE;
 	zilog->zl_prev_blks[zilog->zl_prev_rotor] = zil_blksz;
 	for (i = 0; i < ZIL_PREV_BLKS; i++)
 		zil_blksz = MAX(zil_blksz, zilog->zl_prev_blks[i]);
@@ -1035,16 +1156,16 @@ zil_lwb_write_start(zilog_t *zilog, lwb_t *lwb)
 		 * Allocate a new log write buffer (lwb).
 		 */
 		nlwb = zil_alloc_lwb(zilog, bp, txg, TRUE);
-
-		/* Record the block for later vdev flushing */
-		zil_add_block(zilog, &lwb->lwb_blk);
 	}
 
+	/* Record the block for later vdev flushing */
+	zil_lwb_add_block(lwb, &lwb->lwb_blk);
+
 	if (BP_GET_CHECKSUM(&lwb->lwb_blk) == ZIO_CHECKSUM_ZILOG2) {
 		/* For Slim ZIL only write what is used. */
 		wsz = P2ROUNDUP_TYPED(lwb->lwb_nused, ZIL_MIN_BLKSZ, uint64_t);
 		ASSERT3U(wsz, <=, lwb->lwb_sz);
-		zio_shrink(lwb->lwb_zio, wsz);
+		zio_shrink(lwb->lwb_write_zio, wsz);
 
 	} else {
 		wsz = lwb->lwb_sz;
@@ -1059,7 +1180,20 @@ zil_lwb_write_start(zilog_t *zilog, lwb_t *lwb)
 	 */
 	bzero(lwb->lwb_buf + lwb->lwb_nused, wsz - lwb->lwb_nused);
 
-	zio_nowait(lwb->lwb_zio); /* Kick off the write for the old log block */
+	/*
+	 * The SCL_STATE lock is held until zil_lwb_flush_vdevs_done() so
+	 * that zil_lwb_write_done() can look up the vdevs to flush.
+	 */
+	spa_config_enter(spa, SCL_STATE, lwb, RW_READER);
+
+	mutex_enter(&zilog->zl_lock);
+	lwb->lwb_state = LWB_STATE_ISSUED;
+	lwb->lwb_issued_timestamp = gethrtime();
+	mutex_exit(&zilog->zl_lock);
+
+	/* Kick off the write for the old log block */
+	zio_nowait(lwb->lwb_root_zio);
+	zio_nowait(lwb->lwb_write_zio);
 
 	/*
 	 * If there was an allocation failure then nlwb will be null which
@@ -1081,6 +1215,7 @@ zil_lwb_commit(zilog_t *zilog, itx_t *itx, lwb_t *lwb)
 	if (lwb == NULL)
 		return (NULL);
 
+	ASSERT(MUTEX_HELD(&zilog->zl_issuer_lock));
 	ASSERT(lwb->lwb_buf != NULL);
 	ASSERT(zilog_is_dirty(zilog) ||
 	    spa_freeze_txg(zilog->zl_spa) != UINT64_MAX);
@@ -1097,7 +1232,7 @@ zil_lwb_commit(zilog_t *zilog, itx_t *itx, lwb_t *lwb)
 	 * If this record won't fit in the current log block, start a new one.
 	 */
 	if (lwb->lwb_nused + reclen + dlen > lwb->lwb_sz) {
-		lwb = zil_lwb_write_start(zilog, lwb);
+		lwb = zil_lwb_write_issue(zilog, lwb);
 		if (lwb == NULL)
 			return (NULL);
 		zil_lwb_write_init(zilog, lwb);
@@ -1140,8 +1275,8 @@ zil_lwb_commit(zilog_t *zilog, itx_t *itx, lwb_t *lwb)
 				ZIL_STAT_BUMP(zil_itx_indirect_count);
 				ZIL_STAT_INCR(zil_itx_indirect_bytes, lrw->lr_length);
 			}
-			error = zilog->zl_get_data(
-			    itx->itx_private, lrw, dbuf, lwb->lwb_zio);
+			error = zilog->zl_get_data(itx->itx_private,
+			    lrw, dbuf, lwb, lwb->lwb_write_zio);
 			if (error == EIO) {
 				txg_wait_synced(zilog->zl_dmu_pool, txg);
 				return (lwb);
@@ -1160,7 +1295,7 @@ zil_lwb_commit(zilog_t *zilog, itx_t *itx, lwb_t *lwb)
 	 * equal to the itx sequence number because not all transactions
 	 * are synchronous, and sometimes spa_sync() gets there first.
 	 */
-	lrc->lrc_seq = ++zilog->zl_lr_seq; /* we are single threaded */
+	lrc->lrc_seq = ++zilog->zl_lr_seq; /* under zl_issuer_lock */
 	lwb->lwb_nused += reclen + dlen;
 	lwb->lwb_max_txg = MAX(lwb->lwb_max_txg, txg);
 	ASSERT3U(lwb->lwb_nused, <=, lwb->lwb_sz);
@@ -1209,6 +1344,12 @@ zil_itxg_clean(itxs_t *itxs)
 	list = &itxs->i_sync_list;
 	while ((itx = list_head(list)) != NULL) {
 		list_remove(list, itx);
+		/*
+		 * The txg has synced, so a commit waiter that never made it
+		 * onto a commit list is done.
+		 */
+		if (itx->itx_lr.lrc_txtype == TX_COMMIT)
+			zil_commit_waiter_skip(itx->itx_private);
 		kmem_free(itx, offsetof(itx_t, itx_lr) +
 		    itx->itx_lr.lrc_reclen);
 	}
@@ -1496,78 +1637,218 @@ zil_async_to_sync(zilog_t *zilog, uint64_t foid)
 	}
 }
 
+/*
+ * Walk the commit list, assigning each itx to an lwb.  An lwb is issued as
+ * soon as it is full, so several lwbs can be in flight at once; the last
+ * one is issued before returning.  TX_COMMIT itxs are not written; their
+ * waiters are linked to the lwb holding everything that came before them.
+ */
 static void
-zil_commit_writer(zilog_t *zilog)
+zil_process_commit_list(zilog_t *zilog)
 {
-	uint64_t txg;
-	itx_t *itx;
-	lwb_t *lwb;
 	spa_t *spa = zilog->zl_spa;
-	int error = 0;
-
-	ASSERT(zilog->zl_root_zio == NULL);
-
-	mutex_exit(&zilog->zl_lock);
+	list_t nolwb_waiters;
+	zil_commit_waiter_t *zcw;
+	lwb_t *lwb;
+	itx_t *itx;
 
-	zil_get_commit_list(zilog);
+	ASSERT(MUTEX_HELD(&zilog->zl_issuer_lock));
 
 	/*
 	 * Return if there's nothing to commit before we dirty the fs by
 	 * calling zil_create().
 	 */
-	if (list_head(&zilog->zl_itx_commit_list) == NULL) {
-		mutex_enter(&zilog->zl_lock);
+	if (list_head(&zilog->zl_itx_commit_list) == NULL)
 		return;
-	}
+
+	list_create(&nolwb_waiters, sizeof (zil_commit_waiter_t),
+	    offsetof(zil_commit_waiter_t, zcw_node));
+
+	mutex_enter(&zilog->zl_lock);
+	lwb = list_tail(&zilog->zl_lwb_list);
+	mutex_exit(&zilog->zl_lock);
 
 	if (zilog->zl_suspend) {
 		lwb = NULL;
-	} else {
-		lwb = list_tail(&zilog->zl_lwb_list);
-		if (lwb == NULL)
-			lwb = zil_create(zilog);
+	} else if (lwb == NULL) {
+		lwb = zil_create(zilog);
+	} else if (lwb->lwb_state != LWB_STATE_CLOSED &&
+	    lwb->lwb_state != LWB_STATE_OPENED) {
+		/*
+		 * The tail has already been issued, which means an earlier
+		 * allocation failed and the chain is broken; fall back to
+		 * txg_wait_synced() until zil_sync() cleans up the chain.
+		 */
+		lwb = NULL;
 	}
 
 	DTRACE_PROBE1(zil__cw1, zilog_t *, zilog);
 	while ((itx = list_head(&zilog->zl_itx_commit_list))) {
-		txg = itx->itx_lr.lrc_txg;
+		lr_t *lrc = &itx->itx_lr;
+		uint64_t txg = lrc->lrc_txg;
+		boolean_t synced;
+
 		ASSERT(txg);
+		synced = (txg <= spa_last_synced_txg(spa) &&
+		    txg <= spa_freeze_txg(spa));
 
-		if (txg > spa_last_synced_txg(spa) || txg > spa_freeze_txg(spa))
+		if (lrc->lrc_txtype == TX_COMMIT) {
+			lwb_t *last;
+
+			zcw = itx->itx_private;
+			if (synced) {
+				zil_commit_waiter_skip(zcw);
+			} else if (lwb == NULL) {
+				list_insert_tail(&nolwb_waiters, zcw);
+			} else {
+				/*
+				 * If nothing has gone into the current lwb,
+				 * everything before this waiter is in the
+				 * last lwb we opened (or is already durable).
+				 */
+				mutex_enter(&zilog->zl_lock);
+				last = zilog->zl_last_lwb_opened;
+				if (lwb->lwb_state == LWB_STATE_OPENED) {
+					zil_commit_waiter_link(lwb, zcw);
+				} else if (last != NULL &&
+				    last->lwb_state != LWB_STATE_FLUSH_DONE) {
+					zil_commit_waiter_link(last, zcw);
+				} else {
+					zil_commit_waiter_skip(zcw);
+				}
+				mutex_exit(&zilog->zl_lock);
+			}
+		} else if (!synced && lwb != NULL) {
 			lwb = zil_lwb_commit(zilog, itx, lwb);
+		}
+
 		list_remove(&zilog->zl_itx_commit_list, itx);
 		kmem_free(itx, offsetof(itx_t, itx_lr)
 		    + itx->itx_lr.lrc_reclen);
 	}
 	DTRACE_PROBE1(zil__cw2, zilog_t *, zilog);
 
+	/*
+	 * Without an lwb we can't write anything, so the remaining waiters
+	 * have to wait for their txgs to sync.
+	 */
+	if (!list_is_empty(&nolwb_waiters)) {
+		txg_wait_synced(zilog->zl_dmu_pool, 0);
+		while ((zcw = list_head(&nolwb_waiters)) != NULL) {
+			list_remove(&nolwb_waiters, zcw);
+			zil_commit_waiter_skip(zcw);
+		}
+	}
+	list_destroy(&nolwb_waiters);
+
 	/* write the last block out */
-	if (lwb != NULL && lwb->lwb_zio != NULL)
-		lwb = zil_lwb_write_start(zilog, lwb);
+	if (lwb != NULL && lwb->lwb_state == LWB_STATE_OPENED)
+		(void) zil_lwb_write_issue(zilog, lwb);
 
 	zilog->zl_cur_used = 0;
+}
 
-	/*
-	 * Wait if necessary for the log blocks to be on stable storage.
-	 */
-	if (zilog->zl_root_zio) {
-		error = zio_wait(zilog->zl_root_zio);
-		zilog->zl_root_zio = NULL;
-		zil_flush_vdevs(zilog);
+/*
+ * Assign the pending itxs to lwbs, unless another thread has already
+ * done that for this waiter's itx while we were waiting for the
+ * issuer lock.
+ */
+static void
+zil_commit_writer(zilog_t *zilog, zil_commit_waiter_t *zcw)
+{
+	boolean_t pending;
+
+	mutex_enter(&zilog->zl_issuer_lock);
+
+	mutex_enter(&zcw->zcw_lock);
+	pending = (zcw->zcw_lwb == NULL && !zcw->zcw_done);
+	mutex_exit(&zcw->zcw_lock);
+
+	if (pending) {
+		ZIL_STAT_BUMP(zil_commit_writer_count);
+		zil_get_commit_list(zilog);
+		zil_process_commit_list(zilog);
 	}
 
-	if (error || lwb == NULL)
-		txg_wait_synced(zilog->zl_dmu_pool, 0);
+	mutex_exit(&zilog->zl_issuer_lock);
+}
+
+static zil_commit_waiter_t *
+zil_alloc_commit_waiter(void)
+{
+	zil_commit_waiter_t *zcw = kmem_cache_alloc(zil_zcw_cache, KM_SLEEP);
+
+	cv_init(&zcw->zcw_cv, NULL, CV_DEFAULT, NULL);
+	mutex_init(&zcw->zcw_lock, NULL, MUTEX_DEFAULT, NULL);
+	list_link_init(&zcw->zcw_node);
+	zcw->zcw_lwb = NULL;
+	zcw->zcw_done = B_FALSE;
+	zcw->zcw_zio_error = 0;
+
+	return (zcw);
+}
+
+static void
+zil_free_commit_waiter(zil_commit_waiter_t *zcw)
+{
+	ASSERT(!list_link_active(&zcw->zcw_node));
+	ASSERT3P(zcw->zcw_lwb, ==, NULL);
+	ASSERT(zcw->zcw_done);
+	mutex_destroy(&zcw->zcw_lock);
+	cv_destroy(&zcw->zcw_cv);
+	kmem_cache_free(zil_zcw_cache, zcw);
+}
+
+/*
+ * Wait for every lwb already issued to reach stable storage.  Because each
+ * lwb's root zio depends on the one opened before it, waiting on the most
+ * recently opened lwb covers all of them.
+ */
+static void
+zil_commit_wait_issued(zilog_t *zilog)
+{
+	zil_commit_waiter_t *zcw = zil_alloc_commit_waiter();
+	lwb_t *last;
 
+	mutex_enter(&zilog->zl_issuer_lock);
 	mutex_enter(&zilog->zl_lock);
+	last = zilog->zl_last_lwb_opened;
+	if (last != NULL && last->lwb_state != LWB_STATE_FLUSH_DONE) {
+		ASSERT(last->lwb_state != LWB_STATE_OPENED);
+		zil_commit_waiter_link(last, zcw);
+	} else {
+		zil_commit_waiter_skip(zcw);
+	}
+	mutex_exit(&zilog->zl_lock);
+	mutex_exit(&zilog->zl_issuer_lock);
 
-	/*
-	 * Remember the highest committed log sequence number for ztest.
-	 * We only update this value when all the log writes succeeded,
-	 * because ztest wants to ASSERT that it got the whole log chain.
-	 */
-	if (error == 0 && lwb != NULL)
-		zilog->zl_commit_lr_seq = zilog->zl_lr_seq;
+	mutex_enter(&zcw->zcw_lock);
+	while (!zcw->zcw_done)
+		cv_wait(&zcw->zcw_cv, &zcw->zcw_lock);
+	mutex_exit(&zcw->zcw_lock);
+
+	zil_free_commit_waiter(zcw);
+}
+
+/*
+ * Put a TX_COMMIT itx for the waiter at the end of the sync list, so that
+ * it is ordered after every itx this commit has to wait for.
+ */
+static void
+zil_commit_itx_assign(zilog_t *zilog, zil_commit_waiter_t *zcw)
+{
+	dmu_tx_t *tx = dmu_tx_create(zilog->zl_os);
+	itx_t *itx;
+
+	VERIFY(dmu_tx_assign(tx, TXG_WAIT) == 0);
+
+	itx = zil_itx_create(TX_COMMIT, sizeof (lr_t));
+	itx->itx_sync = B_TRUE;
+	itx->itx_private = zcw;
+
+	zil_itx_assign(zilog, itx, tx);
+
+	dmu_tx_commit(tx);
 }
 
 /*
@@ -1575,28 +1856,21 @@ zil_commit_writer(zilog_t *zilog)
  * If foid is 0 push out all transactions, otherwise push only those
  * for that object or might reference that object.
  *
- * itxs are committed in batches. In a heavily stressed zil there will be
- * a commit writer thread who is writing out a bunch of itxs to the log
- * for a set of committing threads (cthreads) in the same batch as the writer.
- * Those cthreads are all waiting on the same cv for that batch.
- *
- * There will also be a different and growing batch of threads that are
- * waiting to commit (qthreads). When the committing batch completes
- * a transition occurs such that the cthreads exit and the qthreads become
- * cthreads. One of the new cthreads becomes the writer thread for the
- * batch. Any new threads arriving become new qthreads.
- *
- * Only 2 condition variables are needed and there's no transition
- * between the two cvs needed. They just flip-flop between qthreads
- * and cthreads.
- *
- * Using this scheme we can efficiently wakeup up only those threads
- * that have been committed.
+ * Each caller queues a TX_COMMIT itx carrying a zil_commit_waiter_t behind
+ * the itxs it depends on, then tries to become the issuer.  The issuer
+ * (one per ZIL at a time, serialized by zl_issuer_lock) copies the pending
+ * itxs into lwbs and issues each lwb as soon as it fills, so a burst of
+ * commits keeps several log blocks in flight instead of writing and
+ * flushing them one batch at a time.  Waiters are linked to the lwb that
+ * holds everything before them and are woken as soon as that lwb, and
+ * every lwb ahead of it, is on stable storage.  A caller whose waiter was
+ * already handled by another issuer simply waits.
  */
 void
 zil_commit(zilog_t *zilog, uint64_t foid)
 {
-	uint64_t mybatch;
+	zil_commit_waiter_t *zcw;
+	hrtime_t start;
 
     // OSX often has NULL zil for some reason
     if (!zilog) return;
@@ -1606,33 +1880,41 @@ zil_commit(zilog_t *zilog, uint64_t foid)
 
 	ZIL_STAT_BUMP(zil_commit_count);
 
+	/*
+	 * While the log is suspended nothing new is written to it, so we
+	 * rely on txg_wait_synced() instead.  Let the lwbs already in flight
+	 * finish first so that zil_suspend() can safely zil_destroy() them.
+	 */
+	if (zilog->zl_suspend > 0) {
+		zil_commit_wait_issued(zilog);
+		txg_wait_synced(zilog->zl_dmu_pool, 0);
+		return;
+	}
+
+	start = gethrtime();
+
 	/* move the async itxs for the foid to the sync queues */
 	zil_async_to_sync(zilog, foid);
 
-	mutex_enter(&zilog->zl_lock);
-	mybatch = zilog->zl_next_batch;
-	while (zilog->zl_writer) {
-		cv_wait(&zilog->zl_cv_batch[mybatch & 1], &zilog->zl_lock);
-		if (mybatch <= zilog->zl_com_batch) {
-			mutex_exit(&zilog->zl_lock);
-			return;
-		}
-	}
+	zcw = zil_alloc_commit_waiter();
+	zil_commit_itx_assign(zilog, zcw);
+	zil_commit_writer(zilog, zcw);
 
-	zilog->zl_next_batch++;
-	zilog->zl_writer = B_TRUE;
-	ZIL_STAT_BUMP(zil_commit_writer_count);
-	zil_commit_writer(zilog);
-	zilog->zl_com_batch = mybatch;
-	zilog->zl_writer = B_FALSE;
+	mutex_enter(&zcw->zcw_lock);
+	while (!zcw->zcw_done)
+		cv_wait(&zcw->zcw_cv, &zcw->zcw_lock);
+	mutex_exit(&zcw->zcw_lock);
 
-	/* wake up one thread to become the next writer */
-	cv_signal(&zilog->zl_cv_batch[(mybatch+1) & 1]);
+	/*
+	 * A log write or flush failed somewhere in the chain ahead of us,
+	 * so fall back to waiting for the txgs to sync.
+	 */
+	if (zcw->zcw_zio_error != 0)
+		txg_wait_synced(zilog->zl_dmu_pool, 0);
 
-	/* wake up all threads waiting for this batch to be committed */
-	cv_broadcast(&zilog->zl_cv_batch[mybatch & 1]);
+	zil_free_commit_waiter(zcw);
 
-	mutex_exit(&zilog->zl_lock);
+	zil_lat_histogram_add(zil_lat_stats.zls_commit, gethrtime() - start);
 }
 
 /*
@@ -1688,13 +1970,18 @@ zil_sync(zilog_t *zilog, dmu_tx_t *tx)
 
 	while ((lwb = list_head(&zilog->zl_lwb_list)) != NULL) {
 		zh->zh_log = lwb->lwb_blk;
-		if (lwb->lwb_buf != NULL || lwb->lwb_max_txg > txg)
+		if (lwb->lwb_state != LWB_STATE_FLUSH_DONE ||
+		    lwb->lwb_max_txg > txg)
 			break;
 
-		ASSERT(lwb->lwb_zio == NULL);
+		ASSERT3P(lwb->lwb_write_zio, ==, NULL);
+		ASSERT3P(lwb->lwb_root_zio, ==, NULL);
+		ASSERT(list_is_empty(&lwb->lwb_waiters));
 
 		list_remove(&zilog->zl_lwb_list, lwb);
 		zio_free_zil(spa, txg, &lwb->lwb_blk);
+		if (zilog->zl_last_lwb_opened == lwb)
+			zilog->zl_last_lwb_opened = NULL;
 		kmem_cache_free(zil_lwb_cache, lwb);
 
 		/*
@@ -1713,7 +2000,7 @@ zil_sync(zilog_t *zilog, dmu_tx_t *tx)
 	 * unused, long-lived LWBs.
 	 */
 	for (; lwb != NULL; lwb = list_next(&zilog->zl_lwb_list, lwb)) {
-		if (lwb->lwb_fastwrite && !lwb->lwb_zio) {
+		if (lwb->lwb_fastwrite && lwb->lwb_state == LWB_STATE_CLOSED) {
 			metaslab_fastwrite_unmark(zilog->zl_spa, &lwb->lwb_blk);
 			lwb->lwb_fastwrite = 0;
 		}
@@ -1722,11 +2009,42 @@ zil_sync(zilog_t *zilog, dmu_tx_t *tx)
 	mutex_exit(&zilog->zl_lock);
 }
 
+/* ARGSUSED */
+static int
+zil_lwb_cons(void *vbuf, void *unused, int kmflag)
+{
+	lwb_t *lwb = vbuf;
+
+	list_create(&lwb->lwb_waiters, sizeof (zil_commit_waiter_t),
+	    offsetof(zil_commit_waiter_t, zcw_node));
+	avl_create(&lwb->lwb_vdev_tree, zil_vdev_compare,
+	    sizeof (zil_vdev_node_t), offsetof(zil_vdev_node_t, zv_node));
+	mutex_init(&lwb->lwb_vdev_lock, NULL, MUTEX_DEFAULT, NULL);
+	return (0);
+}
+
+/* ARGSUSED */
+static void
+zil_lwb_dest(void *vbuf, void *unused)
+{
+	lwb_t *lwb = vbuf;
+
+	mutex_destroy(&lwb->lwb_vdev_lock);
+	avl_destroy(&lwb->lwb_vdev_tree);
+	list_destroy(&lwb->lwb_waiters);
+}
+
 void
 zil_init(void)
 {
+	int i;
+
 	zil_lwb_cache = kmem_cache_create("zil_lwb_cache",
-	    sizeof (struct lwb), 0, NULL, NULL, NULL, NULL, NULL, 0);
+	    sizeof (struct lwb), 0, zil_lwb_cons, zil_lwb_dest, NULL, NULL,
+	    NULL, 0);
+
+	zil_zcw_cache = kmem_cache_create("zil_zcw_cache",
+	    sizeof (zil_commit_waiter_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
 
 	zil_ksp = kstat_create("zfs", 0, "zil", "misc",
 	    KSTAT_TYPE_NAMED, sizeof(zil_stats) / sizeof(kstat_named_t),
@@ -1736,13 +2054,40 @@ zil_init(void)
 		zil_ksp->ks_data = &zil_stats;
 		kstat_install(zil_ksp);
 	}
+
+	for (i = 0; i < ZIL_LAT_BUCKETS; i++) {
+		kstat_named_t *c = &zil_lat_stats.zls_commit[i];
+		kstat_named_t *l = &zil_lat_stats.zls_lwb[i];
+
+		(void) snprintf(c->name, KSTAT_STRLEN, "commit_%lluus",
+		    (u_longlong_t)1 << i);
+		c->data_type = KSTAT_DATA_UINT64;
+		(void) snprintf(l->name, KSTAT_STRLEN, "lwb_%lluus",
+		    (u_longlong_t)1 << i);
+		l->data_type = KSTAT_DATA_UINT64;
+	}
+
+	zil_lat_ksp = kstat_create("zfs", 0, "zil_latency", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (zil_lat_stats) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+
+	if (zil_lat_ksp != NULL) {
+		zil_lat_ksp->ks_data = &zil_lat_stats;
+		kstat_install(zil_lat_ksp);
+	}
 }
 
 void
 zil_fini(void)
 {
+	kmem_cache_destroy(zil_zcw_cache);
 	kmem_cache_destroy(zil_lwb_cache);
 
+	if (zil_lat_ksp != NULL) {
+		kstat_delete(zil_lat_ksp);
+		zil_lat_ksp = NULL;
+	}
+
 	if (zil_ksp != NULL) {
 		kstat_delete(zil_ksp);
 		zil_ksp = NULL;
@@ -1776,9 +2121,10 @@ zil_alloc(objset_t *os, zil_header_t *zh_phys)
 	zilog->zl_destroy_txg = TXG_INITIAL - 1;
 	zilog->zl_logbias = dmu_objset_logbias(os);
 	zilog->zl_sync = dmu_objset_syncprop(os);
-	zilog->zl_next_batch = 1;
+	zilog->zl_last_lwb_opened = NULL;
 
 	mutex_init(&zilog->zl_lock, NULL, MUTEX_DEFAULT, NULL);
+	mutex_init(&zilog->zl_issuer_lock, NULL, MUTEX_DEFAULT, NULL);
 
 	for (i = 0; i < TXG_SIZE; i++) {
 		mutex_init(&zilog->zl_itxg[i].itxg_lock, NULL,
@@ -1791,15 +2137,7 @@ zil_alloc(objset_t *os, zil_header_t *zh_phys)
 	list_create(&zilog->zl_itx_commit_list, sizeof (itx_t),
 	    offsetof(itx_t, itx_node));
 
-	mutex_init(&zilog->zl_vdev_lock, NULL, MUTEX_DEFAULT, NULL);
-
-	avl_create(&zilog->zl_vdev_tree, zil_vdev_compare,
-	    sizeof (zil_vdev_node_t), offsetof(zil_vdev_node_t, zv_node));
-
-	cv_init(&zilog->zl_cv_writer, NULL, CV_DEFAULT, NULL);
 	cv_init(&zilog->zl_cv_suspend, NULL, CV_DEFAULT, NULL);
-	cv_init(&zilog->zl_cv_batch[0], NULL, CV_DEFAULT, NULL);
-	cv_init(&zilog->zl_cv_batch[1], NULL, CV_DEFAULT, NULL);
 
 	return (zilog);
 }
@@ -1817,9 +2155,6 @@ zil_free(zilog_t *zilog)
 	ASSERT(list_is_empty(&zilog->zl_lwb_list));
 	list_destroy(&zilog->zl_lwb_list);
 
-	avl_destroy(&zilog->zl_vdev_tree);
-	mutex_destroy(&zilog->zl_vdev_lock);
-
 	ASSERT(list_is_empty(&zilog->zl_itx_commit_list));
 	list_destroy(&zilog->zl_itx_commit_list);
 
@@ -1836,12 +2171,10 @@ zil_free(zilog_t *zilog)
 		mutex_destroy(&zilog->zl_itxg[i].itxg_lock);
 	}
 
+	mutex_destroy(&zilog->zl_issuer_lock);
 	mutex_destroy(&zilog->zl_lock);
 
-	cv_destroy(&zilog->zl_cv_writer);
 	cv_destroy(&zilog->zl_cv_suspend);
-	cv_destroy(&zilog->zl_cv_batch[0]);
-	cv_destroy(&zilog->zl_cv_batch[1]);
 
 	kmem_free(zilog, sizeof (zilog_t));
 }
@@ -1902,13 +2235,16 @@ zil_close(zilog_t *zilog)
 	lwb = list_head(&zilog->zl_lwb_list);
 	if (lwb != NULL) {
 		ASSERT(lwb == list_tail(&zilog->zl_lwb_list));
-		ASSERT(lwb->lwb_zio == NULL);
+		ASSERT(lwb->lwb_state == LWB_STATE_CLOSED ||
+		    lwb->lwb_state == LWB_STATE_FLUSH_DONE);
 		if (lwb->lwb_fastwrite)
 			metaslab_fastwrite_unmark(zilog->zl_spa, &lwb->lwb_blk);
 		list_remove(&zilog->zl_lwb_list, lwb);
-		zio_buf_free(lwb->lwb_buf, lwb->lwb_sz);
+		if (lwb->lwb_buf != NULL)
+			zio_buf_free(lwb->lwb_buf, lwb->lwb_sz);
 		kmem_cache_free(zil_lwb_cache, lwb);
 	}
+	zilog->zl_last_lwb_opened = NULL;
 	mutex_exit(&zilog->zl_lock);
 }
 
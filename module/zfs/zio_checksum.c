@@ -66,17 +66,39 @@ zio_checksum_off(const void *buf, uint64_t size, zio_cksum_t *zcp)
 	ZIO_SET_CHECKSUM(zcp, 0, 0, 0, 0);
 }
 
+/*
+ * The ci_incr functions let a scattered buffer be checksummed one chunk at
+ * a time; checksums without one are computed over a borrowed linear copy.
+ */
 zio_checksum_info_t zio_checksum_table[ZIO_CHECKSUM_FUNCTIONS] = {
-	{{NULL,			NULL},			0, 0, 0, "inherit"},
-	{{NULL,			NULL},			0, 0, 0, "on"},
-	{{zio_checksum_off,	zio_checksum_off},	0, 0, 0, "off"},
-	{{zio_checksum_SHA256,	zio_checksum_SHA256},	1, 1, 0, "label"},
-	{{zio_checksum_SHA256,	zio_checksum_SHA256},	1, 1, 0, "gang_header"},
-	{{fletcher_2_native,	fletcher_2_byteswap},	0, 1, 0, "zilog"},
-	{{fletcher_2_native,	fletcher_2_byteswap},	0, 0, 0, "fletcher2"},
-	{{fletcher_4_native,	fletcher_4_byteswap},	1, 0, 0, "fletcher4"},
-	{{zio_checksum_SHA256,	zio_checksum_SHA256},	1, 0, 1, "sha256"},
-	{{fletcher_4_native,	fletcher_4_byteswap},	0, 1, 0, "zilog2"},
+	{{NULL,			NULL},
+	    {NULL,			NULL},			0, 0, 0, "inherit"},
+	{{NULL,			NULL},
+	    {NULL,			NULL},			0, 0, 0, "on"},
+	{{zio_checksum_off,	zio_checksum_off},
+	    {zio_checksum_off,		zio_checksum_off},	0, 0, 0, "off"},
+	{{zio_checksum_SHA256,	zio_checksum_SHA256},
+	    {NULL,			NULL},			1, 1, 0, "label"},
+	{{zio_checksum_SHA256,	zio_checksum_SHA256},
+	    {NULL,			NULL},			1, 1, 0, "gang_header"},
+	{{fletcher_2_native,	fletcher_2_byteswap},
+	    {fletcher_2_incremental_native,
+	    fletcher_2_incremental_byteswap},			0, 1, 0, "zilog"},
+	{{fletcher_2_native,	fletcher_2_byteswap},
+	    {fletcher_2_incremental_native,
+	    fletcher_2_incremental_byteswap},			0, 0, 0, "fletcher2"},
+	{{fletcher_4_native,	fletcher_4_byteswap},
+	    {fletcher_4_incremental_native,
+	    fletcher_4_incremental_byteswap},			1, 0, 0, "fletcher4"},
+	{{zio_checksum_SHA256,	zio_checksum_SHA256},
+	    {NULL,			NULL},			1, 0, 1, "sha256"},
+	{{fletcher_4_native,	fletcher_4_byteswap},
+	    {fletcher_4_incremental_native,
+	    fletcher_4_incremental_byteswap},			0, 1, 0, "zilog2"},
+	{{NULL,			NULL},
+	    {NULL,			NULL},			0, 0, 0, "noparity"},
+	{{zio_checksum_SHA512_native,	zio_checksum_SHA512_byteswap},
+	    {NULL,			NULL},			1, 0, 1, "sha512"},
 };
 
 enum zio_checksum
@@ -144,12 +166,54 @@ zio_checksum_label_verifier(zio_cksum_t *zcp, uint64_t offset)
 	ZIO_SET_CHECKSUM(zcp, offset, 0, 0, 0);
 }
 
+typedef struct zio_checksum_incr_arg {
+	zio_checksum_t	*zia_func;
+	zio_cksum_t	*zia_cksum;
+} zio_checksum_incr_arg_t;
+
+static int
+zio_checksum_incr_cb(void *buf, size_t size, void *private)
+{
+	zio_checksum_incr_arg_t *zia = private;
+
+	zia->zia_func(buf, size, zia->zia_cksum);
+	return (0);
+}
+
+/*
+ * Checksum the first size bytes of an ABD.
+ */
+static void
+zio_checksum_abd(zio_checksum_info_t *ci, int byteswap, abd_t *abd,
+    uint64_t size, zio_cksum_t *zcp)
+{
+	zio_checksum_incr_arg_t zia;
+	void *buf;
+
+	if (abd_is_linear(abd)) {
+		ci->ci_func[byteswap](abd_to_buf(abd), size, zcp);
+		return;
+	}
+
+	if (ci->ci_incr[byteswap] == NULL) {
+		buf = abd_borrow_buf_copy(abd, size);
+		ci->ci_func[byteswap](buf, size, zcp);
+		abd_return_buf(abd, buf, size);
+		return;
+	}
+
+	ZIO_SET_CHECKSUM(zcp, 0, 0, 0, 0);
+	zia.zia_func = ci->ci_incr[byteswap];
+	zia.zia_cksum = zcp;
+	(void) abd_iterate_func(abd, 0, size, zio_checksum_incr_cb, &zia);
+}
+
 /*
  * Generate the checksum.
  */
 void
 zio_checksum_compute(zio_t *zio, enum zio_checksum checksum,
-	void *data, uint64_t size)
+	abd_t *abd, uint64_t size)
 {
 	blkptr_t *bp = zio->io_bp;
 	uint64_t offset = zio->io_offset;
@@ -161,6 +225,8 @@ zio_checksum_compute(zio_t *zio, enum zio_checksum checksum,
 
 	if (ci->ci_eck) {
 		zio_eck_t *eck;
+		uint64_t bsize = size;
+		void *data = abd_borrow_buf_copy(abd, bsize);
 
 		if (checksum == ZIO_CHECKSUM_ZILOG2) {
 			zil_chain_t *zilc = data;
@@ -180,8 +246,10 @@ zio_checksum_compute(zio_t *zio, enum zio_checksum checksum,
 		eck->zec_magic = ZEC_MAGIC;
 		ci->ci_func[0](data, size, &cksum);
 		eck->zec_cksum = cksum;
+
+		abd_return_buf_copy(abd, data, bsize);
 	} else {
-		ci->ci_func[0](data, size, &bp->blk_cksum);
+		zio_checksum_abd(ci, 0, abd, size, &bp->blk_cksum);
 	}
 }
 
@@ -196,7 +264,7 @@ zio_checksum_error(zio_t *zio, zio_bad_cksum_t *info)
 	uint64_t size = (bp == NULL ? zio->io_size :
 	    (BP_IS_GANG(bp) ? SPA_GANGBLOCKSIZE : BP_GET_PSIZE(bp)));
 	uint64_t offset = zio->io_offset;
-	void *data = zio->io_data;
+	abd_t *abd = zio->io_abd;
 	zio_checksum_info_t *ci = &zio_checksum_table[checksum];
 	zio_cksum_t actual_cksum, expected_cksum, verifier;
 
@@ -205,21 +273,27 @@ zio_checksum_error(zio_t *zio, zio_bad_cksum_t *info)
 
 	if (ci->ci_eck) {
 		zio_eck_t *eck;
+		uint64_t bsize = size;
+		void *data = abd_borrow_buf_copy(abd, bsize);
 
 		if (checksum == ZIO_CHECKSUM_ZILOG2) {
 			zil_chain_t *zilc = data;
 			uint64_t nused;
 
 			eck = &zilc->zc_eck;
-			if (eck->zec_magic == ZEC_MAGIC)
+			if (eck->zec_magic == ZEC_MAGIC) {
 				nused = zilc->zc_nused;
-			else if (eck->zec_magic == BSWAP_64(ZEC_MAGIC))
+			} else if (eck->zec_magic == BSWAP_64(ZEC_MAGIC)) {
 				nused = BSWAP_64(zilc->zc_nused);
-			else
+			} else {
+				abd_return_buf(abd, data, bsize);
 				return (ECKSUM);
+			}
 
-			if (nused > size)
+			if (nused > size) {
+				abd_return_buf(abd, data, bsize);
 				return (ECKSUM);
+			}
 
 			size = P2ROUNDUP_TYPED(nused, ZIL_MIN_BLKSZ, uint64_t);
 		} else {
@@ -243,6 +317,8 @@ zio_checksum_error(zio_t *zio, zio_bad_cksum_t *info)
 		ci->ci_func[byteswap](data, size, &actual_cksum);
 		eck->zec_cksum = expected_cksum;
 
+		abd_return_buf(abd, data, bsize);
+
 		if (byteswap)
 			byteswap_uint64_array(&expected_cksum,
 			    sizeof (zio_cksum_t));
@@ -250,7 +326,7 @@ zio_checksum_error(zio_t *zio, zio_bad_cksum_t *info)
 		ASSERT(!BP_IS_GANG(bp));
 		byteswap = BP_SHOULD_BYTESWAP(bp);
 		expected_cksum = bp->blk_cksum;
-		ci->ci_func[byteswap](data, size, &actual_cksum);
+		zio_checksum_abd(ci, byteswap, abd, size, &actual_cksum);
 	}
 
 	info->zbc_expected = expected_cksum;
@@ -33,6 +33,40 @@
 #include <sys/zio.h>
 #include <sys/zio_compress.h>
 
+/*
+ * Compression statistics.  An attempt is a full compression pass over a
+ * block; it is wasted if the result did not save enough space to be kept.
+ * Probes are the cheap trial compressions of a few samples of a block,
+ * done for objects whose recent blocks did not compress, and skipped
+ * counts the blocks a probe found incompressible, which were therefore
+ * never fully compressed.
+ */
+typedef struct zcomp_stats {
+	kstat_named_t zcompstat_attempts;
+	kstat_named_t zcompstat_wasted;
+	kstat_named_t zcompstat_probes;
+	kstat_named_t zcompstat_skipped;
+} zcomp_stats_t;
+
+static zcomp_stats_t zcomp_stats = {
+	{ "attempts",			KSTAT_DATA_UINT64 },
+	{ "wasted",			KSTAT_DATA_UINT64 },
+	{ "probes",			KSTAT_DATA_UINT64 },
+	{ "skipped",			KSTAT_DATA_UINT64 },
+};
+
+#define	ZCOMPSTAT_BUMP(stat) \
+	atomic_add_64(&zcomp_stats.stat.value.ui64, 1);
+
+kstat_t		*zcomp_ksp;
+
+/*
+ * zio_compress_probe() compresses this many samples of this size, spread
+ * evenly over the block.
+ */
+#define	ZIO_COMPRESS_PROBE_SAMPLES	4
+#define	ZIO_COMPRESS_PROBE_SIZE		4096
+
 /*
  * Compression vectors.
  */
@@ -54,6 +88,25 @@ zio_compress_info_t zio_compress_table[ZIO_COMPRESS_FUNCTIONS] = {
 	{gzip_compress,		gzip_decompress,	9,	"gzip-9"},
 	{zle_compress,		zle_decompress,		64,	"zle"},
 	{lz4_compress,		lz4_decompress,		0,	"lz4"},
+	{zstd_compress,		zstd_decompress,	1,	"zstd-1"},
+	{zstd_compress,		zstd_decompress,	2,	"zstd-2"},
+	{zstd_compress,		zstd_decompress,	3,	"zstd-3"},
+	{zstd_compress,		zstd_decompress,	4,	"zstd-4"},
+	{zstd_compress,		zstd_decompress,	5,	"zstd-5"},
+	{zstd_compress,		zstd_decompress,	6,	"zstd-6"},
+	{zstd_compress,		zstd_decompress,	7,	"zstd-7"},
+	{zstd_compress,		zstd_decompress,	8,	"zstd-8"},
+	{zstd_compress,		zstd_decompress,	9,	"zstd-9"},
+	{zstd_compress,		zstd_decompress,	10,	"zstd-10"},
+	{zstd_compress,		zstd_decompress,	11,	"zstd-11"},
+	{zstd_compress,		zstd_decompress,	12,	"zstd-12"},
+	{zstd_compress,		zstd_decompress,	13,	"zstd-13"},
+	{zstd_compress,		zstd_decompress,	14,	"zstd-14"},
+	{zstd_compress,		zstd_decompress,	15,	"zstd-15"},
+	{zstd_compress,		zstd_decompress,	16,	"zstd-16"},
+	{zstd_compress,		zstd_decompress,	17,	"zstd-17"},
+	{zstd_compress,		zstd_decompress,	18,	"zstd-18"},
+	{zstd_compress,		zstd_decompress,	19,	"zstd-19"},
 };
 
 enum zio_compress
@@ -72,12 +125,26 @@ zio_compress_select(enum zio_compress child, enum zio_compress parent)
 	return (child);
 }
 
+/*ARGSUSED*/
+static int
+zio_compress_zeroed_cb(void *data, size_t len, void *private)
+{
+	uint64_t *end = (uint64_t *)((char *)data + len);
+	uint64_t *word;
+
+	for (word = data; word < end; word++)
+		if (*word != 0)
+			return (1);
+
+	return (0);
+}
+
 size_t
-zio_compress_data(enum zio_compress c, void *src, void *dst, size_t s_len)
+zio_compress_data(enum zio_compress c, abd_t *src, void *dst, size_t s_len)
 {
-	uint64_t *word, *word_end;
 	size_t c_len, d_len, r_len;
 	zio_compress_info_t *ci = &zio_compress_table[c];
+	void *tmp;
 
 	ASSERT((uint_t)c < ZIO_COMPRESS_FUNCTIONS);
 	ASSERT((uint_t)c == ZIO_COMPRESS_EMPTY || ci->ci_compress != NULL);
@@ -86,12 +153,7 @@ zio_compress_data(enum zio_compress c, void *src, void *dst, size_t s_len)
 	 * If the data is all zeroes, we don't even need to allocate
 	 * a block for it.  We indicate this by returning zero size.
 	 */
-	word_end = (uint64_t *)((char *)src + s_len);
-	for (word = src; word < word_end; word++)
-		if (*word != 0)
-			break;
-
-	if (word == word_end)
+	if (abd_iterate_func(src, 0, s_len, zio_compress_zeroed_cb, NULL) == 0)
 		return (0);
 
 	if (c == ZIO_COMPRESS_EMPTY)
@@ -102,10 +164,16 @@ zio_compress_data(enum zio_compress c, void *src, void *dst, size_t s_len)
 	if (d_len == 0)
 		return (s_len);
 
-	c_len = ci->ci_compress(src, dst, s_len, d_len, ci->ci_level);
+	/* No compression algorithms can read from ABDs directly */
+	tmp = abd_borrow_buf_copy(src, s_len);
+	c_len = ci->ci_compress(tmp, dst, s_len, d_len, ci->ci_level);
+	abd_return_buf(src, tmp, s_len);
 
-	if (c_len > d_len)
+	ZCOMPSTAT_BUMP(zcompstat_attempts);
+	if (c_len > d_len) {
+		ZCOMPSTAT_BUMP(zcompstat_wasted);
 		return (s_len);
+	}
 
 	/*
 	 * Cool.  We compressed at least as much as we were hoping to.
@@ -123,8 +191,75 @@ zio_compress_data(enum zio_compress c, void *src, void *dst, size_t s_len)
 	return (c_len);
 }
 
+/*
+ * Guess whether a block is worth compressing by compressing a few samples
+ * of it with lz4, which is fast enough that this costs only a fraction of a
+ * full pass with any algorithm.  The samples must save the same 12.5% that
+ * zio_compress_data() requires of the whole block.  Blocks too small to
+ * sample meaningfully are always worth a try.
+ */
+boolean_t
+zio_compress_probe(abd_t *src, size_t s_len)
+{
+	size_t ssize = ZIO_COMPRESS_PROBE_SAMPLES * ZIO_COMPRESS_PROBE_SIZE;
+	size_t c_len, d_len, off;
+	void *sample, *dst;
+	int i;
+
+	if (s_len < 2 * ssize)
+		return (B_TRUE);
+
+	ZCOMPSTAT_BUMP(zcompstat_probes);
+
+	sample = zio_buf_alloc(ssize);
+	dst = zio_buf_alloc(ssize);
+
+	for (i = 0; i < ZIO_COMPRESS_PROBE_SAMPLES; i++) {
+		off = i * (s_len - ZIO_COMPRESS_PROBE_SIZE) /
+		    (ZIO_COMPRESS_PROBE_SAMPLES - 1);
+		abd_copy_to_buf_off((char *)sample +
+		    i * ZIO_COMPRESS_PROBE_SIZE, src,
+		    P2ALIGN(off, sizeof (uint64_t)), ZIO_COMPRESS_PROBE_SIZE);
+	}
+
+	d_len = ssize - (ssize >> 3);
+	c_len = lz4_compress(sample, dst, ssize, d_len, 0);
+
+	zio_buf_free(dst, ssize);
+	zio_buf_free(sample, ssize);
+
+	if (c_len > d_len) {
+		ZCOMPSTAT_BUMP(zcompstat_skipped);
+		return (B_FALSE);
+	}
+
+	return (B_TRUE);
+}
+
+void
+zio_compress_init(void)
+{
+	zcomp_ksp = kstat_create("zfs", 0, "zcompstats", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (zcomp_stats) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+
+	if (zcomp_ksp != NULL) {
+		zcomp_ksp->ks_data = &zcomp_stats;
+		kstat_install(zcomp_ksp);
+	}
+}
+
+void
+zio_compress_fini(void)
+{
+	if (zcomp_ksp != NULL) {
+		kstat_delete(zcomp_ksp);
+		zcomp_ksp = NULL;
+	}
+}
+
 int
-zio_decompress_data(enum zio_compress c, void *src, void *dst,
+zio_decompress_data_buf(enum zio_compress c, void *src, void *dst,
     size_t s_len, size_t d_len)
 {
 	zio_compress_info_t *ci = &zio_compress_table[c];
@@ -134,3 +269,14 @@ zio_decompress_data(enum zio_compress c, void *src, void *dst,
 
 	return (ci->ci_decompress(src, dst, s_len, d_len, ci->ci_level));
 }
+
+int
+zio_decompress_data(enum zio_compress c, abd_t *src, void *dst,
+    size_t s_len, size_t d_len)
+{
+	void *tmp = abd_borrow_buf_copy(src, s_len);
+	int ret = zio_decompress_data_buf(c, tmp, dst, s_len, d_len);
+	abd_return_buf(src, tmp, s_len);
+
+	return (ret);
+}
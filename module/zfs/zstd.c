@@ -0,0 +1,2335 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Zstandard compression.
+ *
+ * This is a self-contained implementation of the Zstandard frame format as
+ * described in RFC 8878, restricted to what a ZFS block needs: one frame per
+ * block, no dictionaries and no content checksum (the block pointer already
+ * carries one).  Frames written here can be read by any conforming zstd
+ * decoder, and the decoder here accepts any single frame produced by a
+ * conforming encoder.
+ *
+ * The compressor is a hash chain match finder feeding the standard entropy
+ * stage: Huffman coded literals and FSE coded sequences with per-block
+ * tables.  The level (1-19) only selects how hard the match finder looks,
+ * so decompression speed does not depend on it.
+ *
+ * Like lz4, the compressed buffer starts with its length as a big-endian
+ * 32-bit value, so that the sector padding added by zio_compress_data() is
+ * never mistaken for part of the frame.
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/zio_compress.h>
+
+#define	ZSTD_MAGIC		0xFD2FB528U
+#define	ZSTD_BLOCKSIZE_MAX	(128 * 1024)
+#define	ZSTD_REP_NUM		3
+
+#define	ZSTD_BLOCK_RAW		0
+#define	ZSTD_BLOCK_RLE		1
+#define	ZSTD_BLOCK_COMPRESSED	2
+
+#define	ZSTD_LIT_RAW		0
+#define	ZSTD_LIT_RLE		1
+#define	ZSTD_LIT_HUF		2
+#define	ZSTD_LIT_TREELESS	3
+
+#define	ZSTD_SEQ_PREDEFINED	0
+#define	ZSTD_SEQ_RLE		1
+#define	ZSTD_SEQ_FSE		2
+#define	ZSTD_SEQ_REPEAT		3
+
+#define	ZSTD_FSE_MAX_LOG	9
+#define	ZSTD_FSE_MAX_SYMS	53
+#define	ZSTD_LL_MAX_LOG		9
+#define	ZSTD_ML_MAX_LOG		9
+#define	ZSTD_OF_MAX_LOG		8
+#define	ZSTD_LL_SYMS		36
+#define	ZSTD_ML_SYMS		53
+#define	ZSTD_OF_SYMS		32
+#define	ZSTD_HUF_MAX_LOG	12	/* accepted by the decoder */
+#define	ZSTD_HUF_ENC_LOG	11	/* produced by the encoder */
+#define	ZSTD_HUF_WEIGHT_LOG	6
+
+/*
+ * Compressor parameters.  Sequences are collected per block until either
+ * the block is full or ZSTD_MAX_SEQS is reached, whichever comes first.
+ */
+#define	ZSTD_MIN_MATCH		4
+#define	ZSTD_HASH_LOG		15
+#define	ZSTD_CHAIN_LOG		16
+#define	ZSTD_CHAIN_SIZE		(1U << ZSTD_CHAIN_LOG)
+#define	ZSTD_CHAIN_MASK		(ZSTD_CHAIN_SIZE - 1)
+#define	ZSTD_MAX_SEQS		8192
+
+static const uint32_t zstd_ll_base[ZSTD_LL_SYMS] = {
+	0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+	16, 18, 20, 22, 24, 28, 32, 40, 48, 64, 128, 256, 512, 1024, 2048,
+	4096, 8192, 16384, 32768, 65536
+};
+
+static const uint8_t zstd_ll_bits[ZSTD_LL_SYMS] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	1, 1, 1, 1, 2, 2, 3, 3, 4, 6, 7, 8, 9, 10, 11,
+	12, 13, 14, 15, 16
+};
+
+static const uint32_t zstd_ml_base[ZSTD_ML_SYMS] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18,
+	19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34,
+	35, 37, 39, 41, 43, 47, 51, 59, 67, 83, 99, 131, 259, 515, 1027,
+	2051, 4099, 8195, 16387, 32771, 65539
+};
+
+static const uint8_t zstd_ml_bits[ZSTD_ML_SYMS] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	1, 1, 1, 1, 2, 2, 3, 3, 4, 4, 5, 7, 8, 9, 10,
+	11, 12, 13, 14, 15, 16
+};
+
+/*
+ * Predefined sequence code distributions (RFC 8878 section 3.1.1.3.2.2).
+ */
+static const int16_t zstd_ll_predef[ZSTD_LL_SYMS] = {
+	4, 3, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1,
+	2, 2, 2, 2, 2, 2, 2, 2, 2, 3, 2, 1, 1, 1, 1, 1,
+	-1, -1, -1, -1
+};
+#define	ZSTD_LL_PREDEF_LOG	6
+
+static const int16_t zstd_ml_predef[ZSTD_ML_SYMS] = {
+	1, 4, 3, 2, 2, 2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, -1, -1,
+	-1, -1, -1, -1, -1
+};
+#define	ZSTD_ML_PREDEF_LOG	6
+
+static const int16_t zstd_of_predef[29] = {
+	1, 1, 1, 1, 1, 1, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, -1, -1, -1, -1, -1
+};
+#define	ZSTD_OF_PREDEF_LOG	5
+#define	ZSTD_OF_PREDEF_SYMS	29
+
+/*
+ * Match finder settings per level: how many chain entries to visit, how
+ * many positions ahead to look for a better match, and the match length
+ * at which the search stops early.
+ */
+typedef struct zstd_level {
+	uint16_t	zl_depth;
+	uint8_t		zl_lazy;
+	uint16_t	zl_target;
+} zstd_level_t;
+
+static const zstd_level_t zstd_levels[ZSTD_MAX_LEVEL + 1] = {
+	{ 0,	0,	0 },
+	{ 1,	0,	16 },	/* 1 */
+	{ 2,	0,	24 },
+	{ 4,	1,	32 },
+	{ 6,	1,	32 },
+	{ 8,	1,	48 },	/* 5 */
+	{ 12,	1,	64 },
+	{ 16,	2,	64 },
+	{ 24,	2,	96 },
+	{ 32,	2,	128 },
+	{ 48,	2,	128 },	/* 10 */
+	{ 64,	2,	192 },
+	{ 96,	2,	256 },
+	{ 128,	2,	256 },
+	{ 192,	2,	384 },
+	{ 256,	2,	512 },	/* 15 */
+	{ 384,	2,	768 },
+	{ 512,	2,	1024 },
+	{ 768,	2,	2048 },
+	{ 1024,	2,	4096 },	/* 19 */
+};
+
+typedef struct zstd_fse_entry {
+	uint8_t		fe_symbol;
+	uint8_t		fe_nbits;
+	uint16_t	fe_base;
+} zstd_fse_entry_t;
+
+typedef struct zstd_fse_dtable {
+	uint_t			fd_log;
+	zstd_fse_entry_t	fd_entries[1 << ZSTD_FSE_MAX_LOG];
+} zstd_fse_dtable_t;
+
+typedef struct zstd_fse_ctable {
+	uint_t		fc_log;
+	uint16_t	fc_state[1 << ZSTD_FSE_MAX_LOG];
+	int32_t		fc_find[ZSTD_FSE_MAX_SYMS];
+	uint32_t	fc_nbits[ZSTD_FSE_MAX_SYMS];
+} zstd_fse_ctable_t;
+
+typedef struct zstd_huf_dtable {
+	uint_t		hd_log;
+	uint16_t	hd_entries[1 << ZSTD_HUF_MAX_LOG]; /* symbol | nbits << 8 */
+} zstd_huf_dtable_t;
+
+typedef struct zstd_seq {
+	uint32_t	zs_litlen;
+	uint32_t	zs_mlbase;	/* match length - 3 */
+	uint32_t	zs_offbase;	/* repeat code 1-3, or offset + 3 */
+} zstd_seq_t;
+
+typedef struct zstd_dctx {
+	uint32_t		dc_rep[ZSTD_REP_NUM];
+	boolean_t		dc_huf_valid;
+	const zstd_fse_dtable_t	*dc_ll;
+	const zstd_fse_dtable_t	*dc_of;
+	const zstd_fse_dtable_t	*dc_ml;
+	zstd_fse_dtable_t	dc_ll_table;
+	zstd_fse_dtable_t	dc_of_table;
+	zstd_fse_dtable_t	dc_ml_table;
+	zstd_fse_dtable_t	dc_weight_table;
+	zstd_huf_dtable_t	dc_huf;
+	uint8_t			dc_lits[ZSTD_BLOCKSIZE_MAX];
+} zstd_dctx_t;
+
+typedef struct zstd_cctx {
+	const zstd_level_t	*cc_level;
+	uint32_t		cc_rep[ZSTD_REP_NUM];
+	uint32_t		cc_next;	/* next position to hash */
+	uint32_t		cc_nlits;
+	uint32_t		cc_nseqs;
+	uint32_t		cc_hash[1 << ZSTD_HASH_LOG];
+	uint32_t		cc_chain[ZSTD_CHAIN_SIZE];
+	zstd_seq_t		cc_seqs[ZSTD_MAX_SEQS];
+	uint8_t			cc_llcode[ZSTD_MAX_SEQS];
+	uint8_t			cc_mlcode[ZSTD_MAX_SEQS];
+	uint8_t			cc_ofcode[ZSTD_MAX_SEQS];
+	uint8_t			cc_lits[ZSTD_BLOCKSIZE_MAX];
+	uint16_t		cc_huf_code[256];
+	uint8_t			cc_huf_len[256];
+	zstd_fse_ctable_t	cc_ll_table;
+	zstd_fse_ctable_t	cc_of_table;
+	zstd_fse_ctable_t	cc_ml_table;
+	zstd_fse_ctable_t	cc_weight_table;
+	zstd_fse_dtable_t	cc_weight_check;
+} zstd_cctx_t;
+
+static kmem_cache_t *zstd_cctx_cache;
+static kmem_cache_t *zstd_dctx_cache;
+
+static zstd_fse_dtable_t zstd_ll_predef_dtable;
+static zstd_fse_dtable_t zstd_of_predef_dtable;
+static zstd_fse_dtable_t zstd_ml_predef_dtable;
+static zstd_fse_ctable_t zstd_ll_predef_ctable;
+static zstd_fse_ctable_t zstd_of_predef_ctable;
+static zstd_fse_ctable_t zstd_ml_predef_ctable;
+
+static inline uint_t
+zstd_highbit32(uint32_t v)
+{
+	ASSERT(v != 0);
+	return (31 - __builtin_clz(v));
+}
+
+static inline uint16_t
+zstd_read16(const uint8_t *p)
+{
+	return (p[0] | (p[1] << 8));
+}
+
+static inline uint32_t
+zstd_read24(const uint8_t *p)
+{
+	return (p[0] | (p[1] << 8) | ((uint32_t)p[2] << 16));
+}
+
+static inline uint32_t
+zstd_read32(const uint8_t *p)
+{
+	uint32_t v;
+
+	bcopy(p, &v, sizeof (v));
+	return (LE_32(v));
+}
+
+static inline uint64_t
+zstd_read64(const uint8_t *p)
+{
+	uint64_t v;
+
+	bcopy(p, &v, sizeof (v));
+	return (LE_64(v));
+}
+
+static inline void
+zstd_write16(uint8_t *p, uint16_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static inline void
+zstd_write24(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+}
+
+static inline void
+zstd_write32(uint8_t *p, uint32_t v)
+{
+	zstd_write16(p, v);
+	zstd_write16(p + 2, v >> 16);
+}
+
+static inline void
+zstd_copy8(uint8_t *dst, const uint8_t *src)
+{
+	uint64_t v;
+
+	bcopy(src, &v, sizeof (v));
+	bcopy(&v, dst, sizeof (v));
+}
+
+static inline void
+zstd_copy16(uint8_t *dst, const uint8_t *src)
+{
+	uint64_t v[2];
+
+	bcopy(src, v, sizeof (v));
+	bcopy(v, dst, sizeof (v));
+}
+
+/*
+ * Apply an encoded offset to the repeat offset history and return the
+ * actual offset.  Shared by both sides so that they never disagree.
+ */
+static inline uint32_t
+zstd_rep_update(uint32_t *rep, uint32_t offbase, boolean_t ll0)
+{
+	uint32_t off;
+
+	if (offbase > ZSTD_REP_NUM) {
+		off = offbase - ZSTD_REP_NUM;
+	} else {
+		uint_t idx = offbase - 1 + (ll0 ? 1 : 0);
+
+		if (idx == 0)
+			return (rep[0]);
+		off = (idx == ZSTD_REP_NUM) ? rep[0] - 1 : rep[idx];
+		if (idx == 1) {
+			rep[1] = rep[0];
+			rep[0] = off;
+			return (off);
+		}
+	}
+	rep[2] = rep[1];
+	rep[1] = rep[0];
+	rep[0] = off;
+
+	return (off);
+}
+
+/*
+ * ==========================================================================
+ * Bitstreams
+ * ==========================================================================
+ *
+ * Entropy coded data is written forwards, least significant bit first, and
+ * closed with a single 1 bit.  It is read backwards starting from that
+ * marker, so the last value written is the first one read.
+ */
+typedef struct zstd_bitin {
+	uint64_t	bi_bits;
+	uint_t		bi_used;	/* bits of bi_bits consumed */
+	const uint8_t	*bi_ptr;	/* where bi_bits was loaded from */
+	const uint8_t	*bi_start;
+} zstd_bitin_t;
+
+static int
+zstd_bitin_init(zstd_bitin_t *bi, const uint8_t *src, size_t len)
+{
+	uint8_t last;
+	size_t i;
+
+	if (len == 0 || (last = src[len - 1]) == 0)
+		return (-1);
+
+	bi->bi_start = src;
+	if (len >= sizeof (uint64_t)) {
+		bi->bi_ptr = src + len - sizeof (uint64_t);
+		bi->bi_bits = zstd_read64(bi->bi_ptr);
+		bi->bi_used = 0;
+	} else {
+		bi->bi_ptr = src;
+		bi->bi_bits = 0;
+		for (i = 0; i < len; i++)
+			bi->bi_bits |= (uint64_t)src[i] << (8 * i);
+		bi->bi_used = (sizeof (uint64_t) - len) * 8;
+	}
+	bi->bi_used += 8 - zstd_highbit32(last);
+
+	return (0);
+}
+
+/*
+ * Bits before the start of the stream read as zeroes.
+ */
+static inline uint64_t
+zstd_bitin_peek(const zstd_bitin_t *bi, uint_t n)
+{
+	if (bi->bi_used >= 64)
+		return (0);
+	return (((bi->bi_bits << bi->bi_used) >> 1) >> (63 - n));
+}
+
+static inline uint64_t
+zstd_bitin_read(zstd_bitin_t *bi, uint_t n)
+{
+	uint64_t v = zstd_bitin_peek(bi, n);
+
+	bi->bi_used += n;
+	return (v);
+}
+
+static inline void
+zstd_bitin_reload(zstd_bitin_t *bi)
+{
+	size_t n;
+
+	if (bi->bi_used > 64)
+		return;
+	n = MIN(bi->bi_used >> 3, bi->bi_ptr - bi->bi_start);
+	if (n == 0)
+		return;
+	bi->bi_ptr -= n;
+	bi->bi_used -= n * 8;
+	bi->bi_bits = zstd_read64(bi->bi_ptr);
+}
+
+/* Read past the start of the stream? */
+static inline boolean_t
+zstd_bitin_overflow(const zstd_bitin_t *bi)
+{
+	return (bi->bi_used > 64);
+}
+
+/* Consumed exactly? */
+static inline boolean_t
+zstd_bitin_done(const zstd_bitin_t *bi)
+{
+	return (bi->bi_ptr == bi->bi_start && bi->bi_used == 64);
+}
+
+typedef struct zstd_bitout {
+	uint64_t	bo_bits;
+	uint_t		bo_nbits;
+	uint8_t		*bo_start;
+	uint8_t		*bo_ptr;
+	uint8_t		*bo_end;
+} zstd_bitout_t;
+
+static void
+zstd_bitout_init(zstd_bitout_t *bo, uint8_t *dst, size_t len)
+{
+	bo->bo_bits = 0;
+	bo->bo_nbits = 0;
+	bo->bo_start = bo->bo_ptr = dst;
+	bo->bo_end = dst + len;
+}
+
+/* At most 32 bits at a time, flushing after every 32 bits queued. */
+static inline void
+zstd_bitout_add(zstd_bitout_t *bo, uint64_t v, uint_t n)
+{
+	ASSERT3U(n, <=, 32);
+	bo->bo_bits |= (v & ((1ULL << n) - 1)) << bo->bo_nbits;
+	bo->bo_nbits += n;
+}
+
+static inline void
+zstd_bitout_flush(zstd_bitout_t *bo)
+{
+	while (bo->bo_nbits >= 8) {
+		if (bo->bo_ptr < bo->bo_end)
+			*bo->bo_ptr = (uint8_t)bo->bo_bits;
+		bo->bo_ptr++;
+		bo->bo_bits >>= 8;
+		bo->bo_nbits -= 8;
+	}
+}
+
+/*
+ * Returns the stream length, or 0 if it did not fit.
+ */
+static size_t
+zstd_bitout_close(zstd_bitout_t *bo)
+{
+	zstd_bitout_add(bo, 1, 1);
+	zstd_bitout_flush(bo);
+	if (bo->bo_nbits > 0) {
+		if (bo->bo_ptr < bo->bo_end)
+			*bo->bo_ptr = (uint8_t)bo->bo_bits;
+		bo->bo_ptr++;
+	}
+	if (bo->bo_ptr > bo->bo_end)
+		return (0);
+	return (bo->bo_ptr - bo->bo_start);
+}
+
+/*
+ * ==========================================================================
+ * FSE tables
+ * ==========================================================================
+ */
+
+/*
+ * Read a little-endian bitfield of up to 25 bits; bytes past the end of
+ * the buffer read as zeroes.
+ */
+static inline uint32_t
+zstd_fwd_bits(const uint8_t *src, size_t len, size_t pos, uint_t n)
+{
+	size_t b = pos >> 3;
+	uint32_t v = 0;
+	int i;
+
+	for (i = 0; i < 4 && b + i < len; i++)
+		v |= (uint32_t)src[b + i] << (8 * i);
+
+	return ((v >> (pos & 7)) & ((1U << n) - 1));
+}
+
+/*
+ * Parse a table description into normalized counts.  On entry *nsym is the
+ * size of the alphabet; on return it is the number of symbols described.
+ * Returns the number of bytes used or -1.
+ */
+static int
+zstd_fse_read_ncount(const uint8_t *src, size_t len, int16_t *norm,
+    uint_t *nsym, uint_t *logp, uint_t maxlog)
+{
+	uint_t maxsym = *nsym;
+	uint_t sym = 0, log, nbits;
+	int remaining, threshold;
+	boolean_t prev0 = B_FALSE;
+	size_t pos;
+
+	if (len == 0)
+		return (-1);
+
+	log = zstd_fwd_bits(src, len, 0, 4) + 5;
+	if (log > maxlog)
+		return (-1);
+	pos = 4;
+
+	remaining = (1 << log) + 1;
+	threshold = 1 << log;
+	nbits = log + 1;
+
+	while (remaining > 1 && sym < maxsym) {
+		int max, count;
+		uint32_t v;
+
+		if (prev0) {
+			uint_t n0 = sym;
+
+			while ((v = zstd_fwd_bits(src, len, pos, 2)) == 3) {
+				n0 += 3;
+				pos += 2;
+				if (n0 >= maxsym)
+					return (-1);
+			}
+			n0 += v;
+			pos += 2;
+			if (n0 >= maxsym)
+				return (-1);
+			while (sym < n0)
+				norm[sym++] = 0;
+		}
+
+		max = (2 * threshold - 1) - remaining;
+		v = zstd_fwd_bits(src, len, pos, nbits);
+		if ((int)(v & (threshold - 1)) < max) {
+			count = v & (threshold - 1);
+			pos += nbits - 1;
+		} else {
+			count = v & (2 * threshold - 1);
+			if (count >= threshold)
+				count -= max;
+			pos += nbits;
+		}
+
+		count--;
+		remaining -= (count < 0) ? -count : count;
+		if (remaining < 1)
+			return (-1);
+		norm[sym++] = count;
+		prev0 = (count == 0);
+
+		while (remaining < threshold) {
+			nbits--;
+			threshold >>= 1;
+		}
+	}
+
+	if (remaining != 1 || (pos + 7) / 8 > len)
+		return (-1);
+
+	*nsym = sym;
+	*logp = log;
+
+	return ((pos + 7) / 8);
+}
+
+/*
+ * Symbols are spread over the table with the same walk on both sides.
+ * Symbols with a "less than one" probability (-1) go at the end.
+ */
+static int
+zstd_fse_spread(uint8_t *table, const int16_t *norm, uint_t nsym, uint_t log)
+{
+	uint_t size = 1U << log;
+	uint_t mask = size - 1;
+	uint_t step = (size >> 1) + (size >> 3) + 3;
+	uint_t high = size - 1;
+	uint_t pos = 0, s;
+	int i;
+
+	for (s = 0; s < nsym; s++) {
+		if (norm[s] == -1)
+			table[high--] = s;
+	}
+
+	for (s = 0; s < nsym; s++) {
+		for (i = 0; i < norm[s]; i++) {
+			table[pos] = s;
+			do {
+				pos = (pos + step) & mask;
+			} while (pos > high);
+		}
+	}
+
+	return (pos == 0 ? 0 : -1);
+}
+
+static int
+zstd_fse_build_dtable(zstd_fse_dtable_t *dt, const int16_t *norm,
+    uint_t nsym, uint_t log)
+{
+	uint8_t table[1 << ZSTD_FSE_MAX_LOG];
+	uint16_t next[ZSTD_FSE_MAX_SYMS];
+	uint_t size = 1U << log;
+	uint_t s, u;
+
+	ASSERT3U(nsym, <=, ZSTD_FSE_MAX_SYMS);
+
+	if (zstd_fse_spread(table, norm, nsym, log) != 0)
+		return (-1);
+
+	for (s = 0; s < nsym; s++)
+		next[s] = (norm[s] == -1) ? 1 : norm[s];
+
+	for (u = 0; u < size; u++) {
+		uint_t x;
+
+		s = table[u];
+		x = next[s]++;
+		dt->fd_entries[u].fe_symbol = s;
+		dt->fd_entries[u].fe_nbits = log - zstd_highbit32(x);
+		dt->fd_entries[u].fe_base =
+		    (x << dt->fd_entries[u].fe_nbits) - size;
+	}
+	dt->fd_log = log;
+
+	return (0);
+}
+
+static void
+zstd_fse_rle_dtable(zstd_fse_dtable_t *dt, uint8_t symbol)
+{
+	dt->fd_log = 0;
+	dt->fd_entries[0].fe_symbol = symbol;
+	dt->fd_entries[0].fe_nbits = 0;
+	dt->fd_entries[0].fe_base = 0;
+}
+
+static int
+zstd_fse_build_ctable(zstd_fse_ctable_t *ct, const int16_t *norm,
+    uint_t nsym, uint_t log)
+{
+	uint8_t table[1 << ZSTD_FSE_MAX_LOG];
+	uint16_t cumul[ZSTD_FSE_MAX_SYMS + 1];
+	uint_t size = 1U << log;
+	uint_t s, u;
+	int total = 0;
+
+	ASSERT3U(nsym, <=, ZSTD_FSE_MAX_SYMS);
+
+	if (zstd_fse_spread(table, norm, nsym, log) != 0)
+		return (-1);
+
+	cumul[0] = 0;
+	for (s = 0; s < nsym; s++)
+		cumul[s + 1] = cumul[s] + ((norm[s] == -1) ? 1 : norm[s]);
+
+	for (u = 0; u < size; u++)
+		ct->fc_state[cumul[table[u]]++] = size + u;
+
+	for (s = 0; s < nsym; s++) {
+		switch (norm[s]) {
+		case 0:
+			ct->fc_nbits[s] = ((log + 1) << 16) - size;
+			ct->fc_find[s] = 0;
+			break;
+		case -1:
+		case 1:
+			ct->fc_nbits[s] = (log << 16) - size;
+			ct->fc_find[s] = total - 1;
+			total++;
+			break;
+		default: {
+			uint_t maxout = log - zstd_highbit32(norm[s] - 1);
+
+			ct->fc_nbits[s] = (maxout << 16) - (norm[s] << maxout);
+			ct->fc_find[s] = total - norm[s];
+			total += norm[s];
+			break;
+		}
+		}
+	}
+	ct->fc_log = log;
+
+	return (0);
+}
+
+static void
+zstd_fse_rle_ctable(zstd_fse_ctable_t *ct, uint8_t symbol)
+{
+	ct->fc_log = 0;
+	ct->fc_state[0] = 0;
+	ct->fc_state[1] = 0;
+	ct->fc_nbits[symbol] = 0;
+	ct->fc_find[symbol] = 0;
+}
+
+static inline uint32_t
+zstd_fse_init_state(const zstd_fse_ctable_t *ct, uint_t symbol)
+{
+	uint32_t nbits = (ct->fc_nbits[symbol] + (1 << 15)) >> 16;
+	uint32_t v = (nbits << 16) - ct->fc_nbits[symbol];
+
+	return (ct->fc_state[(v >> nbits) + ct->fc_find[symbol]]);
+}
+
+static inline void
+zstd_fse_encode(zstd_bitout_t *bo, const zstd_fse_ctable_t *ct,
+    uint32_t *state, uint_t symbol)
+{
+	uint32_t nbits = (*state + ct->fc_nbits[symbol]) >> 16;
+
+	zstd_bitout_add(bo, *state, nbits);
+	*state = ct->fc_state[(*state >> nbits) + ct->fc_find[symbol]];
+}
+
+/*
+ * Scale a histogram to a power of two total.  Every present symbol keeps at
+ * least one slot; the rounding error is taken from or given to the largest.
+ */
+static void
+zstd_fse_normalize(int16_t *norm, const uint32_t *count, uint_t nsym,
+    uint32_t total, uint_t log)
+{
+	int size = 1 << log;
+	int sum = 0;
+	uint_t s, big = 0;
+
+	for (s = 0; s < nsym; s++) {
+		int n = 0;
+
+		if (count[s] != 0) {
+			n = ((uint64_t)count[s] * size + total / 2) / total;
+			if (n == 0)
+				n = 1;
+			if (count[s] > count[big])
+				big = s;
+		}
+		norm[s] = n;
+		sum += n;
+	}
+
+	while (sum > size) {
+		uint_t m = big;
+
+		for (s = 0; s < nsym; s++) {
+			if (norm[s] > norm[m])
+				m = s;
+		}
+		ASSERT3S(norm[m], >, 1);
+		norm[m]--;
+		sum--;
+	}
+	norm[big] += size - sum;
+}
+
+static uint_t
+zstd_fse_optimal_log(uint_t maxlog, uint32_t total, uint_t maxsym)
+{
+	uint_t log = maxlog;
+	uint_t srcbits = (total > 1) ? zstd_highbit32(total - 1) : 0;
+	uint_t minbits = MIN(zstd_highbit32(total) + 1,
+	    zstd_highbit32(maxsym) + 2);
+
+	if (srcbits >= 2 && srcbits - 2 < log)
+		log = srcbits - 2;
+	if (log < minbits)
+		log = minbits;
+
+	return (MAX(MIN(log, maxlog), 5));
+}
+
+/*
+ * Write a table description; the inverse of zstd_fse_read_ncount().
+ * Returns the number of bytes written, or 0 if it did not fit.
+ */
+static size_t
+zstd_fse_write_ncount(uint8_t *dst, size_t len, const int16_t *norm,
+    uint_t nsym, uint_t log)
+{
+	zstd_bitout_t bo;
+	int remaining = (1 << log) + 1;
+	int threshold = 1 << log;
+	uint_t nbits = log + 1;
+	boolean_t prev0 = B_FALSE;
+	uint_t s = 0;
+
+	zstd_bitout_init(&bo, dst, len);
+	zstd_bitout_add(&bo, log - 5, 4);
+
+	while (s < nsym && remaining > 1) {
+		int count, max;
+
+		if (prev0) {
+			uint_t start = s;
+
+			while (s < nsym && norm[s] == 0)
+				s++;
+			ASSERT3U(s, <, nsym);
+			while (s >= start + 3) {
+				start += 3;
+				zstd_bitout_add(&bo, 3, 2);
+				zstd_bitout_flush(&bo);
+			}
+			zstd_bitout_add(&bo, s - start, 2);
+		}
+
+		count = norm[s++];
+		max = (2 * threshold - 1) - remaining;
+		remaining -= (count < 0) ? -count : count;
+		count++;
+		if (count >= threshold)
+			count += max;
+		zstd_bitout_add(&bo, count, nbits);
+		if (count < max)
+			bo.bo_nbits--;
+		prev0 = (count == 1);
+		while (remaining < threshold) {
+			nbits--;
+			threshold >>= 1;
+		}
+		zstd_bitout_flush(&bo);
+	}
+	ASSERT3S(remaining, ==, 1);
+
+	if (bo.bo_nbits > 0) {
+		if (bo.bo_ptr < bo.bo_end)
+			*bo.bo_ptr = (uint8_t)bo.bo_bits;
+		bo.bo_ptr++;
+	}
+	if (bo.bo_ptr > bo.bo_end)
+		return (0);
+	return (bo.bo_ptr - bo.bo_start);
+}
+
+/*
+ * ==========================================================================
+ * Decompression
+ * ==========================================================================
+ */
+
+/*
+ * Huffman weights may be FSE coded, using two interleaved states that share
+ * one table.  Decoding stops once the stream has been read past its start.
+ */
+static int
+zstd_huf_read_weights_fse(zstd_fse_dtable_t *dt, const uint8_t *src,
+    size_t len, uint8_t *weights)
+{
+	int16_t norm[ZSTD_HUF_MAX_LOG + 1];
+	uint_t nsym = ZSTD_HUF_MAX_LOG + 1;
+	uint_t log, s1, s2, n = 0;
+	zstd_bitin_t bi;
+	int hlen;
+
+	hlen = zstd_fse_read_ncount(src, len, norm, &nsym, &log,
+	    ZSTD_HUF_WEIGHT_LOG);
+	if (hlen < 0 || zstd_fse_build_dtable(dt, norm, nsym, log) != 0)
+		return (-1);
+	if (zstd_bitin_init(&bi, src + hlen, len - hlen) != 0)
+		return (-1);
+
+	s1 = zstd_bitin_read(&bi, log);
+	s2 = zstd_bitin_read(&bi, log);
+	zstd_bitin_reload(&bi);
+
+	for (;;) {
+		if (n > 253)
+			return (-1);
+		weights[n++] = dt->fd_entries[s1].fe_symbol;
+		s1 = dt->fd_entries[s1].fe_base +
+		    zstd_bitin_read(&bi, dt->fd_entries[s1].fe_nbits);
+		zstd_bitin_reload(&bi);
+		if (zstd_bitin_overflow(&bi)) {
+			weights[n++] = dt->fd_entries[s2].fe_symbol;
+			break;
+		}
+
+		if (n > 253)
+			return (-1);
+		weights[n++] = dt->fd_entries[s2].fe_symbol;
+		s2 = dt->fd_entries[s2].fe_base +
+		    zstd_bitin_read(&bi, dt->fd_entries[s2].fe_nbits);
+		zstd_bitin_reload(&bi);
+		if (zstd_bitin_overflow(&bi)) {
+			weights[n++] = dt->fd_entries[s1].fe_symbol;
+			break;
+		}
+	}
+
+	return (n);
+}
+
+/*
+ * Parse a Huffman tree description and build the decoding table.  Returns
+ * the number of bytes used or -1.
+ */
+static int
+zstd_huf_read_table(zstd_dctx_t *dc, const uint8_t *src, size_t len)
+{
+	zstd_huf_dtable_t *hd = &dc->dc_huf;
+	uint8_t weights[256];
+	uint32_t rank[ZSTD_HUF_MAX_LOG + 1];
+	uint32_t total = 0, rest, pos;
+	uint_t nw, maxbits, s, w;
+	int used;
+
+	if (len == 0)
+		return (-1);
+
+	if (src[0] >= 128) {
+		nw = src[0] - 127;
+		used = 1 + (nw + 1) / 2;
+		if (used > len)
+			return (-1);
+		for (s = 0; s < nw; s++) {
+			uint8_t b = src[1 + s / 2];
+
+			weights[s] = (s & 1) ? (b & 0xf) : (b >> 4);
+		}
+	} else {
+		int n;
+
+		used = 1 + src[0];
+		if (used > len)
+			return (-1);
+		n = zstd_huf_read_weights_fse(&dc->dc_weight_table, src + 1,
+		    src[0], weights);
+		if (n < 0)
+			return (-1);
+		nw = n;
+	}
+
+	for (s = 0; s < nw; s++) {
+		if (weights[s] > ZSTD_HUF_MAX_LOG)
+			return (-1);
+		if (weights[s] != 0)
+			total += 1U << (weights[s] - 1);
+	}
+	if (total == 0)
+		return (-1);
+
+	maxbits = zstd_highbit32(total) + 1;
+	if (maxbits > ZSTD_HUF_MAX_LOG)
+		return (-1);
+	rest = (1U << maxbits) - total;
+	if (!ISP2(rest))
+		return (-1);
+	weights[nw++] = zstd_highbit32(rest) + 1;
+
+	bzero(rank, sizeof (rank));
+	for (s = 0; s < nw; s++)
+		rank[weights[s]]++;
+	for (pos = 0, w = 1; w <= maxbits; w++) {
+		uint32_t n = rank[w];
+
+		rank[w] = pos;
+		pos += n << (w - 1);
+	}
+
+	for (s = 0; s < nw; s++) {
+		uint32_t i, n;
+		uint16_t e;
+
+		if ((w = weights[s]) == 0)
+			continue;
+		e = s | ((maxbits + 1 - w) << 8);
+		n = 1U << (w - 1);
+		for (i = 0; i < n; i++)
+			hd->hd_entries[rank[w] + i] = e;
+		rank[w] += n;
+	}
+	hd->hd_log = maxbits;
+
+	return (used);
+}
+
+static int
+zstd_huf_decode_stream(const zstd_huf_dtable_t *hd, const uint8_t *src,
+    size_t len, uint8_t *dst, size_t n)
+{
+	uint_t log = hd->hd_log;
+	zstd_bitin_t bi;
+	size_t i;
+
+	if (zstd_bitin_init(&bi, src, len) != 0)
+		return (-1);
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		uint16_t e;
+
+		e = hd->hd_entries[zstd_bitin_peek(&bi, log)];
+		dst[i] = e & 0xff;
+		bi.bi_used += e >> 8;
+		e = hd->hd_entries[zstd_bitin_peek(&bi, log)];
+		dst[i + 1] = e & 0xff;
+		bi.bi_used += e >> 8;
+		e = hd->hd_entries[zstd_bitin_peek(&bi, log)];
+		dst[i + 2] = e & 0xff;
+		bi.bi_used += e >> 8;
+		e = hd->hd_entries[zstd_bitin_peek(&bi, log)];
+		dst[i + 3] = e & 0xff;
+		bi.bi_used += e >> 8;
+		zstd_bitin_reload(&bi);
+	}
+	for (; i < n; i++) {
+		uint16_t e = hd->hd_entries[zstd_bitin_peek(&bi, log)];
+
+		dst[i] = e & 0xff;
+		bi.bi_used += e >> 8;
+	}
+	zstd_bitin_reload(&bi);
+
+	return (zstd_bitin_done(&bi) ? 0 : -1);
+}
+
+/*
+ * Decode the literals section of a compressed block.  Raw literals are
+ * used in place.  Returns the number of bytes used or -1.
+ */
+static int
+zstd_decode_literals(zstd_dctx_t *dc, const uint8_t *src, size_t len,
+    const uint8_t **litp, size_t *nlitp)
+{
+	uint_t type = src[0] & 3;
+	uint_t format = (src[0] >> 2) & 3;
+	size_t hlen, regen, csize;
+
+	if (type == ZSTD_LIT_RAW || type == ZSTD_LIT_RLE) {
+		switch (format) {
+		case 1:
+			hlen = 2;
+			break;
+		case 3:
+			hlen = 3;
+			break;
+		default:
+			hlen = 1;
+			break;
+		}
+		if (hlen > len)
+			return (-1);
+		if (hlen == 1)
+			regen = src[0] >> 3;
+		else if (hlen == 2)
+			regen = (src[0] >> 4) + (src[1] << 4);
+		else
+			regen = (src[0] >> 4) + (src[1] << 4) + (src[2] << 12);
+		if (regen > ZSTD_BLOCKSIZE_MAX)
+			return (-1);
+
+		*nlitp = regen;
+		if (type == ZSTD_LIT_RAW) {
+			if (hlen + regen > len)
+				return (-1);
+			*litp = src + hlen;
+			return (hlen + regen);
+		}
+		if (hlen + 1 > len)
+			return (-1);
+		memset(dc->dc_lits, src[hlen], regen);
+		*litp = dc->dc_lits;
+		return (hlen + 1);
+	} else {
+		uint_t bits = (format < 2) ? 10 : (format == 2) ? 14 : 18;
+		uint_t nstreams = (format == 0) ? 1 : 4;
+		const uint8_t *p;
+		uint64_t h = 0;
+		size_t i, used;
+		int n;
+
+		hlen = (format < 2) ? 3 : (format == 2) ? 4 : 5;
+		if (hlen > len)
+			return (-1);
+		for (i = 0; i < hlen; i++)
+			h |= (uint64_t)src[i] << (8 * i);
+		regen = (h >> 4) & ((1U << bits) - 1);
+		csize = (h >> (4 + bits)) & ((1U << bits) - 1);
+		used = hlen + csize;
+		if (regen > ZSTD_BLOCKSIZE_MAX || used > len)
+			return (-1);
+
+		p = src + hlen;
+		if (type == ZSTD_LIT_HUF) {
+			if ((n = zstd_huf_read_table(dc, p, csize)) < 0)
+				return (-1);
+			dc->dc_huf_valid = B_TRUE;
+			p += n;
+			csize -= n;
+		} else if (!dc->dc_huf_valid) {
+			return (-1);
+		}
+
+		if (nstreams == 1) {
+			if (zstd_huf_decode_stream(&dc->dc_huf, p, csize,
+			    dc->dc_lits, regen) != 0)
+				return (-1);
+		} else {
+			size_t seg = (regen + 3) / 4;
+			size_t slen[4];
+			int s;
+
+			if (csize < 6 || 3 * seg > regen)
+				return (-1);
+			slen[0] = zstd_read16(p);
+			slen[1] = zstd_read16(p + 2);
+			slen[2] = zstd_read16(p + 4);
+			if (6 + slen[0] + slen[1] + slen[2] > csize)
+				return (-1);
+			slen[3] = csize - 6 - slen[0] - slen[1] - slen[2];
+			p += 6;
+			for (s = 0; s < 4; s++) {
+				size_t cnt = (s < 3) ? seg : regen - 3 * seg;
+
+				if (zstd_huf_decode_stream(&dc->dc_huf, p,
+				    slen[s], dc->dc_lits + s * seg, cnt) != 0)
+					return (-1);
+				p += slen[s];
+			}
+		}
+
+		*litp = dc->dc_lits;
+		*nlitp = regen;
+		return (used);
+	}
+}
+
+/*
+ * Set up the decoding table for one kind of sequence code.  Returns the
+ * number of bytes of table description used or -1.
+ */
+static int
+zstd_decode_seq_table(const zstd_fse_dtable_t **cur, zstd_fse_dtable_t *dt,
+    const zstd_fse_dtable_t *predef, uint_t mode, const uint8_t *src,
+    size_t len, uint_t maxsym, uint_t maxlog)
+{
+	int16_t norm[ZSTD_FSE_MAX_SYMS];
+	uint_t nsym = maxsym, log;
+	int n;
+
+	switch (mode) {
+	case ZSTD_SEQ_PREDEFINED:
+		*cur = predef;
+		return (0);
+	case ZSTD_SEQ_RLE:
+		if (len < 1 || src[0] >= maxsym)
+			return (-1);
+		zstd_fse_rle_dtable(dt, src[0]);
+		*cur = dt;
+		return (1);
+	case ZSTD_SEQ_FSE:
+		n = zstd_fse_read_ncount(src, len, norm, &nsym, &log, maxlog);
+		if (n < 0 || zstd_fse_build_dtable(dt, norm, nsym, log) != 0)
+			return (-1);
+		*cur = dt;
+		return (n);
+	default:
+		return (*cur == NULL ? -1 : 0);
+	}
+}
+
+static int
+zstd_decode_block(zstd_dctx_t *dc, const uint8_t *src, size_t len,
+    uint8_t *dst, uint8_t **opp, uint8_t *oend)
+{
+	const uint8_t *ip = src, *iend = src + len;
+	const uint8_t *lit, *litend, *litlimit;
+	uint8_t *op = *opp;
+	uint32_t nseq, i;
+	uint_t ll_state = 0, of_state = 0, ml_state = 0;
+	zstd_bitin_t bi;
+	size_t nlit;
+	int n;
+
+	if (len == 0)
+		return (-1);
+	if ((n = zstd_decode_literals(dc, ip, len, &lit, &nlit)) < 0)
+		return (-1);
+	ip += n;
+	litend = lit + nlit;
+	/* How far literals may be over-read: raw ones are followed by more. */
+	litlimit = (lit == dc->dc_lits) ? dc->dc_lits + ZSTD_BLOCKSIZE_MAX :
+	    iend;
+
+	if (ip >= iend)
+		return (-1);
+	nseq = *ip++;
+	if (nseq >= 128) {
+		if (nseq == 255) {
+			if (ip + 2 > iend)
+				return (-1);
+			nseq = zstd_read16(ip) + 0x7F00;
+			ip += 2;
+		} else {
+			if (ip >= iend)
+				return (-1);
+			nseq = ((nseq - 128) << 8) + *ip++;
+		}
+	}
+
+	if (nseq != 0) {
+		uint_t modes;
+
+		if (ip >= iend || ((modes = *ip++) & 3) != 0)
+			return (-1);
+
+		if ((n = zstd_decode_seq_table(&dc->dc_ll, &dc->dc_ll_table,
+		    &zstd_ll_predef_dtable, modes >> 6, ip, iend - ip,
+		    ZSTD_LL_SYMS, ZSTD_LL_MAX_LOG)) < 0)
+			return (-1);
+		ip += n;
+		if ((n = zstd_decode_seq_table(&dc->dc_of, &dc->dc_of_table,
+		    &zstd_of_predef_dtable, (modes >> 4) & 3, ip, iend - ip,
+		    ZSTD_OF_SYMS, ZSTD_OF_MAX_LOG)) < 0)
+			return (-1);
+		ip += n;
+		if ((n = zstd_decode_seq_table(&dc->dc_ml, &dc->dc_ml_table,
+		    &zstd_ml_predef_dtable, (modes >> 2) & 3, ip, iend - ip,
+		    ZSTD_ML_SYMS, ZSTD_ML_MAX_LOG)) < 0)
+			return (-1);
+		ip += n;
+
+		if (zstd_bitin_init(&bi, ip, iend - ip) != 0)
+			return (-1);
+		ll_state = zstd_bitin_read(&bi, dc->dc_ll->fd_log);
+		of_state = zstd_bitin_read(&bi, dc->dc_of->fd_log);
+		ml_state = zstd_bitin_read(&bi, dc->dc_ml->fd_log);
+		zstd_bitin_reload(&bi);
+	} else if (ip != iend) {
+		return (-1);
+	}
+
+	for (i = 0; i < nseq; i++) {
+		const zstd_fse_entry_t *lle = &dc->dc_ll->fd_entries[ll_state];
+		const zstd_fse_entry_t *ofe = &dc->dc_of->fd_entries[of_state];
+		const zstd_fse_entry_t *mle = &dc->dc_ml->fd_entries[ml_state];
+		uint32_t ll, ml, offbase, off;
+		const uint8_t *match;
+
+		offbase = (1U << ofe->fe_symbol) +
+		    zstd_bitin_read(&bi, ofe->fe_symbol);
+		ml = zstd_ml_base[mle->fe_symbol] +
+		    zstd_bitin_read(&bi, zstd_ml_bits[mle->fe_symbol]);
+		zstd_bitin_reload(&bi);
+		ll = zstd_ll_base[lle->fe_symbol] +
+		    zstd_bitin_read(&bi, zstd_ll_bits[lle->fe_symbol]);
+
+		if (i + 1 < nseq) {
+			ll_state = lle->fe_base +
+			    zstd_bitin_read(&bi, lle->fe_nbits);
+			ml_state = mle->fe_base +
+			    zstd_bitin_read(&bi, mle->fe_nbits);
+			of_state = ofe->fe_base +
+			    zstd_bitin_read(&bi, ofe->fe_nbits);
+		}
+		zstd_bitin_reload(&bi);
+
+		off = zstd_rep_update(dc->dc_rep, offbase, ll == 0);
+
+		if (ll > (size_t)(litend - lit) || ll + ml > (size_t)(oend - op))
+			return (-1);
+		if (ll <= 16 && lit + 16 <= litlimit && op + 16 <= oend)
+			zstd_copy16(op, lit);
+		else
+			bcopy(lit, op, ll);
+		lit += ll;
+		op += ll;
+
+		if (off == 0 || off > (size_t)(op - dst))
+			return (-1);
+		match = op - off;
+		if (off >= 8 && op + ml + 8 <= oend) {
+			/* May write up to 7 bytes past the match. */
+			uint8_t *mend = op + ml;
+
+			do {
+				zstd_copy8(op, match);
+				op += 8;
+				match += 8;
+			} while (op < mend);
+			op = mend;
+		} else {
+			while (ml-- > 0)
+				*op++ = *match++;
+		}
+	}
+
+	if (nseq != 0 && !zstd_bitin_done(&bi))
+		return (-1);
+
+	nlit = litend - lit;
+	if (nlit > (size_t)(oend - op))
+		return (-1);
+	bcopy(lit, op, nlit);
+	*opp = op + nlit;
+
+	return (0);
+}
+
+/*
+ * Decode a single frame into dst.  Returns the decoded size or -1.
+ */
+static ssize_t
+zstd_decompress_frame(zstd_dctx_t *dc, const uint8_t *src, size_t len,
+    uint8_t *dst, size_t dlen)
+{
+	static const uint8_t did_size[4] = { 0, 1, 2, 4 };
+	const uint8_t *ip = src, *iend = src + len;
+	uint8_t *op = dst, *oend = dst + dlen;
+	uint_t fhd, fcs_size, single;
+	uint64_t fcs = 0;
+	boolean_t last;
+	int i;
+
+	if (len < 6 || zstd_read32(ip) != ZSTD_MAGIC)
+		return (-1);
+	fhd = ip[4];
+	ip += 5;
+	if (fhd & 0x08)
+		return (-1);
+
+	single = (fhd >> 5) & 1;
+	if (!single)
+		ip++;		/* window size; the whole frame is in dst */
+
+	if (ip + did_size[fhd & 3] > iend)
+		return (-1);
+	for (i = 0; i < did_size[fhd & 3]; i++) {
+		if (*ip++ != 0)
+			return (-1);	/* no dictionaries */
+	}
+
+	fcs_size = (fhd >> 6) == 0 ? single : 1U << (fhd >> 6);
+	if (ip + fcs_size > iend)
+		return (-1);
+	for (i = 0; i < fcs_size; i++)
+		fcs |= (uint64_t)ip[i] << (8 * i);
+	if (fcs_size == 2)
+		fcs += 256;
+	ip += fcs_size;
+	if (fcs_size != 0 && fcs > dlen)
+		return (-1);
+
+	dc->dc_rep[0] = 1;
+	dc->dc_rep[1] = 4;
+	dc->dc_rep[2] = 8;
+	dc->dc_huf_valid = B_FALSE;
+	dc->dc_ll = dc->dc_of = dc->dc_ml = NULL;
+
+	do {
+		uint32_t bh, bsize;
+
+		if (ip + 3 > iend)
+			return (-1);
+		bh = zstd_read24(ip);
+		ip += 3;
+		last = bh & 1;
+		bsize = bh >> 3;
+
+		switch ((bh >> 1) & 3) {
+		case ZSTD_BLOCK_RAW:
+			if (bsize > (size_t)(iend - ip) ||
+			    bsize > (size_t)(oend - op))
+				return (-1);
+			bcopy(ip, op, bsize);
+			ip += bsize;
+			op += bsize;
+			break;
+		case ZSTD_BLOCK_RLE:
+			if (ip >= iend || bsize > (size_t)(oend - op))
+				return (-1);
+			memset(op, *ip++, bsize);
+			op += bsize;
+			break;
+		case ZSTD_BLOCK_COMPRESSED:
+			if (bsize > ZSTD_BLOCKSIZE_MAX ||
+			    bsize > (size_t)(iend - ip))
+				return (-1);
+			if (zstd_decode_block(dc, ip, bsize, dst, &op,
+			    oend) != 0)
+				return (-1);
+			ip += bsize;
+			break;
+		default:
+			return (-1);
+		}
+	} while (!last);
+
+	if ((fhd & 0x04) && ip + 4 > iend)
+		return (-1);	/* content checksum; not verified */
+	if (fcs_size != 0 && (uint64_t)(op - dst) != fcs)
+		return (-1);
+
+	return (op - dst);
+}
+
+/*
+ * ==========================================================================
+ * Compression
+ * ==========================================================================
+ */
+
+static inline uint32_t
+zstd_hash(const uint8_t *p)
+{
+	return ((zstd_read32(p) * 2654435761U) >> (32 - ZSTD_HASH_LOG));
+}
+
+static inline void
+zstd_insert(zstd_cctx_t *cc, const uint8_t *src, uint32_t pos)
+{
+	uint32_t h = zstd_hash(src + pos);
+
+	cc->cc_chain[pos & ZSTD_CHAIN_MASK] = cc->cc_hash[h];
+	cc->cc_hash[h] = pos;
+}
+
+/*
+ * Hash every position up to (not including) target.  The fast levels skip
+ * the inside of long matches.
+ */
+static inline void
+zstd_insert_upto(zstd_cctx_t *cc, const uint8_t *src, uint32_t target,
+    uint32_t slen)
+{
+	uint32_t pos = cc->cc_next;
+
+	if (target > slen - 3)
+		target = slen - 3;
+	if (cc->cc_level->zl_lazy == 0 && pos + 8 < target)
+		pos = target - 2;
+	for (; pos < target; pos++)
+		zstd_insert(cc, src, pos);
+	if (target > cc->cc_next)
+		cc->cc_next = target;
+}
+
+static inline uint32_t
+zstd_count(const uint8_t *a, const uint8_t *b, const uint8_t *bend)
+{
+	const uint8_t *start = b;
+
+	while (b + 8 <= bend) {
+		uint64_t diff = zstd_read64(a) ^ zstd_read64(b);
+
+		if (diff != 0)
+			return (b - start + (__builtin_ctzll(diff) >> 3));
+		a += 8;
+		b += 8;
+	}
+	while (b < bend && *a == *b) {
+		a++;
+		b++;
+	}
+
+	return (b - start);
+}
+
+static inline int
+zstd_match_score(uint32_t len, uint32_t offbase)
+{
+	return (len * 4 - zstd_highbit32(offbase));
+}
+
+static inline uint32_t
+zstd_offbase(const uint32_t *rep, uint32_t off, boolean_t ll0)
+{
+	if (!ll0) {
+		if (off == rep[0])
+			return (1);
+		if (off == rep[1])
+			return (2);
+		if (off == rep[2])
+			return (3);
+	} else {
+		if (off == rep[1])
+			return (1);
+		if (off == rep[2])
+			return (2);
+		if (off == rep[0] - 1)
+			return (3);
+	}
+	return (off + ZSTD_REP_NUM);
+}
+
+/*
+ * Find the best match at ip, which must not reach past bend.  Returns its
+ * length (0 if none) and sets *offp.
+ */
+static uint32_t
+zstd_find_match(zstd_cctx_t *cc, const uint8_t *src, uint32_t ip,
+    uint32_t bend, uint32_t slen, uint32_t *offp)
+{
+	const zstd_level_t *zl = cc->cc_level;
+	const uint8_t *iend = src + bend;
+	uint32_t best = 0, bestoff = 0;
+	uint32_t cand, depth, len, h;
+
+	if (ip + ZSTD_MIN_MATCH > bend)
+		return (0);
+
+	/* The most recent offset is nearly free to encode, try it first. */
+	if (cc->cc_rep[0] <= ip) {
+		len = zstd_count(src + ip - cc->cc_rep[0], src + ip, iend);
+		if (len >= ZSTD_MIN_MATCH) {
+			best = len;
+			bestoff = cc->cc_rep[0];
+		}
+	}
+
+	zstd_insert_upto(cc, src, ip, slen);
+	h = zstd_hash(src + ip);
+	cand = cc->cc_hash[h];
+
+	for (depth = zl->zl_depth; depth > 0 && best < zl->zl_target &&
+	    ip + best < bend; depth--) {
+		uint32_t next;
+
+		if (cand >= ip)
+			break;
+		if (src[cand + best] == src[ip + best]) {
+			len = zstd_count(src + cand, src + ip, iend);
+			if (len > best) {
+				best = len;
+				bestoff = ip - cand;
+			}
+		}
+		if (ip - cand >= ZSTD_CHAIN_SIZE)
+			break;
+		next = cc->cc_chain[cand & ZSTD_CHAIN_MASK];
+		if (next >= cand)
+			break;
+		cand = next;
+	}
+
+	if (cc->cc_next == ip) {
+		cc->cc_chain[ip & ZSTD_CHAIN_MASK] = cc->cc_hash[h];
+		cc->cc_hash[h] = ip;
+		cc->cc_next = ip + 1;
+	}
+
+	*offp = bestoff;
+	return (best >= ZSTD_MIN_MATCH ? best : 0);
+}
+
+/*
+ * Collect the literals and sequences of one block starting at pos, going
+ * no further than bend.  Returns where the block ended.
+ */
+static uint32_t
+zstd_parse_block(zstd_cctx_t *cc, const uint8_t *src, uint32_t pos,
+    uint32_t bend, uint32_t slen)
+{
+	const zstd_level_t *zl = cc->cc_level;
+	uint32_t ip = pos, anchor = pos;
+	uint32_t len, off;
+
+	cc->cc_nlits = 0;
+	cc->cc_nseqs = 0;
+
+	while (ip + ZSTD_MIN_MATCH <= bend) {
+		zstd_seq_t *zs;
+		uint32_t ll, d;
+
+		if ((len = zstd_find_match(cc, src, ip, bend, slen,
+		    &off)) == 0) {
+			/* Speed up through data that does not compress. */
+			ip += 1 + ((ip - anchor) >> (zl->zl_lazy == 0 ? 6 : 8));
+			continue;
+		}
+
+		for (d = 0; d < zl->zl_lazy && ip + 1 < bend; d++) {
+			uint32_t len2, off2;
+			int gain = zstd_match_score(len, off + ZSTD_REP_NUM) +
+			    (d == 0 ? 4 : 7);
+
+			len2 = zstd_find_match(cc, src, ip + 1, bend, slen,
+			    &off2);
+			if (len2 == 0 ||
+			    zstd_match_score(len2, off2 + ZSTD_REP_NUM) <= gain)
+				break;
+			ip++;
+			len = len2;
+			off = off2;
+		}
+
+		/* Extend backwards over literals. */
+		while (ip > anchor && off < ip &&
+		    src[ip - 1] == src[ip - 1 - off]) {
+			ip--;
+			len++;
+		}
+
+		if (cc->cc_nseqs == ZSTD_MAX_SEQS)
+			break;
+
+		ll = ip - anchor;
+		bcopy(src + anchor, cc->cc_lits + cc->cc_nlits, ll);
+		cc->cc_nlits += ll;
+
+		zs = &cc->cc_seqs[cc->cc_nseqs++];
+		zs->zs_litlen = ll;
+		zs->zs_mlbase = len - 3;
+		zs->zs_offbase = zstd_offbase(cc->cc_rep, off, ll == 0);
+		VERIFY3U(zstd_rep_update(cc->cc_rep, zs->zs_offbase, ll == 0),
+		    ==, off);
+
+		ip += len;
+		anchor = ip;
+	}
+
+	if (cc->cc_nseqs == ZSTD_MAX_SEQS)
+		bend = anchor;
+	bcopy(src + anchor, cc->cc_lits + cc->cc_nlits, bend - anchor);
+	cc->cc_nlits += bend - anchor;
+
+	return (bend);
+}
+
+static size_t
+zstd_write_lit_header(uint8_t *dst, size_t len, uint_t type, size_t size)
+{
+	if (size < 32) {
+		if (len < 1)
+			return (0);
+		dst[0] = type | (size << 3);
+		return (1);
+	} else if (size < 4096) {
+		if (len < 2)
+			return (0);
+		dst[0] = type | (1 << 2) | ((size & 0xf) << 4);
+		dst[1] = size >> 4;
+		return (2);
+	} else {
+		if (len < 3)
+			return (0);
+		dst[0] = type | (3 << 2) | ((size & 0xf) << 4);
+		dst[1] = size >> 4;
+		dst[2] = size >> 12;
+		return (3);
+	}
+}
+
+/*
+ * Build Huffman code lengths no longer than ZSTD_HUF_ENC_LOG.  Counts are
+ * flattened and the tree rebuilt until the longest code fits.  Returns the
+ * longest code length.
+ */
+static uint_t
+zstd_huf_build(const uint32_t *count, uint_t nsym, uint8_t *lens)
+{
+	uint32_t weight[512];
+	uint16_t parent[512];
+	uint16_t leaf[256];
+	uint8_t depth[256];
+	uint_t scale = 0;
+
+	for (;;) {
+		uint_t nleaf = 0, next_leaf = 0, next_node = 256;
+		uint_t nnodes = 256, maxlen = 0, i, j;
+
+		for (i = 0; i < nsym; i++) {
+			uint32_t w;
+
+			if (count[i] == 0)
+				continue;
+			w = (count[i] >> scale) | 1;
+			/* insertion sort by increasing weight */
+			for (j = nleaf; j > 0 && weight[leaf[j - 1]] > w; j--)
+				leaf[j] = leaf[j - 1];
+			leaf[j] = i;
+			weight[i] = w;
+			nleaf++;
+		}
+		ASSERT3U(nleaf, >=, 2);
+
+		/*
+		 * Two queue construction: the sorted leaves, and the internal
+		 * nodes (numbered from 256) which are created in order of
+		 * increasing weight.
+		 */
+		while (nnodes - 256 < nleaf - 1) {
+			uint_t pick[2];
+			int k;
+
+			for (k = 0; k < 2; k++) {
+				if (next_leaf < nleaf && (next_node == nnodes ||
+				    weight[leaf[next_leaf]] <=
+				    weight[next_node]))
+					pick[k] = leaf[next_leaf++];
+				else
+					pick[k] = next_node++;
+			}
+			weight[nnodes] = weight[pick[0]] + weight[pick[1]];
+			parent[pick[0]] = parent[pick[1]] = nnodes;
+			nnodes++;
+		}
+
+		/* Parents are always created later; the root is last. */
+		depth[nnodes - 1 - 256] = 0;
+		for (i = nnodes - 1; i-- > 256; )
+			depth[i - 256] = depth[parent[i] - 256] + 1;
+		for (i = 0; i < nsym; i++) {
+			lens[i] = 0;
+			if (count[i] == 0)
+				continue;
+			lens[i] = depth[parent[i] - 256] + 1;
+			maxlen = MAX(maxlen, lens[i]);
+		}
+
+		if (maxlen <= ZSTD_HUF_ENC_LOG)
+			return (maxlen);
+		scale++;
+	}
+}
+
+/*
+ * Encode Huffman weights with FSE.  The result is checked by decoding it,
+ * since the decoder's end of stream rule cannot express every
+ * distribution.  Returns the size or 0.
+ */
+static size_t
+zstd_huf_write_weights_fse(zstd_cctx_t *cc, uint8_t *dst, size_t len,
+    const uint8_t *weights, uint_t nw)
+{
+	zstd_fse_ctable_t *ct = &cc->cc_weight_table;
+	uint32_t count[ZSTD_HUF_ENC_LOG + 1];
+	int16_t norm[ZSTD_HUF_ENC_LOG + 1];
+	uint8_t check[256];
+	zstd_bitout_t bo;
+	uint32_t state[2];
+	uint_t i, nsym = 0, distinct = 0, log;
+	size_t hlen, blen;
+
+	bzero(count, sizeof (count));
+	for (i = 0; i < nw; i++)
+		count[weights[i]]++;
+	for (i = 0; i <= ZSTD_HUF_ENC_LOG; i++) {
+		if (count[i] != 0) {
+			nsym = i + 1;
+			distinct++;
+		}
+	}
+	if (distinct < 2 || nw < 2)
+		return (0);
+
+	log = zstd_fse_optimal_log(ZSTD_HUF_WEIGHT_LOG, nw, nsym - 1);
+	zstd_fse_normalize(norm, count, nsym, nw, log);
+	if ((hlen = zstd_fse_write_ncount(dst, len, norm, nsym, log)) == 0)
+		return (0);
+	VERIFY0(zstd_fse_build_ctable(ct, norm, nsym, log));
+
+	/* Even indices are decoded by the first state, odd by the second. */
+	zstd_bitout_init(&bo, dst + hlen, len - hlen);
+	i = nw;
+	state[(i - 1) & 1] = zstd_fse_init_state(ct, weights[i - 1]);
+	state[i & 1] = zstd_fse_init_state(ct, weights[i - 2]);
+	for (i = nw - 2; i-- > 0; ) {
+		zstd_fse_encode(&bo, ct, &state[i & 1], weights[i]);
+		zstd_bitout_flush(&bo);
+	}
+	zstd_bitout_add(&bo, state[1], log);
+	zstd_bitout_add(&bo, state[0], log);
+	zstd_bitout_flush(&bo);
+	if ((blen = zstd_bitout_close(&bo)) == 0)
+		return (0);
+
+	if (zstd_huf_read_weights_fse(&cc->cc_weight_check, dst,
+	    hlen + blen, check) != nw || bcmp(check, weights, nw) != 0)
+		return (0);
+
+	return (hlen + blen);
+}
+
+static size_t
+zstd_huf_write_stream(zstd_cctx_t *cc, uint8_t *dst, size_t len,
+    const uint8_t *lits, size_t n)
+{
+	zstd_bitout_t bo;
+	size_t i = n;
+
+	zstd_bitout_init(&bo, dst, len);
+	while (i & 3) {
+		i--;
+		zstd_bitout_add(&bo, cc->cc_huf_code[lits[i]],
+		    cc->cc_huf_len[lits[i]]);
+	}
+	zstd_bitout_flush(&bo);
+	while (i > 0) {
+		i -= 4;
+		zstd_bitout_add(&bo, cc->cc_huf_code[lits[i + 3]],
+		    cc->cc_huf_len[lits[i + 3]]);
+		zstd_bitout_add(&bo, cc->cc_huf_code[lits[i + 2]],
+		    cc->cc_huf_len[lits[i + 2]]);
+		zstd_bitout_flush(&bo);
+		zstd_bitout_add(&bo, cc->cc_huf_code[lits[i + 1]],
+		    cc->cc_huf_len[lits[i + 1]]);
+		zstd_bitout_add(&bo, cc->cc_huf_code[lits[i]],
+		    cc->cc_huf_len[lits[i]]);
+		zstd_bitout_flush(&bo);
+	}
+
+	return (zstd_bitout_close(&bo));
+}
+
+/*
+ * Huffman code the literals.  Returns the size of the section, or 0 if
+ * that would not be smaller than storing them raw.
+ */
+static size_t
+zstd_encode_literals_huf(zstd_cctx_t *cc, uint8_t *dst, size_t len,
+    const uint32_t *count, uint_t nsym)
+{
+	const uint8_t *lits = cc->cc_lits;
+	size_t n = cc->cc_nlits;
+	uint_t nstreams = (n < 256) ? 1 : 4;
+	size_t hlen = (n <= 1023) ? 3 : (n <= 16383) ? 4 : 5;
+	uint8_t weights[256];
+	uint32_t rank[ZSTD_HUF_ENC_LOG + 2];
+	uint8_t *op, *oend;
+	uint_t maxlen, s, w, bits;
+	size_t tlen, csize;
+	uint64_t h;
+
+	len = MIN(len, hlen + n - 1);
+	if (len <= hlen + 6)
+		return (0);
+	op = dst + hlen;
+	oend = dst + len;
+
+	maxlen = zstd_huf_build(count, nsym, cc->cc_huf_len);
+
+	/* Weights for all but the last symbol, which the decoder infers. */
+	for (s = 0; s < nsym; s++)
+		weights[s] = cc->cc_huf_len[s] ?
+		    maxlen + 1 - cc->cc_huf_len[s] : 0;
+	tlen = zstd_huf_write_weights_fse(cc, op + 1, oend - op - 1, weights,
+	    nsym - 1);
+	if (tlen != 0 && tlen < 128) {
+		op[0] = tlen;
+		op += 1 + tlen;
+	} else if (nsym - 1 <= 128 && op + 1 + nsym / 2 <= oend) {
+		op[0] = 127 + nsym - 1;
+		for (s = 0; s < nsym - 1; s += 2) {
+			op[1 + s / 2] = (weights[s] << 4) |
+			    ((s + 1 < nsym - 1) ? weights[s + 1] : 0);
+		}
+		op += 1 + nsym / 2;
+	} else {
+		return (0);
+	}
+
+	/* Canonical codes, in the order the decoder fills its table. */
+	bzero(rank, sizeof (rank));
+	for (s = 0; s < nsym; s++)
+		rank[weights[s]]++;
+	for (bits = 0, w = 1; w <= maxlen; w++) {
+		uint32_t cnt = rank[w];
+
+		rank[w] = bits;
+		bits += cnt << (w - 1);
+	}
+	for (s = 0; s < nsym; s++) {
+		if ((w = weights[s]) == 0)
+			continue;
+		cc->cc_huf_code[s] = rank[w] >> (w - 1);
+		rank[w] += 1U << (w - 1);
+	}
+
+	if (nstreams == 1) {
+		if ((csize = zstd_huf_write_stream(cc, op, oend - op, lits,
+		    n)) == 0)
+			return (0);
+		op += csize;
+	} else {
+		size_t seg = (n + 3) / 4;
+		uint8_t *jump = op;
+		int i;
+
+		if (op + 6 >= oend)
+			return (0);
+		op += 6;
+		for (i = 0; i < 4; i++) {
+			size_t cnt = (i < 3) ? seg : n - 3 * seg;
+
+			if ((csize = zstd_huf_write_stream(cc, op, oend - op,
+			    lits + i * seg, cnt)) == 0)
+				return (0);
+			if (i < 3)
+				zstd_write16(jump + 2 * i, csize);
+			op += csize;
+		}
+	}
+
+	csize = op - dst - hlen;
+	bits = (hlen == 3) ? 10 : (hlen == 4) ? 14 : 18;
+	h = ZSTD_LIT_HUF | ((nstreams == 1 ? 0 : hlen - 2) << 2) |
+	    ((uint64_t)n << 4) | ((uint64_t)csize << (4 + bits));
+	for (s = 0; s < hlen; s++)
+		dst[s] = h >> (8 * s);
+
+	return (op - dst);
+}
+
+static size_t
+zstd_encode_literals(zstd_cctx_t *cc, uint8_t *dst, size_t len)
+{
+	const uint8_t *lits = cc->cc_lits;
+	size_t n = cc->cc_nlits, hlen, i;
+	uint32_t count[256];
+	uint_t nsym = 0, distinct = 0;
+
+	if (n >= 64) {
+		bzero(count, sizeof (count));
+		for (i = 0; i < n; i++)
+			count[lits[i]]++;
+		for (i = 0; i < 256; i++) {
+			if (count[i] != 0) {
+				nsym = i + 1;
+				distinct++;
+			}
+		}
+
+		if (distinct == 1) {
+			hlen = zstd_write_lit_header(dst, len, ZSTD_LIT_RLE, n);
+			if (hlen == 0 || hlen >= len)
+				return (0);
+			dst[hlen] = lits[0];
+			return (hlen + 1);
+		}
+
+		if ((hlen = zstd_encode_literals_huf(cc, dst, len, count,
+		    nsym)) != 0)
+			return (hlen);
+	}
+
+	hlen = zstd_write_lit_header(dst, len, ZSTD_LIT_RAW, n);
+	if (hlen == 0 || hlen + n > len)
+		return (0);
+	bcopy(lits, dst + hlen, n);
+
+	return (hlen + n);
+}
+
+static inline uint_t
+zstd_ll_code(uint32_t ll)
+{
+	static const uint8_t code[64] = {
+		0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+		16, 16, 17, 17, 18, 18, 19, 19, 20, 20, 20, 20, 21, 21, 21, 21,
+		22, 22, 22, 22, 22, 22, 22, 22, 23, 23, 23, 23, 23, 23, 23, 23,
+		24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24
+	};
+
+	return ((ll < 64) ? code[ll] : zstd_highbit32(ll) + 19);
+}
+
+static inline uint_t
+zstd_ml_code(uint32_t mlbase)
+{
+	static const uint8_t code[128] = {
+		0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+		16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31,
+		32, 32, 33, 33, 34, 34, 35, 35, 36, 36, 36, 36, 37, 37, 37, 37,
+		38, 38, 38, 38, 38, 38, 38, 38, 39, 39, 39, 39, 39, 39, 39, 39,
+		40, 40, 40, 40, 40, 40, 40, 40, 40, 40, 40, 40, 40, 40, 40, 40,
+		41, 41, 41, 41, 41, 41, 41, 41, 41, 41, 41, 41, 41, 41, 41, 41,
+		42, 42, 42, 42, 42, 42, 42, 42, 42, 42, 42, 42, 42, 42, 42, 42,
+		42, 42, 42, 42, 42, 42, 42, 42, 42, 42, 42, 42, 42, 42, 42, 42
+	};
+
+	return ((mlbase < 128) ? code[mlbase] : zstd_highbit32(mlbase) + 36);
+}
+
+/*
+ * Choose and describe the table for one kind of sequence code: RLE when
+ * only one code is used, the predefined table for short blocks, and a
+ * table fitted to the block otherwise.  Returns the bytes of description
+ * written, or -1.
+ */
+static int
+zstd_encode_seq_table(zstd_fse_ctable_t *ct, const zstd_fse_ctable_t **cur,
+    const zstd_fse_ctable_t *predef, uint_t predef_syms, uint_t *modep,
+    const uint8_t *codes, uint32_t nseq, uint_t maxlog, uint8_t *dst,
+    size_t len)
+{
+	uint32_t count[ZSTD_FSE_MAX_SYMS];
+	int16_t norm[ZSTD_FSE_MAX_SYMS];
+	uint_t nsym = 0, distinct = 0, log, s;
+	uint32_t i;
+	size_t n;
+
+	bzero(count, sizeof (count));
+	for (i = 0; i < nseq; i++)
+		count[codes[i]]++;
+	for (s = 0; s < ZSTD_FSE_MAX_SYMS; s++) {
+		if (count[s] != 0) {
+			nsym = s + 1;
+			distinct++;
+		}
+	}
+
+	if (nseq < 32 && nsym <= predef_syms) {
+		*cur = predef;
+		*modep = ZSTD_SEQ_PREDEFINED;
+		return (0);
+	}
+
+	if (distinct == 1) {
+		if (len < 1)
+			return (-1);
+		zstd_fse_rle_ctable(ct, nsym - 1);
+		dst[0] = nsym - 1;
+		*cur = ct;
+		*modep = ZSTD_SEQ_RLE;
+		return (1);
+	}
+
+	log = zstd_fse_optimal_log(maxlog, nseq, nsym - 1);
+	zstd_fse_normalize(norm, count, nsym, nseq, log);
+	if ((n = zstd_fse_write_ncount(dst, len, norm, nsym, log)) == 0)
+		return (-1);
+	VERIFY0(zstd_fse_build_ctable(ct, norm, nsym, log));
+	*cur = ct;
+	*modep = ZSTD_SEQ_FSE;
+
+	return (n);
+}
+
+static size_t
+zstd_encode_sequences(zstd_cctx_t *cc, uint8_t *dst, size_t len)
+{
+	const zstd_fse_ctable_t *llt, *oft, *mlt;
+	uint32_t nseq = cc->cc_nseqs, i;
+	uint8_t *op = dst, *oend = dst + len;
+	uint_t llmode, ofmode, mlmode;
+	uint32_t ll_state, of_state, ml_state;
+	uint8_t *modes;
+	zstd_bitout_t bo;
+	size_t n;
+	int t;
+
+	if (len < 4)
+		return (0);
+	if (nseq < 128) {
+		*op++ = nseq;
+	} else if (nseq < 0x7F00) {
+		*op++ = (nseq >> 8) + 128;
+		*op++ = nseq;
+	} else {
+		*op++ = 255;
+		zstd_write16(op, nseq - 0x7F00);
+		op += 2;
+	}
+	if (nseq == 0)
+		return (op - dst);
+
+	for (i = 0; i < nseq; i++) {
+		const zstd_seq_t *zs = &cc->cc_seqs[i];
+
+		cc->cc_llcode[i] = zstd_ll_code(zs->zs_litlen);
+		cc->cc_mlcode[i] = zstd_ml_code(zs->zs_mlbase);
+		cc->cc_ofcode[i] = zstd_highbit32(zs->zs_offbase);
+	}
+
+	modes = op++;
+	if ((t = zstd_encode_seq_table(&cc->cc_ll_table, &llt,
+	    &zstd_ll_predef_ctable, ZSTD_LL_SYMS, &llmode, cc->cc_llcode,
+	    nseq, ZSTD_LL_MAX_LOG, op, oend - op)) < 0)
+		return (0);
+	op += t;
+	if ((t = zstd_encode_seq_table(&cc->cc_of_table, &oft,
+	    &zstd_of_predef_ctable, ZSTD_OF_PREDEF_SYMS, &ofmode,
+	    cc->cc_ofcode, nseq, ZSTD_OF_MAX_LOG, op, oend - op)) < 0)
+		return (0);
+	op += t;
+	if ((t = zstd_encode_seq_table(&cc->cc_ml_table, &mlt,
+	    &zstd_ml_predef_ctable, ZSTD_ML_SYMS, &mlmode, cc->cc_mlcode,
+	    nseq, ZSTD_ML_MAX_LOG, op, oend - op)) < 0)
+		return (0);
+	op += t;
+	*modes = (llmode << 6) | (ofmode << 4) | (mlmode << 2);
+
+	/* Sequences go in backwards, so the decoder reads them in order. */
+	zstd_bitout_init(&bo, op, oend - op);
+	i = nseq - 1;
+	ml_state = zstd_fse_init_state(mlt, cc->cc_mlcode[i]);
+	of_state = zstd_fse_init_state(oft, cc->cc_ofcode[i]);
+	ll_state = zstd_fse_init_state(llt, cc->cc_llcode[i]);
+	for (;;) {
+		const zstd_seq_t *zs = &cc->cc_seqs[i];
+		uint_t llc = cc->cc_llcode[i];
+		uint_t mlc = cc->cc_mlcode[i];
+		uint_t ofc = cc->cc_ofcode[i];
+
+		zstd_bitout_add(&bo, zs->zs_litlen - zstd_ll_base[llc],
+		    zstd_ll_bits[llc]);
+		zstd_bitout_add(&bo, zs->zs_mlbase + 3 - zstd_ml_base[mlc],
+		    zstd_ml_bits[mlc]);
+		zstd_bitout_flush(&bo);
+		zstd_bitout_add(&bo, zs->zs_offbase - (1U << ofc), ofc);
+		zstd_bitout_flush(&bo);
+
+		if (i-- == 0)
+			break;
+
+		zstd_fse_encode(&bo, oft, &of_state, cc->cc_ofcode[i]);
+		zstd_fse_encode(&bo, mlt, &ml_state, cc->cc_mlcode[i]);
+		zstd_fse_encode(&bo, llt, &ll_state, cc->cc_llcode[i]);
+		zstd_bitout_flush(&bo);
+	}
+	zstd_bitout_add(&bo, ml_state, mlt->fc_log);
+	zstd_bitout_add(&bo, of_state, oft->fc_log);
+	zstd_bitout_add(&bo, ll_state, llt->fc_log);
+	zstd_bitout_flush(&bo);
+	if ((n = zstd_bitout_close(&bo)) == 0)
+		return (0);
+
+	return (op + n - dst);
+}
+
+/*
+ * Compress src into a single frame.  Returns the frame size, or 0 if it
+ * would not fit in dlen.
+ */
+static size_t
+zstd_compress_frame(zstd_cctx_t *cc, const uint8_t *src, uint32_t slen,
+    uint8_t *dst, size_t dlen)
+{
+	uint8_t *op = dst, *oend = dst + dlen;
+	uint32_t pos = 0;
+
+	if (dlen < 4 + 1 + 4 + 3)
+		return (0);
+
+	/* Single segment frame with the content size, no checksum. */
+	zstd_write32(op, ZSTD_MAGIC);
+	op += 4;
+	if (slen < 256) {
+		*op++ = 0x20;
+		*op++ = slen;
+	} else if (slen < 65536 + 256) {
+		*op++ = 0x60;
+		zstd_write16(op, slen - 256);
+		op += 2;
+	} else {
+		*op++ = 0xA0;
+		zstd_write32(op, slen);
+		op += 4;
+	}
+
+	bzero(cc->cc_hash, sizeof (cc->cc_hash));
+	cc->cc_next = 0;
+	cc->cc_rep[0] = 1;
+	cc->cc_rep[1] = 4;
+	cc->cc_rep[2] = 8;
+
+	do {
+		uint32_t rep[ZSTD_REP_NUM];
+		uint32_t end, bsize;
+		size_t n = 0, m;
+		boolean_t last;
+
+		bcopy(cc->cc_rep, rep, sizeof (rep));
+		end = zstd_parse_block(cc, src, pos,
+		    MIN(slen, pos + ZSTD_BLOCKSIZE_MAX), slen);
+		bsize = end - pos;
+		last = (end == slen);
+
+		if (oend - op < 3)
+			return (0);
+		m = MIN(oend - op - 3, bsize - 1);
+		if (bsize > 0 &&
+		    (n = zstd_encode_literals(cc, op + 3, m)) != 0) {
+			size_t k = zstd_encode_sequences(cc, op + 3 + n, m - n);
+
+			n = (k == 0) ? 0 : n + k;
+		}
+
+		if (n != 0) {
+			zstd_write24(op, last | (ZSTD_BLOCK_COMPRESSED << 1) |
+			    (n << 3));
+			op += 3 + n;
+		} else {
+			/* The decoder will not see these sequences. */
+			bcopy(rep, cc->cc_rep, sizeof (rep));
+			if ((size_t)(oend - op) < 3 + bsize)
+				return (0);
+			zstd_write24(op, last | (ZSTD_BLOCK_RAW << 1) |
+			    (bsize << 3));
+			bcopy(src + pos, op + 3, bsize);
+			op += 3 + bsize;
+		}
+		pos = end;
+	} while (pos < slen);
+
+	return (op - dst);
+}
+
+/*
+ * ==========================================================================
+ * ZFS interface
+ * ==========================================================================
+ */
+
+size_t
+zstd_compress(void *s_start, void *d_start, size_t s_len, size_t d_len,
+    int level)
+{
+	uint8_t *dest = d_start;
+	zstd_cctx_t *cc;
+	uint32_t bufsiz;
+
+	ASSERT(level >= 1 && level <= ZSTD_MAX_LEVEL);
+
+	if (d_len <= sizeof (bufsiz) || s_len > UINT32_MAX)
+		return (s_len);
+
+	/*
+	 * As with lz4, a failed allocation just means this block is
+	 * written uncompressed.
+	 */
+	if ((cc = kmem_cache_alloc(zstd_cctx_cache, KM_NOSLEEP)) == NULL)
+		return (s_len);
+	cc->cc_level = &zstd_levels[level];
+
+	bufsiz = zstd_compress_frame(cc, s_start, s_len,
+	    &dest[sizeof (bufsiz)], d_len - sizeof (bufsiz));
+
+	kmem_cache_free(zstd_cctx_cache, cc);
+
+	if (bufsiz == 0)
+		return (s_len);
+
+	*(uint32_t *)dest = BE_32(bufsiz);
+
+	return (bufsiz + sizeof (bufsiz));
+}
+
+/*ARGSUSED*/
+int
+zstd_decompress(void *s_start, void *d_start, size_t s_len, size_t d_len,
+    int level)
+{
+	const uint8_t *src = s_start;
+	uint32_t bufsiz;
+	zstd_dctx_t *dc;
+	ssize_t ret;
+
+	if (s_len < sizeof (bufsiz))
+		return (1);
+	bufsiz = BE_IN32(src);
+	if (bufsiz + sizeof (bufsiz) > s_len)
+		return (1);
+
+	dc = kmem_cache_alloc(zstd_dctx_cache, KM_SLEEP);
+	ret = zstd_decompress_frame(dc, &src[sizeof (bufsiz)], bufsiz,
+	    d_start, d_len);
+	kmem_cache_free(zstd_dctx_cache, dc);
+
+	return (ret < 0);
+}
+
+void
+zstd_init(void)
+{
+	VERIFY0(zstd_fse_build_dtable(&zstd_ll_predef_dtable, zstd_ll_predef,
+	    ZSTD_LL_SYMS, ZSTD_LL_PREDEF_LOG));
+	VERIFY0(zstd_fse_build_dtable(&zstd_of_predef_dtable, zstd_of_predef,
+	    ZSTD_OF_PREDEF_SYMS, ZSTD_OF_PREDEF_LOG));
+	VERIFY0(zstd_fse_build_dtable(&zstd_ml_predef_dtable, zstd_ml_predef,
+	    ZSTD_ML_SYMS, ZSTD_ML_PREDEF_LOG));
+	VERIFY0(zstd_fse_build_ctable(&zstd_ll_predef_ctable, zstd_ll_predef,
+	    ZSTD_LL_SYMS, ZSTD_LL_PREDEF_LOG));
+	VERIFY0(zstd_fse_build_ctable(&zstd_of_predef_ctable, zstd_of_predef,
+	    ZSTD_OF_PREDEF_SYMS, ZSTD_OF_PREDEF_LOG));
+	VERIFY0(zstd_fse_build_ctable(&zstd_ml_predef_ctable, zstd_ml_predef,
+	    ZSTD_ML_SYMS, ZSTD_ML_PREDEF_LOG));
+
+	zstd_cctx_cache = kmem_cache_create("zstd_cctx",
+	    sizeof (zstd_cctx_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
+	zstd_dctx_cache = kmem_cache_create("zstd_dctx",
+	    sizeof (zstd_dctx_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
+}
+
+void
+zstd_fini(void)
+{
+	if (zstd_cctx_cache) {
+		kmem_cache_destroy(zstd_cctx_cache);
+		zstd_cctx_cache = NULL;
+	}
+	if (zstd_dctx_cache) {
+		kmem_cache_destroy(zstd_dctx_cache);
+		zstd_dctx_cache = NULL;
+	}
+}
@@ -455,8 +455,9 @@ zpios_dmu_write(run_args_t *run_args, objset_t *os, uint64_t object,
 		rc = dmu_tx_assign(tx, how);
 
 		if (rc) {
-			if (rc == ERESTART && how == TXG_NOWAIT) {
+			if (rc == ERESTART && how != TXG_WAIT) {
 				dmu_tx_wait(tx);
+				how = TXG_WAITED;
 				dmu_tx_abort(tx);
 				continue;
 			}